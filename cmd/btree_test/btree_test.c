@@ -0,0 +1,503 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * btree_test - verify the B-tree and the range trees built on it, and
+ * compare them with AVL trees.
+ *
+ *   o random adds and removes of integers are applied to a B-tree and to
+ *     a bitmap, and the tree is checked against the bitmap, forwards and
+ *     backwards, and with zfs_btree_verify();
+ *   o random adds, removes and clears of ranges are applied to range trees
+ *     of 32-bit and 64-bit segments and to a bitmap of sectors, and the
+ *     segments and the histogram of each tree are checked against it;
+ *   o with -b, a metaslab's worth of scattered segments is added to, found
+ *     in and removed from a range tree of each type and an AVL tree of
+ *     segments like the ones range trees used to keep, and the time taken
+ *     and the memory used are reported for each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/zfs_context.h>
+#include <sys/avl.h>
+#include <sys/btree.h>
+#include <sys/range_tree.h>
+
+#define	BTREE_TEST_RANGE	(1ULL << 16)
+#define	BTREE_TEST_OPS		(1ULL << 18)
+#define	BTREE_TEST_SHIFT	9
+
+static boolean_t verbose = B_FALSE;
+static uint64_t tests_run, tests_failed;
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr, "usage: btree_test [-bv] [-n segments] "
+	    "[-s seed]\n");
+	(void) fprintf(stderr, "\t -b -- benchmark against AVL trees\n");
+	(void) fprintf(stderr, "\t -n -- segments for the benchmark\n");
+	(void) fprintf(stderr, "\t -v -- verbose\n");
+	(void) fprintf(stderr, "\t -s -- random seed\n");
+	exit(1);
+}
+
+static void
+btree_test_fail(const char *what, uint64_t a, uint64_t b)
+{
+	tests_failed++;
+	(void) fprintf(stderr, "FAIL %s %llu %llu\n", what,
+	    (u_longlong_t)a, (u_longlong_t)b);
+}
+
+static uint64_t
+btree_test_random(uint64_t n)
+{
+	return ((((uint64_t)random() << 31) | random()) % n);
+}
+
+static int
+btree_test_u64_compare(const void *x1, const void *x2)
+{
+	uint64_t v1 = *(const uint64_t *)x1;
+	uint64_t v2 = *(const uint64_t *)x2;
+
+	if (v1 < v2)
+		return (-1);
+	if (v1 > v2)
+		return (1);
+	return (0);
+}
+
+/*
+ * Check the elements of bt, walked in both directions, against map.
+ */
+static void
+btree_test_check(zfs_btree_t *bt, uint8_t *map, uint64_t count)
+{
+	zfs_btree_index_t where;
+	uint64_t *vp, v, n;
+
+	zfs_btree_verify(bt);
+	tests_run++;
+	if (zfs_btree_numnodes(bt) != count)
+		btree_test_fail("numnodes", zfs_btree_numnodes(bt), count);
+
+	for (v = 0, n = 0, vp = zfs_btree_first(bt, &where); vp != NULL;
+	    vp = zfs_btree_next(bt, &where, &where), n++) {
+		while (v < *vp && map[v] == 0)
+			v++;
+		if (v != *vp) {
+			btree_test_fail("next", v, *vp);
+			return;
+		}
+		v++;
+	}
+	if (n != count)
+		btree_test_fail("next count", n, count);
+
+	for (n = 0, vp = zfs_btree_last(bt, &where); vp != NULL;
+	    vp = zfs_btree_prev(bt, &where, &where))
+		n++;
+	if (n != count)
+		btree_test_fail("prev count", n, count);
+}
+
+static void
+btree_test_btree(void)
+{
+	zfs_btree_t bt;
+	zfs_btree_index_t where;
+	uint8_t *map;
+	uint64_t i, v, count = 0, *vp, *np;
+
+	map = umem_zalloc(BTREE_TEST_RANGE, UMEM_NOFAIL);
+	zfs_btree_create(&bt, btree_test_u64_compare, sizeof (uint64_t));
+
+	for (i = 0; i < BTREE_TEST_OPS; i++) {
+		/*
+		 * Grow the tree over the first half of the run, then shrink
+		 * it, so that both splits and merges are exercised at every
+		 * height.
+		 */
+		boolean_t add = (btree_test_random(100) <
+		    ((i < BTREE_TEST_OPS / 2) ? 75 : 25));
+
+		v = btree_test_random(BTREE_TEST_RANGE);
+		vp = zfs_btree_find(&bt, &v, &where);
+		if ((vp != NULL) != (map[v] != 0)) {
+			btree_test_fail("find", v, map[v]);
+			break;
+		}
+
+		if (add && vp == NULL) {
+			/* The neighbours of the gap must straddle it. */
+			np = zfs_btree_next(&bt, &where, NULL);
+			if (np != NULL && *np <= v)
+				btree_test_fail("gap next", v, *np);
+			np = zfs_btree_prev(&bt, &where, NULL);
+			if (np != NULL && *np >= v)
+				btree_test_fail("gap prev", v, *np);
+
+			zfs_btree_add_idx(&bt, &v, &where);
+			map[v] = 1;
+			count++;
+		} else if (!add && vp != NULL) {
+			zfs_btree_remove_idx(&bt, &where);
+			map[v] = 0;
+			count--;
+		}
+
+		if ((i & (BTREE_TEST_OPS / 64 - 1)) == 0)
+			btree_test_check(&bt, map, count);
+	}
+	btree_test_check(&bt, map, count);
+
+	if (verbose) {
+		(void) printf("btree: %llu elements, %llu bytes\n",
+		    (u_longlong_t)count, (u_longlong_t)zfs_btree_memory(&bt));
+	}
+
+	zfs_btree_clear(&bt);
+	zfs_btree_destroy(&bt);
+	umem_free(map, BTREE_TEST_RANGE);
+}
+
+typedef struct btree_test_walk {
+	range_tree_t	*btw_rt;
+	uint8_t		*btw_map;
+	uint64_t	btw_next;	/* sector after the last segment */
+	uint64_t	btw_space;
+	uint64_t	btw_failed;
+} btree_test_walk_t;
+
+static void
+btree_test_walk_cb(void *arg, uint64_t start, uint64_t size)
+{
+	btree_test_walk_t *btw = arg;
+	uint64_t s = (start - btw->btw_rt->rt_start) >> BTREE_TEST_SHIFT;
+	uint64_t e = s + (size >> BTREE_TEST_SHIFT);
+	uint64_t i;
+
+	/* Segments must be maximal: apart from each other, and all set. */
+	if (s != 0 && s <= btw->btw_next)
+		btw->btw_failed++;
+	for (i = btw->btw_next; i < s; i++)
+		btw->btw_failed += btw->btw_map[i];
+	for (i = s; i < e; i++)
+		btw->btw_failed += !btw->btw_map[i];
+	btw->btw_next = e;
+	btw->btw_space += size;
+}
+
+static void
+btree_test_check_rt(range_tree_t *rt, uint8_t *map)
+{
+	btree_test_walk_t btw = { rt, map, 0, 0, 0 };
+	uint64_t i;
+
+	range_tree_walk(rt, btree_test_walk_cb, &btw);
+	for (i = btw.btw_next; i < BTREE_TEST_RANGE; i++)
+		btw.btw_failed += map[i];
+
+	tests_run++;
+	if (btw.btw_failed != 0)
+		btree_test_fail("segments", rt->rt_type, btw.btw_failed);
+	if (btw.btw_space != range_tree_space(rt))
+		btree_test_fail("space", btw.btw_space, range_tree_space(rt));
+	range_tree_stat_verify(rt);
+	zfs_btree_verify(&rt->rt_root);
+}
+
+static void
+btree_test_range_tree(range_seg_type_t type)
+{
+	kmutex_t lock;
+	range_tree_t *rt;
+	uint8_t *map;
+	uint64_t start = 1ULL << 40;
+	uint64_t i, j, s, len, space = 0;
+
+	map = umem_zalloc(BTREE_TEST_RANGE, UMEM_NOFAIL);
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_enter(&lock);
+	rt = range_tree_create_impl(NULL, type, NULL, start,
+	    BTREE_TEST_SHIFT, &lock);
+
+	for (i = 0; i < BTREE_TEST_OPS / 4; i++) {
+		uint64_t op = btree_test_random(100);
+		boolean_t clear = B_TRUE, set = B_TRUE, added = B_FALSE;
+
+		s = btree_test_random(BTREE_TEST_RANGE);
+		len = 1 + btree_test_random(MIN(16, BTREE_TEST_RANGE - s));
+		for (j = s; j < s + len; j++) {
+			clear &= !map[j];
+			set &= map[j];
+		}
+
+		if (op < ((i < BTREE_TEST_OPS / 8) ? 60 : 30)) {
+			if (!clear)
+				continue;
+			range_tree_add(rt, start + (s << BTREE_TEST_SHIFT),
+			    len << BTREE_TEST_SHIFT);
+			for (j = s; j < s + len; j++)
+				map[j] = 1;
+			space += len;
+			added = B_TRUE;
+		} else if (op < 90) {
+			if (!set)
+				continue;
+			range_tree_remove(rt, start + (s << BTREE_TEST_SHIFT),
+			    len << BTREE_TEST_SHIFT);
+			for (j = s; j < s + len; j++)
+				map[j] = 0;
+			space -= len;
+		} else {
+			range_tree_clear(rt, start + (s << BTREE_TEST_SHIFT),
+			    len << BTREE_TEST_SHIFT);
+			for (j = s; j < s + len; j++) {
+				space -= map[j];
+				map[j] = 0;
+			}
+		}
+
+		tests_run++;
+		if (range_tree_contains(rt, start + (s << BTREE_TEST_SHIFT),
+		    len << BTREE_TEST_SHIFT) != added)
+			btree_test_fail("contains", s, len);
+		if (range_tree_space(rt) != space << BTREE_TEST_SHIFT)
+			btree_test_fail("space", range_tree_space(rt), space);
+
+		if ((i & (BTREE_TEST_OPS / 64 - 1)) == 0)
+			btree_test_check_rt(rt, map);
+	}
+	btree_test_check_rt(rt, map);
+
+	if (verbose) {
+		(void) printf("range tree (%s): %llu segments, %llu bytes\n",
+		    type == RANGE_SEG32 ? "32-bit" : "64-bit",
+		    (u_longlong_t)range_tree_numsegs(rt),
+		    (u_longlong_t)zfs_btree_memory(&rt->rt_root));
+	}
+
+	range_tree_vacate(rt, NULL, NULL);
+	range_tree_destroy(rt);
+	mutex_exit(&lock);
+	mutex_destroy(&lock);
+	umem_free(map, BTREE_TEST_RANGE);
+}
+
+/*
+ * A segment as range trees kept them in AVL trees: one node for the tree
+ * sorted by offset, and one for the allocators' tree sorted by size.
+ */
+typedef struct btree_test_avl_seg {
+	avl_node_t	bts_node;
+	avl_node_t	bts_pp_node;
+	uint64_t	bts_start;
+	uint64_t	bts_end;
+} btree_test_avl_seg_t;
+
+static int
+btree_test_avl_compare(const void *x1, const void *x2)
+{
+	const btree_test_avl_seg_t *r1 = x1;
+	const btree_test_avl_seg_t *r2 = x2;
+
+	if (r1->bts_end <= r2->bts_start)
+		return (-1);
+	if (r1->bts_start >= r2->bts_end)
+		return (1);
+	return (0);
+}
+
+static void
+btree_test_report(const char *what, uint64_t n, hrtime_t add, hrtime_t find,
+    hrtime_t remove, uint64_t bytes)
+{
+	(void) printf("%-16s %6llu ns/add %6llu ns/find %6llu ns/remove "
+	    "%10llu bytes (%llu per segment)\n", what,
+	    (u_longlong_t)(add / n), (u_longlong_t)(find / n),
+	    (u_longlong_t)(remove / n), (u_longlong_t)bytes,
+	    (u_longlong_t)(bytes / n));
+}
+
+/*
+ * Time n one-sector segments, a sector apart so that none merge, added
+ * to, found in and removed from each kind of tree in random order.
+ */
+static void
+btree_test_bench(uint64_t n)
+{
+	uint64_t *order, i, t, found;
+	uint64_t start = 1ULL << 40;
+	hrtime_t t0, t1, t2, t3;
+	kmutex_t lock;
+
+	order = umem_alloc(n * sizeof (uint64_t), UMEM_NOFAIL);
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	for (i = n - 1; i > 0; i--) {
+		uint64_t j = btree_test_random(i + 1);
+		uint64_t tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_enter(&lock);
+
+	for (t = 0; t < RANGE_SEG_NUM_TYPES; t++) {
+		range_tree_t *rt;
+		uint64_t bytes;
+
+		if (t == RANGE_SEG32 && (2 * n) > UINT32_MAX)
+			continue;
+		rt = range_tree_create_impl(NULL, t, NULL, start,
+		    BTREE_TEST_SHIFT, &lock);
+
+		t0 = gethrtime();
+		for (i = 0; i < n; i++) {
+			range_tree_add(rt, start +
+			    (order[i] << (BTREE_TEST_SHIFT + 1)),
+			    1ULL << BTREE_TEST_SHIFT);
+		}
+		t1 = gethrtime();
+		for (found = 0, i = 0; i < n; i++) {
+			found += range_tree_contains(rt, start +
+			    (order[i] << (BTREE_TEST_SHIFT + 1)),
+			    1ULL << BTREE_TEST_SHIFT);
+		}
+		t2 = gethrtime();
+		bytes = zfs_btree_memory(&rt->rt_root);
+		for (i = 0; i < n; i++) {
+			range_tree_remove(rt, start +
+			    (order[i] << (BTREE_TEST_SHIFT + 1)),
+			    1ULL << BTREE_TEST_SHIFT);
+		}
+		t3 = gethrtime();
+
+		tests_run++;
+		if (found != n)
+			btree_test_fail("bench find", found, n);
+		btree_test_report(t == RANGE_SEG32 ? "btree (32-bit)" :
+		    "btree (64-bit)", n, t1 - t0, t2 - t1, t3 - t2, bytes);
+		range_tree_destroy(rt);
+	}
+
+	mutex_exit(&lock);
+	mutex_destroy(&lock);
+
+	{
+		avl_tree_t avl;
+		avl_index_t where;
+		btree_test_avl_seg_t *segs, search, *rs;
+
+		segs = umem_alloc(n * sizeof (btree_test_avl_seg_t),
+		    UMEM_NOFAIL);
+		avl_create(&avl, btree_test_avl_compare,
+		    sizeof (btree_test_avl_seg_t),
+		    offsetof(btree_test_avl_seg_t, bts_node));
+
+		t0 = gethrtime();
+		for (i = 0; i < n; i++) {
+			rs = &segs[i];
+			rs->bts_start = start +
+			    (order[i] << (BTREE_TEST_SHIFT + 1));
+			rs->bts_end = rs->bts_start +
+			    (1ULL << BTREE_TEST_SHIFT);
+			VERIFY3P(avl_find(&avl, rs, &where), ==, NULL);
+			avl_insert(&avl, rs, where);
+		}
+		t1 = gethrtime();
+		for (found = 0, i = 0; i < n; i++) {
+			search.bts_start = segs[i].bts_start;
+			search.bts_end = segs[i].bts_end;
+			found += (avl_find(&avl, &search, NULL) != NULL);
+		}
+		t2 = gethrtime();
+		for (i = 0; i < n; i++)
+			avl_remove(&avl, &segs[i]);
+		t3 = gethrtime();
+
+		tests_run++;
+		if (found != n)
+			btree_test_fail("bench avl find", found, n);
+		btree_test_report("avl", n, t1 - t0, t2 - t1, t3 - t2,
+		    n * sizeof (btree_test_avl_seg_t));
+
+		avl_destroy(&avl);
+		umem_free(segs, n * sizeof (btree_test_avl_seg_t));
+	}
+
+	umem_free(order, n * sizeof (uint64_t));
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t seed = gethrtime();
+	uint64_t n = 1ULL << 20;
+	boolean_t bench = B_FALSE;
+	int c;
+
+	while ((c = getopt(argc, argv, "bn:vs:")) != -1) {
+		switch (c) {
+		case 'b':
+			bench = B_TRUE;
+			break;
+		case 'n':
+			n = strtoull(optarg, NULL, 0);
+			if (n == 0)
+				usage();
+			break;
+		case 'v':
+			verbose = B_TRUE;
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	srandom(seed);
+	kernel_init(FREAD);
+
+	btree_test_btree();
+	btree_test_range_tree(RANGE_SEG32);
+	btree_test_range_tree(RANGE_SEG64);
+	if (bench)
+		btree_test_bench(n);
+
+	kernel_fini();
+
+	(void) printf("btree_test: %llu tests, %llu failed (seed %llu)\n",
+	    (u_longlong_t)tests_run, (u_longlong_t)tests_failed,
+	    (u_longlong_t)seed);
+
+	return (tests_failed != 0);
+}
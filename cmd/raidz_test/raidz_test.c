@@ -0,0 +1,279 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * raidz_test - verify the RAID-Z parity implementations.
+ *
+ * For single, double and triple parity over a range of column counts,
+ * block sizes and offsets, using both linear and scatter buffers:
+ *
+ *   o parity generated by every implementation usable on this system is
+ *     compared with the parity generated by the scalar implementation;
+ *   o every combination of up to nparity missing columns that includes
+ *     at least one data column is destroyed and reconstructed by every
+ *     implementation, and the data is compared with the original.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/zfs_context.h>
+#include <sys/abd.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
+
+static const char *raidz_impl_names[RAIDZ_IMPL_MAX] = {
+	"fastest", "original", "scalar", "sse2", "ssse3", "avx2", "avx512bw"
+};
+
+static const uint64_t raidz_test_sectors[] = { 1, 2, 3, 7, 16, 32 };
+static const uint64_t raidz_test_ashifts[] = { 9, 12 };
+static const uint64_t raidz_test_offsets[] = { 0, 1ULL << 20 };
+
+#define	RAIDZ_TEST_MAX_DCOLS	8
+#define	ARRAY_LEN(a)		(sizeof (a) / sizeof ((a)[0]))
+
+static boolean_t verbose = B_FALSE;
+static uint64_t tests_run, tests_failed;
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr, "usage: raidz_test [-v] [-s seed]\n");
+	(void) fprintf(stderr, "\t -v -- verbose\n");
+	(void) fprintf(stderr, "\t -s -- random seed\n");
+	exit(1);
+}
+
+static void
+raidz_test_fill(void *buf, size_t size)
+{
+	uint8_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		p[i] = random() & 0xff;
+}
+
+static void
+raidz_test_fail(const char *what, uint64_t impl, uint64_t nparity,
+    uint64_t dcols, uint64_t ashift, uint64_t size, uint64_t offset,
+    boolean_t linear, int *tgts, int ntgts)
+{
+	int t;
+
+	tests_failed++;
+	(void) fprintf(stderr, "FAIL %s impl=%s raidz%llu dcols=%llu "
+	    "ashift=%llu size=%llu offset=%llu %s", what,
+	    raidz_impl_names[impl], (u_longlong_t)nparity,
+	    (u_longlong_t)dcols, (u_longlong_t)ashift, (u_longlong_t)size,
+	    (u_longlong_t)offset, linear ? "linear" : "scatter");
+	if (ntgts > 0) {
+		(void) fprintf(stderr, " tgts=");
+		for (t = 0; t < ntgts; t++)
+			(void) fprintf(stderr, "%s%d", t ? "," : "", tgts[t]);
+	}
+	(void) fprintf(stderr, "\n");
+}
+
+static void
+raidz_test_one(uint64_t nparity, uint64_t dcols, uint64_t ashift,
+    uint64_t size, uint64_t offset, boolean_t linear)
+{
+	uint8_t *golden[VDEV_RAIDZ_MAXPARITY];
+	uint8_t *orig, *garbage;
+	raidz_map_t *rm;
+	abd_t *data;
+	uint64_t impl, mask, c;
+	int p, tgts[VDEV_RAIDZ_MAXPARITY], ntgts;
+
+	orig = umem_alloc(size, UMEM_NOFAIL);
+	garbage = umem_alloc(size, UMEM_NOFAIL);
+	raidz_test_fill(orig, size);
+	raidz_test_fill(garbage, size);
+
+	data = linear ? abd_alloc_linear(size, B_FALSE) :
+	    abd_alloc(size, B_FALSE);
+	abd_copy_from_buf(data, orig, size);
+
+	rm = vdev_raidz_map_alloc(data, size, offset, ashift, dcols, nparity);
+
+	/*
+	 * The scalar implementation provides the reference parity.
+	 */
+	VERIFY0(vdev_raidz_impl_set(RAIDZ_IMPL_SCALAR));
+	vdev_raidz_generate_parity(rm);
+	for (p = 0; p < nparity; p++) {
+		raidz_col_t *rc = &rm->rm_col[p];
+
+		golden[p] = umem_alloc(rc->rc_size, UMEM_NOFAIL);
+		abd_copy_to_buf(golden[p], rc->rc_abd, rc->rc_size);
+	}
+
+	for (impl = RAIDZ_IMPL_ORIGINAL; impl < RAIDZ_IMPL_MAX; impl++) {
+		if (vdev_raidz_impl_set(impl) != 0)
+			continue;
+
+		tests_run++;
+		vdev_raidz_generate_parity(rm);
+		for (p = 0; p < nparity; p++) {
+			raidz_col_t *rc = &rm->rm_col[p];
+
+			if (abd_cmp_buf(rc->rc_abd, golden[p],
+			    rc->rc_size) != 0) {
+				raidz_test_fail("generate", impl, nparity,
+				    dcols, ashift, size, offset, linear,
+				    NULL, 0);
+				break;
+			}
+		}
+
+		for (mask = 1; mask < (1ULL << rm->rm_cols); mask++) {
+			/* Only parity missing, nothing to reconstruct. */
+			if ((mask >> nparity) == 0)
+				continue;
+
+			for (ntgts = 0, c = 0; c < rm->rm_cols; c++) {
+				if ((mask & (1ULL << c)) == 0)
+					continue;
+				if (ntgts == nparity) {
+					ntgts = -1;
+					break;
+				}
+				tgts[ntgts++] = c;
+			}
+			if (ntgts < 0)
+				continue;
+
+			for (p = 0; p < ntgts; p++) {
+				raidz_col_t *rc = &rm->rm_col[tgts[p]];
+
+				abd_copy_from_buf(rc->rc_abd, garbage,
+				    rc->rc_size);
+			}
+
+			tests_run++;
+			(void) vdev_raidz_reconstruct(rm, tgts, ntgts);
+			if (abd_cmp_buf(data, orig, size) != 0) {
+				raidz_test_fail("reconstruct", impl, nparity,
+				    dcols, ashift, size, offset, linear,
+				    tgts, ntgts);
+			}
+
+			abd_copy_from_buf(data, orig, size);
+			for (p = 0; p < nparity; p++) {
+				raidz_col_t *rc = &rm->rm_col[p];
+
+				abd_copy_from_buf(rc->rc_abd, golden[p],
+				    rc->rc_size);
+			}
+		}
+	}
+
+	for (p = 0; p < nparity; p++)
+		umem_free(golden[p], rm->rm_col[p].rc_size);
+	vdev_raidz_map_free(rm);
+	abd_free(data);
+	umem_free(garbage, size);
+	umem_free(orig, size);
+}
+
+static void
+raidz_test_layout(uint64_t nparity, uint64_t dcols)
+{
+	uint64_t ashift, size;
+	int i, j, k, l;
+
+	for (i = 0; i < ARRAY_LEN(raidz_test_ashifts); i++) {
+		ashift = raidz_test_ashifts[i];
+		for (j = 0; j < ARRAY_LEN(raidz_test_sectors); j++) {
+			size = raidz_test_sectors[j] << ashift;
+			for (k = 0; k < ARRAY_LEN(raidz_test_offsets); k++) {
+				for (l = 0; l < 2; l++) {
+					raidz_test_one(nparity, dcols, ashift,
+					    size, raidz_test_offsets[k],
+					    l == 0);
+				}
+			}
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t seed = gethrtime();
+	uint64_t nparity, dcols, impl;
+	int c;
+
+	while ((c = getopt(argc, argv, "vs:")) != -1) {
+		switch (c) {
+		case 'v':
+			verbose = B_TRUE;
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	srandom(seed);
+	kernel_init(FREAD);
+
+	if (verbose) {
+		(void) printf("seed %llu, implementations:",
+		    (u_longlong_t)seed);
+		for (impl = RAIDZ_IMPL_ORIGINAL; impl < RAIDZ_IMPL_MAX;
+		    impl++) {
+			if (vdev_raidz_impl_set(impl) == 0)
+				(void) printf(" %s", raidz_impl_names[impl]);
+		}
+		(void) printf("\n");
+	}
+
+	for (nparity = 1; nparity <= VDEV_RAIDZ_MAXPARITY; nparity++) {
+		for (dcols = nparity + 1;
+		    dcols <= nparity + RAIDZ_TEST_MAX_DCOLS; dcols++) {
+			raidz_test_layout(nparity, dcols);
+
+			if (verbose) {
+				(void) printf("raidz%llu, %llu columns: "
+				    "%llu tests, %llu failed\n",
+				    (u_longlong_t)nparity, (u_longlong_t)dcols,
+				    (u_longlong_t)tests_run,
+				    (u_longlong_t)tests_failed);
+			}
+		}
+	}
+
+	(void) vdev_raidz_impl_set(RAIDZ_IMPL_FASTEST);
+	kernel_fini();
+
+	(void) printf("raidz_test: %llu tests, %llu failed (seed %llu)\n",
+	    (u_longlong_t)tests_run, (u_longlong_t)tests_failed,
+	    (u_longlong_t)seed);
+
+	return (tests_failed != 0);
+}
@@ -765,13 +765,13 @@ dump_metaslab_stats(metaslab_t *msp)
 {
 	char maxbuf[32];
 	range_tree_t *rt = msp->ms_tree;
-	avl_tree_t *t = &msp->ms_size_tree;
+	zfs_btree_t *t = &msp->ms_size_tree;
 	int free_pct = range_tree_space(rt) * 100 / msp->ms_size;
 
 	zdb_nicenum(metaslab_block_maxsize(msp), maxbuf);
 
 	(void) printf("\t %25s %10lu   %7s  %6s   %4s %4d%%\n",
-	    "segments", avl_numnodes(t), "maxsize", maxbuf,
+	    "segments", zfs_btree_numnodes(t), "maxsize", maxbuf,
 	    "freepct", free_pct);
 	(void) printf("\tIn-memory histogram:\n");
 	dump_histogram(rt->rt_histogram, RANGE_TREE_HISTOGRAM_SIZE, 0);
@@ -785,7 +785,7 @@ dump_metaslab(metaslab_t *msp)
 	space_map_t *sm = msp->ms_sm;
 	char freebuf[32];
 
-	zdb_nicenum(msp->ms_size - space_map_allocated(sm), freebuf);
+	zdb_nicenum(msp->ms_size - metaslab_allocated_space(msp), freebuf);
 
 	(void) printf(
 	    "\tmetaslab %6llu   offset %12llx   spacemap %6llu   free    %5s\n",
@@ -2645,8 +2645,18 @@ zdb_count_block(zdb_cb_t *zcb, zilog_t *zilog, const blkptr_t *bp,
 			refcnt = 0;
 		} else {
 			ddt_phys_t *ddp = ddt_phys_select(dde, bp);
-			ddt_phys_decref(ddp);
-			refcnt = ddp->ddp_refcnt;
+
+			/*
+			 * The entry of a pruned block may have been added
+			 * back for another copy of its data, as in
+			 * zio_ddt_free().
+			 */
+			if (ddp == NULL) {
+				refcnt = 0;
+			} else {
+				ddt_phys_decref(ddp);
+				refcnt = ddp->ddp_refcnt;
+			}
 			if (ddt_phys_total_refcnt(dde) == 0)
 				ddt_remove(ddt, dde);
 		}
@@ -2796,45 +2806,66 @@ static metaslab_ops_t zdb_metaslab_ops = {
 	NULL	/* alloc */
 };
 
+static void
+zdb_ddt_leak_entry(spa_t *spa, zdb_cb_t *zcb, enum zio_checksum checksum,
+    ddt_entry_t *dde)
+{
+	ddt_phys_t *ddp = dde->dde_phys;
+	blkptr_t blk;
+	int p;
+
+	ASSERT(ddt_phys_total_refcnt(dde) > 1);
+
+	for (p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
+		if (ddp->ddp_phys_birth == 0)
+			continue;
+		ddt_bp_create(checksum, &dde->dde_key, ddp, &blk);
+		if (p == DDT_PHYS_DITTO) {
+			zdb_count_block(zcb, NULL, &blk, ZDB_OT_DITTO);
+		} else {
+			zcb->zcb_dedup_asize +=
+			    BP_GET_ASIZE(&blk) * (ddp->ddp_refcnt - 1);
+			zcb->zcb_dedup_blocks++;
+		}
+	}
+	if (!dump_opt['L']) {
+		ddt_t *ddt = spa->spa_ddt[checksum];
+		ddt_enter(ddt);
+		VERIFY(ddt_lookup(ddt, &blk, B_TRUE) != NULL);
+		ddt_exit(ddt);
+	}
+}
+
 static void
 zdb_ddt_leak_init(spa_t *spa, zdb_cb_t *zcb)
 {
 	ddt_bookmark_t ddb = { 0 };
 	ddt_entry_t dde;
+	enum zio_checksum c;
 	int error;
-	int p;
 
 	while ((error = ddt_walk(spa, &ddb, &dde)) == 0) {
-		blkptr_t blk;
-		ddt_phys_t *ddp = dde.dde_phys;
-
 		if (ddb.ddb_class == DDT_CLASS_UNIQUE)
-			return;
+			break;
+		zdb_ddt_leak_entry(spa, zcb, ddb.ddb_checksum, &dde);
+	}
 
-		ASSERT(ddt_phys_total_refcnt(&dde) > 1);
+	ASSERT(error == 0 || error == ENOENT);
 
-		for (p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
-			if (ddp->ddp_phys_birth == 0)
-				continue;
-			ddt_bp_create(ddb.ddb_checksum,
-			    &dde.dde_key, ddp, &blk);
-			if (p == DDT_PHYS_DITTO) {
-				zdb_count_block(zcb, NULL, &blk, ZDB_OT_DITTO);
-			} else {
-				zcb->zcb_dedup_asize +=
-				    BP_GET_ASIZE(&blk) * (ddp->ddp_refcnt - 1);
-				zcb->zcb_dedup_blocks++;
-			}
-		}
-		if (!dump_opt['L']) {
-			ddt_t *ddt = spa->spa_ddt[ddb.ddb_checksum];
-			ddt_enter(ddt);
-			VERIFY(ddt_lookup(ddt, &blk, B_TRUE) != NULL);
-			ddt_exit(ddt);
+	/*
+	 * The dedup logs also hold entries that the ZAPs walked above do
+	 * not have in the same class yet.
+	 */
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		boolean_t first = B_TRUE;
+
+		while (ddt_log_walk(ddt, &dde, first) == 0) {
+			first = B_FALSE;
+			if (dde.dde_class != DDT_CLASS_UNIQUE)
+				zdb_ddt_leak_entry(spa, zcb, c, &dde);
 		}
 	}
-
-	ASSERT(error == ENOENT);
 }
 
 static void
@@ -2853,6 +2884,8 @@ zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 		 */
 		spa->spa_normal_class->mc_ops = &zdb_metaslab_ops;
 		spa->spa_log_class->mc_ops = &zdb_metaslab_ops;
+		spa->spa_special_class->mc_ops = &zdb_metaslab_ops;
+		spa->spa_dedup_class->mc_ops = &zdb_metaslab_ops;
 
 		for (c = 0; c < rvd->vdev_children; c++) {
 			vdev_t *vd = rvd->vdev_child[c];
@@ -2890,6 +2923,17 @@ zdb_leak_init(spa_t *spa, zdb_cb_t *zcb)
 					VERIFY0(space_map_load(msp->ms_sm,
 					    msp->ms_tree, SM_ALLOC));
 
+					/*
+					 * Apply the changes which are still
+					 * only in the log space maps.
+					 */
+					range_tree_walk(
+					    msp->ms_unflushed_allocs,
+					    range_tree_add, msp->ms_tree);
+					range_tree_walk(
+					    msp->ms_unflushed_frees,
+					    range_tree_remove, msp->ms_tree);
+
 					if (!msp->ms_loaded) {
 						msp->ms_loaded = B_TRUE;
 					}
@@ -3008,7 +3052,9 @@ dump_block_stats(spa_t *spa)
 	if (dump_opt['c'] > 1)
 		flags |= TRAVERSE_PREFETCH_DATA;
 
-	zcb.zcb_totalasize = metaslab_class_get_alloc(spa_normal_class(spa));
+	zcb.zcb_totalasize = metaslab_class_get_alloc(spa_normal_class(spa)) +
+	    metaslab_class_get_alloc(spa_special_class(spa)) +
+	    metaslab_class_get_alloc(spa_dedup_class(spa));
 	zcb.zcb_start = zcb.zcb_lastprint = gethrtime();
 	zcb.zcb_haderrors |= traverse_pool(spa, 0, flags, zdb_blkptr_cb, &zcb);
 
@@ -3047,7 +3093,10 @@ dump_block_stats(spa_t *spa)
 	norm_alloc = metaslab_class_get_alloc(spa_normal_class(spa));
 	norm_space = metaslab_class_get_space(spa_normal_class(spa));
 
-	total_alloc = norm_alloc + metaslab_class_get_alloc(spa_log_class(spa));
+	total_alloc = norm_alloc +
+	    metaslab_class_get_alloc(spa_log_class(spa)) +
+	    metaslab_class_get_alloc(spa_special_class(spa)) +
+	    metaslab_class_get_alloc(spa_dedup_class(spa));
 	total_found = tzb->zb_asize - zcb.zcb_dedup_asize;
 
 	if (total_found == total_alloc) {
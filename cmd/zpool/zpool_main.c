@@ -92,6 +92,8 @@ static int zpool_do_replace(int, char **);
 static int zpool_do_split(int, char **);
 
 static int zpool_do_scrub(int, char **);
+static int zpool_do_trim(int, char **);
+static int zpool_do_ddtprune(int, char **);
 
 static int zpool_do_import(int, char **);
 static int zpool_do_export(int, char **);
@@ -141,6 +143,8 @@ typedef enum {
 	HELP_REPLACE,
 	HELP_REMOVE,
 	HELP_SCRUB,
+	HELP_TRIM,
+	HELP_DDTPRUNE,
 	HELP_STATUS,
 	HELP_UPGRADE,
 	HELP_EVENTS,
@@ -161,6 +165,7 @@ enum iostat_type {
 	IOS_QUEUES = 2,
 	IOS_L_HISTO = 3,
 	IOS_RQ_HISTO = 4,
+	IOS_MIRROR = 5,
 	IOS_COUNT,	/* always last element */
 };
 
@@ -170,6 +175,7 @@ enum iostat_type {
 #define	IOS_QUEUES_M	(1ULL << IOS_QUEUES)
 #define	IOS_L_HISTO_M	(1ULL << IOS_L_HISTO)
 #define	IOS_RQ_HISTO_M	(1ULL << IOS_RQ_HISTO)
+#define	IOS_MIRROR_M	(1ULL << IOS_MIRROR)
 
 /* Mask of all the histo bits */
 #define	IOS_ANYHISTO_M (IOS_L_HISTO_M | IOS_RQ_HISTO_M)
@@ -216,6 +222,10 @@ static const char *vsx_type_to_nvlist[IOS_COUNT][11] = {
 	    ZPOOL_CONFIG_VDEV_IND_SCRUB_HISTO,
 	    ZPOOL_CONFIG_VDEV_AGG_SCRUB_HISTO,
 	    NULL},
+	[IOS_MIRROR] = {
+	    ZPOOL_CONFIG_VDEV_MIRROR_READS,
+	    ZPOOL_CONFIG_VDEV_MIRROR_READ_LAT,
+	    NULL},
 };
 
 
@@ -265,6 +275,8 @@ static zpool_command_t command_table[] = {
 	{ "split",	zpool_do_split,		HELP_SPLIT		},
 	{ NULL },
 	{ "scrub",	zpool_do_scrub,		HELP_SCRUB		},
+	{ "trim",	zpool_do_trim,		HELP_TRIM		},
+	{ "ddtprune",	zpool_do_ddtprune,	HELP_DDTPRUNE		},
 	{ NULL },
 	{ "import",	zpool_do_import,	HELP_IMPORT		},
 	{ "export",	zpool_do_export,	HELP_EXPORT		},
@@ -321,7 +333,7 @@ get_usage(zpool_help_t idx) {
 		    "\t    <pool | id> [newpool]\n"));
 	case HELP_IOSTAT:
 		return (gettext("\tiostat [-T d | u] [-ghHLpPvy] "
-		    "[[-lq]|[-r|-w]]\n"
+		    "[[-lmq]|[-r|-w]]\n"
 		    "\t    [[pool ...]|[pool vdev ...]|[vdev ...]] "
 		    "[interval [count]]\n"));
 	case HELP_LABELCLEAR:
@@ -342,6 +354,11 @@ get_usage(zpool_help_t idx) {
 		return (gettext("\treopen <pool>\n"));
 	case HELP_SCRUB:
 		return (gettext("\tscrub [-s | -p] <pool> ...\n"));
+	case HELP_TRIM:
+		return (gettext("\ttrim [-c | -s] [-r rate] <pool> "
+		    "[<device> ...]\n"));
+	case HELP_DDTPRUNE:
+		return (gettext("\tddtprune -d days <pool>\n"));
 	case HELP_STATUS:
 		return (gettext("\tstatus [-gLPvxD] [-T d|u] [pool] ... "
 		    "[interval [count]]\n"));
@@ -454,9 +471,13 @@ usage(boolean_t requested)
 	exit(requested ? 0 : 2);
 }
 
+/*
+ * Print the top-level vdevs of the given allocation class ("" for the normal
+ * class) and their children.
+ */
 void
 print_vdev_tree(zpool_handle_t *zhp, const char *name, nvlist_t *nv, int indent,
-    boolean_t print_logs, int name_flags)
+    const char *match, int name_flags)
 {
 	nvlist_t **child;
 	uint_t c, children;
@@ -470,20 +491,43 @@ print_vdev_tree(zpool_handle_t *zhp, const char *name, nvlist_t *nv, int indent,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
-
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if ((is_log && !print_logs) || (!is_log && print_logs))
+		if (strcmp(vdev_alloc_class(child[c]), match) != 0)
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, zhp, child[c], name_flags);
 		print_vdev_tree(zhp, vname, child[c], indent + 2,
-		    B_FALSE, name_flags);
+		    "", name_flags);
 		free(vname);
 	}
 }
 
+/*
+ * Print the vdevs of each allocation class other than the normal one, as
+ * they would be after adding nvroot to poolnvroot (which may be NULL).
+ */
+static void
+print_class_trees(zpool_handle_t *zhp, nvlist_t *poolnvroot, nvlist_t *nvroot,
+    int name_flags)
+{
+	const char *classes[] = { VDEV_ALLOC_BIAS_LOG,
+	    VDEV_ALLOC_BIAS_SPECIAL, VDEV_ALLOC_BIAS_DEDUP };
+	const char *headers[] = { "logs", "special", "dedup" };
+	int i;
+
+	for (i = 0; i < sizeof (classes) / sizeof (classes[0]); i++) {
+		if (poolnvroot != NULL &&
+		    num_class_vdevs(poolnvroot, classes[i]) > 0) {
+			print_vdev_tree(zhp, headers[i], poolnvroot, 0,
+			    classes[i], name_flags);
+			print_vdev_tree(zhp, NULL, nvroot, 0, classes[i],
+			    name_flags);
+		} else if (num_class_vdevs(nvroot, classes[i]) > 0) {
+			print_vdev_tree(zhp, headers[i], nvroot, 0,
+			    classes[i], name_flags);
+		}
+	}
+}
+
 static boolean_t
 prop_list_contains_feature(nvlist_t *proplist)
 {
@@ -704,20 +748,12 @@ zpool_do_add(int argc, char **argv)
 		    "configuration:\n"), zpool_get_name(zhp));
 
 		/* print original main pool and new tree */
-		print_vdev_tree(zhp, poolname, poolnvroot, 0, B_FALSE,
+		print_vdev_tree(zhp, poolname, poolnvroot, 0, "",
 		    name_flags);
-		print_vdev_tree(zhp, NULL, nvroot, 0, B_FALSE, name_flags);
+		print_vdev_tree(zhp, NULL, nvroot, 0, "", name_flags);
 
-		/* Do the same for the logs */
-		if (num_logs(poolnvroot) > 0) {
-			print_vdev_tree(zhp, "logs", poolnvroot, 0, B_TRUE,
-			    name_flags);
-			print_vdev_tree(zhp, NULL, nvroot, 0, B_TRUE,
-			    name_flags);
-		} else if (num_logs(nvroot) > 0) {
-			print_vdev_tree(zhp, "logs", nvroot, 0, B_TRUE,
-			    name_flags);
-		}
+		/* Do the same for the logs and other allocation classes */
+		print_class_trees(zhp, poolnvroot, nvroot, name_flags);
 
 		/* Do the same for the caches */
 		if (nvlist_lookup_nvlist_array(poolnvroot, ZPOOL_CONFIG_L2CACHE,
@@ -1211,9 +1247,8 @@ zpool_do_create(int argc, char **argv)
 		(void) printf(gettext("would create '%s' with the "
 		    "following layout:\n\n"), poolname);
 
-		print_vdev_tree(NULL, poolname, nvroot, 0, B_FALSE, 0);
-		if (num_logs(nvroot) > 0)
-			print_vdev_tree(NULL, "logs", nvroot, 0, B_TRUE, 0);
+		print_vdev_tree(NULL, poolname, nvroot, 0, "", 0);
+		print_class_trees(NULL, NULL, nvroot, 0);
 
 		ret = 0;
 	} else {
@@ -1527,6 +1562,53 @@ find_spare(zpool_handle_t *zhp, void *data)
 	return (0);
 }
 
+/*
+ * Print the state of the manual trim of a top-level vdev, and whether a
+ * leaf vdev is unable to trim.  vsc is the number of uint64_t in vs, which
+ * is shorter when the kernel predates trim.
+ */
+static void
+print_status_trim(vdev_stat_t *vs, uint_t vsc)
+{
+	uint64_t pct = 0;
+	time_t t;
+	char tbuf[64];
+
+	if (vsc * sizeof (uint64_t) <=
+	    offsetof(vdev_stat_t, vs_trim_bytes_est))
+		return;
+
+	if (vs->vs_trim_bytes_est != 0) {
+		pct = MIN(100, vs->vs_trim_bytes_done * 100 /
+		    vs->vs_trim_bytes_est);
+	}
+	t = vs->vs_trim_action_time;
+
+	switch (vs->vs_trim_state) {
+	case VDEV_TRIM_ACTIVE:
+		(void) printf(gettext("  (trimming, %llu%% done)"),
+		    (u_longlong_t)pct);
+		break;
+	case VDEV_TRIM_SUSPENDED:
+		(void) printf(gettext("  (trim suspended, %llu%% done)"),
+		    (u_longlong_t)pct);
+		break;
+	case VDEV_TRIM_CANCELED:
+		(void) printf(gettext("  (trim canceled)"));
+		break;
+	case VDEV_TRIM_COMPLETE:
+		(void) strftime(tbuf, sizeof (tbuf), "%a %b %e %T %Y",
+		    localtime(&t));
+		(void) printf(gettext("  (trimmed on %s)"), tbuf);
+		break;
+	default:
+		break;
+	}
+
+	if (vs->vs_trim_notsup)
+		(void) printf(gettext("  (trim unsupported)"));
+}
+
 /*
  * Print out configuration state as requested by status_callback.
  */
@@ -1646,6 +1728,8 @@ print_status_config(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 		}
 	}
 
+	print_status_trim(vs, c);
+
 	(void) nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_SCAN_STATS,
 	    (uint64_t **)&ps, &c);
 
@@ -1659,14 +1743,12 @@ print_status_config(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 	(void) printf("\n");
 
 	for (c = 0; c < children; c++) {
-		uint64_t islog = B_FALSE, ishole = B_FALSE;
+		uint64_t ishole = B_FALSE;
 
-		/* Don't print logs or holes here */
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &islog);
+		/* Don't print logs, other allocation classes or holes here */
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_HOLE,
 		    &ishole);
-		if (islog || ishole)
+		if (ishole || *vdev_alloc_class(child[c]) != '\0')
 			continue;
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    name_flags | VDEV_NAME_TYPE_ID);
@@ -1741,11 +1823,7 @@ print_import_config(const char *name, nvlist_t *nv, int namewidth, int depth,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
-
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (is_log)
+		if (*vdev_alloc_class(child[c]) != '\0')
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, NULL, child[c],
@@ -1779,16 +1857,17 @@ print_import_config(const char *name, nvlist_t *nv, int namewidth, int depth,
 }
 
 /*
- * Print log vdevs.
- * Logs are recorded as top level vdevs in the main pool child array
- * but with "is_log" set to 1. We use either print_status_config() or
- * print_import_config() to print the top level logs then any log
- * children (eg mirrored slogs) are printed recursively - which
- * works because only the top level vdev is marked "is_log"
+ * Print log, special or dedup vdevs.
+ * These are recorded as top level vdevs in the main pool child array,
+ * logs with "is_log" set to 1 and the others with their "alloc_bias".
+ * We use either print_status_config() or print_import_config() to print
+ * the top level vdevs of the class then any children (eg mirrored slogs)
+ * are printed recursively - which works because only the top level vdev
+ * is marked.
  */
 static void
-print_logs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth, boolean_t verbose,
-    int name_flags)
+print_class_vdevs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth,
+    boolean_t verbose, int name_flags, const char *class)
 {
 	uint_t c, children;
 	nvlist_t **child;
@@ -1797,15 +1876,16 @@ print_logs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth, boolean_t verbose,
 	    &children) != 0)
 		return;
 
-	(void) printf(gettext("\tlogs\n"));
+	if (num_class_vdevs(nv, class) == 0)
+		return;
+
+	(void) printf("\t%s\n", strcmp(class, VDEV_ALLOC_BIAS_LOG) == 0 ?
+	    gettext("logs") : class);
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
 		char *name;
 
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (!is_log)
+		if (strcmp(vdev_alloc_class(child[c]), class) != 0)
 			continue;
 		name = zpool_vdev_name(g_zfs, zhp, child[c],
 		    name_flags | VDEV_NAME_TYPE_ID);
@@ -2069,8 +2149,13 @@ show_import(nvlist_t *config)
 		namewidth = 10;
 
 	print_import_config(name, nvroot, namewidth, 0, 0);
-	if (num_logs(nvroot) > 0)
-		print_logs(NULL, nvroot, namewidth, B_FALSE, 0);
+
+	print_class_vdevs(NULL, nvroot, namewidth, B_FALSE, 0,
+	    VDEV_ALLOC_BIAS_DEDUP);
+	print_class_vdevs(NULL, nvroot, namewidth, B_FALSE, 0,
+	    VDEV_ALLOC_BIAS_SPECIAL);
+	print_class_vdevs(NULL, nvroot, namewidth, B_FALSE, 0,
+	    VDEV_ALLOC_BIAS_LOG);
 
 	if (reason == ZPOOL_STATUS_BAD_GUID_SUM) {
 		(void) printf(gettext("\n\tAdditional devices are known to "
@@ -2684,6 +2769,7 @@ static const name_and_columns_t iostat_top_labels[][IOSTAT_MAX_LABELS] =
 	    {"sync_queue", 2}, {"async_queue", 2}, {NULL}},
 	[IOS_RQ_HISTO] = {{"sync_read", 2}, {"sync_write", 2},
 	    {"async_read", 2}, {"async_write", 2}, {"scrub", 2}, {NULL}},
+	[IOS_MIRROR] = {{"mirror_read", 2}, {NULL}},
 
 };
 
@@ -2700,6 +2786,7 @@ static const name_and_columns_t iostat_bottom_labels[][IOSTAT_MAX_LABELS] =
 	    {"write"}, {"read"}, {"write"}, {"scrub"}, {NULL}},
 	[IOS_RQ_HISTO] = {{"ind"}, {"agg"}, {"ind"}, {"agg"}, {"ind"}, {"agg"},
 	    {"ind"}, {"agg"}, {"ind"}, {"agg"}, {NULL}},
+	[IOS_MIRROR] = {{"ops"}, {"wait"}, {NULL}},
 };
 
 static const char *histo_to_title[] = {
@@ -2758,6 +2845,7 @@ default_column_width(iostat_cbdata_t *cb, enum iostat_type type)
 		[IOS_DEFAULT] = 15, /* 1PB capacity */
 		[IOS_LATENCY] = 10, /* 1B ns = 10sec */
 		[IOS_QUEUES] = 6,   /* 1M queue entries */
+		[IOS_MIRROR] = 10,  /* 1B ns = 10sec */
 	};
 
 	if (cb->cb_literal)
@@ -3327,6 +3415,36 @@ print_iostat_latency(iostat_cbdata_t *cb, nvlist_t *oldnv,
 	free_calc_stats(nva, ARRAY_SIZE(names));
 }
 
+/*
+ * Print the reads a parent mirror directed to each vdev, and their average
+ * latency, so the distribution of reads across mirror children can be seen.
+ */
+static void
+print_iostat_mirror(iostat_cbdata_t *cb, nvlist_t *oldnv,
+    nvlist_t *newnv, double scale)
+{
+	uint64_t reads, wait;
+	const char *names[] = {
+		ZPOOL_CONFIG_VDEV_MIRROR_READS,
+		ZPOOL_CONFIG_VDEV_MIRROR_READ_LAT,
+	};
+	struct stat_array *nva;
+
+	unsigned int column_width = default_column_width(cb, IOS_MIRROR);
+
+	nva = calc_and_alloc_stats_ex(names, ARRAY_SIZE(names), oldnv, newnv);
+
+	reads = nva[0].data[0];
+	wait = reads == 0 ? 0 : nva[1].data[0] / reads;
+
+	print_one_stat((uint64_t)(reads * scale), cb->cb_literal ?
+	    ZFS_NICENUM_RAW : ZFS_NICENUM_1024, column_width, cb->cb_scripted);
+	print_one_stat(wait, cb->cb_literal ? ZFS_NICENUM_RAW :
+	    ZFS_NICENUM_TIME, column_width, cb->cb_scripted);
+
+	free_calc_stats(nva, ARRAY_SIZE(names));
+}
+
 /*
  * Print default statistics (capacity/operations/bandwidth)
  */
@@ -3463,6 +3581,8 @@ print_vdev_stats(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
 		print_iostat_latency(cb, oldnv, newnv, scale);
 	if (cb->cb_flags & IOS_QUEUES_M)
 		print_iostat_queues(cb, oldnv, newnv, scale);
+	if (cb->cb_flags & IOS_MIRROR_M)
+		print_iostat_mirror(cb, oldnv, newnv, scale);
 	if (cb->cb_flags & IOS_ANYHISTO_M) {
 		printf("\n");
 		print_iostat_histos(cb, oldnv, newnv, scale, name);
@@ -3995,7 +4115,7 @@ fsleep(float sec) {
 
 
 /*
- * zpool iostat [-ghHLpPvy] [[-lq]|[-r|-w]] [-n name] [-T d|u]
+ * zpool iostat [-ghHLpPvy] [[-lmq]|[-r|-w]] [-n name] [-T d|u]
  *		[[ pool ...]|[pool vdev ...]|[vdev ...]]
  *		[interval [count]]
  *
@@ -4009,6 +4129,7 @@ fsleep(float sec) {
  *		by a single tab.
  *	-l	Display average latency
  *	-q	Display queue depths
+ *	-m	Display reads directed to each mirror child
  *	-w	Display latency histograms
  *	-r	Display request size histogram
  *	-T	Display a timestamp in date(1) or Unix format
@@ -4031,6 +4152,7 @@ zpool_do_iostat(int argc, char **argv)
 	boolean_t verbose = B_FALSE;
 	boolean_t latency = B_FALSE, l_histo = B_FALSE, rq_histo = B_FALSE;
 	boolean_t queues = B_FALSE, parsable = B_FALSE, scripted = B_FALSE;
+	boolean_t mirror = B_FALSE;
 	boolean_t omit_since_boot = B_FALSE;
 	boolean_t guid = B_FALSE;
 	boolean_t follow_links = B_FALSE;
@@ -4039,12 +4161,12 @@ zpool_do_iostat(int argc, char **argv)
 
 	/* Used for printing error message */
 	const char flag_to_arg[] = {[IOS_LATENCY] = 'l', [IOS_QUEUES] = 'q',
-	    [IOS_L_HISTO] = 'w', [IOS_RQ_HISTO] = 'r'};
+	    [IOS_L_HISTO] = 'w', [IOS_RQ_HISTO] = 'r', [IOS_MIRROR] = 'm'};
 
 	uint64_t unsupported_flags;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "gLPT:vyhplqrwH")) != -1) {
+	while ((c = getopt(argc, argv, "gLPT:vyhplmqrwH")) != -1) {
 		switch (c) {
 		case 'g':
 			guid = B_TRUE;
@@ -4067,6 +4189,9 @@ zpool_do_iostat(int argc, char **argv)
 		case 'l':
 			latency = B_TRUE;
 			break;
+		case 'm':
+			mirror = B_TRUE;
+			break;
 		case 'q':
 			queues = B_TRUE;
 			break;
@@ -4178,10 +4303,10 @@ zpool_do_iostat(int argc, char **argv)
 		return (1);
 	}
 
-	if ((l_histo || rq_histo) && (queues || latency)) {
+	if ((l_histo || rq_histo) && (queues || latency || mirror)) {
 		pool_list_free(list);
 		(void) fprintf(stderr,
-		    gettext("[-r|-w] isn't allowed with [-q|-l]\n"));
+		    gettext("[-r|-w] isn't allowed with [-q|-l|-m]\n"));
 		usage(B_FALSE);
 		return (1);
 	}
@@ -4214,6 +4339,8 @@ zpool_do_iostat(int argc, char **argv)
 			cb.cb_flags |= IOS_LATENCY_M;
 		if (queues)
 			cb.cb_flags |= IOS_QUEUES_M;
+		if (mirror)
+			cb.cb_flags |= IOS_MIRROR_M;
 	}
 
 	/*
@@ -4497,6 +4624,55 @@ print_one_column(zpool_prop_t prop, uint64_t value, boolean_t scripted,
 		(void) printf("  %*s", (int)width, propval);
 }
 
+void print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
+    list_cbdata_t *cb, int depth);
+
+/*
+ * Print the top-level vdevs of a special or dedup allocation class under a
+ * line with the total capacity of the class.
+ */
+static void
+print_list_class(zpool_handle_t *zhp, nvlist_t **child, uint_t children,
+    list_cbdata_t *cb, int depth, const char *class)
+{
+	boolean_t scripted = cb->cb_scripted;
+	uint64_t space = 0, alloc = 0;
+	vdev_stat_t *vs;
+	char *vname;
+	uint_t c, n;
+
+	for (c = 0; c < children; c++) {
+		if (strcmp(vdev_alloc_class(child[c]), class) != 0)
+			continue;
+		verify(nvlist_lookup_uint64_array(child[c],
+		    ZPOOL_CONFIG_VDEV_STATS, (uint64_t **)&vs, &n) == 0);
+		space += vs->vs_space;
+		alloc += vs->vs_alloc;
+	}
+
+	if (scripted)
+		(void) printf("\t%s", class);
+	else
+		(void) printf("%-*s", (int)cb->cb_namewidth, class);
+	print_one_column(ZPOOL_PROP_SIZE, space, scripted, B_TRUE);
+	print_one_column(ZPOOL_PROP_ALLOCATED, alloc, scripted, B_TRUE);
+	print_one_column(ZPOOL_PROP_FREE, space - alloc, scripted, B_TRUE);
+	print_one_column(ZPOOL_PROP_EXPANDSZ, 0, scripted, B_FALSE);
+	print_one_column(ZPOOL_PROP_FRAGMENTATION, 0, scripted, B_FALSE);
+	print_one_column(ZPOOL_PROP_CAPACITY,
+	    space == 0 ? 0 : alloc * 100 / space, scripted, B_TRUE);
+	(void) printf("\n");
+
+	for (c = 0; c < children; c++) {
+		if (strcmp(vdev_alloc_class(child[c]), class) != 0)
+			continue;
+		vname = zpool_vdev_name(g_zfs, zhp, child[c],
+		    cb->cb_name_flags);
+		print_list_stats(zhp, vname, child[c], cb, depth + 2);
+		free(vname);
+	}
+}
+
 void
 print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
     list_cbdata_t *cb, int depth)
@@ -4564,6 +4740,8 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 			haslog = B_TRUE;
 			continue;
 		}
+		if (*vdev_alloc_class(child[c]) != '\0')
+			continue;
 
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags);
@@ -4571,6 +4749,15 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 		free(vname);
 	}
 
+	if (children > 0 && num_class_vdevs(nv, VDEV_ALLOC_BIAS_DEDUP) > 0) {
+		print_list_class(zhp, child, children, cb, depth,
+		    VDEV_ALLOC_BIAS_DEDUP);
+	}
+	if (children > 0 && num_class_vdevs(nv, VDEV_ALLOC_BIAS_SPECIAL) > 0) {
+		print_list_class(zhp, child, children, cb, depth,
+		    VDEV_ALLOC_BIAS_SPECIAL);
+	}
+
 	if (haslog == B_TRUE) {
 		/* LINTED E_SEC_PRINTF_VAR_FMT */
 		(void) printf(dashes, cb->cb_namewidth, "log");
@@ -5081,7 +5268,7 @@ zpool_do_split(int argc, char **argv)
 		if (flags.dryrun) {
 			(void) printf(gettext("would create '%s' with the "
 			    "following layout:\n\n"), newpool);
-			print_vdev_tree(NULL, newpool, config, 0, B_FALSE,
+			print_vdev_tree(NULL, newpool, config, 0, "",
 			    flags.name_flags);
 		}
 	}
@@ -5513,6 +5700,199 @@ zpool_do_scrub(int argc, char **argv)
 	return (for_each_pool(argc, argv, B_TRUE, NULL, scrub_callback, &cb));
 }
 
+/*
+ * zpool trim [-c | -s] [-r rate] <pool> [<device> ...]
+ *
+ *	-c		Cancel.  Cancels any in-progress trim.
+ *	-s		Suspend.  Suspends any in-progress trim.
+ *	-r <rate>	Trim at most <rate> bytes per second.
+ *
+ * Trims the free space of the top-level vdevs holding the given devices,
+ * or of every top-level vdev of the pool when no device is given.
+ */
+int
+zpool_do_trim(int argc, char **argv)
+{
+	pool_trim_func_t func = POOL_TRIM_START;
+	uint64_t rate = 0;
+	zpool_handle_t *zhp;
+	boolean_t avail_spare, l2cache;
+	nvlist_t *tgt;
+	uint64_t guid;
+	int c, i, ret = 0;
+
+	/* check options */
+	while ((c = getopt(argc, argv, "csr:")) != -1) {
+		switch (c) {
+		case 'c':
+			if (func != POOL_TRIM_START) {
+				(void) fprintf(stderr, gettext("-c and -s are "
+				    "mutually exclusive\n"));
+				usage(B_FALSE);
+			}
+			func = POOL_TRIM_CANCEL;
+			break;
+		case 's':
+			if (func != POOL_TRIM_START) {
+				(void) fprintf(stderr, gettext("-c and -s are "
+				    "mutually exclusive\n"));
+				usage(B_FALSE);
+			}
+			func = POOL_TRIM_SUSPEND;
+			break;
+		case 'r':
+			if (zfs_nicestrtonum(g_zfs, optarg, &rate) != 0) {
+				(void) fprintf(stderr, gettext("invalid rate "
+				    "'%s': %s\n"), optarg,
+				    libzfs_error_description(g_zfs));
+				usage(B_FALSE);
+			}
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing pool name argument\n"));
+		usage(B_FALSE);
+	}
+
+	if (func != POOL_TRIM_START && rate != 0) {
+		(void) fprintf(stderr, gettext("-r is only valid when "
+		    "starting a trim\n"));
+		usage(B_FALSE);
+	}
+
+	if ((zhp = zpool_open(g_zfs, argv[0])) == NULL)
+		return (1);
+
+	if (argc == 1) {
+		ret = zpool_trim(zhp, func, 0, rate);
+		zpool_close(zhp);
+		return (ret != 0);
+	}
+
+	for (i = 1; i < argc; i++) {
+		tgt = zpool_find_vdev(zhp, argv[i], &avail_spare, &l2cache,
+		    NULL);
+		if (tgt == NULL) {
+			(void) fprintf(stderr, gettext("cannot trim '%s': no "
+			    "such device in pool\n"), argv[i]);
+			ret = 1;
+			continue;
+		}
+		if (avail_spare || l2cache) {
+			(void) fprintf(stderr, gettext("cannot trim '%s': "
+			    "spare and cache devices are not trimmed\n"),
+			    argv[i]);
+			ret = 1;
+			continue;
+		}
+		verify(nvlist_lookup_uint64(tgt, ZPOOL_CONFIG_GUID,
+		    &guid) == 0);
+		if (zpool_trim(zhp, func, guid, rate) != 0)
+			ret = 1;
+	}
+
+	zpool_close(zhp);
+	return (ret);
+}
+
+/*
+ * zpool ddtprune -d <days> <pool>
+ *
+ *	-d <days>	Prune the entries of unique blocks older than <days>,
+ *			or of every unique block if <days> is 0.
+ *
+ * Removes old unique entries from the dedup table, then reports how many
+ * were removed and the resulting size of the table.
+ */
+int
+zpool_do_ddtprune(int argc, char **argv)
+{
+	zpool_handle_t *zhp;
+	nvlist_t *config;
+	ddt_object_t *ddo;
+	uint64_t days = UINT64_MAX;
+	uint64_t pruned, dsize;
+	char dbuf[32], mbuf[32];
+	boolean_t missing;
+	char *endptr;
+	uint_t c;
+	int opt;
+
+	/* check options */
+	while ((opt = getopt(argc, argv, "d:")) != -1) {
+		switch (opt) {
+		case 'd':
+			errno = 0;
+			days = strtoull(optarg, &endptr, 10);
+			if (errno != 0 || *endptr != '\0' ||
+			    days == UINT64_MAX) {
+				(void) fprintf(stderr,
+				    gettext("invalid days value '%s'\n"),
+				    optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (days == UINT64_MAX) {
+		(void) fprintf(stderr, gettext("missing -d option\n"));
+		usage(B_FALSE);
+	}
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing pool name argument\n"));
+		usage(B_FALSE);
+	}
+	if (argc > 1) {
+		(void) fprintf(stderr, gettext("too many arguments\n"));
+		usage(B_FALSE);
+	}
+
+	if ((zhp = zpool_open(g_zfs, argv[0])) == NULL)
+		return (1);
+
+	if (zpool_ddt_prune(zhp, days, &pruned) != 0) {
+		zpool_close(zhp);
+		return (1);
+	}
+
+	(void) printf(gettext("pruned %llu dedup table entries\n"),
+	    (u_longlong_t)pruned);
+
+	if (zpool_refresh_stats(zhp, &missing) == 0 &&
+	    (config = zpool_get_config(zhp, NULL)) != NULL &&
+	    nvlist_lookup_uint64_array(config, ZPOOL_CONFIG_DDT_OBJ_STATS,
+	    (uint64_t **)&ddo, &c) == 0) {
+		dsize = zpool_get_prop_int(zhp, ZPOOL_PROP_DEDUP_TABLE_SIZE,
+		    NULL);
+		zfs_nicenum(dsize, dbuf, sizeof (dbuf));
+		zfs_nicenum(ddo->ddo_count * ddo->ddo_mspace, mbuf,
+		    sizeof (mbuf));
+		(void) printf(gettext("dedup table is now %llu entries, "
+		    "%s on disk, %s in core\n"),
+		    (u_longlong_t)ddo->ddo_count, dbuf, mbuf);
+	}
+
+	zpool_close(zhp);
+	return (0);
+}
+
 typedef struct status_cbdata {
 	int		cb_count;
 	int		cb_name_flags;
@@ -5528,14 +5908,15 @@ typedef struct status_cbdata {
  * Print out detailed scrub status.
  */
 void
-print_scan_status(pool_scan_stat_t *ps)
+print_scan_status(pool_scan_stat_t *ps, uint_t psc)
 {
 	time_t start, end, pause;
 	uint64_t elapsed, mins_left, hours_left;
-	uint64_t pass_exam, examined, total;
-	uint_t rate;
+	uint64_t pass_scanned, scanned, pass_issued, issued, total;
+	uint64_t scan_rate, issue_rate;
 	double fraction_done;
-	char processed_buf[7], examined_buf[7], total_buf[7], rate_buf[7];
+	char processed_buf[7], scanned_buf[7], issued_buf[7], total_buf[7];
+	char srate_buf[7], irate_buf[7];
 
 	(void) printf(gettext("  scan: "));
 
@@ -5607,49 +5988,71 @@ print_scan_status(pool_scan_stat_t *ps)
 		    ctime(&start));
 	}
 
-	examined = ps->pss_examined ? ps->pss_examined : 1;
-	total = ps->pss_to_examine;
-	fraction_done = (double)examined / total;
+	/*
+	 * A sorted scan first scans (examines) the metadata and then issues
+	 * the reads, so progress is measured by what has been issued.
+	 * Kernels without sorted scans issue everything as it is scanned.
+	 */
+	scanned = ps->pss_examined;
+	pass_scanned = ps->pss_pass_exam;
+	if (psc >= sizeof (pool_scan_stat_t) / sizeof (uint64_t)) {
+		issued = ps->pss_issued;
+		pass_issued = ps->pss_pass_issued;
+	} else {
+		issued = scanned;
+		pass_issued = pass_scanned;
+	}
+	total = ps->pss_to_examine ? ps->pss_to_examine : 1;
+	fraction_done = (double)issued / total;
 
 	/* elapsed time for this pass */
 	elapsed = time(NULL) - ps->pss_pass_start;
 	elapsed -= ps->pss_pass_scrub_spent_paused;
 	elapsed = elapsed ? elapsed : 1;
-	pass_exam = ps->pss_pass_exam ? ps->pss_pass_exam : 1;
-	rate = pass_exam / elapsed;
-	rate = rate ? rate : 1;
-	mins_left = ((total - examined) / rate) / 60;
+	scan_rate = pass_scanned / elapsed;
+	issue_rate = pass_issued / elapsed;
+	mins_left = 0;
+	if (total > issued)
+		mins_left = ((total - issued) / MAX(issue_rate, 1)) / 60;
 	hours_left = mins_left / 60;
 
-	zfs_nicenum(examined, examined_buf, sizeof (examined_buf));
+	zfs_nicenum(scanned, scanned_buf, sizeof (scanned_buf));
+	zfs_nicenum(issued, issued_buf, sizeof (issued_buf));
 	zfs_nicenum(total, total_buf, sizeof (total_buf));
+	zfs_nicenum(scan_rate, srate_buf, sizeof (srate_buf));
+	zfs_nicenum(issue_rate, irate_buf, sizeof (irate_buf));
+
+	if (pause == 0) {
+		(void) printf(gettext("\t%s scanned at %s/s, "
+		    "%s issued at %s/s, %s total\n"),
+		    scanned_buf, srate_buf, issued_buf, irate_buf, total_buf);
+	} else {
+		(void) printf(gettext("\t%s scanned, %s issued, %s total\n"),
+		    scanned_buf, issued_buf, total_buf);
+	}
+
+	if (ps->pss_func == POOL_SCAN_RESILVER) {
+		(void) printf(gettext("    %s resilvered, %.2f%% done"),
+		    processed_buf, 100 * fraction_done);
+	} else if (ps->pss_func == POOL_SCAN_SCRUB) {
+		(void) printf(gettext("    %s repaired, %.2f%% done"),
+		    processed_buf, 100 * fraction_done);
+	}
 
 	/*
-	 * do not print estimated time if hours_left is more than 30 days
-	 * or we have a paused scrub
+	 * do not print estimated time if hours_left is more than 30 days,
+	 * nothing has been issued yet, or we have a paused scrub
 	 */
 	if (pause == 0) {
-		zfs_nicenum(rate, rate_buf, sizeof (rate_buf));
-		(void) printf(gettext("\t%s scanned out of %s at %s/s"),
-		    examined_buf, total_buf, rate_buf);
-		if (hours_left < (30 * 24)) {
+		if (issue_rate != 0 && hours_left < (30 * 24)) {
 			(void) printf(gettext(", %lluh%um to go\n"),
 			    (u_longlong_t)hours_left, (uint_t)(mins_left % 60));
 		} else {
 			(void) printf(gettext(
-			    ", (scan is slow, no estimated time)\n"));
+			    ", no estimated completion time\n"));
 		}
 	} else {
-		(void) printf(gettext("\t%s scanned out of %s\n"),
-		    examined_buf, total_buf);
-	}
-
-	if (ps->pss_func == POOL_SCAN_RESILVER) {
-		(void) printf(gettext("    %s resilvered, %.2f%% done\n"),
-		    processed_buf, 100 * fraction_done);
-	} else if (ps->pss_func == POOL_SCAN_SCRUB) {
-		(void) printf(gettext("    %s repaired, %.2f%% done\n"),
-		    processed_buf, 100 * fraction_done);
+		(void) printf("\n");
 	}
 }
 
@@ -5734,6 +6137,8 @@ print_dedup_stats(nvlist_t *config)
 	ddt_histogram_t *ddh;
 	ddt_stat_t *dds;
 	ddt_object_t *ddo;
+	ddt_log_stat_t *ddls = NULL;
+	uint64_t pruned;
 	uint_t c;
 
 	/*
@@ -5745,9 +6150,14 @@ print_dedup_stats(nvlist_t *config)
 	    (uint64_t **)&ddo, &c) != 0)
 		return;
 
+	/* Only pools with the dedup_log feature active report these. */
+	(void) nvlist_lookup_uint64_array(config, ZPOOL_CONFIG_DDT_LOG_STATS,
+	    (uint64_t **)&ddls, &c);
+
 	(void) printf("\n");
 	(void) printf(gettext(" dedup: "));
-	if (ddo->ddo_count == 0) {
+	if (ddo->ddo_count == 0 &&
+	    (ddls == NULL || ddls->ddls_entries == 0)) {
 		(void) printf(gettext("no DDT entries\n"));
 		return;
 	}
@@ -5757,6 +6167,30 @@ print_dedup_stats(nvlist_t *config)
 	    (u_longlong_t)ddo->ddo_dspace,
 	    (u_longlong_t)ddo->ddo_mspace);
 
+	if (ddls != NULL) {
+		(void) printf("        DDT log entries %llu, size %llu on "
+		    "disk, %llu in core\n",
+		    (u_longlong_t)ddls->ddls_entries,
+		    (u_longlong_t)ddls->ddls_dspace,
+		    (u_longlong_t)ddls->ddls_mspace);
+		(void) printf("        DDT log flushed %llu entries in %llu "
+		    "txgs, %llu per txg\n",
+		    (u_longlong_t)ddls->ddls_flushed,
+		    (u_longlong_t)ddls->ddls_flush_txgs,
+		    (u_longlong_t)(ddls->ddls_flush_txgs == 0 ? 0 :
+		    ddls->ddls_flushed / ddls->ddls_flush_txgs));
+		(void) printf("        DDT lookups %llu, %llu us average\n",
+		    (u_longlong_t)ddls->ddls_lookups,
+		    (u_longlong_t)(ddls->ddls_lookups == 0 ? 0 :
+		    ddls->ddls_lookup_time / ddls->ddls_lookups / 1000));
+	}
+
+	if (nvlist_lookup_uint64(config, ZPOOL_CONFIG_DDT_PRUNED,
+	    &pruned) == 0) {
+		(void) printf("        DDT pruned %llu entries since import\n",
+		    (u_longlong_t)pruned);
+	}
+
 	verify(nvlist_lookup_uint64_array(config, ZPOOL_CONFIG_DDT_STATS,
 	    (uint64_t **)&dds, &c) == 0);
 	verify(nvlist_lookup_uint64_array(config, ZPOOL_CONFIG_DDT_HISTOGRAM,
@@ -6063,7 +6497,7 @@ status_callback(zpool_handle_t *zhp, void *data)
 
 		(void) nvlist_lookup_uint64_array(nvroot,
 		    ZPOOL_CONFIG_SCAN_STATS, (uint64_t **)&ps, &c);
-		print_scan_status(ps);
+		print_scan_status(ps, c);
 
 		namewidth = max_width(zhp, nvroot, 0, 0, cbp->cb_name_flags);
 		if (namewidth < 10)
@@ -6075,9 +6509,12 @@ status_callback(zpool_handle_t *zhp, void *data)
 		print_status_config(zhp, zpool_get_name(zhp), nvroot,
 		    namewidth, 0, B_FALSE, cbp->cb_name_flags);
 
-		if (num_logs(nvroot) > 0)
-			print_logs(zhp, nvroot, namewidth, B_TRUE,
-			    cbp->cb_name_flags);
+		print_class_vdevs(zhp, nvroot, namewidth, B_TRUE,
+		    cbp->cb_name_flags, VDEV_ALLOC_BIAS_DEDUP);
+		print_class_vdevs(zhp, nvroot, namewidth, B_TRUE,
+		    cbp->cb_name_flags, VDEV_ALLOC_BIAS_SPECIAL);
+		print_class_vdevs(zhp, nvroot, namewidth, B_TRUE,
+		    cbp->cb_name_flags, VDEV_ALLOC_BIAS_LOG);
 		if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
 		    &l2cache, &nl2cache) == 0)
 			print_l2cache(zhp, l2cache, nl2cache, namewidth,
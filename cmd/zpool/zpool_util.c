@@ -28,6 +28,7 @@
 #include <libintl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <ctype.h>
 
@@ -86,6 +87,45 @@ num_logs(nvlist_t *nv)
 	return (nlogs);
 }
 
+/*
+ * Return the allocation class of a top-level vdev: VDEV_ALLOC_BIAS_LOG,
+ * VDEV_ALLOC_BIAS_SPECIAL, VDEV_ALLOC_BIAS_DEDUP, or "" for the normal class.
+ */
+const char *
+vdev_alloc_class(nvlist_t *nv)
+{
+	uint64_t is_log = B_FALSE;
+	char *bias;
+
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_LOG, &is_log);
+	if (is_log)
+		return (VDEV_ALLOC_BIAS_LOG);
+	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS, &bias) == 0)
+		return (bias);
+	return ("");
+}
+
+/*
+ * Count the top-level vdevs of the given allocation class.
+ */
+uint_t
+num_class_vdevs(nvlist_t *nv, const char *class)
+{
+	uint_t nclass = 0;
+	uint_t c, children;
+	nvlist_t **child;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return (0);
+
+	for (c = 0; c < children; c++) {
+		if (strcmp(vdev_alloc_class(child[c]), class) == 0)
+			nclass++;
+	}
+	return (nclass);
+}
+
 /* Find the max element in an array of uint64_t values */
 uint64_t
 array64_max(uint64_t array[], unsigned int len) {
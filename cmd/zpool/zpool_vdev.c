@@ -1483,6 +1483,18 @@ is_grouping(const char *type, int *mindev, int *maxdev)
 		return (VDEV_TYPE_L2CACHE);
 	}
 
+	if (strcmp(type, VDEV_ALLOC_BIAS_SPECIAL) == 0) {
+		if (mindev != NULL)
+			*mindev = 1;
+		return (VDEV_ALLOC_BIAS_SPECIAL);
+	}
+
+	if (strcmp(type, VDEV_ALLOC_BIAS_DEDUP) == 0) {
+		if (mindev != NULL)
+			*mindev = 1;
+		return (VDEV_ALLOC_BIAS_DEDUP);
+	}
+
 	return (NULL);
 }
 
@@ -1497,9 +1509,10 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 {
 	nvlist_t *nvroot, *nv, **top, **spares, **l2cache;
 	int t, toplevels, mindev, maxdev, nspares, nlogs, nl2cache;
-	const char *type;
+	int nspecial, ndedup;
+	const char *type, *alloc_class;
 	uint64_t is_log;
-	boolean_t seen_logs;
+	boolean_t seen_logs, seen_special, seen_dedup;
 
 	top = NULL;
 	toplevels = 0;
@@ -1508,8 +1521,13 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 	nspares = 0;
 	nlogs = 0;
 	nl2cache = 0;
+	nspecial = 0;
+	ndedup = 0;
+	alloc_class = NULL;
 	is_log = B_FALSE;
 	seen_logs = B_FALSE;
+	seen_special = B_FALSE;
+	seen_dedup = B_FALSE;
 
 	while (argc > 0) {
 		nv = NULL;
@@ -1531,6 +1549,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					return (NULL);
 				}
 				is_log = B_FALSE;
+				alloc_class = NULL;
 			}
 
 			if (strcmp(type, VDEV_TYPE_LOG) == 0) {
@@ -1543,6 +1562,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				}
 				seen_logs = B_TRUE;
 				is_log = B_TRUE;
+				alloc_class = NULL;
 				argc--;
 				argv++;
 				/*
@@ -1552,6 +1572,31 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				continue;
 			}
 
+			if (strcmp(type, VDEV_ALLOC_BIAS_SPECIAL) == 0 ||
+			    strcmp(type, VDEV_ALLOC_BIAS_DEDUP) == 0) {
+				boolean_t *seen =
+				    strcmp(type, VDEV_ALLOC_BIAS_SPECIAL) == 0 ?
+				    &seen_special : &seen_dedup;
+
+				if (*seen) {
+					(void) fprintf(stderr,
+					    gettext("invalid vdev "
+					    "specification: '%s' can be "
+					    "specified only once\n"), type);
+					return (NULL);
+				}
+				*seen = B_TRUE;
+				is_log = B_FALSE;
+				alloc_class = type;
+				argc--;
+				argv++;
+				/*
+				 * Like a log, an allocation class is not a
+				 * real grouping device.
+				 */
+				continue;
+			}
+
 			if (strcmp(type, VDEV_TYPE_L2CACHE) == 0) {
 				if (l2cache != NULL) {
 					(void) fprintf(stderr,
@@ -1561,6 +1606,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					return (NULL);
 				}
 				is_log = B_FALSE;
+				alloc_class = NULL;
 			}
 
 			if (is_log) {
@@ -1574,6 +1620,12 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				nlogs++;
 			}
 
+			if (alloc_class != NULL &&
+			    strcmp(alloc_class, VDEV_ALLOC_BIAS_SPECIAL) == 0)
+				nspecial++;
+			else if (alloc_class != NULL)
+				ndedup++;
+
 			for (c = 1; c < argc; c++) {
 				if (is_grouping(argv[c], NULL, NULL) != NULL)
 					break;
@@ -1620,6 +1672,11 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				    type) == 0);
 				verify(nvlist_add_uint64(nv,
 				    ZPOOL_CONFIG_IS_LOG, is_log) == 0);
+				if (alloc_class != NULL) {
+					verify(nvlist_add_string(nv,
+					    ZPOOL_CONFIG_ALLOCATION_BIAS,
+					    alloc_class) == 0);
+				}
 				if (strcmp(type, VDEV_TYPE_RAIDZ) == 0) {
 					verify(nvlist_add_uint64(nv,
 					    ZPOOL_CONFIG_NPARITY,
@@ -1643,6 +1700,16 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				return (NULL);
 			if (is_log)
 				nlogs++;
+			if (alloc_class != NULL) {
+				verify(nvlist_add_string(nv,
+				    ZPOOL_CONFIG_ALLOCATION_BIAS,
+				    alloc_class) == 0);
+				if (strcmp(alloc_class,
+				    VDEV_ALLOC_BIAS_SPECIAL) == 0)
+					nspecial++;
+				else
+					ndedup++;
+			}
 			argc--;
 			argv++;
 		}
@@ -1667,6 +1734,14 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 		return (NULL);
 	}
 
+	if ((seen_special && nspecial == 0) || (seen_dedup && ndedup == 0)) {
+		(void) fprintf(stderr, gettext("invalid vdev specification: "
+		    "%s requires at least 1 device\n"), seen_special &&
+		    nspecial == 0 ? VDEV_ALLOC_BIAS_SPECIAL :
+		    VDEV_ALLOC_BIAS_DEDUP);
+		return (NULL);
+	}
+
 	/*
 	 * Finally, create nvroot and add all top-level vdevs to it.
 	 */
@@ -103,6 +103,7 @@
 #include <sys/zil_impl.h>
 #include <sys/vdev_impl.h>
 #include <sys/vdev_file.h>
+#include <sys/vdev_trim.h>
 #include <sys/spa_impl.h>
 #include <sys/metaslab_impl.h>
 #include <sys/dsl_prop.h>
@@ -114,6 +115,7 @@
 #include <sys/zfeature.h>
 #include <sys/dsl_userhold.h>
 #include <sys/abd.h>
+#include <zfs_fletcher.h>
 #include <stdio.h>
 //#include <stdio_ext.h>
 #include <stdlib.h>
@@ -194,6 +196,7 @@ extern uint64_t metaslab_df_alloc_threshold;
 extern int metaslab_preload_limit;
 extern boolean_t zfs_compressed_arc_enabled;
 extern boolean_t zfs_abd_scatter_enabled;
+extern int zfs_vdev_mirror_latency_select;
 
 static ztest_shared_opts_t *ztest_shared_opts;
 static ztest_shared_opts_t ztest_opts;
@@ -316,6 +319,8 @@ static ztest_shared_callstate_t *ztest_shared_callstate;
 ztest_func_t ztest_dmu_read_write;
 ztest_func_t ztest_dmu_write_parallel;
 ztest_func_t ztest_dmu_object_alloc_free;
+ztest_func_t ztest_dmu_object_alloc_rate;
+ztest_func_t ztest_dmu_object_next_chunk;
 ztest_func_t ztest_dmu_commit_callbacks;
 ztest_func_t ztest_zap;
 ztest_func_t ztest_zap_parallel;
@@ -334,14 +339,17 @@ ztest_func_t ztest_ddt_repair;
 ztest_func_t ztest_dmu_snapshot_hold;
 ztest_func_t ztest_spa_rename;
 ztest_func_t ztest_scrub;
+ztest_func_t ztest_trim;
 ztest_func_t ztest_dsl_dataset_promote_busy;
 ztest_func_t ztest_vdev_attach_detach;
 ztest_func_t ztest_vdev_LUN_growth;
 ztest_func_t ztest_vdev_add_remove;
+ztest_func_t ztest_vdev_class_add;
 ztest_func_t ztest_vdev_aux_add_remove;
 ztest_func_t ztest_split_pool;
 ztest_func_t ztest_reguid;
 ztest_func_t ztest_spa_upgrade;
+ztest_func_t ztest_fletcher;
 
 uint64_t zopt_always = 0ULL * NANOSEC;		/* all the time */
 uint64_t zopt_incessant = 1ULL * NANOSEC / 10;	/* every 1/10 second */
@@ -359,6 +367,8 @@ ztest_info_t ztest_info[] = {
 	ZTI_INIT(ztest_dmu_read_write, 1, &zopt_always),
 	ZTI_INIT(ztest_dmu_write_parallel, 10, &zopt_always),
 	ZTI_INIT(ztest_dmu_object_alloc_free, 1, &zopt_always),
+	ZTI_INIT(ztest_dmu_object_alloc_rate, 1, &zopt_always),
+	ZTI_INIT(ztest_dmu_object_next_chunk, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_dmu_commit_callbacks, 1, &zopt_always),
 	ZTI_INIT(ztest_zap, 30, &zopt_always),
 	ZTI_INIT(ztest_zap_parallel, 100, &zopt_always),
@@ -381,11 +391,14 @@ ztest_info_t ztest_info[] = {
 	ZTI_INIT(ztest_reguid, 1, &zopt_rarely),
 	ZTI_INIT(ztest_spa_rename, 1, &zopt_rarely),
 	ZTI_INIT(ztest_scrub, 1, &zopt_rarely),
+	ZTI_INIT(ztest_trim, 1, &zopt_rarely),
 	ZTI_INIT(ztest_spa_upgrade, 1, &zopt_rarely),
+	ZTI_INIT(ztest_fletcher, 1, &zopt_rarely),
 	ZTI_INIT(ztest_dsl_dataset_promote_busy, 1, &zopt_rarely),
 	ZTI_INIT(ztest_vdev_attach_detach, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_vdev_LUN_growth, 1, &zopt_rarely),
 	ZTI_INIT(ztest_vdev_add_remove, 1, &ztest_opts.zo_vdevtime),
+	ZTI_INIT(ztest_vdev_class_add, 1, &ztest_opts.zo_vdevtime),
 	ZTI_INIT(ztest_vdev_aux_add_remove, 1, &ztest_opts.zo_vdevtime),
 };
 
@@ -420,6 +433,8 @@ typedef struct ztest_shared {
 	uint64_t	zs_metaslab_sz;
 	uint64_t	zs_metaslab_df_alloc_threshold;
 	uint64_t	zs_guid;
+	uint64_t	zs_creates;
+	hrtime_t	zs_create_time;
 } ztest_shared_t;
 
 #define	ID_PARALLEL	-1ULL
@@ -1956,14 +1971,14 @@ ztest_get_done(zgd_t *zgd, int error)
 	ztest_object_unlock(zd, object);
 
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	umem_free(zgd, sizeof (*zgd));
 }
 
 static int
-ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
-			   struct znode *zp, struct rl *rl)
+ztest_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio, struct znode *zp, struct rl *rl)
 {
 	ztest_ds_t *zd = arg;
 	objset_t *os = zd->zd_os;
@@ -1997,7 +2012,7 @@ ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
 	db = NULL;
 
 	zgd = umem_zalloc(sizeof (*zgd), UMEM_NOFAIL);
-	zgd->zgd_zilog = zd->zd_zilog;
+	zgd->zgd_lwb = lwb;
 	zgd->zgd_private = zd;
 
 	if (buf != NULL) {	/* immediate write */
@@ -2693,6 +2708,67 @@ ztest_vdev_add_remove(ztest_ds_t *zd, uint64_t id)
 	mutex_exit(&ztest_vdev_lock);
 }
 
+/*
+ * Verify that adding a special or dedup class vdev works as expected.
+ * These cannot be removed, so only a couple of each are ever added.
+ */
+/* ARGSUSED */
+void
+ztest_vdev_class_add(ztest_ds_t *zd, uint64_t id)
+{
+	ztest_shared_t *zs = ztest_shared;
+	spa_t *spa = ztest_spa;
+	uint64_t leaves;
+	nvlist_t *nvroot, **child;
+	uint_t children;
+	metaslab_class_t *mc;
+	char *class;
+	int error;
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_ALLOCATION_CLASSES))
+		return;
+
+	if (ztest_random(2) == 0) {
+		class = VDEV_ALLOC_BIAS_SPECIAL;
+		mc = spa_special_class(spa);
+	} else {
+		class = VDEV_ALLOC_BIAS_DEDUP;
+		mc = spa_dedup_class(spa);
+	}
+
+	mutex_enter(&ztest_vdev_lock);
+	leaves = MAX(zs->zs_mirrors + zs->zs_splits, 1) * ztest_opts.zo_raidz;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	if (mc->mc_groups >= 2) {
+		spa_config_exit(spa, SCL_VDEV, FTAG);
+		mutex_exit(&ztest_vdev_lock);
+		return;
+	}
+	ztest_shared->zs_vdev_next_leaf = find_vdev_hole(spa) * leaves;
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	nvroot = make_vdev_root(NULL, NULL, NULL, ztest_opts.zo_vdev_size, 0,
+	    0, ztest_opts.zo_raidz, zs->zs_mirrors, 1);
+	VERIFY0(nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children));
+	VERIFY0(nvlist_add_string(child[0], ZPOOL_CONFIG_ALLOCATION_BIAS,
+	    class));
+
+	error = spa_vdev_add(spa, nvroot);
+	nvlist_free(nvroot);
+
+	if (error == ENOSPC)
+		ztest_record_enospc("spa_vdev_add");
+	else if (error != 0)
+		fatal(0, "spa_vdev_add(%s) = %d", class, error);
+
+	if (ztest_opts.zo_verbose >= 4)
+		(void) printf("added %s vdev\n", class);
+
+	mutex_exit(&ztest_vdev_lock);
+}
+
 /*
  * Verify that adding/removing aux devices (l2arc, hot spare) works as expected.
  */
@@ -3775,6 +3851,140 @@ ztest_dmu_object_alloc_free(ztest_ds_t *zd, uint64_t id)
 	umem_free(od, size);
 }
 
+#define	ZTEST_CREATE_BATCH	64
+#define	ZTEST_CREATE_THREADS	8
+
+typedef struct ztest_create_arg {
+	objset_t	*zca_os;
+	kmutex_t	zca_lock;
+	kcondvar_t	zca_cv;
+	boolean_t	zca_go;
+	int		zca_done;
+	uint64_t	zca_creates;
+	hrtime_t	zca_end;
+} ztest_create_arg_t;
+
+/*
+ * One of the creators of ztest_dmu_object_alloc_rate(): wait for the
+ * others, create a batch of objects without directory entries, and free
+ * them again.
+ */
+static void *
+ztest_create_thread(void *arg)
+{
+	ztest_create_arg_t *zca = arg;
+	objset_t *os = zca->zca_os;
+	uint64_t *objects;
+	uint64_t created = 0;
+	dmu_tx_t *tx;
+	int i;
+
+	objects = umem_alloc(ZTEST_CREATE_BATCH * sizeof (uint64_t),
+	    UMEM_NOFAIL);
+
+	mutex_enter(&zca->zca_lock);
+	while (!zca->zca_go)
+		cv_wait(&zca->zca_cv, &zca->zca_lock);
+	mutex_exit(&zca->zca_lock);
+
+	tx = dmu_tx_create(os);
+	for (i = 0; i < ZTEST_CREATE_BATCH; i++)
+		dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+	if (ztest_tx_assign(tx, TXG_WAIT, FTAG) != 0) {
+		for (i = 0; i < ZTEST_CREATE_BATCH; i++) {
+			objects[i] = dmu_object_alloc(os, DMU_OT_UINT64_OTHER,
+			    0, DMU_OT_NONE, 0, tx);
+		}
+		created = ZTEST_CREATE_BATCH;
+		dmu_tx_commit(tx);
+	}
+
+	mutex_enter(&zca->zca_lock);
+	zca->zca_creates += created;
+	if (++zca->zca_done == ZTEST_CREATE_THREADS)
+		zca->zca_end = gethrtime();
+	mutex_exit(&zca->zca_lock);
+
+	if (created != 0) {
+		tx = dmu_tx_create(os);
+		for (i = 0; i < ZTEST_CREATE_BATCH; i++)
+			dmu_tx_hold_free(tx, objects[i], 0, DMU_OBJECT_END);
+		if (ztest_tx_assign(tx, TXG_WAIT, FTAG) != 0) {
+			for (i = 0; i < ZTEST_CREATE_BATCH; i++)
+				VERIFY0(dmu_object_free(os, objects[i], tx));
+			dmu_tx_commit(tx);
+		}
+	}
+
+	umem_free(objects, ZTEST_CREATE_BATCH * sizeof (uint64_t));
+
+	thread_exit();
+
+	return (NULL);
+}
+
+/*
+ * Start ZTEST_CREATE_THREADS creators in one dataset at the same time,
+ * and time how long it takes all of them to create their batch, to see
+ * how object allocation scales with concurrent creators.
+ */
+/* ARGSUSED */
+void
+ztest_dmu_object_alloc_rate(ztest_ds_t *zd, uint64_t id)
+{
+	ztest_shared_t *zs = ztest_shared;
+	ztest_create_arg_t zca;
+	kt_did_t tid[ZTEST_CREATE_THREADS];
+	hrtime_t start;
+	int t;
+
+	bzero(&zca, sizeof (zca));
+	zca.zca_os = zd->zd_os;
+	mutex_init(&zca.zca_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zca.zca_cv, NULL, CV_DEFAULT, NULL);
+
+	for (t = 0; t < ZTEST_CREATE_THREADS; t++) {
+		kthread_t *thread;
+
+		VERIFY3P(thread = zk_thread_create(NULL, 0,
+		    (thread_func_t)ztest_create_thread, &zca, TS_RUN, NULL,
+		    0, 0, PTHREAD_CREATE_JOINABLE), !=, NULL);
+		tid[t] = thread->t_tid;
+	}
+
+	mutex_enter(&zca.zca_lock);
+	zca.zca_go = B_TRUE;
+	start = gethrtime();
+	cv_broadcast(&zca.zca_cv);
+	mutex_exit(&zca.zca_lock);
+
+	for (t = 0; t < ZTEST_CREATE_THREADS; t++)
+		thread_join(tid[t]);
+
+	atomic_add_64((uint64_t *)&zs->zs_create_time, zca.zca_end - start);
+	atomic_add_64(&zs->zs_creates, zca.zca_creates);
+
+	cv_destroy(&zca.zca_cv);
+	mutex_destroy(&zca.zca_lock);
+}
+
+/*
+ * Rewind the objset's next chunk of object numbers, so that the per-CPU
+ * allocators backfill and race each other for the same dnodes.
+ */
+/* ARGSUSED */
+void
+ztest_dmu_object_next_chunk(ztest_ds_t *zd, uint64_t id)
+{
+	objset_t *os = zd->zd_os;
+	uint64_t dnodes_per_chunk = 1ULL << dmu_object_alloc_chunk_shift;
+
+	mutex_enter(&os->os_obj_lock);
+	os->os_obj_next_chunk = P2ALIGN(ztest_random(os->os_obj_next_chunk +
+	    1), dnodes_per_chunk);
+	mutex_exit(&os->os_obj_lock);
+}
+
 #undef OD_ARRAY_SIZE
 #define	OD_ARRAY_SIZE	2
 
@@ -4909,6 +5119,11 @@ ztest_dsl_prop_get_set(ztest_ds_t *zd, uint64_t id)
 	VERIFY0(ztest_dsl_prop_set_uint64(zd->zd_name, ZFS_PROP_RECORDSIZE,
 	    ztest_random_blocksize(), (int)ztest_random(2)));
 
+	VERIFY0(ztest_dsl_prop_set_uint64(zd->zd_name,
+	    ZFS_PROP_SPECIAL_SMALL_BLOCKS, ztest_random(2) == 0 ? 0 :
+	    1ULL << (SPA_MINBLOCKSHIFT + ztest_random(8)),
+	    (int)ztest_random(2)));
+
 	(void) rw_unlock(&ztest_name_lock);
 }
 
@@ -4923,6 +5138,9 @@ ztest_spa_prop_get_set(ztest_ds_t *zd, uint64_t id)
 	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_DEDUPDITTO,
 	    ZIO_DEDUPDITTO_MIN + ztest_random(ZIO_DEDUPDITTO_MIN));
 
+	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_AUTOTRIM,
+	    ztest_random(2));
+
 	VERIFY0(spa_prop_get(ztest_spa, &props));
 
 	if (ztest_opts.zo_verbose >= 6)
@@ -5460,6 +5678,29 @@ ztest_scrub(ztest_ds_t *zd, uint64_t id)
 	(void) spa_scan(spa, POOL_SCAN_SCRUB);
 }
 
+/*
+ * Start, suspend or cancel a manual trim of the pool or of a random
+ * top-level vdev, at a random rate.
+ */
+/* ARGSUSED */
+void
+ztest_trim(ztest_ds_t *zd, uint64_t id)
+{
+	spa_t *spa = ztest_spa;
+	pool_trim_func_t func = ztest_random(POOL_TRIM_FUNCS);
+	uint64_t rate = ztest_random(2) ? 0 : (1ULL << 20) * ztest_random(64);
+	uint64_t guid = 0;
+
+	if (ztest_random(2) == 0) {
+		spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+		guid = spa->spa_root_vdev->vdev_child[ztest_random_vdev_top(spa,
+		    B_TRUE)]->vdev_guid;
+		spa_config_exit(spa, SCL_VDEV, FTAG);
+	}
+
+	(void) spa_trim(spa, guid, func, func == POOL_TRIM_START ? rate : 0);
+}
+
 /*
  * Change the guid for the pool.
  */
@@ -5490,6 +5731,68 @@ ztest_reguid(ztest_ds_t *zd, uint64_t id)
 	VERIFY3U(load, ==, spa_load_guid(spa));
 }
 
+/*
+ * Verify that every fletcher-4 implementation usable on this machine
+ * produces the same checksums as the scalar one, both for whole buffers
+ * and when fed in random incremental chunks.
+ */
+/* ARGSUSED */
+void
+ztest_fletcher(ztest_ds_t *zd, uint64_t id)
+{
+	uint64_t saved_impl = zfs_fletcher_4_impl;
+	size_t size = P2ROUNDUP(ztest_random(SPA_MAXBLOCKSIZE) + 1,
+	    sizeof (uint32_t));
+	uint32_t *buf = umem_alloc(size, UMEM_NOFAIL);
+	zio_cksum_t ref_native, ref_bswap;
+	uint64_t impl;
+	int i;
+
+	for (i = 0; i < size / sizeof (uint32_t); i++)
+		buf[i] = (uint32_t)ztest_random(UINT32_MAX);
+
+	VERIFY0(fletcher_4_impl_set(FLETCHER_4_IMPL_SCALAR));
+	fletcher_4_native(buf, size, NULL, &ref_native);
+	fletcher_4_byteswap(buf, size, NULL, &ref_bswap);
+
+	for (impl = FLETCHER_4_IMPL_SCALAR; impl < FLETCHER_4_IMPL_MAX;
+	    impl++) {
+		zio_cksum_t zc_native, zc_bswap, zc_inc;
+		size_t off, len;
+
+		if (fletcher_4_impl_set(impl) != 0)
+			continue;
+
+		fletcher_4_native(buf, size, NULL, &zc_native);
+		fletcher_4_byteswap(buf, size, NULL, &zc_bswap);
+		VERIFY(ZIO_CHECKSUM_EQUAL(ref_native, zc_native));
+		VERIFY(ZIO_CHECKSUM_EQUAL(ref_bswap, zc_bswap));
+
+		fletcher_init(&zc_inc);
+		for (off = 0; off < size; off += len) {
+			len = MIN(size - off, P2ROUNDUP(
+			    ztest_random(SPA_OLD_MAXBLOCKSIZE) + 1,
+			    sizeof (uint32_t)));
+			(void) fletcher_4_incremental_native(
+			    (char *)buf + off, len, &zc_inc);
+		}
+		VERIFY(ZIO_CHECKSUM_EQUAL(ref_native, zc_inc));
+
+		fletcher_init(&zc_inc);
+		for (off = 0; off < size; off += len) {
+			len = MIN(size - off, P2ROUNDUP(
+			    ztest_random(SPA_OLD_MAXBLOCKSIZE) + 1,
+			    sizeof (uint32_t)));
+			(void) fletcher_4_incremental_byteswap(
+			    (char *)buf + off, len, &zc_inc);
+		}
+		VERIFY(ZIO_CHECKSUM_EQUAL(ref_bswap, zc_inc));
+	}
+
+	(void) fletcher_4_impl_set(saved_impl);
+	umem_free(buf, size);
+}
+
 /*
  * Rename the pool to a different name and then rename it back.
  */
@@ -5738,6 +6041,12 @@ ztest_resume_thread(void *arg)
 		 */
 		if (ztest_random(10) == 0)
 			zfs_abd_scatter_enabled = ztest_random(2);
+
+		/*
+		 * Periodically change the mirror read selection policy.
+		 */
+		if (ztest_random(10) == 0)
+			zfs_vdev_mirror_latency_select = ztest_random(2);
 	}
 
 	/*
@@ -6637,6 +6946,8 @@ main(int argc, char **argv)
 			zc->zc_count = 0;
 			zc->zc_time = 0;
 		}
+		zs->zs_creates = 0;
+		zs->zs_create_time = 0;
 
 		/* Set the allocation switch size */
 		zs->zs_metaslab_df_alloc_threshold =
@@ -6695,7 +7006,11 @@ main(int argc, char **argv)
 				    (u_longlong_t)zc->zc_count, timebuf,
 				    zi->zi_funcname);
 			}
-			(void) printf("\n");
+			(void) printf("\n%llu objects created, %.0f/sec with "
+			    "%d concurrent creators\n\n",
+			    (u_longlong_t)zs->zs_creates,
+			    (double)zs->zs_creates * NANOSEC /
+			    MAX(1, zs->zs_create_time), ZTEST_CREATE_THREADS);
 		}
 
 		/*
@@ -76,6 +76,7 @@ AC_DEFUN([ZFS_AC_CONFIG_ALWAYS], [
 	ZFS_AC_CONFIG_ALWAYS_FILESYSTEMS_PREFIX
 	ZFS_AC_CONFIG_ALWAYS_MOUNTEXECDIR
 	ZFS_AC_CONFIG_ALWAYS_ARCH
+	ZFS_AC_CONFIG_ALWAYS_TOOLCHAIN_SIMD
 ])
 
 AC_DEFUN([ZFS_AC_CONFIG], [
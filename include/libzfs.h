@@ -159,6 +159,8 @@ typedef enum zfs_error {
 	EZFS_SHAREAFPFAILED,	/* failed to share over afp */
 	EZFS_CRYPTOFAILED,	/* failed to setup encryption */
 	EZFS_SCRUB_PAUSED,	/* scrub currently paused */
+	EZFS_NO_TRIM,		/* no active trim */
+	EZFS_TRIM_NOTSUP,	/* device unable to trim */
 	EZFS_UNKNOWN
 } zfs_error_t;
 
@@ -279,6 +281,8 @@ typedef struct splitflags {
  * Functions to manipulate pool and vdev state
  */
 extern int zpool_scan(zpool_handle_t *, pool_scan_func_t, pool_scrub_cmd_t);
+extern int zpool_trim(zpool_handle_t *, pool_trim_func_t, uint64_t, uint64_t);
+extern int zpool_ddt_prune(zpool_handle_t *, uint64_t, uint64_t *);
 extern int zpool_clear(zpool_handle_t *, const char *, nvlist_t *);
 extern int zpool_reguid(zpool_handle_t *);
 extern int zpool_reopen(zpool_handle_t *);
@@ -35,6 +35,7 @@ typedef enum abd_flags {
 	ABD_FLAG_META	= 1 << 2,	/* does this represent FS metadata? */
 	ABD_FLAG_SMALL  = 1 << 3,       /* (APPLE) : abd_alloc() went linear for a sub-chunk size */
 	ABD_FLAG_NOMOVE = 1 << 4,       /* (APPLE) : abd_to_buf() called on this abd */
+	ABD_FLAG_GANG	= 1 << 5,	/* is a gang of other ABDs? */
 } abd_flags_t;
 
 typedef struct abd {
@@ -57,6 +58,11 @@ typedef struct abd {
 		struct abd_linear {
 			void	*abd_buf;
 		} abd_linear;
+		struct abd_gang {
+			uint_t	abd_nchildren;
+			uint_t	abd_maxchildren;
+			struct abd **abd_gang_children;
+		} abd_gang;
 	} abd_u;
 } abd_t;
 
@@ -71,6 +77,12 @@ abd_is_linear(abd_t *abd)
 	return ((abd->abd_flags & ABD_FLAG_LINEAR) != 0 ? B_TRUE : B_FALSE);
 }
 
+static inline boolean_t
+abd_is_gang(abd_t *abd)
+{
+	return ((abd->abd_flags & ABD_FLAG_GANG) != 0 ? B_TRUE : B_FALSE);
+}
+
 /*
  * Allocations and deallocations
  */
@@ -79,6 +91,9 @@ abd_t *abd_alloc(size_t, boolean_t);
 abd_t *abd_alloc_linear(size_t, boolean_t);
 abd_t *abd_alloc_for_io(size_t, boolean_t);
 abd_t *abd_alloc_sametype(abd_t *, size_t);
+abd_t *abd_alloc_gang(void);
+void abd_gang_add(abd_t *, abd_t *, size_t, size_t);
+void abd_gang_add_gap(abd_t *, size_t, boolean_t);
 void abd_free(abd_t *);
 abd_t *abd_get_offset(abd_t *, size_t);
 abd_t *abd_get_offset_size(abd_t *, size_t, size_t);
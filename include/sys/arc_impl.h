@@ -211,18 +211,120 @@ typedef struct arc_buf_hdr_crypt {
 	uint8_t			b_mac[ZIO_DATA_MAC_LEN];
 } arc_buf_hdr_crypt_t;
 
+/*
+ * Persistent L2ARC
+ *
+ * So that a cache device does not start out empty after every export,
+ * import or reboot, the buffers written to it are also recorded on the
+ * device itself, in log blocks.  A log block describes up to
+ * L2ARC_LOG_BLK_MAX_ENTRIES buffers, all written to the device before the
+ * log block itself and during the same pass of the write hand.  Each log
+ * block points at the previous one, and the device header, which sits
+ * right after the front vdev labels, points at the newest one.
+ *
+ * When the device is added back to the pool, l2arc_add_vdev() reads the
+ * device header and a separate thread walks the log blocks from the
+ * newest to the oldest, recreating the L2-only ARC headers for the
+ * buffers they describe.  The walk stops at the first log block which has
+ * been overwritten since it was written, which the device header allows
+ * to detect without reading it: before l2arc_evict() lets the write hand
+ * into a region the device header is updated with the end of the region,
+ * l2ad_evict, and the write hand moves strictly forward between wraps.
+ *
+ * All structures are written in native byte order; a device moved to a
+ * machine of the other endianness simply starts out empty.
+ */
+#define	L2ARC_DEV_HDR_MAGIC	0x5a46534c32415243ULL	/* "ZFSL2ARC" */
+#define	L2ARC_LOG_BLK_MAGIC	0x4c4f47424c4b4844ULL	/* "LOGBLKHD" */
+#define	L2ARC_PERSISTENT_VERSION	1
+
+/* Set in dh_flags while the write hand is on its first pass. */
+#define	L2ARC_DEV_HDR_FIRST	(1ULL << 0)
+
+/*
+ * A pointer to a log block.  The log block and the buffers it describes
+ * together span [lbp_payload_start, lbp_daddr + lbp_asize).
+ */
+typedef struct l2arc_log_blkptr {
+	uint64_t		lbp_daddr;	/* address of log block */
+	uint64_t		lbp_payload_start; /* first described buffer */
+	uint64_t		lbp_asize;	/* allocated size, 0 if none */
+	zio_cksum_t		lbp_cksum;	/* fletcher4 of the log block */
+} l2arc_log_blkptr_t;
+
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t		dh_magic;	/* L2ARC_DEV_HDR_MAGIC */
+	uint64_t		dh_version;	/* L2ARC_PERSISTENT_VERSION */
+	uint64_t		dh_spa_guid;	/* pool guid */
+	uint64_t		dh_vdev_guid;	/* cache vdev guid */
+	uint64_t		dh_flags;	/* L2ARC_DEV_HDR_* */
+	uint64_t		dh_start;	/* l2ad_start */
+	uint64_t		dh_end;		/* l2ad_end */
+	uint64_t		dh_hand;	/* l2ad_hand */
+	uint64_t		dh_evict;	/* l2ad_evict */
+	l2arc_log_blkptr_t	dh_start_lbp;	/* newest log block */
+	zio_cksum_t		dh_cksum;	/* fletcher4 of the above */
+	uint64_t		dh_pad[44];	/* pad to 512 bytes */
+} l2arc_dev_hdr_phys_t;
+
+/*
+ * One buffer written to the device.  le_prop packs the sizes, the
+ * compression, the buffer type and whether the block is protected.
+ */
+typedef struct l2arc_log_ent_phys {
+	dva_t			le_dva;		/* dva of buffer */
+	uint64_t		le_birth;	/* birth txg of buffer */
+	uint64_t		le_prop;	/* L2BLK_* properties */
+	uint64_t		le_daddr;	/* device address of buffer */
+	uint64_t		le_pad[3];	/* pad to 64 bytes */
+} l2arc_log_ent_phys_t;
+
+#define	L2ARC_LOG_BLK_MAX_ENTRIES	1022
+
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;	/* L2ARC_LOG_BLK_MAGIC */
+	uint64_t		lb_nents;	/* entries in use */
+	l2arc_log_blkptr_t	lb_prev_lbp;	/* previous log block */
+	uint64_t		lb_pad[7];	/* pad entries to 128 bytes */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_MAX_ENTRIES];
+} l2arc_log_blk_phys_t;				/* 64K total */
+
+#define	L2BLK_GET_LSIZE(field)	\
+	BF64_GET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_LSIZE(field, x)	\
+	BF64_SET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_PSIZE(field)	\
+	BF64_GET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_PSIZE(field, x)	\
+	BF64_SET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_COMPRESS(field)	BF64_GET((field), 32, 8)
+#define	L2BLK_SET_COMPRESS(field, x)	BF64_SET((field), 32, 8, x)
+#define	L2BLK_GET_TYPE(field)		BF64_GET((field), 48, 8)
+#define	L2BLK_SET_TYPE(field, x)	BF64_SET((field), 48, 8, x)
+#define	L2BLK_GET_PROTECTED(field)	BF64_GET((field), 56, 1)
+#define	L2BLK_SET_PROTECTED(field, x)	BF64_SET((field), 56, 1, x)
+
 typedef struct l2arc_dev {
 	vdev_t			*l2ad_vdev;	/* vdev */
 	spa_t			*l2ad_spa;	/* spa */
 	uint64_t		l2ad_hand;	/* next write location */
 	uint64_t		l2ad_start;	/* first addr on device */
 	uint64_t		l2ad_end;	/* last addr on device */
+	uint64_t		l2ad_evict;	/* end of evicted region */
 	boolean_t		l2ad_first;	/* first sweep through */
 	boolean_t		l2ad_writing;	/* currently writing */
 	kmutex_t		l2ad_mtx;	/* lock for buffer list */
 	list_t			l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
 	refcount_t		l2ad_alloc;	/* allocated bytes */
+	/* persistent L2ARC, only used by the feed and rebuild threads */
+	l2arc_dev_hdr_phys_t	*l2ad_dev_hdr;	/* device header */
+	uint64_t		l2ad_dev_hdr_asize; /* aligned header size */
+	l2arc_log_blk_phys_t	*l2ad_log_blk;	/* log block being filled */
+	uint64_t		l2ad_log_ent_idx; /* entries in l2ad_log_blk */
+	/* protected by l2arc_rebuild_thr_lock */
+	boolean_t		l2ad_rebuild;	/* rebuild in progress */
+	boolean_t		l2ad_rebuild_cancel; /* stop rebuilding */
 } l2arc_dev_t;
 
 typedef struct l2arc_buf_hdr {
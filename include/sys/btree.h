@@ -0,0 +1,130 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_BTREE_H
+#define	_SYS_BTREE_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * An in-memory B-tree of fixed size elements, for sets of small records
+ * that are too numerous to give each its own allocation and AVL node.
+ *
+ * Unlike an AVL tree, the tree owns its elements: zfs_btree_add() copies
+ * the element into a node, and the pointers returned by zfs_btree_find(),
+ * zfs_btree_first() etc. point into the node.  Such a pointer, and any
+ * zfs_btree_index_t, remains valid only until the tree is next modified.
+ * An element may be changed in place as long as that doesn't change its
+ * position in the tree.
+ *
+ * Leaves are BTREE_LEAF_SIZE bytes, densely packed with elements; core
+ * nodes hold BTREE_CORE_ELEMS elements and a child pointer for each gap
+ * between them.  Every node but the root is kept at least half full.
+ */
+
+#define	BTREE_CORE_ELEMS	126
+#define	BTREE_LEAF_SIZE		4096
+
+typedef struct zfs_btree_hdr {
+	struct zfs_btree_core	*bth_parent;
+	boolean_t		bth_core;	/* core node or leaf */
+	uint32_t		bth_count;	/* number of elements */
+} zfs_btree_hdr_t;
+
+typedef struct zfs_btree_core {
+	zfs_btree_hdr_t	btc_hdr;
+	zfs_btree_hdr_t	*btc_children[BTREE_CORE_ELEMS + 1];
+	uint8_t		btc_elems[];
+} zfs_btree_core_t;
+
+typedef struct zfs_btree_leaf {
+	zfs_btree_hdr_t	btl_hdr;
+	uint8_t		btl_elems[];
+} zfs_btree_leaf_t;
+
+/*
+ * The position of an element, or, as returned by a zfs_btree_find() that
+ * found nothing, the position in a leaf before which the element would go.
+ */
+typedef struct zfs_btree_index {
+	zfs_btree_hdr_t	*bti_node;
+	uint32_t	bti_offset;
+	boolean_t	bti_before;
+} zfs_btree_index_t;
+
+typedef struct btree {
+	zfs_btree_hdr_t	*bt_root;
+	int64_t		bt_height;	/* -1 when empty, 0 for a lone leaf */
+	size_t		bt_elem_size;
+	uint32_t	bt_leaf_cap;	/* elements per leaf */
+	uint64_t	bt_num_elems;
+	uint64_t	bt_num_leaves;
+	uint64_t	bt_num_cores;
+	int		(*bt_compar)(const void *, const void *);
+} zfs_btree_t;
+
+extern void zfs_btree_init(void);
+extern void zfs_btree_fini(void);
+
+/*
+ * compar has the semantics of an AVL comparison function: it returns
+ * -1, 0 or 1 as its first argument sorts before, with or after its second.
+ */
+extern void zfs_btree_create(zfs_btree_t *tree,
+    int (*compar)(const void *, const void *), size_t size);
+extern void zfs_btree_destroy(zfs_btree_t *tree);
+
+extern void *zfs_btree_find(zfs_btree_t *tree, const void *value,
+    zfs_btree_index_t *where);
+extern void zfs_btree_add_idx(zfs_btree_t *tree, const void *value,
+    const zfs_btree_index_t *where);
+extern void zfs_btree_add(zfs_btree_t *tree, const void *value);
+extern void zfs_btree_remove_idx(zfs_btree_t *tree, zfs_btree_index_t *where);
+extern void zfs_btree_remove(zfs_btree_t *tree, const void *value);
+extern void zfs_btree_clear(zfs_btree_t *tree);
+
+extern void *zfs_btree_get(zfs_btree_t *tree, zfs_btree_index_t *idx);
+extern void *zfs_btree_first(zfs_btree_t *tree, zfs_btree_index_t *where);
+extern void *zfs_btree_last(zfs_btree_t *tree, zfs_btree_index_t *where);
+
+/*
+ * The element after (before) idx, whose position is stored in out_idx;
+ * idx and out_idx may be the same.  For a position returned by a failed
+ * zfs_btree_find(), these are the elements on either side of it.
+ */
+extern void *zfs_btree_next(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx);
+extern void *zfs_btree_prev(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx);
+
+extern ulong_t zfs_btree_numnodes(zfs_btree_t *tree);
+extern size_t zfs_btree_memory(zfs_btree_t *tree);
+extern void zfs_btree_verify(zfs_btree_t *tree);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_BTREE_H */
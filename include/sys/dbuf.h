@@ -263,13 +263,43 @@ typedef struct dmu_buf_impl {
 	uint8_t db_dirtycnt;
 } dmu_buf_impl_t;
 
-/* Note: the dbuf hash table is exposed only for the mdb module */
-#define	DBUF_MUTEXES 8192
-#define	DBUF_HASH_MUTEX(h, idx) (&(h)->hash_mutexes[(idx) & (DBUF_MUTEXES-1)])
+/*
+ * Note: the dbuf hash table is exposed only for the mdb module and
+ * dbuf_stats.c.
+ *
+ * The buckets are protected by a power-of-two number of striped locks,
+ * never more than there are buckets.  The dbuf with hash value hv lives
+ * in bucket (hv & mask) and is protected by stripe (hv & (nlocks - 1)),
+ * so each stripe protects the same set of dbufs whatever the table size.
+ * That lets the table be resized one stripe at a time: every stripe
+ * records which table it uses, and is switched over to the new table
+ * under its own lock once its buckets have been rehashed into it.
+ * hash_table and hash_table_mask describe the table once every stripe
+ * has been switched; lookups always go through the stripe.
+ */
+#define	DBUF_MUTEXES		8192	/* minimum number of stripes */
+#define	DBUF_HASH_LOCK_BUCKETS	256	/* initial buckets per stripe */
+#define	DBUF_HASH_CHAIN_BUCKETS	8	/* chain length histogram size */
+
+typedef struct dbuf_hash_lock {
+	kmutex_t	hl_lock;
+	dmu_buf_impl_t	**hl_table;	/* table used by this stripe */
+	uint64_t	hl_mask;	/* mask of hl_table */
+	uint64_t	hl_count;	/* dbufs hashed under this stripe */
+	uint64_t	hl_contended;	/* acquisitions that had to wait */
+	/* dbufs walked per lookup, power-of-two histogram */
+	uint64_t	hl_chains[DBUF_HASH_CHAIN_BUCKETS];
+} dbuf_hash_lock_t;
+
+#define	DBUF_HASH_LOCK(h, hv) (&(h)->hash_locks[(hv) & ((h)->hash_nlocks-1)])
 typedef struct dbuf_hash_table {
 	uint64_t hash_table_mask;
 	dmu_buf_impl_t **hash_table;
-	kmutex_t hash_mutexes[DBUF_MUTEXES];
+	uint64_t hash_min_size;		/* never shrink below this */
+	uint64_t hash_nlocks;
+	dbuf_hash_lock_t *hash_locks;
+	uint64_t hash_grows;		/* completed resizes */
+	uint64_t hash_shrinks;
 } dbuf_hash_table_t;
 
 
@@ -323,6 +353,7 @@ void dbuf_free_range(struct dnode *dn, uint64_t start, uint64_t end,
 
 void dbuf_new_size(dmu_buf_impl_t *db, int size, dmu_tx_t *tx);
 
+uint64_t dbuf_hash_count(dbuf_hash_table_t *hash);
 void dbuf_stats_init(dbuf_hash_table_t *hash);
 void dbuf_stats_destroy(void);
 
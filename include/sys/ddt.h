@@ -127,6 +127,50 @@ struct ddt_entry {
 	avl_node_t	dde_node;
 };
 
+/*
+ * On-disk dedup log record.  The log holds the latest state of each entry
+ * changed since it was last flushed to the DDT ZAPs; a record with a class
+ * of DDT_CLASSES marks an entry that has been removed.
+ *   +-------+-------+-------+-------+-------+-------+-------+-------+
+ *   |   0   |   0   |   0   |   0   |   0   |   0   | zclass| class |
+ *   +-------+-------+-------+-------+-------+-------+-------+-------+
+ * zclass is the class the entry is held in on disk, or DDT_CLASSES if it
+ * is not in any DDT ZAP yet.
+ */
+typedef struct ddt_log_record {
+	ddt_key_t	dlr_key;
+	ddt_phys_t	dlr_phys[DDT_PHYS_TYPES];
+	uint64_t	dlr_info;
+} ddt_log_record_t;
+
+#define	DLR_GET_CLASS(dlr)		BF64_GET((dlr)->dlr_info, 0, 8)
+#define	DLR_SET_CLASS(dlr, x)		BF64_SET((dlr)->dlr_info, 0, 8, x)
+
+#define	DLR_GET_ZAP_CLASS(dlr)		BF64_GET((dlr)->dlr_info, 8, 8)
+#define	DLR_SET_ZAP_CLASS(dlr, x)	BF64_SET((dlr)->dlr_info, 8, 8, x)
+
+/*
+ * In-core dedup log entry
+ */
+typedef struct ddt_log_entry {
+	ddt_key_t	dle_key;
+	ddt_phys_t	dle_phys[DDT_PHYS_TYPES];
+	uint8_t		dle_class;
+	uint8_t		dle_zap_class;
+	avl_node_t	dle_node;
+} ddt_log_entry_t;
+
+/*
+ * In-core dedup log
+ */
+typedef struct ddt_log {
+	avl_tree_t	ddl_tree;	/* latest entries, by key */
+	uint64_t	ddl_object;	/* on-disk record object */
+	uint64_t	ddl_length;	/* bytes of records on disk */
+	uint64_t	ddl_first_txg;	/* txg of the oldest record */
+	uint64_t	ddl_flush_rate;	/* entries to flush per txg */
+} ddt_log_t;
+
 /*
  * In-core ddt
  */
@@ -142,6 +186,16 @@ struct ddt {
 	ddt_histogram_t	ddt_histogram[DDT_TYPES][DDT_CLASSES];
 	ddt_histogram_t	ddt_histogram_cache[DDT_TYPES][DDT_CLASSES];
 	ddt_object_t	ddt_object_stats[DDT_TYPES][DDT_CLASSES];
+	ddt_log_t	ddt_log[2];
+	ddt_log_t	*ddt_log_active;	/* receives changed entries */
+	ddt_log_t	*ddt_log_flushing;	/* being flushed to the ZAPs */
+	ddt_log_record_t *ddt_log_buf;		/* records not yet written */
+	uint64_t	ddt_log_nrecs;
+	boolean_t	ddt_log_dirty;		/* MOS directory is stale */
+	uint64_t	ddt_log_flushed;	/* entries written to ZAPs */
+	uint64_t	ddt_log_flush_txgs;	/* txgs that flushed */
+	uint64_t	ddt_lookups;		/* entries ddt_lookup loaded */
+	uint64_t	ddt_lookup_time;	/* ns spent loading them */
 	avl_node_t	ddt_node;
 };
 
@@ -215,6 +269,8 @@ extern void ddt_get_dedup_stats(spa_t *spa, ddt_stat_t *dds_total);
 
 extern uint64_t ddt_get_dedup_dspace(spa_t *spa);
 extern uint64_t ddt_get_pool_dedup_ratio(spa_t *spa);
+extern uint64_t ddt_get_ddt_dsize(spa_t *spa);
+extern boolean_t ddt_over_quota(spa_t *spa);
 
 extern int ddt_ditto_copies_needed(ddt_t *ddt, ddt_entry_t *dde,
     ddt_phys_t *ddp_willref);
@@ -229,6 +285,7 @@ extern void ddt_exit(ddt_t *ddt);
 extern void ddt_init(void);
 extern void ddt_fini(void);
 extern ddt_entry_t *ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add);
+extern boolean_t ddt_exists(ddt_t *ddt, const blkptr_t *bp);
 extern void ddt_prefetch(spa_t *spa, const blkptr_t *bp);
 extern void ddt_remove(ddt_t *ddt, ddt_entry_t *dde);
 
@@ -245,8 +302,34 @@ extern int ddt_load(spa_t *spa);
 extern void ddt_unload(spa_t *spa);
 extern void ddt_sync(spa_t *spa, uint64_t txg);
 extern int ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde);
+extern int ddt_prune(spa_t *spa, uint64_t days, uint64_t *pruned);
+extern void ddt_object_create(ddt_t *ddt, enum ddt_type type,
+    enum ddt_class _class, dmu_tx_t *tx);
 extern int ddt_object_update(ddt_t *ddt, enum ddt_type type,
     enum ddt_class _class, ddt_entry_t *dde, dmu_tx_t *tx);
+extern int ddt_object_remove(ddt_t *ddt, enum ddt_type type,
+    enum ddt_class _class, ddt_entry_t *dde, dmu_tx_t *tx);
+
+extern void ddt_log_init(void);
+extern void ddt_log_fini(void);
+extern void ddt_log_alloc(ddt_t *ddt);
+extern void ddt_log_free(ddt_t *ddt);
+extern int ddt_log_load(ddt_t *ddt);
+extern boolean_t ddt_log_enabled(ddt_t *ddt);
+extern boolean_t ddt_log_empty(ddt_t *ddt);
+extern void ddt_log_activate(ddt_t *ddt, dmu_tx_t *tx);
+extern void ddt_log_entry(ddt_t *ddt, ddt_entry_t *dde,
+    enum ddt_class zap_class, enum ddt_class _class, dmu_tx_t *tx);
+extern void ddt_log_commit(ddt_t *ddt, dmu_tx_t *tx);
+extern boolean_t ddt_log_flush(ddt_t *ddt, dmu_tx_t *tx);
+extern void ddt_log_sync(ddt_t *ddt, dmu_tx_t *tx);
+extern int ddt_log_lookup(ddt_t *ddt, ddt_entry_t *dde);
+extern boolean_t ddt_log_hides(ddt_t *ddt, ddt_entry_t *dde,
+    enum ddt_class _class);
+extern int ddt_log_walk(ddt_t *ddt, ddt_entry_t *dde, boolean_t first);
+extern void ddt_get_dedup_log_stats(spa_t *spa, ddt_log_stat_t *ddls);
+extern void ddt_log_lookup_done(ddt_t *ddt, boolean_t log_hit,
+    hrtime_t start);
 
 extern const ddt_ops_t ddt_zap_ops;
 
@@ -108,6 +108,7 @@ struct objset {
 	zfs_sync_type_t os_sync;
 	zfs_redundant_metadata_type_t os_redundant_metadata;
 	int os_recordsize;
+	uint64_t os_zpl_special_smallblk;
 
 	/*
 	 * Pointer is constant; the blkptr it points to is protected by
@@ -128,7 +129,12 @@ struct objset {
 
 	/* Protected by os_obj_lock */
 	kmutex_t os_obj_lock;
-	uint64_t os_obj_next;
+	uint64_t os_obj_next_chunk;
+	boolean_t os_obj_scanning;
+
+	/* Per-CPU chunk of object numbers, updated atomically */
+	uint64_t *os_obj_next_percpu;
+	int os_obj_next_percpu_len;
 
 	/* Protected by os_lock */
 	kmutex_t os_lock;
@@ -40,6 +40,9 @@ struct dmu_replay_record;
 
 extern const char *recv_clone_name;
 
+void dmu_send_init(void);
+void dmu_send_fini(void);
+
 int dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
     boolean_t large_block_ok, boolean_t compressok, boolean_t rawok, int outfd,
     uint64_t resumeobj, uint64_t resumeoff,
@@ -40,6 +40,24 @@ extern uint64_t	zfetch_array_rd_sz;
 
 struct dnode;				/* so we can reference dnode */
 
+/*
+ * Access patterns a stream can follow.  A stream starts out as
+ * ZFETCH_PATTERN_NEW and becomes one of the others on its first hit.
+ */
+typedef enum zfetch_pattern {
+	ZFETCH_PATTERN_NEW,		/* single access, no pattern yet */
+	ZFETCH_PATTERN_FORWARD,		/* contiguous, ascending blkids */
+	ZFETCH_PATTERN_REVERSE,		/* contiguous, descending blkids */
+	ZFETCH_PATTERN_STRIDE		/* fixed-size accesses, fixed gap */
+} zfetch_pattern_t;
+
+/*
+ * For forward streams zs_blkid is the first block of the next expected
+ * access and the prefetch cursors move up.  For reverse streams zs_blkid
+ * is the block just past the end of the next expected access and the
+ * cursors move down.  For stride streams zs_blkid is the first block of
+ * the next expected access and the cursors advance by zs_stride.
+ */
 typedef struct zstream {
 	uint64_t        zs_blkid;       /* expect next access at this blkid */
 	uint64_t        zs_pf_blkid;    /* next block to prefetch */
@@ -50,6 +68,13 @@ typedef struct zstream {
 	 */
 	uint64_t	zs_ipf_blkid;
 
+	zfetch_pattern_t zs_pattern;	/* access pattern being followed */
+	uint64_t	zs_first_blkid;	/* start of the creating access */
+	uint64_t	zs_nblks;	/* blocks per access (NEW/STRIDE) */
+	int64_t		zs_stride;	/* blocks between STRIDE accesses */
+	uint64_t	zs_dist;	/* prefetch distance limit, blocks */
+	uint64_t	zs_hits;	/* accesses matching this stream */
+
 	kmutex_t        zs_lock;        /* protects stream */
 	hrtime_t        zs_atime;       /* time last prefetch issued */
 	list_node_t     zs_node;        /* link for zf_stream */
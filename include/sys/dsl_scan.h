@@ -41,6 +41,7 @@ struct dsl_dir;
 struct dsl_dataset;
 struct dsl_pool;
 struct dmu_tx;
+struct vdev;
 
 /*
  * All members of this structure must be uint64_t, for byteswap
@@ -100,6 +101,22 @@ typedef enum dsl_scan_flags {
  *			the scan but have not yet been processed (i.e deferred
  *			frees) are accounted for.
  *
+ * A sorted scan (scn_is_sorted) splits the work into two phases. The
+ * gather phase traverses the pool and queues the blocks to read on their
+ * top-level vdev, sorted by offset. The issue phase reads those queues
+ * back as large, mostly sequential extents:
+ *
+ * scn_clearing -	the queues have outgrown their memory budget, so
+ *			traversal stops and the fullest extents are issued
+ *			until usage drops below the soft limit.
+ *
+ * scn_checkpointing -	all queues are being drained in offset order. Once
+ *			they are empty, scn_phys is consistent with what has
+ *			actually been read and is written out as the new
+ *			checkpoint. Until then, scn_phys_cached (the last
+ *			checkpoint) is what gets synced to disk, so an import
+ *			resumes from a point where nothing has been skipped.
+ *
  * This structure also maintains information about deferred frees which are
  * a special kind of traversal. Deferred free can exist in either a bptree or
  * a bpobj structure. The scn_is_bptree flag will indicate the type of
@@ -121,9 +138,23 @@ typedef struct dsl_scan {
 	boolean_t scn_async_stalled;
 	uint64_t scn_visited_this_txg;
 
-	dsl_scan_phys_t scn_phys;
+	/* for sorted scans */
+	boolean_t scn_is_sorted;
+	boolean_t scn_clearing;
+	boolean_t scn_checkpointing;
+	hrtime_t scn_last_checkpoint;
+	uint64_t scn_bytes_pending;	/* queued, not yet issued */
+	uint64_t scn_mem_used;		/* memory held by the I/O queues */
+	uint64_t scn_issued_before_pass; /* issued by earlier passes */
+	taskq_t *scn_taskq;		/* issues the per-vdev queues */
+	avl_tree_t scn_queue;		/* datasets left to traverse */
+
+	dsl_scan_phys_t scn_phys;	/* on-disk state, as traversed */
+	dsl_scan_phys_t scn_phys_cached; /* last checkpoint */
 } dsl_scan_t;
 
+typedef struct dsl_scan_io_queue dsl_scan_io_queue_t;
+
 int dsl_scan_init(struct dsl_pool *dp, uint64_t txg);
 void dsl_scan_fini(struct dsl_pool *dp);
 void dsl_scan_sync(struct dsl_pool *, dmu_tx_t *);
@@ -143,6 +174,10 @@ void dsl_scan_ds_clone_swapped(struct dsl_dataset *ds1, struct dsl_dataset *ds2,
 boolean_t dsl_scan_active(dsl_scan_t *scn);
 boolean_t dsl_scan_is_paused_scrub(const dsl_scan_t *scn);
 
+void dsl_scan_freed(spa_t *spa, const blkptr_t *bp);
+void dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *queue);
+void dsl_scan_io_queue_vdev_xfer(struct vdev *svd, struct vdev *tvd);
+
 #ifdef	__cplusplus
 }
 #endif
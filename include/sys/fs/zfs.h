@@ -186,6 +186,7 @@ typedef enum {
 	ZFS_PROP_ENCRYPTION_ROOT,
 	ZFS_PROP_KEY_GUID,
 	ZFS_PROP_KEYSTATUS,
+	ZFS_PROP_SPECIAL_SMALL_BLOCKS,
 	ZFS_NUM_PROPS
 } zfs_prop_t;
 
@@ -233,6 +234,9 @@ typedef enum {
 	ZPOOL_PROP_LEAKED,
 	ZPOOL_PROP_MAXBLOCKSIZE,
 	ZPOOL_PROP_TNAME,
+	ZPOOL_PROP_AUTOTRIM,
+	ZPOOL_PROP_DEDUP_TABLE_QUOTA,
+	ZPOOL_PROP_DEDUP_TABLE_SIZE,
 	ZPOOL_NUM_PROPS
 } zpool_prop_t;
 
@@ -627,6 +631,10 @@ typedef struct zpool_rewind_policy {
 #define	ZPOOL_CONFIG_VDEV_ASYNC_AGG_W_HISTO	"vdev_async_agg_w_histo"
 #define	ZPOOL_CONFIG_VDEV_AGG_SCRUB_HISTO	"vdev_agg_scrub_histo"
 
+/* Mirror child read selection */
+#define	ZPOOL_CONFIG_VDEV_MIRROR_READS		"vdev_mirror_reads"
+#define	ZPOOL_CONFIG_VDEV_MIRROR_READ_LAT	"vdev_mirror_read_lat"
+
 #define	ZPOOL_CONFIG_WHOLE_DISK		"whole_disk"
 #define	ZPOOL_CONFIG_ERRCOUNT		"error_count"
 #define	ZPOOL_CONFIG_NOT_PRESENT	"not_present"
@@ -639,6 +647,7 @@ typedef struct zpool_rewind_policy {
 #define	ZPOOL_CONFIG_UNSPARE		"unspare"
 #define	ZPOOL_CONFIG_PHYS_PATH		"phys_path"
 #define	ZPOOL_CONFIG_IS_LOG		"is_log"
+#define	ZPOOL_CONFIG_ALLOCATION_BIAS	"alloc_bias"
 #define	ZPOOL_CONFIG_L2CACHE		"l2cache"
 #define	ZPOOL_CONFIG_HOLE_ARRAY		"hole_array"
 #define	ZPOOL_CONFIG_VDEV_CHILDREN	"vdev_children"
@@ -646,6 +655,8 @@ typedef struct zpool_rewind_policy {
 #define	ZPOOL_CONFIG_DDT_HISTOGRAM	"ddt_histogram"
 #define	ZPOOL_CONFIG_DDT_OBJ_STATS	"ddt_object_stats"
 #define	ZPOOL_CONFIG_DDT_STATS		"ddt_stats"
+#define	ZPOOL_CONFIG_DDT_LOG_STATS	"ddt_log_stats"
+#define	ZPOOL_CONFIG_DDT_PRUNED		"ddt_pruned"
 #define	ZPOOL_CONFIG_SPLIT		"splitcfg"
 #define	ZPOOL_CONFIG_ORIG_GUID		"orig_guid"
 #define	ZPOOL_CONFIG_SPLIT_GUID		"split_guid"
@@ -705,6 +716,13 @@ typedef struct zpool_rewind_policy {
 #define	VDEV_TYPE_LOG			"log"
 #define	VDEV_TYPE_L2CACHE		"l2cache"
 
+/*
+ * Allocation bias of a top-level vdev, stored as ZPOOL_CONFIG_ALLOCATION_BIAS.
+ */
+#define	VDEV_ALLOC_BIAS_LOG		"log"
+#define	VDEV_ALLOC_BIAS_SPECIAL		"special"
+#define	VDEV_ALLOC_BIAS_DEDUP		"dedup"
+
 /*
  * This is needed in userland to report the minimum necessary device size.
  *
@@ -801,6 +819,27 @@ typedef enum pool_scrub_cmd {
 	POOL_SCRUB_FLAGS_END
 } pool_scrub_cmd_t;
 
+/*
+ * Manual trim functions (ZFS_IOC_POOL_TRIM).
+ */
+typedef enum pool_trim_func {
+	POOL_TRIM_START,
+	POOL_TRIM_CANCEL,
+	POOL_TRIM_SUSPEND,
+	POOL_TRIM_FUNCS
+} pool_trim_func_t;
+
+/*
+ * State of a manual trim of a top-level vdev, reported in vs_trim_state.
+ */
+typedef enum vdev_trim_state {
+	VDEV_TRIM_NONE,
+	VDEV_TRIM_ACTIVE,
+	VDEV_TRIM_CANCELED,
+	VDEV_TRIM_SUSPENDED,
+	VDEV_TRIM_COMPLETE
+} vdev_trim_state_t;
+
 
 /*
  * ZIO types.  Needed to interpret vdev statistics below.
@@ -837,6 +876,10 @@ typedef struct pool_scan_stat {
 	uint64_t	pss_pass_scrub_pause; /* pause time of a scurb pass */
 	/* cumulative time scrub spent paused, needed for rate calculation */
 	uint64_t	pss_pass_scrub_spent_paused;
+
+	/* sorted scan: bytes actually read, as opposed to examined */
+	uint64_t	pss_pass_issued; /* issued bytes per scan pass */
+	uint64_t	pss_issued;	/* total issued bytes */
 } pool_scan_stat_t;
 
 typedef enum dsl_scan_state {
@@ -881,6 +924,11 @@ typedef struct vdev_stat {
 	uint64_t	vs_scan_removing;	/* removing?	*/
 	uint64_t	vs_scan_processed;	/* scan processed bytes	*/
 	uint64_t	vs_fragmentation;	/* device fragmentation */
+	uint64_t	vs_trim_notsup;		/* leaf cannot trim	*/
+	uint64_t	vs_trim_state;		/* vdev_trim_state_t	*/
+	uint64_t	vs_trim_action_time;	/* time of last change	*/
+	uint64_t	vs_trim_bytes_done;	/* bytes walked by trim	*/
+	uint64_t	vs_trim_bytes_est;	/* total bytes to trim	*/
 
 } vdev_stat_t;
 
@@ -935,6 +983,10 @@ typedef struct vdev_stat_ex {
 	uint64_t vsx_agg_histo[ZIO_PRIORITY_NUM_QUEUEABLE]
 	    [VDEV_RQ_HISTO_BUCKETS];
 
+	/* Reads a parent mirror directed to this vdev, and their latency */
+	uint64_t vsx_mirror_reads;
+	uint64_t vsx_mirror_read_lat;	/* total (ns) */
+
 } vdev_stat_ex_t;
 
 /*
@@ -962,6 +1014,16 @@ typedef struct ddt_histogram {
 	ddt_stat_t	ddh_stat[64];	/* power-of-two histogram buckets */
 } ddt_histogram_t;
 
+typedef struct ddt_log_stat {
+	uint64_t	ddls_entries;	/* entries held in the dedup logs */
+	uint64_t	ddls_dspace;	/* size of the dedup logs on disk */
+	uint64_t	ddls_mspace;	/* size of the dedup logs in-core */
+	uint64_t	ddls_flushed;	/* entries flushed to the ddt	*/
+	uint64_t	ddls_flush_txgs; /* txgs that flushed entries	*/
+	uint64_t	ddls_lookups;	/* entries loaded for dedup i/o	*/
+	uint64_t	ddls_lookup_time; /* nanoseconds spent loading	*/
+} ddt_log_stat_t;
+
 #define	ZVOL_DRIVER	"zvol"
 #define	ZFS_DRIVER	"zfs"
 #define	ZFS_DEV		"/dev/zfs"
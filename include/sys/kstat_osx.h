@@ -66,6 +66,8 @@ typedef struct osx_kstat {
 	kstat_named_t zfs_vdev_async_write_max_active;
 	kstat_named_t zfs_vdev_scrub_min_active;
 	kstat_named_t zfs_vdev_scrub_max_active;
+	kstat_named_t zfs_vdev_trim_min_active;
+	kstat_named_t zfs_vdev_trim_max_active;
 	kstat_named_t zfs_vdev_async_write_active_min_dirty_percent;
 	kstat_named_t zfs_vdev_async_write_active_max_dirty_percent;
 	kstat_named_t zfs_vdev_aggregation_limit;
@@ -107,17 +109,25 @@ typedef struct osx_kstat {
 	kstat_named_t metaslab_gang_bang;
 	kstat_named_t metaslab_df_alloc_threshold;
 	kstat_named_t metaslab_df_free_pct;
+	kstat_named_t metaslab_allocator;
 	kstat_named_t zio_injection_enabled;
 	kstat_named_t zvol_immediate_write_sz;
 
 	kstat_named_t l2arc_noprefetch;
 	kstat_named_t l2arc_feed_again;
 	kstat_named_t l2arc_norw;
+	kstat_named_t l2arc_rebuild_enabled;
 
 	kstat_named_t zfs_top_maxinflight;
 	kstat_named_t zfs_resilver_delay;
 	kstat_named_t zfs_scrub_delay;
 	kstat_named_t zfs_scan_idle;
+	kstat_named_t zfs_scan_legacy;
+	kstat_named_t zfs_scan_vdev_limit;
+	kstat_named_t zfs_scan_mem_lim_fact;
+	kstat_named_t zfs_scan_mem_lim_soft_fact;
+	kstat_named_t zfs_scan_max_ext_gap;
+	kstat_named_t zfs_scan_checkpoint_intval;
 
 	kstat_named_t zfs_recover;
 
@@ -146,6 +156,51 @@ typedef struct osx_kstat {
 	kstat_named_t zio_dva_throttle_enabled;
 
 	kstat_named_t zfs_vdev_file_size_mismatch_cnt;
+
+	kstat_named_t zfs_fletcher_4_impl;
+	kstat_named_t zfs_vdev_raidz_impl;
+
+	kstat_named_t zfs_trim_extent_bytes_max;
+	kstat_named_t zfs_trim_extent_bytes_min;
+	kstat_named_t zfs_trim_queue_limit;
+	kstat_named_t zfs_trim_txg_batch;
+
+	kstat_named_t zfs_ddt_data_is_special;
+	kstat_named_t zfs_user_indirect_is_special;
+	kstat_named_t zfs_special_class_metadata_reserve_pct;
+
+	kstat_named_t zfs_unflushed_max_mem_amt;
+	kstat_named_t zfs_unflushed_log_block_max;
+	kstat_named_t zfs_min_metaslabs_to_flush;
+	kstat_named_t zfs_max_metaslabs_to_flush;
+
+	kstat_named_t dmu_object_alloc_chunk_shift;
+	kstat_named_t zfs_commit_timeout_pct;
+	kstat_named_t zil_slog_stripe;
+	kstat_named_t zfs_vdev_queue_adaptive;
+	kstat_named_t zfs_vdev_queue_target_latency_us;
+	kstat_named_t zfs_vdev_queue_adaptive_max_pct;
+	kstat_named_t zfs_vdev_mirror_latency_select;
+	kstat_named_t zfs_vdev_mirror_latency_hysteresis;
+	kstat_named_t zfs_vdev_mirror_latency_stale_ms;
+	kstat_named_t zfetch_max_distance;
+	kstat_named_t zfetch_min_distance;
+	kstat_named_t dbuf_hash_load_max;
+	kstat_named_t zfs_arc_hash_resize;
+	kstat_named_t zfs_arc_evict_threads;
+	kstat_named_t zfs_arc_evict_thread_bytes;
+	kstat_named_t zfs_vdev_aggregate_gang;
+	kstat_named_t zfs_compress_probe;
+	kstat_named_t zfs_compress_probe_size;
+	kstat_named_t zfs_compress_probe_min_pct;
+	kstat_named_t zfs_decompress_stream;
+	kstat_named_t zfs_dedup_log_txg_max;
+	kstat_named_t zfs_dedup_log_mem_max;
+	kstat_named_t zfs_dedup_log_flush_txgs;
+	kstat_named_t zfs_dedup_log_flush_entries_min;
+	kstat_named_t zfs_dedup_log_flush_entries_max;
+	kstat_named_t zfs_send_workers;
+	kstat_named_t zfs_send_worker_range;
 } osx_kstat_t;
 
 
@@ -185,6 +240,8 @@ extern uint32_t zfs_vdev_async_write_min_active;
 extern uint32_t zfs_vdev_async_write_max_active;
 extern uint32_t zfs_vdev_scrub_min_active;
 extern uint32_t zfs_vdev_scrub_max_active;
+extern uint32_t zfs_vdev_trim_min_active;
+extern uint32_t zfs_vdev_trim_max_active;
 extern int zfs_vdev_async_write_active_min_dirty_percent;
 extern int zfs_vdev_async_write_active_max_dirty_percent;
 extern int zfs_vdev_aggregation_limit;
@@ -209,16 +266,24 @@ extern offset_t zfs_read_chunk_size;
 extern uint64_t metaslab_gang_bang;
 extern uint64_t metaslab_df_alloc_threshold;
 extern int metaslab_df_free_pct;
+extern int metaslab_allocator;
 extern ssize_t zvol_immediate_write_sz;
 
 extern boolean_t l2arc_noprefetch;
 extern boolean_t l2arc_feed_again;
 extern boolean_t l2arc_norw;
+extern boolean_t l2arc_rebuild_enabled;
 
 extern int zfs_top_maxinflight;
 extern int zfs_resilver_delay;
 extern int zfs_scrub_delay;
 extern int zfs_scan_idle;
+extern int zfs_scan_legacy;
+extern uint64_t zfs_scan_vdev_limit;
+extern int zfs_scan_mem_lim_fact;
+extern int zfs_scan_mem_lim_soft_fact;
+extern uint64_t zfs_scan_max_ext_gap;
+extern int zfs_scan_checkpoint_intval;
 
 extern uint64_t zfs_free_max_blocks;
 extern int64_t zfs_free_bpobj_enabled;
@@ -246,6 +311,51 @@ extern boolean_t zio_dva_throttle_enabled;
 
 extern uint64_t zfs_vdev_file_size_mismatch_cnt;
 
+extern uint64_t zfs_fletcher_4_impl;
+extern uint64_t zfs_vdev_raidz_impl;
+
+extern uint64_t zfs_trim_extent_bytes_max;
+extern uint64_t zfs_trim_extent_bytes_min;
+extern uint64_t zfs_trim_queue_limit;
+extern uint64_t zfs_trim_txg_batch;
+
+extern uint64_t zfs_ddt_data_is_special;
+extern uint64_t zfs_user_indirect_is_special;
+extern uint64_t zfs_special_class_metadata_reserve_pct;
+
+extern uint64_t zfs_unflushed_max_mem_amt;
+extern uint64_t zfs_unflushed_log_block_max;
+extern uint64_t zfs_min_metaslabs_to_flush;
+extern uint64_t zfs_max_metaslabs_to_flush;
+
+extern int dmu_object_alloc_chunk_shift;
+extern int zfs_commit_timeout_pct;
+extern int zil_slog_stripe;
+extern int zfs_vdev_queue_adaptive;
+extern uint64_t zfs_vdev_queue_target_latency_us;
+extern uint32_t zfs_vdev_queue_adaptive_max_pct;
+extern int zfs_vdev_mirror_latency_select;
+extern uint64_t zfs_vdev_mirror_latency_hysteresis;
+extern uint64_t zfs_vdev_mirror_latency_stale_ms;
+extern uint32_t zfetch_max_distance;
+extern uint32_t zfetch_min_distance;
+extern uint_t dbuf_hash_load_max;
+extern int zfs_arc_hash_resize;
+extern int zfs_arc_evict_threads;
+extern uint64_t zfs_arc_evict_thread_bytes;
+extern int zfs_vdev_aggregate_gang;
+extern int zfs_compress_probe;
+extern uint32_t zfs_compress_probe_size;
+extern uint32_t zfs_compress_probe_min_pct;
+extern int zfs_decompress_stream;
+extern uint64_t zfs_dedup_log_txg_max;
+extern uint64_t zfs_dedup_log_mem_max;
+extern uint64_t zfs_dedup_log_flush_txgs;
+extern uint64_t zfs_dedup_log_flush_entries_min;
+extern uint64_t zfs_dedup_log_flush_entries_max;
+extern int zfs_send_workers;
+extern uint64_t zfs_send_worker_range;
+
 int        kstat_osx_init(void);
 void       kstat_osx_fini(void);
 
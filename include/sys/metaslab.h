@@ -44,6 +44,12 @@ typedef struct metaslab_ops {
 
 extern metaslab_ops_t *zfs_metaslab_ops;
 
+#define	METASLAB_ALLOCATOR_DEFAULT	0
+#define	METASLAB_ALLOCATOR_BUCKET	1
+
+extern int metaslab_allocator;
+metaslab_ops_t *metaslab_allocator_ops(void);
+
 int metaslab_init(metaslab_group_t *, uint64_t, uint64_t, uint64_t,
     metaslab_t **);
 void metaslab_fini(metaslab_t *);
@@ -56,6 +62,11 @@ void metaslab_sync(metaslab_t *, uint64_t);
 void metaslab_sync_done(metaslab_t *, uint64_t);
 void metaslab_sync_reassess(metaslab_group_t *);
 uint64_t metaslab_block_maxsize(metaslab_t *);
+uint64_t metaslab_allocated_space(metaslab_t *);
+
+void metaslab_unflushed_replay(metaslab_t *, uint64_t, maptype_t, uint64_t,
+    uint64_t);
+void metaslab_unflushed_replay_done(metaslab_t *);
 
 #define	METASLAB_HINTBP_FAVOR		0x0
 #define	METASLAB_HINTBP_AVOID		0x1
@@ -75,6 +86,8 @@ void metaslab_fastwrite_unmark(spa_t *, const blkptr_t *);
 
 void metaslab_alloc_trace_init(void);
 void metaslab_alloc_trace_fini(void);
+void metaslab_stat_init(void);
+void metaslab_stat_fini(void);
 void metaslab_trace_init(zio_alloc_list_t *);
 void metaslab_trace_fini(zio_alloc_list_t *);
 
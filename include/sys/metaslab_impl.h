@@ -67,7 +67,8 @@ typedef enum trace_alloc_type {
 	TRACE_GROUP_FAILURE	= -5ULL,
 	TRACE_ENOSPC		= -6ULL,
 	TRACE_CONDENSING	= -7ULL,
-	TRACE_VDEV_ERROR	= -8ULL
+	TRACE_VDEV_ERROR	= -8ULL,
+	TRACE_TRIMMING		= -9ULL
 } trace_alloc_type_t;
 
 #define	METASLAB_WEIGHT_PRIMARY		(1ULL << 63)
@@ -298,8 +299,8 @@ struct metaslab_group {
  * To load the in-core free tree we read the space map from disk.  This
  * object contains a series of alloc and free records that are combined
  * to make up the list of all free segments in this metaslab.  These
- * segments are represented in-core by the ms_tree and are stored in an
- * AVL tree.
+ * segments are represented in-core by the ms_tree and are stored in a
+ * B-tree.
  *
  * As the space map grows (as a result of the appends) it will
  * eventually become space-inefficient.  When the metaslab's in-core
@@ -308,6 +309,14 @@ struct metaslab_group {
  * metaslab needs to condense then we must set the ms_condensing flag to
  * ensure that allocations are not performed on the metaslab that is
  * being written.
+ *
+ * With the log_spacemap feature, a metaslab's allocs and frees are instead
+ * appended to the pool's log space map of the txg, and its own space map
+ * is only brought up to date ("flushed") now and then (see
+ * spa_log_spacemap.c).  The changes logged since the last flush are
+ * kept in ms_unflushed_allocs and ms_unflushed_frees, relative to the
+ * space map: a range is in at most one of them, and both are applied on
+ * top of the space map when the metaslab is loaded.
  */
 struct metaslab {
 	kmutex_t	ms_lock;
@@ -333,6 +342,31 @@ struct metaslab {
 	boolean_t	ms_condensing;	/* condensing? */
 	boolean_t	ms_condense_wanted;
 
+	/*
+	 * Changes logged but not yet flushed to ms_sm, and the txg the
+	 * oldest of them was logged in (zero if there are none).  They are
+	 * only modified in syncing context, under ms_lock.
+	 * ms_unflushed_space is their net allocated space as last reported
+	 * to the vdev.  ms_flushing is set while ms_sm is being flushed,
+	 * from metaslab_sync() to metaslab_sync_done().
+	 */
+	range_tree_t	*ms_unflushed_allocs;
+	range_tree_t	*ms_unflushed_frees;
+	uint64_t	ms_unflushed_txg;
+	int64_t		ms_unflushed_space;
+	boolean_t	ms_flush_wanted;
+	boolean_t	ms_flushing;
+	avl_node_t	ms_unflushed_node; /* spa_metaslabs_by_flushed */
+
+	/*
+	 * Ranges freed since they were last trimmed, kept only while
+	 * autotrim is on.  While ms_trimming is non-zero, ranges of ms_tree
+	 * are being trimmed and the metaslab must not be allocated from.
+	 * Both are protected by ms_lock, see vdev_trim.c.
+	 */
+	range_tree_t	*ms_trim;
+	int		ms_trimming;
+
 	/*
 	 * We must hold both ms_lock and ms_group->mg_lock in order to
 	 * modify ms_loaded.
@@ -359,11 +393,23 @@ struct metaslab {
 	 * range tree and/or an array of LBAs. Not all allocators use
 	 * this functionality. The ms_size_tree should always contain the
 	 * same number of segments as the ms_tree. The only difference
-	 * is that the ms_size_tree is ordered by segment sizes.
+	 * is that the ms_size_tree is ordered by segment sizes.  It holds
+	 * copies of the segments of ms_tree, of the same type.
 	 */
-	avl_tree_t	ms_size_tree;
+	zfs_btree_t	ms_size_tree;
 	uint64_t	ms_lbas[MAX_LBAS];
 
+	/*
+	 * For the size-bucketed allocator, copies of the segments of
+	 * ms_tree in buckets by size, ms_buckets[i] holding those of 2^i
+	 * to 2^(i+1) - 1 bytes sorted by offset, with ms_lbas[i] as its
+	 * cursor.  Bit i of ms_bucket_mask is set while ms_buckets[i] is
+	 * not empty.
+	 */
+	boolean_t	ms_bucketed;
+	zfs_btree_t	*ms_buckets;
+	uint64_t	ms_bucket_mask;
+
 	metaslab_group_t *ms_group;	/* metaslab group		*/
 	avl_node_t	ms_group_node;	/* node in metaslab group tree	*/
 	txg_node_t	ms_txg_node;	/* per-txg dirty metaslab links	*/
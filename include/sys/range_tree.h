@@ -30,7 +30,7 @@
 #ifndef _SYS_RANGE_TREE_H
 #define	_SYS_RANGE_TREE_H
 
-#include <sys/avl.h>
+#include <sys/btree.h>
 #include <sys/dmu.h>
 
 #ifdef	__cplusplus
@@ -41,9 +41,26 @@ extern "C" {
 
 typedef struct range_tree_ops range_tree_ops_t;
 
+/*
+ * The segments of a range tree are kept, by value, in a B-tree.  A tree
+ * whose segments all lie within 2^32 units of 2^rt_shift bytes from
+ * rt_start, such as the trees of a metaslab, can store them as 32-bit
+ * values relative to rt_start, halving their size.  Segments are only
+ * accessed through the rs_get_*() and rs_set_*() functions below, which
+ * take the tree they belong to.
+ */
+typedef enum range_seg_type {
+	RANGE_SEG32,
+	RANGE_SEG64,
+	RANGE_SEG_NUM_TYPES
+} range_seg_type_t;
+
 typedef struct range_tree {
-	avl_tree_t	rt_root;	/* offset-ordered segment AVL tree */
+	zfs_btree_t	rt_root;	/* offset-ordered segment B-tree */
 	uint64_t	rt_space;	/* sum of all segments in the map */
+	range_seg_type_t rt_type;	/* layout of the segments */
+	uint8_t		rt_shift;	/* segment units are 2^rt_shift */
+	uint64_t	rt_start;	/* segments are relative to this */
 	range_tree_ops_t *rt_ops;
 	void		*rt_arg;
 
@@ -56,12 +73,98 @@ typedef struct range_tree {
 	kmutex_t	*rt_lock;	/* pointer to lock that protects map */
 } range_tree_t;
 
-typedef struct range_seg {
-	avl_node_t	rs_node;	/* AVL node */
-	avl_node_t	rs_pp_node;	/* AVL picker-private node */
+typedef struct range_seg32 {
+	uint32_t	rs_start;	/* starting offset of this segment */
+	uint32_t	rs_end;		/* ending offset (non-inclusive) */
+} range_seg32_t;
+
+typedef struct range_seg64 {
 	uint64_t	rs_start;	/* starting offset of this segment */
 	uint64_t	rs_end;		/* ending offset (non-inclusive) */
-} range_seg_t;
+} range_seg64_t;
+
+/*
+ * A segment of any of the types, or a buffer large enough for one.
+ */
+typedef void range_seg_t;
+typedef range_seg64_t range_seg_max_t;
+
+static inline uint64_t
+rs_get_start_raw(const range_seg_t *rs, const range_tree_t *rt)
+{
+	if (rt->rt_type == RANGE_SEG32)
+		return (((const range_seg32_t *)rs)->rs_start);
+	ASSERT3U(rt->rt_type, ==, RANGE_SEG64);
+	return (((const range_seg64_t *)rs)->rs_start);
+}
+
+static inline uint64_t
+rs_get_end_raw(const range_seg_t *rs, const range_tree_t *rt)
+{
+	if (rt->rt_type == RANGE_SEG32)
+		return (((const range_seg32_t *)rs)->rs_end);
+	ASSERT3U(rt->rt_type, ==, RANGE_SEG64);
+	return (((const range_seg64_t *)rs)->rs_end);
+}
+
+static inline void
+rs_set_start_raw(range_seg_t *rs, const range_tree_t *rt, uint64_t start)
+{
+	if (rt->rt_type == RANGE_SEG32) {
+		ASSERT3U(start, <=, UINT32_MAX);
+		((range_seg32_t *)rs)->rs_start = (uint32_t)start;
+	} else {
+		ASSERT3U(rt->rt_type, ==, RANGE_SEG64);
+		((range_seg64_t *)rs)->rs_start = start;
+	}
+}
+
+static inline void
+rs_set_end_raw(range_seg_t *rs, const range_tree_t *rt, uint64_t end)
+{
+	if (rt->rt_type == RANGE_SEG32) {
+		ASSERT3U(end, <=, UINT32_MAX);
+		((range_seg32_t *)rs)->rs_end = (uint32_t)end;
+	} else {
+		ASSERT3U(rt->rt_type, ==, RANGE_SEG64);
+		((range_seg64_t *)rs)->rs_end = end;
+	}
+}
+
+static inline uint64_t
+rs_get_start(const range_seg_t *rs, const range_tree_t *rt)
+{
+	return ((rs_get_start_raw(rs, rt) << rt->rt_shift) + rt->rt_start);
+}
+
+static inline uint64_t
+rs_get_end(const range_seg_t *rs, const range_tree_t *rt)
+{
+	return ((rs_get_end_raw(rs, rt) << rt->rt_shift) + rt->rt_start);
+}
+
+static inline void
+rs_set_start(range_seg_t *rs, const range_tree_t *rt, uint64_t start)
+{
+	ASSERT3U(start, >=, rt->rt_start);
+	ASSERT(IS_P2ALIGNED(start - rt->rt_start, 1ULL << rt->rt_shift));
+	rs_set_start_raw(rs, rt, (start - rt->rt_start) >> rt->rt_shift);
+}
+
+static inline void
+rs_set_end(range_seg_t *rs, const range_tree_t *rt, uint64_t end)
+{
+	ASSERT3U(end, >=, rt->rt_start);
+	ASSERT(IS_P2ALIGNED(end - rt->rt_start, 1ULL << rt->rt_shift));
+	rs_set_end_raw(rs, rt, (end - rt->rt_start) >> rt->rt_shift);
+}
+
+static inline size_t
+range_seg_size(range_seg_type_t type)
+{
+	return (type == RANGE_SEG32 ?
+	    sizeof (range_seg32_t) : sizeof (range_seg64_t));
+}
 
 struct range_tree_ops {
 	void    (*rtop_create)(range_tree_t *rt, void *arg);
@@ -73,12 +176,17 @@ struct range_tree_ops {
 
 typedef void range_tree_func_t(void *arg, uint64_t start, uint64_t size);
 
-void range_tree_init(void);
-void range_tree_fini(void);
+range_tree_t *range_tree_create_impl(range_tree_ops_t *ops,
+    range_seg_type_t type, void *arg, uint64_t start, uint64_t shift,
+    kmutex_t *lp);
 range_tree_t *range_tree_create(range_tree_ops_t *ops, void *arg, kmutex_t *lp);
 void range_tree_destroy(range_tree_t *rt);
 boolean_t range_tree_contains(range_tree_t *rt, uint64_t start, uint64_t size);
 uint64_t range_tree_space(range_tree_t *rt);
+uint64_t range_tree_numsegs(range_tree_t *rt);
+boolean_t range_tree_is_empty(range_tree_t *rt);
+uint64_t range_tree_min(range_tree_t *rt);
+uint64_t range_tree_max(range_tree_t *rt);
 void range_tree_verify(range_tree_t *rt, uint64_t start, uint64_t size);
 void range_tree_swap(range_tree_t **rtsrc, range_tree_t **rtdst);
 void range_tree_stat_verify(range_tree_t *rt);
@@ -86,6 +194,10 @@ void range_tree_stat_verify(range_tree_t *rt);
 void range_tree_add(void *arg, uint64_t start, uint64_t size);
 void range_tree_remove(void *arg, uint64_t start, uint64_t size);
 void range_tree_clear(range_tree_t *rt, uint64_t start, uint64_t size);
+void range_tree_remove_xor_add_segment(uint64_t start, uint64_t end,
+    range_tree_t *removefrom, range_tree_t *addto);
+void range_tree_remove_xor_add(range_tree_t *rt, range_tree_t *removefrom,
+    range_tree_t *addto);
 
 void range_tree_vacate(range_tree_t *rt, range_tree_func_t *func, void *arg);
 void range_tree_walk(range_tree_t *rt, range_tree_func_t *func, void *arg);
@@ -0,0 +1,207 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SIMD support for x86_64 / i386.
+ *
+ * The zfs_*_available() functions report whether an instruction set
+ * can be used in the current context: the CPU must advertise it through
+ * cpuid and, for the AVX family, the matching register state must be
+ * enabled in XCR0.  Only instruction sets the toolchain can assemble
+ * (HAVE_* from configure) are ever reported as available.
+ *
+ * Code using SIMD registers must be bracketed with kfpu_begin() and
+ * kfpu_end().  xnu saves and restores the complete FPU/SIMD state of a
+ * thread on context switch, so nothing extra is needed in the kernel;
+ * the macros mark the regions for ports where that is not the case.
+ */
+
+#ifndef _SYS_SIMD_H
+#define	_SYS_SIMD_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	kfpu_begin()	do {} while (0)
+#define	kfpu_end()	do {} while (0)
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__i386) || \
+	defined(__i386__)
+
+#define	SIMD_CPUID1_ECX_SSSE3	(1U << 9)
+#define	SIMD_CPUID1_ECX_OSXSAVE	(1U << 27)
+#define	SIMD_CPUID1_ECX_AVX	(1U << 28)
+#define	SIMD_CPUID1_EDX_SSE2	(1U << 26)
+#define	SIMD_CPUID7_EBX_AVX2	(1U << 5)
+#define	SIMD_CPUID7_EBX_AVX512F	(1U << 16)
+#define	SIMD_CPUID7_EBX_AVX512BW	(1U << 30)
+
+#define	SIMD_XCR0_SSE		(1ULL << 1)
+#define	SIMD_XCR0_YMM		(1ULL << 2)
+#define	SIMD_XCR0_OPMASK	(1ULL << 5)
+#define	SIMD_XCR0_ZMM_HI256	(1ULL << 6)
+#define	SIMD_XCR0_HI16_ZMM	(1ULL << 7)
+
+#define	SIMD_XCR0_AVX		(SIMD_XCR0_SSE | SIMD_XCR0_YMM)
+#define	SIMD_XCR0_AVX512	(SIMD_XCR0_AVX | SIMD_XCR0_OPMASK | \
+	SIMD_XCR0_ZMM_HI256 | SIMD_XCR0_HI16_ZMM)
+
+static inline void
+__simd_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx,
+    uint32_t *ecx, uint32_t *edx)
+{
+	__asm__ __volatile__("cpuid"
+	    : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+	    : "a" (leaf), "c" (subleaf));
+}
+
+static inline uint32_t
+__simd_cpuid_max_leaf(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	__simd_cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+	return (eax);
+}
+
+static inline boolean_t
+__simd_leaf1(uint32_t *ecx, uint32_t *edx)
+{
+	uint32_t eax, ebx;
+
+	if (__simd_cpuid_max_leaf() < 1)
+		return (B_FALSE);
+
+	__simd_cpuid(1, 0, &eax, &ebx, ecx, edx);
+	return (B_TRUE);
+}
+
+static inline uint32_t
+__simd_leaf7_ebx(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	if (__simd_cpuid_max_leaf() < 7)
+		return (0);
+
+	__simd_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+	return (ebx);
+}
+
+/*
+ * Check that the OS has enabled the given register state in XCR0.
+ */
+static inline boolean_t
+__simd_xcr0_enabled(uint64_t state)
+{
+	uint32_t ecx, edx, xlo, xhi;
+
+	if (!__simd_leaf1(&ecx, &edx))
+		return (B_FALSE);
+	if ((ecx & (SIMD_CPUID1_ECX_OSXSAVE | SIMD_CPUID1_ECX_AVX)) !=
+	    (SIMD_CPUID1_ECX_OSXSAVE | SIMD_CPUID1_ECX_AVX))
+		return (B_FALSE);
+
+	__asm__ __volatile__("xgetbv" : "=a" (xlo), "=d" (xhi) : "c" (0));
+
+	return (((((uint64_t)xhi << 32) | xlo) & state) == state);
+}
+
+static inline boolean_t
+zfs_sse2_available(void)
+{
+#if defined(HAVE_SSE2)
+	uint32_t ecx, edx;
+
+	return (__simd_leaf1(&ecx, &edx) &&
+	    (edx & SIMD_CPUID1_EDX_SSE2) != 0);
+#else
+	return (B_FALSE);
+#endif
+}
+
+static inline boolean_t
+zfs_ssse3_available(void)
+{
+#if defined(HAVE_SSSE3)
+	uint32_t ecx, edx;
+
+	return (__simd_leaf1(&ecx, &edx) &&
+	    (ecx & SIMD_CPUID1_ECX_SSSE3) != 0);
+#else
+	return (B_FALSE);
+#endif
+}
+
+static inline boolean_t
+zfs_avx2_available(void)
+{
+#if defined(HAVE_AVX2)
+	return ((__simd_leaf7_ebx() & SIMD_CPUID7_EBX_AVX2) != 0 &&
+	    __simd_xcr0_enabled(SIMD_XCR0_AVX));
+#else
+	return (B_FALSE);
+#endif
+}
+
+static inline boolean_t
+zfs_avx512f_available(void)
+{
+#if defined(HAVE_AVX512F)
+	return ((__simd_leaf7_ebx() & SIMD_CPUID7_EBX_AVX512F) != 0 &&
+	    __simd_xcr0_enabled(SIMD_XCR0_AVX512));
+#else
+	return (B_FALSE);
+#endif
+}
+
+static inline boolean_t
+zfs_avx512bw_available(void)
+{
+#if defined(HAVE_AVX512BW)
+	uint32_t ebx = __simd_leaf7_ebx();
+
+	return ((ebx & SIMD_CPUID7_EBX_AVX512F) != 0 &&
+	    (ebx & SIMD_CPUID7_EBX_AVX512BW) != 0 &&
+	    __simd_xcr0_enabled(SIMD_XCR0_AVX512));
+#else
+	return (B_FALSE);
+#endif
+}
+
+#else	/* !x86 */
+
+#define	zfs_sse2_available()	(B_FALSE)
+#define	zfs_ssse3_available()	(B_FALSE)
+#define	zfs_avx2_available()	(B_FALSE)
+#define	zfs_avx512f_available()	(B_FALSE)
+#define	zfs_avx512bw_available()	(B_FALSE)
+
+#endif	/* x86 */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _SYS_SIMD_H */
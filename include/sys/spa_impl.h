@@ -34,6 +34,7 @@
 #include <sys/spa.h>
 #include <sys/vdev.h>
 #include <sys/metaslab.h>
+#include <sys/space_map.h>
 #include <sys/dmu.h>
 #include <sys/dsl_pool.h>
 #include <sys/uberblock_impl.h>
@@ -153,6 +154,8 @@ struct spa {
 	boolean_t	spa_is_initializing;	/* true while opening pool */
 	metaslab_class_t *spa_normal_class;	/* normal data class */
 	metaslab_class_t *spa_log_class;	/* intent log data class */
+	metaslab_class_t *spa_special_class;	/* special allocation class */
+	metaslab_class_t *spa_dedup_class;	/* dedup allocation class */
 	uint64_t	spa_first_txg;		/* first txg after spa_open() */
 	uint64_t	spa_final_txg;		/* txg of export/destroy */
 	uint64_t	spa_freeze_txg;		/* freeze pool at this txg */
@@ -174,6 +177,14 @@ struct spa {
 	list_t		spa_state_dirty_list;	/* vdevs with dirty state */
 	kmutex_t	spa_alloc_lock;
 	avl_tree_t	spa_alloc_tree;
+	/* log space maps, see spa_log_spacemap.c */
+	uint64_t	spa_log_sm_zap;		/* txg -> log space map */
+	space_map_t	*spa_syncing_log_sm;	/* log of the syncing txg */
+	kmutex_t	spa_log_sm_lock;	/* protects the below */
+	avl_tree_t	spa_metaslabs_by_flushed; /* by oldest change */
+	list_t		spa_log_sm_list;	/* spa_log_sm_t, oldest first */
+	uint64_t	spa_log_sm_nblocks;	/* blocks of all logs */
+	uint64_t	spa_unflushed_segs;	/* unflushed segments */
 	spa_aux_vdev_t	spa_spares;		/* hot spares */
 	spa_aux_vdev_t	spa_l2cache;		/* L2ARC cache devices */
 	nvlist_t	*spa_label_features;	/* Features for reading MOS */
@@ -202,6 +213,7 @@ struct spa {
 	uint64_t	spa_scan_pass_scrub_pause; /* scrub pause time */
 	uint64_t	spa_scan_pass_scrub_spent_paused; /* total paused */
 	uint64_t	spa_scan_pass_exam;	/* examined bytes per pass */
+	uint64_t	spa_scan_pass_issued;	/* issued bytes per pass */
 	kmutex_t	spa_async_lock;		/* protect async state */
 	kthread_t	*spa_async_thread;	/* thread doing async task */
 	int		spa_async_suspended;	/* async tasks suspended */
@@ -246,9 +258,14 @@ struct spa {
 	int		spa_mode;		/* FREAD | FWRITE */
 	spa_log_state_t spa_log_state;		/* log state */
 	uint64_t	spa_autoexpand;		/* lun expansion on/off */
+	uint64_t	spa_autotrim;		/* automatic trim on/off */
 	ddt_t		*spa_ddt[ZIO_CHECKSUM_FUNCTIONS]; /* in-core DDTs */
 	uint64_t	spa_ddt_stat_object;	/* DDT statistics */
 	uint64_t	spa_dedup_ditto;	/* dedup ditto threshold */
+	uint64_t	spa_dedup_table_quota;	/* DDT size quota, 0 = none */
+	uint64_t	spa_dedup_dsize;	/* DDT on-disk size */
+	uint64_t	spa_ddt_pruned;		/* DDT entries pruned */
+	uint64_t	spa_ddt_sample_time;	/* last txg/time sample */
 	uint64_t	spa_dedup_checksum;	/* default dedup checksum */
 	uint64_t	spa_dspace;		/* dspace in normal class */
 	kmutex_t	spa_vdev_top_lock;	/* dueling offline/remove */
@@ -0,0 +1,91 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_SPA_LOG_SPACEMAP_H
+#define	_SYS_SPA_LOG_SPACEMAP_H
+
+#include <sys/avl.h>
+#include <sys/list.h>
+#include <sys/spa.h>
+#include <sys/space_map.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-core summary of one log space map of the pool.
+ */
+typedef struct spa_log_sm {
+	uint64_t	sls_txg;	/* txg the log was written in */
+	uint64_t	sls_sm_obj;	/* space map object of the log */
+	uint64_t	sls_nblocks;	/* blocks of the log */
+	list_node_t	sls_node;	/* spa_log_sm_list */
+} spa_log_sm_t;
+
+typedef struct log_spacemap_stats {
+	kstat_named_t	lsms_logs;
+	kstat_named_t	lsms_blocks;
+	kstat_named_t	lsms_unflushed_metaslabs;
+	kstat_named_t	lsms_unflushed_segments;
+	kstat_named_t	lsms_bytes_written;
+	kstat_named_t	lsms_metaslabs_logged;
+	kstat_named_t	lsms_metaslabs_flushed;
+	kstat_named_t	lsms_logged_sync_ns;
+	kstat_named_t	lsms_flushed_sync_ns;
+} log_spacemap_stats_t;
+
+extern log_spacemap_stats_t log_spacemap_stats;
+
+#define	LSMS_STAT_INCR(stat, val) \
+	atomic_add_64(&log_spacemap_stats.stat.value.ui64, (val))
+#define	LSMS_STAT_BUMP(stat) \
+	LSMS_STAT_INCR(stat, 1)
+
+extern uint64_t zfs_unflushed_max_mem_amt;
+extern uint64_t zfs_unflushed_log_block_max;
+extern uint64_t zfs_min_metaslabs_to_flush;
+extern uint64_t zfs_max_metaslabs_to_flush;
+
+extern void spa_log_sm_init(void);
+extern void spa_log_sm_fini(void);
+
+extern void spa_log_sm_create(spa_t *spa);
+extern void spa_log_sm_destroy(spa_t *spa);
+
+extern boolean_t spa_log_sm_enabled(spa_t *spa);
+extern void spa_flush_metaslabs(spa_t *spa, dmu_tx_t *tx);
+extern void spa_log_sm_write(spa_t *spa, range_tree_t *rt, maptype_t maptype,
+    uint64_t vdev, dmu_tx_t *tx);
+extern void spa_log_sm_sync_done(spa_t *spa, uint64_t txg);
+
+extern void spa_log_sm_metaslab_logged(metaslab_t *msp, uint64_t txg);
+extern void spa_log_sm_metaslab_flushed(metaslab_t *msp);
+extern void spa_log_sm_segments_update(spa_t *spa, int64_t delta);
+
+extern int spa_ld_log_spacemaps(spa_t *spa);
+extern void spa_unload_log_sm(spa_t *spa);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SPA_LOG_SPACEMAP_H */
@@ -58,7 +58,8 @@ typedef struct space_map_phys {
 	uint64_t	smp_object;	/* on-disk space map object */
 	uint64_t	smp_objsize;	/* size of the object */
 	uint64_t	smp_alloc;	/* space allocated from the map */
-	uint64_t	smp_pad[5];	/* reserved */
+	uint64_t	smp_flush_txg;	/* see space_map_flush_txg() */
+	uint64_t	smp_pad[4];	/* reserved */
 
 	/*
 	 * The smp_histogram maintains a histogram of free regions. Each
@@ -128,12 +129,44 @@ typedef struct space_map {
 
 #define	SM_RUN_MAX			SM_RUN_DECODE(~0ULL)
 
+/*
+ * log space map entry, two words (see spa_log_spacemap.c)
+ *
+ *    1          24                            39
+ *  ,------+---------------+---------------------------------------.
+ *  | type |     vdev      |     run (SPA_MINBLOCKSIZE units)        |
+ *  `------+---------------+---------------------------------------'
+ *    63    62           39 38                                      0
+ *
+ *  ,-------------------------------------------------------------.
+ *  |                offset (SPA_MINBLOCKSIZE units)                |
+ *  `-------------------------------------------------------------'
+ *   63                                                           0
+ */
+#define	SM_LOG_RUN_DECODE(x)	(BF64_DECODE(x, 0, 39) + 1)
+#define	SM_LOG_RUN_ENCODE(x)	BF64_ENCODE((x) - 1, 0, 39)
+#define	SM_LOG_VDEV_DECODE(x)	BF64_DECODE(x, 39, 24)
+#define	SM_LOG_VDEV_ENCODE(x)	BF64_ENCODE(x, 39, 24)
+#define	SM_LOG_TYPE_DECODE(x)	BF64_DECODE(x, 63, 1)
+#define	SM_LOG_TYPE_ENCODE(x)	BF64_ENCODE(x, 63, 1)
+
+#define	SM_LOG_RUN_MAX			SM_LOG_RUN_DECODE(~0ULL)
+#define	SM_LOG_VDEV_MAX			SM_LOG_VDEV_DECODE(~0ULL)
+
 typedef enum {
 	SM_ALLOC,
 	SM_FREE
 } maptype_t;
 
+/*
+ * Callback for space_map_iterate_log(), called for every entry of a log
+ * space map in the order they were written.
+ */
+typedef int (*sm_log_cb_t)(maptype_t maptype, uint64_t vdev, uint64_t offset,
+    uint64_t size, void *arg);
+
 int space_map_load(space_map_t *sm, range_tree_t *rt, maptype_t maptype);
+int space_map_iterate_log(space_map_t *sm, sm_log_cb_t callback, void *arg);
 
 void space_map_histogram_clear(space_map_t *sm);
 void space_map_histogram_add(space_map_t *sm, range_tree_t *rt,
@@ -144,9 +177,13 @@ void space_map_update(space_map_t *sm);
 uint64_t space_map_object(space_map_t *sm);
 uint64_t space_map_allocated(space_map_t *sm);
 uint64_t space_map_length(space_map_t *sm);
+uint64_t space_map_flush_txg(space_map_t *sm);
+void space_map_set_flush_txg(space_map_t *sm, uint64_t txg, dmu_tx_t *tx);
 
 void space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
     dmu_tx_t *tx);
+void space_map_write_log(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
+    uint64_t vdev, dmu_tx_t *tx);
 void space_map_truncate(space_map_t *sm, dmu_tx_t *tx);
 uint64_t space_map_alloc(objset_t *os, dmu_tx_t *tx);
 void space_map_free(space_map_t *sm, dmu_tx_t *tx);
@@ -131,6 +131,7 @@ extern zio_t *vdev_queue_io(zio_t *zio);
 extern void vdev_queue_io_done(zio_t *zio);
 
 extern int vdev_queue_length(vdev_t *vd);
+extern uint32_t vdev_queue_max_active(vdev_t *vd, zio_priority_t p);
 extern uint64_t vdev_queue_lastoffset(vdev_t *vd);
 extern void vdev_queue_register_lastoffset(vdev_t *vd, zio_t *zio);
 
@@ -110,6 +110,22 @@ struct vdev_cache {
 typedef struct vdev_queue_class {
 	uint32_t	vqc_active;
 
+	/*
+	 * Adaptive max_active controller state, see vdev_queue_adapt().
+	 */
+	uint32_t	vqc_max_active;	/* current adaptive limit */
+	uint32_t	vqc_adapt_ios;	/* completions since last adjustment */
+	uint64_t	vqc_lat_avg;	/* average disk service time (ns) */
+	uint64_t	vqc_increases;	/* times the limit was raised */
+	uint64_t	vqc_decreases;	/* times the limit was lowered */
+
+	/*
+	 * Aggregated i/os issued, and the bytes they did not have to copy
+	 * because they were issued from a gang ABD.
+	 */
+	uint64_t	vqc_agg_ios;
+	uint64_t	vqc_agg_copy_saved;
+
 	/*
 	 * Sorted by offset or timestamp, depending on if the queue is
 	 * LBA-ordered vs FIFO.
@@ -123,6 +139,7 @@ struct vdev_queue {
 	avl_tree_t	vq_active_tree;
 	avl_tree_t	vq_read_offset_tree;
 	avl_tree_t	vq_write_offset_tree;
+	avl_tree_t	vq_trim_offset_tree;
 	uint64_t	vq_last_offset;
 	hrtime_t	vq_io_complete_ts; /* time last i/o completed */
 	hrtime_t	vq_io_delta_ts;
@@ -131,6 +148,16 @@ struct vdev_queue {
 	uint64_t	vq_lastoffset;
 };
 
+/*
+ * Which metaslab class a top-level vdev allocates for.
+ */
+typedef enum vdev_alloc_bias {
+	VDEV_BIAS_NONE,
+	VDEV_BIAS_LOG,		/* dedicated to ZIL data (SLOG) */
+	VDEV_BIAS_SPECIAL,	/* dedicated to metadata and small blocks */
+	VDEV_BIAS_DEDUP		/* dedicated to dedup metadata */
+} vdev_alloc_bias_t;
+
 /*
  * Virtual device descriptor
  */
@@ -162,6 +189,17 @@ struct vdev {
 	boolean_t	vdev_expanding;	/* expand the vdev?		*/
 	boolean_t	vdev_reopening;	/* reopen in progress?		*/
 	boolean_t	vdev_nonrot;	/* true if solid state		*/
+
+	/*
+	 * Read statistics kept by a parent mirror for this child, used to
+	 * steer reads towards the fastest child (see vdev_mirror_load()).
+	 */
+	uint64_t	vdev_mirror_reads; /* reads directed to this child */
+	uint64_t	vdev_mirror_read_lat; /* total read latency (ns) */
+	uint64_t	vdev_mirror_lat_avg; /* average read latency (ns) */
+	uint64_t	vdev_mirror_size_avg; /* average read size	*/
+	uint64_t	vdev_mirror_inflight; /* bytes of reads in flight */
+	hrtime_t	vdev_mirror_sampled; /* time of last latency sample */
 	int		vdev_open_error; /* error on last open		*/
 	kthread_t	*vdev_open_thread; /* thread opening children	*/
 	uint64_t	vdev_crtxg;	/* txg when top-level was added */
@@ -175,6 +213,10 @@ struct vdev {
 	metaslab_group_t *vdev_mg;	/* metaslab group		*/
 	metaslab_t	**vdev_ms;	/* metaslab array		*/
 	uint64_t	vdev_pending_fastwrite; /* allocated fastwrites */
+	uint64_t	vdev_zil_writes; /* lwbs written to this vdev	*/
+	uint64_t	vdev_zil_bytes;	/* bytes of lwbs written	*/
+	uint64_t	vdev_zil_lat;	/* total lwb write latency (ns)	*/
+	uint64_t	vdev_zil_lat_max; /* slowest lwb write (ns)	*/
 	txg_list_t	vdev_ms_list;	/* per-txg dirty metaslab lists	*/
 	txg_list_t	vdev_dtl_list;	/* per-txg dirty DTL lists	*/
 	txg_node_t	vdev_txg_node;	/* per-txg dirty vdev linkage	*/
@@ -184,6 +226,7 @@ struct vdev {
 	list_node_t	vdev_state_dirty_node; /* state dirty list	*/
 	uint64_t	vdev_deflate_ratio; /* deflation ratio (x512)	*/
 	uint64_t	vdev_islog;	/* is an intent log device	*/
+	vdev_alloc_bias_t vdev_alloc_bias; /* metaslab class bias	*/
 	uint64_t	vdev_removing;	/* device is being removed?	*/
 	boolean_t	vdev_ishole;	/* is a hole in the namespace	*/
 	kmutex_t	vdev_queue_lock; /* protects vdev_queue_depth	*/
@@ -199,6 +242,28 @@ struct vdev {
 	uint64_t	vdev_async_write_queue_depth;
 	uint64_t	vdev_max_async_write_queue_depth;
 
+	/*
+	 * Sorted scrub/resilver I/O waiting to be issued to this top-level
+	 * vdev, see dsl_scan.c.
+	 */
+	struct dsl_scan_io_queue *vdev_scan_io_queue;
+	kmutex_t	vdev_scan_io_queue_lock;
+
+	/*
+	 * Manual ("zpool trim") and automatic trim of this top-level vdev,
+	 * see vdev_trim.c.  Protected by vdev_trim_lock, except for
+	 * vdev_trim_inflight which is protected by vdev_trim_io_lock.
+	 */
+	kthread_t	*vdev_trim_thread;
+	kthread_t	*vdev_autotrim_thread;
+	boolean_t	vdev_trim_exit_wanted;
+	boolean_t	vdev_autotrim_exit_wanted;
+	vdev_trim_state_t vdev_trim_state;
+	uint64_t	vdev_trim_rate;	/* bytes per second, 0 if unlimited */
+	uint64_t	vdev_trim_offset; /* manual trim progress */
+	time_t		vdev_trim_action_time;
+	uint64_t	vdev_trim_inflight;
+
 	/*
 	 * Leaf vdev state.
 	 */
@@ -221,6 +286,7 @@ struct vdev {
 	uint64_t	vdev_not_present; /* not present during import	*/
 	uint64_t	vdev_unspare;	/* unspare when resilvering done */
 	boolean_t	vdev_nowritecache; /* true if flushwritecache failed */
+	boolean_t	vdev_notrim;	/* true if trim failed		*/
 	boolean_t	vdev_checkremove; /* temporary online test	*/
 	boolean_t	vdev_forcefault; /* force online fault		*/
 	boolean_t	vdev_splitting;	/* split or repair in progress  */
@@ -248,6 +314,10 @@ struct vdev {
 	kmutex_t	vdev_dtl_lock;	/* vdev_dtl_{map,resilver}	*/
 	kmutex_t	vdev_stat_lock;	/* vdev_stat			*/
 	kmutex_t	vdev_probe_lock; /* protects vdev_probe_zio	*/
+	kmutex_t	vdev_trim_lock;	/* trim thread state		*/
+	kcondvar_t	vdev_trim_cv;
+	kmutex_t	vdev_trim_io_lock; /* vdev_trim_inflight	*/
+	kcondvar_t	vdev_trim_io_cv;
 };
 
 #define	VDEV_RAIDZ_MAXPARITY	3
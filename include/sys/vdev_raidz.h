@@ -0,0 +1,73 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_RAIDZ_H
+#define	_SYS_VDEV_RAIDZ_H
+
+#include <sys/types.h>
+#include <sys/abd.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+struct raidz_map;
+
+/*
+ * RAID-Z parity implementations, selected with zfs_vdev_raidz_impl.
+ * "original" is the byte-at-a-time code that predates the vectorized
+ * implementations and is never chosen as the fastest.
+ */
+typedef enum raidz_impl_id {
+	RAIDZ_IMPL_FASTEST = 0,
+	RAIDZ_IMPL_ORIGINAL,
+	RAIDZ_IMPL_SCALAR,
+	RAIDZ_IMPL_SSE2,
+	RAIDZ_IMPL_SSSE3,
+	RAIDZ_IMPL_AVX2,
+	RAIDZ_IMPL_AVX512BW,
+	RAIDZ_IMPL_MAX
+} raidz_impl_id_t;
+
+extern uint64_t zfs_vdev_raidz_impl;
+
+/*
+ * vdev_raidz_math
+ */
+extern void vdev_raidz_math_init(void);
+extern void vdev_raidz_math_fini(void);
+extern int vdev_raidz_impl_set(uint64_t);
+
+/*
+ * Map allocation, parity generation and reconstruction.  These are used
+ * by the RAID-Z vdev and by the raidz_test utility.
+ */
+extern struct raidz_map *vdev_raidz_map_alloc(abd_t *, uint64_t, uint64_t,
+    uint64_t, uint64_t, uint64_t);
+extern void vdev_raidz_map_free(struct raidz_map *);
+extern void vdev_raidz_generate_parity(struct raidz_map *);
+extern int vdev_raidz_reconstruct(struct raidz_map *, int *, int);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_VDEV_RAIDZ_H */
@@ -0,0 +1,174 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright (c) 2005, 2010, Oracle and/or its affiliates. All rights reserved.
+ * Copyright (c) 2012, 2017 by Delphix. All rights reserved.
+ */
+
+#ifndef _SYS_VDEV_RAIDZ_IMPL_H
+#define	_SYS_VDEV_RAIDZ_IMPL_H
+
+#include <sys/types.h>
+#include <sys/abd.h>
+#include <sys/vdev_raidz.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef struct raidz_col {
+	uint64_t rc_devidx;		/* child device index for I/O */
+	uint64_t rc_offset;		/* device offset */
+	uint64_t rc_size;		/* I/O size */
+	abd_t *rc_abd;			/* I/O data */
+	void *rc_gdata;			/* used to store the "good" version */
+	int rc_error;			/* I/O error for this device */
+	uint8_t rc_tried;		/* Did we attempt this I/O column? */
+	uint8_t rc_skipped;		/* Did we skip this I/O column? */
+} raidz_col_t;
+
+typedef struct raidz_map {
+	uint64_t rm_cols;		/* Regular column count */
+	uint64_t rm_scols;		/* Count including skipped columns */
+	uint64_t rm_bigcols;		/* Number of oversized columns */
+	uint64_t rm_asize;		/* Actual total I/O size */
+	uint64_t rm_missingdata;	/* Count of missing data devices */
+	uint64_t rm_missingparity;	/* Count of missing parity devices */
+	uint64_t rm_firstdatacol;	/* First data column/parity count */
+	uint64_t rm_nskip;		/* Skipped sectors for padding */
+	uint64_t rm_skipstart;		/* Column index of padding start */
+	abd_t *rm_abd_copy;		/* rm_asize-buffer of copied data */
+	uintptr_t rm_reports;		/* # of referencing checksum reports */
+	uint8_t	rm_freed;		/* map no longer has referencing ZIO */
+	uint8_t	rm_ecksuminjected;	/* checksum error was injected */
+	raidz_col_t rm_col[1];		/* Flexible array of I/O columns */
+} raidz_map_t;
+
+#define	VDEV_RAIDZ_P		0
+#define	VDEV_RAIDZ_Q		1
+#define	VDEV_RAIDZ_R		2
+
+#define	VDEV_RAIDZ_MUL_2(x)	(((x) << 1) ^ (((x) & 0x80) ? 0x1d : 0))
+#define	VDEV_RAIDZ_MUL_4(x)	(VDEV_RAIDZ_MUL_2(VDEV_RAIDZ_MUL_2(x)))
+
+/*
+ * We provide a mechanism to perform the field multiplication operation on a
+ * 64-bit value all at once rather than a byte at a time. This works by
+ * creating a mask from the top bit in each byte and using that to
+ * conditionally apply the XOR of 0x1d.
+ */
+#define	VDEV_RAIDZ_64MUL_2(x, mask) \
+{ \
+	(mask) = (x) & 0x8080808080808080ULL; \
+	(mask) = ((mask) << 1) - ((mask) >> 7); \
+	(x) = (((x) << 1) & 0xfefefefefefefefeULL) ^ \
+	    ((mask) & 0x1d1d1d1d1d1d1d1dULL); \
+}
+
+#define	VDEV_RAIDZ_64MUL_4(x, mask) \
+{ \
+	VDEV_RAIDZ_64MUL_2((x), mask); \
+	VDEV_RAIDZ_64MUL_2((x), mask); \
+}
+
+/*
+ * Vectorized parity kernels.  Every kernel works on linear buffers whose
+ * size is a multiple of RAIDZ_MATH_BLOCK bytes; vdev_raidz_math.c feeds
+ * them ABD chunks and finishes any remainder with the scalar kernels.
+ *
+ *   gen_p:	P ^= D
+ *   gen_pq:	P ^= D, Q = 2 * Q + D
+ *   gen_pqr:	P ^= D, Q = 2 * Q + D, R = 4 * R + D
+ *   mul_add:	DST ^= c * SRC
+ *
+ * All arithmetic is in GF(2^8) as described in vdev_raidz.c.
+ */
+#define	RAIDZ_MATH_BLOCK	64
+
+typedef void raidz_gen_p_f(uint8_t *, const uint8_t *, size_t);
+typedef void raidz_gen_pq_f(uint8_t *, uint8_t *, const uint8_t *, size_t);
+typedef void raidz_gen_pqr_f(uint8_t *, uint8_t *, uint8_t *,
+    const uint8_t *, size_t);
+typedef void raidz_mul_add_f(uint8_t *, const uint8_t *, size_t, uint8_t);
+
+typedef struct raidz_impl_ops {
+	raidz_gen_p_f *gen_p;
+	raidz_gen_pq_f *gen_pq;
+	raidz_gen_pqr_f *gen_pqr;
+	raidz_mul_add_f *mul_add;
+	boolean_t (*is_supported)(void);
+	const char *name;
+} raidz_impl_ops_t;
+
+extern const raidz_impl_ops_t vdev_raidz_scalar_ops;
+extern const raidz_impl_ops_t vdev_raidz_sse2_ops;
+extern const raidz_impl_ops_t vdev_raidz_ssse3_ops;
+extern const raidz_impl_ops_t vdev_raidz_avx2_ops;
+extern const raidz_impl_ops_t vdev_raidz_avx512bw_ops;
+
+/*
+ * Multiply two elements of GF(2^8).
+ */
+static inline uint8_t
+vdev_raidz_gf_mul(uint8_t a, uint8_t b)
+{
+	uint8_t r = 0;
+
+	while (b != 0) {
+		if (b & 1)
+			r ^= a;
+		a = VDEV_RAIDZ_MUL_2(a);
+		b >>= 1;
+	}
+
+	return (r);
+}
+
+/*
+ * Build the two 16-entry tables for multiplying by c with a byte shuffle:
+ * c * x = lo[x & 0xf] ^ hi[x >> 4].
+ */
+static inline void
+vdev_raidz_gf_mul_tables(uint8_t c, uint8_t *lo, uint8_t *hi)
+{
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		lo[i] = vdev_raidz_gf_mul(c, i);
+		hi[i] = vdev_raidz_gf_mul(c, i << 4);
+	}
+}
+
+/*
+ * Returns the kernels selected by zfs_vdev_raidz_impl, or NULL when the
+ * original implementation in vdev_raidz.c should be used.
+ */
+extern const raidz_impl_ops_t *vdev_raidz_math_get_ops(void);
+extern void vdev_raidz_math_generate(const raidz_impl_ops_t *,
+    raidz_map_t *);
+extern void vdev_raidz_math_reconstruct(const raidz_impl_ops_t *,
+    raidz_map_t *, int, int, const int *, uint8_t **, const uint8_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_VDEV_RAIDZ_IMPL_H */
@@ -0,0 +1,58 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_TRIM_H
+#define	_SYS_VDEV_TRIM_H
+
+#include <sys/spa.h>
+#include <sys/fs/zfs.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+extern uint64_t zfs_trim_extent_bytes_max;
+extern uint64_t zfs_trim_extent_bytes_min;
+extern uint64_t zfs_trim_queue_limit;
+extern uint64_t zfs_trim_txg_batch;
+
+/*
+ * Manual trim of a top-level vdev ("zpool trim").
+ */
+extern int spa_trim(spa_t *spa, uint64_t guid, pool_trim_func_t func,
+    uint64_t rate);
+
+/*
+ * Automatic trim of freed space (the "autotrim" pool property).
+ */
+extern void vdev_autotrim_restart(spa_t *spa);
+
+/*
+ * Thread management when a top-level vdev goes away or is replaced.
+ */
+extern void vdev_trim_stop_wait(vdev_t *vd);
+extern void vdev_trim_xfer(vdev_t *svd, vdev_t *tvd);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_VDEV_TRIM_H */
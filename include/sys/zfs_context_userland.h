@@ -547,6 +547,7 @@ extern int vn_openat(char *path, int x1, int oflags, int mode, vnode_t **vpp,
 extern int vn_rdwr(int uio, vnode_t *vp, void *addr, ssize_t len,
     offset_t offset, int x1, int x2, rlim64_t x3, void *x4, ssize_t *residp);
 extern void vn_close(vnode_t *vp);
+extern int vn_punch_hole(vnode_t *vp, uint64_t offset, uint64_t size);
 
 #define	vn_remove(path, x1, x2)		remove(path)
 #define	vn_rename(from, to, seg)	rename((from), (to))
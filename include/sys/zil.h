@@ -131,6 +131,7 @@ typedef enum zil_create {
 /*
  * Intent log transaction types and record structures
  */
+#define	TX_COMMIT		0	/* Commit marker (no on-disk state) */
 #define	TX_CREATE		1	/* Create file */
 #define	TX_MKDIR		2	/* Make directory */
 #define	TX_MKXATTR		3	/* Make XATTR directory */
@@ -382,6 +383,10 @@ typedef struct itx {
 /*
  * Used for zil kstat.
  */
+#define	ZIL_COMMIT_LAT_SHIFT	10
+#define	ZIL_COMMIT_LAT_BUCKETS	24
+#define	ZIL_LWB_WAITERS_BUCKETS	12
+
 typedef struct zil_stats {
 	/*
 	 * Number of times a ZIL commit (e.g. fsync) has been requested.
@@ -429,6 +434,37 @@ typedef struct zil_stats {
 	 */
 	kstat_named_t zil_itx_metaslab_slog_count;
 	kstat_named_t zil_itx_metaslab_slog_bytes;
+
+	/*
+	 * Log write blocks issued to disk, and how many of those were
+	 * issued early because a commit waiter timed out waiting for the
+	 * open lwb to fill up.
+	 */
+	kstat_named_t zil_lwb_issued_count;
+	kstat_named_t zil_lwb_timeout_count;
+
+	/*
+	 * Number of times a commit had to fall back to txg_wait_synced(),
+	 * either because an lwb could not be allocated or because its
+	 * write failed.
+	 */
+	kstat_named_t zil_commit_stall_count;
+	kstat_named_t zil_commit_error_count;
+
+	/*
+	 * Histogram of zil_commit() latency: zil_commit_lat[i] counts the
+	 * commits that took 2^(i+10) to 2^(i+11) - 1 ns, the first bucket
+	 * also counts anything faster and the last anything slower.
+	 */
+	kstat_named_t zil_commit_lat[ZIL_COMMIT_LAT_BUCKETS];
+
+	/*
+	 * Histogram of the number of commit waiters signalled by each lwb:
+	 * zil_lwb_waiters[i] counts the lwbs with 2^(i-1) to 2^i - 1
+	 * waiters; a high count of lwbs with many waiters means commits
+	 * are being batched well.
+	 */
+	kstat_named_t zil_lwb_waiters[ZIL_LWB_WAITERS_BUCKETS];
 } zil_stats_t;
 
 extern zil_stats_t zil_stats;
@@ -446,8 +482,9 @@ typedef int (*zil_replay_func_t)(void *, char *, boolean_t);
 
 struct znode;
 struct rl;
-typedef int zil_get_data_t(void *arg, lr_write_t *lr, char *dbuf, zio_t *zio,
-						   struct znode *zp, struct rl *rl);
+struct lwb;
+typedef int zil_get_data_t(void *arg, lr_write_t *lr, char *dbuf,
+    struct lwb *lwb, zio_t *zio, struct znode *zp, struct rl *rl);
 
 extern int zil_parse(zilog_t *zilog, zil_parse_blk_func_t *parse_blk_func,
     zil_parse_lr_func_t *parse_lr_func, void *arg, uint64_t txg,
@@ -473,6 +510,7 @@ extern void	zil_itx_destroy(itx_t *itx);
 extern void	zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx);
 
 extern void	zil_commit(zilog_t *zilog, uint64_t oid);
+extern void	zil_commit_impl(zilog_t *zilog, uint64_t oid);
 
 extern int	zil_vdev_offline(const char *osname, void *txarg);
 extern int	zil_claim(struct dsl_pool *dp,
@@ -485,7 +523,7 @@ extern void	zil_clean(zilog_t *zilog, uint64_t synced_txg);
 extern int	zil_suspend(const char *osname, void **cookiep);
 extern void	zil_resume(void *cookie);
 
-extern void	zil_add_block(zilog_t *zilog, const blkptr_t *bp);
+extern void	zil_lwb_add_block(struct lwb *lwb, const blkptr_t *bp);
 extern int	zil_bp_tree_add(zilog_t *zilog, const blkptr_t *bp);
 
 extern void	zil_set_sync(zilog_t *zilog, uint64_t syncval);
@@ -493,6 +531,7 @@ extern void	zil_set_sync(zilog_t *zilog, uint64_t syncval);
 extern void	zil_set_logbias(zilog_t *zilog, uint64_t slogval);
 
 extern int zil_replay_disable;
+extern int zfs_commit_timeout_pct;
 
 #ifdef	__cplusplus
 }
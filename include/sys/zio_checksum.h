@@ -109,6 +109,8 @@ extern int zio_checksum_error(zio_t *zio, zio_bad_cksum_t *out);
 extern enum zio_checksum spa_dedup_checksum(spa_t *spa);
 extern void zio_checksum_templates_free(spa_t *spa);
 extern spa_feature_t zio_checksum_to_feature(enum zio_checksum cksum);
+extern void zio_checksum_init(void);
+extern void zio_checksum_fini(void);
 
 #ifdef	__cplusplus
 }
@@ -51,6 +51,65 @@ void fletcher_4_native(const void *, size_t, const void *, zio_cksum_t *);
 void fletcher_4_byteswap(const void *, size_t, const void *, zio_cksum_t *);
 int fletcher_4_incremental_native(void *, size_t, void *);
 int fletcher_4_incremental_byteswap(void *, size_t, void *);
+int fletcher_4_impl_set(uint64_t);
+void fletcher_4_init(void);
+void fletcher_4_fini(void);
+
+/*
+ * fletcher-4 implementation interface
+ *
+ * SIMD implementations run several interleaved fletcher-4 accumulators
+ * ("lanes") over the buffer; lane j sees words j, j + lanes, ...  The
+ * fini function folds the lanes back into a single checksum.  Compute
+ * functions are only handed multiples of FLETCHER_4_BLOCK_SIZE bytes.
+ */
+#define	FLETCHER_4_BLOCK_SIZE	64
+#define	FLETCHER_4_MAX_LANES	8
+
+typedef union fletcher_4_ctx {
+	zio_cksum_t scalar;
+	uint64_t simd[4][FLETCHER_4_MAX_LANES];	/* a, b, c, d per lane */
+} fletcher_4_ctx_t;
+
+typedef void (*fletcher_4_init_f)(fletcher_4_ctx_t *);
+typedef void (*fletcher_4_fini_f)(fletcher_4_ctx_t *, zio_cksum_t *);
+typedef void (*fletcher_4_compute_f)(fletcher_4_ctx_t *,
+    const void *, uint64_t);
+
+typedef struct fletcher_4_ops {
+	fletcher_4_init_f init_native;
+	fletcher_4_fini_f fini_native;
+	fletcher_4_compute_f compute_native;
+	fletcher_4_init_f init_byteswap;
+	fletcher_4_fini_f fini_byteswap;
+	fletcher_4_compute_f compute_byteswap;
+	boolean_t (*valid)(void);
+	const char *name;
+} fletcher_4_ops_t;
+
+/*
+ * Implementation ids, as used by the zfs_fletcher_4_impl tunable.
+ * FLETCHER_4_IMPL_FASTEST selects the benchmark winner.
+ */
+typedef enum fletcher_4_impl_id {
+	FLETCHER_4_IMPL_FASTEST = 0,
+	FLETCHER_4_IMPL_SCALAR,
+	FLETCHER_4_IMPL_SSE2,
+	FLETCHER_4_IMPL_SSSE3,
+	FLETCHER_4_IMPL_AVX2,
+	FLETCHER_4_IMPL_AVX512F,
+	FLETCHER_4_IMPL_MAX
+} fletcher_4_impl_id_t;
+
+extern uint64_t zfs_fletcher_4_impl;
+
+void fletcher_4_simd_init(fletcher_4_ctx_t *);
+void fletcher_4_simd_fini(const fletcher_4_ctx_t *, int, zio_cksum_t *);
+
+extern const fletcher_4_ops_t fletcher_4_sse2_ops;
+extern const fletcher_4_ops_t fletcher_4_ssse3_ops;
+extern const fletcher_4_ops_t fletcher_4_avx2_ops;
+extern const fletcher_4_ops_t fletcher_4_avx512f_ops;
 
 #ifdef	__cplusplus
 }
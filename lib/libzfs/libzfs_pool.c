@@ -312,6 +312,7 @@ zpool_get_prop(zpool_handle_t *zhp, zpool_prop_t prop, char *buf,
 		case ZPOOL_PROP_FREEING:
 		case ZPOOL_PROP_LEAKED:
 		case ZPOOL_PROP_ASHIFT:
+		case ZPOOL_PROP_DEDUP_TABLE_SIZE:
 			if (literal)
 				(void) snprintf(buf, len, "%llu",
 					(u_longlong_t)intval);
@@ -319,6 +320,17 @@ zpool_get_prop(zpool_handle_t *zhp, zpool_prop_t prop, char *buf,
 				(void) zfs_nicenum(intval, buf, len);
 			break;
 
+		case ZPOOL_PROP_DEDUP_TABLE_QUOTA:
+			if (intval == 0) {
+				(void) strlcpy(buf, "none", len);
+			} else if (literal) {
+				(void) snprintf(buf, len, "%llu",
+				    (u_longlong_t)intval);
+			} else {
+				(void) zfs_nicenum(intval, buf, len);
+			}
+			break;
+
 		case ZPOOL_PROP_EXPANDSZ:
 			if (intval == 0) {
 				(void) strlcpy(buf, "-", len);
@@ -1320,6 +1332,15 @@ zpool_create(libzfs_handle_t *hdl, const char *pool, nvlist_t *nvroot,
 			    "cache device must be a disk or disk slice"));
 			return (zfs_error(hdl, EZFS_BADDEV, msg));
 
+		case ENOTSUP:
+			if (zfs_special_devs(nvroot)) {
+				zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+				    "special and dedup vdevs need the "
+				    "allocation_classes feature"));
+				return (zfs_error(hdl, EZFS_BADVERSION, msg));
+			}
+			return (zpool_standard_error(hdl, errno, msg));
+
 		default:
 			return (zpool_standard_error(hdl, errno, msg));
 		}
@@ -2048,6 +2069,82 @@ zpool_scan(zpool_handle_t *zhp, pool_scan_func_t func, pool_scrub_cmd_t cmd)
 	}
 }
 
+/*
+ * Start, cancel or suspend the trim of the top-level vdev containing the
+ * vdev with the given guid, or of the whole pool if guid is zero.  The rate
+ * is in bytes per second, zero meaning unlimited.
+ */
+int
+zpool_trim(zpool_handle_t *zhp, pool_trim_func_t func, uint64_t guid,
+    uint64_t rate)
+{
+	zfs_cmd_t zc = {"\0"};
+	char msg[1024];
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+
+	(void) strlcpy(zc.zc_name, zhp->zpool_name, sizeof (zc.zc_name));
+	zc.zc_cookie = func;
+	zc.zc_guid = guid;
+	zc.zc_obj = rate;
+
+	if (zfs_ioctl(hdl, ZFS_IOC_POOL_TRIM, &zc) == 0)
+		return (0);
+
+	switch (func) {
+	case POOL_TRIM_START:
+		(void) snprintf(msg, sizeof (msg),
+		    dgettext(TEXT_DOMAIN, "cannot trim %s"), zc.zc_name);
+		break;
+	case POOL_TRIM_CANCEL:
+		(void) snprintf(msg, sizeof (msg),
+		    dgettext(TEXT_DOMAIN, "cannot cancel trimming %s"),
+		    zc.zc_name);
+		break;
+	default:
+		(void) snprintf(msg, sizeof (msg),
+		    dgettext(TEXT_DOMAIN, "cannot suspend trimming %s"),
+		    zc.zc_name);
+		break;
+	}
+
+	switch (errno) {
+	case ENOENT:
+		return (zfs_error(hdl, EZFS_NO_TRIM, msg));
+	case ENXIO:
+		return (zfs_error(hdl, EZFS_TRIM_NOTSUP, msg));
+	case ENODEV:
+		return (zfs_error(hdl, EZFS_NODEVICE, msg));
+	default:
+		return (zpool_standard_error(hdl, errno, msg));
+	}
+}
+
+/*
+ * Prune the dedup table entries of unique blocks older than the given
+ * number of days, or of all unique blocks if days is zero.  The number of
+ * entries pruned is returned in pruned.
+ */
+int
+zpool_ddt_prune(zpool_handle_t *zhp, uint64_t days, uint64_t *pruned)
+{
+	zfs_cmd_t zc = {"\0"};
+	char msg[1024];
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+
+	(void) strlcpy(zc.zc_name, zhp->zpool_name, sizeof (zc.zc_name));
+	zc.zc_obj = days;
+
+	if (zfs_ioctl(hdl, ZFS_IOC_POOL_DDT_PRUNE, &zc) == 0) {
+		*pruned = zc.zc_cookie;
+		return (0);
+	}
+
+	(void) snprintf(msg, sizeof (msg),
+	    dgettext(TEXT_DOMAIN, "cannot prune dedup table of %s"),
+	    zc.zc_name);
+	return (zpool_standard_error(hdl, errno, msg));
+}
+
 #ifdef illumos
 
 /*
@@ -847,6 +847,31 @@ vn_rdwr(int uio, vnode_t *vp, void *addr, ssize_t len, offset_t offset,
 	return (0);
 }
 
+/*
+ * Deallocate a range of the file, used to trim file vdevs.
+ */
+int
+vn_punch_hole(vnode_t *vp, uint64_t offset, uint64_t size)
+{
+#if defined(__APPLE__) && defined(F_PUNCHHOLE)
+	fpunchhole_t fp;
+
+	bzero(&fp, sizeof (fp));
+	fp.fp_offset = offset;
+	fp.fp_length = size;
+	if (fcntl(vp->v_fd, F_PUNCHHOLE, &fp) == -1)
+		return (errno);
+	return (0);
+#elif defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+	if (fallocate(vp->v_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	    offset, size) == -1)
+		return (errno);
+	return (0);
+#else
+	return (ENOTSUP);
+#endif
+}
+
 void
 vn_close(vnode_t *vp)
 {
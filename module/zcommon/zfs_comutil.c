@@ -42,7 +42,8 @@
 #include "zfs_comutil.h"
 
 /*
- * Are there allocatable vdevs?
+ * Are there allocatable vdevs?  Log, special and dedup vdevs do not count,
+ * as they only hold some kinds of blocks.
  */
 boolean_t
 zfs_allocatable_devs(nvlist_t *nv)
@@ -51,6 +52,7 @@ zfs_allocatable_devs(nvlist_t *nv)
 	uint_t c;
 	nvlist_t **child;
 	uint_t children;
+	char *bias;
 
 	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
 	    &child, &children) != 0) {
@@ -60,12 +62,39 @@ zfs_allocatable_devs(nvlist_t *nv)
 		is_log = 0;
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
 		    &is_log);
-		if (!is_log)
+		if (!is_log && nvlist_lookup_string(child[c],
+		    ZPOOL_CONFIG_ALLOCATION_BIAS, &bias) != 0)
 			return (B_TRUE);
 	}
 	return (B_FALSE);
 }
 
+/*
+ * Are there special or dedup vdevs?
+ */
+boolean_t
+zfs_special_devs(nvlist_t *nv)
+{
+	char *bias;
+	uint_t c;
+	nvlist_t **child;
+	uint_t children;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0) {
+		return (B_FALSE);
+	}
+	for (c = 0; c < children; c++) {
+		if (nvlist_lookup_string(child[c], ZPOOL_CONFIG_ALLOCATION_BIAS,
+		    &bias) == 0) {
+			if (strcmp(bias, VDEV_ALLOC_BIAS_SPECIAL) == 0 ||
+			    strcmp(bias, VDEV_ALLOC_BIAS_DEDUP) == 0)
+				return (B_TRUE);
+		}
+	}
+	return (B_FALSE);
+}
+
 void
 zpool_get_rewind_policy(nvlist_t *nvl, zpool_rewind_policy_t *zrpp)
 {
@@ -208,6 +237,7 @@ const char *zfs_history_event_names[ZFS_NUM_LEGACY_HISTORY_EVENTS] = {
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
 EXPORT_SYMBOL(zfs_allocatable_devs);
+EXPORT_SYMBOL(zfs_special_devs);
 EXPORT_SYMBOL(zpool_get_rewind_policy);
 EXPORT_SYMBOL(zfs_zpl_version_map);
 EXPORT_SYMBOL(zfs_spa_version_map);
@@ -127,6 +127,38 @@
  *
  * For both cached and uncached data, both fletcher checksums are much faster
  * than sha-256, and slower than 'off', which doesn't touch the data at all.
+ *
+ * ------------------------
+ * SIMD fletcher-4 variants
+ * ------------------------
+ *
+ * fletcher-4 is the default checksum, so it is computed for nearly every
+ * block written and read.  Besides the scalar loop there are SSE2, SSSE3,
+ * AVX2 and AVX-512F implementations which run 2, 4 or 8 interleaved
+ * accumulators ("lanes") in vector registers.  Lane j accumulates the
+ * words f_j, f_(j+N), f_(j+2N), ... of an N-lane implementation.  Writing
+ * an input position in terms of the lane step r, the weights of the
+ * series above become polynomials in r, so the lane sums can be folded
+ * back into a, b, c and d with small integer coefficients; see
+ * fletcher_4_simd_fini().
+ *
+ * The implementations are benchmarked by fletcher_4_init() and the fastest
+ * one is used unless zfs_fletcher_4_impl selects a specific one.  All of
+ * them produce bit-identical results.
+ *
+ * Incremental callers (abd_iterate_func() et al.) hand us the buffer in
+ * arbitrary chunks.  Each chunk is checksummed on its own and combined
+ * with the running checksum: for a chunk of c1 words with checksum
+ * (A', B', C', D') appended to state (a, b, c, d),
+ *
+ *	a' = a + A'
+ *	b' = b + B' + c1 * a
+ *	c' = c + C' + c1 * b + c2 * a
+ *	d' = d + D' + c1 * c + c2 * b + c3 * a
+ *
+ * with c2 = c1 * (c1 + 1) / 2 and c3 = c1 * (c1 + 1) * (c1 + 2) / 6.  c3
+ * overflows for chunks close to 16M, so large chunks are processed in
+ * steps of FLETCHER_4_INC_MAX_SIZE.
  */
 
 #include <sys/types.h>
@@ -134,6 +166,7 @@
 #include <sys/byteorder.h>
 #include <sys/zio.h>
 #include <sys/spa.h>
+#include <sys/simd.h>
 #include <zfs_fletcher.h>
 
 void
@@ -209,19 +242,30 @@ fletcher_2_byteswap(const void *buf, size_t size,
 	(void) fletcher_2_incremental_byteswap((void *) buf, size, zcp);
 }
 
-int
-fletcher_4_incremental_native(void *buf, size_t size, void *data)
+static void
+fletcher_4_scalar_init(fletcher_4_ctx_t *ctx)
 {
-	zio_cksum_t *zcp = data;
+	ZIO_SET_CHECKSUM(&ctx->scalar, 0, 0, 0, 0);
+}
+
+static void
+fletcher_4_scalar_fini(fletcher_4_ctx_t *ctx, zio_cksum_t *zcp)
+{
+	*zcp = ctx->scalar;
+}
 
+static void
+fletcher_4_scalar_native(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
 	uint64_t a, b, c, d;
 
-	a = zcp->zc_word[0];
-	b = zcp->zc_word[1];
-	c = zcp->zc_word[2];
-	d = zcp->zc_word[3];
+	a = ctx->scalar.zc_word[0];
+	b = ctx->scalar.zc_word[1];
+	c = ctx->scalar.zc_word[2];
+	d = ctx->scalar.zc_word[3];
 
 	for (; ip < ipend; ip++) {
 		a += ip[0];
@@ -230,32 +274,21 @@ fletcher_4_incremental_native(void *buf, size_t size, void *data)
 		d += c;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
-	return (0);
-}
-
-/*ARGSUSED*/
-void
-fletcher_4_native(const void *buf, size_t size,
-    const void *ctx_template, zio_cksum_t *zcp)
-{
-	fletcher_init(zcp);
-	(void) fletcher_4_incremental_native((void *) buf, size, zcp);
+	ZIO_SET_CHECKSUM(&ctx->scalar, a, b, c, d);
 }
 
-int
-fletcher_4_incremental_byteswap(void *buf, size_t size, void *data)
+static void
+fletcher_4_scalar_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
 {
-	zio_cksum_t *zcp = data;
-
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
 	uint64_t a, b, c, d;
 
-	a = zcp->zc_word[0];
-	b = zcp->zc_word[1];
-	c = zcp->zc_word[2];
-	d = zcp->zc_word[3];
+	a = ctx->scalar.zc_word[0];
+	b = ctx->scalar.zc_word[1];
+	c = ctx->scalar.zc_word[2];
+	d = ctx->scalar.zc_word[3];
 
 	for (; ip < ipend; ip++) {
 		a += BSWAP_32(ip[0]);
@@ -264,8 +297,184 @@ fletcher_4_incremental_byteswap(void *buf, size_t size, void *data)
 		d += c;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
-	return (0);
+	ZIO_SET_CHECKSUM(&ctx->scalar, a, b, c, d);
+}
+
+static boolean_t
+fletcher_4_scalar_valid(void)
+{
+	return (B_TRUE);
+}
+
+static const fletcher_4_ops_t fletcher_4_scalar_ops = {
+	.init_native = fletcher_4_scalar_init,
+	.fini_native = fletcher_4_scalar_fini,
+	.compute_native = fletcher_4_scalar_native,
+	.init_byteswap = fletcher_4_scalar_init,
+	.fini_byteswap = fletcher_4_scalar_fini,
+	.compute_byteswap = fletcher_4_scalar_byteswap,
+	.valid = fletcher_4_scalar_valid,
+	.name = "scalar"
+};
+
+/*
+ * Indexed by fletcher_4_impl_id_t - 1.  Entries are always present; the
+ * valid() callback reports whether an implementation was built and is
+ * usable on this CPU.
+ */
+static const fletcher_4_ops_t *fletcher_4_impls[] = {
+	&fletcher_4_scalar_ops,
+	&fletcher_4_sse2_ops,
+	&fletcher_4_ssse3_ops,
+	&fletcher_4_avx2_ops,
+	&fletcher_4_avx512f_ops,
+};
+
+#define	FLETCHER_4_IMPL_CNT	\
+	(sizeof (fletcher_4_impls) / sizeof (fletcher_4_impls[0]))
+
+/*
+ * Tunable: which fletcher-4 implementation to use, see
+ * fletcher_4_impl_id_t.  Ids which are not usable on this system fall
+ * back to the fastest implementation.
+ */
+uint64_t zfs_fletcher_4_impl = FLETCHER_4_IMPL_FASTEST;
+
+static const fletcher_4_ops_t *fletcher_4_fastest = &fletcher_4_scalar_ops;
+static const fletcher_4_ops_t *fletcher_4_selected = &fletcher_4_scalar_ops;
+static boolean_t fletcher_4_initialized = B_FALSE;
+
+static inline const fletcher_4_ops_t *
+fletcher_4_impl_get(void)
+{
+	if (!fletcher_4_initialized)
+		return (&fletcher_4_scalar_ops);
+
+	return (fletcher_4_selected);
+}
+
+/*
+ * Select the implementation used for new checksums.  Returns EINVAL for
+ * an unknown id and ENOTSUP for an implementation which is not usable
+ * here; the fastest implementation is selected in both cases.
+ */
+int
+fletcher_4_impl_set(uint64_t id)
+{
+	const fletcher_4_ops_t *ops;
+	int error = 0;
+
+	if (id == FLETCHER_4_IMPL_FASTEST) {
+		ops = fletcher_4_fastest;
+	} else if (id >= FLETCHER_4_IMPL_MAX) {
+		ops = fletcher_4_fastest;
+		error = SET_ERROR(EINVAL);
+	} else if (!fletcher_4_impls[id - 1]->valid()) {
+		ops = fletcher_4_fastest;
+		error = SET_ERROR(ENOTSUP);
+	} else {
+		ops = fletcher_4_impls[id - 1];
+	}
+
+	zfs_fletcher_4_impl = (error == 0) ? id : FLETCHER_4_IMPL_FASTEST;
+	fletcher_4_selected = ops;
+
+	return (error);
+}
+
+/*
+ * Fold the lanes of an N-lane SIMD implementation into the checksum.  For
+ * lane j the weight of an input word, expressed in the lane step r, is
+ *
+ *	b:	N * r - j
+ *	c:	N^2 * T(r) + (N - N^2 - 2Nj) / 2 * r + j(j - 1) / 2
+ *	d:	N^3 * Te(r) + (N^2 - N^2 j - N^3) * T(r) +
+ *		(3Nj^2 - 6Nj + 2N + N^3 - 3N^2 + 3N^2 j) / 6 * r -
+ *		j(j - 1)(j - 2) / 6
+ *
+ * where r, T(r) = r(r + 1) / 2 and Te(r) = r(r + 1)(r + 2) / 6 are exactly
+ * what the lane's a, b, c and d accumulate.  All arithmetic is mod 2^64.
+ */
+void
+fletcher_4_simd_fini(const fletcher_4_ctx_t *ctx, int lanes,
+    zio_cksum_t *zcp)
+{
+	const int64_t n = lanes;
+	uint64_t A = 0, B = 0, C = 0, D = 0;
+	int64_t j;
+
+	ASSERT3S(lanes, <=, FLETCHER_4_MAX_LANES);
+
+	for (j = 0; j < n; j++) {
+		const uint64_t a = ctx->simd[0][j];
+		const uint64_t b = ctx->simd[1][j];
+		const uint64_t c = ctx->simd[2][j];
+		const uint64_t d = ctx->simd[3][j];
+
+		A += a;
+
+		B += n * b - j * a;
+
+		C += n * n * c + ((n - n * n - 2 * n * j) / 2) * b +
+		    (j * (j - 1) / 2) * a;
+
+		D += n * n * n * d + (n * n - n * n * j - n * n * n) * c +
+		    ((3 * n * j * j - 6 * n * j + 2 * n + n * n * n -
+		    3 * n * n + 3 * n * n * j) / 6) * b -
+		    (j * (j - 1) * (j - 2) / 6) * a;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, A, B, C, D);
+}
+
+void
+fletcher_4_simd_init(fletcher_4_ctx_t *ctx)
+{
+	bzero(ctx->simd, sizeof (ctx->simd));
+}
+
+static inline void
+fletcher_4_native_impl(const fletcher_4_ops_t *ops, const void *buf,
+    uint64_t size, zio_cksum_t *zcp)
+{
+	fletcher_4_ctx_t ctx;
+
+	ops->init_native(&ctx);
+	ops->compute_native(&ctx, buf, size);
+	ops->fini_native(&ctx, zcp);
+}
+
+static inline void
+fletcher_4_byteswap_impl(const fletcher_4_ops_t *ops, const void *buf,
+    uint64_t size, zio_cksum_t *zcp)
+{
+	fletcher_4_ctx_t ctx;
+
+	ops->init_byteswap(&ctx);
+	ops->compute_byteswap(&ctx, buf, size);
+	ops->fini_byteswap(&ctx, zcp);
+}
+
+/*ARGSUSED*/
+void
+fletcher_4_native(const void *buf, size_t size,
+    const void *ctx_template, zio_cksum_t *zcp)
+{
+	const uint64_t p2size = P2ALIGN(size, FLETCHER_4_BLOCK_SIZE);
+
+	ASSERT(IS_P2ALIGNED(size, sizeof (uint32_t)));
+
+	if (p2size == 0) {
+		ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	} else {
+		fletcher_4_native_impl(fletcher_4_impl_get(), buf, p2size,
+		    zcp);
+	}
+
+	if (p2size < size) {
+		fletcher_4_scalar_native((fletcher_4_ctx_t *)zcp,
+		    (char *)buf + p2size, size - p2size);
+	}
 }
 
 /*ARGSUSED*/
@@ -273,8 +482,223 @@ void
 fletcher_4_byteswap(const void *buf, size_t size,
     const void *ctx_template, zio_cksum_t *zcp)
 {
-	fletcher_init(zcp);
-	(void) fletcher_4_incremental_byteswap((void *) buf, size, zcp);
+	const uint64_t p2size = P2ALIGN(size, FLETCHER_4_BLOCK_SIZE);
+
+	ASSERT(IS_P2ALIGNED(size, sizeof (uint32_t)));
+
+	if (p2size == 0) {
+		ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	} else {
+		fletcher_4_byteswap_impl(fletcher_4_impl_get(), buf, p2size,
+		    zcp);
+	}
+
+	if (p2size < size) {
+		fletcher_4_scalar_byteswap((fletcher_4_ctx_t *)zcp,
+		    (char *)buf + p2size, size - p2size);
+	}
+}
+
+/*
+ * Incremental fletcher-4, see "SIMD fletcher-4 variants" above.
+ */
+#define	FLETCHER_4_INC_MAX_SIZE	(8ULL << 20)
+
+static inline void
+fletcher_4_incremental_combine(zio_cksum_t *zcp, const uint64_t size,
+    const zio_cksum_t *nzcp)
+{
+	const uint64_t c1 = size / sizeof (uint32_t);
+	const uint64_t c2 = c1 * (c1 + 1) / 2;
+	const uint64_t c3 = c2 * (c1 + 2) / 3;
+
+	ASSERT3U(size, <=, FLETCHER_4_INC_MAX_SIZE);
+
+	zcp->zc_word[3] += nzcp->zc_word[3] + c1 * zcp->zc_word[2] +
+	    c2 * zcp->zc_word[1] + c3 * zcp->zc_word[0];
+	zcp->zc_word[2] += nzcp->zc_word[2] + c1 * zcp->zc_word[1] +
+	    c2 * zcp->zc_word[0];
+	zcp->zc_word[1] += nzcp->zc_word[1] + c1 * zcp->zc_word[0];
+	zcp->zc_word[0] += nzcp->zc_word[0];
+}
+
+static inline void
+fletcher_4_incremental_impl(boolean_t native, const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	while (size > 0) {
+		zio_cksum_t nzc;
+		uint64_t len = MIN(size, FLETCHER_4_INC_MAX_SIZE);
+
+		if (native)
+			fletcher_4_native(buf, len, NULL, &nzc);
+		else
+			fletcher_4_byteswap(buf, len, NULL, &nzc);
+
+		fletcher_4_incremental_combine(zcp, len, &nzc);
+
+		size -= len;
+		buf = (char *)buf + len;
+	}
+}
+
+int
+fletcher_4_incremental_native(void *buf, size_t size, void *data)
+{
+	zio_cksum_t *zcp = data;
+
+	/* Use scalar impl to directly update cksum of small blocks */
+	if (size < SPA_MINBLOCKSIZE)
+		fletcher_4_scalar_native((fletcher_4_ctx_t *)zcp, buf, size);
+	else
+		fletcher_4_incremental_impl(B_TRUE, buf, size, zcp);
+	return (0);
+}
+
+int
+fletcher_4_incremental_byteswap(void *buf, size_t size, void *data)
+{
+	zio_cksum_t *zcp = data;
+
+	/* Use scalar impl to directly update cksum of small blocks */
+	if (size < SPA_MINBLOCKSIZE)
+		fletcher_4_scalar_byteswap((fletcher_4_ctx_t *)zcp, buf, size);
+	else
+		fletcher_4_incremental_impl(B_FALSE, buf, size, zcp);
+	return (0);
+}
+
+/*
+ * Benchmark
+ *
+ * Every usable implementation is timed over a FLETCHER_4_BENCH_SIZE
+ * buffer for FLETCHER_4_BENCH_NS, separately for native and byteswap.
+ * The results are exported as bytes per second in the fletcher_4_bench
+ * kstat.  The fastest native implementation becomes the default.
+ */
+#define	FLETCHER_4_BENCH_SIZE	(128 * 1024)
+#define	FLETCHER_4_BENCH_NS	(MSEC2NSEC(1))
+
+typedef struct fletcher_4_kstat {
+	kstat_named_t f4ks_native[FLETCHER_4_IMPL_CNT];
+	kstat_named_t f4ks_byteswap[FLETCHER_4_IMPL_CNT];
+	kstat_named_t f4ks_fastest;
+	kstat_named_t f4ks_selected;
+} fletcher_4_kstat_t;
+
+static fletcher_4_kstat_t fletcher_4_kstat_data;
+static kstat_t *fletcher_4_kstat;
+
+static uint64_t
+fletcher_4_benchmark_impl(const fletcher_4_ops_t *ops, boolean_t native,
+    const void *buf, uint64_t size)
+{
+	hrtime_t start;
+	uint64_t run_count = 0, run_time_ns;
+	zio_cksum_t zc;
+
+	kpreempt_disable();
+	start = gethrtime();
+	do {
+		int i;
+
+		for (i = 0; i < 32; i++, run_count++) {
+			if (native)
+				fletcher_4_native_impl(ops, buf, size, &zc);
+			else
+				fletcher_4_byteswap_impl(ops, buf, size, &zc);
+		}
+	} while ((run_time_ns = gethrtime() - start) < FLETCHER_4_BENCH_NS);
+	kpreempt_enable();
+
+	return (size * run_count * NANOSEC / MAX(run_time_ns, 1));
+}
+
+static int
+fletcher_4_kstat_update(kstat_t *ksp, int rw)
+{
+	fletcher_4_kstat_t *fks = ksp->ks_data;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	fks->f4ks_selected.value.ui64 = zfs_fletcher_4_impl;
+
+	return (0);
+}
+
+void
+fletcher_4_init(void)
+{
+	fletcher_4_kstat_t *fks = &fletcher_4_kstat_data;
+	uint64_t best_bw = 0;
+	char *databuf;
+	int i;
+
+	databuf = vmem_alloc(FLETCHER_4_BENCH_SIZE, KM_SLEEP);
+	for (i = 0; i < FLETCHER_4_BENCH_SIZE / sizeof (uint64_t); i++)
+		((uint64_t *)databuf)[i] = (uintptr_t)(databuf + i);
+
+	kstat_named_init(&fks->f4ks_fastest, "fastest", KSTAT_DATA_UINT64);
+	kstat_named_init(&fks->f4ks_selected, "selected", KSTAT_DATA_UINT64);
+
+	for (i = 0; i < FLETCHER_4_IMPL_CNT; i++) {
+		const fletcher_4_ops_t *ops = fletcher_4_impls[i];
+		uint64_t native_bw = 0, byteswap_bw = 0;
+		char name[KSTAT_STRLEN];
+
+		if (ops->valid()) {
+			native_bw = fletcher_4_benchmark_impl(ops, B_TRUE,
+			    databuf, FLETCHER_4_BENCH_SIZE);
+			byteswap_bw = fletcher_4_benchmark_impl(ops, B_FALSE,
+			    databuf, FLETCHER_4_BENCH_SIZE);
+		}
+
+		if (native_bw > best_bw) {
+			best_bw = native_bw;
+			fletcher_4_fastest = ops;
+		}
+
+		(void) snprintf(name, sizeof (name), "%s_native", ops->name);
+		kstat_named_init(&fks->f4ks_native[i], name,
+		    KSTAT_DATA_UINT64);
+		fks->f4ks_native[i].value.ui64 = native_bw;
+
+		(void) snprintf(name, sizeof (name), "%s_byteswap", ops->name);
+		kstat_named_init(&fks->f4ks_byteswap[i], name,
+		    KSTAT_DATA_UINT64);
+		fks->f4ks_byteswap[i].value.ui64 = byteswap_bw;
+
+		if (ops == fletcher_4_fastest)
+			fks->f4ks_fastest.value.ui64 = i + 1;
+	}
+
+	vmem_free(databuf, FLETCHER_4_BENCH_SIZE);
+
+	fletcher_4_initialized = B_TRUE;
+	(void) fletcher_4_impl_set(zfs_fletcher_4_impl);
+
+	fletcher_4_kstat = kstat_create("zfs", 0, "fletcher_4_bench", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (fletcher_4_kstat_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (fletcher_4_kstat != NULL) {
+		fletcher_4_kstat->ks_data = fks;
+		fletcher_4_kstat->ks_update = fletcher_4_kstat_update;
+		kstat_install(fletcher_4_kstat);
+	}
+}
+
+void
+fletcher_4_fini(void)
+{
+	if (fletcher_4_kstat != NULL) {
+		kstat_delete(fletcher_4_kstat);
+		fletcher_4_kstat = NULL;
+	}
+
+	fletcher_4_initialized = B_FALSE;
+	fletcher_4_fastest = &fletcher_4_scalar_ops;
+	fletcher_4_selected = &fletcher_4_scalar_ops;
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
@@ -284,4 +708,7 @@ EXPORT_SYMBOL(fletcher_4_native);
 EXPORT_SYMBOL(fletcher_4_byteswap);
 EXPORT_SYMBOL(fletcher_4_incremental_native);
 EXPORT_SYMBOL(fletcher_4_incremental_byteswap);
+EXPORT_SYMBOL(fletcher_4_init);
+EXPORT_SYMBOL(fletcher_4_fini);
+EXPORT_SYMBOL(fletcher_4_impl_set);
 #endif
@@ -0,0 +1,158 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX-512F fletcher-4, eight 64-bit lanes per zmm register.
+ *
+ * vpmovzxdq zero-extends eight consecutive words into the eight lanes, so
+ * lane j accumulates words j, j + 8, j + 16, ...  AVX-512F has no byte
+ * shuffle on zmm registers, so the byteswap variant swaps the words in a
+ * ymm register with AVX2 before widening them.
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <sys/simd.h>
+#include <zfs_fletcher.h>
+
+#if defined(__x86_64__) && defined(HAVE_AVX512F) && defined(HAVE_AVX2)
+
+#define	FLETCHER_4_AVX512_LANES	8
+
+#define	FLETCHER_4_AVX512_STEP			\
+	"vpaddq	%%zmm5, %%zmm0, %%zmm0\n"	\
+	"vpaddq	%%zmm0, %%zmm1, %%zmm1\n"	\
+	"vpaddq	%%zmm1, %%zmm2, %%zmm2\n"	\
+	"vpaddq	%%zmm2, %%zmm3, %%zmm3\n"
+
+#define	FLETCHER_4_AVX512_LOAD			\
+	"vmovdqu64 0(%[ctx]), %%zmm0\n"		\
+	"vmovdqu64 64(%[ctx]), %%zmm1\n"	\
+	"vmovdqu64 128(%[ctx]), %%zmm2\n"	\
+	"vmovdqu64 192(%[ctx]), %%zmm3\n"
+
+#define	FLETCHER_4_AVX512_STORE			\
+	"vmovdqu64 %%zmm0, 0(%[ctx])\n"		\
+	"vmovdqu64 %%zmm1, 64(%[ctx])\n"	\
+	"vmovdqu64 %%zmm2, 128(%[ctx])\n"	\
+	"vmovdqu64 %%zmm3, 192(%[ctx])\n"	\
+	"vzeroupper\n"
+
+static const uint8_t fletcher_4_avx512_bswap_mask[32]
+    __attribute__((aligned(32))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static void
+fletcher_4_avx512f_fini(fletcher_4_ctx_t *ctx, zio_cksum_t *zcp)
+{
+	fletcher_4_simd_fini(ctx, FLETCHER_4_AVX512_LANES, zcp);
+}
+
+static void
+fletcher_4_avx512f_native(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, FLETCHER_4_BLOCK_SIZE));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_AVX512_LOAD
+	    "1:\n"
+	    "vpmovzxdq (%[ip]), %%zmm5\n"
+	    FLETCHER_4_AVX512_STEP
+	    "add	$32, %[ip]\n"
+	    "cmp	%[end], %[ip]\n"
+	    "jb	1b\n"
+	    FLETCHER_4_AVX512_STORE
+	    : [ip] "+r" (ip)
+	    : [end] "r" (ipend), [ctx] "r" (ctx->simd)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm5", "memory", "cc");
+	kfpu_end();
+}
+
+static void
+fletcher_4_avx512f_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, FLETCHER_4_BLOCK_SIZE));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_AVX512_LOAD
+	    "vmovdqa (%[mask]), %%ymm7\n"
+	    "1:\n"
+	    "vmovdqu (%[ip]), %%ymm6\n"
+	    "vpshufb %%ymm7, %%ymm6, %%ymm6\n"
+	    "vpmovzxdq %%ymm6, %%zmm5\n"
+	    FLETCHER_4_AVX512_STEP
+	    "add	$32, %[ip]\n"
+	    "cmp	%[end], %[ip]\n"
+	    "jb	1b\n"
+	    FLETCHER_4_AVX512_STORE
+	    : [ip] "+r" (ip)
+	    : [end] "r" (ipend), [ctx] "r" (ctx->simd),
+	    [mask] "r" (fletcher_4_avx512_bswap_mask)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm5", "xmm6", "xmm7",
+	    "memory", "cc");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_avx512f_valid(void)
+{
+	return (zfs_avx512f_available() && zfs_avx2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_avx512f_ops = {
+	.init_native = fletcher_4_simd_init,
+	.fini_native = fletcher_4_avx512f_fini,
+	.compute_native = fletcher_4_avx512f_native,
+	.init_byteswap = fletcher_4_simd_init,
+	.fini_byteswap = fletcher_4_avx512f_fini,
+	.compute_byteswap = fletcher_4_avx512f_byteswap,
+	.valid = fletcher_4_avx512f_valid,
+	.name = "avx512f"
+};
+
+#else	/* !(__x86_64__ && HAVE_AVX512F && HAVE_AVX2) */
+
+static boolean_t
+fletcher_4_avx512f_valid(void)
+{
+	return (B_FALSE);
+}
+
+const fletcher_4_ops_t fletcher_4_avx512f_ops = {
+	.valid = fletcher_4_avx512f_valid,
+	.name = "avx512f"
+};
+
+#endif	/* __x86_64__ && HAVE_AVX512F && HAVE_AVX2 */
@@ -0,0 +1,158 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 fletcher-4, four 64-bit lanes per ymm register.
+ *
+ * vpmovzxdq zero-extends four consecutive words into the four lanes, so
+ * lane j accumulates words j, j + 4, j + 8, ...
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <sys/simd.h>
+#include <zfs_fletcher.h>
+
+#if defined(__x86_64__) && defined(HAVE_AVX2)
+
+#define	FLETCHER_4_AVX2_LANES	4
+
+#define	FLETCHER_4_AVX2_STEP			\
+	"vpaddq	%%ymm5, %%ymm0, %%ymm0\n"	\
+	"vpaddq	%%ymm0, %%ymm1, %%ymm1\n"	\
+	"vpaddq	%%ymm1, %%ymm2, %%ymm2\n"	\
+	"vpaddq	%%ymm2, %%ymm3, %%ymm3\n"
+
+#define	FLETCHER_4_AVX2_LOAD			\
+	"vmovdqu 0(%[ctx]), %%ymm0\n"		\
+	"vmovdqu 64(%[ctx]), %%ymm1\n"		\
+	"vmovdqu 128(%[ctx]), %%ymm2\n"		\
+	"vmovdqu 192(%[ctx]), %%ymm3\n"
+
+#define	FLETCHER_4_AVX2_STORE			\
+	"vmovdqu %%ymm0, 0(%[ctx])\n"		\
+	"vmovdqu %%ymm1, 64(%[ctx])\n"		\
+	"vmovdqu %%ymm2, 128(%[ctx])\n"		\
+	"vmovdqu %%ymm3, 192(%[ctx])\n"		\
+	"vzeroupper\n"
+
+/*
+ * Byteswap the low word of every 64-bit lane and clear the upper half.
+ */
+static const uint8_t fletcher_4_avx2_bswap_mask[32]
+    __attribute__((aligned(32))) = {
+	3, 2, 1, 0, 0x80, 0x80, 0x80, 0x80,
+	11, 10, 9, 8, 0x80, 0x80, 0x80, 0x80,
+	3, 2, 1, 0, 0x80, 0x80, 0x80, 0x80,
+	11, 10, 9, 8, 0x80, 0x80, 0x80, 0x80
+};
+
+static void
+fletcher_4_avx2_fini(fletcher_4_ctx_t *ctx, zio_cksum_t *zcp)
+{
+	fletcher_4_simd_fini(ctx, FLETCHER_4_AVX2_LANES, zcp);
+}
+
+static void
+fletcher_4_avx2_native(fletcher_4_ctx_t *ctx, const void *buf, uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, FLETCHER_4_BLOCK_SIZE));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_AVX2_LOAD
+	    "1:\n"
+	    "vpmovzxdq (%[ip]), %%ymm5\n"
+	    FLETCHER_4_AVX2_STEP
+	    "add	$16, %[ip]\n"
+	    "cmp	%[end], %[ip]\n"
+	    "jb	1b\n"
+	    FLETCHER_4_AVX2_STORE
+	    : [ip] "+r" (ip)
+	    : [end] "r" (ipend), [ctx] "r" (ctx->simd)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm5", "memory", "cc");
+	kfpu_end();
+}
+
+static void
+fletcher_4_avx2_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, FLETCHER_4_BLOCK_SIZE));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_AVX2_LOAD
+	    "vmovdqa (%[mask]), %%ymm7\n"
+	    "1:\n"
+	    "vpmovzxdq (%[ip]), %%ymm5\n"
+	    "vpshufb %%ymm7, %%ymm5, %%ymm5\n"
+	    FLETCHER_4_AVX2_STEP
+	    "add	$16, %[ip]\n"
+	    "cmp	%[end], %[ip]\n"
+	    "jb	1b\n"
+	    FLETCHER_4_AVX2_STORE
+	    : [ip] "+r" (ip)
+	    : [end] "r" (ipend), [ctx] "r" (ctx->simd),
+	    [mask] "r" (fletcher_4_avx2_bswap_mask)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm5", "xmm7", "memory", "cc");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_avx2_valid(void)
+{
+	return (zfs_avx2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_avx2_ops = {
+	.init_native = fletcher_4_simd_init,
+	.fini_native = fletcher_4_avx2_fini,
+	.compute_native = fletcher_4_avx2_native,
+	.init_byteswap = fletcher_4_simd_init,
+	.fini_byteswap = fletcher_4_avx2_fini,
+	.compute_byteswap = fletcher_4_avx2_byteswap,
+	.valid = fletcher_4_avx2_valid,
+	.name = "avx2"
+};
+
+#else	/* !(__x86_64__ && HAVE_AVX2) */
+
+static boolean_t
+fletcher_4_avx2_valid(void)
+{
+	return (B_FALSE);
+}
+
+const fletcher_4_ops_t fletcher_4_avx2_ops = {
+	.valid = fletcher_4_avx2_valid,
+	.name = "avx2"
+};
+
+#endif	/* __x86_64__ && HAVE_AVX2 */
@@ -0,0 +1,237 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SSE2 and SSSE3 fletcher-4, two 64-bit lanes per xmm register.
+ *
+ * Each 16 byte load holds four words; the low two are zero-extended into
+ * one register and the high two into another, and both are run through
+ * the a/b/c/d chain, so lane j accumulates words j, j + 2, j + 4, ...
+ * The SSSE3 variant only differs in using pshufb for byteswapping.
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <sys/simd.h>
+#include <zfs_fletcher.h>
+
+#if defined(__x86_64__) && defined(HAVE_SSE2)
+
+#define	FLETCHER_4_SSE_LANES	2
+
+/*
+ * Accumulate one zero-extended register of two words into a, b, c, d.
+ */
+#define	FLETCHER_4_SSE_STEP(r)		\
+	"paddq	" r ", %%xmm0\n"	\
+	"paddq	%%xmm0, %%xmm1\n"	\
+	"paddq	%%xmm1, %%xmm2\n"	\
+	"paddq	%%xmm2, %%xmm3\n"
+
+#define	FLETCHER_4_SSE_LOAD		\
+	"movdqu	0(%[ctx]), %%xmm0\n"	\
+	"movdqu	64(%[ctx]), %%xmm1\n"	\
+	"movdqu	128(%[ctx]), %%xmm2\n"	\
+	"movdqu	192(%[ctx]), %%xmm3\n"	\
+	"pxor	%%xmm4, %%xmm4\n"
+
+#define	FLETCHER_4_SSE_STORE		\
+	"movdqu	%%xmm0, 0(%[ctx])\n"	\
+	"movdqu	%%xmm1, 64(%[ctx])\n"	\
+	"movdqu	%%xmm2, 128(%[ctx])\n"	\
+	"movdqu	%%xmm3, 192(%[ctx])\n"
+
+#define	FLETCHER_4_SSE_SPLIT		\
+	"movdqa	%%xmm5, %%xmm6\n"	\
+	"punpckldq %%xmm4, %%xmm5\n"	\
+	"punpckhdq %%xmm4, %%xmm6\n"
+
+static void
+fletcher_4_sse2_fini(fletcher_4_ctx_t *ctx, zio_cksum_t *zcp)
+{
+	fletcher_4_simd_fini(ctx, FLETCHER_4_SSE_LANES, zcp);
+}
+
+static void
+fletcher_4_sse2_native(fletcher_4_ctx_t *ctx, const void *buf, uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, FLETCHER_4_BLOCK_SIZE));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_SSE_LOAD
+	    "1:\n"
+	    "movdqu	(%[ip]), %%xmm5\n"
+	    FLETCHER_4_SSE_SPLIT
+	    FLETCHER_4_SSE_STEP("%%xmm5")
+	    FLETCHER_4_SSE_STEP("%%xmm6")
+	    "add	$16, %[ip]\n"
+	    "cmp	%[end], %[ip]\n"
+	    "jb	1b\n"
+	    FLETCHER_4_SSE_STORE
+	    : [ip] "+r" (ip)
+	    : [end] "r" (ipend), [ctx] "r" (ctx->simd)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+	    "memory", "cc");
+	kfpu_end();
+}
+
+static void
+fletcher_4_sse2_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, FLETCHER_4_BLOCK_SIZE));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_SSE_LOAD
+	    "1:\n"
+	    "movdqu	(%[ip]), %%xmm5\n"
+	    /* swap the 16-bit halves, then the bytes within them */
+	    "pshuflw $0xb1, %%xmm5, %%xmm5\n"
+	    "pshufhw $0xb1, %%xmm5, %%xmm5\n"
+	    "movdqa	%%xmm5, %%xmm7\n"
+	    "psllw	$8, %%xmm5\n"
+	    "psrlw	$8, %%xmm7\n"
+	    "por	%%xmm7, %%xmm5\n"
+	    FLETCHER_4_SSE_SPLIT
+	    FLETCHER_4_SSE_STEP("%%xmm5")
+	    FLETCHER_4_SSE_STEP("%%xmm6")
+	    "add	$16, %[ip]\n"
+	    "cmp	%[end], %[ip]\n"
+	    "jb	1b\n"
+	    FLETCHER_4_SSE_STORE
+	    : [ip] "+r" (ip)
+	    : [end] "r" (ipend), [ctx] "r" (ctx->simd)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+	    "memory", "cc");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_sse2_valid(void)
+{
+	return (zfs_sse2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_sse2_ops = {
+	.init_native = fletcher_4_simd_init,
+	.fini_native = fletcher_4_sse2_fini,
+	.compute_native = fletcher_4_sse2_native,
+	.init_byteswap = fletcher_4_simd_init,
+	.fini_byteswap = fletcher_4_sse2_fini,
+	.compute_byteswap = fletcher_4_sse2_byteswap,
+	.valid = fletcher_4_sse2_valid,
+	.name = "sse2"
+};
+
+#else	/* !(__x86_64__ && HAVE_SSE2) */
+
+static boolean_t
+fletcher_4_sse2_valid(void)
+{
+	return (B_FALSE);
+}
+
+const fletcher_4_ops_t fletcher_4_sse2_ops = {
+	.valid = fletcher_4_sse2_valid,
+	.name = "sse2"
+};
+
+#endif	/* __x86_64__ && HAVE_SSE2 */
+
+#if defined(__x86_64__) && defined(HAVE_SSE2) && defined(HAVE_SSSE3)
+
+static const uint8_t fletcher_4_ssse3_bswap_mask[16]
+    __attribute__((aligned(16))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static void
+fletcher_4_ssse3_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint8_t *ip = buf;
+	const uint8_t *ipend = ip + size;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, FLETCHER_4_BLOCK_SIZE));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    FLETCHER_4_SSE_LOAD
+	    "movdqa	(%[mask]), %%xmm7\n"
+	    "1:\n"
+	    "movdqu	(%[ip]), %%xmm5\n"
+	    "pshufb	%%xmm7, %%xmm5\n"
+	    FLETCHER_4_SSE_SPLIT
+	    FLETCHER_4_SSE_STEP("%%xmm5")
+	    FLETCHER_4_SSE_STEP("%%xmm6")
+	    "add	$16, %[ip]\n"
+	    "cmp	%[end], %[ip]\n"
+	    "jb	1b\n"
+	    FLETCHER_4_SSE_STORE
+	    : [ip] "+r" (ip)
+	    : [end] "r" (ipend), [ctx] "r" (ctx->simd),
+	    [mask] "r" (fletcher_4_ssse3_bswap_mask)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+	    "memory", "cc");
+	kfpu_end();
+}
+
+static boolean_t
+fletcher_4_ssse3_valid(void)
+{
+	return (zfs_sse2_available() && zfs_ssse3_available());
+}
+
+const fletcher_4_ops_t fletcher_4_ssse3_ops = {
+	.init_native = fletcher_4_simd_init,
+	.fini_native = fletcher_4_sse2_fini,
+	.compute_native = fletcher_4_sse2_native,
+	.init_byteswap = fletcher_4_simd_init,
+	.fini_byteswap = fletcher_4_sse2_fini,
+	.compute_byteswap = fletcher_4_ssse3_byteswap,
+	.valid = fletcher_4_ssse3_valid,
+	.name = "ssse3"
+};
+
+#else	/* !(__x86_64__ && HAVE_SSE2 && HAVE_SSSE3) */
+
+static boolean_t
+fletcher_4_ssse3_valid(void)
+{
+	return (B_FALSE);
+}
+
+const fletcher_4_ops_t fletcher_4_ssse3_ops = {
+	.valid = fletcher_4_ssse3_valid,
+	.name = "ssse3"
+};
+
+#endif	/* __x86_64__ && HAVE_SSE2 && HAVE_SSSE3 */
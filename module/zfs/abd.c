@@ -65,6 +65,15 @@
  * allow us to quickly reclaim enough space for a new large allocation (assuming
  * it is also scattered).
  *
+ * (c) Gang. A gang ABD owns no data of its own; it is an ordered list of
+ *     child ABDs (offset ABDs into other buffers, or gap fillers) whose data
+ *     reads as one contiguous buffer. vdev_queue_aggregate() uses gangs to
+ *     issue an aggregated I/O directly from, or into, the buffers of the I/Os
+ *     it is made of instead of copying them through a bounce buffer. Gaps
+ *     between those I/Os are filled with references to a shared, read-only
+ *     zero buffer for writes, or with a private scratch ABD for reads.
+ *     Gangs cannot be nested, and offset ABDs cannot be taken of them.
+ *
  * In addition to directly allocating a linear or scattered ABD, it is also
  * possible to create an ABD by requesting the "sub-ABD" starting at an offset
  * within an existing ABD. In linear buffers this is simple (set abd_buf of
@@ -170,6 +179,8 @@ typedef struct abd_stats {
 	kstat_named_t abdstat_moved_scattered_filedata;
 	kstat_named_t abdstat_moved_scattered_metadata;
 	kstat_named_t abdstat_move_to_buf_flag_fail;
+	kstat_named_t abdstat_gang_cnt;
+	kstat_named_t abdstat_gang_children;
 } abd_stats_t;
 
 static abd_stats_t abd_stats = {
@@ -215,6 +226,9 @@ static abd_stats_t abd_stats = {
 	{ "moved_scattered_filedata",           KSTAT_DATA_UINT64 },
 	{ "moved_scattered_metadata",           KSTAT_DATA_UINT64 },
 	{ "move_to_buf_flag_fail",              KSTAT_DATA_UINT64 },
+	/* Number of gang ABDs currently allocated, and their children */
+	{ "gang_cnt",                           KSTAT_DATA_UINT64 },
+	{ "gang_children",                      KSTAT_DATA_UINT64 },
 };
 
 #define	ABDSTAT(stat)		(abd_stats.stat.value.ui64)
@@ -248,6 +262,23 @@ extern vmem_t *zio_arena;
 kmem_cache_t *abd_chunk_cache;
 static kstat_t *abd_ksp;
 
+/*
+ * Shared zero-filled buffer referenced by the gaps of gang ABDs that are
+ * written to disk. Nothing may ever write into it.
+ */
+#define	ABD_ZERO_SIZE	SPA_OLD_MAXBLOCKSIZE
+static abd_t *abd_zero_buf;
+
+/*
+ * Gang ABDs keep their children in a separately allocated array, so the
+ * abd_t only needs room for struct abd_gang in its union.
+ */
+#define	ABD_GANG_CHUNKCNT						\
+	((sizeof (struct abd_gang) -					\
+	offsetof(struct abd_scatter, abd_chunks) +			\
+	sizeof (void *) - 1) / sizeof (void *))
+#define	ABD_GANG_MINCHILDREN	8
+
 static void *
 abd_alloc_chunk()
 {
@@ -331,6 +362,9 @@ abd_init(void)
 	VERIFY3P(abd_chunk_cache, !=, NULL);
 #endif
 
+	abd_zero_buf = abd_get_from_buf(kmem_zalloc(ABD_ZERO_SIZE, KM_SLEEP),
+	    ABD_ZERO_SIZE);
+
 	abd_ksp = kstat_create("zfs", 0, "abdstats", "misc", KSTAT_TYPE_NAMED,
 	    sizeof (abd_stats) / sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
 	if (abd_ksp != NULL) {
@@ -347,6 +381,11 @@ abd_fini(void)
 		abd_ksp = NULL;
 	}
 
+	void *zero = abd_zero_buf->abd_u.abd_linear.abd_buf;
+	abd_put(abd_zero_buf);
+	abd_zero_buf = NULL;
+	kmem_free(zero, ABD_ZERO_SIZE);
+
 	kmem_cache_destroy(abd_chunk_cache);
 	abd_chunk_cache = NULL;
 #if defined(__APPLE__) && defined (_KERNEL)
@@ -376,11 +415,22 @@ abd_verify(abd_t *abd)
 	ASSERT3U(abd->abd_size, >, 0);
 	ASSERT3U(abd->abd_size, <=, SPA_MAXBLOCKSIZE);
 	ASSERT3U(abd->abd_flags, ==, abd->abd_flags & (ABD_FLAG_LINEAR |
-	    ABD_FLAG_OWNER | ABD_FLAG_META | ABD_FLAG_SMALL | ABD_FLAG_NOMOVE));
+	    ABD_FLAG_OWNER | ABD_FLAG_META | ABD_FLAG_SMALL | ABD_FLAG_NOMOVE |
+	    ABD_FLAG_GANG));
 	IMPLY(abd->abd_parent != NULL, !(abd->abd_flags & ABD_FLAG_OWNER));
 	IMPLY(abd->abd_flags & ABD_FLAG_META, abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd)) {
 		ASSERT3P(abd->abd_u.abd_linear.abd_buf, !=, NULL);
+	} else if (abd_is_gang(abd)) {
+		struct abd_gang *gang = &abd->abd_u.abd_gang;
+		size_t size = 0;
+		for (int i = 0; i < gang->abd_nchildren; i++) {
+			abd_t *cabd = gang->abd_gang_children[i];
+			ASSERT3P(cabd, !=, NULL);
+			ASSERT(!abd_is_gang(cabd));
+			size += cabd->abd_size;
+		}
+		ASSERT3U(size, ==, abd->abd_size);
 	} else {
 		ASSERT3U(abd->abd_u.abd_scatter.abd_offset, <,
 		    zfs_abd_chunk_size);
@@ -412,7 +462,8 @@ static inline void
 abd_free_struct(abd_t *abd)
 {
 	mutex_enter(&abd->abd_mutex);
-	size_t chunkcnt = abd_is_linear(abd) ? 0 : abd_scatter_chunkcnt(abd);
+	size_t chunkcnt = abd_is_linear(abd) ? 0 : abd_is_gang(abd) ?
+	    ABD_GANG_CHUNKCNT : abd_scatter_chunkcnt(abd);
 	int size = offsetof(abd_t, abd_u.abd_scatter.abd_chunks[chunkcnt]);
 	VERIFY_ABD_MAGIC(abd);
 #ifdef DEBUG
@@ -583,8 +634,36 @@ abd_free_linear(abd_t *abd)
 }
 
 /*
- * Free an ABD. Only use this on ABDs allocated with abd_alloc() or
- * abd_alloc_linear().
+ * Release the children of a gang ABD: offset ABDs are put, and gap
+ * fillers allocated by abd_gang_add_gap() are freed.
+ */
+static void
+abd_free_gang(abd_t *abd)
+{
+	struct abd_gang *gang = &abd->abd_u.abd_gang;
+
+	for (int i = 0; i < gang->abd_nchildren; i++) {
+		abd_t *cabd = gang->abd_gang_children[i];
+
+		if (cabd->abd_flags & ABD_FLAG_OWNER)
+			abd_free(cabd);
+		else
+			abd_put(cabd);
+	}
+	ABDSTAT_INCR(abdstat_gang_children, -(int)gang->abd_nchildren);
+	ABDSTAT_BUMPDOWN(abdstat_gang_cnt);
+
+	if (gang->abd_maxchildren != 0) {
+		kmem_free(gang->abd_gang_children,
+		    gang->abd_maxchildren * sizeof (abd_t *));
+	}
+	refcount_destroy(&abd->abd_children);
+	abd_free_struct(abd);
+}
+
+/*
+ * Free an ABD. Only use this on ABDs allocated with abd_alloc(),
+ * abd_alloc_linear() or abd_alloc_gang().
  */
 void
 abd_free(abd_t *abd)
@@ -597,6 +676,8 @@ abd_free(abd_t *abd)
 	ASSERT(abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd))
 		abd_free_linear(abd);
+	else if (abd_is_gang(abd))
+		abd_free_gang(abd);
 	else
 		abd_free_scatter(abd);
 }
@@ -634,6 +715,95 @@ abd_alloc_for_io(size_t size, boolean_t is_metadata)
 	return (abd_alloc(size, is_metadata));
 }
 
+/*
+ * Allocate an empty gang ABD. Its data is made up by the children added
+ * with abd_gang_add() and abd_gang_add_gap(), in order, and it is freed
+ * along with them by abd_free().
+ */
+abd_t *
+abd_alloc_gang(void)
+{
+	abd_t *abd = abd_alloc_struct(ABD_GANG_CHUNKCNT);
+
+	/*
+	 * The gang never owns data buffers; ABD_FLAG_OWNER here means it
+	 * owns its children, and is freed with abd_free().
+	 */
+	abd->abd_flags = ABD_FLAG_GANG | ABD_FLAG_OWNER | ABD_FLAG_NOMOVE;
+	abd->abd_size = 0;
+	abd->abd_parent = NULL;
+	refcount_create(&abd->abd_children);
+
+	ABDSTAT_BUMP(abdstat_gang_cnt);
+
+	return (abd);
+}
+
+static void
+abd_gang_add_child(abd_t *abd, abd_t *cabd)
+{
+	struct abd_gang *gang = &abd->abd_u.abd_gang;
+
+	ASSERT(abd_is_gang(abd));
+	ASSERT(!abd_is_gang(cabd));
+	ASSERT3U(abd->abd_size + cabd->abd_size, <=, SPA_MAXBLOCKSIZE);
+
+	mutex_enter(&abd->abd_mutex);
+	if (gang->abd_nchildren == gang->abd_maxchildren) {
+		uint_t max = MAX(gang->abd_maxchildren * 2,
+		    ABD_GANG_MINCHILDREN);
+		abd_t **children = kmem_alloc(max * sizeof (abd_t *),
+		    KM_PUSHPAGE);
+
+		if (gang->abd_maxchildren != 0) {
+			bcopy(gang->abd_gang_children, children,
+			    gang->abd_nchildren * sizeof (abd_t *));
+			kmem_free(gang->abd_gang_children,
+			    gang->abd_maxchildren * sizeof (abd_t *));
+		}
+		gang->abd_gang_children = children;
+		gang->abd_maxchildren = max;
+	}
+	gang->abd_gang_children[gang->abd_nchildren++] = cabd;
+	abd->abd_size += cabd->abd_size;
+	mutex_exit(&abd->abd_mutex);
+
+	ABDSTAT_BUMP(abdstat_gang_children);
+}
+
+/*
+ * Append size bytes of cabd, starting at off, to the gang ABD. The data
+ * is referenced, not copied, so cabd must not be freed before the gang.
+ */
+void
+abd_gang_add(abd_t *abd, abd_t *cabd, size_t off, size_t size)
+{
+	abd_gang_add_child(abd, abd_get_offset_size(cabd, off, size));
+}
+
+/*
+ * Append a gap of size bytes to the gang ABD. If zero is set the gap
+ * reads as zeroes and must not be written to, which makes it suitable
+ * for the gang's data to be written out; otherwise it is backed by a
+ * private scratch buffer with undefined contents, for the gaps of reads.
+ */
+void
+abd_gang_add_gap(abd_t *abd, size_t size, boolean_t zero)
+{
+	if (!zero) {
+		abd_gang_add_child(abd, abd_alloc(size, B_FALSE));
+		return;
+	}
+
+	while (size > 0) {
+		size_t len = MIN(size, ABD_ZERO_SIZE);
+
+		abd_gang_add_child(abd,
+		    abd_get_offset_size(abd_zero_buf, 0, len));
+		size -= len;
+	}
+}
+
 /*
  * Allocate a new ABD to point to offset off of sabd. It shares the underlying
  * buffer data with sabd. Use abd_put() to free. sabd must not be freed while
@@ -644,6 +814,9 @@ abd_get_offset_impl(abd_t *sabd, size_t off, size_t size)
 {
 	abd_t *abd;
 
+	/* Gangs are only built for vdev I/O, and never subdivided */
+	VERIFY(!abd_is_gang(sabd));
+
 	mutex_enter(&sabd->abd_mutex);
 	abd_verify(sabd);
 	sabd->abd_flags |= ABD_FLAG_NOMOVE;
@@ -804,6 +977,11 @@ abd_to_buf_ephemeral(abd_t *abd)
  * into the buffer. If the ABD is scattered, this will allocate a raw buffer
  * whose contents are undefined. To copy over the existing data in the ABD, use
  * abd_borrow_buf_copy() instead.
+ *
+ * (APPLE) The buffer of a linear ABD is lent without setting
+ * ABD_FLAG_NOMOVE: the hold taken on abd_children below already stops
+ * abd_try_move() until the buffer is returned, and the ABD stays movable
+ * afterwards.
  */
 void *
 abd_borrow_buf(abd_t *abd, size_t n)
@@ -813,9 +991,7 @@ abd_borrow_buf(abd_t *abd, size_t n)
 	abd_verify(abd);
 	ASSERT3U((size_t)abd->abd_size, >=, n);
 	if (abd_is_linear(abd)) {
-		mutex_exit(&abd->abd_mutex);
-		buf = abd_to_buf(abd);
-		mutex_enter(&abd->abd_mutex);
+		buf = abd->abd_u.abd_linear.abd_buf;
 	} else {
 		buf = zio_buf_alloc(n);
 	}
@@ -851,9 +1027,7 @@ abd_return_buf(abd_t *abd, void *buf, size_t n)
 	VERIFY_BUF_NOMAGIC(buf, n);
 	ASSERT3U((size_t)abd->abd_size, >=, n);
 	if (abd_is_linear(abd)) {
-		mutex_exit(&abd->abd_mutex);
-		ASSERT3P(buf, ==, abd_to_buf(abd));
-		mutex_enter(&abd->abd_mutex);
+		ASSERT3P(buf, ==, abd->abd_u.abd_linear.abd_buf);
 	} else {
 		mutex_exit(&abd->abd_mutex);
 		ASSERT0(abd_cmp_buf(abd, buf, n));
@@ -904,9 +1078,7 @@ abd_return_buf_off(abd_t *abd, void *buf, size_t off, size_t len, size_t n)
 	VERIFY_BUF_NOMAGIC(buf, n);
 	ASSERT3U((size_t)abd->abd_size, >=, n);
 	if (abd_is_linear(abd)) {
-		mutex_exit(&abd->abd_mutex);
-		ASSERT3P(buf, ==, abd_to_buf(abd));
-		mutex_enter(&abd->abd_mutex);
+		ASSERT3P(buf, ==, abd->abd_u.abd_linear.abd_buf);
 	} else {
 		mutex_exit(&abd->abd_mutex);
 		ASSERT0(abd_cmp_buf_off(abd, buf, off, len));
@@ -969,6 +1141,8 @@ struct abd_iter {
 	size_t		iter_pos;	/* position (relative to abd_offset) */
 	void		*iter_mapaddr;	/* addr corresponding to iter_pos */
 	size_t		iter_mapsize;	/* length of data valid at mapaddr */
+	uint_t		iter_child;	/* gang child containing iter_pos */
+	size_t		iter_child_pos;	/* position of that child */
 };
 
 static inline size_t
@@ -998,6 +1172,8 @@ abd_iter_init(struct abd_iter *aiter, abd_t *abd)
 	aiter->iter_pos = 0;
 	aiter->iter_mapaddr = NULL;
 	aiter->iter_mapsize = 0;
+	aiter->iter_child = 0;
+	aiter->iter_child_pos = 0;
 }
 
 /*
@@ -1018,6 +1194,27 @@ abd_iter_advance(struct abd_iter *aiter, size_t amount)
 	aiter->iter_pos += amount;
 }
 
+/*
+ * Find the child of a gang ABD containing the iterator's position, and
+ * the offset of that position within it. The iterator only moves
+ * forward, so the search resumes from the last child found.
+ */
+static abd_t *
+abd_iter_gang_child(struct abd_iter *aiter, size_t *offp)
+{
+	struct abd_gang *gang = &aiter->iter_abd->abd_u.abd_gang;
+	abd_t *cabd = gang->abd_gang_children[aiter->iter_child];
+
+	while (aiter->iter_pos >= aiter->iter_child_pos + cabd->abd_size) {
+		aiter->iter_child_pos += cabd->abd_size;
+		ASSERT3U(aiter->iter_child + 1, <, gang->abd_nchildren);
+		cabd = gang->abd_gang_children[++aiter->iter_child];
+	}
+
+	*offp = aiter->iter_pos - aiter->iter_child_pos;
+	return (cabd);
+}
+
 /*
  * Map the current chunk into aiter. This can be safely called when the aiter
  * has already exhausted, in which case this does nothing.
@@ -1032,7 +1229,8 @@ abd_iter_map(struct abd_iter *aiter)
 	ASSERT0(aiter->iter_mapsize);
 
 	/* Panic if someone has changed zfs_abd_chunk_size */
-	IMPLY(!abd_is_linear(aiter->iter_abd), zfs_abd_chunk_size ==
+	IMPLY(!abd_is_linear(aiter->iter_abd) &&
+	    !abd_is_gang(aiter->iter_abd), zfs_abd_chunk_size ==
 	    aiter->iter_abd->abd_u.abd_scatter.abd_chunk_size);
 
 	/* There's nothing left to iterate over, so do nothing */
@@ -1043,6 +1241,26 @@ abd_iter_map(struct abd_iter *aiter)
 		offset = aiter->iter_pos;
 		aiter->iter_mapsize = aiter->iter_abd->abd_size - offset;
 		paddr = aiter->iter_abd->abd_u.abd_linear.abd_buf;
+	} else if (abd_is_gang(aiter->iter_abd)) {
+		size_t coff;
+		abd_t *cabd = abd_iter_gang_child(aiter, &coff);
+
+		/* Never map past the end of the child */
+		if (abd_is_linear(cabd)) {
+			offset = coff;
+			aiter->iter_mapsize = cabd->abd_size - coff;
+			paddr = cabd->abd_u.abd_linear.abd_buf;
+		} else {
+			size_t pos = cabd->abd_u.abd_scatter.abd_offset + coff;
+
+			ASSERT3U(cabd->abd_u.abd_scatter.abd_chunk_size, ==,
+			    zfs_abd_chunk_size);
+			offset = pos % zfs_abd_chunk_size;
+			aiter->iter_mapsize = MIN(zfs_abd_chunk_size - offset,
+			    cabd->abd_size - coff);
+			paddr = cabd->abd_u.abd_scatter.abd_chunks[
+			    pos / zfs_abd_chunk_size];
+		}
 	} else {
 		size_t index = abd_iter_scatter_chunk_index(aiter);
 		offset = abd_iter_scatter_chunk_offset(aiter);
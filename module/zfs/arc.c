@@ -334,6 +334,19 @@ uint_t arc_reduce_dnlc_percent = 3;
  */
 int zfs_arc_evict_batch_limit = 10;
 
+/*
+ * The maximum number of threads used to evict from a single arc state
+ * list.  When greater than one, arc_evict_state() divides the sublists
+ * among up to this many workers on arc_evict_taskq, with one worker per
+ * zfs_arc_evict_thread_bytes of the amount to evict; small evictions
+ * remain single threaded.  Zero or one disables parallel eviction.
+ */
+int zfs_arc_evict_threads = 0;
+uint64_t zfs_arc_evict_thread_bytes = 32 << 20;
+
+static taskq_t		*arc_evict_taskq;
+static int		arc_evict_taskq_nthreads;
+
 /*
  * The number of sublists used for each of the arc state lists. If this
  * is not set to a suitable value by the user, it will be configured to
@@ -471,6 +484,25 @@ typedef struct arc_stats {
 	 * buffers to reach its target amount.
 	 */
 	kstat_named_t arcstat_evict_not_enough;
+	/*
+	 * Bytes evicted by arc_evict_state() and the time it spent doing
+	 * so; their ratio is the eviction throughput.
+	 */
+	kstat_named_t arcstat_evict_bytes;
+	kstat_named_t arcstat_evict_time_ns;
+	/*
+	 * Number of arc_evict_state() calls that were spread over several
+	 * threads, and the total number of workers they used.
+	 */
+	kstat_named_t arcstat_evict_parallel;
+	kstat_named_t arcstat_evict_parallel_workers;
+	/*
+	 * Number of times an allocation in arc_get_data_impl() found the
+	 * ARC overflowing and had to wait for reclaim, and the total time
+	 * spent waiting.
+	 */
+	kstat_named_t arcstat_evict_alloc_waits;
+	kstat_named_t arcstat_evict_alloc_wait_ns;
 	kstat_named_t arcstat_evict_l2_cached;
 	kstat_named_t arcstat_evict_l2_eligible;
 	kstat_named_t arcstat_evict_l2_ineligible;
@@ -480,6 +512,22 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_hash_collisions;
 	kstat_named_t arcstat_hash_chains;
 	kstat_named_t arcstat_hash_chain_max;
+	kstat_named_t arcstat_hash_buckets;
+	kstat_named_t arcstat_hash_locks;
+	kstat_named_t arcstat_hash_grows;
+	kstat_named_t arcstat_hash_shrinks;
+	/*
+	 * Number of hash table lookups, and the number of headers they
+	 * walked; their ratio is the average chain length seen by lookups.
+	 */
+	kstat_named_t arcstat_hash_lookups;
+	kstat_named_t arcstat_hash_lookup_walked;
+	/*
+	 * Number of hash lock acquisitions in lookups and inserts that had
+	 * to wait for another thread, and the total time they waited.
+	 */
+	kstat_named_t arcstat_hash_lock_waits;
+	kstat_named_t arcstat_hash_lock_wait_ns;
 	kstat_named_t arcstat_p;
 	kstat_named_t arcstat_c;
 	kstat_named_t arcstat_c_min;
@@ -657,6 +705,23 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_lsize;
 	kstat_named_t arcstat_l2_psize;
 	kstat_named_t arcstat_l2_hdr_size;
+	/*
+	 * Persistent L2ARC: log blocks written, and the outcome, progress
+	 * and duration (in milliseconds, summed over all devices) of the
+	 * rebuilds done when cache devices are added back to a pool.
+	 */
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_rebuild_success;
+	kstat_named_t arcstat_l2_rebuild_unsupported;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_errors;
+	kstat_named_t arcstat_l2_rebuild_lowmem;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_size;
+	kstat_named_t arcstat_l2_rebuild_asize;
+	kstat_named_t arcstat_l2_rebuild_time_ms;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_meta_used;
 	kstat_named_t arcstat_meta_limit;
@@ -712,6 +777,12 @@ static arc_stats_t arc_stats = {
 	{ "mutex_miss",			KSTAT_DATA_UINT64 },
 	{ "evict_skip",			KSTAT_DATA_UINT64 },
 	{ "evict_not_enough",		KSTAT_DATA_UINT64 },
+	{ "evict_bytes",		KSTAT_DATA_UINT64 },
+	{ "evict_time_ns",		KSTAT_DATA_UINT64 },
+	{ "evict_parallel",		KSTAT_DATA_UINT64 },
+	{ "evict_parallel_workers",	KSTAT_DATA_UINT64 },
+	{ "evict_alloc_waits",		KSTAT_DATA_UINT64 },
+	{ "evict_alloc_wait_ns",	KSTAT_DATA_UINT64 },
 	{ "evict_l2_cached",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_eligible",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_ineligible",	KSTAT_DATA_UINT64 },
@@ -721,6 +792,14 @@ static arc_stats_t arc_stats = {
 	{ "hash_collisions",		KSTAT_DATA_UINT64 },
 	{ "hash_chains",		KSTAT_DATA_UINT64 },
 	{ "hash_chain_max",		KSTAT_DATA_UINT64 },
+	{ "hash_buckets",		KSTAT_DATA_UINT64 },
+	{ "hash_locks",			KSTAT_DATA_UINT64 },
+	{ "hash_grows",			KSTAT_DATA_UINT64 },
+	{ "hash_shrinks",		KSTAT_DATA_UINT64 },
+	{ "hash_lookups",		KSTAT_DATA_UINT64 },
+	{ "hash_lookup_walked",		KSTAT_DATA_UINT64 },
+	{ "hash_lock_waits",		KSTAT_DATA_UINT64 },
+	{ "hash_lock_wait_ns",		KSTAT_DATA_UINT64 },
 	{ "p",				KSTAT_DATA_UINT64 },
 	{ "c",				KSTAT_DATA_UINT64 },
 	{ "c_min",			KSTAT_DATA_UINT64 },
@@ -769,6 +848,18 @@ static arc_stats_t arc_stats = {
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_asize",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_success",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_unsupported",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_size",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_asize",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_time_ms",		KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "arc_meta_used",		KSTAT_DATA_UINT64 },
 	{ "arc_meta_limit",		KSTAT_DATA_UINT64 },
@@ -988,30 +1079,61 @@ typedef struct l2arc_dev l2arc_dev_t;
  * Hash table routines
  */
 
+/*
+ * The buckets are protected by a power-of-two number of lock stripes,
+ * never more than there are buckets.  A header with hash value hv lives
+ * in bucket (hv & ht_mask) of the table and is protected by stripe
+ * (hv & (ht_nlocks - 1)).  The stripe, and so HDR_LOCK(), does not
+ * depend on the table size, which lets the table follow arc_c: the
+ * reclaim thread rehashes it one stripe at a time, and each stripe
+ * records the table it uses so that lookups never need more than their
+ * own stripe lock.  Hash statistics are kept per stripe, under its lock,
+ * and summed by arc_kstat_update().
+ */
 #define	HT_LOCK_PAD	64
+#define	HT_LOCK_SIZE \
+	(sizeof (kmutex_t) + sizeof (void *) + 9 * sizeof (uint64_t))
 
 struct ht_lock {
 	kmutex_t	ht_lock;
+	arc_buf_hdr_t	**ht_table;	/* table used by this stripe */
+	uint64_t	ht_mask;	/* mask of ht_table */
+	uint64_t	ht_elements;	/* headers hashed under this stripe */
+	uint64_t	ht_collisions;	/* inserts into a non-empty chain */
+	uint64_t	ht_chains;	/* chains longer than one header */
+	uint64_t	ht_chain_max;	/* longest chain inserted into */
+	uint64_t	ht_lookups;	/* buf_hash_find() calls */
+	uint64_t	ht_walked;	/* headers walked by those */
+	uint64_t	ht_waits;	/* lock acquisitions that waited */
+	uint64_t	ht_wait_time;	/* ns spent waiting for the lock */
 #ifdef _KERNEL
-	unsigned char	pad[(HT_LOCK_PAD - sizeof (kmutex_t))];
+	unsigned char	pad[(HT_LOCK_PAD - (HT_LOCK_SIZE % HT_LOCK_PAD))];
 #endif
 };
 
-#define	BUF_LOCKS 256
+#define	BUF_LOCKS 256		/* minimum number of lock stripes */
+#define	BUF_LOCKS_PER_CPU 64
 typedef struct buf_hash_table {
 	uint64_t ht_mask;
 	arc_buf_hdr_t **ht_table;
-	struct ht_lock ht_locks[BUF_LOCKS];
+	uint64_t ht_nlocks;
+	struct ht_lock *ht_locks;
+	uint64_t ht_grows;
+	uint64_t ht_shrinks;
 } buf_hash_table_t;
 
 static buf_hash_table_t buf_hash_table;
 
-#define	BUF_HASH_INDEX(spa, dva, birth) \
-	(buf_hash(spa, dva, birth) & buf_hash_table.ht_mask)
-#define	BUF_HASH_LOCK_NTRY(idx) (buf_hash_table.ht_locks[idx & (BUF_LOCKS-1)])
-#define	BUF_HASH_LOCK(idx)	(&(BUF_HASH_LOCK_NTRY(idx).ht_lock))
+/*
+ * Allow the hash table to be resized as arc_c changes.
+ */
+int zfs_arc_hash_resize = 1;
+
+#define	BUF_HASH_LOCK_NTRY(hv) \
+	(buf_hash_table.ht_locks[(hv) & (buf_hash_table.ht_nlocks - 1)])
+#define	BUF_HASH_LOCK(hv)	(&(BUF_HASH_LOCK_NTRY(hv).ht_lock))
 #define	HDR_LOCK(hdr) \
-	(BUF_HASH_LOCK(BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth)))
+	(BUF_HASH_LOCK(buf_hash(hdr->b_spa, &hdr->b_dva, hdr->b_birth)))
 
 #ifdef __APPLE__
 uint64_t *zfs_crc64_table = NULL;
@@ -1055,6 +1177,7 @@ uint64_t l2arc_feed_min_ms = L2ARC_FEED_MIN_MS;	/* min interval milliseconds */
 boolean_t l2arc_noprefetch = B_TRUE;		/* don't cache prefetch bufs */
 boolean_t l2arc_feed_again = B_TRUE;		/* turbo warmup */
 boolean_t l2arc_norw = B_TRUE;			/* no reads during writes */
+boolean_t l2arc_rebuild_enabled = B_TRUE;	/* rebuild from device logs */
 
 static list_t L2ARC_dev_list;			/* device list */
 static list_t *l2arc_dev_list;			/* device list pointer */
@@ -1064,6 +1187,8 @@ static list_t L2ARC_free_on_write;		/* free after write buf list */
 static list_t *l2arc_free_on_write;		/* free after write list ptr */
 static kmutex_t l2arc_free_on_write_mtx;	/* mutex for list */
 static uint64_t l2arc_ndev;			/* number of devices */
+static kmutex_t l2arc_rebuild_thr_lock;		/* l2ad_rebuild* lock */
+static kcondvar_t l2arc_rebuild_thr_cv;		/* rebuild thread exit */
 
 typedef struct l2arc_read_callback {
 	arc_buf_hdr_t		*l2rcb_hdr;		/* read header */
@@ -1147,24 +1272,44 @@ buf_discard_identity(arc_buf_hdr_t *hdr)
 	hdr->b_birth = 0;
 }
 
+/*
+ * Acquire the stripe lock covering hash value hv, accounting for the
+ * time spent waiting if it is contended.
+ */
+static struct ht_lock *
+buf_hash_lock_enter(uint64_t hv)
+{
+	struct ht_lock *htl = &BUF_HASH_LOCK_NTRY(hv);
+
+	if (!mutex_tryenter(&htl->ht_lock)) {
+		hrtime_t start = gethrtime();
+
+		mutex_enter(&htl->ht_lock);
+		htl->ht_waits++;
+		htl->ht_wait_time += gethrtime() - start;
+	}
+	return (htl);
+}
+
 static arc_buf_hdr_t *
 buf_hash_find(uint64_t spa, const blkptr_t *bp, kmutex_t **lockp)
 {
 	const dva_t *dva = BP_IDENTITY(bp);
 	uint64_t birth = BP_PHYSICAL_BIRTH(bp);
-	uint64_t idx = BUF_HASH_INDEX(spa, dva, birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
+	uint64_t hv = buf_hash(spa, dva, birth);
+	struct ht_lock *htl = buf_hash_lock_enter(hv);
 	arc_buf_hdr_t *hdr;
 
-	mutex_enter(hash_lock);
-	for (hdr = buf_hash_table.ht_table[idx]; hdr != NULL;
+	htl->ht_lookups++;
+	for (hdr = htl->ht_table[hv & htl->ht_mask]; hdr != NULL;
 	    hdr = hdr->b_hash_next) {
+		htl->ht_walked++;
 		if (HDR_EQUAL(spa, dva, birth, hdr)) {
-			*lockp = hash_lock;
+			*lockp = &htl->ht_lock;
 			return (hdr);
 		}
 	}
-	mutex_exit(hash_lock);
+	mutex_exit(&htl->ht_lock);
 	*lockp = NULL;
 	return (NULL);
 }
@@ -1179,9 +1324,9 @@ buf_hash_find(uint64_t spa, const blkptr_t *bp, kmutex_t **lockp)
 static arc_buf_hdr_t *
 buf_hash_insert(arc_buf_hdr_t *hdr, kmutex_t **lockp)
 {
-	uint64_t idx = BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
-	arc_buf_hdr_t *fhdr;
+	uint64_t hv = buf_hash(hdr->b_spa, &hdr->b_dva, hdr->b_birth);
+	struct ht_lock *htl;
+	arc_buf_hdr_t *fhdr, **hdrp;
 	uint32_t i;
 
 	ASSERT(!DVA_IS_EMPTY(&hdr->b_dva));
@@ -1189,33 +1334,34 @@ buf_hash_insert(arc_buf_hdr_t *hdr, kmutex_t **lockp)
 	ASSERT(!HDR_IN_HASH_TABLE(hdr));
 
 	if (lockp != NULL) {
-		*lockp = hash_lock;
-		mutex_enter(hash_lock);
+		htl = buf_hash_lock_enter(hv);
+		*lockp = &htl->ht_lock;
 	} else {
-		ASSERT(MUTEX_HELD(hash_lock));
+		htl = &BUF_HASH_LOCK_NTRY(hv);
+		ASSERT(MUTEX_HELD(&htl->ht_lock));
 	}
 
-	for (fhdr = buf_hash_table.ht_table[idx], i = 0; fhdr != NULL;
+	hdrp = &htl->ht_table[hv & htl->ht_mask];
+	for (fhdr = *hdrp, i = 0; fhdr != NULL;
 	    fhdr = fhdr->b_hash_next, i++) {
 		if (HDR_EQUAL(hdr->b_spa, &hdr->b_dva, hdr->b_birth, fhdr))
 			return (fhdr);
 	}
 
-	hdr->b_hash_next = buf_hash_table.ht_table[idx];
-	buf_hash_table.ht_table[idx] = hdr;
+	hdr->b_hash_next = *hdrp;
+	*hdrp = hdr;
 	arc_hdr_set_flags(hdr, ARC_FLAG_IN_HASH_TABLE);
 
 	/* collect some hash table performance data */
 	if (i > 0) {
-		ARCSTAT_BUMP(arcstat_hash_collisions);
+		htl->ht_collisions++;
 		if (i == 1)
-			ARCSTAT_BUMP(arcstat_hash_chains);
+			htl->ht_chains++;
 
-		ARCSTAT_MAX(arcstat_hash_chain_max, i);
+		htl->ht_chain_max = MAX(htl->ht_chain_max, i);
 	}
 
-	ARCSTAT_BUMP(arcstat_hash_elements);
-	ARCSTAT_MAXSTAT(arcstat_hash_elements);
+	htl->ht_elements++;
 
 	return (NULL);
 }
@@ -1223,13 +1369,14 @@ buf_hash_insert(arc_buf_hdr_t *hdr, kmutex_t **lockp)
 static void
 buf_hash_remove(arc_buf_hdr_t *hdr)
 {
-	arc_buf_hdr_t *fhdr, **hdrp;
-	uint64_t idx = BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth);
+	arc_buf_hdr_t *fhdr, **hdrp, **head;
+	uint64_t hv = buf_hash(hdr->b_spa, &hdr->b_dva, hdr->b_birth);
+	struct ht_lock *htl = &BUF_HASH_LOCK_NTRY(hv);
 
-	ASSERT(MUTEX_HELD(BUF_HASH_LOCK(idx)));
+	ASSERT(MUTEX_HELD(&htl->ht_lock));
 	ASSERT(HDR_IN_HASH_TABLE(hdr));
 
-	hdrp = &buf_hash_table.ht_table[idx];
+	head = hdrp = &htl->ht_table[hv & htl->ht_mask];
 	while ((fhdr = *hdrp) != hdr) {
 		ASSERT3P(fhdr, !=, NULL);
 		hdrp = &fhdr->b_hash_next;
@@ -1239,11 +1386,153 @@ buf_hash_remove(arc_buf_hdr_t *hdr)
 	arc_hdr_clear_flags(hdr, ARC_FLAG_IN_HASH_TABLE);
 
 	/* collect some hash table performance data */
-	ARCSTAT_BUMPDOWN(arcstat_hash_elements);
+	htl->ht_elements--;
+
+	if (*head != NULL && (*head)->b_hash_next == NULL)
+		htl->ht_chains--;
+}
+
+static uint64_t
+buf_hash_elements(void)
+{
+	uint64_t elements = 0;
+
+	for (uint64_t i = 0; i < buf_hash_table.ht_nlocks; i++)
+		elements += buf_hash_table.ht_locks[i].ht_elements;
+
+	return (elements);
+}
+
+/*
+ * The table is sized to hold arc_c worth of zfs_arc_average_blocksize
+ * blocks, or all the headers currently hashed (which include ghost and
+ * L2ARC-only headers) if there are more.  It grows as soon as it is too
+ * small, and shrinks only once it is four times larger than needed.
+ */
+static uint64_t
+buf_hash_target_size(void)
+{
+	uint64_t size = buf_hash_table.ht_mask + 1;
+	uint64_t want;
 
-	if (buf_hash_table.ht_table[idx] &&
-	    buf_hash_table.ht_table[idx]->b_hash_next == NULL)
-		ARCSTAT_BUMPDOWN(arcstat_hash_chains);
+	if (!zfs_arc_hash_resize)
+		return (size);
+
+	want = MAX(arc_c / MAX(zfs_arc_average_blocksize, SPA_MINBLOCKSIZE),
+	    buf_hash_elements());
+	while (size < want)
+		size <<= 1;
+	while (size >= 4 * want && size / 2 >= buf_hash_table.ht_nlocks)
+		size >>= 1;
+
+	return (size);
+}
+
+/*
+ * Rehash the table to buf_hash_target_size() buckets, one stripe at a
+ * time, the same way dbuf_hash_resize() does for the dbuf hash table;
+ * see the comment there for why that is safe.  Also recounts each
+ * stripe's chains for the kstat.
+ *
+ * Called only from the reclaim thread, so resizes never overlap.
+ * Returns ENOMEM if the new table could not be allocated.
+ */
+static int
+buf_hash_resize(void)
+{
+	buf_hash_table_t *ht = &buf_hash_table;
+	uint64_t osize = ht->ht_mask + 1;
+	uint64_t size = buf_hash_target_size();
+	arc_buf_hdr_t **otable = ht->ht_table;
+	arc_buf_hdr_t **ntable, *hdr;
+
+	if (size == osize)
+		return (0);
+
+	ASSERT(ISP2(size));
+	ASSERT3U(size, >=, ht->ht_nlocks);
+
+	ntable = kmem_zalloc(size * sizeof (void *), KM_NOSLEEP);
+	if (ntable == NULL)
+		return (SET_ERROR(ENOMEM));
+
+	for (uint64_t i = 0; i < ht->ht_nlocks; i++) {
+		struct ht_lock *htl = &ht->ht_locks[i];
+		uint64_t idx;
+
+		mutex_enter(&htl->ht_lock);
+		ASSERT3P(htl->ht_table, ==, otable);
+		for (idx = i; idx < osize; idx += ht->ht_nlocks) {
+			while ((hdr = otable[idx]) != NULL) {
+				uint64_t nidx = buf_hash(hdr->b_spa,
+				    &hdr->b_dva, hdr->b_birth) & (size - 1);
+
+				otable[idx] = hdr->b_hash_next;
+				hdr->b_hash_next = ntable[nidx];
+				ntable[nidx] = hdr;
+			}
+		}
+
+		htl->ht_chains = 0;
+		for (idx = i; idx < size; idx += ht->ht_nlocks) {
+			if (ntable[idx] != NULL &&
+			    ntable[idx]->b_hash_next != NULL)
+				htl->ht_chains++;
+		}
+
+		htl->ht_table = ntable;
+		htl->ht_mask = size - 1;
+		mutex_exit(&htl->ht_lock);
+	}
+
+	ht->ht_table = ntable;
+	ht->ht_mask = size - 1;
+	if (size > osize)
+		ht->ht_grows++;
+	else
+		ht->ht_shrinks++;
+
+	kmem_free(otable, osize * sizeof (void *));
+	return (0);
+}
+
+/*
+ * Sum the per-stripe hash statistics into arcstats.
+ */
+static void
+buf_hash_kstat_update(arc_stats_t *as)
+{
+	buf_hash_table_t *ht = &buf_hash_table;
+	uint64_t elements = 0, collisions = 0, chains = 0, chain_max = 0;
+	uint64_t lookups = 0, walked = 0, waits = 0, wait_time = 0;
+
+	for (uint64_t i = 0; i < ht->ht_nlocks; i++) {
+		struct ht_lock *htl = &ht->ht_locks[i];
+
+		elements += htl->ht_elements;
+		collisions += htl->ht_collisions;
+		chains += htl->ht_chains;
+		chain_max = MAX(chain_max, htl->ht_chain_max);
+		lookups += htl->ht_lookups;
+		walked += htl->ht_walked;
+		waits += htl->ht_waits;
+		wait_time += htl->ht_wait_time;
+	}
+
+	as->arcstat_hash_elements.value.ui64 = elements;
+	as->arcstat_hash_elements_max.value.ui64 =
+	    MAX(as->arcstat_hash_elements_max.value.ui64, elements);
+	as->arcstat_hash_collisions.value.ui64 = collisions;
+	as->arcstat_hash_chains.value.ui64 = chains;
+	as->arcstat_hash_chain_max.value.ui64 = chain_max;
+	as->arcstat_hash_buckets.value.ui64 = ht->ht_mask + 1;
+	as->arcstat_hash_locks.value.ui64 = ht->ht_nlocks;
+	as->arcstat_hash_grows.value.ui64 = ht->ht_grows;
+	as->arcstat_hash_shrinks.value.ui64 = ht->ht_shrinks;
+	as->arcstat_hash_lookups.value.ui64 = lookups;
+	as->arcstat_hash_lookup_walked.value.ui64 = walked;
+	as->arcstat_hash_lock_waits.value.ui64 = waits;
+	as->arcstat_hash_lock_wait_ns.value.ui64 = wait_time;
 }
 
 /*
@@ -1262,8 +1551,10 @@ buf_fini(void)
 
 	kmem_free(buf_hash_table.ht_table,
 	    (buf_hash_table.ht_mask + 1) * sizeof (void *));
-	for (i = 0; i < BUF_LOCKS; i++)
+	for (i = 0; i < buf_hash_table.ht_nlocks; i++)
 		mutex_destroy(&buf_hash_table.ht_locks[i].ht_lock);
+	kmem_free(buf_hash_table.ht_locks,
+	    buf_hash_table.ht_nlocks * sizeof (struct ht_lock));
 	kmem_cache_destroy(hdr_full_cache);
 	kmem_cache_destroy(hdr_full_crypt_cache);
 	kmem_cache_destroy(hdr_l2only_cache);
@@ -1405,13 +1696,19 @@ buf_init(void)
 	int i, j;
 
 	/*
-	 * The hash table is big enough to fill all of physical memory
-	 * with an average block size of zfs_arc_average_blocksize (default 8K).
-	 * By default, the table will take up
-	 * totalmem * sizeof(void*) / 8K (1MB per GB with 8-byte pointers).
+	 * The hash table starts out big enough to fill arc_c with an
+	 * average block size of zfs_arc_average_blocksize (default 8K),
+	 * and follows arc_c from then on (see buf_hash_resize()).  With
+	 * zfs_arc_hash_resize disabled it keeps the historical size, big
+	 * enough to fill all of physical memory.
 	 */
-	while (hsize * zfs_arc_average_blocksize < physmem * PAGESIZE)
-		hsize <<= 1;
+	if (zfs_arc_hash_resize) {
+		while (hsize * zfs_arc_average_blocksize < arc_c)
+			hsize <<= 1;
+	} else {
+		while (hsize * zfs_arc_average_blocksize < physmem * PAGESIZE)
+			hsize <<= 1;
+	}
 retry:
 	buf_hash_table.ht_mask = hsize - 1;
 	buf_hash_table.ht_table =
@@ -1439,9 +1736,23 @@ retry:
 		for (ct = zfs_crc64_table + i, *ct = i, j = 8; j > 0; j--)
 			*ct = (*ct >> 1) ^ (-(*ct & 1) & ZFS_CRC64_POLY);
 
-	for (i = 0; i < BUF_LOCKS; i++) {
-		mutex_init(&buf_hash_table.ht_locks[i].ht_lock,
-		    NULL, MUTEX_DEFAULT, NULL);
+	/*
+	 * Scale the number of lock stripes with the number of CPUs.  The
+	 * stripe count is fixed from here on, and the table never shrinks
+	 * below it.
+	 */
+	buf_hash_table.ht_nlocks = BUF_LOCKS;
+	while (buf_hash_table.ht_nlocks < max_ncpus * BUF_LOCKS_PER_CPU &&
+	    buf_hash_table.ht_nlocks < hsize)
+		buf_hash_table.ht_nlocks <<= 1;
+	buf_hash_table.ht_locks = kmem_zalloc(buf_hash_table.ht_nlocks *
+	    sizeof (struct ht_lock), KM_SLEEP);
+	for (i = 0; i < buf_hash_table.ht_nlocks; i++) {
+		struct ht_lock *htl = &buf_hash_table.ht_locks[i];
+
+		mutex_init(&htl->ht_lock, NULL, MUTEX_DEFAULT, NULL);
+		htl->ht_table = buf_hash_table.ht_table;
+		htl->ht_mask = buf_hash_table.ht_mask;
 	}
 }
 
@@ -1963,7 +2274,7 @@ arc_hdr_authenticate(arc_buf_hdr_t *hdr, spa_t *spa, uint64_t dsobj)
 		abd_take_ownership_of_buf(abd, B_TRUE);
 
 		csize = zio_compress_data(HDR_GET_COMPRESS(hdr),
-		    hdr->b_l1hdr.b_pabd, tmpbuf, lsize);
+		    hdr->b_l1hdr.b_pabd, tmpbuf, lsize, B_FALSE);
 		ASSERT3U(csize, <=, psize);
 		abd_zero_off(abd, csize, psize - csize);
 	}
@@ -4048,53 +4359,20 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 }
 
 /*
- * Evict buffers from the given arc state, until we've removed the
- * specified number of bytes. Move the removed buffers to the
- * appropriate evict state.
- *
- * This function makes a "best effort". It skips over any buffers
- * it can't get a hash_lock on, and so, may not catch all candidates.
- * It may also return without evicting as much space as requested.
- *
- * If bytes is specified using the special value ARC_EVICT_ALL, this
- * will evict all available (i.e. unlocked and evictable) buffers from
- * the given arc state; which is used by arc_flush().
+ * Evict up to the specified number of bytes from the sublists of ml
+ * whose index is congruent to first modulo stride, continuing from
+ * each sublist's marker.  With first == 0 and stride == 1 this covers
+ * every sublist.
  */
 static uint64_t
-arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
-    arc_buf_contents_t type)
+arc_evict_sublists(multilist_t *ml, arc_buf_hdr_t **markers, uint64_t spa,
+    int64_t bytes, int first, int stride)
 {
+	int num_sublists = multilist_get_num_sublists(ml);
+	int count = (num_sublists - first + stride - 1) / stride;
 	uint64_t total_evicted = 0;
-	multilist_t *ml = state->arcs_list[type];
-	int num_sublists;
-	arc_buf_hdr_t **markers;
 
-	IMPLY(bytes < 0, bytes == ARC_EVICT_ALL);
-
-	num_sublists = multilist_get_num_sublists(ml);
-
-	/*
-	 * If we've tried to evict from each sublist, made some
-	 * progress, but still have not hit the target number of bytes
-	 * to evict, we want to keep trying. The markers allow us to
-	 * pick up where we left off for each individual sublist, rather
-	 * than starting from the tail each time.
-	 */
-	markers = kmem_zalloc(sizeof (*markers) * num_sublists, KM_SLEEP);
-	for (int i = 0; i < num_sublists; i++) {
-		markers[i] = kmem_cache_alloc(hdr_full_cache, KM_SLEEP);
-
-		/*
-		 * A b_spa of 0 is used to indicate that this header is
-		 * a marker. This fact is used in arc_adjust_type() and
-		 * arc_evict_state_impl().
-		 */
-		markers[i]->b_spa = 0;
-
-		multilist_sublist_t *mls = multilist_sublist_lock(ml, i);
-		multilist_sublist_insert_tail(mls, markers[i]);
-		multilist_sublist_unlock(mls);
-	}
+	ASSERT3S(first, <, num_sublists);
 
 	/*
 	 * While we haven't hit our target number of bytes to evict, or
@@ -4108,10 +4386,11 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		 * (e.g. index 0) would cause evictions to favor certain
 		 * sublists over others.
 		 */
-		int sublist_idx = multilist_get_random_index(ml);
+		int sublist_idx = first +
+		    stride * (multilist_get_random_index(ml) % count);
 		uint64_t scan_evicted = 0;
 
-		for (int i = 0; i < num_sublists; i++) {
+		for (int i = 0; i < count; i++) {
 			uint64_t bytes_remaining;
 			uint64_t bytes_evicted;
 
@@ -4129,8 +4408,9 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 			total_evicted += bytes_evicted;
 
 			/* we've reached the end, wrap to the beginning */
-			if (++sublist_idx >= num_sublists)
-				sublist_idx = 0;
+			sublist_idx += stride;
+			if (sublist_idx >= num_sublists)
+				sublist_idx = first;
 		}
 
 		/*
@@ -4141,22 +4421,196 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		if (scan_evicted == 0) {
 			/* This isn't possible, let's make that obvious */
 			ASSERT3S(bytes, !=, 0);
-
-			/*
-			 * When bytes is ARC_EVICT_ALL, the only way to
-			 * break the loop is when scan_evicted is zero.
-			 * In that case, we actually have evicted enough,
-			 * so we don't want to increment the kstat.
-			 */
-			if (bytes != ARC_EVICT_ALL) {
-				ASSERT3S(total_evicted, <, bytes);
-				ARCSTAT_BUMP(arcstat_evict_not_enough);
-			}
-
 			break;
 		}
 	}
 
+	return (total_evicted);
+}
+
+typedef struct arc_evict_task {
+	multilist_t	*aet_ml;
+	arc_buf_hdr_t	**aet_markers;
+	uint64_t	aet_spa;
+	int64_t		aet_bytes;
+	int		aet_first;
+	int		aet_stride;
+	uint64_t	aet_evicted;
+	kmutex_t	*aet_lock;
+	kcondvar_t	*aet_cv;
+	int		*aet_pending;
+} arc_evict_task_t;
+
+static void
+arc_evict_task(void *arg)
+{
+	arc_evict_task_t *aet = arg;
+
+	aet->aet_evicted = arc_evict_sublists(aet->aet_ml, aet->aet_markers,
+	    aet->aet_spa, aet->aet_bytes, aet->aet_first, aet->aet_stride);
+
+	mutex_enter(aet->aet_lock);
+	if (--(*aet->aet_pending) == 0)
+		cv_signal(aet->aet_cv);
+	mutex_exit(aet->aet_lock);
+}
+
+/*
+ * Number of workers to use for evicting the specified number of bytes
+ * from ml: one per zfs_arc_evict_thread_bytes of backlog, bounded by
+ * zfs_arc_evict_threads, the size of arc_evict_taskq and the number of
+ * sublists.  Flushes (ARC_EVICT_ALL) are not on any allocation path
+ * and are always done by the calling thread.
+ */
+static int
+arc_evict_workers(multilist_t *ml, int64_t bytes)
+{
+	int64_t nworkers;
+
+	if (arc_evict_taskq == NULL || zfs_arc_evict_threads <= 1 ||
+	    bytes == ARC_EVICT_ALL)
+		return (1);
+
+	nworkers = bytes / MAX(zfs_arc_evict_thread_bytes, SPA_MAXBLOCKSIZE);
+	nworkers = MIN(nworkers, zfs_arc_evict_threads);
+	nworkers = MIN(nworkers, arc_evict_taskq_nthreads);
+	nworkers = MIN(nworkers, multilist_get_num_sublists(ml));
+
+	return (MAX(nworkers, 1));
+}
+
+/*
+ * Divide the sublists of ml among nworkers threads on arc_evict_taskq,
+ * each evicting its share of the specified number of bytes, and wait
+ * for them.  Sublists are not evenly loaded, so whatever the workers
+ * fall short by is then evicted from all sublists by the caller.
+ */
+static uint64_t
+arc_evict_sublists_parallel(multilist_t *ml, arc_buf_hdr_t **markers,
+    uint64_t spa, int64_t bytes, int nworkers)
+{
+	arc_evict_task_t *tasks;
+	uint64_t total_evicted = 0;
+	kmutex_t lock;
+	kcondvar_t cv;
+	int pending = nworkers;
+
+	ASSERT3S(bytes, >, 0);
+
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&cv, NULL, CV_DEFAULT, NULL);
+	tasks = kmem_zalloc(sizeof (*tasks) * nworkers, KM_SLEEP);
+
+	for (int w = 0; w < nworkers; w++) {
+		arc_evict_task_t *aet = &tasks[w];
+
+		aet->aet_ml = ml;
+		aet->aet_markers = markers;
+		aet->aet_spa = spa;
+		aet->aet_bytes = (bytes + nworkers - 1) / nworkers;
+		aet->aet_first = w;
+		aet->aet_stride = nworkers;
+		aet->aet_lock = &lock;
+		aet->aet_cv = &cv;
+		aet->aet_pending = &pending;
+		(void) taskq_dispatch(arc_evict_taskq, arc_evict_task, aet,
+		    TQ_SLEEP);
+	}
+
+	mutex_enter(&lock);
+	while (pending != 0)
+		cv_wait(&cv, &lock);
+	mutex_exit(&lock);
+
+	for (int w = 0; w < nworkers; w++)
+		total_evicted += tasks[w].aet_evicted;
+
+	kmem_free(tasks, sizeof (*tasks) * nworkers);
+	cv_destroy(&cv);
+	mutex_destroy(&lock);
+
+	ARCSTAT_BUMP(arcstat_evict_parallel);
+	ARCSTAT_INCR(arcstat_evict_parallel_workers, nworkers);
+
+	if (total_evicted < bytes) {
+		total_evicted += arc_evict_sublists(ml, markers, spa,
+		    bytes - total_evicted, 0, 1);
+	}
+
+	return (total_evicted);
+}
+
+/*
+ * Evict buffers from the given arc state, until we've removed the
+ * specified number of bytes. Move the removed buffers to the
+ * appropriate evict state.
+ *
+ * This function makes a "best effort". It skips over any buffers
+ * it can't get a hash_lock on, and so, may not catch all candidates.
+ * It may also return without evicting as much space as requested.
+ *
+ * If bytes is specified using the special value ARC_EVICT_ALL, this
+ * will evict all available (i.e. unlocked and evictable) buffers from
+ * the given arc state; which is used by arc_flush().
+ */
+static uint64_t
+arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
+    arc_buf_contents_t type)
+{
+	uint64_t total_evicted;
+	multilist_t *ml = state->arcs_list[type];
+	int num_sublists, nworkers;
+	arc_buf_hdr_t **markers;
+	hrtime_t start;
+
+	IMPLY(bytes < 0, bytes == ARC_EVICT_ALL);
+
+	num_sublists = multilist_get_num_sublists(ml);
+
+	/*
+	 * If we've tried to evict from each sublist, made some
+	 * progress, but still have not hit the target number of bytes
+	 * to evict, we want to keep trying. The markers allow us to
+	 * pick up where we left off for each individual sublist, rather
+	 * than starting from the tail each time.
+	 */
+	markers = kmem_zalloc(sizeof (*markers) * num_sublists, KM_SLEEP);
+	for (int i = 0; i < num_sublists; i++) {
+		markers[i] = kmem_cache_alloc(hdr_full_cache, KM_SLEEP);
+
+		/*
+		 * A b_spa of 0 is used to indicate that this header is
+		 * a marker. This fact is used in arc_adjust_type() and
+		 * arc_evict_state_impl().
+		 */
+		markers[i]->b_spa = 0;
+
+		multilist_sublist_t *mls = multilist_sublist_lock(ml, i);
+		multilist_sublist_insert_tail(mls, markers[i]);
+		multilist_sublist_unlock(mls);
+	}
+
+	start = gethrtime();
+	nworkers = arc_evict_workers(ml, bytes);
+	if (nworkers > 1) {
+		total_evicted = arc_evict_sublists_parallel(ml, markers, spa,
+		    bytes, nworkers);
+	} else {
+		total_evicted = arc_evict_sublists(ml, markers, spa, bytes,
+		    0, 1);
+	}
+
+	/*
+	 * When bytes is ARC_EVICT_ALL, we stop only once nothing more
+	 * could be evicted; in that case we have evicted enough, so we
+	 * don't want to increment the kstat.
+	 */
+	if (bytes != ARC_EVICT_ALL && total_evicted < bytes)
+		ARCSTAT_BUMP(arcstat_evict_not_enough);
+
+	ARCSTAT_INCR(arcstat_evict_bytes, total_evicted);
+	ARCSTAT_INCR(arcstat_evict_time_ns, gethrtime() - start);
+
 	for (int i = 0; i < num_sublists; i++) {
 		multilist_sublist_t *mls = multilist_sublist_lock(ml, i);
 		multilist_sublist_remove(mls, markers[i]);
@@ -4698,7 +5152,7 @@ arc_kmem_reap_now(void)
 	kmem_cache_t		*prev_data_cache = NULL;
 	extern kmem_cache_t	*zio_buf_cache[];
 	extern kmem_cache_t	*zio_data_buf_cache[];
-	extern kmem_cache_t	*range_seg_cache;
+	extern kmem_cache_t	*zfs_btree_leaf_cache;
 	extern kmem_cache_t	*abd_chunk_cache;
 	extern vmem_t           *abd_chunk_arena;
 
@@ -4755,7 +5209,7 @@ arc_kmem_reap_now(void)
 	kmem_cache_reap_now(buf_cache);
 	kmem_cache_reap_now(hdr_full_cache);
 	kmem_cache_reap_now(hdr_l2only_cache);
-	kmem_cache_reap_now(range_seg_cache);
+	kmem_cache_reap_now(zfs_btree_leaf_cache);
 #ifdef _KERNEL
 	extern kmem_cache_t *dnode_cache;
 	if (dnode_cache) kmem_cache_reap_now(dnode_cache);
@@ -4797,6 +5251,7 @@ arc_reclaim_thread(void)
 #endif
 {
 	hrtime_t		growtime = 0;
+	hrtime_t		resize_retry = 0;
 	callb_cpr_t		cpr;
 
 	CALLB_CPR_INIT(&cpr, &arc_reclaim_lock, callb_generic_cpr, FTAG);
@@ -4822,6 +5277,13 @@ arc_reclaim_thread(void)
 
 		mutex_exit(&arc_reclaim_lock);
 
+		/*
+		 * The new table is allocated with KM_NOSLEEP; if that fails,
+		 * memory is short, so leave the table alone for a second.
+		 */
+		if (gethrtime() >= resize_retry && buf_hash_resize() != 0)
+			resize_retry = gethrtime() + SEC2NSEC(1);
+
 #ifdef __APPLE__
 #ifdef _KERNEL
 		if (reclaim_shrink_target > 0) {
@@ -5378,6 +5840,9 @@ arc_get_data_impl(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 	 * overflowing; thus we don't use a while loop here.
 	 */
 	if (arc_is_overflowing()) {
+		hrtime_t wait_start = gethrtime();
+		boolean_t waited = B_FALSE;
+
 		mutex_enter(&arc_reclaim_lock);
 
 		/*
@@ -5395,6 +5860,7 @@ arc_get_data_impl(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 		if (arc_is_overflowing()) {
 			cv_signal(&arc_reclaim_thread_cv);
 			cv_wait(&arc_reclaim_waiters_cv, &arc_reclaim_lock);
+			waited = B_TRUE;
 		}
 #else
 		if (arc_is_overflowing()) {
@@ -5414,6 +5880,7 @@ arc_get_data_impl(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 				(void) cv_timedwait_hires(&arc_reclaim_waiters_cv,
 				    &arc_reclaim_lock, USEC2NSEC(500), 0, 0);
 				ARCSTAT_BUMPDOWN(arc_reclaim_waiters_count);
+				waited = B_TRUE;
 
 				if (gethrtime() > start + MSEC2NSEC(30)) {
 					ARCSTAT_BUMP(arc_reclaim_waiters_loop_timeout);
@@ -5425,6 +5892,12 @@ arc_get_data_impl(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 #endif
 
 		mutex_exit(&arc_reclaim_lock);
+
+		if (waited) {
+			ARCSTAT_BUMP(arcstat_evict_alloc_waits);
+			ARCSTAT_INCR(arcstat_evict_alloc_wait_ns,
+			    gethrtime() - wait_start);
+		}
 	}
 
 	VERIFY3U(hdr->b_type, ==, type);
@@ -7153,6 +7626,7 @@ arc_kstat_update(kstat_t *ksp, int rw)
 		    &as->arcstat_mfu_ghost_size,
 		    &as->arcstat_mfu_ghost_evictable_data,
 		    &as->arcstat_mfu_ghost_evictable_metadata);
+		buf_hash_kstat_update(as);
 	}
 
 	return (0);
@@ -7534,6 +8008,10 @@ arc_init(void)
 		kstat_install(arc_ksp);
 	}
 
+	arc_evict_taskq_nthreads = max_ncpus;
+	arc_evict_taskq = taskq_create("arc_evict", arc_evict_taskq_nthreads,
+	    minclsyspri, 1, INT_MAX, TASKQ_DYNAMIC);
+
 	(void) thread_create(NULL, 0, arc_reclaim_thread, NULL, 0, &p0,
 	    TS_RUN, minclsyspri);
 
@@ -7582,6 +8060,9 @@ arc_fini(void)
 	/* Use B_TRUE to ensure *all* buffers are evicted */
 	arc_flush(NULL, B_TRUE);
 
+	taskq_destroy(arc_evict_taskq);
+	arc_evict_taskq = NULL;
+
 	arc_dead = B_TRUE;
 
 	if (arc_ksp != NULL) {
@@ -7717,6 +8198,12 @@ arc_fini(void)
  * 8. If an ARC buffer is written (and dirtied) which also exists in the
  * L2ARC, the now stale L2ARC buffer is immediately dropped.
  *
+ * 9. The buffers written to each device are also logged on the device, so
+ * that the L2ARC contents survive export/import and reboots; see the
+ * "Persistent L2ARC" comment in arc_impl.h.  The L2-only headers are
+ * rebuilt from the log by a separate thread when the device is added back,
+ * and the device is not written to until that is done.
+ *
  * The performance of the L2ARC can be tweaked by a number of tunables, which
  * may be necessary for different workloads:
  *
@@ -7730,6 +8217,8 @@ arc_fini(void)
  *				since more compressed buffers are likely to
  *				be present
  *	l2arc_feed_secs		seconds between L2ARC writing
+ *	l2arc_rebuild_enabled	rebuild the L2ARC headers from the device
+ *				logs when a cache device is added
  *
  * Tunables may be removed or added as future performance improvements are
  * integrated, and also may become zpool properties.
@@ -7846,10 +8335,10 @@ l2arc_dev_get_next(void)
 		else if (next == first)
 			break;
 
-	} while (vdev_is_dead(next->l2ad_vdev));
+	} while (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild);
 
 	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
+	if (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild)
 		next = NULL;
 
 	l2arc_dev_last = next;
@@ -8280,6 +8769,139 @@ l2arc_sublist_lock(int list_num)
 	return (multilist_sublist_lock(ml, idx));
 }
 
+/*
+ * Room on the device which log blocks may take, on top of write_sz bytes
+ * of buffers, during one l2arc_write_buffers() call: one log block per
+ * L2ARC_LOG_BLK_MAX_ENTRIES sector-sized buffers, one for the entries
+ * left over from the previous call, and the one committed at a wrap.
+ */
+static uint64_t
+l2arc_log_blk_overhead(l2arc_dev_t *dev, uint64_t write_sz)
+{
+	uint64_t nents = write_sz >> dev->l2ad_vdev->vdev_ashift;
+
+	return ((nents / L2ARC_LOG_BLK_MAX_ENTRIES + 2) *
+	    vdev_psize_to_asize(dev->l2ad_vdev, sizeof (l2arc_log_blk_phys_t)));
+}
+
+/*
+ * Write the device header.  This is synchronous, as the header must be
+ * on the device before any write it allows, i.e. before anything is
+ * written to a region newly evicted by l2arc_evict().
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *dh = dev->l2ad_dev_hdr;
+	uint64_t asize = dev->l2ad_dev_hdr_asize;
+	abd_t *abd;
+	int err;
+
+	dh->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	dh->dh_version = L2ARC_PERSISTENT_VERSION;
+	dh->dh_spa_guid = spa_guid(dev->l2ad_spa);
+	dh->dh_vdev_guid = dev->l2ad_vdev->vdev_guid;
+	dh->dh_flags = dev->l2ad_first ? L2ARC_DEV_HDR_FIRST : 0;
+	dh->dh_start = dev->l2ad_start;
+	dh->dh_end = dev->l2ad_end;
+	dh->dh_hand = dev->l2ad_hand;
+	dh->dh_evict = dev->l2ad_evict;
+	fletcher_4_native(dh, offsetof(l2arc_dev_hdr_phys_t, dh_cksum), NULL,
+	    &dh->dh_cksum);
+
+	abd = abd_alloc_for_io(asize, B_TRUE);
+	abd_copy_from_buf(abd, dh, sizeof (*dh));
+	if (asize > sizeof (*dh))
+		abd_zero_off(abd, sizeof (*dh), asize - sizeof (*dh));
+
+	err = zio_wait(zio_write_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+	abd_free(abd);
+
+	if (err != 0) {
+		zfs_dbgmsg("L2ARC device header update failed on vdev %llu, "
+		    "error %d", (u_longlong_t)dev->l2ad_vdev->vdev_guid, err);
+	}
+}
+
+/*
+ * Write out the log block being filled at the write hand, as a child of
+ * pio, and make it the newest one.  The device header is updated by the
+ * caller once pio has completed.
+ */
+static void
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log_blk;
+	l2arc_log_blkptr_t *lbp = &dev->l2ad_dev_hdr->dh_start_lbp;
+	uint64_t nents = dev->l2ad_log_ent_idx;
+	uint64_t asize;
+	abd_t *abd;
+
+	ASSERT3U(nents, >, 0);
+	ASSERT3U(nents, <=, L2ARC_LOG_BLK_MAX_ENTRIES);
+
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_nents = nents;
+	lb->lb_prev_lbp = *lbp;
+	bzero(lb->lb_pad, sizeof (lb->lb_pad));
+	bzero(&lb->lb_entries[nents],
+	    (L2ARC_LOG_BLK_MAX_ENTRIES - nents) * sizeof (lb->lb_entries[0]));
+
+	asize = vdev_psize_to_asize(dev->l2ad_vdev, sizeof (*lb));
+	ASSERT3U(dev->l2ad_hand + asize, <=, dev->l2ad_end);
+
+	lbp->lbp_daddr = dev->l2ad_hand;
+	lbp->lbp_payload_start = lb->lb_entries[0].le_daddr;
+	lbp->lbp_asize = asize;
+	fletcher_4_native(lb, sizeof (*lb), NULL, &lbp->lbp_cksum);
+
+	/* freed by l2arc_write_done() once the write is done */
+	abd = abd_alloc_for_io(asize, B_TRUE);
+	abd_copy_from_buf(abd, lb, sizeof (*lb));
+	if (asize > sizeof (*lb))
+		abd_zero_off(abd, sizeof (*lb), asize - sizeof (*lb));
+	l2arc_free_abd_on_write(abd, asize, ARC_BUFC_METADATA);
+
+	(void) zio_nowait(zio_write_phys(pio, dev->l2ad_vdev, lbp->lbp_daddr,
+	    asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_ASYNC_WRITE,
+	    ZIO_FLAG_CANFAIL, B_FALSE));
+
+	dev->l2ad_hand += asize;
+	dev->l2ad_log_ent_idx = 0;
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+}
+
+/*
+ * Record a buffer just written at hdr->b_l2hdr.b_daddr in the log block
+ * being filled, committing the log block if it is full.  Returns B_TRUE
+ * if a log block was committed.
+ */
+static boolean_t
+l2arc_log_blk_insert(l2arc_dev_t *dev, const arc_buf_hdr_t *hdr, zio_t *pio)
+{
+	l2arc_log_ent_phys_t *le;
+
+	le = &dev->l2ad_log_blk->lb_entries[dev->l2ad_log_ent_idx++];
+	le->le_dva = hdr->b_dva;
+	le->le_birth = hdr->b_birth;
+	le->le_daddr = hdr->b_l2hdr.b_daddr;
+	le->le_prop = 0;
+	L2BLK_SET_LSIZE(le->le_prop, HDR_GET_LSIZE(hdr));
+	L2BLK_SET_PSIZE(le->le_prop, HDR_GET_PSIZE(hdr));
+	L2BLK_SET_COMPRESS(le->le_prop, HDR_GET_COMPRESS(hdr));
+	L2BLK_SET_TYPE(le->le_prop, hdr->b_type);
+	L2BLK_SET_PROTECTED(le->le_prop, !!HDR_PROTECTED(hdr));
+	bzero(le->le_pad, sizeof (le->le_pad));
+
+	if (dev->l2ad_log_ent_idx < L2ARC_LOG_BLK_MAX_ENTRIES)
+		return (B_FALSE);
+
+	l2arc_log_blk_commit(dev, pio);
+	return (B_TRUE);
+}
+
 /*
  * Evict buffers from the device write hand to the distance specified in
  * bytes.  This distance may span populated buffers, it may span nothing.
@@ -8316,6 +8938,16 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 	DTRACE_PROBE4(l2arc__evict, l2arc_dev_t *, dev, list_t *, buflist,
 	    uint64_t, taddr, boolean_t, all);
 
+	/*
+	 * Record the evicted region on the device before anything is
+	 * written to it, so that a rebuild never trusts a log block (or a
+	 * buffer) which may since have been overwritten.
+	 */
+	if (!all && taddr != dev->l2ad_evict) {
+		dev->l2ad_evict = taddr;
+		l2arc_dev_hdr_update(dev);
+	}
+
 top:
 	mutex_enter(&dev->l2ad_mtx);
 	for (hdr = list_tail(buflist); hdr; hdr = hdr_prev) {
@@ -8437,7 +9069,7 @@ l2arc_apply_transforms(spa_t *spa, arc_buf_hdr_t *hdr, uint64_t asize,
         cabd = abd_alloc_for_io(asize, ismd);
         tmp = abd_borrow_buf(cabd, asize);
 
-        psize = zio_compress_data(compress, to_write, tmp, size);
+        psize = zio_compress_data(compress, to_write, tmp, size, B_FALSE);
 		ASSERT3U(psize, <=, HDR_GET_PSIZE(hdr));
 		if (psize < asize)
 			bzero((char *)tmp + psize, asize - psize);
@@ -8516,7 +9148,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 {
 	arc_buf_hdr_t *hdr, *hdr_prev, *head;
 	uint64_t write_asize, write_psize, write_lsize, headroom;
-	boolean_t full;
+	boolean_t full, log_committed = B_FALSE;
 	l2arc_write_callback_t *cb;
 	zio_t *pio, *wzio;
 	uint64_t guid = spa_load_guid(spa);
@@ -8729,6 +9361,9 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			write_psize += psize;
 			dev->l2ad_hand += asize;
 
+			if (l2arc_log_blk_insert(dev, hdr, pio))
+				log_committed = B_TRUE;
+
 			mutex_exit(hash_lock);
 
 			(void) zio_nowait(wzio);
@@ -8757,10 +9392,18 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 
 	/*
 	 * Bump device hand to the device start if it is approaching the end.
-	 * l2arc_evict() will already have evicted ahead for this case.
-	 */
-	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
+	 * l2arc_evict() will already have evicted ahead for this case.  A
+	 * log block never describes buffers from two passes, so the one
+	 * being filled is committed first.
+	 */
+	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz -
+	    l2arc_log_blk_overhead(dev, target_sz))) {
+		if (dev->l2ad_log_ent_idx > 0) {
+			l2arc_log_blk_commit(dev, pio);
+			log_committed = B_TRUE;
+		}
 		dev->l2ad_hand = dev->l2ad_start;
+		dev->l2ad_evict = dev->l2ad_start;
 		dev->l2ad_first = B_FALSE;
 	}
 
@@ -8768,6 +9411,10 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	(void) zio_wait(pio);
 	dev->l2ad_writing = B_FALSE;
 
+	/* Point the device header at the log blocks just written. */
+	if (log_committed)
+		l2arc_dev_hdr_update(dev);
+
 	return (write_asize);
 }
 
@@ -8850,9 +9497,11 @@ l2arc_feed_thread(void)
 		size = l2arc_write_size();
 
 		/*
-		 * Evict L2ARC buffers that will be overwritten.
+		 * Evict L2ARC buffers that will be overwritten, by buffers
+		 * or by log blocks.
 		 */
-		l2arc_evict(dev, size, B_FALSE);
+		l2arc_evict(dev, size + l2arc_log_blk_overhead(dev, size),
+		    B_FALSE);
 
 		/*
 		 * Write ARC buffers.
@@ -8872,6 +9521,275 @@ l2arc_feed_thread(void)
 	thread_exit();
 }
 
+/*
+ * Read the device header into dev->l2ad_dev_hdr and, if it describes this
+ * very device, resume the write hand where it was.  Returns 0 if the log
+ * blocks it points at may be used to rebuild the L2ARC headers.
+ */
+static int
+l2arc_dev_hdr_read(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *dh = dev->l2ad_dev_hdr;
+	uint64_t asize = dev->l2ad_dev_hdr_asize;
+	zio_cksum_t cksum;
+	abd_t *abd;
+	int err;
+
+	abd = abd_alloc_for_io(asize, B_TRUE);
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY, B_FALSE));
+	if (err == 0)
+		abd_copy_to_buf(dh, abd, sizeof (*dh));
+	abd_free(abd);
+
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		return (err);
+	}
+
+	/* Never used as a persistent cache device. */
+	if (dh->dh_magic != L2ARC_DEV_HDR_MAGIC)
+		return (SET_ERROR(ENOENT));
+
+	if (dh->dh_version != L2ARC_PERSISTENT_VERSION) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	fletcher_4_native(dh, offsetof(l2arc_dev_hdr_phys_t, dh_cksum), NULL,
+	    &cksum);
+	if (!ZIO_CHECKSUM_EQUAL(cksum, dh->dh_cksum)) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_errors);
+		return (SET_ERROR(ECKSUM));
+	}
+
+	/* Written for another pool, or the device has been resized. */
+	if (dh->dh_spa_guid != spa_guid(dev->l2ad_spa) ||
+	    dh->dh_vdev_guid != dev->l2ad_vdev->vdev_guid ||
+	    dh->dh_start != dev->l2ad_start || dh->dh_end != dev->l2ad_end ||
+	    dh->dh_hand < dh->dh_start || dh->dh_hand >= dh->dh_end ||
+	    dh->dh_evict < dh->dh_start || dh->dh_evict > dh->dh_end)
+		return (SET_ERROR(EINVAL));
+
+	dev->l2ad_hand = dh->dh_hand;
+	dev->l2ad_evict = dh->dh_evict;
+	dev->l2ad_first = !!(dh->dh_flags & L2ARC_DEV_HDR_FIRST);
+
+	return (0);
+}
+
+/*
+ * Walking the log from the newest block, each log block and the buffers it
+ * describes must lie before the newer log block on the device, except
+ * across a single wrap of the write hand from the start of the device back
+ * to its end, after which they must also lie past the region evicted ahead
+ * of the hand.  Anything else has since been overwritten.  *limit and
+ * *wrapped carry the state of the walk.
+ */
+static boolean_t
+l2arc_log_blkptr_valid(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp,
+    uint64_t *limit, boolean_t *wrapped)
+{
+	uint64_t start = lbp->lbp_payload_start;
+	uint64_t end = lbp->lbp_daddr + lbp->lbp_asize;
+
+	if (lbp->lbp_asize != vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (l2arc_log_blk_phys_t)) || start < dev->l2ad_start ||
+	    start > lbp->lbp_daddr || end > dev->l2ad_end)
+		return (B_FALSE);
+
+	if (end > *limit) {
+		if (*wrapped || dev->l2ad_first)
+			return (B_FALSE);
+		*wrapped = B_TRUE;
+	}
+	if (*wrapped && start < MAX(dev->l2ad_evict, dev->l2ad_hand))
+		return (B_FALSE);
+
+	*limit = start;
+	return (B_TRUE);
+}
+
+/*
+ * Read and verify the log block lbp points at.  The spa config lock is
+ * only tried, so that l2arc_remove_vdev(), called with it held, can stop
+ * the rebuild.
+ */
+static int
+l2arc_log_blk_read(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp,
+    l2arc_log_blk_phys_t *lb, abd_t *abd)
+{
+	spa_t *spa = dev->l2ad_spa;
+	zio_cksum_t cksum;
+	int err;
+
+	while (!spa_config_tryenter(spa, SCL_L2ARC, dev, RW_READER)) {
+		if (dev->l2ad_rebuild_cancel)
+			return (SET_ERROR(ECANCELED));
+		delay(1);
+	}
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev, lbp->lbp_daddr,
+	    lbp->lbp_asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY, B_FALSE));
+	spa_config_exit(spa, SCL_L2ARC, dev);
+
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		return (err);
+	}
+
+	abd_copy_to_buf(lb, abd, sizeof (*lb));
+	fletcher_4_native(lb, sizeof (*lb), NULL, &cksum);
+	if (!ZIO_CHECKSUM_EQUAL(cksum, lbp->lbp_cksum) ||
+	    lb->lb_magic != L2ARC_LOG_BLK_MAGIC || lb->lb_nents == 0 ||
+	    lb->lb_nents > L2ARC_LOG_BLK_MAX_ENTRIES) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_errors);
+		return (SET_ERROR(ECKSUM));
+	}
+
+	return (0);
+}
+
+/*
+ * Recreate the L2-only header for a buffer described by the log block lbp
+ * points at, unless the buffer is already cached.  As the log is walked
+ * backwards the header goes to the tail of the buffer list, where
+ * l2arc_evict() looks for the oldest buffers.
+ */
+static void
+l2arc_hdr_restore(l2arc_dev_t *dev, const l2arc_log_ent_phys_t *le,
+    const l2arc_log_blkptr_t *lbp)
+{
+	uint64_t lsize = L2BLK_GET_LSIZE(le->le_prop);
+	uint64_t psize = L2BLK_GET_PSIZE(le->le_prop);
+	uint64_t asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+	enum zio_compress compress = L2BLK_GET_COMPRESS(le->le_prop);
+	arc_buf_contents_t type = L2BLK_GET_TYPE(le->le_prop);
+	arc_buf_hdr_t *hdr, *exists;
+	kmutex_t *hash_lock;
+
+	if (le->le_daddr < lbp->lbp_payload_start ||
+	    le->le_daddr + asize > lbp->lbp_daddr ||
+	    DVA_IS_EMPTY(&le->le_dva) || le->le_birth == 0 ||
+	    compress >= ZIO_COMPRESS_FUNCTIONS ||
+	    (type != ARC_BUFC_DATA && type != ARC_BUFC_METADATA))
+		return;
+
+	hdr = kmem_cache_alloc(hdr_l2only_cache, KM_SLEEP);
+	ASSERT(HDR_EMPTY(hdr));
+	HDR_SET_LSIZE(hdr, lsize);
+	HDR_SET_PSIZE(hdr, psize);
+	hdr->b_spa = spa_load_guid(dev->l2ad_spa);
+	hdr->b_type = type;
+	hdr->b_flags = 0;
+	arc_hdr_set_flags(hdr, arc_bufc_to_flags(type) | ARC_FLAG_HAS_L2HDR);
+	arc_hdr_set_compress(hdr, compress);
+	if (L2BLK_GET_PROTECTED(le->le_prop))
+		arc_hdr_set_flags(hdr, ARC_FLAG_PROTECTED);
+	hdr->b_dva = le->le_dva;
+	hdr->b_birth = le->le_birth;
+	hdr->b_l2hdr.b_dev = dev;
+	hdr->b_l2hdr.b_daddr = le->le_daddr;
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		/* cached since, or logged again by a newer log block */
+		mutex_exit(hash_lock);
+		buf_discard_identity(hdr);
+		kmem_cache_free(hdr_l2only_cache, hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+		return;
+	}
+
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_buflist, hdr);
+	(void) refcount_add_many(&dev->l2ad_alloc, arc_hdr_size(hdr), hdr);
+	mutex_exit(&dev->l2ad_mtx);
+	mutex_exit(hash_lock);
+
+	ARCSTAT_INCR(arcstat_l2_lsize, lsize);
+	ARCSTAT_INCR(arcstat_l2_psize, psize);
+	vdev_space_update(dev->l2ad_vdev, psize, 0, 0);
+
+	ARCSTAT_BUMP(arcstat_l2_rebuild_bufs);
+	ARCSTAT_INCR(arcstat_l2_rebuild_size, lsize);
+	ARCSTAT_INCR(arcstat_l2_rebuild_asize, asize);
+}
+
+/*
+ * Walk the log of a cache device from the newest log block, recreating
+ * the L2-only headers, until the log ends or has been overwritten.
+ */
+static void
+l2arc_rebuild(l2arc_dev_t *dev)
+{
+	l2arc_log_blkptr_t lbp = dev->l2ad_dev_hdr->dh_start_lbp;
+	uint64_t limit = dev->l2ad_hand;
+	boolean_t wrapped = B_FALSE;
+	hrtime_t start = gethrtime();
+	l2arc_log_blk_phys_t *lb;
+	abd_t *abd;
+	int err = 0;
+
+	lb = kmem_alloc(sizeof (*lb), KM_SLEEP);
+	abd = abd_alloc_for_io(vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (*lb)), B_TRUE);
+
+	while (lbp.lbp_asize != 0) {
+		if (dev->l2ad_rebuild_cancel) {
+			err = SET_ERROR(ECANCELED);
+			break;
+		}
+
+		/* Rebuilt headers are not worth evicting cached data for. */
+		if (arc_reclaim_needed()) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_lowmem);
+			err = SET_ERROR(ENOMEM);
+			break;
+		}
+
+		if (!l2arc_log_blkptr_valid(dev, &lbp, &limit, &wrapped))
+			break;
+
+		err = l2arc_log_blk_read(dev, &lbp, lb, abd);
+		if (err != 0)
+			break;
+
+		for (int i = lb->lb_nents - 1; i >= 0; i--)
+			l2arc_hdr_restore(dev, &lb->lb_entries[i], &lbp);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+
+		lbp = lb->lb_prev_lbp;
+	}
+
+	abd_free(abd);
+	kmem_free(lb, sizeof (*lb));
+
+	if (err == 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_success);
+	ARCSTAT_INCR(arcstat_l2_rebuild_time_ms,
+	    NSEC2MSEC(gethrtime() - start));
+}
+
+static void
+l2arc_dev_rebuild_thread(void *arg)
+{
+	l2arc_dev_t *dev = arg;
+
+	ASSERT(dev->l2ad_rebuild);
+	l2arc_rebuild(dev);
+
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_thr_cv);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
+	thread_exit();
+}
+
 boolean_t
 l2arc_vdev_present(vdev_t *vd)
 {
@@ -8905,9 +9823,16 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	adddev->l2ad_dev_hdr = kmem_zalloc(sizeof (l2arc_dev_hdr_phys_t),
+	    KM_SLEEP);
+	adddev->l2ad_dev_hdr_asize = vdev_psize_to_asize(vd,
+	    sizeof (l2arc_dev_hdr_phys_t));
+	adddev->l2ad_log_blk = kmem_zalloc(sizeof (l2arc_log_blk_phys_t),
+	    KM_SLEEP);
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE + adddev->l2ad_dev_hdr_asize;
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
 	adddev->l2ad_hand = adddev->l2ad_start;
+	adddev->l2ad_evict = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
 
@@ -8919,9 +9844,26 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_create(&adddev->l2ad_buflist, sizeof (arc_buf_hdr_t),
 	    offsetof(arc_buf_hdr_t, b_l2hdr.b_l2node));
 
-	vdev_space_update(vd, 0, 0, adddev->l2ad_end - adddev->l2ad_hand);
+	vdev_space_update(vd, 0, 0, adddev->l2ad_end - adddev->l2ad_start);
 	refcount_create(&adddev->l2ad_alloc);
 
+	/*
+	 * Pick up where the device was left, and rebuild its contents
+	 * from the log, if it holds one for this pool.  Otherwise start
+	 * afresh, and make sure an older log is not used later on.
+	 */
+	if (l2arc_rebuild_enabled && l2arc_dev_hdr_read(adddev) == 0) {
+		adddev->l2ad_rebuild =
+		    (adddev->l2ad_dev_hdr->dh_start_lbp.lbp_asize != 0);
+	} else {
+		bzero(adddev->l2ad_dev_hdr, sizeof (l2arc_dev_hdr_phys_t));
+		adddev->l2ad_hand = adddev->l2ad_start;
+		adddev->l2ad_evict = adddev->l2ad_start;
+		adddev->l2ad_first = B_TRUE;
+		if (spa_writeable(spa))
+			l2arc_dev_hdr_update(adddev);
+	}
+
 	/*
 	 * Add device to global list
 	 */
@@ -8929,6 +9871,14 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	/*
+	 * l2arc_dev_get_next() skips the device until the rebuild is done.
+	 */
+	if (adddev->l2ad_rebuild) {
+		(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread,
+		    adddev, 0, &p0, TS_RUN, minclsyspri);
+	}
 }
 
 /*
@@ -8960,6 +9910,15 @@ l2arc_remove_vdev(vdev_t *vd)
 	atomic_dec_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
 
+	/*
+	 * Stop a rebuild still going on.
+	 */
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	while (remdev->l2ad_rebuild)
+		cv_wait(&l2arc_rebuild_thr_cv, &l2arc_rebuild_thr_lock);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
 	/*
 	 * Clear all buflists and ARC references.  L2ARC device flush.
 	 */
@@ -8967,6 +9926,8 @@ l2arc_remove_vdev(vdev_t *vd)
 	list_destroy(&remdev->l2ad_buflist);
 	mutex_destroy(&remdev->l2ad_mtx);
 	refcount_destroy(&remdev->l2ad_alloc);
+	kmem_free(remdev->l2ad_log_blk, sizeof (l2arc_log_blk_phys_t));
+	kmem_free(remdev->l2ad_dev_hdr, sizeof (l2arc_dev_hdr_phys_t));
 	kmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
@@ -8982,6 +9943,8 @@ l2arc_init(void)
 	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&l2arc_rebuild_thr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_thr_cv, NULL, CV_DEFAULT, NULL);
 
 	l2arc_dev_list = &L2ARC_dev_list;
 	l2arc_free_on_write = &L2ARC_free_on_write;
@@ -9006,6 +9969,8 @@ l2arc_fini(void)
 	cv_destroy(&l2arc_feed_thr_cv);
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
+	mutex_destroy(&l2arc_rebuild_thr_lock);
+	cv_destroy(&l2arc_rebuild_thr_cv);
 
 	list_destroy(l2arc_dev_list);
 	list_destroy(l2arc_free_on_write);
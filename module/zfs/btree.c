@@ -0,0 +1,752 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * In-memory B-tree; see btree.h for the interface.
+ *
+ * Elements live in the core nodes as well as in the leaves, so a search
+ * may end early, and every core node with n elements has n + 1 children.
+ * A full node is split in two when an element is added to it, its middle
+ * element moving up to the parent.  A node left less than half full by a
+ * removal is merged with a sibling, pulling their separating element down
+ * from the parent, or, if the two don't fit in one node, the elements of
+ * both are redistributed evenly.  An element is only ever removed from a
+ * leaf: removing one from a core node replaces it with its predecessor.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/btree.h>
+
+kmem_cache_t *zfs_btree_leaf_cache;
+
+void
+zfs_btree_init(void)
+{
+	zfs_btree_leaf_cache = kmem_cache_create("zfs_btree_leaf_cache",
+	    BTREE_LEAF_SIZE, 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+zfs_btree_fini(void)
+{
+	kmem_cache_destroy(zfs_btree_leaf_cache);
+}
+
+static size_t
+zfs_btree_core_size(zfs_btree_t *tree)
+{
+	return (sizeof (zfs_btree_core_t) +
+	    BTREE_CORE_ELEMS * tree->bt_elem_size);
+}
+
+static uint32_t
+zfs_btree_cap(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	return (hdr->bth_core ? BTREE_CORE_ELEMS : tree->bt_leaf_cap);
+}
+
+static zfs_btree_hdr_t **
+zfs_btree_children(zfs_btree_hdr_t *hdr)
+{
+	ASSERT(hdr->bth_core);
+	return (((zfs_btree_core_t *)hdr)->btc_children);
+}
+
+static uint8_t *
+zfs_btree_elem(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, uint32_t i)
+{
+	uint8_t *elems;
+
+	if (hdr->bth_core)
+		elems = ((zfs_btree_core_t *)hdr)->btc_elems;
+	else
+		elems = ((zfs_btree_leaf_t *)hdr)->btl_elems;
+	return (elems + i * tree->bt_elem_size);
+}
+
+static void
+zfs_btree_move(zfs_btree_t *tree, zfs_btree_hdr_t *dst, uint32_t di,
+    zfs_btree_hdr_t *src, uint32_t si, uint32_t count)
+{
+	if (count != 0) {
+		memmove(zfs_btree_elem(tree, dst, di),
+		    zfs_btree_elem(tree, src, si), count * tree->bt_elem_size);
+	}
+}
+
+/*
+ * Move count children of src to dst, making dst their parent.
+ */
+static void
+zfs_btree_move_children(zfs_btree_hdr_t *dst, uint32_t di,
+    zfs_btree_hdr_t *src, uint32_t si, uint32_t count)
+{
+	zfs_btree_hdr_t **dc = zfs_btree_children(dst);
+
+	if (count == 0)
+		return;
+	memmove(&dc[di], &zfs_btree_children(src)[si],
+	    count * sizeof (zfs_btree_hdr_t *));
+	for (uint32_t i = di; i < di + count; i++)
+		dc[i]->bth_parent = (zfs_btree_core_t *)dst;
+}
+
+static zfs_btree_hdr_t *
+zfs_btree_node_alloc(zfs_btree_t *tree, boolean_t core)
+{
+	zfs_btree_hdr_t *hdr;
+
+	if (core) {
+		hdr = kmem_alloc(zfs_btree_core_size(tree), KM_SLEEP);
+		tree->bt_num_cores++;
+	} else {
+		hdr = kmem_cache_alloc(zfs_btree_leaf_cache, KM_SLEEP);
+		tree->bt_num_leaves++;
+	}
+	hdr->bth_parent = NULL;
+	hdr->bth_core = core;
+	hdr->bth_count = 0;
+	return (hdr);
+}
+
+static void
+zfs_btree_node_free(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	if (hdr->bth_core) {
+		kmem_free(hdr, zfs_btree_core_size(tree));
+		tree->bt_num_cores--;
+	} else {
+		kmem_cache_free(zfs_btree_leaf_cache, hdr);
+		tree->bt_num_leaves--;
+	}
+}
+
+void
+zfs_btree_create(zfs_btree_t *tree, int (*compar)(const void *, const void *),
+    size_t size)
+{
+	size_t leaf_space = BTREE_LEAF_SIZE -
+	    offsetof(zfs_btree_leaf_t, btl_elems);
+
+	VERIFY3U(size, !=, 0);
+	VERIFY3U(size, <=, leaf_space / 4);
+
+	bzero(tree, sizeof (*tree));
+	tree->bt_compar = compar;
+	tree->bt_elem_size = size;
+	tree->bt_leaf_cap = leaf_space / size;
+	tree->bt_height = -1;
+}
+
+void
+zfs_btree_destroy(zfs_btree_t *tree)
+{
+	ASSERT0(tree->bt_num_elems);
+	ASSERT3P(tree->bt_root, ==, NULL);
+}
+
+/*
+ * Binary search of a node: the index of the element matching value, or
+ * else of the first element after it.
+ */
+static uint32_t
+zfs_btree_node_search(zfs_btree_t *tree, zfs_btree_hdr_t *hdr,
+    const void *value, boolean_t *found)
+{
+	uint32_t lo = 0, hi = hdr->bth_count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		int c = tree->bt_compar(value, zfs_btree_elem(tree, hdr, mid));
+
+		if (c == 0) {
+			*found = B_TRUE;
+			return (mid);
+		}
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	*found = B_FALSE;
+	return (lo);
+}
+
+static uint32_t
+zfs_btree_child_index(zfs_btree_core_t *parent, zfs_btree_hdr_t *child)
+{
+	uint32_t i;
+
+	for (i = 0; i <= parent->btc_hdr.bth_count; i++) {
+		if (parent->btc_children[i] == child)
+			return (i);
+	}
+	panic("btree node %p not a child of %p", (void *)child,
+	    (void *)parent);
+	return (0);
+}
+
+static void
+zfs_btree_set_index(zfs_btree_index_t *idx, zfs_btree_hdr_t *hdr,
+    uint32_t offset, boolean_t before)
+{
+	if (idx != NULL) {
+		idx->bti_node = hdr;
+		idx->bti_offset = offset;
+		idx->bti_before = before;
+	}
+}
+
+void *
+zfs_btree_find(zfs_btree_t *tree, const void *value, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+	boolean_t found;
+	uint32_t i;
+
+	if (hdr == NULL) {
+		zfs_btree_set_index(where, NULL, 0, B_TRUE);
+		return (NULL);
+	}
+
+	for (;;) {
+		i = zfs_btree_node_search(tree, hdr, value, &found);
+		if (found) {
+			zfs_btree_set_index(where, hdr, i, B_FALSE);
+			return (zfs_btree_elem(tree, hdr, i));
+		}
+		if (!hdr->bth_core)
+			break;
+		hdr = zfs_btree_children(hdr)[i];
+	}
+
+	zfs_btree_set_index(where, hdr, i, B_TRUE);
+	return (NULL);
+}
+
+/*
+ * Insert value at position idx of a node with room for it; in a core
+ * node rchild becomes the child following it.
+ */
+static void
+zfs_btree_node_insert(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, uint32_t idx,
+    const void *value, zfs_btree_hdr_t *rchild)
+{
+	uint32_t count = hdr->bth_count;
+
+	ASSERT3U(count, <, zfs_btree_cap(tree, hdr));
+	ASSERT3U(idx, <=, count);
+
+	zfs_btree_move(tree, hdr, idx + 1, hdr, idx, count - idx);
+	bcopy(value, zfs_btree_elem(tree, hdr, idx), tree->bt_elem_size);
+	if (hdr->bth_core) {
+		zfs_btree_hdr_t **children = zfs_btree_children(hdr);
+
+		memmove(&children[idx + 2], &children[idx + 1],
+		    (count - idx) * sizeof (zfs_btree_hdr_t *));
+		children[idx + 1] = rchild;
+		rchild->bth_parent = (zfs_btree_core_t *)hdr;
+	}
+	hdr->bth_count++;
+}
+
+/*
+ * Insert value at position idx of a node, splitting the node if it is full
+ * and passing its middle element up to its parent.
+ */
+static void
+zfs_btree_insert(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, uint32_t idx,
+    const void *value, zfs_btree_hdr_t *rchild)
+{
+	size_t size = tree->bt_elem_size;
+	uint32_t cap = zfs_btree_cap(tree, hdr);
+	zfs_btree_hdr_t *right;
+	uint32_t mid, k;
+	uint8_t *sep;
+
+	if (hdr->bth_count < cap) {
+		zfs_btree_node_insert(tree, hdr, idx, value, rchild);
+		return;
+	}
+
+	/*
+	 * Of the cap + 1 elements including the new one, the first mid stay
+	 * here, the next moves up and the rest go to the new right node.
+	 * The right node and the separator are taken first, while the
+	 * elements of this node are still where they were.
+	 */
+	mid = (cap + 1) / 2;
+	right = zfs_btree_node_alloc(tree, hdr->bth_core);
+	sep = kmem_alloc(size, KM_SLEEP);
+
+	for (k = mid + 1; k <= cap; k++) {
+		const void *src = (k == idx) ? value :
+		    zfs_btree_elem(tree, hdr, (k < idx) ? k : k - 1);
+		bcopy(src, zfs_btree_elem(tree, right, k - mid - 1), size);
+	}
+	bcopy((mid == idx) ? value :
+	    zfs_btree_elem(tree, hdr, (mid < idx) ? mid : mid - 1), sep, size);
+	right->bth_count = cap - mid;
+
+	if (hdr->bth_core) {
+		zfs_btree_hdr_t **children = zfs_btree_children(hdr);
+		zfs_btree_hdr_t **rchildren = zfs_btree_children(right);
+
+		for (k = mid + 1; k <= cap + 1; k++) {
+			zfs_btree_hdr_t *c = (k == idx + 1) ? rchild :
+			    children[(k <= idx) ? k : k - 1];
+			rchildren[k - mid - 1] = c;
+			c->bth_parent = (zfs_btree_core_t *)right;
+		}
+		if (idx + 1 <= mid) {
+			memmove(&children[idx + 2], &children[idx + 1],
+			    (mid - idx - 1) * sizeof (zfs_btree_hdr_t *));
+			children[idx + 1] = rchild;
+			rchild->bth_parent = (zfs_btree_core_t *)hdr;
+		}
+	}
+	if (idx < mid) {
+		zfs_btree_move(tree, hdr, idx + 1, hdr, idx, mid - 1 - idx);
+		bcopy(value, zfs_btree_elem(tree, hdr, idx), size);
+	}
+	hdr->bth_count = mid;
+
+	if (hdr->bth_parent == NULL) {
+		zfs_btree_hdr_t *root = zfs_btree_node_alloc(tree, B_TRUE);
+
+		bcopy(sep, zfs_btree_elem(tree, root, 0), size);
+		zfs_btree_children(root)[0] = hdr;
+		zfs_btree_children(root)[1] = right;
+		hdr->bth_parent = right->bth_parent = (zfs_btree_core_t *)root;
+		root->bth_count = 1;
+		tree->bt_root = root;
+		tree->bt_height++;
+	} else {
+		zfs_btree_core_t *parent = hdr->bth_parent;
+
+		zfs_btree_insert(tree, &parent->btc_hdr,
+		    zfs_btree_child_index(parent, hdr), sep, right);
+	}
+	kmem_free(sep, size);
+}
+
+void
+zfs_btree_add_idx(zfs_btree_t *tree, const void *value,
+    const zfs_btree_index_t *where)
+{
+	if (tree->bt_root == NULL) {
+		zfs_btree_hdr_t *leaf = zfs_btree_node_alloc(tree, B_FALSE);
+
+		ASSERT3P(where->bti_node, ==, NULL);
+		bcopy(value, zfs_btree_elem(tree, leaf, 0), tree->bt_elem_size);
+		leaf->bth_count = 1;
+		tree->bt_root = leaf;
+		tree->bt_height = 0;
+	} else {
+		ASSERT(where->bti_before);
+		ASSERT(!where->bti_node->bth_core);
+		zfs_btree_insert(tree, where->bti_node, where->bti_offset,
+		    value, NULL);
+	}
+	tree->bt_num_elems++;
+}
+
+void
+zfs_btree_add(zfs_btree_t *tree, const void *value)
+{
+	zfs_btree_index_t where;
+
+	VERIFY3P(zfs_btree_find(tree, value, &where), ==, NULL);
+	zfs_btree_add_idx(tree, value, &where);
+}
+
+/*
+ * Merge the children of parent on either side of its element sep, and
+ * that element, into the left one.
+ */
+static void
+zfs_btree_merge(zfs_btree_t *tree, zfs_btree_core_t *parent, uint32_t sep)
+{
+	zfs_btree_hdr_t *phdr = &parent->btc_hdr;
+	zfs_btree_hdr_t *l = parent->btc_children[sep];
+	zfs_btree_hdr_t *r = parent->btc_children[sep + 1];
+	uint32_t lc = l->bth_count, rc = r->bth_count;
+
+	ASSERT3U(lc + rc + 1, <=, zfs_btree_cap(tree, l));
+
+	zfs_btree_move(tree, l, lc, phdr, sep, 1);
+	zfs_btree_move(tree, l, lc + 1, r, 0, rc);
+	if (l->bth_core)
+		zfs_btree_move_children(l, lc + 1, r, 0, rc + 1);
+	l->bth_count = lc + 1 + rc;
+
+	zfs_btree_move(tree, phdr, sep, phdr, sep + 1,
+	    phdr->bth_count - sep - 1);
+	memmove(&parent->btc_children[sep + 1], &parent->btc_children[sep + 2],
+	    (phdr->bth_count - sep - 1) * sizeof (zfs_btree_hdr_t *));
+	phdr->bth_count--;
+
+	zfs_btree_node_free(tree, r);
+}
+
+/*
+ * Even out the children of parent on either side of its element sep.
+ */
+static void
+zfs_btree_redistribute(zfs_btree_t *tree, zfs_btree_core_t *parent,
+    uint32_t sep)
+{
+	zfs_btree_hdr_t *phdr = &parent->btc_hdr;
+	zfs_btree_hdr_t *l = parent->btc_children[sep];
+	zfs_btree_hdr_t *r = parent->btc_children[sep + 1];
+	uint32_t lc = l->bth_count, rc = r->bth_count;
+	uint32_t nl = (lc + rc) / 2;
+	uint32_t shift;
+
+	if (lc > nl) {
+		/* Move the tail of the left node over to the right. */
+		shift = lc - nl;
+		zfs_btree_move(tree, r, shift, r, 0, rc);
+		zfs_btree_move(tree, r, shift - 1, phdr, sep, 1);
+		zfs_btree_move(tree, r, 0, l, nl + 1, shift - 1);
+		zfs_btree_move(tree, phdr, sep, l, nl, 1);
+		if (r->bth_core) {
+			zfs_btree_hdr_t **rchildren = zfs_btree_children(r);
+
+			memmove(&rchildren[shift], &rchildren[0],
+			    (rc + 1) * sizeof (zfs_btree_hdr_t *));
+			zfs_btree_move_children(r, 0, l, nl + 1, shift);
+		}
+	} else if (lc < nl) {
+		/* Move the head of the right node over to the left. */
+		shift = nl - lc;
+		zfs_btree_move(tree, l, lc, phdr, sep, 1);
+		zfs_btree_move(tree, l, lc + 1, r, 0, shift - 1);
+		zfs_btree_move(tree, phdr, sep, r, shift - 1, 1);
+		zfs_btree_move(tree, r, 0, r, shift, rc - shift);
+		if (l->bth_core) {
+			zfs_btree_hdr_t **rchildren = zfs_btree_children(r);
+
+			zfs_btree_move_children(l, lc + 1, r, 0, shift);
+			memmove(&rchildren[0], &rchildren[shift],
+			    (rc - shift + 1) * sizeof (zfs_btree_hdr_t *));
+		}
+	} else {
+		return;
+	}
+	l->bth_count = nl;
+	r->bth_count = lc + rc - nl;
+}
+
+/*
+ * Restore the fill invariant of a node an element was just removed from,
+ * working up the tree as merges take elements from the parents.
+ */
+static void
+zfs_btree_rebalance(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	for (;;) {
+		zfs_btree_core_t *parent = hdr->bth_parent;
+		uint32_t cap = zfs_btree_cap(tree, hdr);
+		uint32_t i, sep;
+		zfs_btree_hdr_t *l, *r;
+
+		if (parent == NULL) {
+			if (hdr->bth_count != 0)
+				return;
+			if (hdr->bth_core) {
+				tree->bt_root = zfs_btree_children(hdr)[0];
+				tree->bt_root->bth_parent = NULL;
+			} else {
+				tree->bt_root = NULL;
+			}
+			tree->bt_height--;
+			zfs_btree_node_free(tree, hdr);
+			return;
+		}
+
+		if (hdr->bth_count >= cap / 2)
+			return;
+
+		i = zfs_btree_child_index(parent, hdr);
+		sep = (i > 0) ? i - 1 : 0;
+		l = parent->btc_children[sep];
+		r = parent->btc_children[sep + 1];
+
+		if (l->bth_count + r->bth_count + 1 > cap) {
+			zfs_btree_redistribute(tree, parent, sep);
+			return;
+		}
+		zfs_btree_merge(tree, parent, sep);
+		hdr = &parent->btc_hdr;
+	}
+}
+
+void
+zfs_btree_remove_idx(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = where->bti_node;
+	uint32_t idx = where->bti_offset;
+
+	ASSERT(!where->bti_before);
+	ASSERT3U(idx, <, hdr->bth_count);
+
+	if (hdr->bth_core) {
+		zfs_btree_hdr_t *leaf = zfs_btree_children(hdr)[idx];
+
+		while (leaf->bth_core)
+			leaf = zfs_btree_children(leaf)[leaf->bth_count];
+		zfs_btree_move(tree, hdr, idx, leaf, leaf->bth_count - 1, 1);
+		hdr = leaf;
+		idx = leaf->bth_count - 1;
+	}
+
+	zfs_btree_move(tree, hdr, idx, hdr, idx + 1, hdr->bth_count - idx - 1);
+	hdr->bth_count--;
+	tree->bt_num_elems--;
+
+	zfs_btree_rebalance(tree, hdr);
+}
+
+void
+zfs_btree_remove(zfs_btree_t *tree, const void *value)
+{
+	zfs_btree_index_t where;
+
+	VERIFY3P(zfs_btree_find(tree, value, &where), !=, NULL);
+	zfs_btree_remove_idx(tree, &where);
+}
+
+static void
+zfs_btree_clear_node(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	if (hdr->bth_core) {
+		for (uint32_t i = 0; i <= hdr->bth_count; i++)
+			zfs_btree_clear_node(tree, zfs_btree_children(hdr)[i]);
+	}
+	zfs_btree_node_free(tree, hdr);
+}
+
+/*
+ * Remove all the elements of the tree at once.
+ */
+void
+zfs_btree_clear(zfs_btree_t *tree)
+{
+	if (tree->bt_root != NULL)
+		zfs_btree_clear_node(tree, tree->bt_root);
+	tree->bt_root = NULL;
+	tree->bt_height = -1;
+	tree->bt_num_elems = 0;
+	ASSERT0(tree->bt_num_leaves);
+	ASSERT0(tree->bt_num_cores);
+}
+
+void *
+zfs_btree_get(zfs_btree_t *tree, zfs_btree_index_t *idx)
+{
+	ASSERT(!idx->bti_before);
+	ASSERT3U(idx->bti_offset, <, idx->bti_node->bth_count);
+	return (zfs_btree_elem(tree, idx->bti_node, idx->bti_offset));
+}
+
+void *
+zfs_btree_first(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+
+	if (hdr == NULL) {
+		zfs_btree_set_index(where, NULL, 0, B_TRUE);
+		return (NULL);
+	}
+	while (hdr->bth_core)
+		hdr = zfs_btree_children(hdr)[0];
+	zfs_btree_set_index(where, hdr, 0, B_FALSE);
+	return (zfs_btree_elem(tree, hdr, 0));
+}
+
+void *
+zfs_btree_last(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+
+	if (hdr == NULL) {
+		zfs_btree_set_index(where, NULL, 0, B_TRUE);
+		return (NULL);
+	}
+	while (hdr->bth_core)
+		hdr = zfs_btree_children(hdr)[hdr->bth_count];
+	zfs_btree_set_index(where, hdr, hdr->bth_count - 1, B_FALSE);
+	return (zfs_btree_elem(tree, hdr, hdr->bth_count - 1));
+}
+
+void *
+zfs_btree_next(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t off = idx->bti_offset;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	if (idx->bti_before) {
+		if (off < hdr->bth_count) {
+			zfs_btree_set_index(out_idx, hdr, off, B_FALSE);
+			return (zfs_btree_elem(tree, hdr, off));
+		}
+	} else if (hdr->bth_core) {
+		hdr = zfs_btree_children(hdr)[off + 1];
+		while (hdr->bth_core)
+			hdr = zfs_btree_children(hdr)[0];
+		zfs_btree_set_index(out_idx, hdr, 0, B_FALSE);
+		return (zfs_btree_elem(tree, hdr, 0));
+	} else if (off + 1 < hdr->bth_count) {
+		zfs_btree_set_index(out_idx, hdr, off + 1, B_FALSE);
+		return (zfs_btree_elem(tree, hdr, off + 1));
+	}
+
+	/* Past the end of a leaf: the next element is in an ancestor. */
+	for (;;) {
+		zfs_btree_core_t *parent = hdr->bth_parent;
+		uint32_t i;
+
+		if (parent == NULL)
+			return (NULL);
+		i = zfs_btree_child_index(parent, hdr);
+		if (i < parent->btc_hdr.bth_count) {
+			zfs_btree_set_index(out_idx, &parent->btc_hdr, i,
+			    B_FALSE);
+			return (zfs_btree_elem(tree, &parent->btc_hdr, i));
+		}
+		hdr = &parent->btc_hdr;
+	}
+}
+
+void *
+zfs_btree_prev(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t off = idx->bti_offset;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	if (!idx->bti_before && hdr->bth_core) {
+		hdr = zfs_btree_children(hdr)[off];
+		while (hdr->bth_core)
+			hdr = zfs_btree_children(hdr)[hdr->bth_count];
+		zfs_btree_set_index(out_idx, hdr, hdr->bth_count - 1, B_FALSE);
+		return (zfs_btree_elem(tree, hdr, hdr->bth_count - 1));
+	}
+	if (off > 0) {
+		zfs_btree_set_index(out_idx, hdr, off - 1, B_FALSE);
+		return (zfs_btree_elem(tree, hdr, off - 1));
+	}
+
+	/* At the start of a leaf: the previous element is in an ancestor. */
+	for (;;) {
+		zfs_btree_core_t *parent = hdr->bth_parent;
+		uint32_t i;
+
+		if (parent == NULL)
+			return (NULL);
+		i = zfs_btree_child_index(parent, hdr);
+		if (i > 0) {
+			zfs_btree_set_index(out_idx, &parent->btc_hdr, i - 1,
+			    B_FALSE);
+			return (zfs_btree_elem(tree, &parent->btc_hdr, i - 1));
+		}
+		hdr = &parent->btc_hdr;
+	}
+}
+
+ulong_t
+zfs_btree_numnodes(zfs_btree_t *tree)
+{
+	return (tree->bt_num_elems);
+}
+
+/*
+ * Bytes of memory taken by the nodes of the tree.
+ */
+size_t
+zfs_btree_memory(zfs_btree_t *tree)
+{
+	return (tree->bt_num_leaves * BTREE_LEAF_SIZE +
+	    tree->bt_num_cores * zfs_btree_core_size(tree));
+}
+
+static uint64_t
+zfs_btree_verify_node(zfs_btree_t *tree, zfs_btree_hdr_t *hdr,
+    int64_t height, const void *lo, const void *hi)
+{
+	uint64_t elems = hdr->bth_count;
+	uint32_t i;
+
+	VERIFY3U(hdr->bth_count, <=, zfs_btree_cap(tree, hdr));
+	if (hdr != tree->bt_root)
+		VERIFY3U(hdr->bth_count, >=, zfs_btree_cap(tree, hdr) / 2);
+	VERIFY3S(hdr->bth_core, ==, height > 0);
+
+	for (i = 0; i < hdr->bth_count; i++) {
+		const void *e = zfs_btree_elem(tree, hdr, i);
+
+		if (i > 0) {
+			VERIFY3S(tree->bt_compar(zfs_btree_elem(tree, hdr,
+			    i - 1), e), <, 0);
+		}
+		if (lo != NULL)
+			VERIFY3S(tree->bt_compar(lo, e), <, 0);
+		if (hi != NULL)
+			VERIFY3S(tree->bt_compar(e, hi), <, 0);
+	}
+
+	if (hdr->bth_core) {
+		for (i = 0; i <= hdr->bth_count; i++) {
+			zfs_btree_hdr_t *c = zfs_btree_children(hdr)[i];
+
+			VERIFY3P(c->bth_parent, ==, hdr);
+			elems += zfs_btree_verify_node(tree, c, height - 1,
+			    (i > 0) ? zfs_btree_elem(tree, hdr, i - 1) : lo,
+			    (i < hdr->bth_count) ?
+			    zfs_btree_elem(tree, hdr, i) : hi);
+		}
+	}
+	return (elems);
+}
+
+/*
+ * Check the structure of the tree: ordering, fill and parent pointers.
+ */
+void
+zfs_btree_verify(zfs_btree_t *tree)
+{
+	if (tree->bt_root == NULL) {
+		VERIFY0(tree->bt_num_elems);
+		VERIFY3S(tree->bt_height, ==, -1);
+		return;
+	}
+	VERIFY3P(tree->bt_root->bth_parent, ==, NULL);
+	VERIFY3U(zfs_btree_verify_node(tree, tree->bt_root, tree->bt_height,
+	    NULL, NULL), ==, tree->bt_num_elems);
+}
@@ -192,7 +192,13 @@ dbuf_dest(void *vdb, void *unused)
  */
 static dbuf_hash_table_t dbuf_hash_table;
 
-static uint64_t dbuf_hash_count;
+/*
+ * The hash table is resized by the dbuf eviction thread when the average
+ * chain length exceeds dbuf_hash_load_max, and shrunk again (but never
+ * below its initial size) once it drops under an eighth of that.
+ * Setting it to zero disables resizing.
+ */
+uint_t dbuf_hash_load_max = 2;
 
 static uint64_t
 dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
@@ -219,28 +225,68 @@ dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
 	(dbuf)->db_level == (level) &&			\
 	(dbuf)->db_blkid == (blkid))
 
+/*
+ * Acquire the stripe lock covering hash value hv, noting whether we had
+ * to wait for it.
+ */
+static dbuf_hash_lock_t *
+dbuf_hash_lock_enter(dbuf_hash_table_t *h, uint64_t hv)
+{
+	dbuf_hash_lock_t *hl = DBUF_HASH_LOCK(h, hv);
+
+	if (!mutex_tryenter(&hl->hl_lock)) {
+		mutex_enter(&hl->hl_lock);
+		hl->hl_contended++;
+	}
+	return (hl);
+}
+
+/*
+ * Record that a lookup walked "len" dbufs of a chain.
+ */
+static void
+dbuf_hash_chain_stat(dbuf_hash_lock_t *hl, uint64_t len)
+{
+	ASSERT(MUTEX_HELD(&hl->hl_lock));
+	hl->hl_chains[MIN(highbit64(len), DBUF_HASH_CHAIN_BUCKETS - 1)]++;
+}
+
+uint64_t
+dbuf_hash_count(dbuf_hash_table_t *h)
+{
+	uint64_t count = 0;
+
+	for (uint64_t i = 0; i < h->hash_nlocks; i++)
+		count += h->hash_locks[i].hl_count;
+
+	return (count);
+}
+
 dmu_buf_impl_t *
 dbuf_find(objset_t *os, uint64_t obj, uint8_t level, uint64_t blkid)
 {
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	uint64_t hv = dbuf_hash(os, obj, level, blkid);
-	uint64_t idx;
+	dbuf_hash_lock_t *hl;
 	dmu_buf_impl_t *db;
+	uint64_t len = 0;
 
-	idx = hv & h->hash_table_mask;
-
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (db = h->hash_table[idx]; db != NULL; db = db->db_hash_next) {
+	hl = dbuf_hash_lock_enter(h, hv);
+	for (db = hl->hl_table[hv & hl->hl_mask]; db != NULL;
+	    db = db->db_hash_next) {
+		len++;
 		if (DBUF_EQUAL(db, os, obj, level, blkid)) {
 			mutex_enter(&db->db_mtx);
 			if (db->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				dbuf_hash_chain_stat(hl, len);
+				mutex_exit(&hl->hl_lock);
 				return (db);
 			}
 			mutex_exit(&db->db_mtx);
 		}
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	dbuf_hash_chain_stat(hl, len);
+	mutex_exit(&hl->hl_lock);
 	return (NULL);
 }
 
@@ -277,15 +323,19 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	int level = db->db_level;
 	uint64_t blkid = db->db_blkid;
 	uint64_t hv = dbuf_hash(os, obj, level, blkid);
-	uint64_t idx = hv & h->hash_table_mask;
-	dmu_buf_impl_t *dbf;
+	dbuf_hash_lock_t *hl;
+	dmu_buf_impl_t *dbf, **dbp;
+	uint64_t len = 0;
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (dbf = h->hash_table[idx]; dbf != NULL; dbf = dbf->db_hash_next) {
+	hl = dbuf_hash_lock_enter(h, hv);
+	dbp = &hl->hl_table[hv & hl->hl_mask];
+	for (dbf = *dbp; dbf != NULL; dbf = dbf->db_hash_next) {
+		len++;
 		if (DBUF_EQUAL(dbf, os, obj, level, blkid)) {
 			mutex_enter(&dbf->db_mtx);
 			if (dbf->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				dbuf_hash_chain_stat(hl, len);
+				mutex_exit(&hl->hl_lock);
 				return (dbf);
 			}
 			mutex_exit(&dbf->db_mtx);
@@ -293,10 +343,11 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	}
 
 	mutex_enter(&db->db_mtx);
-	db->db_hash_next = h->hash_table[idx];
-	h->hash_table[idx] = db;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_inc_64(&dbuf_hash_count);
+	db->db_hash_next = *dbp;
+	*dbp = db;
+	hl->hl_count++;
+	dbuf_hash_chain_stat(hl, len);
+	mutex_exit(&hl->hl_lock);
 
 	return (NULL);
 }
@@ -310,27 +361,118 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	uint64_t hv = dbuf_hash(db->db_objset, db->db.db_object,
 		db->db_level, db->db_blkid);
-	uint64_t idx = hv & h->hash_table_mask;
+	dbuf_hash_lock_t *hl;
 	dmu_buf_impl_t *dbf, **dbp;
 
 	/*
 	 * We mustn't hold db_mtx to maintain lock ordering:
-	 * DBUF_HASH_MUTEX > db_mtx.
+	 * DBUF_HASH_LOCK > db_mtx.
 	 */
 	ASSERT(refcount_is_zero(&db->db_holds));
 	ASSERT(db->db_state == DB_EVICTING);
 	ASSERT(!MUTEX_HELD(&db->db_mtx));
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	dbp = &h->hash_table[idx];
+	hl = dbuf_hash_lock_enter(h, hv);
+	dbp = &hl->hl_table[hv & hl->hl_mask];
 	while ((dbf = *dbp) != db) {
 		dbp = &dbf->db_hash_next;
 		ASSERT(dbf != NULL);
 	}
 	*dbp = db->db_hash_next;
 	db->db_hash_next = NULL;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_dec_64(&dbuf_hash_count);
+	hl->hl_count--;
+	mutex_exit(&hl->hl_lock);
+}
+
+/*
+ * Return the size the hash table should have for the number of dbufs it
+ * currently holds.
+ */
+static uint64_t
+dbuf_hash_target_size(dbuf_hash_table_t *h)
+{
+	uint64_t size = h->hash_table_mask + 1;
+	uint64_t count;
+
+	if (dbuf_hash_load_max == 0)
+		return (size);
+
+	count = dbuf_hash_count(h);
+	while (count > size * dbuf_hash_load_max)
+		size <<= 1;
+	while (size > h->hash_min_size &&
+	    count * 8 < size * dbuf_hash_load_max)
+		size >>= 1;
+
+	return (size);
+}
+
+static boolean_t
+dbuf_hash_needs_resize(dbuf_hash_table_t *h)
+{
+	return (dbuf_hash_target_size(h) != h->hash_table_mask + 1);
+}
+
+/*
+ * Rehash the table to the size dbuf_hash_target_size() asks for.  Only
+ * one stripe is locked at a time, and only while its own buckets are
+ * moved, so lookups on all other stripes proceed while the table is being
+ * resized.  Since the number of stripes divides both table sizes, every
+ * dbuf stays under the same stripe, and the buckets it moves into are
+ * only reachable through that stripe.  Once all stripes have switched, no
+ * lookup can reference the old table any more and it can be freed.
+ *
+ * Called only from the dbuf eviction thread, so resizes never overlap.
+ * Returns ENOMEM if the new table could not be allocated.
+ */
+static int
+dbuf_hash_resize(dbuf_hash_table_t *h)
+{
+	uint64_t osize = h->hash_table_mask + 1;
+	uint64_t size = dbuf_hash_target_size(h);
+	dmu_buf_impl_t **otable = h->hash_table;
+	dmu_buf_impl_t **ntable, *db;
+
+	if (size == osize)
+		return (0);
+
+	ASSERT(ISP2(size));
+	ASSERT3U(size, >=, h->hash_nlocks);
+
+	ntable = kmem_zalloc(size * sizeof (void *), KM_NOSLEEP);
+	if (ntable == NULL)
+		return (SET_ERROR(ENOMEM));
+
+	for (uint64_t i = 0; i < h->hash_nlocks; i++) {
+		dbuf_hash_lock_t *hl = &h->hash_locks[i];
+
+		mutex_enter(&hl->hl_lock);
+		ASSERT3P(hl->hl_table, ==, otable);
+		for (uint64_t idx = i; idx < osize; idx += h->hash_nlocks) {
+			while ((db = otable[idx]) != NULL) {
+				uint64_t nidx = dbuf_hash(db->db_objset,
+				    db->db.db_object, db->db_level,
+				    db->db_blkid) & (size - 1);
+
+				otable[idx] = db->db_hash_next;
+				db->db_hash_next = ntable[nidx];
+				ntable[nidx] = db;
+			}
+		}
+		hl->hl_table = ntable;
+		hl->hl_mask = size - 1;
+		mutex_exit(&hl->hl_lock);
+	}
+
+	h->hash_table = ntable;
+	h->hash_table_mask = size - 1;
+	if (size > osize)
+		h->hash_grows++;
+	else
+		h->hash_shrinks++;
+
+	kmem_free(otable, osize * sizeof (void *));
+	return (0);
 }
 
 typedef enum {
@@ -539,12 +681,15 @@ dbuf_evict_thread(void)
 #endif
 {
 	callb_cpr_t cpr;
+	hrtime_t resize_retry = 0;
 
 	CALLB_CPR_INIT(&cpr, &dbuf_evict_lock, callb_generic_cpr, FTAG);
 
 	mutex_enter(&dbuf_evict_lock);
 	while (!dbuf_evict_thread_exit) {
-		while (!dbuf_cache_above_lowater() && !dbuf_evict_thread_exit) {
+		while (!dbuf_cache_above_lowater() && !dbuf_evict_thread_exit &&
+		    (gethrtime() < resize_retry ||
+		    !dbuf_hash_needs_resize(&dbuf_hash_table))) {
 			CALLB_CPR_SAFE_BEGIN(&cpr);
 			(void) cv_timedwait_hires(&dbuf_evict_cv,
 			    &dbuf_evict_lock, SEC2NSEC(1), MSEC2NSEC(1), 0);
@@ -552,6 +697,17 @@ dbuf_evict_thread(void)
 		}
 		mutex_exit(&dbuf_evict_lock);
 
+		/*
+		 * The hash table is resized here, where it is checked about
+		 * once a second, rather than from the insert and remove
+		 * paths, to keep those free of any shared state.  If the
+		 * new table can't be allocated, wait a second before trying
+		 * again rather than spinning while memory is short.
+		 */
+		if (!dbuf_evict_thread_exit && gethrtime() >= resize_retry &&
+		    dbuf_hash_resize(&dbuf_hash_table) != 0)
+			resize_retry = gethrtime() + SEC2NSEC(1);
+
 		/*
 		 * Keep evicting as long as we're above the low water mark
 		 * for the cache. We do this without holding the locks to
@@ -651,8 +807,23 @@ retry:
 	    sizeof (dmu_buf_impl_t),
 	    0, dbuf_cons, dbuf_dest, NULL, NULL, NULL, 0);
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_init(&h->hash_mutexes[i], NULL, MUTEX_DEFAULT, NULL);
+	/*
+	 * Scale the number of stripe locks with the initial table size,
+	 * keeping at least DBUF_MUTEXES of them.  The stripe count is fixed
+	 * from here on, so the table never shrinks below its initial size.
+	 */
+	h->hash_min_size = hsize;
+	h->hash_nlocks = MIN(hsize,
+	    MAX(DBUF_MUTEXES, hsize / DBUF_HASH_LOCK_BUCKETS));
+	h->hash_locks = kmem_zalloc(h->hash_nlocks * sizeof (dbuf_hash_lock_t),
+	    KM_SLEEP);
+	for (i = 0; i < h->hash_nlocks; i++) {
+		dbuf_hash_lock_t *hl = &h->hash_locks[i];
+
+		mutex_init(&hl->hl_lock, NULL, MUTEX_DEFAULT, NULL);
+		hl->hl_table = h->hash_table;
+		hl->hl_mask = h->hash_table_mask;
+	}
 
 	dbuf_stats_init(h);
 
@@ -690,15 +861,10 @@ dbuf_fini(void)
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	int i;
 
-	dbuf_stats_destroy();
-
-	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_destroy(&h->hash_mutexes[i]);
-
-	kmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
-	kmem_cache_destroy(dbuf_kmem_cache);
-	taskq_destroy(dbu_evict_taskq);
-
+	/*
+	 * Stop the eviction thread first, since it may be resizing the
+	 * hash table.
+	 */
 	mutex_enter(&dbuf_evict_lock);
 	dbuf_evict_thread_exit = B_TRUE;
 	while (dbuf_evict_thread_exit) {
@@ -706,6 +872,16 @@ dbuf_fini(void)
 		cv_wait(&dbuf_evict_cv, &dbuf_evict_lock);
 	}
 	mutex_exit(&dbuf_evict_lock);
+
+	dbuf_stats_destroy();
+
+	for (i = 0; i < h->hash_nlocks; i++)
+		mutex_destroy(&h->hash_locks[i].hl_lock);
+	kmem_free(h->hash_locks, h->hash_nlocks * sizeof (dbuf_hash_lock_t));
+
+	kmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
+	kmem_cache_destroy(dbuf_kmem_cache);
+	taskq_destroy(dbu_evict_taskq);
 #ifdef _KERNEL
 	tsd_destroy(&zfs_dbuf_evict_key);
 #endif
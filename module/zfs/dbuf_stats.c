@@ -132,15 +132,23 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 {
 	dbuf_stats_t *dsh = (dbuf_stats_t *)data;
 	dbuf_hash_table_t *h = dsh->hash;
+	dbuf_hash_lock_t *hl = DBUF_HASH_LOCK(h, dsh->idx);
 	dmu_buf_impl_t *db;
 	int length, error = 0;
 
 	ASSERT3S(dsh->idx, >=, 0);
-	ASSERT3S(dsh->idx, <=, h->hash_table_mask);
 	memset(buf, 0, size);
 
-	mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
-	for (db = h->hash_table[dsh->idx]; db != NULL; db = db->db_hash_next) {
+	/*
+	 * The table may have been resized since dbuf_stats_hash_table_addr()
+	 * checked the index; the stripe's own table is authoritative.
+	 */
+	mutex_enter(&hl->hl_lock);
+	if (dsh->idx > hl->hl_mask) {
+		mutex_exit(&hl->hl_lock);
+		return (0);
+	}
+	for (db = hl->hl_table[dsh->idx]; db != NULL; db = db->db_hash_next) {
 		/*
 		 * Returning ENOMEM will cause the data and header functions
 		 * to be called with a larger scratch buffers.
@@ -151,7 +159,7 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 		}
 
 		mutex_enter(&db->db_mtx);
-		mutex_exit(DBUF_HASH_MUTEX(h, dsh->idx));
+		mutex_exit(&hl->hl_lock);
 
 		if (db->db_state != DB_EVICTING) {
 			length = __dbuf_stats_hash_table_data(buf, size, db);
@@ -160,9 +168,9 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 		}
 
 		mutex_exit(&db->db_mtx);
-		mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
+		mutex_enter(&hl->hl_lock);
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, dsh->idx));
+	mutex_exit(&hl->hl_lock);
 
 	return (error);
 }
@@ -218,15 +226,115 @@ dbuf_stats_hash_table_destroy(void)
 	mutex_destroy(&dsh->lock);
 }
 
+/*
+ * ==========================================================================
+ * Dbuf Hash Summary Routines
+ * ==========================================================================
+ */
+typedef struct dbuf_hash_stats {
+	kstat_named_t dhs_elements;
+	kstat_named_t dhs_buckets;
+	kstat_named_t dhs_min_buckets;
+	kstat_named_t dhs_locks;
+	kstat_named_t dhs_grows;
+	kstat_named_t dhs_shrinks;
+	kstat_named_t dhs_lock_contended;
+	kstat_named_t dhs_chains[DBUF_HASH_CHAIN_BUCKETS];
+} dbuf_hash_stats_t;
+
+static dbuf_hash_stats_t dbuf_hash_stats = {
+	{ "elements",			KSTAT_DATA_UINT64 },
+	{ "buckets",			KSTAT_DATA_UINT64 },
+	{ "min_buckets",		KSTAT_DATA_UINT64 },
+	{ "locks",			KSTAT_DATA_UINT64 },
+	{ "grows",			KSTAT_DATA_UINT64 },
+	{ "shrinks",			KSTAT_DATA_UINT64 },
+	{ "lock_contended",		KSTAT_DATA_UINT64 },
+	{
+		/* dbufs walked per lookup */
+		{ "chain_0",		KSTAT_DATA_UINT64 },
+		{ "chain_1",		KSTAT_DATA_UINT64 },
+		{ "chain_2_3",		KSTAT_DATA_UINT64 },
+		{ "chain_4_7",		KSTAT_DATA_UINT64 },
+		{ "chain_8_15",		KSTAT_DATA_UINT64 },
+		{ "chain_16_31",	KSTAT_DATA_UINT64 },
+		{ "chain_32_63",	KSTAT_DATA_UINT64 },
+		{ "chain_64_plus",	KSTAT_DATA_UINT64 },
+	}
+};
+
+static kstat_t *dbuf_hash_ksp;
+
+/*
+ * The counters are kept per stripe, without atomics, and summed here.
+ */
+static int
+dbuf_stats_hash_update(kstat_t *ksp, int rw)
+{
+	dbuf_hash_table_t *h = ksp->ks_private;
+	dbuf_hash_stats_t *dhs = ksp->ks_data;
+	uint64_t contended = 0;
+	int c;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	for (c = 0; c < DBUF_HASH_CHAIN_BUCKETS; c++)
+		dhs->dhs_chains[c].value.ui64 = 0;
+	for (uint64_t i = 0; i < h->hash_nlocks; i++) {
+		dbuf_hash_lock_t *hl = &h->hash_locks[i];
+
+		contended += hl->hl_contended;
+		for (c = 0; c < DBUF_HASH_CHAIN_BUCKETS; c++)
+			dhs->dhs_chains[c].value.ui64 += hl->hl_chains[c];
+	}
+
+	dhs->dhs_elements.value.ui64 = dbuf_hash_count(h);
+	dhs->dhs_buckets.value.ui64 = h->hash_table_mask + 1;
+	dhs->dhs_min_buckets.value.ui64 = h->hash_min_size;
+	dhs->dhs_locks.value.ui64 = h->hash_nlocks;
+	dhs->dhs_grows.value.ui64 = h->hash_grows;
+	dhs->dhs_shrinks.value.ui64 = h->hash_shrinks;
+	dhs->dhs_lock_contended.value.ui64 = contended;
+
+	return (0);
+}
+
+static void
+dbuf_stats_hash_init(dbuf_hash_table_t *hash)
+{
+	dbuf_hash_ksp = kstat_create("zfs", 0, "dbufhashstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dbuf_hash_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (dbuf_hash_ksp != NULL) {
+		dbuf_hash_ksp->ks_data = &dbuf_hash_stats;
+		dbuf_hash_ksp->ks_private = hash;
+		dbuf_hash_ksp->ks_update = dbuf_stats_hash_update;
+		kstat_install(dbuf_hash_ksp);
+	}
+}
+
+static void
+dbuf_stats_hash_destroy(void)
+{
+	if (dbuf_hash_ksp != NULL) {
+		kstat_delete(dbuf_hash_ksp);
+		dbuf_hash_ksp = NULL;
+	}
+}
+
 void
 dbuf_stats_init(dbuf_hash_table_t *hash)
 {
 	dbuf_stats_hash_table_init(hash);
+	dbuf_stats_hash_init(hash);
 }
 
 void
 dbuf_stats_destroy(void)
 {
+	dbuf_stats_hash_destroy();
 	dbuf_stats_hash_table_destroy();
 }
 
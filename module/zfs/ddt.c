@@ -36,7 +36,9 @@
 #include <sys/zio_checksum.h>
 #include <sys/zio_compress.h>
 #include <sys/dsl_scan.h>
+#include <sys/dsl_synctask.h>
 #include <sys/abd.h>
+#include <sys/zfeature.h>
 
 static kmem_cache_t *ddt_cache;
 static kmem_cache_t *ddt_entry_cache;
@@ -56,7 +58,7 @@ static const char *ddt_class_name[DDT_CLASSES] = {
 	"unique",
 };
 
-static void
+void
 ddt_object_create(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
     dmu_tx_t *tx)
 {
@@ -192,7 +194,7 @@ ddt_object_update(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
 	    ddt->ddt_object[type][class], dde, tx));
 }
 
-static int
+int
 ddt_object_remove(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
     ddt_entry_t *dde, dmu_tx_t *tx)
 {
@@ -545,6 +547,53 @@ ddt_get_pool_dedup_ratio(spa_t *spa)
 	return (dds_total.dds_ref_dsize * 100 / dds_total.dds_dsize);
 }
 
+/*
+ * Recompute the on-disk size of the DDT: its ZAPs, as cached by
+ * ddt_object_sync(), plus whatever the dedup logs hold.
+ */
+static void
+ddt_update_dsize(spa_t *spa)
+{
+	enum zio_checksum c;
+	enum ddt_type type;
+	enum ddt_class class;
+	uint64_t dsize = 0;
+
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		if (ddt == NULL)
+			continue;
+		for (type = 0; type < DDT_TYPES; type++) {
+			for (class = 0; class < DDT_CLASSES; class++) {
+				dsize += ddt->ddt_object_stats[type][class].
+				    ddo_dspace;
+			}
+		}
+		dsize += ddt->ddt_log[0].ddl_length +
+		    ddt->ddt_log[1].ddl_length;
+	}
+
+	spa->spa_dedup_dsize = dsize;
+}
+
+uint64_t
+ddt_get_ddt_dsize(spa_t *spa)
+{
+	return (spa->spa_dedup_dsize);
+}
+
+/*
+ * True once the DDT has grown to the pool's dedup_table_quota, at which
+ * point new unique blocks are no longer given an entry.
+ */
+boolean_t
+ddt_over_quota(spa_t *spa)
+{
+	uint64_t quota = spa->spa_dedup_table_quota;
+
+	return (quota != 0 && spa->spa_dedup_dsize >= quota);
+}
+
 int
 ddt_ditto_copies_needed(ddt_t *ddt, ddt_entry_t *dde, ddt_phys_t *ddp_willref)
 {
@@ -679,11 +728,13 @@ ddt_init(void)
 	    sizeof (ddt_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	ddt_entry_cache = kmem_cache_create("ddt_entry_cache",
 	    sizeof (ddt_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	ddt_log_init();
 }
 
 void
 ddt_fini(void)
 {
+	ddt_log_fini();
 	kmem_cache_destroy(ddt_entry_cache);
 	kmem_cache_destroy(ddt_cache);
 }
@@ -728,18 +779,19 @@ ddt_remove(ddt_t *ddt, ddt_entry_t *dde)
 	ddt_free(dde);
 }
 
-ddt_entry_t *
-ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
+static ddt_entry_t *
+ddt_lookup_key(ddt_t *ddt, const ddt_key_t *ddk, boolean_t add)
 {
 	ddt_entry_t *dde, dde_search;
 	enum ddt_type type;
 	enum ddt_class class;
 	avl_index_t where;
+	hrtime_t start;
 	int error;
 
 	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
 
-	ddt_key_fill(&dde_search.dde_key, bp);
+	dde_search.dde_key = *ddk;
 
 	dde = avl_find(&ddt->ddt_tree, &dde_search, &where);
 	if (dde == NULL) {
@@ -757,24 +809,40 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 
 	dde->dde_loading = B_TRUE;
 
-	ddt_exit(ddt);
+	start = gethrtime();
+
+	/*
+	 * The dedup logs hold the latest state of the entries they have,
+	 * which the ZAPs only catch up with when the logs are flushed.
+	 */
+	error = ddt_log_lookup(ddt, dde);
+	if (error != ESRCH) {
+		ddt_log_lookup_done(ddt, B_TRUE, start);
+		type = dde->dde_type;
+		class = dde->dde_class;
+	} else {
+		ddt_exit(ddt);
 
-	error = ENOENT;
+		error = ENOENT;
 
-	for (type = 0; type < DDT_TYPES; type++) {
-		for (class = 0; class < DDT_CLASSES; class++) {
-			error = ddt_object_lookup(ddt, type, class, dde);
+		for (type = 0; type < DDT_TYPES; type++) {
+			for (class = 0; class < DDT_CLASSES; class++) {
+				error = ddt_object_lookup(ddt, type, class,
+				    dde);
+				if (error != ENOENT)
+					break;
+			}
 			if (error != ENOENT)
 				break;
 		}
-		if (error != ENOENT)
-			break;
+
+		ddt_log_lookup_done(ddt, B_FALSE, start);
+
+		ddt_enter(ddt);
 	}
 
 	ASSERT(error == 0 || error == ENOENT);
 
-	ddt_enter(ddt);
-
 	ASSERT(dde->dde_loaded == B_FALSE);
 	ASSERT(dde->dde_loading == B_TRUE);
 
@@ -791,6 +859,75 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 	return (dde);
 }
 
+ddt_entry_t *
+ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
+{
+	ddt_key_t ddk;
+
+	ddt_key_fill(&ddk, bp);
+
+	return (ddt_lookup_key(ddt, &ddk, add));
+}
+
+/*
+ * True if dde was added by ddt_lookup() and nothing has claimed it yet.
+ */
+static boolean_t
+ddt_entry_is_new(const ddt_entry_t *dde)
+{
+	int p;
+
+	if (dde->dde_type != DDT_TYPES)
+		return (B_FALSE);
+
+	for (p = 0; p < DDT_PHYS_TYPES; p++) {
+		if (dde->dde_phys[p].ddp_phys_birth != 0 ||
+		    dde->dde_lead_zio[p] != NULL)
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * True if bp has an entry in core, in the logs or in the ZAPs.  Unlike
+ * ddt_lookup(), this never adds an in-core entry, so zio_ddt_write() can
+ * decide to skip dedup once the DDT is over its quota without leaving an
+ * empty entry behind.  An in-core entry that nothing has claimed yet does
+ * not count.  The lock is dropped while the ZAPs are searched.
+ */
+boolean_t
+ddt_exists(ddt_t *ddt, const blkptr_t *bp)
+{
+	ddt_entry_t *dde, dde_search;
+	enum ddt_type type;
+	enum ddt_class class;
+	int error;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	dde = ddt_lookup(ddt, bp, B_FALSE);
+	if (dde != NULL)
+		return (!ddt_entry_is_new(dde));
+
+	bzero(&dde_search, sizeof (dde_search));
+	ddt_key_fill(&dde_search.dde_key, bp);
+
+	error = ddt_log_lookup(ddt, &dde_search);
+	if (error != ESRCH)
+		return (error == 0);
+
+	ddt_exit(ddt);
+	for (type = 0; type < DDT_TYPES && error != 0; type++) {
+		for (class = 0; class < DDT_CLASSES && error != 0; class++)
+			error = ddt_object_lookup(ddt, type, class,
+			    &dde_search);
+	}
+	ddt_enter(ddt);
+
+	return (error == 0);
+}
+
 void
 ddt_prefetch(spa_t *spa, const blkptr_t *bp)
 {
@@ -849,6 +986,7 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
 	avl_create(&ddt->ddt_repair_tree, ddt_entry_compare,
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
+	ddt_log_alloc(ddt);
 	ddt->ddt_checksum = c;
 	ddt->ddt_spa = spa;
 	ddt->ddt_os = spa->spa_meta_objset;
@@ -863,16 +1001,93 @@ ddt_table_free(ddt_t *ddt)
 	ASSERT(avl_numnodes(&ddt->ddt_repair_tree) == 0);
 	avl_destroy(&ddt->ddt_tree);
 	avl_destroy(&ddt->ddt_repair_tree);
+	ddt_log_free(ddt);
 	mutex_destroy(&ddt->ddt_lock);
 	kmem_cache_free(ddt_cache, ddt);
 }
 
+/*
+ * DDT entries only know the txg their block was born in, so to let
+ * ddt_prune() work in terms of age, the DDT statistics ZAP keeps a daily
+ * (time, txg) sample.  Only the most recent DDT_TXG_TIMES_MAX samples are
+ * kept, which is as many as fit in a single ZAP value.
+ */
+#define	DDT_TXG_TIMES		"txg-times"
+#define	DDT_TXG_TIMES_MAX	(ZAP_MAXVALUELEN / (2 * sizeof (uint64_t)))
+#define	DDT_SECS_PER_DAY	(24 * 60 * 60)
+#define	DDT_TXG_TIMES_INTERVAL	DDT_SECS_PER_DAY
+
+static uint64_t *
+ddt_txg_times_load(spa_t *spa, uint64_t *nsamples)
+{
+	uint64_t *tt = kmem_zalloc(ZAP_MAXVALUELEN, KM_SLEEP);
+	uint64_t n = 0;
+
+	if (spa->spa_ddt_stat_object != 0 &&
+	    zap_length(spa->spa_meta_objset, spa->spa_ddt_stat_object,
+	    DDT_TXG_TIMES, NULL, &n) == 0 &&
+	    zap_lookup(spa->spa_meta_objset, spa->spa_ddt_stat_object,
+	    DDT_TXG_TIMES, sizeof (uint64_t), n, tt) != 0)
+		n = 0;
+
+	*nsamples = n / 2;
+	return (tt);
+}
+
+static void
+ddt_txg_times_sync(spa_t *spa, dmu_tx_t *tx)
+{
+	uint64_t now = gethrestime_sec();
+	uint64_t *tt;
+	uint64_t i, n;
+
+	if (spa->spa_ddt_stat_object == 0 ||
+	    now < spa->spa_ddt_sample_time + DDT_TXG_TIMES_INTERVAL)
+		return;
+
+	tt = ddt_txg_times_load(spa, &n);
+	if (n == DDT_TXG_TIMES_MAX) {
+		for (i = 2; i < 2 * n; i++)
+			tt[i - 2] = tt[i];
+		n--;
+	}
+	tt[2 * n] = now;
+	tt[2 * n + 1] = dmu_tx_get_txg(tx);
+	n++;
+
+	VERIFY(zap_update(spa->spa_meta_objset, spa->spa_ddt_stat_object,
+	    DDT_TXG_TIMES, sizeof (uint64_t), 2 * n, tt, tx) == 0);
+	kmem_free(tt, ZAP_MAXVALUELEN);
+
+	spa->spa_ddt_sample_time = now;
+}
+
+/*
+ * Return the last sampled txg that was synced no later than time, or 0
+ * if the samples don't go back that far.
+ */
+static uint64_t
+ddt_txg_times_lookup(spa_t *spa, uint64_t time)
+{
+	uint64_t *tt;
+	uint64_t i, n, txg = 0;
+
+	tt = ddt_txg_times_load(spa, &n);
+	for (i = 0; i < n && tt[2 * i] <= time; i++)
+		txg = tt[2 * i + 1];
+	kmem_free(tt, ZAP_MAXVALUELEN);
+
+	return (txg);
+}
+
 void
 ddt_create(spa_t *spa)
 {
 	enum zio_checksum c;
 
 	spa->spa_dedup_checksum = ZIO_DEDUPCHECKSUM;
+	spa->spa_dedup_dsize = 0;
+	spa->spa_ddt_sample_time = 0;
 
 	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++)
 		spa->spa_ddt[c] = ddt_table_alloc(spa, c);
@@ -884,6 +1099,7 @@ ddt_load(spa_t *spa)
 	enum zio_checksum c;
 	enum ddt_type type;
 	enum ddt_class class;
+	uint64_t *tt, n;
 	int error;
 
 	ddt_create(spa);
@@ -906,6 +1122,10 @@ ddt_load(spa_t *spa)
 			}
 		}
 
+		error = ddt_log_load(ddt);
+		if (error != 0)
+			return (error);
+
 		/*
 		 * Seed the cached histograms.
 		 */
@@ -913,6 +1133,13 @@ ddt_load(spa_t *spa)
 		    sizeof (ddt->ddt_histogram));
 	}
 
+	tt = ddt_txg_times_load(spa, &n);
+	if (n != 0)
+		spa->spa_ddt_sample_time = tt[2 * (n - 1)];
+	kmem_free(tt, ZAP_MAXVALUELEN);
+
+	ddt_update_dsize(spa);
+
 	return (0);
 }
 
@@ -948,11 +1175,17 @@ ddt_class_contains(spa_t *spa, enum ddt_class max_class, const blkptr_t *bp)
 
 	ddt_key_fill(&(dde->dde_key), bp);
 
+	/*
+	 * Answer as a walk of the ZAPs would, so that the scan traverses
+	 * exactly the blocks that dsl_scan_ddt() does not visit.
+	 */
 	for (type = 0; type < DDT_TYPES; type++) {
 		for (class = 0; class <= max_class; class++) {
 			if (ddt_object_lookup(ddt, type, class, dde) == 0) {
+				boolean_t hidden = ddt_log_hides(ddt, dde,
+				    class);
 				kmem_cache_free(ddt_entry_cache, dde);
-				return (B_TRUE);
+				return (!hidden);
 			}
 		}
 	}
@@ -968,12 +1201,19 @@ ddt_repair_start(ddt_t *ddt, const blkptr_t *bp)
 	ddt_entry_t *dde;
 	enum ddt_type type;
 	enum ddt_class class;
+	int error;
 
 	ddt_key_fill(&ddk, bp);
 
 	dde = ddt_alloc(&ddk);
 
-	for (type = 0; type < DDT_TYPES; type++) {
+	ddt_enter(ddt);
+	error = ddt_log_lookup(ddt, dde);
+	ddt_exit(ddt);
+	if (error == 0 && dde->dde_class != DDT_CLASS_UNIQUE)
+		return (dde);
+
+	for (type = 0; error == ESRCH && type < DDT_TYPES; type++) {
 		for (class = 0; class < DDT_CLASSES; class++) {
 			/*
 			 * We can only do repair if there are multiple copies
@@ -1107,7 +1347,13 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 	else
 		nclass = DDT_CLASS_UNIQUE;
 
-	if (otype != DDT_TYPES &&
+	if (ddt_log_enabled(ddt)) {
+		/*
+		 * The ZAPs catch up with the log in ddt_log_flush().
+		 */
+		ddt_log_entry(ddt, dde, otype != DDT_TYPES ? oclass :
+		    DDT_CLASSES, total_refcnt != 0 ? nclass : DDT_CLASSES, tx);
+	} else if (otype != DDT_TYPES &&
 	    (otype != ntype || oclass != nclass || total_refcnt == 0)) {
 		VERIFY(ddt_object_remove(ddt, otype, oclass, dde, tx) == 0);
 		ASSERT(ddt_object_lookup(ddt, otype, oclass, dde) == ENOENT);
@@ -1119,7 +1365,10 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 		ddt_stat_update(ddt, dde, 0);
 		if (!ddt_object_exists(ddt, ntype, nclass))
 			ddt_object_create(ddt, ntype, nclass, tx);
-		VERIFY(ddt_object_update(ddt, ntype, nclass, dde, tx) == 0);
+		if (!ddt_log_enabled(ddt)) {
+			VERIFY(ddt_object_update(ddt, ntype, nclass, dde,
+			    tx) == 0);
+		}
 
 		/*
 		 * If the class changes, the order that we scan this bp
@@ -1143,16 +1392,23 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 	void *cookie = NULL;
 	enum ddt_type type;
 	enum ddt_class class;
+	boolean_t dirty = (avl_numnodes(&ddt->ddt_tree) != 0);
 
-	if (avl_numnodes(&ddt->ddt_tree) == 0)
+	if (!dirty && ddt_log_empty(ddt))
 		return;
 
 	ASSERT(spa->spa_uberblock.ub_version >= SPA_VERSION_DEDUP);
 
-	if (spa->spa_ddt_stat_object == 0) {
-		spa->spa_ddt_stat_object = zap_create_link(ddt->ddt_os,
-		    DMU_OT_DDT_STATS, DMU_POOL_DIRECTORY_OBJECT,
-		    DMU_POOL_DDT_STATS, tx);
+	if (dirty) {
+		if (spa->spa_ddt_stat_object == 0) {
+			spa->spa_ddt_stat_object = zap_create_link(ddt->ddt_os,
+			    DMU_OT_DDT_STATS, DMU_POOL_DIRECTORY_OBJECT,
+			    DMU_POOL_DDT_STATS, tx);
+		}
+
+		if (!ddt_log_enabled(ddt) &&
+		    spa_feature_is_enabled(spa, SPA_FEATURE_DEDUP_LOG))
+			ddt_log_activate(ddt, tx);
 	}
 
 	while ((dde = avl_destroy_nodes(&ddt->ddt_tree, &cookie)) != NULL) {
@@ -1160,6 +1416,16 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 		ddt_free(dde);
 	}
 
+	if (ddt_log_enabled(ddt)) {
+		ddt_log_commit(ddt, tx);
+		if (spa_sync_pass(spa) == 1 && ddt_log_flush(ddt, tx))
+			dirty = B_TRUE;
+		ddt_log_sync(ddt, tx);
+	}
+
+	if (!dirty)
+		return;
+
 	for (type = 0; type < DDT_TYPES; type++) {
 		uint64_t count = 0;
 		for (class = 0; class < DDT_CLASSES; class++) {
@@ -1168,6 +1434,11 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 				count += ddt_object_count(ddt, type, class);
 			}
 		}
+		/*
+		 * Entries still in the dedup logs may yet go to any class.
+		 */
+		if (!ddt_log_empty(ddt))
+			continue;
 		for (class = 0; class < DDT_CLASSES; class++) {
 			if (count == 0 && ddt_object_exists(ddt, type, class))
 				ddt_object_destroy(ddt, type, class, tx);
@@ -1200,6 +1471,10 @@ ddt_sync(spa_t *spa, uint64_t txg)
 
 	(void) zio_wait(rio);
 
+	if (spa_sync_pass(spa) == 1)
+		ddt_txg_times_sync(spa, tx);
+	ddt_update_dsize(spa);
+
 	dmu_tx_commit(tx);
 }
 
@@ -1213,9 +1488,18 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 				int error = ENOENT;
 				if (ddt_object_exists(ddt, ddb->ddb_type,
 				    ddb->ddb_class)) {
-					error = ddt_object_walk(ddt,
-					    ddb->ddb_type, ddb->ddb_class,
-					    &ddb->ddb_cursor, dde);
+					/*
+					 * Skip the entries the dedup logs
+					 * have removed or moved elsewhere.
+					 */
+					do {
+						error = ddt_object_walk(ddt,
+						    ddb->ddb_type,
+						    ddb->ddb_class,
+						    &ddb->ddb_cursor, dde);
+					} while (error == 0 &&
+					    ddt_log_hides(ddt, dde,
+					    ddb->ddb_class));
 				}
 				dde->dde_type = ddb->ddb_type;
 				dde->dde_class = ddb->ddb_class;
@@ -1232,3 +1516,190 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 
 	return (SET_ERROR(ENOENT));
 }
+
+/*
+ * Pruning removes the entries of unique blocks born before a given txg,
+ * leaving the blocks themselves in place.  Nothing can find them to dedup
+ * against any more, and zio_ddt_free() frees them directly once their
+ * only reference goes away.  The UNIQUE ZAPs are walked in open context
+ * and each batch of candidates is then checked and pruned in a sync task.
+ * Older software would instead look up the missing entry on free and leak
+ * the block, so the first prune activates SPA_FEATURE_DDT_PRUNE.
+ */
+#define	DDT_PRUNE_BATCH	1024
+
+typedef struct ddt_prune_arg {
+	ddt_t		*dpa_ddt;
+	uint64_t	dpa_txg;	/* prune blocks born up to this txg */
+	ddt_key_t	*dpa_keys;
+	uint64_t	dpa_nkeys;
+	uint64_t	dpa_pruned;
+} ddt_prune_arg_t;
+
+/*
+ * Return the birth txg of dde if it is a unique entry that can be
+ * pruned, or 0 if it isn't.
+ */
+static uint64_t
+ddt_prune_birth(const ddt_entry_t *dde)
+{
+	const ddt_phys_t *ddp = dde->dde_phys;
+	uint64_t birth = 0;
+	int p;
+
+	if (ddp[DDT_PHYS_DITTO].ddp_phys_birth != 0 ||
+	    ddt_phys_total_refcnt(dde) != 1)
+		return (0);
+
+	for (p = DDT_PHYS_SINGLE; p <= DDT_PHYS_TRIPLE; p++) {
+		if (dde->dde_lead_zio[p] != NULL)
+			return (0);
+		if (ddp[p].ddp_refcnt != 0)
+			birth = ddp[p].ddp_phys_birth;
+	}
+
+	return (birth);
+}
+
+/* ARGSUSED */
+static int
+ddt_prune_check(void *arg, dmu_tx_t *tx)
+{
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_DDT_PRUNE))
+		return (SET_ERROR(ENOTSUP));
+
+	return (0);
+}
+
+static void
+ddt_prune_sync(void *arg, dmu_tx_t *tx)
+{
+	ddt_prune_arg_t *dpa = arg;
+	ddt_t *ddt = dpa->dpa_ddt;
+	spa_t *spa = ddt->ddt_spa;
+	uint64_t i, birth;
+
+	ddt_enter(ddt);
+	for (i = 0; i < dpa->dpa_nkeys; i++) {
+		ddt_entry_t *dde = ddt_lookup_key(ddt, &dpa->dpa_keys[i],
+		    B_TRUE);
+
+		/*
+		 * The entry may have gained references or been freed since
+		 * it was found, so check it again now that it can't change.
+		 * ddt_sync_entry() drops it once it has no phys left.
+		 */
+		if (dde->dde_type == DDT_TYPES ||
+		    dde->dde_class != DDT_CLASS_UNIQUE)
+			continue;
+		birth = ddt_prune_birth(dde);
+		if (birth == 0 || birth > dpa->dpa_txg)
+			continue;
+
+		if (!spa_feature_is_active(spa, SPA_FEATURE_DDT_PRUNE))
+			spa_feature_incr(spa, SPA_FEATURE_DDT_PRUNE, tx);
+		bzero(dde->dde_phys, sizeof (dde->dde_phys));
+		dpa->dpa_pruned++;
+	}
+	ddt_exit(ddt);
+
+	spa->spa_ddt_pruned += dpa->dpa_pruned;
+}
+
+static int
+ddt_prune_batch(ddt_prune_arg_t *dpa)
+{
+	int error;
+
+	dpa->dpa_pruned = 0;
+	error = dsl_sync_task(spa_name(dpa->dpa_ddt->ddt_spa),
+	    ddt_prune_check, ddt_prune_sync, dpa, 0,
+	    ZFS_SPACE_CHECK_RESERVED);
+	dpa->dpa_nkeys = 0;
+
+	return (error);
+}
+
+static int
+ddt_prune_table(ddt_t *ddt, uint64_t txg, uint64_t *pruned)
+{
+	ddt_prune_arg_t dpa = { 0 };
+	ddt_entry_t dde;
+	enum ddt_type type;
+	uint64_t birth;
+	int error = 0;
+
+	bzero(&dde, sizeof (dde));
+	dpa.dpa_ddt = ddt;
+	dpa.dpa_txg = txg;
+	dpa.dpa_keys = vmem_alloc(DDT_PRUNE_BATCH * sizeof (ddt_key_t),
+	    KM_SLEEP);
+
+	for (type = 0; type < DDT_TYPES && error == 0; type++) {
+		uint64_t walk = 0;
+
+		if (!ddt_object_exists(ddt, type, DDT_CLASS_UNIQUE))
+			continue;
+
+		while ((error = ddt_object_walk(ddt, type, DDT_CLASS_UNIQUE,
+		    &walk, &dde)) == 0) {
+			birth = ddt_prune_birth(&dde);
+			if (birth == 0 || birth > txg)
+				continue;
+			dpa.dpa_keys[dpa.dpa_nkeys++] = dde.dde_key;
+			if (dpa.dpa_nkeys == DDT_PRUNE_BATCH) {
+				error = ddt_prune_batch(&dpa);
+				*pruned += dpa.dpa_pruned;
+				if (error != 0)
+					break;
+			}
+		}
+		if (error == ENOENT)
+			error = 0;
+	}
+
+	if (error == 0 && dpa.dpa_nkeys != 0) {
+		error = ddt_prune_batch(&dpa);
+		*pruned += dpa.dpa_pruned;
+	}
+
+	vmem_free(dpa.dpa_keys, DDT_PRUNE_BATCH * sizeof (ddt_key_t));
+
+	return (error);
+}
+
+/*
+ * Prune the unique entries whose blocks are more than days old, or all of
+ * them if days is 0, and return how many were pruned.  Blocks younger than
+ * the oldest txg/time sample are always kept.
+ */
+int
+ddt_prune(spa_t *spa, uint64_t days, uint64_t *pruned)
+{
+	uint64_t now = gethrestime_sec();
+	uint64_t txg;
+	enum zio_checksum c;
+	int error = 0;
+
+	*pruned = 0;
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_DDT_PRUNE))
+		return (SET_ERROR(ENOTSUP));
+
+	if (days == 0)
+		txg = UINT64_MAX;
+	else if (days > now / DDT_SECS_PER_DAY)
+		txg = 0;
+	else
+		txg = ddt_txg_times_lookup(spa, now - days * DDT_SECS_PER_DAY);
+
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS && txg != 0; c++) {
+		error = ddt_prune_table(spa->spa_ddt[c], txg, pruned);
+		if (error != 0)
+			break;
+	}
+
+	return (error);
+}
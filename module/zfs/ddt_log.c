@@ -0,0 +1,783 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Dedup logs.
+ *
+ * Without them every DDT entry that changes in a txg is updated in place
+ * in its DDT ZAP in that txg.  Dedup checksums are uniformly distributed,
+ * so each of those updates dirties a different ZAP leaf, and once the
+ * DDT no longer fits in the ARC each of them also has to read its leaf
+ * first.  The cost of syncing a txg then grows with the number of dedup
+ * writes and frees rather than with the amount of data written.
+ *
+ * With the dedup_log feature each DDT instead appends the entries that
+ * changed in a txg to its active log, a plain object of ddt_log_record_t
+ * written sequentially, and keeps the latest state of every logged entry
+ * in memory, in the log's ddl_tree.  ddt_lookup() and the other readers
+ * of the DDT consult these trees before the ZAPs.
+ *
+ * Once the active log is zfs_dedup_log_txg_max txgs old, or the logs of
+ * all the DDTs take more than zfs_dedup_log_mem_max bytes of memory, it
+ * becomes the flushing log and an empty one takes its place.  Each txg,
+ * ddt_log_flush() then writes the next zfs_dedup_log_flush_txgs'th of
+ * the flushing log (but at least zfs_dedup_log_flush_entries_min entries)
+ * back to the ZAPs, in key order.  The DDT ZAPs of cryptographic checksums
+ * are hashed by key, so a batch of sorted entries shares ZAP leaves.  An
+ * entry changed again while it waits to be flushed moves to the active
+ * log.  The flushing log is truncated once it has been flushed entirely.
+ *
+ * Every logged entry records the class it belongs to and the class the
+ * ZAPs hold it in, so that flushing it only has to look at those two ZAP
+ * objects.  The objects, lengths and first txgs of both logs are kept in
+ * the MOS directory under DMU_POOL_DDT_LOG.  When the pool is opened
+ * ddt_log_load() reads the flushing log and then the active log back in.
+ *
+ * ddt_lock protects the trees of both logs and which of them is active;
+ * everything else is only used from syncing context.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/zio.h>
+#include <sys/ddt.h>
+#include <sys/zap.h>
+#include <sys/dmu_tx.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_scan.h>
+#include <sys/zio_checksum.h>
+#include <sys/zfeature.h>
+
+/*
+ * Start flushing the active log once it is this many txgs old.
+ */
+uint64_t zfs_dedup_log_txg_max = 100;
+
+/*
+ * Start flushing the active logs, and flush the flushing logs at up to
+ * zfs_dedup_log_flush_entries_max entries per txg, once the in-core
+ * entries of all the dedup logs take more than this much memory.
+ */
+uint64_t zfs_dedup_log_mem_max = 64ULL << 20;
+
+/*
+ * Spread the flush of a log over this many txgs.
+ */
+uint64_t zfs_dedup_log_flush_txgs = 20;
+
+/*
+ * Entries flushed each txg while a log is flushing, and while over the
+ * memory limit above.
+ */
+uint64_t zfs_dedup_log_flush_entries_min = 1000;
+uint64_t zfs_dedup_log_flush_entries_max = 100000;
+
+#define	DDT_LOG_BLKSZ		(1ULL << 17)
+#define	DDT_LOG_BUF_RECS	(DDT_LOG_BLKSZ / sizeof (ddt_log_record_t))
+
+/*
+ * On-disk location of a dedup log, as kept in the MOS directory.  The
+ * active log comes first.
+ */
+typedef struct ddt_log_phys {
+	uint64_t	dlp_object;
+	uint64_t	dlp_length;
+	uint64_t	dlp_first_txg;
+} ddt_log_phys_t;
+
+#define	DDT_LOG_PHYS_WORDS	\
+	(2 * sizeof (ddt_log_phys_t) / sizeof (uint64_t))
+
+typedef struct ddt_log_stats {
+	kstat_named_t	ddls_entries;
+	kstat_named_t	ddls_bytes;
+	kstat_named_t	ddls_records_written;
+	kstat_named_t	ddls_entries_flushed;
+	kstat_named_t	ddls_flush_txgs;
+	kstat_named_t	ddls_flush_ns;
+	kstat_named_t	ddls_lookups;
+	kstat_named_t	ddls_lookup_log_hits;
+	kstat_named_t	ddls_lookup_ns;
+} ddt_log_stats_t;
+
+static ddt_log_stats_t ddt_log_stats = {
+	{ "entries",			KSTAT_DATA_UINT64 },
+	{ "bytes",			KSTAT_DATA_UINT64 },
+	{ "records_written",		KSTAT_DATA_UINT64 },
+	{ "entries_flushed",		KSTAT_DATA_UINT64 },
+	{ "flush_txgs",			KSTAT_DATA_UINT64 },
+	{ "flush_ns",			KSTAT_DATA_UINT64 },
+	{ "lookups",			KSTAT_DATA_UINT64 },
+	{ "lookup_log_hits",		KSTAT_DATA_UINT64 },
+	{ "lookup_ns",			KSTAT_DATA_UINT64 },
+};
+
+#define	DDLS_STAT_INCR(stat, val) \
+	atomic_add_64(&ddt_log_stats.stat.value.ui64, (val))
+#define	DDLS_STAT_BUMP(stat) \
+	DDLS_STAT_INCR(stat, 1)
+
+static kstat_t *ddt_log_ksp;
+static kmem_cache_t *ddt_log_entry_cache;
+
+void
+ddt_log_init(void)
+{
+	ddt_log_entry_cache = kmem_cache_create("ddt_log_entry_cache",
+	    sizeof (ddt_log_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+
+	ddt_log_ksp = kstat_create("zfs", 0, "ddt_log", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (ddt_log_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (ddt_log_ksp != NULL) {
+		ddt_log_ksp->ks_data = &ddt_log_stats;
+		kstat_install(ddt_log_ksp);
+	}
+}
+
+void
+ddt_log_fini(void)
+{
+	if (ddt_log_ksp != NULL) {
+		kstat_delete(ddt_log_ksp);
+		ddt_log_ksp = NULL;
+	}
+
+	kmem_cache_destroy(ddt_log_entry_cache);
+}
+
+static int
+ddt_log_compare(const void *x1, const void *x2)
+{
+	const ddt_log_entry_t *dle1 = x1;
+	const ddt_log_entry_t *dle2 = x2;
+	const uint64_t *u1 = (const uint64_t *)&dle1->dle_key;
+	const uint64_t *u2 = (const uint64_t *)&dle2->dle_key;
+	int i;
+
+	for (i = 0; i < DDT_KEY_WORDS; i++) {
+		if (u1[i] < u2[i])
+			return (-1);
+		if (u1[i] > u2[i])
+			return (1);
+	}
+
+	return (0);
+}
+
+void
+ddt_log_alloc(ddt_t *ddt)
+{
+	for (int i = 0; i < 2; i++) {
+		avl_create(&ddt->ddt_log[i].ddl_tree, ddt_log_compare,
+		    sizeof (ddt_log_entry_t),
+		    offsetof(ddt_log_entry_t, dle_node));
+	}
+	ddt->ddt_log_active = &ddt->ddt_log[0];
+	ddt->ddt_log_flushing = &ddt->ddt_log[1];
+}
+
+void
+ddt_log_free(ddt_t *ddt)
+{
+	ASSERT3P(ddt->ddt_log_buf, ==, NULL);
+
+	for (int i = 0; i < 2; i++) {
+		ddt_log_t *ddl = &ddt->ddt_log[i];
+		ddt_log_entry_t *dle;
+		void *cookie = NULL;
+
+		DDLS_STAT_INCR(ddls_entries, -avl_numnodes(&ddl->ddl_tree));
+		DDLS_STAT_INCR(ddls_bytes, -ddl->ddl_length);
+		while ((dle = avl_destroy_nodes(&ddl->ddl_tree,
+		    &cookie)) != NULL)
+			kmem_cache_free(ddt_log_entry_cache, dle);
+		avl_destroy(&ddl->ddl_tree);
+	}
+}
+
+boolean_t
+ddt_log_enabled(ddt_t *ddt)
+{
+	return (ddt->ddt_log_active->ddl_object != 0);
+}
+
+/*
+ * True if neither log holds any entries, in memory or on disk.
+ */
+boolean_t
+ddt_log_empty(ddt_t *ddt)
+{
+	for (int i = 0; i < 2; i++) {
+		if (avl_numnodes(&ddt->ddt_log[i].ddl_tree) != 0 ||
+		    ddt->ddt_log[i].ddl_length != 0)
+			return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+static uint64_t
+ddt_log_mem(void)
+{
+	return (ddt_log_stats.ddls_entries.value.ui64 *
+	    sizeof (ddt_log_entry_t));
+}
+
+static void
+ddt_log_name(ddt_t *ddt, char *name)
+{
+	(void) snprintf(name, DDT_NAMELEN, DMU_POOL_DDT_LOG,
+	    zio_checksum_table[ddt->ddt_checksum].ci_name);
+}
+
+static ddt_log_entry_t *
+ddt_log_find(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	ddt_log_entry_t search, *dle;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	search.dle_key = *ddk;
+	dle = avl_find(&ddt->ddt_log_active->ddl_tree, &search, NULL);
+	if (dle == NULL)
+		dle = avl_find(&ddt->ddt_log_flushing->ddl_tree, &search, NULL);
+	return (dle);
+}
+
+/*
+ * Apply one record of a log being read back in to that log's tree.
+ */
+static void
+ddt_log_replay_record(ddt_t *ddt, ddt_log_t *ddl, const ddt_log_record_t *dlr)
+{
+	ddt_log_t *fddl = ddt->ddt_log_flushing;
+	ddt_log_entry_t search, *dle;
+	avl_index_t where;
+
+	search.dle_key = dlr->dlr_key;
+	dle = avl_find(&ddl->ddl_tree, &search, &where);
+	if (dle == NULL) {
+		if (ddl != fddl &&
+		    (dle = avl_find(&fddl->ddl_tree, &search, NULL)) != NULL) {
+			avl_remove(&fddl->ddl_tree, dle);
+		} else {
+			dle = kmem_cache_alloc(ddt_log_entry_cache, KM_SLEEP);
+			dle->dle_key = dlr->dlr_key;
+			DDLS_STAT_BUMP(ddls_entries);
+		}
+		avl_insert(&ddl->ddl_tree, dle, where);
+	}
+	bcopy(dlr->dlr_phys, dle->dle_phys, sizeof (dle->dle_phys));
+	dle->dle_class = DLR_GET_CLASS(dlr);
+	dle->dle_zap_class = DLR_GET_ZAP_CLASS(dlr);
+}
+
+static int
+ddt_log_replay(ddt_t *ddt, ddt_log_t *ddl)
+{
+	ddt_log_record_t *buf;
+	uint64_t off, len;
+	int error = 0;
+
+	if (ddl->ddl_length % sizeof (ddt_log_record_t) != 0)
+		return (SET_ERROR(EINVAL));
+
+	buf = vmem_alloc(DDT_LOG_BUF_RECS * sizeof (ddt_log_record_t),
+	    KM_SLEEP);
+	for (off = 0; off < ddl->ddl_length; off += len) {
+		len = MIN(ddl->ddl_length - off,
+		    DDT_LOG_BUF_RECS * sizeof (ddt_log_record_t));
+		error = dmu_read(ddt->ddt_os, ddl->ddl_object, off, len, buf,
+		    DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+		for (int i = 0; i < len / sizeof (ddt_log_record_t); i++)
+			ddt_log_replay_record(ddt, ddl, &buf[i]);
+	}
+	vmem_free(buf, DDT_LOG_BUF_RECS * sizeof (ddt_log_record_t));
+
+	return (error);
+}
+
+int
+ddt_log_load(ddt_t *ddt)
+{
+	ddt_log_phys_t dlp[2];
+	char name[DDT_NAMELEN];
+	int error;
+
+	ddt_log_name(ddt, name);
+	error = zap_lookup(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), DDT_LOG_PHYS_WORDS, dlp);
+	if (error == ENOENT)
+		return (0);
+	if (error != 0)
+		return (error);
+
+	for (int i = 0; i < 2; i++) {
+		ddt->ddt_log[i].ddl_object = dlp[i].dlp_object;
+		ddt->ddt_log[i].ddl_length = dlp[i].dlp_length;
+		ddt->ddt_log[i].ddl_first_txg = dlp[i].dlp_first_txg;
+		DDLS_STAT_INCR(ddls_bytes, dlp[i].dlp_length);
+	}
+	ddt->ddt_log_active = &ddt->ddt_log[0];
+	ddt->ddt_log_flushing = &ddt->ddt_log[1];
+
+	error = ddt_log_replay(ddt, ddt->ddt_log_flushing);
+	if (error == 0)
+		error = ddt_log_replay(ddt, ddt->ddt_log_active);
+
+	ddt->ddt_log_flushing->ddl_flush_rate = howmany(
+	    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree),
+	    MAX(zfs_dedup_log_flush_txgs, 1));
+
+	return (error);
+}
+
+/*
+ * Create the logs of a DDT the first time it syncs with the dedup_log
+ * feature enabled.  The ZAPs already hold every entry.
+ */
+void
+ddt_log_activate(ddt_t *ddt, dmu_tx_t *tx)
+{
+	spa_t *spa = ddt->ddt_spa;
+
+	ASSERT(!ddt_log_enabled(ddt));
+	ASSERT(spa_feature_is_enabled(spa, SPA_FEATURE_DEDUP_LOG));
+
+	for (int i = 0; i < 2; i++) {
+		ddt->ddt_log[i].ddl_object = dmu_object_alloc(ddt->ddt_os,
+		    DMU_OTN_UINT64_METADATA, DDT_LOG_BLKSZ, DMU_OT_NONE, 0, tx);
+	}
+	ddt->ddt_log_dirty = B_TRUE;
+
+	if (!spa_feature_is_active(spa, SPA_FEATURE_DEDUP_LOG))
+		spa_feature_incr(spa, SPA_FEATURE_DEDUP_LOG, tx);
+}
+
+static void
+ddt_log_write(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+	uint64_t size = ddt->ddt_log_nrecs * sizeof (ddt_log_record_t);
+
+	if (size == 0)
+		return;
+
+	if (ddl->ddl_length == 0)
+		ddl->ddl_first_txg = dmu_tx_get_txg(tx);
+	dmu_write(ddt->ddt_os, ddl->ddl_object, ddl->ddl_length, size,
+	    ddt->ddt_log_buf, tx);
+	ddl->ddl_length += size;
+	ddt->ddt_log_dirty = B_TRUE;
+
+	DDLS_STAT_INCR(ddls_bytes, size);
+	DDLS_STAT_INCR(ddls_records_written, ddt->ddt_log_nrecs);
+	ddt->ddt_log_nrecs = 0;
+}
+
+/*
+ * Log the new state of dde, which belongs to class from now on (or has
+ * been removed, if class is DDT_CLASSES).  zap_class is the class the
+ * ZAPs hold the entry in, for entries that are not already logged.
+ */
+void
+ddt_log_entry(ddt_t *ddt, ddt_entry_t *dde, enum ddt_class zap_class,
+    enum ddt_class class, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+	ddt_log_t *fddl = ddt->ddt_log_flushing;
+	ddt_log_entry_t search, *dle;
+	ddt_log_record_t *dlr;
+	avl_index_t where;
+
+	ASSERT(ddt_log_enabled(ddt));
+
+	search.dle_key = dde->dde_key;
+
+	ddt_enter(ddt);
+	dle = avl_find(&ddl->ddl_tree, &search, &where);
+	if (dle == NULL) {
+		dle = avl_find(&fddl->ddl_tree, &search, NULL);
+		if (dle != NULL) {
+			avl_remove(&fddl->ddl_tree, dle);
+		} else if (zap_class == DDT_CLASSES && class == DDT_CLASSES) {
+			/* An entry that never made it to the ZAPs or logs. */
+			ddt_exit(ddt);
+			return;
+		} else {
+			dle = kmem_cache_alloc(ddt_log_entry_cache, KM_SLEEP);
+			dle->dle_key = dde->dde_key;
+			dle->dle_zap_class = zap_class;
+			DDLS_STAT_BUMP(ddls_entries);
+		}
+		avl_insert(&ddl->ddl_tree, dle, where);
+	}
+	bcopy(dde->dde_phys, dle->dle_phys, sizeof (dle->dle_phys));
+	dle->dle_class = class;
+	ddt_exit(ddt);
+
+	if (ddt->ddt_log_buf == NULL) {
+		ddt->ddt_log_buf = vmem_alloc(DDT_LOG_BUF_RECS *
+		    sizeof (ddt_log_record_t), KM_SLEEP);
+	}
+	dlr = &ddt->ddt_log_buf[ddt->ddt_log_nrecs++];
+	dlr->dlr_key = dle->dle_key;
+	bcopy(dle->dle_phys, dlr->dlr_phys, sizeof (dlr->dlr_phys));
+	dlr->dlr_info = 0;
+	DLR_SET_CLASS(dlr, dle->dle_class);
+	DLR_SET_ZAP_CLASS(dlr, dle->dle_zap_class);
+
+	if (ddt->ddt_log_nrecs == DDT_LOG_BUF_RECS)
+		ddt_log_write(ddt, tx);
+}
+
+/*
+ * Write out the records logged by ddt_log_entry() that are still buffered.
+ */
+void
+ddt_log_commit(ddt_t *ddt, dmu_tx_t *tx)
+{
+	if (ddt->ddt_log_buf == NULL)
+		return;
+
+	ddt_log_write(ddt, tx);
+	vmem_free(ddt->ddt_log_buf, DDT_LOG_BUF_RECS *
+	    sizeof (ddt_log_record_t));
+	ddt->ddt_log_buf = NULL;
+}
+
+/*
+ * Write one logged entry back to the ZAPs.  There is only one DDT type.
+ */
+static void
+ddt_log_flush_entry(ddt_t *ddt, ddt_log_entry_t *dle, ddt_entry_t *dde,
+    dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = ddt->ddt_spa->spa_dsl_pool;
+	enum ddt_type type = DDT_TYPE_CURRENT;
+	enum ddt_class class = dle->dle_class;
+	enum ddt_class zap_class = dle->dle_zap_class;
+	int error;
+
+	dde->dde_key = dle->dle_key;
+	bcopy(dle->dle_phys, dde->dde_phys, sizeof (dde->dde_phys));
+
+	if (zap_class != DDT_CLASSES && zap_class != class &&
+	    ddt_object_exists(ddt, type, zap_class)) {
+		error = ddt_object_remove(ddt, type, zap_class, dde, tx);
+		VERIFY(error == 0 || error == ENOENT);
+	}
+
+	if (class != DDT_CLASSES) {
+		if (!ddt_object_exists(ddt, type, class))
+			ddt_object_create(ddt, type, class, tx);
+		VERIFY0(ddt_object_update(ddt, type, class, dde, tx));
+
+		/*
+		 * A walk of the ZAPs sees the entry in its new class from
+		 * now on, and ddt_class_contains() stops the scan from
+		 * traversing it, so scan it now as ddt_sync_entry() does.
+		 */
+		if (class < zap_class) {
+			dde->dde_type = type;
+			dde->dde_class = class;
+			dsl_scan_ddt_entry(dp->dp_scan, ddt->ddt_checksum,
+			    dde, tx);
+		}
+	}
+}
+
+static boolean_t
+ddt_log_swap_needed(ddt_t *ddt, uint64_t txg)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+
+	if (avl_numnodes(&ddl->ddl_tree) == 0)
+		return (B_FALSE);
+
+	return (txg >= ddl->ddl_first_txg + zfs_dedup_log_txg_max ||
+	    ddt_log_mem() > zfs_dedup_log_mem_max);
+}
+
+/*
+ * Flush the next batch of the flushing log to the ZAPs.  Once it has been
+ * flushed entirely, truncate it, and make the active log the flushing log
+ * when it is due.  Called in the first pass of every txg; returns B_TRUE
+ * if there was anything to do.
+ */
+boolean_t
+ddt_log_flush(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_flushing;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	ddt_log_entry_t *dle;
+	ddt_entry_t *dde;
+	uint64_t count, flushed = 0;
+	hrtime_t start;
+	boolean_t truncated = B_FALSE;
+
+	if (!ddt_log_enabled(ddt))
+		return (B_FALSE);
+
+	if (avl_numnodes(&ddl->ddl_tree) == 0) {
+		if (ddl->ddl_length != 0) {
+			VERIFY0(dmu_free_range(ddt->ddt_os, ddl->ddl_object,
+			    0, DMU_OBJECT_END, tx));
+			DDLS_STAT_INCR(ddls_bytes, -ddl->ddl_length);
+			ddl->ddl_length = 0;
+			ddl->ddl_first_txg = 0;
+			ddt->ddt_log_dirty = B_TRUE;
+			truncated = B_TRUE;
+		}
+
+		if (!ddt_log_swap_needed(ddt, txg))
+			return (truncated);
+
+		ddt_enter(ddt);
+		ddt->ddt_log_flushing = ddt->ddt_log_active;
+		ddt->ddt_log_active = ddl;
+		ddt_exit(ddt);
+		ddt->ddt_log_dirty = B_TRUE;
+
+		ddl = ddt->ddt_log_flushing;
+		ddl->ddl_flush_rate = howmany(avl_numnodes(&ddl->ddl_tree),
+		    MAX(zfs_dedup_log_flush_txgs, 1));
+	}
+
+	count = MAX(ddl->ddl_flush_rate, zfs_dedup_log_flush_entries_min);
+	if (ddt_log_mem() > zfs_dedup_log_mem_max)
+		count = MAX(count, zfs_dedup_log_flush_entries_max);
+
+	start = gethrtime();
+	dde = kmem_zalloc(sizeof (ddt_entry_t), KM_SLEEP);
+	while (flushed < count &&
+	    (dle = avl_first(&ddl->ddl_tree)) != NULL) {
+		ddt_log_flush_entry(ddt, dle, dde, tx);
+
+		ddt_enter(ddt);
+		avl_remove(&ddl->ddl_tree, dle);
+		ddt_exit(ddt);
+		kmem_cache_free(ddt_log_entry_cache, dle);
+		flushed++;
+	}
+	kmem_free(dde, sizeof (ddt_entry_t));
+
+	ddt->ddt_log_flushed += flushed;
+	ddt->ddt_log_flush_txgs++;
+
+	DDLS_STAT_INCR(ddls_entries, -flushed);
+	DDLS_STAT_INCR(ddls_entries_flushed, flushed);
+	DDLS_STAT_BUMP(ddls_flush_txgs);
+	DDLS_STAT_INCR(ddls_flush_ns, gethrtime() - start);
+
+	return (B_TRUE);
+}
+
+/*
+ * Record where the logs are in the MOS directory, if that has changed.
+ */
+void
+ddt_log_sync(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_phys_t dlp[2];
+	char name[DDT_NAMELEN];
+
+	if (!ddt->ddt_log_dirty)
+		return;
+
+	ASSERT(ddt_log_enabled(ddt));
+
+	dlp[0].dlp_object = ddt->ddt_log_active->ddl_object;
+	dlp[0].dlp_length = ddt->ddt_log_active->ddl_length;
+	dlp[0].dlp_first_txg = ddt->ddt_log_active->ddl_first_txg;
+	dlp[1].dlp_object = ddt->ddt_log_flushing->ddl_object;
+	dlp[1].dlp_length = ddt->ddt_log_flushing->ddl_length;
+	dlp[1].dlp_first_txg = ddt->ddt_log_flushing->ddl_first_txg;
+
+	ddt_log_name(ddt, name);
+	VERIFY0(zap_update(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), DDT_LOG_PHYS_WORDS, dlp, tx));
+	ddt->ddt_log_dirty = B_FALSE;
+}
+
+/*
+ * Look dde up in the logs.  Returns 0 and fills in dde if the logs hold
+ * it, ENOENT if they record that it was removed, and ESRCH if the ZAPs
+ * have to be searched instead.
+ */
+int
+ddt_log_lookup(ddt_t *ddt, ddt_entry_t *dde)
+{
+	ddt_log_entry_t *dle;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	dle = ddt_log_find(ddt, &dde->dde_key);
+	if (dle == NULL)
+		return (SET_ERROR(ESRCH));
+
+	if (dle->dle_class == DDT_CLASSES) {
+		dde->dde_type = DDT_TYPES;
+		dde->dde_class = DDT_CLASSES;
+		return (SET_ERROR(ENOENT));
+	}
+
+	bcopy(dle->dle_phys, dde->dde_phys, sizeof (dde->dde_phys));
+	dde->dde_type = DDT_TYPE_CURRENT;
+	dde->dde_class = dle->dle_class;
+	return (0);
+}
+
+/*
+ * True if the logs supersede the copy of dde found in the ZAP of class:
+ * the entry has since been removed or moved to another class.  Otherwise
+ * dde is refreshed with the logged copy of the entry, if there is one.
+ */
+boolean_t
+ddt_log_hides(ddt_t *ddt, ddt_entry_t *dde, enum ddt_class class)
+{
+	ddt_log_entry_t *dle;
+	boolean_t hidden = B_FALSE;
+
+	ddt_enter(ddt);
+	dle = ddt_log_find(ddt, &dde->dde_key);
+	if (dle != NULL) {
+		if (dle->dle_class != class)
+			hidden = B_TRUE;
+		else
+			bcopy(dle->dle_phys, dde->dde_phys,
+			    sizeof (dde->dde_phys));
+	}
+	ddt_exit(ddt);
+
+	return (hidden);
+}
+
+static ddt_log_entry_t *
+ddt_log_next(avl_tree_t *t, const ddt_key_t *ddk)
+{
+	ddt_log_entry_t search, *dle;
+	avl_index_t where;
+
+	if (ddk == NULL)
+		return (avl_first(t));
+
+	search.dle_key = *ddk;
+	dle = avl_find(t, &search, &where);
+	if (dle != NULL)
+		return (AVL_NEXT(t, dle));
+	return (avl_nearest(t, where, AVL_AFTER));
+}
+
+/*
+ * Walk the logged entries that a walk of the ZAPs does not see, because
+ * the logs add them to a class the ZAPs do not hold them in.  Returns in
+ * dde the first such entry after dde's key, or the first of all if first
+ * is set, and ENOENT once there are none left.
+ */
+int
+ddt_log_walk(ddt_t *ddt, ddt_entry_t *dde, boolean_t first)
+{
+	ddt_log_entry_t *dle, *adle, *fdle;
+	ddt_key_t key = dde->dde_key;
+	const ddt_key_t *ddk = first ? NULL : &key;
+	int error = ENOENT;
+
+	ddt_enter(ddt);
+	for (;;) {
+		adle = ddt_log_next(&ddt->ddt_log_active->ddl_tree, ddk);
+		fdle = ddt_log_next(&ddt->ddt_log_flushing->ddl_tree, ddk);
+		if (adle == NULL)
+			dle = fdle;
+		else if (fdle == NULL)
+			dle = adle;
+		else
+			dle = ddt_log_compare(adle, fdle) < 0 ? adle : fdle;
+		if (dle == NULL)
+			break;
+
+		if (dle->dle_class != DDT_CLASSES &&
+		    dle->dle_class != dle->dle_zap_class) {
+			dde->dde_key = dle->dle_key;
+			bcopy(dle->dle_phys, dde->dde_phys,
+			    sizeof (dde->dde_phys));
+			dde->dde_type = DDT_TYPE_CURRENT;
+			dde->dde_class = dle->dle_class;
+			error = 0;
+			break;
+		}
+
+		key = dle->dle_key;
+		ddk = &key;
+	}
+	ddt_exit(ddt);
+
+	return (error);
+}
+
+/*
+ * Account for a ddt_lookup() that had to load its entry, from the logs
+ * if log_hit is set or from the ZAPs otherwise, starting at start.
+ */
+void
+ddt_log_lookup_done(ddt_t *ddt, boolean_t log_hit, hrtime_t start)
+{
+	hrtime_t delta = gethrtime() - start;
+
+	atomic_inc_64(&ddt->ddt_lookups);
+	atomic_add_64(&ddt->ddt_lookup_time, delta);
+
+	DDLS_STAT_BUMP(ddls_lookups);
+	DDLS_STAT_INCR(ddls_lookup_ns, delta);
+	if (log_hit)
+		DDLS_STAT_BUMP(ddls_lookup_log_hits);
+}
+
+void
+ddt_get_dedup_log_stats(spa_t *spa, ddt_log_stat_t *ddls)
+{
+	enum zio_checksum c;
+
+	bzero(ddls, sizeof (ddt_log_stat_t));
+
+	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		uint64_t n;
+
+		ddt_enter(ddt);
+		n = avl_numnodes(&ddt->ddt_log[0].ddl_tree) +
+		    avl_numnodes(&ddt->ddt_log[1].ddl_tree);
+		ddt_exit(ddt);
+
+		ddls->ddls_entries += n;
+		ddls->ddls_mspace += n * sizeof (ddt_log_entry_t);
+		ddls->ddls_dspace += ddt->ddt_log[0].ddl_length +
+		    ddt->ddt_log[1].ddl_length;
+		ddls->ddls_flushed += ddt->ddt_log_flushed;
+		ddls->ddls_flush_txgs += ddt->ddt_log_flush_txgs;
+		ddls->ddls_lookups += ddt->ddt_lookups;
+		ddls->ddls_lookup_time += ddt->ddt_lookup_time;
+	}
+}
@@ -31,53 +31,143 @@
 #include <sys/zap.h>
 #include <sys/zfeature.h>
 
+/*
+ * Each CPU allocates object numbers from a chunk of its own of
+ * 2^dmu_object_alloc_chunk_shift dnodes, and only takes os_obj_lock to
+ * get a new chunk.  The chunk is at least one dnode block, so that CPUs
+ * do not contend on the same dbuf, and at most one L1 block's worth of
+ * dnodes, so that the backfill scan below still happens.
+ */
+int dmu_object_alloc_chunk_shift = 7;
+
+/*
+ * A CPU's chunk is kept in a single word, so that an object number can be
+ * claimed from it with one atomic add: the next object number in the low
+ * DN_MAX_OBJECT_SHIFT bits, and the number of object numbers left in the
+ * chunk above them.  The add bumps the first and decrements the second;
+ * claiming from an empty chunk wraps the count around to a value no chunk
+ * can hold, which is how the claimer knows it overran.
+ */
+#define	OBJ_CHUNK(next, left)	(((uint64_t)(left) << DN_MAX_OBJECT_SHIFT) | \
+	(next))
+#define	OBJ_CHUNK_NEXT(oc)	((oc) & (DN_MAX_OBJECT - 1))
+#define	OBJ_CHUNK_LEFT(oc)	((oc) >> DN_MAX_OBJECT_SHIFT)
+#define	OBJ_CHUNK_CLAIM		OBJ_CHUNK(1, -1ULL)
+#define	OBJ_CHUNK_MAX		\
+	(DNODES_PER_BLOCK << (DN_MAX_INDBLKSHIFT - SPA_BLKPTRSHIFT))
+
+/*
+ * Give this CPU a new chunk of object numbers, unless another thread on
+ * it already has since the caller found its chunk empty.
+ *
+ * Each time we polish off a L1 bp worth of dnodes (2^12 objects), move
+ * to another L1 bp that's still reasonably sparse (at most 1/4 full).
+ * Look from the beginning at most once per txg, but after that keep
+ * looking from here.  os_scan_dnodes is set during txg sync if enough
+ * objects have been freed since the previous rescan to justify
+ * backfilling again.  If we can't find a suitable block, just keep going
+ * from here.  The scan is done by the first CPU to reach the L1 boundary,
+ * without os_obj_lock, so other CPUs keep taking chunks meanwhile; a hole
+ * they have since been given chunks in is ignored.
+ *
+ * Note that dmu_traverse depends on the behavior that we use multiple
+ * blocks of the dnode object before going back to reuse objects.  Any
+ * change to this algorithm should preserve that property or find another
+ * solution to the issues described in traverse_visitbp.
+ */
+static void
+dmu_object_alloc_chunk(objset_t *os, uint64_t *cpuobj,
+    uint64_t dnodes_per_chunk, uint64_t L1_dnode_count)
+{
+	uint64_t object, left, offset;
+	boolean_t rescan;
+	int error;
+
+	mutex_enter(&os->os_obj_lock);
+
+	left = OBJ_CHUNK_LEFT(*cpuobj);
+	if (left != 0 && left <= OBJ_CHUNK_MAX) {
+		mutex_exit(&os->os_obj_lock);
+		return;
+	}
+
+	object = os->os_obj_next_chunk;
+	if (P2PHASE(object, L1_dnode_count) == 0 && !os->os_obj_scanning) {
+		os->os_obj_scanning = B_TRUE;
+		rescan = os->os_rescan_dnodes;
+		os->os_rescan_dnodes = B_FALSE;
+		mutex_exit(&os->os_obj_lock);
+
+		offset = rescan ? 0 : object << DNODE_SHIFT;
+		error = dnode_next_offset(DMU_META_DNODE(os),
+		    DNODE_FIND_HOLE, &offset, 2, DNODES_PER_BLOCK >> 2, 0);
+
+		mutex_enter(&os->os_obj_lock);
+		os->os_obj_scanning = B_FALSE;
+		if (error == 0 && ((offset >> DNODE_SHIFT) < object ||
+		    (offset >> DNODE_SHIFT) >= os->os_obj_next_chunk))
+			os->os_obj_next_chunk = offset >> DNODE_SHIFT;
+
+		/* Another thread may have refilled this CPU meanwhile. */
+		left = OBJ_CHUNK_LEFT(*cpuobj);
+		if (left != 0 && left <= OBJ_CHUNK_MAX) {
+			mutex_exit(&os->os_obj_lock);
+			return;
+		}
+	}
+
+	/*
+	 * After a backfill the chunk may start part way into an aligned
+	 * chunk; it still ends where that one does.
+	 */
+	object = os->os_obj_next_chunk;
+	os->os_obj_next_chunk = P2ALIGN(object, dnodes_per_chunk) +
+	    dnodes_per_chunk;
+	(void) atomic_swap_64(cpuobj,
+	    OBJ_CHUNK(object, os->os_obj_next_chunk - object));
+
+	mutex_exit(&os->os_obj_lock);
+}
+
 uint64_t
 dmu_object_alloc(objset_t *os, dmu_object_type_t ot, int blocksize,
     dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx)
 {
-	uint64_t object;
+	uint64_t object, next, oc;
 	uint64_t L1_dnode_count = DNODES_PER_BLOCK <<
 	    (DMU_META_DNODE(os)->dn_indblkshift - SPA_BLKPTRSHIFT);
+	uint64_t dnodes_per_chunk = 1ULL << dmu_object_alloc_chunk_shift;
+	uint64_t *cpuobj;
 	dnode_t *dn = NULL;
 
-	mutex_enter(&os->os_obj_lock);
+	kpreempt_disable();
+	cpuobj = &os->os_obj_next_percpu[CPU_SEQID %
+	    os->os_obj_next_percpu_len];
+	kpreempt_enable();
+
+	dnodes_per_chunk = MIN(MAX(dnodes_per_chunk, DNODES_PER_BLOCK),
+	    L1_dnode_count);
+
 	for (;;) {
-		object = os->os_obj_next;
 		/*
-		 * Each time we polish off a L1 bp worth of dnodes (2^12
-		 * objects), move to another L1 bp that's still reasonably
-		 * sparse (at most 1/4 full). Look from the beginning at most
-		 * once per txg, but after that keep looking from here.
-		 * os_scan_dnodes is set during txg sync if enough objects
-		 * have been freed since the previous rescan to justify
-		 * backfilling again. If we can't find a suitable block, just
-		 * keep going from here.
-		 *
-		 * Note that dmu_traverse depends on the behavior that we use
-		 * multiple blocks of the dnode object before going back to
-		 * reuse objects.  Any change to this algorithm should preserve
-		 * that property or find another solution to the issues
-		 * described in traverse_visitbp.
+		 * Claim the next object number of this CPU's chunk.  If the
+		 * chunk had none left, get a new one and try again.
 		 */
-
-		if (P2PHASE(object, L1_dnode_count) == 0) {
-			uint64_t offset;
-			int error;
-			if (os->os_rescan_dnodes) {
-				offset = 0;
-				os->os_rescan_dnodes = B_FALSE;
-			} else {
-				offset = object << DNODE_SHIFT;
-			}
-			error = dnode_next_offset(DMU_META_DNODE(os),
-			    DNODE_FIND_HOLE,
-			    &offset, 2, DNODES_PER_BLOCK >> 2, 0);
-			if (error == 0)
-				object = offset >> DNODE_SHIFT;
+		oc = atomic_add_64_nv(cpuobj, OBJ_CHUNK_CLAIM);
+		if (OBJ_CHUNK_LEFT(oc) >= OBJ_CHUNK_MAX) {
+			dmu_object_alloc_chunk(os, cpuobj, dnodes_per_chunk,
+			    L1_dnode_count);
+			continue;
 		}
-		os->os_obj_next = ++object;
+		object = OBJ_CHUNK_NEXT(oc) - 1;
 
 		/*
+		 * An object number is only handed out once per chunk, but a
+		 * backfilled chunk may cover objects allocated since the scan,
+		 * or objects of a chunk still held by another CPU.  A free
+		 * dnode can only be held by one DNODE_MUST_BE_FREE caller at
+		 * a time, so those races are settled here.
+		 *
 		 * XXX We should check for an i/o error here and return
 		 * up to our caller.  Actually we should pre-read it in
 		 * dmu_tx_assign(), but there is currently no mechanism
@@ -88,13 +178,24 @@ dmu_object_alloc(objset_t *os, dmu_object_type_t ot, int blocksize,
 		if (dn)
 			break;
 
-		if (dmu_object_next(os, &object, B_TRUE, 0) == 0)
-			os->os_obj_next = object - 1;
+		/*
+		 * Skip to the next hole if it is still in this chunk, or
+		 * else give the rest of the chunk up.  Either is only done
+		 * if no other thread on this CPU has claimed from the chunk
+		 * since; if one has, it will run into the same dnodes.
+		 */
+		next = object;
+		if (dmu_object_next(os, &next, B_TRUE, 0) == 0 &&
+		    next - OBJ_CHUNK_NEXT(oc) < OBJ_CHUNK_LEFT(oc)) {
+			(void) atomic_cas_64(cpuobj, oc, OBJ_CHUNK(next,
+			    OBJ_CHUNK_LEFT(oc) - (next - OBJ_CHUNK_NEXT(oc))));
+		} else {
+			(void) atomic_cas_64(cpuobj, oc,
+			    OBJ_CHUNK(OBJ_CHUNK_NEXT(oc), 0));
+		}
 	}
 
 	dnode_allocate(dn, ot, blocksize, 0, bonustype, bonuslen, tx);
-	mutex_exit(&os->os_obj_lock);
-
 	dmu_tx_add_new_object(tx, dn);
 	dnode_rele(dn, FTAG);
 
@@ -44,6 +44,7 @@
 #include <sys/zfs_ioctl.h>
 #include <sys/zap.h>
 #include <sys/zio_checksum.h>
+#include <sys/zio_compress.h>
 #include <sys/zfs_znode.h>
 #include <zfs_fletcher.h>
 #include <sys/avl.h>
@@ -61,6 +62,10 @@
 int zfs_send_corrupt_data = B_FALSE;
 int zfs_send_queue_length = 16 * 1024 * 1024;
 int zfs_recv_queue_length = 16 * 1024 * 1024;
+/* Number of threads that traverse and read a dataset being sent */
+int zfs_send_workers = 4;
+/* Number of dnode blocks each of those threads handles at a time */
+uint64_t zfs_send_worker_range = 4;
 /* Set this tunable to FALSE to disable setting of DRR_FLAG_FREERECORDS */
 uint64_t zfs_send_set_freerecords_bit = B_TRUE;
 
@@ -81,17 +86,74 @@ struct send_thread_arg {
 	int		error_code;
 	boolean_t	cancel;
 	zbookmark_phys_t resume;
+	uint64_t	featureflags;	/* Stream features, to read ahead */
+	uint64_t	range;		/* First range this thread handles */
+	uint64_t	nranges;	/* Ranges in the whole send */
+	uint64_t	range_skip;	/* Ranges between this thread's ones */
+	uint64_t	range_size;	/* Dnode blocks per range, 0 for all */
+	uint64_t	range_start;	/* Current range, in dnode blocks */
+	uint64_t	range_end;	/* 0 if the current range is the last */
 };
 
 struct send_block_record {
-	boolean_t		eos_marker; /* Marks the end of the stream */
+	boolean_t		eos_marker; /* Marks the end of the range */
 	blkptr_t		bp;
 	zbookmark_phys_t	zb;
 	uint8_t			indblkshift;
 	uint16_t		datablkszsec;
+	arc_buf_t		*abuf; /* Block data, if already read */
 	bqueue_node_t		ln;
 };
 
+typedef struct send_stats {
+	kstat_named_t	ss_streams;
+	kstat_named_t	ss_bytes;
+	kstat_named_t	ss_time_ns;
+	kstat_named_t	ss_ranges;
+	kstat_named_t	ss_blocks_read_ahead;
+	kstat_named_t	ss_queue_empty_stalls;
+	kstat_named_t	ss_queue_full_stalls;
+} send_stats_t;
+
+static send_stats_t send_stats = {
+	{ "streams",			KSTAT_DATA_UINT64 },
+	{ "bytes",			KSTAT_DATA_UINT64 },
+	{ "time_ns",			KSTAT_DATA_UINT64 },
+	{ "ranges",			KSTAT_DATA_UINT64 },
+	{ "blocks_read_ahead",		KSTAT_DATA_UINT64 },
+	{ "queue_empty_stalls",		KSTAT_DATA_UINT64 },
+	{ "queue_full_stalls",		KSTAT_DATA_UINT64 },
+};
+
+#define	SS_STAT_INCR(stat, val) \
+	atomic_add_64(&send_stats.stat.value.ui64, (val))
+#define	SS_STAT_BUMP(stat) \
+	SS_STAT_INCR(stat, 1)
+
+static kstat_t *send_ksp;
+
+void
+dmu_send_init(void)
+{
+	send_ksp = kstat_create("zfs", 0, "dmu_send", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (send_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (send_ksp != NULL) {
+		send_ksp->ks_data = &send_stats;
+		kstat_install(send_ksp);
+	}
+}
+
+void
+dmu_send_fini(void)
+{
+	if (send_ksp != NULL) {
+		kstat_delete(send_ksp);
+		send_ksp = NULL;
+	}
+}
+
 static int
 dump_bytes(dmu_sendarg_t *dsp, void *buf, int len)
 {
@@ -122,6 +184,7 @@ dump_bytes(dmu_sendarg_t *dsp, void *buf, int len)
 	mutex_enter(&ds->ds_sendstream_lock);
 	*dsp->dsa_off += len;
 	mutex_exit(&ds->ds_sendstream_lock);
+	SS_STAT_INCR(ss_bytes, len);
 
 	return (dsp->dsa_err);
 }
@@ -595,6 +658,9 @@ backup_do_embed(dmu_sendarg_t *dsp, const blkptr_t *bp)
 	if ((BP_GET_COMPRESS(bp) >= ZIO_COMPRESS_LEGACY_FUNCTIONS &&
 	    !(dsp->dsa_featureflags & DMU_BACKUP_FEATURE_LZ4)))
 		return (B_FALSE);
+	if (ZIO_COMPRESS_IS_ZSTD(BP_GET_COMPRESS(bp)) &&
+	    !(dsp->dsa_featureflags & DMU_BACKUP_FEATURE_ZSTD))
+		return (B_FALSE);
 
 	/*
 	 * Embed type must be explicitly enabled.
@@ -610,6 +676,93 @@ backup_do_embed(dmu_sendarg_t *dsp, const blkptr_t *bp)
 	return (B_FALSE);
 }
 
+/*
+ * Return the flags do_dump() reads a level-0 block of a regular object with.
+ * The send threads read blocks ahead with the same flags, so that do_dump()
+ * can use their buffers as they are.
+ */
+static enum zio_flag
+send_data_read_flags(uint64_t featureflags, const blkptr_t *bp, int blksz)
+{
+	boolean_t split_large_blocks = blksz > SPA_OLD_MAXBLOCKSIZE &&
+	    !(featureflags & DMU_BACKUP_FEATURE_LARGE_BLOCKS);
+
+	/*
+	 * Raw sends require that we always get raw data as it exists
+	 * on disk.
+	 */
+	if (featureflags & DMU_BACKUP_FEATURE_RAW)
+		return (ZIO_FLAG_RAW);
+
+	/*
+	 * We should only request compressed data from the ARC if all
+	 * the following are true:
+	 *  - stream compression was requested
+	 *  - we aren't splitting large blocks into smaller chunks
+	 *  - the data won't need to be byteswapped before sending
+	 *  - this isn't an embedded block
+	 *  - this isn't metadata (if receiving on a different endian
+	 *    system it can be byteswapped more easily)
+	 */
+	if ((featureflags & DMU_BACKUP_FEATURE_COMPRESSED) &&
+	    !split_large_blocks && !BP_SHOULD_BYTESWAP(bp) &&
+	    !BP_IS_EMBEDDED(bp) && !DMU_OT_IS_METADATA(BP_GET_TYPE(bp)))
+		return (ZIO_FLAG_RAW_COMPRESS);
+
+	return (0);
+}
+
+/*
+ * Read the block of a record that do_dump() is going to need, so that the
+ * main thread only has to write it out.  The buffer is tagged with the
+ * record's abuf field, like the one send_read() reads.
+ */
+static void
+send_read_ahead(struct send_thread_arg *sta, struct send_block_record *data)
+{
+	const blkptr_t *bp = &data->bp;
+	const zbookmark_phys_t *zb = &data->zb;
+	spa_t *spa = sta->ds->ds_dir->dd_pool->dp_spa;
+	dmu_object_type_t type = BP_GET_TYPE(bp);
+	arc_flags_t aflags = ARC_FLAG_WAIT;
+	enum zio_flag zioflags = ZIO_FLAG_CANFAIL;
+
+	if (BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp) || zb->zb_level > 0 ||
+	    type == DMU_OT_OBJSET || (zb->zb_object != DMU_META_DNODE_OBJECT &&
+	    DMU_OBJECT_IS_SPECIAL(zb->zb_object)))
+		return;
+
+	if (type == DMU_OT_DNODE || type == DMU_OT_SA) {
+		if (sta->featureflags & DMU_BACKUP_FEATURE_RAW)
+			zioflags |= ZIO_FLAG_RAW;
+	} else {
+		zioflags |= send_data_read_flags(sta->featureflags, bp,
+		    data->datablkszsec << SPA_MINBLOCKSHIFT);
+	}
+
+	/* On failure do_dump() reads it again and handles the error. */
+	if (arc_read(NULL, spa, bp, arc_getbuf_func, &data->abuf,
+	    ZIO_PRIORITY_ASYNC_READ, zioflags, &aflags, zb) == 0)
+		SS_STAT_BUMP(ss_blocks_read_ahead);
+}
+
+/*
+ * Return the dnode block that the subtree of the block at zb starts in.
+ * Records are ordered by it, which is what lets the send threads split the
+ * dataset into ranges of dnode blocks.
+ */
+static uint64_t
+send_range_key(const zbookmark_phys_t *zb, uint8_t indblkshift)
+{
+	if (zb->zb_object == DMU_META_DNODE_OBJECT) {
+		return (zb->zb_blkid <<
+		    (zb->zb_level * (indblkshift - SPA_BLKPTRSHIFT)));
+	}
+	if (DMU_OBJECT_IS_SPECIAL(zb->zb_object))
+		return (UINT64_MAX);
+	return (zb->zb_object >> DNODES_PER_BLOCK_SHIFT);
+}
+
 /*
  * This is the callback function to traverse_dataset that acts as the worker
  * thread for dmu_send_impl.
@@ -622,6 +775,7 @@ send_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	struct send_thread_arg *sta = arg;
 	struct send_block_record *record;
 	uint64_t record_size;
+	uint64_t key;
 	int err = 0;
 
 	ASSERT(zb->zb_object == DMU_META_DNODE_OBJECT ||
@@ -638,6 +792,17 @@ send_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 		return (0);
 	}
 
+	/*
+	 * The traversal starts at the beginning of the range, but still
+	 * visits the indirect blocks above it; those belong to an earlier
+	 * range.  Stop once the traversal leaves the range.
+	 */
+	key = send_range_key(zb, dnp->dn_indblkshift);
+	if (key < sta->range_start)
+		return (0);
+	if (sta->range_end != 0 && key >= sta->range_end)
+		return (SET_ERROR(EINTR));
+
 	record = kmem_zalloc(sizeof (struct send_block_record), KM_SLEEP);
 	record->eos_marker = B_FALSE;
 	record->bp = *bp;
@@ -645,38 +810,94 @@ send_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	record->indblkshift = dnp->dn_indblkshift;
 	record->datablkszsec = dnp->dn_datablkszsec;
 	record_size = dnp->dn_datablkszsec << SPA_MINBLOCKSHIFT;
+	send_read_ahead(sta, record);
+
+	/* An unlocked peek, like bqueue_empty(); only used for the kstat. */
+	if (sta->q.bq_size + record_size > sta->q.bq_maxsize)
+		SS_STAT_BUMP(ss_queue_full_stalls);
 	bqueue_enqueue(&sta->q, record, record_size);
 
 	return (err);
 }
 
 /*
- * This function kicks off the traverse_dataset.  It also handles setting the
- * error code of the thread in case something goes wrong, and pushes the End of
- * Stream record when the traverse_dataset call has finished.  If there is no
- * dataset to traverse, the thread immediately pushes End of Stream marker.
+ * This function kicks off the traverse_dataset for each of the thread's
+ * ranges.  It also handles setting the error code of the thread in case
+ * something goes wrong, and pushes an end of range marker when each
+ * traverse_dataset call has finished.  If there is no dataset to traverse,
+ * the thread immediately pushes the markers.
  */
 static void
 send_traverse_thread(void *arg)
 {
 	struct send_thread_arg *st_arg = arg;
+	uint64_t nranges = st_arg->nranges;
+	uint64_t range_skip = st_arg->range_skip;
 	int err;
 	struct send_block_record *data;
+	uint64_t r;
+
+	/*
+	 * st_arg is freed once the last end of range marker is consumed, so
+	 * the loop condition must only use the copies taken above.
+	 */
+	for (r = st_arg->range; r < nranges; r += range_skip) {
+		st_arg->range_start = r * st_arg->range_size;
+		st_arg->range_end = (r + 1 < nranges) ?
+		    st_arg->range_start + st_arg->range_size : 0;
 
-	if (st_arg->ds != NULL) {
-		err = traverse_dataset_resume(st_arg->ds,
-		    st_arg->fromtxg, &st_arg->resume,
-		    st_arg->flags, send_cb, st_arg);
+		if (st_arg->ds != NULL && !st_arg->cancel) {
+			/*
+			 * A single range keeps the bookmark it was started
+			 * with, which is where a resumed send picks up.
+			 */
+			if (nranges > 1) {
+				bzero(&st_arg->resume, sizeof (st_arg->resume));
+				if (st_arg->range_start != 0) {
+					SET_BOOKMARK(&st_arg->resume,
+					    st_arg->ds->ds_object,
+					    DMU_META_DNODE_OBJECT, 0,
+					    st_arg->range_start);
+				}
+			}
+
+			err = traverse_dataset_resume(st_arg->ds,
+			    st_arg->fromtxg, &st_arg->resume,
+			    st_arg->flags, send_cb, st_arg);
 
-		if (err != EINTR)
-			st_arg->error_code = err;
+			if (err != 0 && err != EINTR)
+				st_arg->error_code = err;
+		}
+		data = kmem_zalloc(sizeof (*data), KM_SLEEP);
+		data->eos_marker = B_TRUE;
+		bqueue_enqueue(&st_arg->q, data, 1);
 	}
-	data = kmem_zalloc(sizeof (*data), KM_SLEEP);
-	data->eos_marker = B_TRUE;
-	bqueue_enqueue(&st_arg->q, data, 1);
 	thread_exit();
 }
 
+/*
+ * Make the block of data available in data->abuf, reading it unless one of
+ * the send threads already has.
+ */
+static int
+send_read(spa_t *spa, struct send_block_record *data, enum zio_flag zioflags)
+{
+	arc_flags_t aflags = ARC_FLAG_WAIT;
+
+	if (data->abuf != NULL)
+		return (0);
+
+	return (arc_read(NULL, spa, &data->bp, arc_getbuf_func, &data->abuf,
+	    ZIO_PRIORITY_ASYNC_READ, zioflags, &aflags, &data->zb));
+}
+
+static void
+send_read_done(struct send_block_record *data)
+{
+	arc_buf_destroy(data->abuf, &data->abuf);
+	data->abuf = NULL;
+}
+
 /*
  * This function actually handles figuring out what kind of record needs to be
  * dumped, reading the data (which has hopefully been prefetched), and calling
@@ -729,7 +950,6 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 	} else if (type == DMU_OT_DNODE) {
 		dnode_phys_t *blk;
 		int epb = BP_GET_LSIZE(bp) >> DNODE_SHIFT;
-		arc_flags_t aflags = ARC_FLAG_WAIT;
 		arc_buf_t *abuf;
 		enum zio_flag zioflags = ZIO_FLAG_CANFAIL;
 		int i;
@@ -742,10 +962,10 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 
 		ASSERT0(zb->zb_level);
 
-		if (arc_read(NULL, spa, bp, arc_getbuf_func, &abuf,
-		    ZIO_PRIORITY_ASYNC_READ, zioflags, &aflags, zb) != 0)
+		if (send_read(spa, data, zioflags) != 0)
 			return (SET_ERROR(EIO));
 
+		abuf = data->abuf;
 		blk = abuf->b_data;
 		dnobj = zb->zb_blkid * epb;
 
@@ -767,10 +987,8 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 					break;
 			}
 		}
-		arc_buf_destroy(abuf, &abuf);
+		send_read_done(data);
 	} else if (type == DMU_OT_SA) {
-		arc_flags_t aflags = ARC_FLAG_WAIT;
-		arc_buf_t *abuf;
 		enum zio_flag zioflags = ZIO_FLAG_CANFAIL;
 
 		if (dsa->dsa_featureflags & DMU_BACKUP_FEATURE_RAW) {
@@ -778,12 +996,11 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 			zioflags |= ZIO_FLAG_RAW;
 		}
 
-		if (arc_read(NULL, spa, bp, arc_getbuf_func, &abuf,
-		    ZIO_PRIORITY_ASYNC_READ, zioflags, &aflags, zb) != 0)
+		if (send_read(spa, data, zioflags) != 0)
 			return (SET_ERROR(EIO));
 
-		err = dump_spill(dsa, bp, zb->zb_object, abuf->b_data);
-		arc_buf_destroy(abuf, &abuf);
+		err = dump_spill(dsa, bp, zb->zb_object, data->abuf->b_data);
+		send_read_done(data);
 	} else if (backup_do_embed(dsa, bp)) {
 		/* it's an embedded level-0 block of a regular object */
 		int blksz = dblkszsec << SPA_MINBLOCKSHIFT;
@@ -792,7 +1009,6 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 		    zb->zb_blkid * blksz, blksz, bp);
 	} else {
 		/* it's a level-0 block of a regular object */
-		arc_flags_t aflags = ARC_FLAG_WAIT;
 		arc_buf_t *abuf;
 		int blksz = dblkszsec << SPA_MINBLOCKSHIFT;
 		uint64_t offset;
@@ -813,21 +1029,6 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 		boolean_t request_raw =
 		    (dsa->dsa_featureflags & DMU_BACKUP_FEATURE_RAW) != 0;
 
-		/*
-		 * We should only request compressed data from the ARC if all
-		 * the following are true:
-		 *  - stream compression was requested
-		 *  - we aren't splitting large blocks into smaller chunks
-		 *  - the data won't need to be byteswapped before sending
-		 *  - this isn't an embedded block
-		 *  - this isn't metadata (if receiving on a different endian
-		 *    system it can be byteswapped more easily)
-		 */
-		boolean_t request_compressed =
-		    (dsa->dsa_featureflags & DMU_BACKUP_FEATURE_COMPRESSED) &&
-		    !split_large_blocks && !BP_SHOULD_BYTESWAP(bp) &&
-		    !BP_IS_EMBEDDED(bp) && !DMU_OT_IS_METADATA(BP_GET_TYPE(bp));
-
 		IMPLY(request_raw, !split_large_blocks);
 		IMPLY(request_raw, BP_IS_PROTECTED(bp));
 		ASSERT0(zb->zb_level);
@@ -835,17 +1036,15 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 		    (zb->zb_object == dsa->dsa_resume_object &&
 		    zb->zb_blkid * blksz >= dsa->dsa_resume_offset));
 
-		if (request_raw)
-			zioflags |= ZIO_FLAG_RAW;
-		else if (request_compressed)
-			zioflags |= ZIO_FLAG_RAW_COMPRESS;
+		zioflags |= send_data_read_flags(dsa->dsa_featureflags, bp,
+		    blksz);
 
-		if (arc_read(NULL, spa, bp, arc_getbuf_func, &abuf,
-		    ZIO_PRIORITY_ASYNC_READ, zioflags, &aflags, zb) != 0) {
+		if (send_read(spa, data, zioflags) != 0) {
 			if (zfs_send_corrupt_data) {
 				/* Send a block filled with 0x"zfs badd bloc" */
-				abuf = arc_alloc_buf(spa, &abuf, ARC_BUFC_DATA,
-				    blksz);
+				data->abuf = arc_alloc_buf(spa, &data->abuf,
+				    ARC_BUFC_DATA, blksz);
+				abuf = data->abuf;
 				uint64_t *ptr;
 				for (ptr = abuf->b_data;
 				    (char *)ptr < (char *)abuf->b_data + blksz;
@@ -856,6 +1055,7 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 			}
 		}
 
+		abuf = data->abuf;
 		offset = zb->zb_blkid * blksz;
 
 		if (split_large_blocks) {
@@ -875,7 +1075,7 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 			err = dump_write(dsa, type, zb->zb_object, offset,
 			    blksz, arc_buf_size(abuf), bp, abuf->b_data);
 		}
-		arc_buf_destroy(abuf, &abuf);
+		send_read_done(data);
 	}
 
 	ASSERT(err == 0 || err == EINTR);
@@ -883,13 +1083,30 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 }
 
 /*
- * Pop the new data off the queue, and free the old data.
+ * Free a record, along with any block a send thread read for it that
+ * do_dump() did not consume.
+ */
+static void
+send_record_free(struct send_block_record *data)
+{
+	if (data->abuf != NULL)
+		send_read_done(data);
+	kmem_free(data, sizeof (*data));
+}
+
+/*
+ * Pop the new data off the queue, and free the old data, if any.
  */
 static struct send_block_record *
 get_next_record(bqueue_t *bq, struct send_block_record *data)
 {
-	struct send_block_record *tmp = bqueue_dequeue(bq);
-	kmem_free(data, sizeof (*data));
+	struct send_block_record *tmp;
+
+	if (bqueue_empty(bq))
+		SS_STAT_BUMP(ss_queue_empty_stalls);
+	tmp = bqueue_dequeue(bq);
+	if (data != NULL)
+		send_record_free(data);
 	return (tmp);
 }
 
@@ -913,7 +1130,14 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	uint64_t featureflags = 0;
 	void *payload = NULL;
 	size_t payload_len = 0;
-	struct send_thread_arg to_arg = { { { 0 } } };
+	zbookmark_phys_t resume = { 0 };
+	struct send_thread_arg *to_args;
+	int nworkers = 1;
+	uint64_t nranges = 1;
+	uint64_t range_size = 0;
+	hrtime_t start = gethrtime();
+	uint64_t r;
+	int w;
 
 	err = dmu_objset_from_ds(to_ds, &os);
 	if (err != 0) {
@@ -983,6 +1207,17 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 		featureflags |= DMU_BACKUP_FEATURE_LZ4;
 	}
 
+	/*
+	 * zstd blocks are only sent as they are on disk when the stream is
+	 * compressed, raw or embeds data; the receiver must support zstd.
+	 */
+	if ((featureflags &
+	    (DMU_BACKUP_FEATURE_EMBED_DATA | DMU_BACKUP_FEATURE_COMPRESSED |
+	    DMU_BACKUP_FEATURE_RAW)) != 0 &&
+	    to_ds->ds_feature_inuse[SPA_FEATURE_ZSTD_COMPRESS]) {
+		featureflags |= DMU_BACKUP_FEATURE_ZSTD;
+	}
+
 	if (resumeobj != 0 || resumeoff != 0) {
 		featureflags |= DMU_BACKUP_FEATURE_RESUMING;
 	}
@@ -1047,7 +1282,7 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 				goto out;
 			}
 
-			SET_BOOKMARK(&to_arg.resume, to_ds->ds_object,
+			SET_BOOKMARK(&resume, to_ds->ds_object,
 			    resumeobj, 0,
 			    resumeoff / to_doi.doi_data_block_size);
 
@@ -1080,40 +1315,79 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 		goto out;
 	}
 
-	err = bqueue_init(&to_arg.q, zfs_send_queue_length,
-	    offsetof(struct send_block_record, ln));
-	to_arg.error_code = 0;
-	to_arg.cancel = B_FALSE;
-	to_arg.ds = to_ds;
-	to_arg.fromtxg = fromtxg;
-	to_arg.flags = TRAVERSE_PRE | TRAVERSE_PREFETCH;
-	if (rawok)
-		to_arg.flags |= TRAVERSE_NO_DECRYPT;
-	(void) thread_create(NULL, 0, send_traverse_thread, &to_arg, 0, curproc,
-	    TS_RUN, minclsyspri);
+	/*
+	 * Split the dnode blocks into ranges and hand them out round-robin
+	 * to the send threads, each of which traverses and reads its ranges
+	 * in order into a queue of its own.  Consuming the ranges in order
+	 * produces the same stream as a single thread would.  A resumed send
+	 * only has the one range that starts at its bookmark.
+	 */
+	if (zfs_send_workers > 1 && zfs_send_worker_range > 0 &&
+	    !(featureflags & DMU_BACKUP_FEATURE_RESUMING)) {
+		range_size = zfs_send_worker_range;
+		nranges = (DMU_META_DNODE(os)->dn_maxblkid + range_size) /
+		    range_size;
+		nworkers = (int)MIN(zfs_send_workers, nranges);
+	}
+	SS_STAT_BUMP(ss_streams);
+	SS_STAT_INCR(ss_ranges, nranges);
+
+	to_args = kmem_zalloc(nworkers * sizeof (*to_args), KM_SLEEP);
+	for (w = 0; w < nworkers; w++) {
+		struct send_thread_arg *to_arg = &to_args[w];
+
+		(void) bqueue_init(&to_arg->q, zfs_send_queue_length,
+		    offsetof(struct send_block_record, ln));
+		to_arg->error_code = 0;
+		to_arg->cancel = B_FALSE;
+		to_arg->ds = to_ds;
+		to_arg->fromtxg = fromtxg;
+		to_arg->flags = TRAVERSE_PRE | TRAVERSE_PREFETCH;
+		if (rawok)
+			to_arg->flags |= TRAVERSE_NO_DECRYPT;
+		to_arg->resume = resume;
+		to_arg->featureflags = featureflags;
+		to_arg->range = w;
+		to_arg->nranges = nranges;
+		to_arg->range_skip = nworkers;
+		to_arg->range_size = range_size;
+		(void) thread_create(NULL, 0, send_traverse_thread, to_arg, 0,
+		    curproc, TS_RUN, minclsyspri);
+	}
+
+	for (r = 0; r < nranges; r++) {
+		struct send_thread_arg *to_arg = &to_args[r % nworkers];
+		struct send_block_record *to_data;
+
+		to_data = get_next_record(&to_arg->q, NULL);
+		while (!to_data->eos_marker && err == 0) {
+			err = do_dump(dsp, to_data);
+			to_data = get_next_record(&to_arg->q, to_data);
+			if (issig(JUSTLOOKING) && issig(FORREAL))
+				err = EINTR;
+		}
 
-	struct send_block_record *to_data;
-	to_data = bqueue_dequeue(&to_arg.q);
+		if (err == 0 && to_arg->error_code != 0)
+			err = to_arg->error_code;
 
-	while (!to_data->eos_marker && err == 0) {
-		err = do_dump(dsp, to_data);
-		to_data = get_next_record(&to_arg.q, to_data);
-		if (issig(JUSTLOOKING) && issig(FORREAL))
-			err = EINTR;
-	}
-
-	if (err != 0) {
-		to_arg.cancel = B_TRUE;
-		while (!to_data->eos_marker) {
-			to_data = get_next_record(&to_arg.q, to_data);
+		/*
+		 * Once something has failed, let every thread wind down
+		 * and drain what is left of each range.
+		 */
+		if (err != 0) {
+			for (w = 0; w < nworkers; w++)
+				to_args[w].cancel = B_TRUE;
+			while (!to_data->eos_marker) {
+				to_data = get_next_record(&to_arg->q,
+				    to_data);
+			}
 		}
+		send_record_free(to_data);
 	}
-	kmem_free(to_data, sizeof (*to_data));
 
-	bqueue_destroy(&to_arg.q);
-
-	if (err == 0 && to_arg.error_code != 0)
-		err = to_arg.error_code;
+	for (w = 0; w < nworkers; w++)
+		bqueue_destroy(&to_args[w].q);
+	kmem_free(to_args, nworkers * sizeof (*to_args));
 
 	if (err != 0)
 		goto out;
@@ -1135,6 +1409,7 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 
 	if (dump_record(dsp, NULL, 0) != 0)
 		err = dsp->dsa_err;
+	SS_STAT_INCR(ss_time_ns, gethrtime() - start);
 out:
 	mutex_enter(&to_ds->ds_sendstream_lock);
 	list_remove(&to_ds->ds_sendstreams, dsp);
@@ -1602,6 +1877,9 @@ dmu_recv_begin_check(void *arg, dmu_tx_t *tx)
 	if ((featureflags & DMU_BACKUP_FEATURE_LZ4) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LZ4_COMPRESS))
 		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_ZSTD) &&
+	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ZSTD_COMPRESS))
+		return (SET_ERROR(ENOTSUP));
 
 	/*
 	 * The receiving code doesn't know how to translate large blocks
@@ -1884,6 +2162,9 @@ dmu_recv_resume_begin_check(void *arg, dmu_tx_t *tx)
 	if ((featureflags & DMU_BACKUP_FEATURE_LZ4) &&
 	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_LZ4_COMPRESS))
 		return (SET_ERROR(ENOTSUP));
+	if ((featureflags & DMU_BACKUP_FEATURE_ZSTD) &&
+	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ZSTD_COMPRESS))
+		return (SET_ERROR(ENOTSUP));
 
 	/* 6 extra bytes for /%recv */
 	char recvname[ZFS_MAX_DATASET_NAME_LEN + 6];
@@ -49,21 +49,65 @@ uint32_t	zfetch_max_streams = 8;
 uint32_t	zfetch_min_sec_reap = 2;
 /* max bytes to prefetch per stream (default 8MB) */
 uint32_t	zfetch_max_distance = 8 * 1024 * 1024;
+/* initial and min bytes to prefetch per stream (default 1MB) */
+uint32_t	zfetch_min_distance = 1024 * 1024;
 /* max bytes to prefetch indirects for per stream (default 64MB) */
 uint32_t	zfetch_max_idistance = 64 * 1024 * 1024;
 /* max number of bytes in an array_read in which we allow prefetching (1MB) */
 uint64_t	zfetch_array_rd_sz = 1024 * 1024;
 
+/*
+ * Each stream follows one of three access patterns: forward sequential,
+ * reverse sequential (e.g. a backward index walk) or constant stride
+ * (fixed size accesses a fixed number of blocks apart, e.g. one column
+ * of a columnar file).  A new stream remembers the access that created
+ * it; the next access decides the pattern.  Forward and reverse streams
+ * start prefetching on that second access, stride streams only once a
+ * third access confirms the stride, so that random reads which happen
+ * to land near each other do not trigger prefetch.
+ *
+ * The prefetch distance of a stream adapts between zfetch_min_distance
+ * and zfetch_max_distance.  It doubles whenever the reader hits a
+ * stream whose prefetch window is already at the limit, and halves
+ * whenever prefetched blocks are skipped over by the reader.  Blocks
+ * still outstanding when a stream is reclaimed also count as wasted.
+ * The per-pattern "hits" and "misses" kstats count prefetched blocks
+ * that were later read and prefetched blocks that were wasted.
+ *
+ * When all streams of a file are in use, a new access recycles the
+ * least recently used stream that never got a hit, so that a burst of
+ * random reads cannot keep many interleaved sequential readers of one
+ * file from getting streams of their own.
+ */
+
 typedef struct zfetch_stats {
 	kstat_named_t zfetchstat_hits;
 	kstat_named_t zfetchstat_misses;
 	kstat_named_t zfetchstat_max_streams;
+	kstat_named_t zfetchstat_recycled;
+	kstat_named_t zfetchstat_forward_hits;
+	kstat_named_t zfetchstat_forward_misses;
+	kstat_named_t zfetchstat_reverse_hits;
+	kstat_named_t zfetchstat_reverse_misses;
+	kstat_named_t zfetchstat_stride_hits;
+	kstat_named_t zfetchstat_stride_misses;
+	kstat_named_t zfetchstat_dist_grows;
+	kstat_named_t zfetchstat_dist_shrinks;
 } zfetch_stats_t;
 
 static zfetch_stats_t zfetch_stats = {
 	{ "hits",			KSTAT_DATA_UINT64 },
 	{ "misses",			KSTAT_DATA_UINT64 },
 	{ "max_streams",		KSTAT_DATA_UINT64 },
+	{ "recycled",			KSTAT_DATA_UINT64 },
+	{ "forward_hits",		KSTAT_DATA_UINT64 },
+	{ "forward_misses",		KSTAT_DATA_UINT64 },
+	{ "reverse_hits",		KSTAT_DATA_UINT64 },
+	{ "reverse_misses",		KSTAT_DATA_UINT64 },
+	{ "stride_hits",		KSTAT_DATA_UINT64 },
+	{ "stride_misses",		KSTAT_DATA_UINT64 },
+	{ "dist_grows",			KSTAT_DATA_UINT64 },
+	{ "dist_shrinks",		KSTAT_DATA_UINT64 },
 };
 
 #define	ZFETCHSTAT_BUMP(stat) \
@@ -93,6 +137,111 @@ zfetch_fini(void)
 	}
 }
 
+/*
+ * Account "nblks" prefetched blocks of a stream following "pattern" as
+ * either read by the consumer (hit) or discarded unread (miss).
+ */
+static void
+dmu_zfetch_stat_pattern(zfetch_pattern_t pattern, boolean_t hit,
+    uint64_t nblks)
+{
+	kstat_named_t *ksn;
+
+	if (nblks == 0)
+		return;
+
+	switch (pattern) {
+	case ZFETCH_PATTERN_FORWARD:
+		ksn = hit ? &zfetch_stats.zfetchstat_forward_hits :
+		    &zfetch_stats.zfetchstat_forward_misses;
+		break;
+	case ZFETCH_PATTERN_REVERSE:
+		ksn = hit ? &zfetch_stats.zfetchstat_reverse_hits :
+		    &zfetch_stats.zfetchstat_reverse_misses;
+		break;
+	case ZFETCH_PATTERN_STRIDE:
+		ksn = hit ? &zfetch_stats.zfetchstat_stride_hits :
+		    &zfetch_stats.zfetchstat_stride_misses;
+		break;
+	default:
+		return;
+	}
+
+	atomic_add_64(&ksn->value.ui64, nblks);
+}
+
+/*
+ * Limits on the data prefetch distance of a stream, in blocks.
+ */
+static uint64_t
+dmu_zfetch_dist_max(zfetch_t *zf)
+{
+	return (MAX(1, zfetch_max_distance >> zf->zf_dnode->dn_datablkshift));
+}
+
+static uint64_t
+dmu_zfetch_dist_min(zfetch_t *zf)
+{
+	return (MAX(1, MIN(zfetch_min_distance, zfetch_max_distance) >>
+	    zf->zf_dnode->dn_datablkshift));
+}
+
+/*
+ * The reader consumed prefetched data while the stream was already
+ * prefetching as far ahead as it may; let it go further.
+ */
+static void
+dmu_zfetch_dist_grow(zfetch_t *zf, zstream_t *zs)
+{
+	uint64_t max = dmu_zfetch_dist_max(zf);
+
+	ASSERT(MUTEX_HELD(&zs->zs_lock));
+	if (zs->zs_dist < max) {
+		zs->zs_dist = MIN(zs->zs_dist * 2, max);
+		ZFETCHSTAT_BUMP(zfetchstat_dist_grows);
+	}
+}
+
+/*
+ * The reader skipped over prefetched data; prefetch less far ahead.
+ */
+static void
+dmu_zfetch_dist_shrink(zfetch_t *zf, zstream_t *zs)
+{
+	uint64_t min = dmu_zfetch_dist_min(zf);
+
+	ASSERT(MUTEX_HELD(&zs->zs_lock));
+	if (zs->zs_dist > min) {
+		zs->zs_dist = MAX(zs->zs_dist / 2, min);
+		ZFETCHSTAT_BUMP(zfetchstat_dist_shrinks);
+	}
+}
+
+/*
+ * Return the number of blocks this stream prefetched that the reader
+ * has not read yet.
+ */
+static uint64_t
+dmu_zfetch_stream_outstanding(zfetch_t *zf, zstream_t *zs)
+{
+	uint64_t end;
+	int64_t accesses;
+
+	switch (zs->zs_pattern) {
+	case ZFETCH_PATTERN_FORWARD:
+		end = MIN(zs->zs_pf_blkid, zf->zf_dnode->dn_maxblkid + 1);
+		return (end > zs->zs_blkid ? end - zs->zs_blkid : 0);
+	case ZFETCH_PATTERN_REVERSE:
+		return (zs->zs_blkid - zs->zs_pf_blkid);
+	case ZFETCH_PATTERN_STRIDE:
+		accesses = ((int64_t)zs->zs_pf_blkid - (int64_t)zs->zs_blkid) /
+		    zs->zs_stride;
+		return (accesses > 0 ? accesses * zs->zs_nblks : 0);
+	default:
+		return (0);
+	}
+}
+
 /*
  * This takes a pointer to a zfetch structure and a dnode.  It performs the
  * necessary setup for the zfetch structure, grokking data from the
@@ -116,6 +265,8 @@ static void
 dmu_zfetch_stream_remove(zfetch_t *zf, zstream_t *zs)
 {
 	ASSERT(RW_WRITE_HELD(&zf->zf_rwlock));
+	dmu_zfetch_stat_pattern(zs->zs_pattern, B_FALSE,
+	    dmu_zfetch_stream_outstanding(zf, zs));
 	list_remove(&zf->zf_stream, zs);
 	mutex_destroy(&zs->zs_lock);
 	kmem_free(zs, sizeof (*zs));
@@ -144,14 +295,15 @@ dmu_zfetch_fini(zfetch_t *zf)
 
 /*
  * If there aren't too many streams already, create a new stream.
- * The "blkid" argument is the next block that we expect this stream to access.
+ * The "blkid" and "nblks" arguments describe the access that created the
+ * stream; we expect the stream to next access the block just after it.
  * While we're here, clean up old streams (which haven't been
  * accessed for at least zfetch_min_sec_reap seconds).
  */
 static void
-dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
+dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid, uint64_t nblks)
 {
-	zstream_t *zs_next;
+	zstream_t *zs_next, *zs_lru = NULL;
 	int numstreams = 0;
 
 	ASSERT(RW_WRITE_HELD(&zf->zf_rwlock));
@@ -163,10 +315,14 @@ dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
 	    zs != NULL; zs = zs_next) {
 		zs_next = list_next(&zf->zf_stream, zs);
 		if (((gethrtime() - zs->zs_atime) / NANOSEC) >
-		    zfetch_min_sec_reap)
+		    zfetch_min_sec_reap) {
 			dmu_zfetch_stream_remove(zf, zs);
-		else
-			numstreams++;
+			continue;
+		}
+		numstreams++;
+		if (zs->zs_hits == 0 &&
+		    (zs_lru == NULL || zs->zs_atime < zs_lru->zs_atime))
+			zs_lru = zs;
 	}
 
 	/*
@@ -175,26 +331,134 @@ dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
 	 * for all the streams to be non-overlapping.
 	 *
 	 * If we are already at the maximum number of streams for this file,
-	 * even after removing old streams, then don't create this stream.
+	 * even after removing old streams, then reuse the least recently
+	 * used stream that never had a hit.  If every stream has had hits,
+	 * don't create this stream.
 	 */
 	uint32_t max_streams = MAX(1, MIN(zfetch_max_streams,
 	    zf->zf_dnode->dn_maxblkid * zf->zf_dnode->dn_datablksz /
 	    zfetch_max_distance));
 	if (numstreams >= max_streams) {
-		ZFETCHSTAT_BUMP(zfetchstat_max_streams);
-		return;
+		if (zs_lru == NULL) {
+			ZFETCHSTAT_BUMP(zfetchstat_max_streams);
+			return;
+		}
+		dmu_zfetch_stream_remove(zf, zs_lru);
+		ZFETCHSTAT_BUMP(zfetchstat_recycled);
 	}
 
 	zstream_t *zs = kmem_zalloc(sizeof (*zs), KM_SLEEP);
-	zs->zs_blkid = blkid;
-	zs->zs_pf_blkid = blkid;
-	zs->zs_ipf_blkid = blkid;
+	zs->zs_blkid = blkid + nblks;
+	zs->zs_pf_blkid = blkid + nblks;
+	zs->zs_ipf_blkid = blkid + nblks;
+	zs->zs_pattern = ZFETCH_PATTERN_NEW;
+	zs->zs_first_blkid = blkid;
+	zs->zs_nblks = nblks;
+	zs->zs_dist = dmu_zfetch_dist_min(zf);
 	zs->zs_atime = gethrtime();
 	mutex_init(&zs->zs_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	list_insert_head(&zf->zf_stream, zs);
 }
 
+/*
+ * Return B_TRUE if an access of nblks blocks at blkid is the access the
+ * stream expects next.  New streams expect a forward access; the other
+ * patterns are recognized by dmu_zfetch_stream_classify().
+ */
+static boolean_t
+dmu_zfetch_stream_match(zstream_t *zs, uint64_t blkid, uint64_t nblks)
+{
+	if (zs->zs_pattern == ZFETCH_PATTERN_REVERSE)
+		return (blkid + nblks == zs->zs_blkid);
+	return (blkid == zs->zs_blkid);
+}
+
+/*
+ * Called for an access that no stream expected.  Look for a stream the
+ * access still belongs to:
+ *
+ *  - A new stream whose creating access directly follows this one
+ *    becomes a reverse stream, and the access is its first hit.
+ *
+ *  - A stream with no hits whose creating access had the same size and
+ *    started a short distance away becomes a stride candidate.  The
+ *    access is claimed, but there is no hit until the stride repeats.
+ *
+ *  - An access landing inside the prefetched window of a forward or
+ *    reverse stream means the reader skipped over prefetched blocks.
+ *    Those are wasted, the stream's distance is reduced and the stream
+ *    resynchronizes to the access, which then counts as a hit.
+ *
+ * Returns B_TRUE if the access was claimed by a stream.  If the access
+ * is a hit, *zsp is set to that stream, with zs_lock held.
+ */
+static boolean_t
+dmu_zfetch_stream_classify(zfetch_t *zf, uint64_t blkid, uint64_t nblks,
+    zstream_t **zsp)
+{
+	uint64_t end_of_access_blkid = blkid + nblks;
+	int64_t max_stride = dmu_zfetch_dist_max(zf);
+	int64_t stride;
+
+	ASSERT(RW_LOCK_HELD(&zf->zf_rwlock));
+	*zsp = NULL;
+
+	for (zstream_t *zs = list_head(&zf->zf_stream); zs != NULL;
+	    zs = list_next(&zf->zf_stream, zs)) {
+		mutex_enter(&zs->zs_lock);
+
+		if (zs->zs_pattern == ZFETCH_PATTERN_NEW &&
+		    end_of_access_blkid == zs->zs_first_blkid) {
+			zs->zs_pattern = ZFETCH_PATTERN_REVERSE;
+			zs->zs_blkid = zs->zs_first_blkid;
+			zs->zs_pf_blkid = zs->zs_first_blkid;
+			zs->zs_ipf_blkid = zs->zs_first_blkid;
+			*zsp = zs;
+			return (B_TRUE);
+		}
+
+		stride = (int64_t)blkid - (int64_t)zs->zs_first_blkid;
+		if (zs->zs_hits == 0 && nblks == zs->zs_nblks &&
+		    ABS(stride) > (int64_t)nblks && ABS(stride) <= max_stride &&
+		    (int64_t)blkid + stride >= 0) {
+			zs->zs_pattern = ZFETCH_PATTERN_STRIDE;
+			zs->zs_stride = stride;
+			zs->zs_first_blkid = blkid;
+			zs->zs_blkid = blkid + stride;
+			zs->zs_pf_blkid = blkid + stride;
+			zs->zs_atime = gethrtime();
+			mutex_exit(&zs->zs_lock);
+			return (B_TRUE);
+		}
+
+		if (zs->zs_pattern == ZFETCH_PATTERN_FORWARD &&
+		    blkid > zs->zs_blkid && blkid < zs->zs_pf_blkid) {
+			dmu_zfetch_stat_pattern(zs->zs_pattern, B_FALSE,
+			    blkid - zs->zs_blkid);
+			dmu_zfetch_dist_shrink(zf, zs);
+			zs->zs_blkid = blkid;
+			*zsp = zs;
+			return (B_TRUE);
+		}
+
+		if (zs->zs_pattern == ZFETCH_PATTERN_REVERSE &&
+		    end_of_access_blkid < zs->zs_blkid &&
+		    end_of_access_blkid > zs->zs_pf_blkid) {
+			dmu_zfetch_stat_pattern(zs->zs_pattern, B_FALSE,
+			    zs->zs_blkid - end_of_access_blkid);
+			dmu_zfetch_dist_shrink(zf, zs);
+			zs->zs_blkid = end_of_access_blkid;
+			*zsp = zs;
+			return (B_TRUE);
+		}
+
+		mutex_exit(&zs->zs_lock);
+	}
+
+	return (B_FALSE);
+}
+
 /*
  * This is the predictive prefetch entry point.  It associates dnode access
  * specified with blkid and nblks arguments with prefetch stream, predicts
@@ -208,9 +472,10 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 {
 	zstream_t *zs;
 	int64_t pf_start, ipf_start, ipf_istart, ipf_iend;
-	int64_t pf_ahead_blks, max_blks;
-	int epbs, max_dist_blks, pf_nblks, ipf_nblks;
+	int64_t pf_ahead_blks, max_blks, pf_lead, pf_stride;
+	int epbs, pf_nblks, pf_count, ipf_nblks;
 	uint64_t end_of_access_blkid = blkid + nblks;
+	uint64_t used_blks;
 
 	if (zfs_prefetch_disable)
 		return;
@@ -226,13 +491,13 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 
 	for (zs = list_head(&zf->zf_stream); zs != NULL;
 	    zs = list_next(&zf->zf_stream, zs)) {
-		if (blkid == zs->zs_blkid) {
+		if (dmu_zfetch_stream_match(zs, blkid, nblks)) {
 			mutex_enter(&zs->zs_lock);
 			/*
 			 * zs_blkid could have changed before we
 			 * acquired zs_lock; re-check them here.
 			 */
-			if (blkid != zs->zs_blkid) {
+			if (!dmu_zfetch_stream_match(zs, blkid, nblks)) {
 				mutex_exit(&zs->zs_lock);
 				continue;
 			}
@@ -241,76 +506,195 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 	}
 
 	if (zs == NULL) {
-		/*
-		 * This access is not part of any existing stream.  Create
-		 * a new stream for it.
-		 */
-		ZFETCHSTAT_BUMP(zfetchstat_misses);
-		if (rw_tryupgrade(&zf->zf_rwlock))
-			dmu_zfetch_stream_create(zf, end_of_access_blkid);
-		rw_exit(&zf->zf_rwlock);
-		return;
+		boolean_t claimed;
+
+		claimed = dmu_zfetch_stream_classify(zf, blkid, nblks, &zs);
+		if (zs == NULL) {
+			/*
+			 * This access is not part of any existing stream.
+			 * Unless it made an existing stream a stride
+			 * candidate, create a new stream for it.
+			 */
+			ZFETCHSTAT_BUMP(zfetchstat_misses);
+			if (!claimed && rw_tryupgrade(&zf->zf_rwlock))
+				dmu_zfetch_stream_create(zf, blkid, nblks);
+			rw_exit(&zf->zf_rwlock);
+			return;
+		}
 	}
 
+	if (zs->zs_pattern == ZFETCH_PATTERN_NEW)
+		zs->zs_pattern = ZFETCH_PATTERN_FORWARD;
+	zs->zs_hits++;
+	zs->zs_dist = MIN(zs->zs_dist, dmu_zfetch_dist_max(zf));
+
 	/*
 	 * This access was to a block that we issued a prefetch for on
 	 * behalf of this stream. Issue further prefetches for this stream.
-	 *
-	 * Normally, we start prefetching where we stopped
-	 * prefetching last (zs_pf_blkid).  But when we get our first
-	 * hit on this stream, zs_pf_blkid == zs_blkid, we don't
-	 * want to prefetch the block we just accessed.  In this case,
-	 * start just after the block we just accessed.
+	 * Data prefetch is described as pf_count runs of pf_nblks blocks,
+	 * the first starting at pf_start and each following one pf_stride
+	 * blocks after the previous; indirect prefetch as the range of L1
+	 * blocks [ipf_istart, ipf_iend).
 	 */
-	pf_start = MAX(zs->zs_pf_blkid, end_of_access_blkid);
+	epbs = zf->zf_dnode->dn_indblkshift - SPA_BLKPTRSHIFT;
+	pf_count = 1;
+	pf_stride = 0;
+	ipf_istart = ipf_iend = 0;
 
-	/*
-	 * Double our amount of prefetched data, but don't let the
-	 * prefetch get further ahead than zfetch_max_distance.
-	 */
-	if (fetch_data) {
-		max_dist_blks =
-		    zfetch_max_distance >> zf->zf_dnode->dn_datablkshift;
+	switch (zs->zs_pattern) {
+	case ZFETCH_PATTERN_FORWARD:
 		/*
-		 * Previously, we were (zs_pf_blkid - blkid) ahead.  We
-		 * want to now be double that, so read that amount again,
-		 * plus the amount we are catching up by (i.e. the amount
-		 * read just now).
+		 * Normally, we start prefetching where we stopped
+		 * prefetching last (zs_pf_blkid).  But when we get our first
+		 * hit on this stream, zs_pf_blkid == zs_blkid, we don't
+		 * want to prefetch the block we just accessed.  In this case,
+		 * start just after the block we just accessed.
 		 */
-		pf_ahead_blks = zs->zs_pf_blkid - blkid + nblks;
-		max_blks = max_dist_blks - (pf_start - end_of_access_blkid);
-		pf_nblks = MIN(pf_ahead_blks, max_blks);
-	} else {
-		pf_nblks = 0;
-	}
+		pf_start = MAX(zs->zs_pf_blkid, end_of_access_blkid);
+		pf_lead = (int64_t)zs->zs_pf_blkid - (int64_t)blkid;
+		used_blks = MIN((int64_t)nblks, MAX(pf_lead, 0));
+		if (pf_lead >= (int64_t)zs->zs_dist)
+			dmu_zfetch_dist_grow(zf, zs);
 
-	zs->zs_pf_blkid = pf_start + pf_nblks;
+		/*
+		 * Double our amount of prefetched data, but don't let the
+		 * prefetch get further ahead than the stream's distance.
+		 */
+		if (fetch_data) {
+			/*
+			 * Previously, we were (zs_pf_blkid - blkid) ahead.  We
+			 * want to now be double that, so read that amount
+			 * again, plus the amount we are catching up by (i.e.
+			 * the amount read just now).
+			 */
+			pf_ahead_blks = pf_lead + nblks;
+			max_blks = (int64_t)zs->zs_dist -
+			    (pf_start - (int64_t)end_of_access_blkid);
+			pf_nblks = MAX(0, MIN(pf_ahead_blks, max_blks));
+		} else {
+			pf_nblks = 0;
+		}
 
-	/*
-	 * Do the same for indirects, starting from where we stopped last,
-	 * or where we will stop reading data blocks (and the indirects
-	 * that point to them).
-	 */
-	ipf_start = MAX(zs->zs_ipf_blkid, zs->zs_pf_blkid);
-	max_dist_blks = zfetch_max_idistance >> zf->zf_dnode->dn_datablkshift;
-	/*
-	 * We want to double our distance ahead of the data prefetch
-	 * (or reader, if we are not prefetching data).  Previously, we
-	 * were (zs_ipf_blkid - blkid) ahead.  To double that, we read
-	 * that amount again, plus the amount we are catching up by
-	 * (i.e. the amount read now + the amount of data prefetched now).
-	 */
-	pf_ahead_blks = zs->zs_ipf_blkid - blkid + nblks + pf_nblks;
-	max_blks = max_dist_blks - (ipf_start - end_of_access_blkid);
-	ipf_nblks = MIN(pf_ahead_blks, max_blks);
-	zs->zs_ipf_blkid = ipf_start + ipf_nblks;
+		zs->zs_pf_blkid = pf_start + pf_nblks;
 
-	epbs = zf->zf_dnode->dn_indblkshift - SPA_BLKPTRSHIFT;
-	ipf_istart = P2ROUNDUP(ipf_start, 1 << epbs) >> epbs;
-	ipf_iend = P2ROUNDUP(zs->zs_ipf_blkid, 1 << epbs) >> epbs;
+		/*
+		 * Do the same for indirects, starting from where we stopped
+		 * last, or where we will stop reading data blocks (and the
+		 * indirects that point to them).
+		 */
+		ipf_start = MAX(zs->zs_ipf_blkid, zs->zs_pf_blkid);
+		/*
+		 * We want to double our distance ahead of the data prefetch
+		 * (or reader, if we are not prefetching data).  Previously,
+		 * we were (zs_ipf_blkid - blkid) ahead.  To double that, we
+		 * read that amount again, plus the amount we are catching up
+		 * by (i.e. the amount read now + the amount of data
+		 * prefetched now).
+		 */
+		pf_ahead_blks = zs->zs_ipf_blkid - blkid + nblks + pf_nblks;
+		max_blks = (zfetch_max_idistance >>
+		    zf->zf_dnode->dn_datablkshift) -
+		    (ipf_start - end_of_access_blkid);
+		ipf_nblks = MAX(0, MIN(pf_ahead_blks, max_blks));
+		zs->zs_ipf_blkid = ipf_start + ipf_nblks;
+
+		ipf_istart = P2ROUNDUP(ipf_start, 1 << epbs) >> epbs;
+		ipf_iend = P2ROUNDUP(zs->zs_ipf_blkid, 1 << epbs) >> epbs;
+
+		zs->zs_blkid = end_of_access_blkid;
+		break;
+
+	case ZFETCH_PATTERN_REVERSE:
+		/*
+		 * The mirror image of the forward case: zs_blkid is the
+		 * end of this access, and data and indirects have been
+		 * prefetched down to zs_pf_blkid and zs_ipf_blkid.
+		 */
+		pf_start = MIN(zs->zs_pf_blkid, blkid);
+		pf_lead = (int64_t)zs->zs_blkid - (int64_t)zs->zs_pf_blkid;
+		used_blks = MIN((int64_t)nblks, pf_lead);
+		if (pf_lead >= (int64_t)zs->zs_dist)
+			dmu_zfetch_dist_grow(zf, zs);
+
+		if (fetch_data) {
+			pf_ahead_blks = pf_lead + nblks;
+			max_blks = (int64_t)zs->zs_dist -
+			    ((int64_t)blkid - pf_start);
+			pf_nblks = MAX(0, MIN(MIN(pf_ahead_blks, max_blks),
+			    pf_start));
+		} else {
+			pf_nblks = 0;
+		}
+
+		zs->zs_pf_blkid = pf_start - pf_nblks;
+		pf_start = zs->zs_pf_blkid;
 
+		ipf_start = MIN(zs->zs_ipf_blkid, zs->zs_pf_blkid);
+		pf_ahead_blks = zs->zs_blkid - zs->zs_ipf_blkid + nblks +
+		    pf_nblks;
+		max_blks = (zfetch_max_idistance >>
+		    zf->zf_dnode->dn_datablkshift) -
+		    ((int64_t)blkid - ipf_start);
+		ipf_nblks = MAX(0, MIN(MIN(pf_ahead_blks, max_blks),
+		    ipf_start));
+		zs->zs_ipf_blkid = ipf_start - ipf_nblks;
+
+		/*
+		 * Going down, an L1 is prefetched once the stream crosses
+		 * the last block it points to.
+		 */
+		ipf_istart = zs->zs_ipf_blkid >> epbs;
+		ipf_iend = ipf_start >> epbs;
+
+		zs->zs_blkid = blkid;
+		break;
+
+	case ZFETCH_PATTERN_STRIDE:
+	default:
+		/*
+		 * Prefetch whole accesses, continuing from the last one
+		 * prefetched (zs_pf_blkid) or the one after this access,
+		 * whichever is further along.  dbuf_prefetch() reads the
+		 * indirects each access needs, so there is no separate
+		 * indirect prefetch.  pf_lead is the number of accesses,
+		 * starting with this one, that were already prefetched.
+		 */
+		pf_stride = zs->zs_stride;
+		pf_nblks = zs->zs_nblks;
+		pf_lead = ((int64_t)zs->zs_pf_blkid - (int64_t)blkid) /
+		    pf_stride;
+		used_blks = pf_lead > 0 ? nblks : 0;
+		if (pf_lead * pf_nblks >= (int64_t)zs->zs_dist)
+			dmu_zfetch_dist_grow(zf, zs);
+
+		pf_start = (int64_t)blkid + pf_stride;
+		if (pf_start < 0) {
+			/* A negative stride ran off the start of the file. */
+			pf_count = 0;
+			break;
+		}
+		if (pf_lead > 0)
+			pf_start = zs->zs_pf_blkid;
+
+		if (fetch_data) {
+			pf_ahead_blks = MAX(pf_lead, 0) + 1;
+			max_blks = MAX(1, (int64_t)zs->zs_dist / pf_nblks) -
+			    MAX(pf_lead - 1, 0);
+			pf_count = MAX(0, MIN(pf_ahead_blks, max_blks));
+			if (pf_stride < 0)
+				pf_count = MIN(pf_count,
+				    pf_start / -pf_stride + 1);
+		} else {
+			pf_count = 0;
+		}
+
+		zs->zs_pf_blkid = pf_start + pf_count * pf_stride;
+		zs->zs_blkid = blkid + pf_stride;
+		break;
+	}
+
+	dmu_zfetch_stat_pattern(zs->zs_pattern, B_TRUE, used_blks);
 	zs->zs_atime = gethrtime();
-	zs->zs_blkid = end_of_access_blkid;
 	mutex_exit(&zs->zs_lock);
 	rw_exit(&zf->zf_rwlock);
 
@@ -320,9 +704,13 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 	 * calling it to reduce the time we hold them.
 	 */
 
-	for (int i = 0; i < pf_nblks; i++) {
-		dbuf_prefetch(zf->zf_dnode, 0, pf_start + i,
-		    ZIO_PRIORITY_ASYNC_READ, ARC_FLAG_PREDICTIVE_PREFETCH);
+	for (int c = 0; c < pf_count; c++) {
+		for (int i = 0; i < pf_nblks; i++) {
+			dbuf_prefetch(zf->zf_dnode, 0,
+			    pf_start + c * pf_stride + i,
+			    ZIO_PRIORITY_ASYNC_READ,
+			    ARC_FLAG_PREDICTIVE_PREFETCH);
+		}
 	}
 	for (int64_t iblk = ipf_istart; iblk < ipf_iend; iblk++) {
 		dbuf_prefetch(zf->zf_dnode, 1, iblk,
@@ -62,6 +62,13 @@ static void dsl_scan_cancel_sync(void *, dmu_tx_t *);
 static void dsl_scan_sync_state(dsl_scan_t *, dmu_tx_t *);
 static boolean_t dsl_scan_restarting(dsl_scan_t *, dmu_tx_t *);
 
+static void scan_ds_queue_insert(dsl_scan_t *, uint64_t, uint64_t);
+static void scan_ds_queue_remove(dsl_scan_t *, uint64_t);
+static boolean_t scan_ds_queue_contains(dsl_scan_t *, uint64_t, uint64_t *);
+static void scan_ds_queue_clear(dsl_scan_t *);
+static void scan_io_queues_run(dsl_scan_t *);
+static void scan_io_queues_destroy(dsl_scan_t *);
+
 int zfs_top_maxinflight = 32;		/* maximum I/Os per top-level */
 int zfs_resilver_delay = 2;		/* number of ticks to delay resilver */
 int zfs_scrub_delay = 4;		/* number of ticks to delay scrub */
@@ -77,6 +84,21 @@ int dsl_scan_delay_completion = B_FALSE; /* set to delay scan completion */
 /* max number of blocks to free in a single TXG */
 uint64_t zfs_free_max_blocks = 100000;
 
+/*
+ * Sorted scan tunables.  Unless zfs_scan_legacy is set, scrub and resilver
+ * reads are queued per top-level vdev and issued in offset order.
+ */
+int zfs_scan_legacy = B_FALSE;	/* issue reads in traversal order */
+uint64_t zfs_scan_vdev_limit = 4 << 20;	/* max bytes in flight per leaf */
+int zfs_scan_mem_lim_fact = 20;	/* queues may use 1/20th of memory */
+int zfs_scan_mem_lim_soft_fact = 20; /* and are drained by 1/20th of that */
+uint64_t zfs_scan_max_ext_gap = 2 << 20; /* largest gap merged in an extent */
+int zfs_scan_checkpoint_intval = 7200;	/* seconds between checkpoints */
+
+#define	SCAN_MEM_LIM_MIN	(16 << 20)	/* floor of the memory budget */
+#define	SCAN_EXT_FILL_WEIGHT	3	/* weight of density in ext score */
+#define	SCAN_GATHER_MAX		32	/* sios issued per queue lock drop */
+
 #define	DSL_SCAN_IS_SCRUB_RESILVER(scn) \
 	((scn)->scn_phys.scn_func == POOL_SCAN_SCRUB || \
 	(scn)->scn_phys.scn_func == POOL_SCAN_RESILVER)
@@ -93,6 +115,150 @@ static scan_cb_t *scan_funcs[POOL_SCAN_FUNCS] = {
 	dsl_scan_scrub_cb,	/* POOL_SCAN_RESILVER */
 };
 
+/*
+ * A dataset still to be traversed.  scn_queue holds these in core; the
+ * scn_queue_obj ZAP is only rewritten from it at a checkpoint, so that
+ * the on-disk queue always matches the on-disk bookmark.
+ */
+typedef struct scan_ds {
+	avl_node_t	sds_node;
+	uint64_t	sds_dsobj;
+	uint64_t	sds_txg;
+} scan_ds_t;
+
+/*
+ * A block queued by a sorted scan.  It sits on the queue of the top-level
+ * vdev of its first DVA, sorted by that DVA's offset.  The whole bp is
+ * kept so that the read still covers, and can repair, every copy.
+ */
+typedef struct scan_io {
+	blkptr_t		sio_bp;
+	int			sio_flags;
+	zbookmark_phys_t	sio_zb;
+
+	union {
+		avl_node_t	sio_addr_node;	/* q_sios_by_addr */
+		list_node_t	sio_list_node;	/* while being issued */
+	} sio_nodes;
+} scan_io_t;
+
+#define	SIO_GET_OFFSET(sio)	DVA_GET_OFFSET(&(sio)->sio_bp.blk_dva[0])
+#define	SIO_GET_ASIZE(sio)	DVA_GET_ASIZE(&(sio)->sio_bp.blk_dva[0])
+#define	SIO_GET_END_OFFSET(sio)	(SIO_GET_OFFSET(sio) + SIO_GET_ASIZE(sio))
+
+/*
+ * A run of queued blocks, with gaps of at most zfs_scan_max_ext_gap
+ * between them, which is issued as one mostly sequential sweep.
+ */
+typedef struct scan_ext {
+	avl_node_t	se_addr_node;	/* q_exts_by_addr */
+	avl_node_t	se_score_node;	/* q_exts_by_score */
+	uint64_t	se_start;
+	uint64_t	se_end;
+	uint64_t	se_fill;	/* bytes of queued blocks in extent */
+} scan_ext_t;
+
+struct dsl_scan_io_queue {
+	dsl_scan_t	*q_scn;
+	vdev_t		*q_vd;		/* top-level vdev, owns the lock */
+
+	avl_tree_t	q_sios_by_addr;	/* scan_io_t by offset */
+	avl_tree_t	q_exts_by_addr;	/* scan_ext_t by offset */
+	avl_tree_t	q_exts_by_score; /* scan_ext_t, best first */
+
+	uint64_t	q_maxinflight_bytes;
+	uint64_t	q_inflight_bytes;
+	kcondvar_t	q_zio_cv;	/* signalled as reads complete */
+};
+
+static int
+scan_ds_queue_compare(const void *a, const void *b)
+{
+	const scan_ds_t *sds_a = a, *sds_b = b;
+
+	if (sds_a->sds_dsobj < sds_b->sds_dsobj)
+		return (-1);
+	if (sds_a->sds_dsobj > sds_b->sds_dsobj)
+		return (1);
+	return (0);
+}
+
+static void
+scan_ds_queue_clear(dsl_scan_t *scn)
+{
+	void *cookie = NULL;
+	scan_ds_t *sds;
+
+	while ((sds = avl_destroy_nodes(&scn->scn_queue, &cookie)) != NULL)
+		kmem_free(sds, sizeof (*sds));
+}
+
+static boolean_t
+scan_ds_queue_contains(dsl_scan_t *scn, uint64_t dsobj, uint64_t *txg)
+{
+	scan_ds_t srch, *sds;
+
+	srch.sds_dsobj = dsobj;
+	sds = avl_find(&scn->scn_queue, &srch, NULL);
+	if (sds != NULL && txg != NULL)
+		*txg = sds->sds_txg;
+	return (sds != NULL);
+}
+
+static void
+scan_ds_queue_insert(dsl_scan_t *scn, uint64_t dsobj, uint64_t txg)
+{
+	scan_ds_t *sds;
+	avl_index_t where;
+
+	sds = kmem_zalloc(sizeof (*sds), KM_SLEEP);
+	sds->sds_dsobj = dsobj;
+	sds->sds_txg = txg;
+
+	VERIFY3P(avl_find(&scn->scn_queue, sds, &where), ==, NULL);
+	avl_insert(&scn->scn_queue, sds, where);
+}
+
+static void
+scan_ds_queue_remove(dsl_scan_t *scn, uint64_t dsobj)
+{
+	scan_ds_t srch, *sds;
+
+	srch.sds_dsobj = dsobj;
+	sds = avl_find(&scn->scn_queue, &srch, NULL);
+	VERIFY(sds != NULL);
+	avl_remove(&scn->scn_queue, sds);
+	kmem_free(sds, sizeof (*sds));
+}
+
+/*
+ * Replace the on-disk dataset queue with the in-core one.
+ */
+static void
+scan_ds_queue_sync(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	dmu_object_type_t ot = DMU_OT_SCAN_QUEUE;
+	scan_ds_t *sds;
+
+	ASSERT0(scn->scn_bytes_pending);
+	ASSERT(scn->scn_phys.scn_queue_obj != 0);
+
+	if (spa_version(dp->dp_spa) < SPA_VERSION_DSL_SCRUB)
+		ot = DMU_OT_ZAP_OTHER;
+
+	VERIFY0(dmu_object_free(dp->dp_meta_objset,
+	    scn->scn_phys.scn_queue_obj, tx));
+	scn->scn_phys.scn_queue_obj = zap_create(dp->dp_meta_objset, ot,
+	    DMU_OT_NONE, 0, tx);
+	for (sds = avl_first(&scn->scn_queue); sds != NULL;
+	    sds = AVL_NEXT(&scn->scn_queue, sds)) {
+		VERIFY0(zap_add_int_key(dp->dp_meta_objset,
+		    scn->scn_phys.scn_queue_obj, sds->sds_dsobj,
+		    sds->sds_txg, tx));
+	}
+}
+
 int
 dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 {
@@ -103,6 +269,8 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 
 	scn = dp->dp_scan = kmem_zalloc(sizeof (dsl_scan_t), KM_SLEEP);
 	scn->scn_dp = dp;
+	avl_create(&scn->scn_queue, scan_ds_queue_compare, sizeof (scan_ds_t),
+	    offsetof(scan_ds_t, sds_node));
 
 	/*
 	 * It's possible that we're resuming a scan after a reboot so
@@ -190,9 +358,33 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 			zfs_dbgmsg("new-style scrub was modified "
 			    "by old software; restarting in txg %llu",
 			    scn->scn_restart_txg);
+		} else if (scn->scn_phys.scn_state == DSS_SCANNING &&
+		    scn->scn_phys.scn_queue_obj != 0) {
+			zap_cursor_t *zc;
+			zap_attribute_t *za;
+
+			/* Reload the dataset queue of the last checkpoint. */
+			zc = kmem_alloc(sizeof (zap_cursor_t), KM_SLEEP);
+			za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
+			for (zap_cursor_init(zc, dp->dp_meta_objset,
+			    scn->scn_phys.scn_queue_obj);
+			    zap_cursor_retrieve(zc, za) == 0;
+			    (void) zap_cursor_advance(zc)) {
+				scan_ds_queue_insert(scn,
+				    strtonum(za->za_name, NULL),
+				    za->za_first_integer);
+			}
+			zap_cursor_fini(zc);
+			kmem_free(za, sizeof (zap_attribute_t));
+			kmem_free(zc, sizeof (zap_cursor_t));
 		}
 	}
 
+	bcopy(&scn->scn_phys, &scn->scn_phys_cached, sizeof (scn->scn_phys));
+
+	/* Everything examined up to the checkpoint has also been issued. */
+	scn->scn_issued_before_pass = scn->scn_phys.scn_examined;
+
 	spa_scan_stat_init(spa);
 	return (0);
 }
@@ -201,6 +393,14 @@ void
 dsl_scan_fini(dsl_pool_t *dp)
 {
 	if (dp->dp_scan) {
+		dsl_scan_t *scn = dp->dp_scan;
+
+		if (scn->scn_taskq != NULL)
+			taskq_destroy(scn->scn_taskq);
+		if (dp->dp_spa->spa_root_vdev != NULL)
+			scan_io_queues_destroy(scn);
+		scan_ds_queue_clear(scn);
+		avl_destroy(&scn->scn_queue);
 		kmem_free(dp->dp_scan, sizeof (dsl_scan_t));
 		dp->dp_scan = NULL;
 	}
@@ -240,6 +440,9 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 	scn->scn_phys.scn_to_examine = spa->spa_root_vdev->vdev_stat.vs_alloc;
 	scn->scn_restart_txg = 0;
 	scn->scn_done_txg = 0;
+	scn->scn_issued_before_pass = 0;
+	ASSERT(avl_is_empty(&scn->scn_queue));
+	ASSERT0(scn->scn_bytes_pending);
 	spa_scan_stat_init(spa);
 
 	if (DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
@@ -320,6 +523,7 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		    scn->scn_phys.scn_queue_obj, tx));
 		scn->scn_phys.scn_queue_obj = 0;
 	}
+	scan_ds_queue_clear(scn);
 
 	scn->scn_phys.scn_flags &= ~DSF_SCRUB_PAUSED;
 
@@ -355,6 +559,14 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		spa->spa_scrub_started = B_FALSE;
 		spa->spa_scrub_active = B_FALSE;
 
+		/* Drop whatever a cancelled sorted scan still had queued. */
+		if (scn->scn_is_sorted) {
+			scan_io_queues_destroy(scn);
+			scn->scn_is_sorted = B_FALSE;
+			scn->scn_clearing = B_FALSE;
+			scn->scn_checkpointing = B_FALSE;
+		}
+
 		/*
 		 * If the scrub/resilver completed, update all DTLs to
 		 * reflect this.  Whether it succeeded or not, vacate
@@ -454,6 +666,7 @@ dsl_scrub_pause_resume_sync(void *arg, dmu_tx_t *tx)
 		/* can't pause a scrub when there is no in-progress scrub */
 		spa->spa_scan_pass_scrub_pause = gethrestime_sec();
 		scn->scn_phys.scn_flags |= DSF_SCRUB_PAUSED;
+		scn->scn_phys_cached.scn_flags |= DSF_SCRUB_PAUSED;
 		dsl_scan_sync_state(scn, tx);
 	} else {
 		ASSERT3U(*cmd, ==, POOL_SCRUB_NORMAL);
@@ -467,6 +680,7 @@ dsl_scrub_pause_resume_sync(void *arg, dmu_tx_t *tx)
 			    gethrestime_sec() - spa->spa_scan_pass_scrub_pause;
 			spa->spa_scan_pass_scrub_pause = 0;
 			scn->scn_phys.scn_flags &= ~DSF_SCRUB_PAUSED;
+			scn->scn_phys_cached.scn_flags &= ~DSF_SCRUB_PAUSED;
 			dsl_scan_sync_state(scn, tx);
 		}
 	}
@@ -524,24 +738,104 @@ dsl_scan_ds_maxtxg(dsl_dataset_t *ds)
 	return (smt);
 }
 
+/*
+ * While a sorted scan still has reads queued, the traversal state in
+ * scn_phys is ahead of what has actually been verified, so the state of
+ * the last checkpoint is written out instead.  Once the queues are empty
+ * the current state becomes the new checkpoint.
+ */
 static void
 dsl_scan_sync_state(dsl_scan_t *scn, dmu_tx_t *tx)
 {
+	if (scn->scn_bytes_pending != 0) {
+		VERIFY0(zap_update(scn->scn_dp->dp_meta_objset,
+		    DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_SCAN, sizeof (uint64_t), SCAN_PHYS_NUMINTS,
+		    &scn->scn_phys_cached, tx));
+		return;
+	}
+
+	if (scn->scn_phys.scn_queue_obj != 0)
+		scan_ds_queue_sync(scn, tx);
 	VERIFY0(zap_update(scn->scn_dp->dp_meta_objset,
 	    DMU_POOL_DIRECTORY_OBJECT,
 	    DMU_POOL_SCAN, sizeof (uint64_t), SCAN_PHYS_NUMINTS,
 	    &scn->scn_phys, tx));
+	bcopy(&scn->scn_phys, &scn->scn_phys_cached, sizeof (scn->scn_phys));
+
+	if (scn->scn_checkpointing) {
+		zfs_dbgmsg("finished scan checkpoint in txg %llu",
+		    (longlong_t)tx->tx_txg);
+		scn->scn_checkpointing = B_FALSE;
+	}
+	scn->scn_last_checkpoint = gethrtime();
 }
 
 extern int zfs_vdev_async_write_active_min_dirty_percent;
 
+/*
+ * Returns B_TRUE once the scan has used up its share of this txg:
+ *  - we have scanned for the maximum time: an entire txg
+ *    timeout (default 5 sec)
+ *  or
+ *  - we have scanned for at least the minimum time (default 1 sec
+ *    for scrub, 3 sec for resilver), and either we have sufficient
+ *    dirty data that we are starting to write more quickly
+ *    (default 30%), or someone is explicitly waiting for this txg
+ *    to complete.
+ *  or
+ *  - the spa is shutting down because this pool is being exported
+ *    or the machine is rebooting.
+ */
 static boolean_t
-dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
+dsl_scan_txg_expired(dsl_scan_t *scn)
 {
 	uint64_t elapsed_nanosecs;
 	int mintime;
 	int dirty_pct;
 
+	mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
+	    zfs_resilver_min_time_ms : zfs_scan_min_time_ms;
+	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
+	dirty_pct = scn->scn_dp->dp_dirty_total * 100 / zfs_dirty_data_max;
+	return (elapsed_nanosecs / NANOSEC >= zfs_txg_timeout ||
+	    (NSEC2MSEC(elapsed_nanosecs) > mintime &&
+	    (txg_sync_waiting(scn->scn_dp) ||
+	    dirty_pct >= zfs_vdev_async_write_active_min_dirty_percent)) ||
+	    spa_shutting_down(scn->scn_dp->dp_spa));
+}
+
+/*
+ * The sorted scan queues may use 1/zfs_scan_mem_lim_fact of physical
+ * memory.  Once they reach that, traversal stops and the queues are
+ * drained until they are back under the soft limit, which lies
+ * 1/zfs_scan_mem_lim_soft_fact of the way below it.
+ */
+static uint64_t
+dsl_scan_mem_lim(void)
+{
+	return (MAX(physmem / MAX(zfs_scan_mem_lim_fact, 1) * PAGESIZE,
+	    SCAN_MEM_LIM_MIN));
+}
+
+static boolean_t
+dsl_scan_should_clear(dsl_scan_t *scn)
+{
+	uint64_t mlim_hard = dsl_scan_mem_lim();
+	uint64_t mlim_soft = mlim_hard -
+	    mlim_hard / MAX(zfs_scan_mem_lim_soft_fact, 1);
+	uint64_t mused = scn->scn_mem_used;
+
+	if (mused >= mlim_hard)
+		return (B_TRUE);
+	if (mused < mlim_soft)
+		return (B_FALSE);
+	return (scn->scn_clearing);
+}
+
+static boolean_t
+dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
+{
 	/* we never skip user/group accounting objects */
 	if (zb && (int64_t)zb->zb_object < 0)
 		return (B_FALSE);
@@ -557,28 +851,11 @@ dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 		return (B_FALSE);
 
 	/*
-	 * We suspend if:
-	 *  - we have scanned for the maximum time: an entire txg
-	 *    timeout (default 5 sec)
-	 *  or
-	 *  - we have scanned for at least the minimum time (default 1 sec
-	 *    for scrub, 3 sec for resilver), and either we have sufficient
-	 *    dirty data that we are starting to write more quickly
-	 *    (default 30%), or someone is explicitly waiting for this txg
-	 *    to complete.
-	 *  or
-	 *  - the spa is shutting down because this pool is being exported
-	 *    or the machine is rebooting.
+	 * A sorted scan also suspends its traversal once the queued reads
+	 * have used up their memory, so that they can be issued.
 	 */
-	mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
-	    zfs_resilver_min_time_ms : zfs_scan_min_time_ms;
-	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
-	dirty_pct = scn->scn_dp->dp_dirty_total * 100 / zfs_dirty_data_max;
-	if (elapsed_nanosecs / NANOSEC >= zfs_txg_timeout ||
-	    (NSEC2MSEC(elapsed_nanosecs) > mintime &&
-	    (txg_sync_waiting(scn->scn_dp) ||
-	    dirty_pct >= zfs_vdev_async_write_active_min_dirty_percent)) ||
-	    spa_shutting_down(scn->scn_dp->dp_spa)) {
+	if (dsl_scan_txg_expired(scn) || (scn->scn_is_sorted &&
+	    scn->scn_mem_used >= dsl_scan_mem_lim())) {
 		if (zb) {
 			dprintf("suspending at bookmark %llx/%llx/%llx/%llx\n",
 			    (longlong_t)zb->zb_objset,
@@ -971,6 +1248,44 @@ dsl_scan_visit_rootbp(dsl_scan_t *scn, dsl_dataset_t *ds, blkptr_t *bp,
 	dprintf_ds(ds, "finished scan%s", "");
 }
 
+/*
+ * The bookmark fixups below are applied both to the traversal state and
+ * to the state of the last checkpoint, which is what is on disk while a
+ * sorted scan still has reads queued.
+ */
+static void
+ds_destroyed_scn_phys(dsl_dataset_t *ds, dsl_scan_phys_t *scn_phys)
+{
+	if (scn_phys->scn_bookmark.zb_objset != ds->ds_object)
+		return;
+
+	if (ds->ds_is_snapshot) {
+		/*
+		 * Note:
+		 *  - scn_cur_{min,max}_txg stays the same.
+		 *  - Setting the flag is not really necessary if
+		 *    scn_cur_max_txg == scn_max_txg, because there
+		 *    is nothing after this snapshot that we care
+		 *    about.  However, we set it anyway and then
+		 *    ignore it when we retraverse it in
+		 *    dsl_scan_visitds().
+		 */
+		scn_phys->scn_bookmark.zb_objset =
+		    dsl_dataset_phys(ds)->ds_next_snap_obj;
+		zfs_dbgmsg("destroying ds %llu; currently traversing; "
+		    "reset zb_objset to %llu",
+		    (u_longlong_t)ds->ds_object,
+		    (u_longlong_t)dsl_dataset_phys(ds)->ds_next_snap_obj);
+		scn_phys->scn_flags |= DSF_VISIT_DS_AGAIN;
+	} else {
+		SET_BOOKMARK(&scn_phys->scn_bookmark,
+		    ZB_DESTROYED_OBJSET, 0, 0, 0);
+		zfs_dbgmsg("destroying ds %llu; currently traversing; "
+		    "reset bookmark to -1,0,0,0",
+		    (u_longlong_t)ds->ds_object);
+	}
+}
+
 void
 dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 {
@@ -981,34 +1296,18 @@ dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 	if (scn->scn_phys.scn_state != DSS_SCANNING)
 		return;
 
-	if (scn->scn_phys.scn_bookmark.zb_objset == ds->ds_object) {
+	ds_destroyed_scn_phys(ds, &scn->scn_phys);
+	ds_destroyed_scn_phys(ds, &scn->scn_phys_cached);
+
+	if (scan_ds_queue_contains(scn, ds->ds_object, &mintxg)) {
+		scan_ds_queue_remove(scn, ds->ds_object);
 		if (ds->ds_is_snapshot) {
-			/*
-			 * Note:
-			 *  - scn_cur_{min,max}_txg stays the same.
-			 *  - Setting the flag is not really necessary if
-			 *    scn_cur_max_txg == scn_max_txg, because there
-			 *    is nothing after this snapshot that we care
-			 *    about.  However, we set it anyway and then
-			 *    ignore it when we retraverse it in
-			 *    dsl_scan_visitds().
-			 */
-			scn->scn_phys.scn_bookmark.zb_objset =
-			    dsl_dataset_phys(ds)->ds_next_snap_obj;
-			zfs_dbgmsg("destroying ds %llu; currently traversing; "
-			    "reset zb_objset to %llu",
-			    (u_longlong_t)ds->ds_object,
-			    (u_longlong_t)dsl_dataset_phys(ds)->
-			    ds_next_snap_obj);
-			scn->scn_phys.scn_flags |= DSF_VISIT_DS_AGAIN;
-		} else {
-			SET_BOOKMARK(&scn->scn_phys.scn_bookmark,
-			    ZB_DESTROYED_OBJSET, 0, 0, 0);
-			zfs_dbgmsg("destroying ds %llu; currently traversing; "
-			    "reset bookmark to -1,0,0,0",
-			    (u_longlong_t)ds->ds_object);
+			scan_ds_queue_insert(scn,
+			    dsl_dataset_phys(ds)->ds_next_snap_obj, mintxg);
 		}
-	} else if (zap_lookup_int_key(dp->dp_meta_objset,
+	}
+
+	if (zap_lookup_int_key(dp->dp_meta_objset,
 	    scn->scn_phys.scn_queue_obj, ds->ds_object, &mintxg) == 0) {
 		ASSERT3U(dsl_dataset_phys(ds)->ds_num_children, <=, 1);
 		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
@@ -1041,6 +1340,19 @@ dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 	dsl_scan_sync_state(scn, tx);
 }
 
+static void
+ds_snapshotted_bookmark(dsl_dataset_t *ds, zbookmark_phys_t *scn_bookmark)
+{
+	if (scn_bookmark->zb_objset == ds->ds_object) {
+		scn_bookmark->zb_objset =
+		    dsl_dataset_phys(ds)->ds_prev_snap_obj;
+		zfs_dbgmsg("snapshotting ds %llu; currently traversing; "
+		    "reset zb_objset to %llu",
+		    (u_longlong_t)ds->ds_object,
+		    (u_longlong_t)dsl_dataset_phys(ds)->ds_prev_snap_obj);
+	}
+}
+
 void
 dsl_scan_ds_snapshotted(dsl_dataset_t *ds, dmu_tx_t *tx)
 {
@@ -1053,14 +1365,16 @@ dsl_scan_ds_snapshotted(dsl_dataset_t *ds, dmu_tx_t *tx)
 
 	ASSERT(dsl_dataset_phys(ds)->ds_prev_snap_obj != 0);
 
-	if (scn->scn_phys.scn_bookmark.zb_objset == ds->ds_object) {
-		scn->scn_phys.scn_bookmark.zb_objset =
-		    dsl_dataset_phys(ds)->ds_prev_snap_obj;
-		zfs_dbgmsg("snapshotting ds %llu; currently traversing; "
-		    "reset zb_objset to %llu",
-		    (u_longlong_t)ds->ds_object,
-		    (u_longlong_t)dsl_dataset_phys(ds)->ds_prev_snap_obj);
-	} else if (zap_lookup_int_key(dp->dp_meta_objset,
+	ds_snapshotted_bookmark(ds, &scn->scn_phys.scn_bookmark);
+	ds_snapshotted_bookmark(ds, &scn->scn_phys_cached.scn_bookmark);
+
+	if (scan_ds_queue_contains(scn, ds->ds_object, &mintxg)) {
+		scan_ds_queue_remove(scn, ds->ds_object);
+		scan_ds_queue_insert(scn,
+		    dsl_dataset_phys(ds)->ds_prev_snap_obj, mintxg);
+	}
+
+	if (zap_lookup_int_key(dp->dp_meta_objset,
 	    scn->scn_phys.scn_queue_obj, ds->ds_object, &mintxg) == 0) {
 		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
 		    scn->scn_phys.scn_queue_obj, ds->ds_object, tx));
@@ -1075,6 +1389,25 @@ dsl_scan_ds_snapshotted(dsl_dataset_t *ds, dmu_tx_t *tx)
 	dsl_scan_sync_state(scn, tx);
 }
 
+static void
+ds_clone_swapped_bookmark(dsl_dataset_t *ds1, dsl_dataset_t *ds2,
+    zbookmark_phys_t *scn_bookmark)
+{
+	if (scn_bookmark->zb_objset == ds1->ds_object) {
+		scn_bookmark->zb_objset = ds2->ds_object;
+		zfs_dbgmsg("clone_swap ds %llu; currently traversing; "
+		    "reset zb_objset to %llu",
+		    (u_longlong_t)ds1->ds_object,
+		    (u_longlong_t)ds2->ds_object);
+	} else if (scn_bookmark->zb_objset == ds2->ds_object) {
+		scn_bookmark->zb_objset = ds1->ds_object;
+		zfs_dbgmsg("clone_swap ds %llu; currently traversing; "
+		    "reset zb_objset to %llu",
+		    (u_longlong_t)ds2->ds_object,
+		    (u_longlong_t)ds1->ds_object);
+	}
+}
+
 void
 dsl_scan_ds_clone_swapped(dsl_dataset_t *ds1, dsl_dataset_t *ds2, dmu_tx_t *tx)
 {
@@ -1085,18 +1418,19 @@ dsl_scan_ds_clone_swapped(dsl_dataset_t *ds1, dsl_dataset_t *ds2, dmu_tx_t *tx)
 	if (scn->scn_phys.scn_state != DSS_SCANNING)
 		return;
 
-	if (scn->scn_phys.scn_bookmark.zb_objset == ds1->ds_object) {
-		scn->scn_phys.scn_bookmark.zb_objset = ds2->ds_object;
-		zfs_dbgmsg("clone_swap ds %llu; currently traversing; "
-		    "reset zb_objset to %llu",
-		    (u_longlong_t)ds1->ds_object,
-		    (u_longlong_t)ds2->ds_object);
-	} else if (scn->scn_phys.scn_bookmark.zb_objset == ds2->ds_object) {
-		scn->scn_phys.scn_bookmark.zb_objset = ds1->ds_object;
-		zfs_dbgmsg("clone_swap ds %llu; currently traversing; "
-		    "reset zb_objset to %llu",
-		    (u_longlong_t)ds2->ds_object,
-		    (u_longlong_t)ds1->ds_object);
+	ds_clone_swapped_bookmark(ds1, ds2, &scn->scn_phys.scn_bookmark);
+	ds_clone_swapped_bookmark(ds1, ds2,
+	    &scn->scn_phys_cached.scn_bookmark);
+
+	/* If both were queued to begin with, there is nothing to do. */
+	if (scan_ds_queue_contains(scn, ds1->ds_object, &mintxg)) {
+		if (!scan_ds_queue_contains(scn, ds2->ds_object, NULL)) {
+			scan_ds_queue_remove(scn, ds1->ds_object);
+			scan_ds_queue_insert(scn, ds2->ds_object, mintxg);
+		}
+	} else if (scan_ds_queue_contains(scn, ds2->ds_object, &mintxg)) {
+		scan_ds_queue_remove(scn, ds2->ds_object);
+		scan_ds_queue_insert(scn, ds1->ds_object, mintxg);
 	}
 
 	if (zap_lookup_int_key(dp->dp_meta_objset, scn->scn_phys.scn_queue_obj,
@@ -1138,7 +1472,6 @@ dsl_scan_ds_clone_swapped(dsl_dataset_t *ds1, dsl_dataset_t *ds2, dmu_tx_t *tx)
 }
 
 struct enqueue_clones_arg {
-	dmu_tx_t *tx;
 	uint64_t originobj;
 };
 
@@ -1168,9 +1501,8 @@ enqueue_clones_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
 			return (err);
 		ds = prev;
 	}
-	VERIFY(zap_add_int_key(dp->dp_meta_objset,
-	    scn->scn_phys.scn_queue_obj, ds->ds_object,
-	    dsl_dataset_phys(ds)->ds_prev_snap_txg, eca->tx) == 0);
+	scan_ds_queue_insert(scn, ds->ds_object,
+	    dsl_dataset_phys(ds)->ds_prev_snap_txg);
 	dsl_dataset_rele(ds, FTAG);
 	return (0);
 }
@@ -1268,9 +1600,8 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	if (scn->scn_phys.scn_flags & DSF_VISIT_DS_AGAIN) {
 		zfs_dbgmsg("incomplete pass; visiting again");
 		scn->scn_phys.scn_flags &= ~DSF_VISIT_DS_AGAIN;
-		VERIFY(zap_add_int_key(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj, ds->ds_object,
-		    scn->scn_phys.scn_cur_max_txg, tx) == 0);
+		scan_ds_queue_insert(scn, ds->ds_object,
+		    scn->scn_phys.scn_cur_max_txg);
 		goto out;
 	}
 
@@ -1278,10 +1609,9 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	 * Add descendent datasets to work queue.
 	 */
 	if (dsl_dataset_phys(ds)->ds_next_snap_obj != 0) {
-		VERIFY(zap_add_int_key(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj,
+		scan_ds_queue_insert(scn,
 		    dsl_dataset_phys(ds)->ds_next_snap_obj,
-		    dsl_dataset_phys(ds)->ds_creation_txg, tx) == 0);
+		    dsl_dataset_phys(ds)->ds_creation_txg);
 	}
 	if (dsl_dataset_phys(ds)->ds_num_children > 1) {
 		boolean_t usenext = B_FALSE;
@@ -1302,13 +1632,24 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 		}
 
 		if (usenext) {
-			VERIFY0(zap_join_key(dp->dp_meta_objset,
-			    dsl_dataset_phys(ds)->ds_next_clones_obj,
-			    scn->scn_phys.scn_queue_obj,
-			    dsl_dataset_phys(ds)->ds_creation_txg, tx));
+			zap_cursor_t *zc;
+			zap_attribute_t *za;
+
+			zc = kmem_alloc(sizeof (zap_cursor_t), KM_SLEEP);
+			za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
+			for (zap_cursor_init(zc, dp->dp_meta_objset,
+			    dsl_dataset_phys(ds)->ds_next_clones_obj);
+			    zap_cursor_retrieve(zc, za) == 0;
+			    (void) zap_cursor_advance(zc)) {
+				scan_ds_queue_insert(scn,
+				    strtonum(za->za_name, NULL),
+				    dsl_dataset_phys(ds)->ds_creation_txg);
+			}
+			zap_cursor_fini(zc);
+			kmem_free(za, sizeof (zap_attribute_t));
+			kmem_free(zc, sizeof (zap_cursor_t));
 		} else {
 			struct enqueue_clones_arg eca;
-			eca.tx = tx;
 			eca.originobj = ds->ds_object;
 
 			VERIFY0(dmu_objset_find_dp(dp, dp->dp_root_dir_obj,
@@ -1324,7 +1665,6 @@ out:
 static int
 enqueue_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
 {
-	dmu_tx_t *tx = arg;
 	dsl_dataset_t *ds;
 	int err;
 	dsl_scan_t *scn = dp->dp_scan;
@@ -1354,8 +1694,8 @@ enqueue_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
 		ds = prev;
 	}
 
-	VERIFY(zap_add_int_key(dp->dp_meta_objset, scn->scn_phys.scn_queue_obj,
-	    ds->ds_object, dsl_dataset_phys(ds)->ds_prev_snap_txg, tx) == 0);
+	scan_ds_queue_insert(scn, ds->ds_object,
+	    dsl_dataset_phys(ds)->ds_prev_snap_txg);
 	dsl_dataset_rele(ds, FTAG);
 	return (0);
 }
@@ -1463,8 +1803,7 @@ static void
 dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 {
 	dsl_pool_t *dp = scn->scn_dp;
-	zap_cursor_t *zc;
-	zap_attribute_t *za;
+	scan_ds_t *sds;
 
 	if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
 	    scn->scn_phys.scn_ddt_class_max) {
@@ -1488,7 +1827,7 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 
 		if (spa_version(dp->dp_spa) < SPA_VERSION_DSL_SCRUB) {
 			VERIFY0(dmu_objset_find_dp(dp, dp->dp_root_dir_obj,
-			    enqueue_cb, tx, DS_FIND_CHILDREN));
+			    enqueue_cb, NULL, DS_FIND_CHILDREN));
 		} else {
 			dsl_scan_visitds(scn,
 			    dp->dp_origin_snap->ds_object, tx);
@@ -1512,26 +1851,20 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 	 * bookmark so we don't think that we're still trying to resume.
 	 */
 	bzero(&scn->scn_phys.scn_bookmark, sizeof (zbookmark_phys_t));
-	zc = kmem_alloc(sizeof (zap_cursor_t), KM_SLEEP);
-	za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
 
-	/* keep pulling things out of the zap-object-as-queue */
-	while (zap_cursor_init(zc, dp->dp_meta_objset,
-	    scn->scn_phys.scn_queue_obj),
-	    zap_cursor_retrieve(zc, za) == 0) {
+	/* keep pulling things out of the dataset queue */
+	while ((sds = avl_first(&scn->scn_queue)) != NULL) {
 		dsl_dataset_t *ds;
-		uint64_t dsobj;
+		uint64_t dsobj = sds->sds_dsobj;
+		uint64_t txg = sds->sds_txg;
 
-		dsobj = strtonum(za->za_name, NULL);
-		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj, dsobj, tx));
+		scan_ds_queue_remove(scn, dsobj);
 
 		/* Set up min/max txg */
 		VERIFY3U(0, ==, dsl_dataset_hold_obj(dp, dsobj, FTAG, &ds));
-		if (za->za_first_integer != 0) {
+		if (txg != 0) {
 			scn->scn_phys.scn_cur_min_txg =
-			    MAX(scn->scn_phys.scn_min_txg,
-			    za->za_first_integer);
+			    MAX(scn->scn_phys.scn_min_txg, txg);
 		} else {
 			scn->scn_phys.scn_cur_min_txg =
 			    MAX(scn->scn_phys.scn_min_txg,
@@ -1541,14 +1874,9 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 		dsl_dataset_rele(ds, FTAG);
 
 		dsl_scan_visitds(scn, dsobj, tx);
-		zap_cursor_fini(zc);
 		if (scn->scn_suspending)
-			goto out;
+			return;
 	}
-	zap_cursor_fini(zc);
-out:
-	kmem_free(za, sizeof (zap_attribute_t));
-	kmem_free(zc, sizeof (zap_cursor_t));
 }
 
 static boolean_t
@@ -1775,7 +2103,12 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	if (scn->scn_phys.scn_state != DSS_SCANNING)
 		return;
 
-	if (scn->scn_done_txg == tx->tx_txg) {
+	/*
+	 * A sorted scan is only done once its traversal has completed and
+	 * every read it queued has been issued.
+	 */
+	if (scn->scn_done_txg != 0 && scn->scn_done_txg <= tx->tx_txg &&
+	    scn->scn_bytes_pending == 0) {
 		ASSERT(!scn->scn_suspending);
 		/* finished with scan. */
 		zfs_dbgmsg("txg %llu scan complete", tx->tx_txg);
@@ -1788,44 +2121,102 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	if (dsl_scan_is_paused_scrub(scn))
 		return;
 
-	if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
-	    scn->scn_phys.scn_ddt_class_max) {
-		zfs_dbgmsg("doing scan sync txg %llu; "
-		    "ddt bm=%llu/%llu/%llu/%llx",
-		    (longlong_t)tx->tx_txg,
-		    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_class,
-		    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_type,
-		    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_checksum,
-		    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_cursor);
-		ASSERT(scn->scn_phys.scn_bookmark.zb_objset == 0);
-		ASSERT(scn->scn_phys.scn_bookmark.zb_object == 0);
-		ASSERT(scn->scn_phys.scn_bookmark.zb_level == 0);
-		ASSERT(scn->scn_phys.scn_bookmark.zb_blkid == 0);
-	} else {
-		zfs_dbgmsg("doing scan sync txg %llu; bm=%llu/%llu/%llu/%llu",
-		    (longlong_t)tx->tx_txg,
-		    (longlong_t)scn->scn_phys.scn_bookmark.zb_objset,
-		    (longlong_t)scn->scn_phys.scn_bookmark.zb_object,
-		    (longlong_t)scn->scn_phys.scn_bookmark.zb_level,
-		    (longlong_t)scn->scn_phys.scn_bookmark.zb_blkid);
+	/*
+	 * Unless zfs_scan_legacy is set, scrub and resilver queue the
+	 * blocks they find and issue the reads sorted by offset.  A scan
+	 * that has started sorting keeps doing so until it is done.
+	 */
+	if (!scn->scn_is_sorted && !zfs_scan_legacy &&
+	    DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
+		scn->scn_is_sorted = B_TRUE;
+		scn->scn_last_checkpoint = gethrtime();
+	}
+
+	/*
+	 * Traversal stops while the queues are drained: periodically, so
+	 * that the progress made so far can be recorded on disk, and
+	 * whenever the queues have used up their memory.
+	 */
+	if (scn->scn_is_sorted) {
+		if (!scn->scn_checkpointing &&
+		    (gethrtime() - scn->scn_last_checkpoint) / NANOSEC >=
+		    zfs_scan_checkpoint_intval) {
+			zfs_dbgmsg("starting scan checkpoint in txg %llu",
+			    (longlong_t)tx->tx_txg);
+			scn->scn_checkpointing = B_TRUE;
+		}
+		scn->scn_clearing = dsl_scan_should_clear(scn);
 	}
 
-	scn->scn_zio_root = zio_root(dp->dp_spa, NULL,
-	    NULL, ZIO_FLAG_CANFAIL);
-	dsl_pool_config_enter(dp, FTAG);
-	dsl_scan_visit(scn, tx);
-	dsl_pool_config_exit(dp, FTAG);
-	(void) zio_wait(scn->scn_zio_root);
-	scn->scn_zio_root = NULL;
+	if (!scn->scn_checkpointing && !scn->scn_clearing &&
+	    scn->scn_done_txg == 0) {
+		if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
+		    scn->scn_phys.scn_ddt_class_max) {
+			zfs_dbgmsg("doing scan sync txg %llu; "
+			    "ddt bm=%llu/%llu/%llu/%llx",
+			    (longlong_t)tx->tx_txg,
+			    (longlong_t)
+			    scn->scn_phys.scn_ddt_bookmark.ddb_class,
+			    (longlong_t)
+			    scn->scn_phys.scn_ddt_bookmark.ddb_type,
+			    (longlong_t)
+			    scn->scn_phys.scn_ddt_bookmark.ddb_checksum,
+			    (longlong_t)
+			    scn->scn_phys.scn_ddt_bookmark.ddb_cursor);
+			ASSERT(scn->scn_phys.scn_bookmark.zb_objset == 0);
+			ASSERT(scn->scn_phys.scn_bookmark.zb_object == 0);
+			ASSERT(scn->scn_phys.scn_bookmark.zb_level == 0);
+			ASSERT(scn->scn_phys.scn_bookmark.zb_blkid == 0);
+		} else {
+			zfs_dbgmsg("doing scan sync txg %llu; "
+			    "bm=%llu/%llu/%llu/%llu",
+			    (longlong_t)tx->tx_txg,
+			    (longlong_t)scn->scn_phys.scn_bookmark.zb_objset,
+			    (longlong_t)scn->scn_phys.scn_bookmark.zb_object,
+			    (longlong_t)scn->scn_phys.scn_bookmark.zb_level,
+			    (longlong_t)scn->scn_phys.scn_bookmark.zb_blkid);
+		}
 
-	zfs_dbgmsg("visited %llu blocks in %llums",
-	    (longlong_t)scn->scn_visited_this_txg,
-	    (longlong_t)NSEC2MSEC(gethrtime() - scn->scn_sync_start_time));
+		scn->scn_zio_root = zio_root(dp->dp_spa, NULL,
+		    NULL, ZIO_FLAG_CANFAIL);
+		dsl_pool_config_enter(dp, FTAG);
+		dsl_scan_visit(scn, tx);
+		dsl_pool_config_exit(dp, FTAG);
+		(void) zio_wait(scn->scn_zio_root);
+		scn->scn_zio_root = NULL;
+
+		zfs_dbgmsg("visited %llu blocks in %llums",
+		    (longlong_t)scn->scn_visited_this_txg,
+		    (longlong_t)NSEC2MSEC(gethrtime() -
+		    scn->scn_sync_start_time));
+
+		if (!scn->scn_suspending) {
+			scn->scn_done_txg = tx->tx_txg + 1;
+			zfs_dbgmsg("txg %llu traversal complete, "
+			    "waiting till txg %llu",
+			    tx->tx_txg, scn->scn_done_txg);
+
+			/* Nothing more will be queued; sweep in order. */
+			if (scn->scn_is_sorted)
+				scn->scn_checkpointing = B_TRUE;
+		}
+	}
 
-	if (!scn->scn_suspending) {
-		scn->scn_done_txg = tx->tx_txg + 1;
-		zfs_dbgmsg("txg %llu traversal complete, waiting till txg %llu",
-		    tx->tx_txg, scn->scn_done_txg);
+	if (scn->scn_is_sorted && scn->scn_bytes_pending != 0) {
+		scn->scn_clearing = dsl_scan_should_clear(scn);
+		if (scn->scn_done_txg != 0 || scn->scn_checkpointing ||
+		    scn->scn_clearing) {
+			zfs_dbgmsg("issuing sorted scan reads in txg %llu; "
+			    "%llu bytes pending, %llu bytes of memory",
+			    (longlong_t)tx->tx_txg,
+			    (longlong_t)scn->scn_bytes_pending,
+			    (longlong_t)scn->scn_mem_used);
+			scan_io_queues_run(scn);
+			zfs_dbgmsg("%llu bytes still pending after %llums",
+			    (longlong_t)scn->scn_bytes_pending,
+			    (longlong_t)NSEC2MSEC(gethrtime() -
+			    scn->scn_sync_start_time));
+		}
 	}
 
 	if (DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
@@ -1921,13 +2312,242 @@ count_block(zfs_all_blkstats_t *zab, const blkptr_t *bp)
 	}
 }
 
+static void
+count_block_issued(spa_t *spa, const blkptr_t *bp)
+{
+	uint64_t asize = 0;
+	int d;
+
+	for (d = 0; d < BP_GET_NDVAS(bp); d++)
+		asize += DVA_GET_ASIZE(&bp->blk_dva[d]);
+	atomic_add_64(&spa->spa_scan_pass_issued, asize);
+}
+
+static int
+sio_addr_compare(const void *a, const void *b)
+{
+	uint64_t off_a = SIO_GET_OFFSET((const scan_io_t *)a);
+	uint64_t off_b = SIO_GET_OFFSET((const scan_io_t *)b);
+
+	if (off_a < off_b)
+		return (-1);
+	if (off_a > off_b)
+		return (1);
+	return (0);
+}
+
+/*
+ * Overlapping extents compare equal, so that avl_find() with a search
+ * range returns any extent that intersects it.
+ */
+static int
+ext_addr_compare(const void *a, const void *b)
+{
+	const scan_ext_t *ext_a = a, *ext_b = b;
+
+	if (ext_a->se_end <= ext_b->se_start)
+		return (-1);
+	if (ext_a->se_start >= ext_b->se_end)
+		return (1);
+	return (0);
+}
+
+/*
+ * Extents are issued best first: the more bytes they hold the better,
+ * with a bonus for extents that have few gaps.  The fill percentage is
+ * weighted by SCAN_EXT_FILL_WEIGHT and scaled by the fill itself.
+ */
+static uint64_t
+ext_score(const scan_ext_t *ext)
+{
+	uint64_t size = ext->se_end - ext->se_start;
+	uint64_t fill = ext->se_fill;
+
+	return (fill +
+	    (((fill * 100) / size) * SCAN_EXT_FILL_WEIGHT * fill) / 100);
+}
+
+static int
+ext_score_compare(const void *a, const void *b)
+{
+	const scan_ext_t *ext_a = a, *ext_b = b;
+	uint64_t score_a = ext_score(ext_a);
+	uint64_t score_b = ext_score(ext_b);
+
+	if (score_a > score_b)
+		return (-1);
+	if (score_a < score_b)
+		return (1);
+	if (ext_a->se_start < ext_b->se_start)
+		return (-1);
+	if (ext_a->se_start > ext_b->se_start)
+		return (1);
+	return (0);
+}
+
+static scan_io_t *
+sio_alloc(dsl_scan_t *scn)
+{
+	atomic_add_64(&scn->scn_mem_used, sizeof (scan_io_t));
+	return (kmem_zalloc(sizeof (scan_io_t), KM_SLEEP));
+}
+
+static void
+sio_free(dsl_scan_t *scn, scan_io_t *sio)
+{
+	kmem_free(sio, sizeof (scan_io_t));
+	atomic_add_64(&scn->scn_mem_used, -(int64_t)sizeof (scan_io_t));
+}
+
+static scan_ext_t *
+ext_alloc(dsl_scan_t *scn)
+{
+	atomic_add_64(&scn->scn_mem_used, sizeof (scan_ext_t));
+	return (kmem_zalloc(sizeof (scan_ext_t), KM_SLEEP));
+}
+
+static void
+ext_free(dsl_scan_t *scn, scan_ext_t *ext)
+{
+	kmem_free(ext, sizeof (scan_ext_t));
+	atomic_add_64(&scn->scn_mem_used, -(int64_t)sizeof (scan_ext_t));
+}
+
+static dsl_scan_io_queue_t *
+scan_io_queue_create(vdev_t *vd)
+{
+	dsl_scan_io_queue_t *queue;
+
+	queue = kmem_zalloc(sizeof (dsl_scan_io_queue_t), KM_SLEEP);
+	queue->q_scn = vd->vdev_spa->spa_dsl_pool->dp_scan;
+	queue->q_vd = vd;
+	cv_init(&queue->q_zio_cv, NULL, CV_DEFAULT, NULL);
+	avl_create(&queue->q_sios_by_addr, sio_addr_compare,
+	    sizeof (scan_io_t), offsetof(scan_io_t, sio_nodes.sio_addr_node));
+	avl_create(&queue->q_exts_by_addr, ext_addr_compare,
+	    sizeof (scan_ext_t), offsetof(scan_ext_t, se_addr_node));
+	avl_create(&queue->q_exts_by_score, ext_score_compare,
+	    sizeof (scan_ext_t), offsetof(scan_ext_t, se_score_node));
+
+	return (queue);
+}
+
+/*
+ * Account for fill bytes queued at [start, end), merging them with any
+ * extent that is less than zfs_scan_max_ext_gap away.
+ */
+static void
+scan_io_queue_ext_add(dsl_scan_io_queue_t *queue, uint64_t start,
+    uint64_t end, uint64_t fill)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	uint64_t gap = zfs_scan_max_ext_gap;
+	scan_ext_t srch, *ext, *merged = NULL;
+
+	srch.se_start = (start > gap) ? start - gap : 0;
+	srch.se_end = end + gap;
+
+	while ((ext = avl_find(&queue->q_exts_by_addr, &srch, NULL)) != NULL) {
+		avl_remove(&queue->q_exts_by_addr, ext);
+		avl_remove(&queue->q_exts_by_score, ext);
+		start = MIN(start, ext->se_start);
+		end = MAX(end, ext->se_end);
+		fill += ext->se_fill;
+		if (merged == NULL)
+			merged = ext;
+		else
+			ext_free(scn, ext);
+	}
+
+	if (merged == NULL)
+		merged = ext_alloc(scn);
+	merged->se_start = start;
+	merged->se_end = end;
+	merged->se_fill = fill;
+	avl_add(&queue->q_exts_by_addr, merged);
+	avl_add(&queue->q_exts_by_score, merged);
+}
+
+/*
+ * Take fill bytes at offset out of the extent holding them.
+ */
+static void
+scan_io_queue_ext_remove(dsl_scan_io_queue_t *queue, uint64_t offset,
+    uint64_t fill)
+{
+	scan_ext_t srch, *ext;
+
+	srch.se_start = offset;
+	srch.se_end = offset + 1;
+	ext = avl_find(&queue->q_exts_by_addr, &srch, NULL);
+	VERIFY(ext != NULL);
+
+	avl_remove(&queue->q_exts_by_score, ext);
+	ASSERT3U(ext->se_fill, >=, fill);
+	ext->se_fill -= fill;
+	if (ext->se_fill == 0) {
+		avl_remove(&queue->q_exts_by_addr, ext);
+		ext_free(queue->q_scn, ext);
+	} else {
+		avl_add(&queue->q_exts_by_score, ext);
+	}
+}
+
+static void
+scan_io_queue_insert_impl(dsl_scan_io_queue_t *queue, scan_io_t *sio)
+{
+	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
+
+	avl_add(&queue->q_sios_by_addr, sio);
+	scan_io_queue_ext_add(queue, SIO_GET_OFFSET(sio),
+	    SIO_GET_END_OFFSET(sio), SIO_GET_ASIZE(sio));
+}
+
+static void
+scan_io_queue_insert(dsl_scan_io_queue_t *queue, const blkptr_t *bp,
+    int zio_flags, const zbookmark_phys_t *zb)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	scan_io_t *sio;
+
+	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
+
+	/*
+	 * The same block can be reached twice, e.g. when a dataset has to
+	 * be visited again; it only needs to be read once.  The copy already
+	 * queued accounts for its pending bytes, and is counted as issued
+	 * when it is read.
+	 */
+	sio = sio_alloc(scn);
+	sio->sio_bp = *bp;
+	if (avl_find(&queue->q_sios_by_addr, sio, NULL) != NULL) {
+		sio_free(scn, sio);
+		return;
+	}
+
+	sio->sio_flags = zio_flags;
+	sio->sio_zb = *zb;
+	atomic_add_64(&scn->scn_bytes_pending, SIO_GET_ASIZE(sio));
+	scan_io_queue_insert_impl(queue, sio);
+}
+
 static void
 dsl_scan_scrub_done(zio_t *zio)
 {
 	spa_t *spa = zio->io_spa;
+	dsl_scan_io_queue_t *queue = zio->io_private;
 
 	abd_free(zio->io_abd);
 
+	if (queue != NULL) {
+		kmutex_t *q_lock = &queue->q_vd->vdev_scan_io_queue_lock;
+
+		mutex_enter(q_lock);
+		queue->q_inflight_bytes -= zio->io_size;
+		cv_broadcast(&queue->q_zio_cv);
+		mutex_exit(q_lock);
+	}
+
 	mutex_enter(&spa->spa_scrub_lock);
 	spa->spa_scrub_inflight--;
 	cv_broadcast(&spa->spa_scrub_io_cv);
@@ -1939,17 +2559,91 @@ dsl_scan_scrub_done(zio_t *zio)
 	mutex_exit(&spa->spa_scrub_lock);
 }
 
+/*
+ * Read a block for the scan.  Reads issued in traversal order are limited
+ * to zfs_top_maxinflight per top-level vdev; reads issued from a sorted
+ * queue are limited by the bytes in flight to that queue's vdev instead.
+ */
+static void
+scan_exec_io(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
+    const zbookmark_phys_t *zb, dsl_scan_io_queue_t *queue)
+{
+	spa_t *spa = dp->dp_spa;
+	dsl_scan_t *scn = dp->dp_scan;
+	size_t size = BP_GET_PSIZE(bp);
+	int scan_delay = (scn->scn_phys.scn_func == POOL_SCAN_SCRUB) ?
+	    zfs_scrub_delay : zfs_resilver_delay;
+
+	if (queue == NULL) {
+		vdev_t *rvd = spa->spa_root_vdev;
+		uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
+
+		mutex_enter(&spa->spa_scrub_lock);
+		while (spa->spa_scrub_inflight >= maxinflight)
+			cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
+		spa->spa_scrub_inflight++;
+		mutex_exit(&spa->spa_scrub_lock);
+	} else {
+		kmutex_t *q_lock = &queue->q_vd->vdev_scan_io_queue_lock;
+
+		mutex_enter(q_lock);
+		while (queue->q_inflight_bytes >= queue->q_maxinflight_bytes)
+			cv_wait(&queue->q_zio_cv, q_lock);
+		queue->q_inflight_bytes += size;
+		mutex_exit(q_lock);
+
+		mutex_enter(&spa->spa_scrub_lock);
+		spa->spa_scrub_inflight++;
+		mutex_exit(&spa->spa_scrub_lock);
+	}
+
+	count_block_issued(spa, bp);
+
+	/*
+	 * If we're seeing recent (zfs_scan_idle) "important" I/Os
+	 * then throttle our workload to limit the impact of a scan.
+	 */
+	if (ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
+		delay(scan_delay);
+
+	zio_nowait(zio_read(NULL, spa, bp, abd_alloc_for_io(size, B_FALSE),
+	    size, dsl_scan_scrub_done, queue, ZIO_PRIORITY_SCRUB, zio_flags,
+	    zb));
+}
+
+/*
+ * Queue the read of a block on the top-level vdev of its first DVA.
+ * Gang blocks are read right away: their members can be anywhere, and
+ * are only known once the gang header has been read.
+ */
+static void
+dsl_scan_enqueue(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
+    const zbookmark_phys_t *zb)
+{
+	vdev_t *vd;
+
+	if (!dp->dp_scan->scn_is_sorted || BP_IS_GANG(bp)) {
+		scan_exec_io(dp, bp, zio_flags, zb, NULL);
+		return;
+	}
+
+	vd = vdev_lookup_top(dp->dp_spa, DVA_GET_VDEV(&bp->blk_dva[0]));
+	mutex_enter(&vd->vdev_scan_io_queue_lock);
+	if (vd->vdev_scan_io_queue == NULL)
+		vd->vdev_scan_io_queue = scan_io_queue_create(vd);
+	scan_io_queue_insert(vd->vdev_scan_io_queue, bp, zio_flags, zb);
+	mutex_exit(&vd->vdev_scan_io_queue_lock);
+}
+
 static int
 dsl_scan_scrub_cb(dsl_pool_t *dp,
     const blkptr_t *bp, const zbookmark_phys_t *zb)
 {
 	dsl_scan_t *scn = dp->dp_scan;
-	size_t size = BP_GET_PSIZE(bp);
 	spa_t *spa = dp->dp_spa;
 	uint64_t phys_birth = BP_PHYSICAL_BIRTH(bp);
 	boolean_t needs_io = B_FALSE;
 	int zio_flags = ZIO_FLAG_SCAN_THREAD | ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL;
-	int scan_delay = 0;
 	int d;
 
 	if (phys_birth <= scn->scn_phys.scn_min_txg ||
@@ -1965,12 +2659,10 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	if (scn->scn_phys.scn_func == POOL_SCAN_SCRUB) {
 		zio_flags |= ZIO_FLAG_SCRUB;
 		needs_io = B_TRUE;
-		scan_delay = zfs_scrub_delay;
 	} else {
 		ASSERT3U(scn->scn_phys.scn_func, ==, POOL_SCAN_RESILVER);
 		zio_flags |= ZIO_FLAG_RESILVER;
 		needs_io = B_FALSE;
-		scan_delay = zfs_resilver_delay;
 	}
 
 	/* If it's an intent log block, failure is expected. */
@@ -2007,30 +2699,323 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 		}
 	}
 
-	if (needs_io && !zfs_no_scrub_io) {
-		vdev_t *rvd = spa->spa_root_vdev;
-		uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
+	if (needs_io && !zfs_no_scrub_io)
+		dsl_scan_enqueue(dp, bp, zio_flags, zb);
+	else
+		count_block_issued(spa, bp);
 
-		mutex_enter(&spa->spa_scrub_lock);
-		while (spa->spa_scrub_inflight >= maxinflight)
-			cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
-		spa->spa_scrub_inflight++;
-		mutex_exit(&spa->spa_scrub_lock);
+	/* do not relocate this block */
+	return (0);
+}
+
+/*
+ * Number of readable leaf vdevs of the pool proper below vd.
+ */
+static uint64_t
+dsl_scan_count_leaves(vdev_t *vd)
+{
+	uint64_t c, leaves = 0;
+
+	if (vd->vdev_islog || vd->vdev_isspare || vd->vdev_isl2cache ||
+	    !vdev_readable(vd))
+		return (0);
+
+	if (vd->vdev_ops->vdev_op_leaf)
+		return (1);
+
+	for (c = 0; c < vd->vdev_children; c++)
+		leaves += dsl_scan_count_leaves(vd->vdev_child[c]);
+
+	return (leaves);
+}
+
+/*
+ * When checkpointing nothing more will be queued, so the queue is swept
+ * in offset order.  Otherwise the queue is only issued to free up memory,
+ * and the best extents go first, leaving the sparse ones time to fill up.
+ */
+static scan_ext_t *
+scan_io_queue_fetch_ext(dsl_scan_io_queue_t *queue)
+{
+	dsl_scan_t *scn = queue->q_scn;
+
+	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
+
+	if (scn->scn_checkpointing)
+		return (avl_first(&queue->q_exts_by_addr));
+	if (dsl_scan_should_clear(scn))
+		return (avl_first(&queue->q_exts_by_score));
+	return (NULL);
+}
+
+/*
+ * Move up to SCAN_GATHER_MAX blocks from the front of ext onto list.
+ * Returns B_TRUE if ext still has blocks left, B_FALSE if it was used
+ * up and freed.
+ */
+static boolean_t
+scan_io_queue_gather(dsl_scan_io_queue_t *queue, scan_ext_t *ext,
+    list_t *list)
+{
+	scan_io_t srch, *sio, *next;
+	avl_index_t idx;
+	uint64_t bytes = 0;
+	int num_sios = 0;
+
+	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
+
+	bzero(&srch.sio_bp.blk_dva[0], sizeof (dva_t));
+	DVA_SET_OFFSET(&srch.sio_bp.blk_dva[0], ext->se_start);
+	sio = avl_find(&queue->q_sios_by_addr, &srch, &idx);
+	if (sio == NULL)
+		sio = avl_nearest(&queue->q_sios_by_addr, idx, AVL_AFTER);
+
+	while (sio != NULL && SIO_GET_OFFSET(sio) < ext->se_end &&
+	    num_sios < SCAN_GATHER_MAX) {
+		next = AVL_NEXT(&queue->q_sios_by_addr, sio);
+		avl_remove(&queue->q_sios_by_addr, sio);
+		list_insert_tail(list, sio);
+		bytes += SIO_GET_ASIZE(sio);
+		num_sios++;
+		sio = next;
+	}
+
+	avl_remove(&queue->q_exts_by_score, ext);
+	if (sio != NULL && SIO_GET_OFFSET(sio) < ext->se_end) {
+		ext->se_start = SIO_GET_OFFSET(sio);
+		ext->se_fill -= bytes;
+		avl_add(&queue->q_exts_by_score, ext);
+		return (B_TRUE);
+	}
+
+	avl_remove(&queue->q_exts_by_addr, ext);
+	ext_free(queue->q_scn, ext);
+	return (B_FALSE);
+}
+
+/*
+ * Issue the reads on list, stopping early once this txg's time is up.
+ * Returns B_TRUE if it stopped early.
+ */
+static boolean_t
+scan_io_queue_issue(dsl_scan_io_queue_t *queue, list_t *list)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	scan_io_t *sio;
+	uint64_t bytes_issued = 0;
+	boolean_t suspended = B_FALSE;
+
+	while ((sio = list_head(list)) != NULL) {
+		if (dsl_scan_txg_expired(scn)) {
+			suspended = B_TRUE;
+			break;
+		}
+
+		list_remove(list, sio);
+		scan_exec_io(scn->scn_dp, &sio->sio_bp, sio->sio_flags,
+		    &sio->sio_zb, queue);
+		bytes_issued += SIO_GET_ASIZE(sio);
+		sio_free(scn, sio);
+	}
+
+	atomic_add_64(&scn->scn_bytes_pending, -(int64_t)bytes_issued);
+	return (suspended);
+}
+
+/*
+ * Issue one top-level vdev's queue; runs on scn_taskq.
+ */
+static void
+scan_io_queues_run_one(void *arg)
+{
+	dsl_scan_io_queue_t *queue = arg;
+	kmutex_t *q_lock = &queue->q_vd->vdev_scan_io_queue_lock;
+	boolean_t suspended = B_FALSE;
+	scan_ext_t *ext;
+	scan_io_t *sio;
+	list_t sio_list;
+
+	list_create(&sio_list, sizeof (scan_io_t),
+	    offsetof(scan_io_t, sio_nodes.sio_list_node));
+
+	mutex_enter(q_lock);
+
+	/* allow zfs_scan_vdev_limit in flight per leaf, at least 1MB */
+	queue->q_maxinflight_bytes = MAX(dsl_scan_count_leaves(queue->q_vd) *
+	    zfs_scan_vdev_limit, 1ULL << 20);
+
+	while (!suspended && (ext = scan_io_queue_fetch_ext(queue)) != NULL) {
+		boolean_t more_left = B_TRUE;
 
 		/*
-		 * If we're seeing recent (zfs_scan_idle) "important" I/Os
-		 * then throttle our workload to limit the impact of a scan.
+		 * Only this thread takes blocks off the queue during the
+		 * issue phase, so ext stays valid while the lock is dropped
+		 * to issue (which may block on the in-flight limit).
 		 */
-		if (ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
-			delay(scan_delay);
+		while (more_left && !suspended) {
+			more_left = scan_io_queue_gather(queue, ext, &sio_list);
+			mutex_exit(q_lock);
+			suspended = scan_io_queue_issue(queue, &sio_list);
+			mutex_enter(q_lock);
+		}
+	}
 
-		zio_nowait(zio_read(NULL, spa, bp,
-		    abd_alloc_for_io(size, B_FALSE), size, dsl_scan_scrub_done,
-		    NULL, ZIO_PRIORITY_SCRUB, zio_flags, zb));
+	/* put back whatever we did not get to */
+	while ((sio = list_head(&sio_list)) != NULL) {
+		list_remove(&sio_list, sio);
+		scan_io_queue_insert_impl(queue, sio);
 	}
 
-	/* do not relocate this block */
-	return (0);
+	mutex_exit(q_lock);
+	list_destroy(&sio_list);
+}
+
+/*
+ * Issue the queues of all top-level vdevs in parallel, until they are
+ * drained or this txg's time is up.
+ */
+static void
+scan_io_queues_run(dsl_scan_t *scn)
+{
+	spa_t *spa = scn->scn_dp->dp_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t c;
+
+	ASSERT(scn->scn_is_sorted);
+
+	if (scn->scn_taskq == NULL) {
+		int nthreads = MAX(rvd->vdev_children, 1);
+
+		scn->scn_taskq = taskq_create("dsl_scan_iss", nthreads,
+		    minclsyspri, nthreads, nthreads, TASKQ_PREPOPULATE);
+	}
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		mutex_enter(&vd->vdev_scan_io_queue_lock);
+		if (vd->vdev_scan_io_queue != NULL) {
+			VERIFY(taskq_dispatch(scn->scn_taskq,
+			    scan_io_queues_run_one, vd->vdev_scan_io_queue,
+			    TQ_SLEEP) != 0);
+		}
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+	}
+
+	taskq_wait(scn->scn_taskq);
+}
+
+/*
+ * Free a queue and everything still on it.  Called with the vdev's
+ * vdev_scan_io_queue_lock held.
+ */
+void
+dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *queue)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	scan_io_t *sio;
+	scan_ext_t *ext;
+	void *cookie = NULL;
+
+	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
+	ASSERT0(queue->q_inflight_bytes);
+
+	while ((sio = avl_destroy_nodes(&queue->q_sios_by_addr,
+	    &cookie)) != NULL) {
+		atomic_add_64(&scn->scn_bytes_pending,
+		    -(int64_t)SIO_GET_ASIZE(sio));
+		sio_free(scn, sio);
+	}
+
+	cookie = NULL;
+	while (avl_destroy_nodes(&queue->q_exts_by_score, &cookie) != NULL)
+		continue;
+	cookie = NULL;
+	while ((ext = avl_destroy_nodes(&queue->q_exts_by_addr,
+	    &cookie)) != NULL)
+		ext_free(scn, ext);
+
+	avl_destroy(&queue->q_sios_by_addr);
+	avl_destroy(&queue->q_exts_by_score);
+	avl_destroy(&queue->q_exts_by_addr);
+	cv_destroy(&queue->q_zio_cv);
+	kmem_free(queue, sizeof (dsl_scan_io_queue_t));
+}
+
+static void
+scan_io_queues_destroy(dsl_scan_t *scn)
+{
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+	uint64_t c;
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		mutex_enter(&vd->vdev_scan_io_queue_lock);
+		if (vd->vdev_scan_io_queue != NULL)
+			dsl_scan_io_queue_destroy(vd->vdev_scan_io_queue);
+		vd->vdev_scan_io_queue = NULL;
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+	}
+}
+
+/*
+ * Called by vdev_top_transfer() when svd is replaced by tvd as a
+ * top-level vdev, so that the queued reads move along.
+ */
+void
+dsl_scan_io_queue_vdev_xfer(vdev_t *svd, vdev_t *tvd)
+{
+	mutex_enter(&svd->vdev_scan_io_queue_lock);
+	mutex_enter(&tvd->vdev_scan_io_queue_lock);
+
+	VERIFY3P(tvd->vdev_scan_io_queue, ==, NULL);
+	tvd->vdev_scan_io_queue = svd->vdev_scan_io_queue;
+	svd->vdev_scan_io_queue = NULL;
+	if (tvd->vdev_scan_io_queue != NULL)
+		tvd->vdev_scan_io_queue->q_vd = tvd;
+
+	mutex_exit(&tvd->vdev_scan_io_queue_lock);
+	mutex_exit(&svd->vdev_scan_io_queue_lock);
+}
+
+/*
+ * Called from zio_free_sync() for every freed block.  A read that is
+ * still queued for the block must be dropped: by the time it would be
+ * issued, the space may already hold other data.
+ */
+void
+dsl_scan_freed(spa_t *spa, const blkptr_t *bp)
+{
+	dsl_pool_t *dp = spa->spa_dsl_pool;
+	dsl_scan_t *scn;
+	dsl_scan_io_queue_t *queue;
+	scan_io_t srch, *sio;
+	vdev_t *vd;
+
+	if (dp == NULL || (scn = dp->dp_scan) == NULL ||
+	    !scn->scn_is_sorted || BP_IS_GANG(bp))
+		return;
+
+	vd = vdev_lookup_top(spa, DVA_GET_VDEV(&bp->blk_dva[0]));
+	if (vd == NULL)
+		return;
+
+	mutex_enter(&vd->vdev_scan_io_queue_lock);
+	queue = vd->vdev_scan_io_queue;
+	srch.sio_bp.blk_dva[0] = bp->blk_dva[0];
+	if (queue != NULL &&
+	    (sio = avl_find(&queue->q_sios_by_addr, &srch, NULL)) != NULL &&
+	    DVA_EQUAL(&sio->sio_bp.blk_dva[0], &bp->blk_dva[0])) {
+		avl_remove(&queue->q_sios_by_addr, sio);
+		scan_io_queue_ext_remove(queue, SIO_GET_OFFSET(sio),
+		    SIO_GET_ASIZE(sio));
+		atomic_add_64(&scn->scn_bytes_pending,
+		    -(int64_t)SIO_GET_ASIZE(sio));
+		count_block_issued(spa, &sio->sio_bp);
+		sio_free(scn, sio);
+	}
+	mutex_exit(&vd->vdev_scan_io_queue_lock);
 }
 
 /*
@@ -447,6 +447,55 @@ handle_sync_iokit(struct ldi_handle *lhp)
 	return (0);
 }
 
+#ifdef DKIOCUNMAP
+int
+handle_unmap_iokit(struct ldi_handle *lhp, dk_unmap_t *dkm)
+{
+	IOStorageExtent *extents;
+	IOReturn ret;
+	vm_size_t size;
+	int i;
+
+	/* Validate arguments */
+	if (!lhp || !dkm || dkm->extentsCount == 0) {
+		return (EINVAL);
+	}
+
+	/* Validate IOMedia and client */
+	if (!OSDynamicCast(IOMedia, LH_MEDIA(lhp)) ||
+	    !OSDynamicCast(IOService, LH_CLIENT(lhp))) {
+		dprintf("%s invalid IOMedia or client\n", __func__);
+		return (ENODEV);
+	}
+
+	/* Convert the extents, dk_extent_t may differ from IOKit's */
+	size = dkm->extentsCount * sizeof (IOStorageExtent);
+	extents = (IOStorageExtent *)IOMalloc(size);
+	if (!extents) {
+		return (ENOMEM);
+	}
+	for (i = 0; i < dkm->extentsCount; i++) {
+		extents[i].byteStart = dkm->extents[i].offset;
+		extents[i].byteCount = dkm->extents[i].length;
+	}
+
+	/* Issue device unmap */
+	ret = LH_MEDIA(lhp)->unmap(LH_CLIENT(lhp), extents,
+	    dkm->extentsCount, 0);
+	IOFree(extents, size);
+
+	if (ret == kIOReturnUnsupported) {
+		return (ENOTSUP);
+	} else if (ret != kIOReturnSuccess) {
+		dprintf("%s %s %x\n", __func__, "IOMedia unmap failed", ret);
+		return (EIO);
+	}
+
+	/* Success */
+	return (0);
+}
+#endif
+
 static dev_t
 dev_from_media(IOMedia *media)
 {
@@ -2179,6 +2179,24 @@ ldi_ioctl(ldi_handle_t lh, int cmd, intptr_t arg,
 			return (ENOTSUP);
 		}
 
+#ifdef DKIOCUNMAP
+	/* Discard (trim) extents */
+	case DKIOCUNMAP:
+		/* IOMedia or vnode */
+		switch (handlep->lh_type) {
+		case LDI_TYPE_IOKIT:
+			return (handle_unmap_iokit(handlep,
+			    (dk_unmap_t *)arg));
+
+		case LDI_TYPE_VNODE:
+			return (handle_unmap_vnode(handlep,
+			    (dk_unmap_t *)arg));
+
+		default:
+			return (ENOTSUP);
+		}
+#endif
+
 	case DKIOCGETBOOTINFO:
 		/* IOMedia or vnode */
 		switch (handlep->lh_type) {
@@ -901,3 +901,50 @@ handle_is_solidstate_vnode(struct ldi_handle *lhp, int *isssd)
 
 	return (error);
 }
+
+#ifdef DKIOCUNMAP
+int
+handle_unmap_vnode(struct ldi_handle *lhp, dk_unmap_t *dkm)
+{
+	vfs_context_t context;
+	int error;
+
+	if (!lhp || !dkm) {
+		dprintf("%s missing lhp or unmap request\n", __func__);
+		return (EINVAL);
+	}
+
+	/* Validate vnode */
+	if (LH_VNODE(lhp) == NULLVP) {
+		dprintf("%s missing vnode\n", __func__);
+		return (ENODEV);
+	}
+
+	/* Allocate and validate context */
+	context = vfs_context_create(spl_vfs_context_kernel());
+	if (!context) {
+		dprintf("%s couldn't create VFS context\n", __func__);
+		return (ENOMEM);
+	}
+
+	/* Take an iocount on devvp vnode. */
+	error = vnode_getwithref(LH_VNODE(lhp));
+	if (error) {
+		dprintf("%s vnode_getwithref error %d\n",
+		    __func__, error);
+		vfs_context_rele(context);
+		return (ENODEV);
+	}
+	/* All code paths from here must vnode_put. */
+
+	error = VNOP_IOCTL(LH_VNODE(lhp), DKIOCUNMAP,
+	    (caddr_t)dkm, 0, context);
+
+	/* Release iocount on vnode (still has usecount) */
+	vnode_put(LH_VNODE(lhp));
+	/* Drop vfs_context */
+	vfs_context_rele(context);
+
+	return (error);
+}
+#endif
@@ -1005,6 +1005,156 @@ LZ4_uncompress_unknownOutputSize(const char *source, char *dest, int isize,
 	return (int)(-(((char *)ip) - source));
 }
 
+/*
+ * Decompression straight from an ABD.  The compressed block of a scatter
+ * ABD is fed to the decoder one chunk at a time by abd_iterate_func(), so
+ * it is never copied into a linear buffer first.  Since a sequence may
+ * be split across chunks at any byte, the decoder is a small state
+ * machine; the output is linear, so matches are copied exactly as in
+ * LZ4_uncompress_unknownOutputSize().
+ */
+typedef enum lz4_stream_state {
+	LZ4S_TOKEN,		/* next byte is a sequence token */
+	LZ4S_LITLEN,		/* literal length continuation bytes */
+	LZ4S_LITERALS,		/* copying literals */
+	LZ4S_OFFSET,		/* little endian match offset */
+	LZ4S_MATCHLEN		/* match length continuation bytes */
+} lz4_stream_state_t;
+
+typedef struct lz4_stream {
+	lz4_stream_state_t	ls_state;
+	BYTE		*ls_dst;	/* start of the output */
+	BYTE		*ls_op;		/* next output byte */
+	BYTE		*ls_oend;	/* end of the output */
+	size_t		ls_length;	/* literal or match length */
+	size_t		ls_offset;	/* match offset being assembled */
+	unsigned	ls_nbytes;	/* offset bytes seen so far */
+	unsigned	ls_token;
+} lz4_stream_t;
+
+static int
+lz4_stream_match(lz4_stream_t *ls)
+{
+	BYTE *op = ls->ls_op;
+	const BYTE *ref = op - ls->ls_offset;
+	size_t length = ls->ls_length + MINMATCH;
+
+	if (ls->ls_offset == 0 || ls->ls_offset > (size_t)(op - ls->ls_dst) ||
+	    length > (size_t)(ls->ls_oend - op))
+		return (1);
+
+	if (ls->ls_offset >= length) {
+		(void) memcpy(op, ref, length);
+		op += length;
+	} else {
+		/* overlapping match, repeats the last ls_offset bytes */
+		while (length-- != 0)
+			*op++ = *ref++;
+	}
+	ls->ls_op = op;
+	ls->ls_state = LZ4S_TOKEN;
+
+	return (0);
+}
+
+static int
+lz4_stream_cb(void *buf, size_t len, void *private)
+{
+	lz4_stream_t *ls = private;
+	const BYTE *ip = buf;
+	const BYTE *const iend = ip + len;
+	size_t n;
+	unsigned s;
+
+	while (ip < iend) {
+		switch (ls->ls_state) {
+		case LZ4S_TOKEN:
+			ls->ls_token = *ip++;
+			ls->ls_length = ls->ls_token >> ML_BITS;
+			if (ls->ls_length == RUN_MASK)
+				ls->ls_state = LZ4S_LITLEN;
+			else
+				ls->ls_state = LZ4S_LITERALS;
+			break;
+		case LZ4S_LITLEN:
+			s = *ip++;
+			ls->ls_length += s;
+			if (s != 255)
+				ls->ls_state = LZ4S_LITERALS;
+			break;
+		case LZ4S_LITERALS:
+			n = MIN(ls->ls_length, (size_t)(iend - ip));
+			if (n > (size_t)(ls->ls_oend - ls->ls_op))
+				return (1);
+			(void) memcpy(ls->ls_op, ip, n);
+			ls->ls_op += n;
+			ip += n;
+			ls->ls_length -= n;
+			break;
+		case LZ4S_OFFSET:
+			ls->ls_offset |= (size_t)*ip++ << (8 * ls->ls_nbytes);
+			if (++ls->ls_nbytes < 2)
+				break;
+			ls->ls_length = ls->ls_token & ML_MASK;
+			if (ls->ls_length == ML_MASK)
+				ls->ls_state = LZ4S_MATCHLEN;
+			else if (lz4_stream_match(ls) != 0)
+				return (1);
+			break;
+		case LZ4S_MATCHLEN:
+			s = *ip++;
+			ls->ls_length += s;
+			if (s != 255 && lz4_stream_match(ls) != 0)
+				return (1);
+			break;
+		}
+
+		/* The literals are done, the match offset comes next. */
+		if (ls->ls_state == LZ4S_LITERALS && ls->ls_length == 0) {
+			ls->ls_state = LZ4S_OFFSET;
+			ls->ls_offset = 0;
+			ls->ls_nbytes = 0;
+		}
+	}
+
+	return (0);
+}
+
+/*ARGSUSED*/
+int
+lz4_decompress_abd(abd_t *src, void *d_start, size_t s_len,
+    size_t d_len, int n)
+{
+	lz4_stream_t ls = { 0 };
+	uint8_t hdr[sizeof (uint32_t)];
+	uint32_t bufsiz;
+
+	if (s_len < sizeof (hdr))
+		return (1);
+
+	abd_copy_to_buf_off(hdr, src, 0, sizeof (hdr));
+	bufsiz = BE_IN32(hdr);
+
+	/* invalid compressed buffer size encoded at start */
+	if (bufsiz + sizeof (bufsiz) > s_len)
+		return (1);
+
+	ls.ls_state = LZ4S_TOKEN;
+	ls.ls_dst = ls.ls_op = d_start;
+	ls.ls_oend = ls.ls_dst + d_len;
+
+	if (abd_iterate_func(src, sizeof (bufsiz), bufsiz, lz4_stream_cb,
+	    &ls) != 0)
+		return (1);
+
+	/*
+	 * A block ends either with its last literals, or (never produced by
+	 * the compressor, but accepted by the linear decoder) after a match.
+	 */
+	return (ls.ls_state != LZ4S_TOKEN &&
+	    !(ls.ls_state == LZ4S_OFFSET && ls.ls_nbytes == 0));
+}
+
 void
 lz4_init(void)
 {
@@ -32,6 +32,7 @@
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
 #include <sys/spa_impl.h>
+#include <sys/spa_log_spacemap.h>
 #include <sys/zfeature.h>
 
 #define	WITH_DF_BLOCK_ALLOCATOR
@@ -130,6 +131,12 @@ uint64_t metaslab_df_alloc_threshold = SPA_MAXBLOCKSIZE;
  */
 int metaslab_df_free_pct = 4;
 
+/*
+ * The block allocator of the pools opened from now on: 0 for the default
+ * (dynamic fit) allocator, 1 for the size-bucketed allocator.
+ */
+int metaslab_allocator = METASLAB_ALLOCATOR_DEFAULT;
+
 /*
  * Percentage of all cpus that can be used by the metaslab taskq.
  */
@@ -197,6 +204,7 @@ uint64_t metaslab_trace_max_entries = 5000;
 
 static uint64_t metaslab_weight(metaslab_t *);
 static void metaslab_set_fragmentation(metaslab_t *);
+static int64_t metaslab_unflushed_space(metaslab_t *);
 
 kmem_cache_t *metaslab_alloc_trace_cache;
 
@@ -471,7 +479,7 @@ metaslab_verify_space(metaslab_t *msp, uint64_t txg)
 		return;
 
 	sm_free_space = msp->ms_size - space_map_allocated(msp->ms_sm) -
-	    space_map_alloc_delta(msp->ms_sm);
+	    space_map_alloc_delta(msp->ms_sm) - metaslab_unflushed_space(msp);
 
 	/*
 	 * Account for future allocations since we would have already
@@ -876,11 +884,14 @@ metaslab_group_allocatable(metaslab_group_t *mg, metaslab_group_t *rotor,
 
 	/*
 	 * We can only consider skipping this metaslab group if it's
-	 * in the normal metaslab class and there are other metaslab
-	 * groups to select from. Otherwise, we always consider it eligible
-	 * for allocations.
+	 * in the normal, special or dedup metaslab class and there are
+	 * other metaslab groups to select from. Otherwise, we always
+	 * consider it eligible for allocations.
 	 */
-	if (mc != spa_normal_class(spa) || mc->mc_groups <= 1)
+	if ((mc != spa_normal_class(spa) &&
+	    mc != spa_special_class(spa) &&
+	    mc != spa_dedup_class(spa)) ||
+	    mc->mc_groups <= 1)
 		return (B_TRUE);
 
 	/*
@@ -962,14 +973,38 @@ metaslab_group_allocatable(metaslab_group_t *mg, metaslab_group_t *rotor,
  */
 
 /*
- * Comparison function for the private size-ordered tree. Tree is sorted
- * by size, larger sizes at the end of the tree.
+ * Comparison functions for the private size-ordered tree. Tree is sorted
+ * by size, larger sizes at the end of the tree.  Its segments are copies
+ * of those of ms_tree, and so of the same type; sizes in the units of the
+ * range tree order the same as sizes in bytes.
  */
 static int
-metaslab_rangesize_compare(const void *x1, const void *x2)
+metaslab_rangesize32_compare(const void *x1, const void *x2)
 {
-	const range_seg_t *r1 = x1;
-	const range_seg_t *r2 = x2;
+	const range_seg32_t *r1 = x1;
+	const range_seg32_t *r2 = x2;
+	uint64_t rs_size1 = r1->rs_end - r1->rs_start;
+	uint64_t rs_size2 = r2->rs_end - r2->rs_start;
+
+	if (rs_size1 < rs_size2)
+		return (-1);
+	if (rs_size1 > rs_size2)
+		return (1);
+
+	if (r1->rs_start < r2->rs_start)
+		return (-1);
+
+	if (r1->rs_start > r2->rs_start)
+		return (1);
+
+	return (0);
+}
+
+static int
+metaslab_rangesize64_compare(const void *x1, const void *x2)
+{
+	const range_seg64_t *r1 = x1;
+	const range_seg64_t *r2 = x2;
 	uint64_t rs_size1 = r1->rs_end - r1->rs_start;
 	uint64_t rs_size2 = r2->rs_end - r2->rs_start;
 
@@ -987,6 +1022,48 @@ metaslab_rangesize_compare(const void *x1, const void *x2)
 	return (0);
 }
 
+/*
+ * Comparison functions for the size buckets, which are sorted by offset.
+ */
+static int
+metaslab_rangestart32_compare(const void *x1, const void *x2)
+{
+	const range_seg32_t *r1 = x1;
+	const range_seg32_t *r2 = x2;
+
+	if (r1->rs_start < r2->rs_start)
+		return (-1);
+	if (r1->rs_start > r2->rs_start)
+		return (1);
+	return (0);
+}
+
+static int
+metaslab_rangestart64_compare(const void *x1, const void *x2)
+{
+	const range_seg64_t *r1 = x1;
+	const range_seg64_t *r2 = x2;
+
+	if (r1->rs_start < r2->rs_start)
+		return (-1);
+	if (r1->rs_start > r2->rs_start)
+		return (1);
+	return (0);
+}
+
+/*
+ * The size bucket of a segment: bucket i holds the free segments of
+ * 2^i to 2^(i+1) - 1 bytes.
+ */
+static zfs_btree_t *
+metaslab_bucket(metaslab_t *msp, range_tree_t *rt, range_seg_t *rs, int *idx)
+{
+	*idx = highbit64(rs_get_end(rs, rt) - rs_get_start(rs, rt)) - 1;
+	ASSERT3S(*idx, >=, 0);
+	ASSERT3S(*idx, <, MAX_LBAS);
+	return (&msp->ms_buckets[*idx]);
+}
+
 /*
  * Create any block allocator specific components. The current allocators
  * rely on using both a size-ordered range_tree_t and an array of uint64_t's.
@@ -999,8 +1076,22 @@ metaslab_rt_create(range_tree_t *rt, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT(msp->ms_tree == NULL);
 
-	avl_create(&msp->ms_size_tree, metaslab_rangesize_compare,
-	    sizeof (range_seg_t), offsetof(range_seg_t, rs_pp_node));
+	zfs_btree_create(&msp->ms_size_tree, rt->rt_type == RANGE_SEG32 ?
+	    metaslab_rangesize32_compare : metaslab_rangesize64_compare,
+	    range_seg_size(rt->rt_type));
+
+	if (msp->ms_bucketed) {
+		msp->ms_buckets = kmem_alloc(MAX_LBAS * sizeof (zfs_btree_t),
+		    KM_SLEEP);
+		for (int i = 0; i < MAX_LBAS; i++) {
+			zfs_btree_create(&msp->ms_buckets[i],
+			    rt->rt_type == RANGE_SEG32 ?
+			    metaslab_rangestart32_compare :
+			    metaslab_rangestart64_compare,
+			    range_seg_size(rt->rt_type));
+		}
+		msp->ms_bucket_mask = 0;
+	}
 }
 
 /*
@@ -1013,9 +1104,17 @@ metaslab_rt_destroy(range_tree_t *rt, void *arg)
 
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
-	ASSERT0(avl_numnodes(&msp->ms_size_tree));
+	ASSERT0(zfs_btree_numnodes(&msp->ms_size_tree));
 
-	avl_destroy(&msp->ms_size_tree);
+	zfs_btree_destroy(&msp->ms_size_tree);
+
+	if (msp->ms_buckets != NULL) {
+		ASSERT0(msp->ms_bucket_mask);
+		for (int i = 0; i < MAX_LBAS; i++)
+			zfs_btree_destroy(&msp->ms_buckets[i]);
+		kmem_free(msp->ms_buckets, MAX_LBAS * sizeof (zfs_btree_t));
+		msp->ms_buckets = NULL;
+	}
 }
 
 static void
@@ -1026,7 +1125,14 @@ metaslab_rt_add(range_tree_t *rt, range_seg_t *rs, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
 	VERIFY(!msp->ms_condensing);
-	avl_add(&msp->ms_size_tree, rs);
+	zfs_btree_add(&msp->ms_size_tree, rs);
+
+	if (msp->ms_buckets != NULL) {
+		int idx;
+
+		zfs_btree_add(metaslab_bucket(msp, rt, rs, &idx), rs);
+		msp->ms_bucket_mask |= 1ULL << idx;
+	}
 }
 
 static void
@@ -1037,7 +1143,17 @@ metaslab_rt_remove(range_tree_t *rt, range_seg_t *rs, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
 	VERIFY(!msp->ms_condensing);
-	avl_remove(&msp->ms_size_tree, rs);
+	zfs_btree_remove(&msp->ms_size_tree, rs);
+
+	if (msp->ms_buckets != NULL) {
+		zfs_btree_t *t;
+		int idx;
+
+		t = metaslab_bucket(msp, rt, rs, &idx);
+		zfs_btree_remove(t, rs);
+		if (zfs_btree_numnodes(t) == 0)
+			msp->ms_bucket_mask &= ~(1ULL << idx);
+	}
 }
 
 static void
@@ -1048,14 +1164,13 @@ metaslab_rt_vacate(range_tree_t *rt, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
 
-	/*
-	 * Normally one would walk the tree freeing nodes along the way.
-	 * Since the nodes are shared with the range trees we can avoid
-	 * walking all nodes and just reinitialize the avl tree. The nodes
-	 * will be freed by the range tree, so we don't want to free them here.
-	 */
-	avl_create(&msp->ms_size_tree, metaslab_rangesize_compare,
-	    sizeof (range_seg_t), offsetof(range_seg_t, rs_pp_node));
+	zfs_btree_clear(&msp->ms_size_tree);
+
+	if (msp->ms_buckets != NULL) {
+		for (int i = 0; i < MAX_LBAS; i++)
+			zfs_btree_clear(&msp->ms_buckets[i]);
+		msp->ms_bucket_mask = 0;
+	}
 }
 
 static range_tree_ops_t metaslab_rt_ops = {
@@ -1078,27 +1193,34 @@ static range_tree_ops_t metaslab_rt_ops = {
 uint64_t
 metaslab_block_maxsize(metaslab_t *msp)
 {
-	avl_tree_t *t = &msp->ms_size_tree;
+	zfs_btree_t *t = &msp->ms_size_tree;
 	range_seg_t *rs;
 
-	if (t == NULL || (rs = avl_last(t)) == NULL)
+	if (msp->ms_tree == NULL || (rs = zfs_btree_last(t, NULL)) == NULL)
 		return (0ULL);
 
-	return (rs->rs_end - rs->rs_start);
+	return (rs_get_end(rs, msp->ms_tree) - rs_get_start(rs, msp->ms_tree));
 }
 
+/*
+ * Find the first segment of t, which is either rt's own tree or its
+ * size-sorted twin, at or after [start, start + size).  The segments of
+ * both are laid out as rt's.
+ */
 static range_seg_t *
-metaslab_block_find(avl_tree_t *t, uint64_t start, uint64_t size)
+metaslab_block_find(zfs_btree_t *t, range_tree_t *rt, uint64_t start,
+    uint64_t size, zfs_btree_index_t *where)
 {
-	range_seg_t *rs, rsearch;
-	avl_index_t where;
+	range_seg_t *rs;
+	range_seg_max_t rsearch;
 
-	rsearch.rs_start = start;
-	rsearch.rs_end = start + size;
+	start = MAX(start, rt->rt_start);
+	rs_set_start(&rsearch, rt, start);
+	rs_set_end(&rsearch, rt, start + size);
 
-	rs = avl_find(t, &rsearch, &where);
+	rs = zfs_btree_find(t, &rsearch, where);
 	if (rs == NULL) {
-		rs = avl_nearest(t, where, AVL_AFTER);
+		rs = zfs_btree_next(t, where, where);
 	}
 	return (rs);
 }
@@ -1108,23 +1230,24 @@ metaslab_block_find(avl_tree_t *t, uint64_t start, uint64_t size)
     defined(WITH_CF_BLOCK_ALLOCATOR)
 /*
  * This is a helper function that can be used by the allocator to find
- * a suitable block to allocate. This will search the specified AVL
- * tree looking for a block that matches the specified criteria.
+ * a suitable block to allocate. This will search the specified B-tree
+ * looking for a block that matches the specified criteria.
  */
 static uint64_t
-metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
-    uint64_t align)
+metaslab_block_picker(zfs_btree_t *t, range_tree_t *rt, uint64_t *cursor,
+    uint64_t size, uint64_t align)
 {
-	range_seg_t *rs = metaslab_block_find(t, *cursor, size);
+	zfs_btree_index_t where;
+	range_seg_t *rs = metaslab_block_find(t, rt, *cursor, size, &where);
 
 	while (rs != NULL) {
-		uint64_t offset = P2ROUNDUP(rs->rs_start, align);
+		uint64_t offset = P2ROUNDUP(rs_get_start(rs, rt), align);
 
-		if (offset + size <= rs->rs_end) {
+		if (offset + size <= rs_get_end(rs, rt)) {
 			*cursor = offset + size;
 			return (offset);
 		}
-		rs = AVL_NEXT(t, rs);
+		rs = zfs_btree_next(t, &where, &where);
 	}
 
 	/*
@@ -1135,7 +1258,7 @@ metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
 		return (-1ULL);
 
 	*cursor = 0;
-	return (metaslab_block_picker(t, cursor, size, align));
+	return (metaslab_block_picker(t, rt, cursor, size, align));
 }
 #endif /* WITH_FF/DF/CF_BLOCK_ALLOCATOR */
 
@@ -1157,9 +1280,9 @@ metaslab_ff_alloc(metaslab_t *msp, uint64_t size)
 	 */
 	uint64_t align = size & -size;
 	uint64_t *cursor = &msp->ms_lbas[highbit64(align) - 1];
-	avl_tree_t *t = &msp->ms_tree->rt_root;
+	range_tree_t *rt = msp->ms_tree;
 
-	return (metaslab_block_picker(t, cursor, size, align));
+	return (metaslab_block_picker(&rt->rt_root, rt, cursor, size, align));
 }
 
 static metaslab_ops_t metaslab_ff_ops = {
@@ -1191,19 +1314,20 @@ metaslab_df_alloc(metaslab_t *msp, uint64_t size)
 	uint64_t align = size & -size;
 	uint64_t *cursor = &msp->ms_lbas[highbit64(align) - 1];
 	range_tree_t *rt = msp->ms_tree;
-	avl_tree_t *t = &rt->rt_root;
+	zfs_btree_t *t = &rt->rt_root;
 	uint64_t max_size = metaslab_block_maxsize(msp);
 	int free_pct = range_tree_space(rt) * 100 / msp->ms_size;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==, avl_numnodes(&msp->ms_size_tree));
+	ASSERT3U(zfs_btree_numnodes(t), ==,
+	    zfs_btree_numnodes(&msp->ms_size_tree));
 
 	if (max_size < size)
 		return (-1ULL);
 
 	/*
 	 * If we're running low on space switch to using the size
-	 * sorted AVL tree (best-fit).
+	 * sorted tree (best-fit).
 	 */
 	if (max_size < metaslab_df_alloc_threshold ||
 	    free_pct < metaslab_df_free_pct) {
@@ -1211,7 +1335,7 @@ metaslab_df_alloc(metaslab_t *msp, uint64_t size)
 		*cursor = 0;
 	}
 
-	return (metaslab_block_picker(t, cursor, size, 1ULL));
+	return (metaslab_block_picker(t, rt, cursor, size, 1ULL));
 }
 
 static metaslab_ops_t metaslab_df_ops = {
@@ -1235,25 +1359,26 @@ static uint64_t
 metaslab_cf_alloc(metaslab_t *msp, uint64_t size)
 {
 	range_tree_t *rt = msp->ms_tree;
-	avl_tree_t *t = &msp->ms_size_tree;
+	zfs_btree_t *t = &msp->ms_size_tree;
 	uint64_t *cursor = &msp->ms_lbas[0];
 	uint64_t *cursor_end = &msp->ms_lbas[1];
 	uint64_t offset = 0;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==, avl_numnodes(&rt->rt_root));
+	ASSERT3U(zfs_btree_numnodes(t), ==, zfs_btree_numnodes(&rt->rt_root));
 
 	ASSERT3U(*cursor_end, >=, *cursor);
 
 	if ((*cursor + size) > *cursor_end) {
 		range_seg_t *rs;
 
-		rs = avl_last(&msp->ms_size_tree);
-		if (rs == NULL || (rs->rs_end - rs->rs_start) < size)
+		rs = zfs_btree_last(t, NULL);
+		if (rs == NULL ||
+		    (rs_get_end(rs, rt) - rs_get_start(rs, rt)) < size)
 			return (-1ULL);
 
-		*cursor = rs->rs_start;
-		*cursor_end = rs->rs_end;
+		*cursor = rs_get_start(rs, rt);
+		*cursor_end = rs_get_end(rs, rt);
 	}
 
 	offset = *cursor;
@@ -1288,38 +1413,42 @@ uint64_t metaslab_ndf_clump_shift = 4;
 static uint64_t
 metaslab_ndf_alloc(metaslab_t *msp, uint64_t size)
 {
-	avl_tree_t *t = &msp->ms_tree->rt_root;
-	avl_index_t where;
-	range_seg_t *rs, rsearch;
+	range_tree_t *rt = msp->ms_tree;
+	zfs_btree_t *t = &rt->rt_root;
+	zfs_btree_index_t where;
+	range_seg_t *rs;
+	range_seg_max_t rsearch;
 	uint64_t hbit = highbit64(size);
 	uint64_t *cursor = &msp->ms_lbas[hbit - 1];
 	uint64_t max_size = metaslab_block_maxsize(msp);
+	uint64_t start = MAX(*cursor, rt->rt_start);
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==, avl_numnodes(&msp->ms_size_tree));
+	ASSERT3U(zfs_btree_numnodes(t), ==,
+	    zfs_btree_numnodes(&msp->ms_size_tree));
 
 	if (max_size < size)
 		return (-1ULL);
 
-	rsearch.rs_start = *cursor;
-	rsearch.rs_end = *cursor + size;
+	rs_set_start(&rsearch, rt, start);
+	rs_set_end(&rsearch, rt, start + size);
 
-	rs = avl_find(t, &rsearch, &where);
-	if (rs == NULL || (rs->rs_end - rs->rs_start) < size) {
+	rs = zfs_btree_find(t, &rsearch, &where);
+	if (rs == NULL || (rs_get_end(rs, rt) - rs_get_start(rs, rt)) < size) {
 		t = &msp->ms_size_tree;
 
-		rsearch.rs_start = 0;
-		rsearch.rs_end = MIN(max_size,
-		    1ULL << (hbit + metaslab_ndf_clump_shift));
-		rs = avl_find(t, &rsearch, &where);
+		rs_set_start(&rsearch, rt, rt->rt_start);
+		rs_set_end(&rsearch, rt, rt->rt_start + MIN(max_size,
+		    1ULL << (hbit + metaslab_ndf_clump_shift)));
+		rs = zfs_btree_find(t, &rsearch, &where);
 		if (rs == NULL)
-			rs = avl_nearest(t, where, AVL_AFTER);
+			rs = zfs_btree_next(t, &where, &where);
 		ASSERT(rs != NULL);
 	}
 
-	if ((rs->rs_end - rs->rs_start) >= size) {
-		*cursor = rs->rs_start + size;
-		return (rs->rs_start);
+	if ((rs_get_end(rs, rt) - rs_get_start(rs, rt)) >= size) {
+		*cursor = rs_get_start(rs, rt) + size;
+		return (rs_get_start(rs, rt));
 	}
 	return (-1ULL);
 }
@@ -1331,6 +1460,77 @@ static metaslab_ops_t metaslab_ndf_ops = {
 metaslab_ops_t *zfs_metaslab_ops = &metaslab_ndf_ops;
 #endif /* WITH_NDF_BLOCK_ALLOCATOR */
 
+/*
+ * ==========================================================================
+ * Size-bucketed allocator -
+ * Keep the free segments in power of 2 size buckets, each sorted by offset
+ * and with a cursor of its own.  An allocation comes from the smallest
+ * non-empty bucket whose segments are all large enough, at or after the
+ * bucket's cursor, so that allocations of similar sizes are laid out
+ * sequentially.  Finding the bucket takes a bitmap lookup; only when none
+ * will do does it fall back to a best-fit search of the size-sorted tree.
+ * ==========================================================================
+ */
+static uint64_t
+metaslab_bucket_alloc(metaslab_t *msp, uint64_t size)
+{
+	range_tree_t *rt = msp->ms_tree;
+	zfs_btree_index_t where;
+	zfs_btree_t *t;
+	range_seg_t *rs;
+	uint64_t *cursor, offset, mask;
+	int idx;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT3P(msp->ms_buckets, !=, NULL);
+	ASSERT3U(size, !=, 0);
+
+	/*
+	 * Every segment of bucket highbit64(size - 1) or above is at least
+	 * size bytes long.
+	 */
+	idx = highbit64(size - 1);
+	mask = (idx < MAX_LBAS) ? msp->ms_bucket_mask >> idx : 0;
+
+	if (mask == 0) {
+		rs = metaslab_block_find(&msp->ms_size_tree, rt, rt->rt_start,
+		    size, &where);
+		if (rs == NULL)
+			return (-1ULL);
+		ASSERT3U(rs_get_end(rs, rt) - rs_get_start(rs, rt), >=, size);
+		return (rs_get_start(rs, rt));
+	}
+
+	idx += highbit64(mask & -mask) - 1;
+	t = &msp->ms_buckets[idx];
+	cursor = &msp->ms_lbas[idx];
+
+	rs = metaslab_block_find(t, rt, *cursor, size, &where);
+	if (rs == NULL)
+		rs = zfs_btree_first(t, NULL);
+	ASSERT3P(rs, !=, NULL);
+
+	offset = rs_get_start(rs, rt);
+	ASSERT3U(rs_get_end(rs, rt) - offset, >=, size);
+	*cursor = offset + size;
+	return (offset);
+}
+
+static metaslab_ops_t metaslab_bucket_ops = {
+	metaslab_bucket_alloc
+};
+
+/*
+ * The block allocator for the metaslab classes of a pool being opened.
+ */
+metaslab_ops_t *
+metaslab_allocator_ops(void)
+{
+	if (metaslab_allocator == METASLAB_ALLOCATOR_BUCKET)
+		return (&metaslab_bucket_ops);
+	return (zfs_metaslab_ops);
+}
+
 
 /*
  * ==========================================================================
@@ -1338,6 +1538,38 @@ metaslab_ops_t *zfs_metaslab_ops = &metaslab_ndf_ops;
  * ==========================================================================
  */
 
+/*
+ * Net space allocated by the changes which are only in the log space maps,
+ * or zero once they have been written to the metaslab's space map.
+ */
+static int64_t
+metaslab_unflushed_space(metaslab_t *msp)
+{
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (msp->ms_flushing)
+		return (0);
+	return ((int64_t)range_tree_space(msp->ms_unflushed_allocs) -
+	    (int64_t)range_tree_space(msp->ms_unflushed_frees));
+}
+
+static int64_t
+metaslab_unflushed_segs(metaslab_t *msp)
+{
+	return (range_tree_numsegs(msp->ms_unflushed_allocs) +
+	    range_tree_numsegs(msp->ms_unflushed_frees));
+}
+
+/*
+ * Returns the space allocated in the metaslab as of the last synced txg,
+ * including what is allocated by its unflushed changes.
+ */
+uint64_t
+metaslab_allocated_space(metaslab_t *msp)
+{
+	return (space_map_allocated(msp->ms_sm) + msp->ms_unflushed_space);
+}
+
 /*
  * Wait for any in-progress metaslab loads to complete.
  */
@@ -1379,13 +1611,37 @@ metaslab_load(metaslab_t *msp)
 	msp->ms_loading = B_FALSE;
 
 	if (success) {
+		range_tree_t *freed = msp->ms_freedtree;
+		zfs_btree_index_t where;
+		range_seg_t *rs;
+
 		ASSERT3P(msp->ms_group, !=, NULL);
 		msp->ms_loaded = B_TRUE;
 
+		/*
+		 * Apply the changes which are only in the log space maps.
+		 */
+		range_tree_walk(msp->ms_unflushed_allocs,
+		    range_tree_remove, msp->ms_tree);
+		range_tree_walk(msp->ms_unflushed_frees,
+		    range_tree_add, msp->ms_tree);
+
 		for (t = 0; t < TXG_DEFER_SIZE; t++) {
 			range_tree_walk(msp->ms_defertree[t],
 			    range_tree_remove, msp->ms_tree);
 		}
+
+		/*
+		 * If we are loading in the middle of a sync, the frees of
+		 * this txg are in ms_unflushed_frees if they were logged,
+		 * but they must not be allocated before they go through
+		 * the defer trees.
+		 */
+		for (rs = zfs_btree_first(&freed->rt_root, &where); rs != NULL;
+		    rs = zfs_btree_next(&freed->rt_root, &where, &where)) {
+			range_tree_clear(msp->ms_tree, rs_get_start(rs, freed),
+			    rs_get_end(rs, freed) - rs_get_start(rs, freed));
+		}
 		msp->ms_max_size = metaslab_block_maxsize(msp);
 	}
 	cv_broadcast(&msp->ms_load_cv);
@@ -1402,6 +1658,22 @@ metaslab_unload(metaslab_t *msp)
 	msp->ms_max_size = 0;
 }
 
+/*
+ * The range trees of a metaslab keep their segments relative to its start
+ * and in units of the vdev's sectors, which takes 32 bits for any metaslab
+ * of fewer than 2^32 sectors.
+ */
+static range_tree_t *
+metaslab_range_tree_create(metaslab_t *msp, vdev_t *vd, range_tree_ops_t *ops,
+    void *arg)
+{
+	range_seg_type_t type = (vd->vdev_ms_shift - vd->vdev_ashift < 32) ?
+	    RANGE_SEG32 : RANGE_SEG64;
+
+	return (range_tree_create_impl(ops, type, arg, msp->ms_start,
+	    vd->vdev_ashift, &msp->ms_lock));
+}
+
 int
 metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
     metaslab_t **msp)
@@ -1417,6 +1689,7 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	ms->ms_id = id;
 	ms->ms_start = id << vd->vdev_ms_shift;
 	ms->ms_size = 1ULL << vd->vdev_ms_shift;
+	ms->ms_bucketed = (mg->mg_class->mc_ops == &metaslab_bucket_ops);
 
 	/*
 	 * We only open space map objects that already exist. All others
@@ -1441,7 +1714,10 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	 * addition of new space; and for debugging, it ensures that we'd
 	 * data fault on any attempt to use this metaslab before it's ready.
 	 */
-	ms->ms_tree = range_tree_create(&metaslab_rt_ops, ms, &ms->ms_lock);
+	ms->ms_tree = metaslab_range_tree_create(ms, vd, &metaslab_rt_ops, ms);
+	ms->ms_trim = metaslab_range_tree_create(ms, vd, NULL, ms);
+	ms->ms_unflushed_allocs = metaslab_range_tree_create(ms, vd, NULL, ms);
+	ms->ms_unflushed_frees = metaslab_range_tree_create(ms, vd, NULL, ms);
 	metaslab_group_add(mg, ms);
 
 	metaslab_set_fragmentation(ms);
@@ -1490,12 +1766,23 @@ metaslab_fini(metaslab_t *msp)
 
 	mutex_enter(&msp->ms_lock);
 	VERIFY(msp->ms_group == NULL);
-	vdev_space_update(mg->mg_vd, -space_map_allocated(msp->ms_sm),
+	vdev_space_update(mg->mg_vd, -metaslab_allocated_space(msp),
 	    0, -msp->ms_size);
 	space_map_close(msp->ms_sm);
 
+	spa_log_sm_segments_update(mg->mg_vd->vdev_spa,
+	    -metaslab_unflushed_segs(msp));
+	spa_log_sm_metaslab_flushed(msp);
+	range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
+	range_tree_destroy(msp->ms_unflushed_allocs);
+	range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
+	range_tree_destroy(msp->ms_unflushed_frees);
+
 	metaslab_unload(msp);
 	range_tree_destroy(msp->ms_tree);
+	ASSERT0(msp->ms_trimming);
+	range_tree_vacate(msp->ms_trim, NULL, NULL);
+	range_tree_destroy(msp->ms_trim);
 	range_tree_destroy(msp->ms_freeingtree);
 	range_tree_destroy(msp->ms_freedtree);
 
@@ -1654,7 +1941,7 @@ metaslab_space_weight(metaslab_t *msp)
 	/*
 	 * The baseline weight is the metaslab's free space.
 	 */
-	space = msp->ms_size - space_map_allocated(msp->ms_sm);
+	space = msp->ms_size - metaslab_allocated_space(msp);
 
 	if (metaslab_fragmentation_factor_enabled &&
 	    msp->ms_fragmentation != ZFS_FRAG_INVALID) {
@@ -1758,14 +2045,29 @@ metaslab_weight_from_range_tree(metaslab_t *msp)
 static uint64_t
 metaslab_weight_from_spacemap(metaslab_t *msp)
 {
+	space_map_t *sm = msp->ms_sm;
+	range_tree_t *rt = msp->ms_unflushed_frees;
+	uint64_t histogram[SPACE_MAP_HISTOGRAM_SIZE];
 	uint64_t weight = 0;
+	int i;
+
+	/*
+	 * The on-disk histogram does not know of the frees which are only
+	 * in the log space maps yet, so add theirs, normalized the same way
+	 * as in space_map_histogram_add().
+	 */
+	bcopy(sm->sm_phys->smp_histogram, histogram, sizeof (histogram));
+	for (i = sm->sm_shift; i < RANGE_TREE_HISTOGRAM_SIZE; i++) {
+		int idx = MIN(i - sm->sm_shift, SPACE_MAP_HISTOGRAM_SIZE - 1);
+
+		histogram[idx] += rt->rt_histogram[i] <<
+		    (i - idx - sm->sm_shift);
+	}
 
-	for (int i = SPACE_MAP_HISTOGRAM_SIZE - 1; i >= 0; i--) {
-		if (msp->ms_sm->sm_phys->smp_histogram[i] != 0) {
-			WEIGHT_SET_COUNT(weight,
-			    msp->ms_sm->sm_phys->smp_histogram[i]);
-			WEIGHT_SET_INDEX(weight, i +
-			    msp->ms_sm->sm_shift);
+	for (i = SPACE_MAP_HISTOGRAM_SIZE - 1; i >= 0; i--) {
+		if (histogram[i] != 0) {
+			WEIGHT_SET_COUNT(weight, histogram[i]);
+			WEIGHT_SET_INDEX(weight, i + sm->sm_shift);
 			WEIGHT_SET_ACTIVE(weight, 0);
 			break;
 		}
@@ -1790,7 +2092,7 @@ metaslab_segment_weight(metaslab_t *msp)
 	/*
 	 * The metaslab is completely free.
 	 */
-	if (space_map_allocated(msp->ms_sm) == 0) {
+	if (metaslab_allocated_space(msp) == 0) {
 		int idx = highbit64(msp->ms_size) - 1;
 		int max_idx = SPACE_MAP_HISTOGRAM_SIZE + shift - 1;
 
@@ -1812,7 +2114,7 @@ metaslab_segment_weight(metaslab_t *msp)
 	/*
 	 * If the metaslab is fully allocated then just make the weight 0.
 	 */
-	if (space_map_allocated(msp->ms_sm) == msp->ms_size)
+	if (metaslab_allocated_space(msp) == msp->ms_size)
 		return (0);
 	/*
 	 * If the metaslab is already loaded, then use the range tree to
@@ -1882,7 +2184,7 @@ metaslab_weight(metaslab_t *msp)
 	 * for us to do here.
 	 */
 	if (vd->vdev_removing) {
-		ASSERT0(space_map_allocated(msp->ms_sm));
+		ASSERT0(metaslab_allocated_space(msp));
 		ASSERT0(vd->vdev_ms_shift);
 		return (0);
 	}
@@ -2087,7 +2389,7 @@ metaslab_should_condense(metaslab_t *msp)
 	 * metaslabs that are empty and metaslabs for which a condense
 	 * request has been made.
 	 */
-	rs = avl_last(&msp->ms_size_tree);
+	rs = zfs_btree_last(&msp->ms_size_tree, NULL);
 	if (rs == NULL || msp->ms_condense_wanted)
 		return (B_TRUE);
 
@@ -2097,11 +2399,12 @@ metaslab_should_condense(metaslab_t *msp)
 	 * larger on-disk than the entire current on-disk structure, then
 	 * clearly condensing will increase the on-disk structure size.
 	 */
-	size = (rs->rs_end - rs->rs_start) >> sm->sm_shift;
+	size = (rs_get_end(rs, msp->ms_tree) -
+	    rs_get_start(rs, msp->ms_tree)) >> sm->sm_shift;
 	entries = size / (MIN(size, SM_RUN_MAX));
 	segsz = entries * sizeof (uint64_t);
 
-	optimal_size = sizeof (uint64_t) * avl_numnodes(&msp->ms_tree->rt_root);
+	optimal_size = sizeof (uint64_t) * range_tree_numsegs(msp->ms_tree);
 	object_size = space_map_length(msp->ms_sm);
 
 	dmu_object_info_from_db(sm->sm_dbuf, &doi);
@@ -2133,7 +2436,7 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	spa_dbgmsg(spa, "condensing: txg %llu, msp[%llu] %p, "
 	    "smp size %llu, segments %lu, forcing condense=%s", txg,
 	    msp->ms_id, msp, space_map_length(msp->ms_sm),
-	    avl_numnodes(&msp->ms_tree->rt_root),
+	    range_tree_numsegs(msp->ms_tree),
 	    msp->ms_condense_wanted ? "TRUE" : "FALSE");
 
 	msp->ms_condense_wanted = B_FALSE;
@@ -2145,7 +2448,8 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	 * a relatively inexpensive operation since we expect these trees to
 	 * have a small number of nodes.
 	 */
-	condense_tree = range_tree_create(NULL, NULL, &msp->ms_lock);
+	condense_tree = metaslab_range_tree_create(msp, msp->ms_group->mg_vd,
+	    NULL, NULL);
 	range_tree_add(condense_tree, msp->ms_start, msp->ms_size);
 
 	/*
@@ -2198,6 +2502,76 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	msp->ms_condensing = B_FALSE;
 }
 
+/*
+ * Decide whether the changes of this sync pass go to the pool's log space
+ * map or to the metaslab's own space map, flushing it.  A metaslab is
+ * flushed when spa_flush_metaslabs() asked for it or when it condenses,
+ * and always in sync pass 1, so that it stays flushed for the rest of the
+ * txg: changes logged in a txg the space map was flushed in would not be
+ * replayed.
+ */
+static boolean_t
+metaslab_should_log(metaslab_t *msp)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (!spa_log_sm_enabled(spa) || vd->vdev_islog ||
+	    msp->ms_sm == NULL ||
+	    msp->ms_sm->sm_dbuf->db_size != sizeof (space_map_phys_t))
+		return (B_FALSE);
+
+	if (msp->ms_flushing ||
+	    space_map_flush_txg(msp->ms_sm) == spa_syncing_txg(spa))
+		return (B_FALSE);
+
+	if (spa_sync_pass(spa) > 1)
+		return (B_TRUE);
+
+	return (!msp->ms_flush_wanted &&
+	    !(msp->ms_loaded && metaslab_should_condense(msp)));
+}
+
+/*
+ * Append this sync pass's allocs and frees to the log space map of the
+ * txg and fold them into the metaslab's unflushed changes.
+ */
+static void
+metaslab_sync_log(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+	range_tree_t *alloctree = msp->ms_alloctree[txg & TXG_MASK];
+	hrtime_t start = gethrtime();
+	int64_t segs;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (range_tree_space(alloctree) == 0 &&
+	    range_tree_space(msp->ms_freeingtree) == 0)
+		return;
+
+	spa_log_sm_write(spa, alloctree, SM_ALLOC, vd->vdev_id, tx);
+	spa_log_sm_write(spa, msp->ms_freeingtree, SM_FREE, vd->vdev_id, tx);
+
+	/*
+	 * An alloc cancels an unflushed free of the same range, and a free
+	 * an unflushed alloc; whatever remains is a new unflushed change.
+	 */
+	segs = metaslab_unflushed_segs(msp);
+	range_tree_remove_xor_add(alloctree, msp->ms_unflushed_frees,
+	    msp->ms_unflushed_allocs);
+	range_tree_remove_xor_add(msp->ms_freeingtree, msp->ms_unflushed_allocs,
+	    msp->ms_unflushed_frees);
+	spa_log_sm_segments_update(spa, metaslab_unflushed_segs(msp) - segs);
+	spa_log_sm_metaslab_logged(msp, txg);
+
+	LSMS_STAT_BUMP(lsms_metaslabs_logged);
+	LSMS_STAT_INCR(lsms_logged_sync_ns, gethrtime() - start);
+}
+
 /*
  * Write a metaslab to disk in the context of the specified transaction group.
  */
@@ -2211,6 +2585,7 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	range_tree_t *alloctree = msp->ms_alloctree[txg & TXG_MASK];
 	dmu_tx_t *tx;
 	uint64_t object = space_map_object(msp->ms_sm);
+	hrtime_t start;
 
 	ASSERT(!vd->vdev_ishole);
 
@@ -2234,7 +2609,8 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	 */
 	if (range_tree_space(alloctree) == 0 &&
 	    range_tree_space(msp->ms_freeingtree) == 0 &&
-	    !(msp->ms_loaded && msp->ms_condense_wanted))
+	    !(msp->ms_loaded && msp->ms_condense_wanted) &&
+	    !msp->ms_flush_wanted)
 		return;
 
 
@@ -2266,6 +2642,12 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 
 	mutex_enter(&msp->ms_lock);
 
+	if (metaslab_should_log(msp)) {
+		metaslab_sync_log(msp, txg, tx);
+		goto done;
+	}
+	start = gethrtime();
+
 	/*
 	 * Note: metaslab_condense() clears the space map's histogram.
 	 * Therefore we muse verify and remove this histogram before
@@ -2279,10 +2661,35 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	    metaslab_should_condense(msp)) {
 		metaslab_condense(msp, txg, tx);
 	} else {
+		/*
+		 * Flush the changes which are only in the log space maps
+		 * first, unless an earlier pass of this txg already did.
+		 */
+		if (!msp->ms_flushing) {
+			space_map_write(msp->ms_sm, msp->ms_unflushed_allocs,
+			    SM_ALLOC, tx);
+			space_map_write(msp->ms_sm, msp->ms_unflushed_frees,
+			    SM_FREE, tx);
+			if (!msp->ms_loaded) {
+				space_map_histogram_add(msp->ms_sm,
+				    msp->ms_unflushed_frees, tx);
+			}
+		}
 		space_map_write(msp->ms_sm, alloctree, SM_ALLOC, tx);
 		space_map_write(msp->ms_sm, msp->ms_freeingtree, SM_FREE, tx);
 	}
 
+	/*
+	 * The space map is now up to date; the unflushed changes are
+	 * dropped in metaslab_sync_done(), once it has synced.
+	 */
+	space_map_set_flush_txg(msp->ms_sm, txg, tx);
+	if (msp->ms_unflushed_txg != 0 && !msp->ms_flushing) {
+		msp->ms_flushing = B_TRUE;
+		LSMS_STAT_BUMP(lsms_metaslabs_flushed);
+	}
+	msp->ms_flush_wanted = B_FALSE;
+
 	if (msp->ms_loaded) {
 		/*
 		 * When the space map is loaded, we have an accruate
@@ -2328,6 +2735,10 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	metaslab_group_histogram_verify(mg);
 	metaslab_class_histogram_verify(mg->mg_class);
 
+	if (spa_log_sm_enabled(spa))
+		LSMS_STAT_INCR(lsms_flushed_sync_ns, gethrtime() - start);
+
+done:
 	/*
 	 * For sync pass 1, we avoid traversing this txg's free range tree
 	 * and instead will just swap the pointers for freeingtree and
@@ -2383,23 +2794,23 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 		for (t = 0; t < TXG_SIZE; t++) {
 			ASSERT(msp->ms_alloctree[t] == NULL);
 
-			msp->ms_alloctree[t] = range_tree_create(NULL, msp,
-			    &msp->ms_lock);
+			msp->ms_alloctree[t] = metaslab_range_tree_create(msp,
+			    vd, NULL, msp);
 		}
 
 		ASSERT3P(msp->ms_freeingtree, ==, NULL);
-		msp->ms_freeingtree = range_tree_create(NULL, msp,
-		    &msp->ms_lock);
+		msp->ms_freeingtree = metaslab_range_tree_create(msp, vd,
+		    NULL, msp);
 
 		ASSERT3P(msp->ms_freedtree, ==, NULL);
-		msp->ms_freedtree = range_tree_create(NULL, msp,
-		    &msp->ms_lock);
+		msp->ms_freedtree = metaslab_range_tree_create(msp, vd,
+		    NULL, msp);
 
 		for (t = 0; t < TXG_DEFER_SIZE; t++) {
 			ASSERT(msp->ms_defertree[t] == NULL);
 
-			msp->ms_defertree[t] = range_tree_create(NULL, msp,
-			    &msp->ms_lock);
+			msp->ms_defertree[t] = metaslab_range_tree_create(msp,
+			    vd, NULL, msp);
 		}
 
 		vdev_space_update(vd, 0, 0, msp->ms_size);
@@ -2414,7 +2825,9 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	}
 
 	defer_delta = 0;
-	alloc_delta = space_map_alloc_delta(msp->ms_sm);
+	alloc_delta = space_map_alloc_delta(msp->ms_sm) +
+	    metaslab_unflushed_space(msp) - msp->ms_unflushed_space;
+	msp->ms_unflushed_space = metaslab_unflushed_space(msp);
 	if (defer_allowed) {
 		defer_delta = range_tree_space(msp->ms_freedtree) -
 		    range_tree_space(*defer_tree);
@@ -2430,6 +2843,19 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 */
 	metaslab_load_wait(msp);
 
+	/*
+	 * With autotrim on, remember the frees about to go back into
+	 * circulation so that the autotrim thread can trim them unless
+	 * they are allocated again first.
+	 */
+	if (spa_get_autotrim(spa)) {
+		range_tree_walk(*defer_tree, range_tree_add, msp->ms_trim);
+		if (!defer_allowed) {
+			range_tree_walk(msp->ms_freedtree, range_tree_add,
+			    msp->ms_trim);
+		}
+	}
+
 	/*
 	 * Move the frees from the defer_tree back to the free
 	 * range tree (if it's loaded). Swap the freed_tree and the
@@ -2447,6 +2873,19 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 
 	space_map_update(msp->ms_sm);
 
+	/*
+	 * A metaslab flushed in this txg has its log space map entries
+	 * in its own space map now, so they can be dropped.
+	 */
+	if (msp->ms_flushing) {
+		spa_log_sm_segments_update(spa,
+		    -metaslab_unflushed_segs(msp));
+		range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
+		range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
+		spa_log_sm_metaslab_flushed(msp);
+		msp->ms_flushing = B_FALSE;
+	}
+
 	msp->ms_deferspace += defer_delta;
 	ASSERT3S(msp->ms_deferspace, >=, 0);
 	ASSERT3S(msp->ms_deferspace, <=, msp->ms_size);
@@ -2482,6 +2921,59 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	mutex_exit(&msp->ms_lock);
 }
 
+/*
+ * Apply an entry of a log space map, written in the given txg, to the
+ * unflushed changes of the metaslab. Entries from txgs that the metaslab
+ * has since flushed to its own space map are already accounted for there.
+ */
+void
+metaslab_unflushed_replay(metaslab_t *msp, uint64_t txg, maptype_t type,
+    uint64_t start, uint64_t size)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+	int64_t segs;
+
+	if (msp->ms_sm == NULL || txg <= space_map_flush_txg(msp->ms_sm))
+		return;
+
+	mutex_enter(&msp->ms_lock);
+	segs = metaslab_unflushed_segs(msp);
+	if (type == SM_ALLOC) {
+		range_tree_remove_xor_add_segment(start, start + size,
+		    msp->ms_unflushed_frees, msp->ms_unflushed_allocs);
+	} else {
+		range_tree_remove_xor_add_segment(start, start + size,
+		    msp->ms_unflushed_allocs, msp->ms_unflushed_frees);
+	}
+	spa_log_sm_segments_update(spa, metaslab_unflushed_segs(msp) - segs);
+	spa_log_sm_metaslab_logged(msp, txg);
+	mutex_exit(&msp->ms_lock);
+}
+
+/*
+ * Called once all the log space maps have been replayed to account for
+ * the unflushed changes of the metaslab in its space and weight.
+ */
+void
+metaslab_unflushed_replay_done(metaslab_t *msp)
+{
+	metaslab_group_t *mg = msp->ms_group;
+	vdev_t *vd = mg->mg_vd;
+	int64_t delta;
+
+	mutex_enter(&msp->ms_lock);
+	delta = metaslab_unflushed_space(msp) - msp->ms_unflushed_space;
+	msp->ms_unflushed_space += delta;
+	vdev_space_update(vd, delta, 0, 0);
+
+	if (msp->ms_loaded) {
+		metaslab_unload(msp);
+		VERIFY0(metaslab_load(msp));
+	}
+	metaslab_group_sort(mg, msp, metaslab_weight(msp));
+	mutex_exit(&msp->ms_lock);
+}
+
 void
 metaslab_sync_reassess(metaslab_group_t *mg)
 {
@@ -2511,6 +3003,79 @@ metaslab_distance(metaslab_t *msp, dva_t *dva)
 	return (0);
 }
 
+/*
+ * ==========================================================================
+ * Metaslab allocator statistics
+ * ==========================================================================
+ */
+
+/*
+ * The time taken by the block allocator to pick each block, in power of 2
+ * buckets: msas_lat[i] counts the picks of 2^(i+8) to 2^(i+9) - 1 ns, the
+ * first and last buckets also those below and above them.
+ */
+#define	METASLAB_LAT_SHIFT	8
+#define	METASLAB_LAT_BUCKETS	24
+
+typedef struct metaslab_alloc_stats {
+	kstat_named_t	msas_allocs;
+	kstat_named_t	msas_failures;
+	kstat_named_t	msas_ns;
+	kstat_named_t	msas_lat[METASLAB_LAT_BUCKETS];
+} metaslab_alloc_stats_t;
+
+static metaslab_alloc_stats_t metaslab_alloc_stats;
+static kstat_t *metaslab_alloc_ksp;
+
+void
+metaslab_stat_init(void)
+{
+	char name[KSTAT_STRLEN];
+
+	kstat_named_init(&metaslab_alloc_stats.msas_allocs, "allocs",
+	    KSTAT_DATA_UINT64);
+	kstat_named_init(&metaslab_alloc_stats.msas_failures, "failures",
+	    KSTAT_DATA_UINT64);
+	kstat_named_init(&metaslab_alloc_stats.msas_ns, "alloc_ns",
+	    KSTAT_DATA_UINT64);
+	for (int i = 0; i < METASLAB_LAT_BUCKETS; i++) {
+		(void) snprintf(name, sizeof (name), "lat_%lluns",
+		    (i == 0) ? 0ULL : 1ULL << (i + METASLAB_LAT_SHIFT));
+		kstat_named_init(&metaslab_alloc_stats.msas_lat[i], name,
+		    KSTAT_DATA_UINT64);
+	}
+
+	metaslab_alloc_ksp = kstat_create("zfs", 0, "metaslab_alloc_stats",
+	    "misc", KSTAT_TYPE_NAMED, sizeof (metaslab_alloc_stats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (metaslab_alloc_ksp != NULL) {
+		metaslab_alloc_ksp->ks_data = &metaslab_alloc_stats;
+		kstat_install(metaslab_alloc_ksp);
+	}
+}
+
+void
+metaslab_stat_fini(void)
+{
+	if (metaslab_alloc_ksp != NULL) {
+		kstat_delete(metaslab_alloc_ksp);
+		metaslab_alloc_ksp = NULL;
+	}
+}
+
+static void
+metaslab_alloc_stat_update(hrtime_t delta, boolean_t failed)
+{
+	int idx = highbit64(delta) - METASLAB_LAT_SHIFT - 1;
+
+	idx = MIN(MAX(idx, 0), METASLAB_LAT_BUCKETS - 1);
+	atomic_inc_64(&metaslab_alloc_stats.msas_allocs.value.ui64);
+	if (failed)
+		atomic_inc_64(&metaslab_alloc_stats.msas_failures.value.ui64);
+	atomic_add_64(&metaslab_alloc_stats.msas_ns.value.ui64, delta);
+	atomic_inc_64(&metaslab_alloc_stats.msas_lat[idx].value.ui64);
+}
+
 /*
  * ==========================================================================
  * Metaslab allocation tracing facility
@@ -2673,10 +3238,13 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 	uint64_t start;
 	range_tree_t *rt = msp->ms_tree;
 	metaslab_class_t *mc = msp->ms_group->mg_class;
+	hrtime_t begin;
 
 	VERIFY(!msp->ms_condensing);
 
+	begin = gethrtime();
 	start = mc->mc_ops->msop_alloc(msp, size);
+	metaslab_alloc_stat_update(gethrtime() - begin, start == -1ULL);
 	if (start != -1ULL) {
 		metaslab_group_t *mg = msp->ms_group;
 		vdev_t *vd = mg->mg_vd;
@@ -2685,6 +3253,7 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 		VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
 		VERIFY3U(range_tree_space(rt) - size, <=, msp->ms_size);
 		range_tree_remove(rt, start, size);
+		range_tree_clear(msp->ms_trim, start, size);
 
 		if (range_tree_space(msp->ms_alloctree[txg & TXG_MASK]) == 0)
 			vdev_dirty(mg->mg_vd, VDD_METASLAB, msp, txg);
@@ -2763,12 +3332,18 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 			if (msp->ms_condensing)
 				continue;
 
+			/*
+			 * Nor can we allocate from one being trimmed.
+			 */
+			if (msp->ms_trimming > 0)
+				continue;
+
 			was_active = msp->ms_weight & METASLAB_ACTIVE_MASK;
 			if (activation_weight == METASLAB_WEIGHT_PRIMARY)
 				break;
 
 			target_distance = min_distance +
-			    (space_map_allocated(msp->ms_sm) != 0 ? 0 :
+			    (metaslab_allocated_space(msp) != 0 ? 0 :
 			    min_distance >> 1);
 
 			for (i = 0; i < d; i++) {
@@ -2842,6 +3417,20 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 			continue;
 		}
 
+		/*
+		 * Likewise, ranges of a metaslab that is being trimmed must
+		 * not be allocated until the trim i/o has completed, so
+		 * passivate it and pick again.
+		 */
+		if (msp->ms_trimming > 0) {
+			metaslab_trace_add(zal, mg, msp, asize, d,
+			    TRACE_TRIMMING);
+			metaslab_passivate(msp,
+			    msp->ms_weight & ~METASLAB_ACTIVE_MASK);
+			mutex_exit(&msp->ms_lock);
+			continue;
+		}
+
 		offset = metaslab_block_alloc(msp, asize, txg);
 		metaslab_trace_add(zal, mg, msp, asize, d, offset);
 
@@ -3288,6 +3877,7 @@ metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
 	VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
 	VERIFY3U(range_tree_space(msp->ms_tree) - size, <=, msp->ms_size);
 	range_tree_remove(msp->ms_tree, offset, size);
+	range_tree_clear(msp->ms_trim, offset, size);
 
 	if (spa_writeable(spa)) {	/* don't dirty if we're zdb(1M) */
 		if (range_tree_space(msp->ms_alloctree[txg & TXG_MASK]) == 0)
@@ -33,33 +33,17 @@
 #include <sys/zio.h>
 #include <sys/range_tree.h>
 
-kmem_cache_t *range_seg_cache;
-
-void
-range_tree_init(void)
-{
-	ASSERT(range_seg_cache == NULL);
-	range_seg_cache = kmem_cache_create("range_seg_cache",
-	    sizeof (range_seg_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
-}
-
-void
-range_tree_fini(void)
-{
-	kmem_cache_destroy(range_seg_cache);
-	range_seg_cache = NULL;
-}
-
 void
 range_tree_stat_verify(range_tree_t *rt)
 {
 	range_seg_t *rs;
+	zfs_btree_index_t where;
 	uint64_t hist[RANGE_TREE_HISTOGRAM_SIZE] = { 0 };
 	int i;
 
-	for (rs = avl_first(&rt->rt_root); rs != NULL;
-	    rs = AVL_NEXT(&rt->rt_root, rs)) {
-		uint64_t size = rs->rs_end - rs->rs_start;
+	for (rs = zfs_btree_first(&rt->rt_root, &where); rs != NULL;
+	    rs = zfs_btree_next(&rt->rt_root, &where, &where)) {
+		uint64_t size = rs_get_end(rs, rt) - rs_get_start(rs, rt);
 		int idx	= highbit64(size) - 1;
 
 		hist[idx]++;
@@ -78,7 +62,7 @@ range_tree_stat_verify(range_tree_t *rt)
 static void
 range_tree_stat_incr(range_tree_t *rt, range_seg_t *rs)
 {
-	uint64_t size = rs->rs_end - rs->rs_start;
+	uint64_t size = rs_get_end(rs, rt) - rs_get_start(rs, rt);
 	int idx = highbit64(size) - 1;
 
 	ASSERT(size != 0);
@@ -93,7 +77,7 @@ range_tree_stat_incr(range_tree_t *rt, range_seg_t *rs)
 static void
 range_tree_stat_decr(range_tree_t *rt, range_seg_t *rs)
 {
-	uint64_t size = rs->rs_end - rs->rs_start;
+	uint64_t size = rs_get_end(rs, rt) - rs_get_start(rs, rt);
 	int idx = highbit64(size) - 1;
 
 	ASSERT(size != 0);
@@ -109,10 +93,29 @@ range_tree_stat_decr(range_tree_t *rt, range_seg_t *rs)
  * NOTE: caller is responsible for all locking.
  */
 static int
-range_tree_seg_compare(const void *x1, const void *x2)
+range_tree_seg32_compare(const void *x1, const void *x2)
+{
+	const range_seg32_t *r1 = x1;
+	const range_seg32_t *r2 = x2;
+
+	if (r1->rs_start < r2->rs_start) {
+		if (r1->rs_end > r2->rs_start)
+			return (0);
+		return (-1);
+	}
+	if (r1->rs_start > r2->rs_start) {
+		if (r1->rs_start < r2->rs_end)
+			return (0);
+		return (1);
+	}
+	return (0);
+}
+
+static int
+range_tree_seg64_compare(const void *x1, const void *x2)
 {
-	const range_seg_t *r1 = x1;
-	const range_seg_t *r2 = x2;
+	const range_seg64_t *r1 = x1;
+	const range_seg64_t *r2 = x2;
 
 	if (r1->rs_start < r2->rs_start) {
 		if (r1->rs_end > r2->rs_start)
@@ -127,16 +130,29 @@ range_tree_seg_compare(const void *x1, const void *x2)
 	return (0);
 }
 
+/*
+ * Create a range tree whose segments are of the given type, relative to
+ * start and in units of 2^shift bytes: every range added to or removed
+ * from it must be aligned to that.
+ */
 range_tree_t *
-range_tree_create(range_tree_ops_t *ops, void *arg, kmutex_t *lp)
+range_tree_create_impl(range_tree_ops_t *ops, range_seg_type_t type,
+    void *arg, uint64_t start, uint64_t shift, kmutex_t *lp)
 {
 	range_tree_t *rt;
 
+	ASSERT3U(type, <, RANGE_SEG_NUM_TYPES);
+	ASSERT3U(shift, <, 64);
+
 	rt = kmem_zalloc(sizeof (range_tree_t), KM_SLEEP);
 
-	avl_create(&rt->rt_root, range_tree_seg_compare,
-	    sizeof (range_seg_t), offsetof(range_seg_t, rs_node));
+	zfs_btree_create(&rt->rt_root, type == RANGE_SEG32 ?
+	    range_tree_seg32_compare : range_tree_seg64_compare,
+	    range_seg_size(type));
 
+	rt->rt_type = type;
+	rt->rt_start = start;
+	rt->rt_shift = shift;
 	rt->rt_lock = lp;
 	rt->rt_ops = ops;
 	rt->rt_arg = arg;
@@ -147,6 +163,12 @@ range_tree_create(range_tree_ops_t *ops, void *arg, kmutex_t *lp)
 	return (rt);
 }
 
+range_tree_t *
+range_tree_create(range_tree_ops_t *ops, void *arg, kmutex_t *lp)
+{
+	return (range_tree_create_impl(ops, RANGE_SEG64, arg, 0, 0, lp));
+}
+
 void
 range_tree_destroy(range_tree_t *rt)
 {
@@ -163,7 +185,8 @@ range_tree_destroy(range_tree_t *rt)
 	if (rt->rt_ops != NULL)
 		rt->rt_ops->rtop_destroy(rt, rt->rt_arg);
 
-	avl_destroy(&rt->rt_root);
+	zfs_btree_clear(&rt->rt_root);
+	zfs_btree_destroy(&rt->rt_root);
 	kmem_free(rt, sizeof (*rt));
 }
 
@@ -171,19 +194,21 @@ void
 range_tree_add(void *arg, uint64_t start, uint64_t size)
 {
 	range_tree_t *rt = arg;
-	avl_index_t where;
-	range_seg_t rsearch, *rs_before, *rs_after, *rs;
+	zfs_btree_index_t where, where_before, where_after;
+	range_seg_max_t rsearch, rsnew;
+	range_seg_t *rs_before, *rs_after, *rs;
 	uint64_t end = start + size;
 	boolean_t merge_before, merge_after;
 
 	ASSERT(MUTEX_HELD(rt->rt_lock));
 	VERIFY(size != 0);
 
-	rsearch.rs_start = start;
-	rsearch.rs_end = end;
-	rs = avl_find(&rt->rt_root, &rsearch, &where);
+	rs_set_start(&rsearch, rt, start);
+	rs_set_end(&rsearch, rt, end);
+	rs = zfs_btree_find(&rt->rt_root, &rsearch, &where);
 
-	if (rs != NULL && rs->rs_start <= start && rs->rs_end >= end) {
+	if (rs != NULL && rs_get_start(rs, rt) <= start &&
+	    rs_get_end(rs, rt) >= end) {
 		zfs_panic_recover("zfs: allocating allocated segment"
 		    "(offset=%llu size=%llu)\n",
 		    (longlong_t)start, (longlong_t)size);
@@ -193,14 +218,17 @@ range_tree_add(void *arg, uint64_t start, uint64_t size)
 	/* Make sure we don't overlap with either of our neighbors */
 	VERIFY(rs == NULL);
 
-	rs_before = avl_nearest(&rt->rt_root, where, AVL_BEFORE);
-	rs_after = avl_nearest(&rt->rt_root, where, AVL_AFTER);
+	rs_before = zfs_btree_prev(&rt->rt_root, &where, &where_before);
+	rs_after = zfs_btree_next(&rt->rt_root, &where, &where_after);
 
-	merge_before = (rs_before != NULL && rs_before->rs_end == start);
-	merge_after = (rs_after != NULL && rs_after->rs_start == end);
+	merge_before = (rs_before != NULL &&
+	    rs_get_end(rs_before, rt) == start);
+	merge_after = (rs_after != NULL &&
+	    rs_get_start(rs_after, rt) == end);
 
 	if (merge_before && merge_after) {
-		avl_remove(&rt->rt_root, rs_before);
+		uint64_t before_start = rs_get_start(rs_before, rt);
+
 		if (rt->rt_ops != NULL) {
 			rt->rt_ops->rtop_remove(rt, rs_before, rt->rt_arg);
 			rt->rt_ops->rtop_remove(rt, rs_after, rt->rt_arg);
@@ -209,8 +237,16 @@ range_tree_add(void *arg, uint64_t start, uint64_t size)
 		range_tree_stat_decr(rt, rs_before);
 		range_tree_stat_decr(rt, rs_after);
 
-		rs_after->rs_start = rs_before->rs_start;
-		kmem_cache_free(range_seg_cache, rs_before);
+		/*
+		 * Removing the segment before invalidates the pointer to
+		 * the one after, so look it up again.
+		 */
+		bcopy(rs_after, &rsearch, range_seg_size(rt->rt_type));
+		zfs_btree_remove_idx(&rt->rt_root, &where_before);
+		rs_after = zfs_btree_find(&rt->rt_root, &rsearch, NULL);
+		ASSERT3P(rs_after, !=, NULL);
+
+		rs_set_start(rs_after, rt, before_start);
 		rs = rs_after;
 	} else if (merge_before) {
 		if (rt->rt_ops != NULL)
@@ -218,7 +254,7 @@ range_tree_add(void *arg, uint64_t start, uint64_t size)
 
 		range_tree_stat_decr(rt, rs_before);
 
-		rs_before->rs_end = end;
+		rs_set_end(rs_before, rt, end);
 		rs = rs_before;
 	} else if (merge_after) {
 		if (rt->rt_ops != NULL)
@@ -226,13 +262,13 @@ range_tree_add(void *arg, uint64_t start, uint64_t size)
 
 		range_tree_stat_decr(rt, rs_after);
 
-		rs_after->rs_start = start;
+		rs_set_start(rs_after, rt, start);
 		rs = rs_after;
 	} else {
-		rs = kmem_cache_alloc(range_seg_cache, KM_SLEEP);
-		rs->rs_start = start;
-		rs->rs_end = end;
-		avl_insert(&rt->rt_root, rs, where);
+		rs_set_start(&rsnew, rt, start);
+		rs_set_end(&rsnew, rt, end);
+		zfs_btree_add_idx(&rt->rt_root, &rsnew, &where);
+		rs = &rsnew;
 	}
 
 	if (rt->rt_ops != NULL)
@@ -246,18 +282,20 @@ void
 range_tree_remove(void *arg, uint64_t start, uint64_t size)
 {
 	range_tree_t *rt = arg;
-	avl_index_t where;
-	range_seg_t rsearch, *rs, *newseg;
+	zfs_btree_index_t where;
+	range_seg_max_t rsearch, newseg;
+	range_seg_t *rs;
 	uint64_t end = start + size;
+	uint64_t rs_end;
 	boolean_t left_over, right_over;
 
 	ASSERT(MUTEX_HELD(rt->rt_lock));
 	VERIFY3U(size, !=, 0);
 	VERIFY3U(size, <=, rt->rt_space);
 
-	rsearch.rs_start = start;
-	rsearch.rs_end = end;
-	rs = avl_find(&rt->rt_root, &rsearch, &where);
+	rs_set_start(&rsearch, rt, start);
+	rs_set_end(&rsearch, rt, end);
+	rs = zfs_btree_find(&rt->rt_root, &rsearch, &where);
 
 	/* Make sure we completely overlap with someone */
 	if (rs == NULL) {
@@ -266,11 +304,12 @@ range_tree_remove(void *arg, uint64_t start, uint64_t size)
 		    (longlong_t)start, (longlong_t)size);
 		return;
 	}
-	VERIFY3U(rs->rs_start, <=, start);
-	VERIFY3U(rs->rs_end, >=, end);
+	rs_end = rs_get_end(rs, rt);
+	VERIFY3U(rs_get_start(rs, rt), <=, start);
+	VERIFY3U(rs_end, >=, end);
 
-	left_over = (rs->rs_start != start);
-	right_over = (rs->rs_end != end);
+	left_over = (rs_get_start(rs, rt) != start);
+	right_over = (rs_end != end);
 
 	range_tree_stat_decr(rt, rs);
 
@@ -278,23 +317,28 @@ range_tree_remove(void *arg, uint64_t start, uint64_t size)
 		rt->rt_ops->rtop_remove(rt, rs, rt->rt_arg);
 
 	if (left_over && right_over) {
-		newseg = kmem_cache_alloc(range_seg_cache, KM_SLEEP);
-		newseg->rs_start = end;
-		newseg->rs_end = rs->rs_end;
-		range_tree_stat_incr(rt, newseg);
-
-		rs->rs_end = start;
+		/*
+		 * Finish with the head of the segment before inserting its
+		 * tail, which invalidates the pointer to it.
+		 */
+		rs_set_end(rs, rt, start);
+		range_tree_stat_incr(rt, rs);
+		if (rt->rt_ops != NULL)
+			rt->rt_ops->rtop_add(rt, rs, rt->rt_arg);
 
-		avl_insert_here(&rt->rt_root, newseg, rs, AVL_AFTER);
+		rs_set_start(&newseg, rt, end);
+		rs_set_end(&newseg, rt, rs_end);
+		zfs_btree_add(&rt->rt_root, &newseg);
+		range_tree_stat_incr(rt, &newseg);
 		if (rt->rt_ops != NULL)
-			rt->rt_ops->rtop_add(rt, newseg, rt->rt_arg);
+			rt->rt_ops->rtop_add(rt, &newseg, rt->rt_arg);
+		rs = NULL;
 	} else if (left_over) {
-		rs->rs_end = start;
+		rs_set_end(rs, rt, start);
 	} else if (right_over) {
-		rs->rs_start = end;
+		rs_set_start(rs, rt, end);
 	} else {
-		avl_remove(&rt->rt_root, rs);
-		kmem_cache_free(range_seg_cache, rs);
+		zfs_btree_remove_idx(&rt->rt_root, &where);
 		rs = NULL;
 	}
 
@@ -309,25 +353,26 @@ range_tree_remove(void *arg, uint64_t start, uint64_t size)
 }
 
 static range_seg_t *
-range_tree_find_impl(range_tree_t *rt, uint64_t start, uint64_t size)
+range_tree_find_impl(range_tree_t *rt, uint64_t start, uint64_t size,
+    zfs_btree_index_t *where)
 {
-	avl_index_t where;
-	range_seg_t rsearch;
+	range_seg_max_t rsearch;
 	uint64_t end = start + size;
 
 	ASSERT(MUTEX_HELD(rt->rt_lock));
 	VERIFY(size != 0);
 
-	rsearch.rs_start = start;
-	rsearch.rs_end = end;
-	return (avl_find(&rt->rt_root, &rsearch, &where));
+	rs_set_start(&rsearch, rt, start);
+	rs_set_end(&rsearch, rt, end);
+	return (zfs_btree_find(&rt->rt_root, &rsearch, where));
 }
 
 static range_seg_t *
 range_tree_find(range_tree_t *rt, uint64_t start, uint64_t size)
 {
-	range_seg_t *rs = range_tree_find_impl(rt, start, size);
-	if (rs != NULL && rs->rs_start <= start && rs->rs_end >= start + size)
+	range_seg_t *rs = range_tree_find_impl(rt, start, size, NULL);
+	if (rs != NULL && rs_get_start(rs, rt) <= start &&
+	    rs_get_end(rs, rt) >= start + size)
 		return (rs);
 	return (NULL);
 }
@@ -359,13 +404,75 @@ range_tree_clear(range_tree_t *rt, uint64_t start, uint64_t size)
 {
 	range_seg_t *rs;
 
-	while ((rs = range_tree_find_impl(rt, start, size)) != NULL) {
-		uint64_t free_start = MAX(rs->rs_start, start);
-		uint64_t free_end = MIN(rs->rs_end, start + size);
+	while ((rs = range_tree_find_impl(rt, start, size, NULL)) != NULL) {
+		uint64_t free_start = MAX(rs_get_start(rs, rt), start);
+		uint64_t free_end = MIN(rs_get_end(rs, rt), start + size);
 		range_tree_remove(rt, free_start, free_end - free_start);
 	}
 }
 
+/*
+ * Remove the parts of [start, end) which are in removefrom from it, and
+ * add the parts which are not to addto.  Both trees must share a lock.
+ */
+void
+range_tree_remove_xor_add_segment(uint64_t start, uint64_t end,
+    range_tree_t *removefrom, range_tree_t *addto)
+{
+	zfs_btree_index_t where;
+	range_seg_t *rs, *prev;
+
+	ASSERT(MUTEX_HELD(removefrom->rt_lock));
+	ASSERT3P(removefrom->rt_lock, ==, addto->rt_lock);
+
+	while (start < end) {
+		rs = range_tree_find_impl(removefrom, start, end - start,
+		    &where);
+		if (rs == NULL) {
+			range_tree_add(addto, start, end - start);
+			return;
+		}
+
+		/*
+		 * Any overlapping segment may have been found; go back to
+		 * the first one.
+		 */
+		while ((prev = zfs_btree_prev(&removefrom->rt_root, &where,
+		    &where)) != NULL && rs_get_end(prev, removefrom) > start)
+			rs = prev;
+
+		uint64_t rs_start = rs_get_start(rs, removefrom);
+		uint64_t overlap_end = MIN(rs_get_end(rs, removefrom), end);
+
+		if (rs_start > start) {
+			range_tree_add(addto, start, rs_start - start);
+			start = rs_start;
+		}
+
+		range_tree_remove(removefrom, start, overlap_end - start);
+		start = overlap_end;
+	}
+}
+
+/*
+ * Apply range_tree_remove_xor_add_segment() to every segment of rt.
+ */
+void
+range_tree_remove_xor_add(range_tree_t *rt, range_tree_t *removefrom,
+    range_tree_t *addto)
+{
+	zfs_btree_index_t where;
+	range_seg_t *rs;
+
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+
+	for (rs = zfs_btree_first(&rt->rt_root, &where); rs != NULL;
+	    rs = zfs_btree_next(&rt->rt_root, &where, &where)) {
+		range_tree_remove_xor_add_segment(rs_get_start(rs, rt),
+		    rs_get_end(rs, rt), removefrom, addto);
+	}
+}
+
 void
 range_tree_swap(range_tree_t **rtsrc, range_tree_t **rtdst)
 {
@@ -373,7 +480,7 @@ range_tree_swap(range_tree_t **rtsrc, range_tree_t **rtdst)
 
 	ASSERT(MUTEX_HELD((*rtsrc)->rt_lock));
 	ASSERT0(range_tree_space(*rtdst));
-	ASSERT0(avl_numnodes(&(*rtdst)->rt_root));
+	ASSERT0(zfs_btree_numnodes(&(*rtdst)->rt_root));
 
 	rt = *rtsrc;
 	*rtsrc = *rtdst;
@@ -383,19 +490,14 @@ range_tree_swap(range_tree_t **rtsrc, range_tree_t **rtdst)
 void
 range_tree_vacate(range_tree_t *rt, range_tree_func_t *func, void *arg)
 {
-	range_seg_t *rs;
-	void *cookie = NULL;
-
 	ASSERT(MUTEX_HELD(rt->rt_lock));
 
 	if (rt->rt_ops != NULL)
 		rt->rt_ops->rtop_vacate(rt, rt->rt_arg);
 
-	while ((rs = avl_destroy_nodes(&rt->rt_root, &cookie)) != NULL) {
-		if (func != NULL)
-			func(arg, rs->rs_start, rs->rs_end - rs->rs_start);
-		kmem_cache_free(range_seg_cache, rs);
-	}
+	if (func != NULL)
+		range_tree_walk(rt, func, arg);
+	zfs_btree_clear(&rt->rt_root);
 
 	bzero(rt->rt_histogram, sizeof (rt->rt_histogram));
 	rt->rt_space = 0;
@@ -404,12 +506,16 @@ range_tree_vacate(range_tree_t *rt, range_tree_func_t *func, void *arg)
 void
 range_tree_walk(range_tree_t *rt, range_tree_func_t *func, void *arg)
 {
+	zfs_btree_index_t where;
 	range_seg_t *rs;
 
 	ASSERT(MUTEX_HELD(rt->rt_lock));
 
-	for (rs = avl_first(&rt->rt_root); rs; rs = AVL_NEXT(&rt->rt_root, rs))
-		func(arg, rs->rs_start, rs->rs_end - rs->rs_start);
+	for (rs = zfs_btree_first(&rt->rt_root, &where); rs != NULL;
+	    rs = zfs_btree_next(&rt->rt_root, &where, &where)) {
+		func(arg, rs_get_start(rs, rt),
+		    rs_get_end(rs, rt) - rs_get_start(rs, rt));
+	}
 }
 
 uint64_t
@@ -417,3 +523,38 @@ range_tree_space(range_tree_t *rt)
 {
 	return (rt->rt_space);
 }
+
+uint64_t
+range_tree_numsegs(range_tree_t *rt)
+{
+	return ((rt == NULL) ? 0 : zfs_btree_numnodes(&rt->rt_root));
+}
+
+boolean_t
+range_tree_is_empty(range_tree_t *rt)
+{
+	ASSERT(rt != NULL);
+	return (range_tree_space(rt) == 0);
+}
+
+/*
+ * The start of the first segment of a non-empty tree.
+ */
+uint64_t
+range_tree_min(range_tree_t *rt)
+{
+	range_seg_t *rs = zfs_btree_first(&rt->rt_root, NULL);
+
+	return ((rs != NULL) ? rs_get_start(rs, rt) : 0);
+}
+
+/*
+ * The end of the last segment of a non-empty tree.
+ */
+uint64_t
+range_tree_max(range_tree_t *rt)
+{
+	range_seg_t *rs = zfs_btree_last(&rt->rt_root, NULL);
+
+	return ((rs != NULL) ? rs_get_end(rs, rt) : 0);
+}
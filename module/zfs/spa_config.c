@@ -516,6 +516,22 @@ spa_config_generate(spa_t *spa, vdev_t *vd, uint64_t txg, int getstats)
 		    ZPOOL_CONFIG_DDT_STATS,
 		    (uint64_t *)dds, sizeof (*dds) / sizeof (uint64_t));
 		kmem_free(dds, sizeof (ddt_stat_t));
+
+		if (spa_feature_is_active(spa, SPA_FEATURE_DEDUP_LOG)) {
+			ddt_log_stat_t *ddls;
+
+			ddls = kmem_zalloc(sizeof (ddt_log_stat_t), KM_SLEEP);
+			ddt_get_dedup_log_stats(spa, ddls);
+			fnvlist_add_uint64_array(config,
+			    ZPOOL_CONFIG_DDT_LOG_STATS, (uint64_t *)ddls,
+			    sizeof (*ddls) / sizeof (uint64_t));
+			kmem_free(ddls, sizeof (ddt_log_stat_t));
+		}
+
+		if (spa->spa_ddt_pruned != 0) {
+			fnvlist_add_uint64(config, ZPOOL_CONFIG_DDT_PRUNED,
+			    spa->spa_ddt_pruned);
+		}
 	}
 
 	if (locked)
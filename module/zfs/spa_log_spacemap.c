@@ -0,0 +1,510 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Log space maps.
+ *
+ * Without them every metaslab that is allocated from or freed to in a txg
+ * appends to its own space map in that txg.  With many metaslabs in use
+ * this is a lot of small, scattered writes, each of which also dirties
+ * the space map's bonus buffer and the indirect blocks above it, and the
+ * cost of syncing the metaslabs grows with their number rather than with
+ * the amount of space that changed.
+ *
+ * With the log_spacemap feature the allocs and frees of all the metaslabs
+ * of the pool are instead appended to one log space map per txg, which is
+ * written sequentially.  The changes that a metaslab has logged but not
+ * yet written to its own space map are its unflushed changes, kept in
+ * ms_unflushed_allocs and ms_unflushed_frees, and are applied on top of
+ * its space map whenever it is loaded.
+ *
+ * Each txg, spa_flush_metaslabs() picks the metaslabs whose oldest
+ * unflushed change is the oldest in the pool (spa_metaslabs_by_flushed)
+ * and has them flushed: they write their unflushed changes to their own
+ * space maps and record the txg of the flush in the space map header.
+ * A log space map is destroyed once no metaslab has unflushed changes as
+ * old as it is.  The number of metaslabs flushed in a txg is kept at
+ * zfs_min_metaslabs_to_flush unless the log space maps have grown beyond
+ * zfs_unflushed_log_block_max blocks, or the unflushed changes held in
+ * memory beyond zfs_unflushed_max_mem_amt bytes, in which case up to
+ * zfs_max_metaslabs_to_flush metaslabs are flushed.
+ *
+ * When the pool is opened, spa_ld_log_spacemaps() reads the log space
+ * maps back in txg order, and applies every entry written after the last
+ * flush of its metaslab to the metaslab's unflushed changes.
+ *
+ * Log vdevs keep writing to their own space maps as they always have;
+ * their metaslabs are few and short-lived.
+ *
+ * spa_log_sm_lock protects spa_metaslabs_by_flushed, spa_log_sm_list and
+ * spa_log_sm_nblocks; it is always taken after ms_lock.  The log space map
+ * of the syncing txg itself is only used from syncing context.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/spa_log_spacemap.h>
+#include <sys/vdev_impl.h>
+#include <sys/metaslab_impl.h>
+#include <sys/space_map.h>
+#include <sys/dmu_objset.h>
+#include <sys/dmu_tx.h>
+#include <sys/zap.h>
+#include <sys/zfeature.h>
+
+/*
+ * Flush more metaslabs per txg once the unflushed changes of all the
+ * metaslabs take more than this much memory.
+ */
+uint64_t zfs_unflushed_max_mem_amt = 256ULL << 20;
+
+/*
+ * Flush more metaslabs per txg once the log space maps of the pool take
+ * more than this many blocks.
+ */
+uint64_t zfs_unflushed_log_block_max = 4096;
+
+/*
+ * Metaslabs flushed each txg, and while over either of the limits above.
+ */
+uint64_t zfs_min_metaslabs_to_flush = 1;
+uint64_t zfs_max_metaslabs_to_flush = 64;
+
+#define	SPA_LOG_SM_BLKSZ	(1ULL << 17)
+
+log_spacemap_stats_t log_spacemap_stats = {
+	{ "logs",			KSTAT_DATA_UINT64 },
+	{ "blocks",			KSTAT_DATA_UINT64 },
+	{ "unflushed_metaslabs",	KSTAT_DATA_UINT64 },
+	{ "unflushed_segments",		KSTAT_DATA_UINT64 },
+	{ "bytes_written",		KSTAT_DATA_UINT64 },
+	{ "metaslabs_logged",		KSTAT_DATA_UINT64 },
+	{ "metaslabs_flushed",		KSTAT_DATA_UINT64 },
+	{ "logged_sync_ns",		KSTAT_DATA_UINT64 },
+	{ "flushed_sync_ns",		KSTAT_DATA_UINT64 },
+};
+
+static kstat_t *log_spacemap_ksp;
+
+void
+spa_log_sm_init(void)
+{
+	log_spacemap_ksp = kstat_create("zfs", 0, "log_spacemap", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (log_spacemap_stats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+
+	if (log_spacemap_ksp != NULL) {
+		log_spacemap_ksp->ks_data = &log_spacemap_stats;
+		kstat_install(log_spacemap_ksp);
+	}
+}
+
+void
+spa_log_sm_fini(void)
+{
+	if (log_spacemap_ksp != NULL) {
+		kstat_delete(log_spacemap_ksp);
+		log_spacemap_ksp = NULL;
+	}
+}
+
+static int
+spa_metaslab_flushed_compare(const void *x1, const void *x2)
+{
+	const metaslab_t *m1 = x1;
+	const metaslab_t *m2 = x2;
+
+	if (m1->ms_unflushed_txg < m2->ms_unflushed_txg)
+		return (-1);
+	if (m1->ms_unflushed_txg > m2->ms_unflushed_txg)
+		return (1);
+
+	uint64_t v1 = m1->ms_group->mg_vd->vdev_id;
+	uint64_t v2 = m2->ms_group->mg_vd->vdev_id;
+	if (v1 < v2)
+		return (-1);
+	if (v1 > v2)
+		return (1);
+
+	if (m1->ms_id < m2->ms_id)
+		return (-1);
+	if (m1->ms_id > m2->ms_id)
+		return (1);
+	return (0);
+}
+
+void
+spa_log_sm_create(spa_t *spa)
+{
+	mutex_init(&spa->spa_log_sm_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&spa->spa_metaslabs_by_flushed,
+	    spa_metaslab_flushed_compare, sizeof (metaslab_t),
+	    offsetof(metaslab_t, ms_unflushed_node));
+	list_create(&spa->spa_log_sm_list, sizeof (spa_log_sm_t),
+	    offsetof(spa_log_sm_t, sls_node));
+}
+
+void
+spa_log_sm_destroy(spa_t *spa)
+{
+	ASSERT0(avl_numnodes(&spa->spa_metaslabs_by_flushed));
+	ASSERT(list_is_empty(&spa->spa_log_sm_list));
+	ASSERT3P(spa->spa_syncing_log_sm, ==, NULL);
+
+	list_destroy(&spa->spa_log_sm_list);
+	avl_destroy(&spa->spa_metaslabs_by_flushed);
+	mutex_destroy(&spa->spa_log_sm_lock);
+}
+
+boolean_t
+spa_log_sm_enabled(spa_t *spa)
+{
+	return (spa->spa_log_sm_zap != 0);
+}
+
+/*
+ * Called by metaslab_sync() with the metaslab's lock held, which is
+ * also the lock of rt, to append rt to the log space map of this txg.
+ */
+void
+spa_log_sm_write(spa_t *spa, range_tree_t *rt, maptype_t maptype,
+    uint64_t vdev, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	space_map_t *sm;
+	uint64_t objsize;
+
+	ASSERT(spa_log_sm_enabled(spa));
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+
+	if (range_tree_space(rt) == 0)
+		return;
+
+	if (spa->spa_syncing_log_sm == NULL) {
+		uint64_t obj;
+
+		mutex_exit(rt->rt_lock);
+		obj = dmu_object_alloc(mos, DMU_OT_SPACE_MAP,
+		    SPA_LOG_SM_BLKSZ, DMU_OT_SPACE_MAP_HEADER,
+		    sizeof (space_map_phys_t), tx);
+		VERIFY0(zap_add_int_key(mos, spa->spa_log_sm_zap,
+		    dmu_tx_get_txg(tx), obj, tx));
+		VERIFY0(space_map_open(&spa->spa_syncing_log_sm, mos, obj,
+		    0, UINT64_MAX, SPA_MINBLOCKSHIFT, &spa->spa_log_sm_lock));
+		mutex_enter(rt->rt_lock);
+	}
+
+	sm = spa->spa_syncing_log_sm;
+	objsize = sm->sm_phys->smp_objsize;
+	space_map_write_log(sm, rt, maptype, vdev, tx);
+	LSMS_STAT_INCR(lsms_bytes_written, sm->sm_phys->smp_objsize - objsize);
+}
+
+/*
+ * Called at the end of spa_sync() to add the log space map of the txg,
+ * if anything was logged, to the list of the pool's log space maps.
+ */
+void
+spa_log_sm_sync_done(spa_t *spa, uint64_t txg)
+{
+	space_map_t *sm = spa->spa_syncing_log_sm;
+	spa_log_sm_t *sls;
+
+	if (sm == NULL)
+		return;
+
+	sls = kmem_zalloc(sizeof (spa_log_sm_t), KM_SLEEP);
+	sls->sls_txg = txg;
+	sls->sls_sm_obj = space_map_object(sm);
+	sls->sls_nblocks = howmany(sm->sm_phys->smp_objsize, sm->sm_blksz);
+
+	mutex_enter(&spa->spa_log_sm_lock);
+	list_insert_tail(&spa->spa_log_sm_list, sls);
+	spa->spa_log_sm_nblocks += sls->sls_nblocks;
+	mutex_exit(&spa->spa_log_sm_lock);
+
+	LSMS_STAT_BUMP(lsms_logs);
+	LSMS_STAT_INCR(lsms_blocks, sls->sls_nblocks);
+
+	space_map_close(sm);
+	spa->spa_syncing_log_sm = NULL;
+}
+
+/*
+ * Called with the metaslab's lock held whenever it logs changes in txg.
+ */
+void
+spa_log_sm_metaslab_logged(metaslab_t *msp, uint64_t txg)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (msp->ms_unflushed_txg != 0)
+		return;
+
+	mutex_enter(&spa->spa_log_sm_lock);
+	msp->ms_unflushed_txg = txg;
+	avl_add(&spa->spa_metaslabs_by_flushed, msp);
+	mutex_exit(&spa->spa_log_sm_lock);
+
+	LSMS_STAT_BUMP(lsms_unflushed_metaslabs);
+}
+
+/*
+ * Called with the metaslab's lock held once it has no unflushed changes.
+ */
+void
+spa_log_sm_metaslab_flushed(metaslab_t *msp)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (msp->ms_unflushed_txg == 0)
+		return;
+
+	mutex_enter(&spa->spa_log_sm_lock);
+	avl_remove(&spa->spa_metaslabs_by_flushed, msp);
+	msp->ms_unflushed_txg = 0;
+	mutex_exit(&spa->spa_log_sm_lock);
+
+	LSMS_STAT_INCR(lsms_unflushed_metaslabs, -1);
+}
+
+void
+spa_log_sm_segments_update(spa_t *spa, int64_t delta)
+{
+	atomic_add_64(&spa->spa_unflushed_segs, delta);
+	LSMS_STAT_INCR(lsms_unflushed_segments, delta);
+}
+
+static void
+spa_log_sm_activate(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	uint64_t zap;
+
+	zap = zap_create(mos, DMU_OTN_ZAP_METADATA, DMU_OT_NONE, 0, tx);
+	VERIFY0(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_LOG_SPACEMAP_ZAP, sizeof (uint64_t), 1, &zap, tx));
+	spa_feature_incr(spa, SPA_FEATURE_LOG_SPACEMAP, tx);
+	spa->spa_log_sm_zap = zap;
+}
+
+/*
+ * Called in sync pass 1, before the metaslabs are synced, to destroy the
+ * log space maps which no longer hold unflushed changes and to pick the
+ * metaslabs to flush in this txg.
+ */
+void
+spa_flush_metaslabs(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	uint64_t txg = dmu_tx_get_txg(tx);
+	uint64_t min_txg, want, segs;
+	spa_log_sm_t *sls;
+	metaslab_t *msp;
+
+	ASSERT3U(spa_sync_pass(spa), ==, 1);
+
+	/*
+	 * Leave idle txgs alone, so that they can stay no-ops.
+	 */
+	if (spa->spa_uberblock.ub_rootbp.blk_birth < txg &&
+	    !dmu_objset_is_dirty(mos, txg))
+		return;
+
+	if (!spa_log_sm_enabled(spa)) {
+		if (spa_feature_is_enabled(spa, SPA_FEATURE_LOG_SPACEMAP) &&
+		    !spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP))
+			spa_log_sm_activate(spa, tx);
+		return;
+	}
+
+	/*
+	 * Every log space map older than the oldest unflushed change of
+	 * any metaslab is obsolete.
+	 */
+	mutex_enter(&spa->spa_log_sm_lock);
+	msp = avl_first(&spa->spa_metaslabs_by_flushed);
+	min_txg = (msp != NULL) ? msp->ms_unflushed_txg : txg;
+	while ((sls = list_head(&spa->spa_log_sm_list)) != NULL &&
+	    sls->sls_txg < min_txg) {
+		list_remove(&spa->spa_log_sm_list, sls);
+		spa->spa_log_sm_nblocks -= sls->sls_nblocks;
+		mutex_exit(&spa->spa_log_sm_lock);
+
+		VERIFY0(dmu_object_free(mos, sls->sls_sm_obj, tx));
+		VERIFY0(zap_remove_int(mos, spa->spa_log_sm_zap,
+		    sls->sls_txg, tx));
+		LSMS_STAT_INCR(lsms_logs, -1);
+		LSMS_STAT_INCR(lsms_blocks, -sls->sls_nblocks);
+		kmem_free(sls, sizeof (spa_log_sm_t));
+
+		mutex_enter(&spa->spa_log_sm_lock);
+	}
+
+	want = zfs_min_metaslabs_to_flush;
+	segs = spa->spa_unflushed_segs;
+	if (spa->spa_log_sm_nblocks > zfs_unflushed_log_block_max ||
+	    segs * sizeof (range_seg64_t) > zfs_unflushed_max_mem_amt)
+		want = MAX(want, zfs_max_metaslabs_to_flush);
+
+	for (msp = avl_first(&spa->spa_metaslabs_by_flushed);
+	    msp != NULL && want != 0;
+	    msp = AVL_NEXT(&spa->spa_metaslabs_by_flushed, msp), want--) {
+		msp->ms_flush_wanted = B_TRUE;
+		vdev_dirty(msp->ms_group->mg_vd, VDD_METASLAB, msp, txg);
+	}
+	mutex_exit(&spa->spa_log_sm_lock);
+}
+
+typedef struct spa_ld_log_sm_arg {
+	spa_t		*slla_spa;
+	uint64_t	slla_txg;
+} spa_ld_log_sm_arg_t;
+
+static int
+spa_ld_log_sm_cb(maptype_t type, uint64_t vdev, uint64_t offset,
+    uint64_t size, void *arg)
+{
+	spa_ld_log_sm_arg_t *slla = arg;
+	vdev_t *rvd = slla->slla_spa->spa_root_vdev;
+	vdev_t *vd;
+	uint64_t id;
+
+	if (vdev >= rvd->vdev_children)
+		return (SET_ERROR(EIO));
+	vd = rvd->vdev_child[vdev];
+	if (vd->vdev_ms == NULL)
+		return (0);
+
+	id = offset >> vd->vdev_ms_shift;
+	if (id >= vd->vdev_ms_count ||
+	    ((offset + size - 1) >> vd->vdev_ms_shift) != id)
+		return (SET_ERROR(EIO));
+
+	metaslab_unflushed_replay(vd->vdev_ms[id], slla->slla_txg, type,
+	    offset, size);
+	return (0);
+}
+
+/*
+ * Read the pool's log space maps back into the unflushed changes of the
+ * metaslabs.  Called once the vdevs and their metaslabs have been loaded.
+ */
+int
+spa_ld_log_spacemaps(spa_t *spa)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	spa_log_sm_t *sls, *next;
+	metaslab_t *msp;
+	int error;
+
+	error = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_LOG_SPACEMAP_ZAP, sizeof (uint64_t), 1,
+	    &spa->spa_log_sm_zap);
+	if (error == ENOENT) {
+		spa->spa_log_sm_zap = 0;
+		return (0);
+	}
+	if (error != 0)
+		return (error);
+
+	/*
+	 * The log space maps have to be replayed in the order they were
+	 * written, which the ZAP doesn't give us.
+	 */
+	for (zap_cursor_init(&zc, mos, spa->spa_log_sm_zap);
+	    (error = zap_cursor_retrieve(&zc, &za)) == 0;
+	    (void) zap_cursor_advance(&zc)) {
+		sls = kmem_zalloc(sizeof (spa_log_sm_t), KM_SLEEP);
+		sls->sls_txg = strtonum(za.za_name, NULL);
+		sls->sls_sm_obj = za.za_first_integer;
+
+		for (next = list_head(&spa->spa_log_sm_list);
+		    next != NULL && next->sls_txg < sls->sls_txg;
+		    next = list_next(&spa->spa_log_sm_list, next))
+			;
+		if (next == NULL)
+			list_insert_tail(&spa->spa_log_sm_list, sls);
+		else
+			list_insert_before(&spa->spa_log_sm_list, next, sls);
+		LSMS_STAT_BUMP(lsms_logs);
+	}
+	zap_cursor_fini(&zc);
+	if (error != ENOENT)
+		return (error);
+	error = 0;
+
+	for (sls = list_head(&spa->spa_log_sm_list); sls != NULL;
+	    sls = list_next(&spa->spa_log_sm_list, sls)) {
+		spa_ld_log_sm_arg_t slla = { spa, sls->sls_txg };
+		space_map_t *sm;
+
+		error = space_map_open(&sm, mos, sls->sls_sm_obj, 0,
+		    UINT64_MAX, SPA_MINBLOCKSHIFT, &spa->spa_log_sm_lock);
+		if (error != 0)
+			break;
+
+		sls->sls_nblocks = howmany(sm->sm_phys->smp_objsize,
+		    sm->sm_blksz);
+		spa->spa_log_sm_nblocks += sls->sls_nblocks;
+		LSMS_STAT_INCR(lsms_blocks, sls->sls_nblocks);
+
+		error = space_map_iterate_log(sm, spa_ld_log_sm_cb, &slla);
+		space_map_close(sm);
+		if (error != 0)
+			break;
+	}
+
+	for (msp = avl_first(&spa->spa_metaslabs_by_flushed); msp != NULL;
+	    msp = AVL_NEXT(&spa->spa_metaslabs_by_flushed, msp))
+		metaslab_unflushed_replay_done(msp);
+
+	return (error);
+}
+
+/*
+ * Free the in-core list of log space maps.  The metaslabs have already
+ * dropped their unflushed changes in metaslab_fini().
+ */
+void
+spa_unload_log_sm(spa_t *spa)
+{
+	spa_log_sm_t *sls;
+
+	mutex_enter(&spa->spa_log_sm_lock);
+	while ((sls = list_remove_head(&spa->spa_log_sm_list)) != NULL) {
+		spa->spa_log_sm_nblocks -= sls->sls_nblocks;
+		LSMS_STAT_INCR(lsms_logs, -1);
+		LSMS_STAT_INCR(lsms_blocks, -sls->sls_nblocks);
+		kmem_free(sls, sizeof (spa_log_sm_t));
+	}
+	ASSERT0(spa->spa_log_sm_nblocks);
+	mutex_exit(&spa->spa_log_sm_lock);
+
+	spa->spa_log_sm_zap = 0;
+}
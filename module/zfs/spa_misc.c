@@ -40,6 +40,7 @@
 #include <sys/vdev_impl.h>
 #include <sys/vdev_file.h>
 #include <sys/metaslab.h>
+#include <sys/spa_log_spacemap.h>
 #include <sys/uberblock_impl.h>
 #include <sys/txg.h>
 #include <sys/avl.h>
@@ -55,6 +56,8 @@
 #include <sys/ddt.h>
 #include <sys/stropts.h>
 #include "zfs_prop.h"
+#include "zfs_fletcher.h"
+#include <sys/vdev_raidz.h>
 #include <sys/zfeature.h>
 
 /*
@@ -302,6 +305,20 @@ int spa_asize_inflation = 24;
 int spa_slop_shift = 5;
 uint64_t spa_min_slop = 128 * 1024 * 1024;
 
+/*
+ * Allocation classes.  Blocks are allocated from the special class when it
+ * exists if they are metadata, indirect blocks, or file data no larger than
+ * the dataset's special_small_blocks; DDT blocks prefer the dedup class.
+ * When the preferred class is out of space the normal class is used.
+ *
+ * zfs_special_class_metadata_reserve_pct is the percentage of the special
+ * class kept for metadata: small file blocks stop being placed there once
+ * less than this much of it is free.
+ */
+uint64_t zfs_ddt_data_is_special = 1;
+uint64_t zfs_user_indirect_is_special = 1;
+uint64_t zfs_special_class_metadata_reserve_pct = 25;
+
 /*
  * ==========================================================================
  * SPA config locking
@@ -562,6 +579,7 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 
 	avl_create(&spa->spa_alloc_tree, zio_bookmark_compare,
 	    sizeof (zio_t), offsetof(zio_t, io_alloc_node));
+	spa_log_sm_create(spa);
 
 	/*
 	 * Every pool starts with the default cachefile
@@ -641,6 +659,7 @@ spa_remove(spa_t *spa)
 	}
 
 	avl_destroy(&spa->spa_alloc_tree);
+	spa_log_sm_destroy(spa);
 	list_destroy(&spa->spa_config_list);
 
 	nvlist_free(spa->spa_label_features);
@@ -1650,6 +1669,73 @@ spa_log_class(spa_t *spa)
 	return (spa->spa_log_class);
 }
 
+metaslab_class_t *
+spa_special_class(spa_t *spa)
+{
+	return (spa->spa_special_class);
+}
+
+metaslab_class_t *
+spa_dedup_class(spa_t *spa)
+{
+	return (spa->spa_dedup_class);
+}
+
+static boolean_t
+spa_has_class(metaslab_class_t *mc)
+{
+	return (mc->mc_rotor != NULL);
+}
+
+/*
+ * Locate an appropriate allocation class for a block of the given size,
+ * object type and level.
+ */
+metaslab_class_t *
+spa_preferred_class(spa_t *spa, uint64_t size, dmu_object_type_t objtype,
+    uint_t level, uint_t special_smallblk)
+{
+	metaslab_class_t *special = spa_special_class(spa);
+	metaslab_class_t *dedup = spa_dedup_class(spa);
+	boolean_t has_special = spa_has_class(special);
+
+	if (DMU_OT_IS_DDT(objtype)) {
+		if (spa_has_class(dedup))
+			return (dedup);
+		if (has_special && zfs_ddt_data_is_special)
+			return (special);
+		return (spa_normal_class(spa));
+	}
+
+	if (!has_special)
+		return (spa_normal_class(spa));
+
+	if (level > 0 && DMU_OT_IS_FILE(objtype)) {
+		if (zfs_user_indirect_is_special)
+			return (special);
+		return (spa_normal_class(spa));
+	}
+
+	if (DMU_OT_IS_METADATA(objtype) || level > 0)
+		return (special);
+
+	/*
+	 * Small file blocks go to the special class while it still has more
+	 * than the metadata reserve free.
+	 */
+	if (DMU_OT_IS_FILE(objtype) && size <= special_smallblk) {
+		uint64_t space = metaslab_class_get_space(special);
+		uint64_t limit = space *
+		    (100 - MIN(zfs_special_class_metadata_reserve_pct, 100)) /
+		    100;
+
+		if (metaslab_class_get_alloc(special) < limit)
+			return (special);
+	}
+
+	return (spa_normal_class(spa));
+}
+
 void
 spa_evicting_os_register(spa_t *spa, objset_t *os)
 {
@@ -1815,9 +1901,13 @@ spa_init(int mode)
 	fm_init();
 	refcount_init();
 	unique_init();
-	range_tree_init();
+	zfs_btree_init();
 	metaslab_alloc_trace_init();
+	metaslab_stat_init();
+	spa_log_sm_init();
 	ddt_init();
+	fletcher_4_init();
+	vdev_raidz_math_init();
 	zio_init();
 	dmu_init();
 	zil_init();
@@ -1840,9 +1930,13 @@ spa_fini(void)
 	zil_fini();
 	dmu_fini();
 	zio_fini();
+	vdev_raidz_math_fini();
+	fletcher_4_fini();
 	ddt_fini();
+	spa_log_sm_fini();
+	metaslab_stat_fini();
 	metaslab_alloc_trace_fini();
-	range_tree_fini();
+	zfs_btree_fini();
 	unique_fini();
 	refcount_fini();
 	fm_fini();
@@ -1920,6 +2014,12 @@ spa_delegation(spa_t *spa)
 	return (spa->spa_delegation);
 }
 
+uint64_t
+spa_get_autotrim(spa_t *spa)
+{
+	return (spa->spa_autotrim);
+}
+
 objset_t *
 spa_meta_objset(spa_t *spa)
 {
@@ -1946,6 +2046,7 @@ spa_scan_stat_init(spa_t *spa)
 		spa->spa_scan_pass_scrub_pause = 0;
 	spa->spa_scan_pass_scrub_spent_paused = 0;
 	spa->spa_scan_pass_exam = 0;
+	spa->spa_scan_pass_issued = 0;
 	vdev_scan_stat_init(spa->spa_root_vdev);
 }
 
@@ -1977,6 +2078,9 @@ spa_scan_get_stats(spa_t *spa, pool_scan_stat_t *ps)
 	ps->pss_pass_exam = spa->spa_scan_pass_exam;
 	ps->pss_pass_scrub_pause = spa->spa_scan_pass_scrub_pause;
 	ps->pss_pass_scrub_spent_paused = spa->spa_scan_pass_scrub_spent_paused;
+	ps->pss_pass_issued = spa->spa_scan_pass_issued;
+	ps->pss_issued =
+	    scn->scn_issued_before_pass + spa->spa_scan_pass_issued;
 
 	return (0);
 }
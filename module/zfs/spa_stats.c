@@ -21,6 +21,7 @@
 
 #include <sys/zfs_context.h>
 #include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
 
 /*
  * Keeps stats on last N reads per spa_t, disabled by default.
@@ -655,6 +656,384 @@ spa_io_history_destroy(spa_t *spa)
 	mutex_destroy(&ssh->lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA ZIL Vdev Routines
+ * ==========================================================================
+ */
+
+/*
+ * Intent log write statistics - Information exported regarding the lwbs
+ * written to each top-level vdev.  The counters live in the vdev_t and are
+ * snapshotted here each time the kstat is read.
+ */
+typedef struct spa_zil_vdev_stats {
+	uint64_t	id;		/* top-level vdev id */
+	uint64_t	guid;		/* top-level vdev guid */
+	uint64_t	islog;		/* is an intent log device */
+	uint64_t	writes;		/* lwbs written */
+	uint64_t	bytes;		/* bytes of lwbs written */
+	uint64_t	lat;		/* total lwb write latency (ns) */
+	uint64_t	lat_max;	/* slowest lwb write (ns) */
+} spa_zil_vdev_stats_t;
+
+static int
+spa_zil_vdev_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-8s %-20s %-4s %-12s %-16s %-12s "
+	    "%-12s\n", "vdev", "guid", "log", "writes", "bytes", "avg_ns",
+	    "max_ns");
+
+	return (0);
+}
+
+static int
+spa_zil_vdev_data(char *buf, size_t size, void *data)
+{
+	spa_zil_vdev_stats_t *szv = (spa_zil_vdev_stats_t *)data;
+	uint64_t avg = szv->writes ? szv->lat / szv->writes : 0;
+
+	(void) snprintf(buf, size, "%-8llu %-20llu %-4llu %-12llu %-16llu "
+	    "%-12llu %-12llu\n", (u_longlong_t)szv->id,
+	    (u_longlong_t)szv->guid, (u_longlong_t)szv->islog,
+	    (u_longlong_t)szv->writes, (u_longlong_t)szv->bytes,
+	    (u_longlong_t)avg, (u_longlong_t)szv->lat_max);
+
+	return (0);
+}
+
+/*
+ * Calculate the address for the next spa_zil_vdev_stats_t entry.  The
+ * ssh->lock will be held until ksp->ks_ndata entries are processed.
+ */
+static void *
+spa_zil_vdev_addr(kstat_t *ksp, off_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zil_vdev_stats;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (n < ssh->count)
+		return ((spa_zil_vdev_stats_t *)ssh->_private + n);
+
+	return (NULL);
+}
+
+/*
+ * Snapshot the intent log counters of every top-level vdev which is either
+ * a log device or has received lwbs.  When the kstat is written the
+ * counters are reset.
+ */
+static int
+spa_zil_vdev_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zil_vdev_stats;
+	spa_zil_vdev_stats_t *szv;
+	vdev_t *rvd;
+	uint64_t c;
+
+	if (ssh->_private != NULL) {
+		kmem_free(ssh->_private, ssh->size);
+		ssh->_private = NULL;
+	}
+	ssh->count = 0;
+	ssh->size = 0;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	rvd = spa->spa_root_vdev;
+	if (rvd != NULL && rvd->vdev_children != 0) {
+		ssh->size = rvd->vdev_children * sizeof (spa_zil_vdev_stats_t);
+		ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+		szv = ssh->_private;
+
+		for (c = 0; c < rvd->vdev_children; c++) {
+			vdev_t *vd = rvd->vdev_child[c];
+
+			if (rw == KSTAT_WRITE) {
+				vd->vdev_zil_writes = 0;
+				vd->vdev_zil_bytes = 0;
+				vd->vdev_zil_lat = 0;
+				vd->vdev_zil_lat_max = 0;
+				continue;
+			}
+
+			if (!vd->vdev_islog && vd->vdev_zil_writes == 0)
+				continue;
+
+			szv->id = vd->vdev_id;
+			szv->guid = vd->vdev_guid;
+			szv->islog = vd->vdev_islog;
+			szv->writes = vd->vdev_zil_writes;
+			szv->bytes = vd->vdev_zil_bytes;
+			szv->lat = vd->vdev_zil_lat;
+			szv->lat_max = vd->vdev_zil_lat_max;
+			szv++;
+			ssh->count++;
+		}
+	}
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	ksp->ks_ndata = ssh->count;
+	ksp->ks_data_size = ssh->count * sizeof (spa_zil_vdev_stats_t);
+
+	return (0);
+}
+
+static void
+spa_zil_vdev_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zil_vdev_stats;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = 0;
+	ssh->size = 0;
+	ssh->_private = NULL;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "zil_vdevs", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_zil_vdev_update;
+		kstat_set_raw_ops(ksp, spa_zil_vdev_headers,
+		    spa_zil_vdev_data, spa_zil_vdev_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_zil_vdev_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zil_vdev_stats;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * Account a completed lwb write of 'size' bytes to top-level vdev 'vd'.
+ * The maximum is updated without a lock; a racing writer may be lost.
+ */
+void
+spa_zil_vdev_add(vdev_t *vd, uint64_t size, hrtime_t lat)
+{
+	atomic_inc_64(&vd->vdev_zil_writes);
+	atomic_add_64(&vd->vdev_zil_bytes, size);
+	atomic_add_64(&vd->vdev_zil_lat, lat);
+	if (lat > vd->vdev_zil_lat_max)
+		vd->vdev_zil_lat_max = lat;
+}
+
+/*
+ * ==========================================================================
+ * SPA Vdev Queue Routines
+ * ==========================================================================
+ */
+
+/*
+ * I/O scheduler statistics - Information exported regarding the current
+ * max_active of each i/o class of each leaf vdev and the state of its
+ * adaptive controller (see vdev_queue_adapt()).
+ */
+typedef struct spa_vdev_queue_stats {
+	uint64_t	guid;		/* leaf vdev guid */
+	uint64_t	priority;	/* i/o class */
+	uint64_t	active;		/* i/os issued to the disk */
+	uint64_t	queued;		/* i/os waiting to be issued */
+	uint64_t	max_active;	/* current limit */
+	uint64_t	lat_avg;	/* average disk service time (ns) */
+	uint64_t	increases;	/* times the limit was raised */
+	uint64_t	decreases;	/* times the limit was lowered */
+	uint64_t	agg_ios;	/* aggregated i/os issued */
+	uint64_t	agg_copy_saved;	/* bytes not copied by aggregation */
+} spa_vdev_queue_stats_t;
+
+static const char *spa_vdev_queue_class_name[ZIO_PRIORITY_NUM_QUEUEABLE] = {
+	"sync_read", "sync_write", "async_read", "async_write", "scrub", "trim"
+};
+
+static int
+spa_vdev_queue_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-20s %-12s %-8s %-8s %-8s %-12s %-10s "
+	    "%-10s %-12s %-16s\n", "guid", "class", "active", "queued", "limit",
+	    "avg_us", "increases", "decreases", "agg_ios", "agg_copy_saved");
+
+	return (0);
+}
+
+static int
+spa_vdev_queue_data(char *buf, size_t size, void *data)
+{
+	spa_vdev_queue_stats_t *svq = (spa_vdev_queue_stats_t *)data;
+
+	(void) snprintf(buf, size, "%-20llu %-12s %-8llu %-8llu %-8llu "
+	    "%-12llu %-10llu %-10llu %-12llu %-16llu\n",
+	    (u_longlong_t)svq->guid,
+	    spa_vdev_queue_class_name[svq->priority],
+	    (u_longlong_t)svq->active, (u_longlong_t)svq->queued,
+	    (u_longlong_t)svq->max_active,
+	    (u_longlong_t)(svq->lat_avg / (NANOSEC / MICROSEC)),
+	    (u_longlong_t)svq->increases, (u_longlong_t)svq->decreases,
+	    (u_longlong_t)svq->agg_ios, (u_longlong_t)svq->agg_copy_saved);
+
+	return (0);
+}
+
+/*
+ * Calculate the address for the next spa_vdev_queue_stats_t entry.  The
+ * ssh->lock will be held until ksp->ks_ndata entries are processed.
+ */
+static void *
+spa_vdev_queue_addr(kstat_t *ksp, off_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_queue_stats;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (n < ssh->count)
+		return ((spa_vdev_queue_stats_t *)ssh->_private + n);
+
+	return (NULL);
+}
+
+static uint64_t
+spa_vdev_queue_leaves(vdev_t *vd)
+{
+	uint64_t c, n = vd->vdev_ops->vdev_op_leaf ? 1 : 0;
+
+	for (c = 0; c < vd->vdev_children; c++)
+		n += spa_vdev_queue_leaves(vd->vdev_child[c]);
+
+	return (n);
+}
+
+static void
+spa_vdev_queue_fill(spa_stats_history_t *ssh, vdev_t *vd)
+{
+	spa_vdev_queue_stats_t *svq;
+	vdev_queue_class_t *vqc;
+	zio_priority_t p;
+	uint64_t c;
+
+	for (c = 0; c < vd->vdev_children; c++)
+		spa_vdev_queue_fill(ssh, vd->vdev_child[c]);
+
+	if (!vd->vdev_ops->vdev_op_leaf)
+		return;
+
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+		svq = (spa_vdev_queue_stats_t *)ssh->_private + ssh->count++;
+		vqc = &vd->vdev_queue.vq_class[p];
+
+		svq->guid = vd->vdev_guid;
+		svq->priority = p;
+		svq->active = vqc->vqc_active;
+		svq->queued = avl_numnodes(&vqc->vqc_queued_tree);
+		svq->max_active = vdev_queue_max_active(vd, p);
+		svq->lat_avg = vqc->vqc_lat_avg;
+		svq->increases = vqc->vqc_increases;
+		svq->decreases = vqc->vqc_decreases;
+		svq->agg_ios = vqc->vqc_agg_ios;
+		svq->agg_copy_saved = vqc->vqc_agg_copy_saved;
+	}
+}
+
+/*
+ * Snapshot the scheduler state of every leaf vdev.  The values are read
+ * without the vq_lock; they are only a point in time view.
+ */
+static int
+spa_vdev_queue_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_queue_stats;
+	vdev_t *rvd;
+	uint64_t leaves;
+
+	if (ssh->_private != NULL) {
+		kmem_free(ssh->_private, ssh->size);
+		ssh->_private = NULL;
+	}
+	ssh->count = 0;
+	ssh->size = 0;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	rvd = spa->spa_root_vdev;
+	if (rvd != NULL && (leaves = spa_vdev_queue_leaves(rvd)) != 0) {
+		ssh->size = leaves * ZIO_PRIORITY_NUM_QUEUEABLE *
+		    sizeof (spa_vdev_queue_stats_t);
+		ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+		spa_vdev_queue_fill(ssh, rvd);
+	}
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	ksp->ks_ndata = ssh->count;
+	ksp->ks_data_size = ssh->count * sizeof (spa_vdev_queue_stats_t);
+
+	return (0);
+}
+
+static void
+spa_vdev_queue_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_queue_stats;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = 0;
+	ssh->size = 0;
+	ssh->_private = NULL;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "vdev_queues", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_vdev_queue_update;
+		kstat_set_raw_ops(ksp, spa_vdev_queue_headers,
+		    spa_vdev_queue_data, spa_vdev_queue_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_vdev_queue_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_queue_stats;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+
+	mutex_destroy(&ssh->lock);
+}
+
 void
 spa_stats_init(spa_t *spa)
 {
@@ -662,6 +1041,8 @@ spa_stats_init(spa_t *spa)
 	spa_txg_history_init(spa);
 	spa_tx_assign_init(spa);
 	spa_io_history_init(spa);
+	spa_zil_vdev_init(spa);
+	spa_vdev_queue_init(spa);
 }
 
 void
@@ -671,4 +1052,6 @@ spa_stats_destroy(spa_t *spa)
 	spa_txg_history_destroy(spa);
 	spa_read_history_destroy(spa);
 	spa_io_history_destroy(spa);
+	spa_zil_vdev_destroy(spa);
+	spa_vdev_queue_destroy(spa);
 }
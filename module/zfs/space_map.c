@@ -132,6 +132,53 @@ space_map_load(space_map_t *sm, range_tree_t *rt, maptype_t maptype)
 	return (error);
 }
 
+/*
+ * Call the callback for every entry of a log space map, stopping at the
+ * first callback that returns non-zero.  Unlike space_map_load(), this
+ * reads the whole object as it is in the current txg.
+ */
+int
+space_map_iterate_log(space_map_t *sm, sm_log_cb_t callback, void *arg)
+{
+	uint64_t *entry, *entry_map, *entry_map_end;
+	uint64_t bufsize, size, offset, end;
+	int error = 0;
+
+	end = sm->sm_phys->smp_objsize;
+	VERIFY0(P2PHASE(end, 2 * sizeof (uint64_t)));
+
+	bufsize = MAX(sm->sm_blksz, SPA_MINBLOCKSIZE);
+	entry_map = zio_buf_alloc(bufsize);
+
+	if (end > bufsize) {
+		dmu_prefetch(sm->sm_os, space_map_object(sm), 0, bufsize,
+		    end - bufsize, ZIO_PRIORITY_SYNC_READ);
+	}
+
+	for (offset = 0; offset < end && error == 0; offset += bufsize) {
+		size = MIN(end - offset, bufsize);
+
+		error = dmu_read(sm->sm_os, space_map_object(sm), offset, size,
+		    entry_map, DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+
+		entry_map_end = entry_map + (size / sizeof (uint64_t));
+		for (entry = entry_map; entry < entry_map_end && error == 0;
+		    entry += 2) {
+			uint64_t e = entry[0];
+
+			error = callback(SM_LOG_TYPE_DECODE(e),
+			    SM_LOG_VDEV_DECODE(e),
+			    entry[1] << SPA_MINBLOCKSHIFT,
+			    SM_LOG_RUN_DECODE(e) << SPA_MINBLOCKSHIFT, arg);
+		}
+	}
+
+	zio_buf_free(entry_map, bufsize);
+	return (error);
+}
+
 void
 space_map_histogram_clear(space_map_t *sm)
 {
@@ -212,7 +259,8 @@ space_map_histogram_add(space_map_t *sm, range_tree_t *rt, dmu_tx_t *tx)
 uint64_t
 space_map_entries(space_map_t *sm, range_tree_t *rt)
 {
-	avl_tree_t *t = &rt->rt_root;
+	zfs_btree_t *t = &rt->rt_root;
+	zfs_btree_index_t where;
 	range_seg_t *rs;
 	uint64_t size, entries;
 
@@ -225,8 +273,10 @@ space_map_entries(space_map_t *sm, range_tree_t *rt)
 	 * Traverse the range tree and calculate the number of space map
 	 * entries that would be required to write out the range tree.
 	 */
-	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs)) {
-		size = (rs->rs_end - rs->rs_start) >> sm->sm_shift;
+	for (rs = zfs_btree_first(t, &where); rs != NULL;
+	    rs = zfs_btree_next(t, &where, &where)) {
+		size = (rs_get_end(rs, rt) - rs_get_start(rs, rt)) >>
+		    sm->sm_shift;
 		entries += howmany(size, SM_RUN_MAX);
 	}
 	return (entries);
@@ -241,7 +291,8 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 {
 	objset_t *os = sm->sm_os;
 	spa_t *spa = dmu_objset_spa(os);
-	avl_tree_t *t = &rt->rt_root;
+	zfs_btree_t *t = &rt->rt_root;
+	zfs_btree_index_t where;
 	range_seg_t *rs;
 	uint64_t size, total, rt_space, nodes;
 	uint64_t *entry, *entry_map, *entry_map_end;
@@ -281,13 +332,15 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 	    SM_DEBUG_TXG_ENCODE(dmu_tx_get_txg(tx));
 
 	total = 0;
-	nodes = avl_numnodes(&rt->rt_root);
+	nodes = zfs_btree_numnodes(t);
 	rt_space = range_tree_space(rt);
-	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs)) {
+	for (rs = zfs_btree_first(t, &where); rs != NULL;
+	    rs = zfs_btree_next(t, &where, &where)) {
 		uint64_t start;
 
-		size = (rs->rs_end - rs->rs_start) >> sm->sm_shift;
-		start = (rs->rs_start - sm->sm_start) >> sm->sm_shift;
+		size = (rs_get_end(rs, rt) - rs_get_start(rs, rt)) >>
+		    sm->sm_shift;
+		start = (rs_get_start(rs, rt) - sm->sm_start) >> sm->sm_shift;
 
 		total += size << sm->sm_shift;
 
@@ -330,13 +383,105 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 	 * Ensure that the space_map's accounting wasn't changed
 	 * while we were in the middle of writing it out.
 	 */
-	VERIFY3U(nodes, ==, avl_numnodes(&rt->rt_root));
+	VERIFY3U(nodes, ==, zfs_btree_numnodes(t));
 	VERIFY3U(range_tree_space(rt), ==, rt_space);
 	VERIFY3U(range_tree_space(rt), ==, total);
 
 	zio_buf_free(entry_map, sm->sm_blksz);
 }
 
+/*
+ * Append the segments of the range tree to a log space map as entries of
+ * the given vdev.  Entries are two words, so that a block always holds a
+ * whole number of them.
+ *
+ * Note: space_map_write_log() will drop rt_lock across dmu_write() calls.
+ */
+void
+space_map_write_log(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
+    uint64_t vdev, dmu_tx_t *tx)
+{
+	objset_t *os = sm->sm_os;
+	zfs_btree_t *t = &rt->rt_root;
+	zfs_btree_index_t where;
+	range_seg_t *rs;
+	uint64_t size, nodes, rt_space;
+	uint64_t *entry, *entry_map, *entry_map_end;
+
+	ASSERT(MUTEX_HELD(rt->rt_lock));
+	ASSERT(dsl_pool_sync_context(dmu_objset_pool(os)));
+	ASSERT3U(vdev, <=, SM_LOG_VDEV_MAX);
+	VERIFY3U(space_map_object(sm), !=, 0);
+
+	if (range_tree_space(rt) == 0)
+		return;
+
+	dmu_buf_will_dirty(sm->sm_dbuf, tx);
+
+	if (maptype == SM_ALLOC)
+		sm->sm_phys->smp_alloc += range_tree_space(rt);
+	else
+		sm->sm_phys->smp_alloc -= range_tree_space(rt);
+
+	entry_map = zio_buf_alloc(sm->sm_blksz);
+	entry_map_end = entry_map + (sm->sm_blksz / sizeof (uint64_t));
+	entry = entry_map;
+
+	nodes = zfs_btree_numnodes(t);
+	rt_space = range_tree_space(rt);
+	for (rs = zfs_btree_first(t, &where); rs != NULL;
+	    rs = zfs_btree_next(t, &where, &where)) {
+		uint64_t rstart = rs_get_start(rs, rt);
+		uint64_t rend = rs_get_end(rs, rt);
+		uint64_t start;
+
+		VERIFY0(P2PHASE(rstart, SPA_MINBLOCKSIZE));
+		VERIFY0(P2PHASE(rend, SPA_MINBLOCKSIZE));
+		size = (rend - rstart) >> SPA_MINBLOCKSHIFT;
+		start = rstart >> SPA_MINBLOCKSHIFT;
+
+		while (size != 0) {
+			uint64_t run_len = MIN(size, SM_LOG_RUN_MAX);
+
+			if (entry == entry_map_end) {
+				mutex_exit(rt->rt_lock);
+				dmu_write(os, space_map_object(sm),
+				    sm->sm_phys->smp_objsize, sm->sm_blksz,
+				    entry_map, tx);
+				mutex_enter(rt->rt_lock);
+				sm->sm_phys->smp_objsize += sm->sm_blksz;
+				entry = entry_map;
+			}
+
+			*entry++ = SM_LOG_TYPE_ENCODE(maptype) |
+			    SM_LOG_VDEV_ENCODE(vdev) |
+			    SM_LOG_RUN_ENCODE(run_len);
+			*entry++ = start;
+
+			start += run_len;
+			size -= run_len;
+		}
+	}
+
+	if (entry != entry_map) {
+		size = (entry - entry_map) * sizeof (uint64_t);
+		mutex_exit(rt->rt_lock);
+		dmu_write(os, space_map_object(sm), sm->sm_phys->smp_objsize,
+		    size, entry_map, tx);
+		mutex_enter(rt->rt_lock);
+		sm->sm_phys->smp_objsize += size;
+	}
+
+	/*
+	 * Ensure that the range tree wasn't changed while we were in the
+	 * middle of writing it out.
+	 */
+	VERIFY3U(nodes, ==, zfs_btree_numnodes(t));
+	VERIFY3U(range_tree_space(rt), ==, rt_space);
+
+	zio_buf_free(entry_map, sm->sm_blksz);
+}
+
 static int
 space_map_open_impl(space_map_t *sm)
 {
@@ -539,6 +684,32 @@ space_map_length(space_map_t *sm)
 	return (sm != NULL ? sm->sm_length : 0);
 }
 
+/*
+ * Returns the txg the space map was last brought up to date in by a
+ * metaslab flush: changes of later txgs may still be held in the pool's
+ * log space maps (see spa_log_spacemap.c).  Zero for space maps which
+ * have never been flushed or which predate the histogram.
+ */
+uint64_t
+space_map_flush_txg(space_map_t *sm)
+{
+	if (sm == NULL || sm->sm_dbuf->db_size != sizeof (space_map_phys_t))
+		return (0);
+	return (sm->sm_phys->smp_flush_txg);
+}
+
+void
+space_map_set_flush_txg(space_map_t *sm, uint64_t txg, dmu_tx_t *tx)
+{
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	if (sm->sm_dbuf->db_size != sizeof (space_map_phys_t))
+		return;
+
+	dmu_buf_will_dirty(sm->sm_dbuf, tx);
+	sm->sm_phys->smp_flush_txg = txg;
+}
+
 /*
  * Returns the allocated space that is currently syncing.
  */
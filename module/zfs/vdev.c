@@ -43,6 +43,8 @@
 #include <sys/arc.h>
 #include <sys/zil.h>
 #include <sys/dsl_scan.h>
+#include <sys/vdev_trim.h>
+#include <sys/zfeature.h>
 #include <sys/zvol.h>
 #include <sys/zfs_context.h>
 #include <sys/abd.h>
@@ -355,6 +357,11 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	mutex_init(&vd->vdev_stat_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_probe_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_queue_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_scan_io_queue_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_trim_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vd->vdev_trim_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&vd->vdev_trim_io_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vd->vdev_trim_io_cv, NULL, CV_DEFAULT, NULL);
 	for (t = 0; t < DTL_TYPES; t++) {
 		vd->vdev_dtl[t] = range_tree_create(NULL, NULL,
 		    &vd->vdev_dtl_lock);
@@ -370,6 +377,36 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	return (vd);
 }
 
+/*
+ * The metaslab class a top-level vdev with the given bias allocates for.
+ */
+static metaslab_class_t *
+vdev_alloc_class(spa_t *spa, vdev_alloc_bias_t alloc_bias)
+{
+	switch (alloc_bias) {
+	case VDEV_BIAS_LOG:
+		return (spa_log_class(spa));
+	case VDEV_BIAS_SPECIAL:
+		return (spa_special_class(spa));
+	case VDEV_BIAS_DEDUP:
+		return (spa_dedup_class(spa));
+	default:
+		return (spa_normal_class(spa));
+	}
+}
+
+static vdev_alloc_bias_t
+vdev_derive_alloc_bias(const char *bias)
+{
+	if (strcmp(bias, VDEV_ALLOC_BIAS_LOG) == 0)
+		return (VDEV_BIAS_LOG);
+	if (strcmp(bias, VDEV_ALLOC_BIAS_SPECIAL) == 0)
+		return (VDEV_BIAS_SPECIAL);
+	if (strcmp(bias, VDEV_ALLOC_BIAS_DEDUP) == 0)
+		return (VDEV_BIAS_DEDUP);
+	return (VDEV_BIAS_NONE);
+}
+
 /*
  * Allocate a new vdev.  The 'alloctype' is used to control whether we are
  * creating a new vdev or loading an existing one - the behavior is slightly
@@ -380,8 +417,9 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
     int alloctype)
 {
 	vdev_ops_t *ops;
-	char *type;
+	char *type, *bias;
 	uint64_t guid = 0, islog, nparity;
+	vdev_alloc_bias_t alloc_bias = VDEV_BIAS_NONE;
 	vdev_t *vd;
 
 	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == SCL_ALL);
@@ -430,6 +468,23 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	if (islog && spa_version(spa) < SPA_VERSION_SLOGS)
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * Determine the allocation class of a top-level vdev.  Adding special
+	 * or dedup vdevs to an existing pool needs the allocation_classes
+	 * feature; spa_create() checks for it itself.
+	 */
+	if (islog) {
+		alloc_bias = VDEV_BIAS_LOG;
+	} else if (nvlist_lookup_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS,
+	    &bias) == 0) {
+		alloc_bias = vdev_derive_alloc_bias(bias);
+		if (alloctype == VDEV_ALLOC_ADD &&
+		    spa->spa_load_state != SPA_LOAD_CREATE &&
+		    !spa_feature_is_enabled(spa,
+		    SPA_FEATURE_ALLOCATION_CLASSES))
+			return (SET_ERROR(ENOTSUP));
+	}
+
 	if (ops == &vdev_hole_ops && spa_version(spa) < SPA_VERSION_HOLES)
 		return (SET_ERROR(ENOTSUP));
 
@@ -473,6 +528,8 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 
 	vd->vdev_islog = islog;
 	vd->vdev_nparity = nparity;
+	if (parent && !parent->vdev_parent)
+		vd->vdev_alloc_bias = alloc_bias;
 
 	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &vd->vdev_path) == 0)
 		vd->vdev_path = spa_strdup(vd->vdev_path);
@@ -534,8 +591,8 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		    alloctype == VDEV_ALLOC_ADD ||
 		    alloctype == VDEV_ALLOC_SPLIT ||
 		    alloctype == VDEV_ALLOC_ROOTPOOL);
-		vd->vdev_mg = metaslab_group_create(islog ?
-		    spa_log_class(spa) : spa_normal_class(spa), vd);
+		vd->vdev_mg = metaslab_group_create(vdev_alloc_class(spa,
+		    alloc_bias), vd);
 	}
 
 	if (vd->vdev_ops->vdev_op_leaf &&
@@ -654,6 +711,16 @@ vdev_free(vdev_t *vd)
 
 	ASSERT(vd->vdev_parent == NULL);
 
+	/*
+	 * Discard any scrub/resilver I/O still queued for this vdev.
+	 */
+	if (vd->vdev_scan_io_queue != NULL) {
+		mutex_enter(&vd->vdev_scan_io_queue_lock);
+		dsl_scan_io_queue_destroy(vd->vdev_scan_io_queue);
+		vd->vdev_scan_io_queue = NULL;
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+	}
+
 	/*
 	 * Clean up vdev structure.
 	 */
@@ -686,6 +753,13 @@ vdev_free(vdev_t *vd)
 	mutex_exit(&vd->vdev_dtl_lock);
 
 	mutex_destroy(&vd->vdev_queue_lock);
+	mutex_destroy(&vd->vdev_scan_io_queue_lock);
+	ASSERT3P(vd->vdev_trim_thread, ==, NULL);
+	ASSERT3P(vd->vdev_autotrim_thread, ==, NULL);
+	mutex_destroy(&vd->vdev_trim_lock);
+	cv_destroy(&vd->vdev_trim_cv);
+	mutex_destroy(&vd->vdev_trim_io_lock);
+	cv_destroy(&vd->vdev_trim_io_cv);
 	mutex_destroy(&vd->vdev_dtl_lock);
 	mutex_destroy(&vd->vdev_stat_lock);
 	mutex_destroy(&vd->vdev_probe_lock);
@@ -763,6 +837,12 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 
 	tvd->vdev_islog = svd->vdev_islog;
 	svd->vdev_islog = 0;
+
+	tvd->vdev_alloc_bias = svd->vdev_alloc_bias;
+	svd->vdev_alloc_bias = VDEV_BIAS_NONE;
+
+	dsl_scan_io_queue_vdev_xfer(svd, tvd);
+	vdev_trim_xfer(svd, tvd);
 }
 
 static void
@@ -948,6 +1028,11 @@ vdev_metaslab_fini(vdev_t *vd)
 	uint64_t m;
 	uint64_t count = vd->vdev_ms_count;
 
+	/*
+	 * The trim threads may be using the metaslabs.
+	 */
+	vdev_trim_stop_wait(vd);
+
 	if (vd->vdev_ms != NULL) {
 		metaslab_group_passivate(vd->vdev_mg);
 		for (m = 0; m < count; m++) {
@@ -1790,14 +1875,11 @@ vdev_dtl_empty(vdev_t *vd, vdev_dtl_type_t t)
 static uint64_t
 vdev_dtl_min(vdev_t *vd)
 {
-	range_seg_t *rs;
-
 	ASSERT(MUTEX_HELD(&vd->vdev_dtl_lock));
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_first(&vd->vdev_dtl[DTL_MISSING]->rt_root);
-	return (rs->rs_start - 1);
+	return (range_tree_min(vd->vdev_dtl[DTL_MISSING]) - 1);
 }
 
 /*
@@ -1806,14 +1888,11 @@ vdev_dtl_min(vdev_t *vd)
 static uint64_t
 vdev_dtl_max(vdev_t *vd)
 {
-	range_seg_t *rs;
-
 	ASSERT(MUTEX_HELD(&vd->vdev_dtl_lock));
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_last(&vd->vdev_dtl[DTL_MISSING]->rt_root);
-	return (rs->rs_end);
+	return (range_tree_max(vd->vdev_dtl[DTL_MISSING]));
 }
 
 /*
@@ -2049,6 +2128,11 @@ vdev_construct_zaps(vdev_t *vd, dmu_tx_t *tx)
 		}
 		if (vd == vd->vdev_top && vd->vdev_top_zap == 0) {
 			vd->vdev_top_zap = vdev_create_link_zap(vd, tx);
+			if (vd->vdev_alloc_bias == VDEV_BIAS_SPECIAL ||
+			    vd->vdev_alloc_bias == VDEV_BIAS_DEDUP) {
+				spa_feature_incr(vd->vdev_spa,
+				    SPA_FEATURE_ALLOCATION_CLASSES, tx);
+			}
 		}
 	}
 	for (uint64_t i = 0; i < vd->vdev_children; i++) {
@@ -2321,7 +2405,7 @@ vdev_remove(vdev_t *vd, uint64_t txg)
 			 */
 			metaslab_group_histogram_remove(mg, msp);
 
-			VERIFY0(space_map_allocated(msp->ms_sm));
+			VERIFY0(metaslab_allocated_space(msp));
 			space_map_free(msp->ms_sm, tx);
 			space_map_close(msp->ms_sm);
 			msp->ms_sm = NULL;
@@ -2880,6 +2964,15 @@ vdev_get_stats_ex_impl(vdev_t *vd, vdev_stat_t *vs, vdev_stat_ex_t *vsx)
 			    &vd->vdev_queue.vq_class[t].vqc_queued_tree);
 		}
 	}
+
+	/*
+	 * Mirror read counters belong to this vdev as a mirror child and
+	 * are not aggregated from its own children.
+	 */
+	if (vsx) {
+		vsx->vsx_mirror_reads = vd->vdev_mirror_reads;
+		vsx->vsx_mirror_read_lat = vd->vdev_mirror_read_lat;
+	}
 }
 
 void
@@ -2907,6 +3000,17 @@ vdev_get_stats_ex(vdev_t *vd, vdev_stat_t *vs, vdev_stat_ex_t *vsx)
 		    !vd->vdev_ishole) {
 			vs->vs_fragmentation = vd->vdev_mg->mg_fragmentation;
 		}
+		if (vd == vd->vdev_top && !vd->vdev_ishole) {
+			mutex_enter(&vd->vdev_trim_lock);
+			vs->vs_trim_state = vd->vdev_trim_state;
+			vs->vs_trim_action_time = vd->vdev_trim_action_time;
+			vs->vs_trim_bytes_done = vd->vdev_trim_offset;
+			vs->vs_trim_bytes_est =
+			    vd->vdev_ms_count << vd->vdev_ms_shift;
+			mutex_exit(&vd->vdev_trim_lock);
+		}
+		if (vd->vdev_ops->vdev_op_leaf)
+			vs->vs_trim_notsup = vd->vdev_notrim;
 	}
 
 	ASSERT(spa_config_held(vd->vdev_spa, SCL_ALL, RW_READER) != 0);
@@ -540,6 +540,11 @@ skip_open:
 	 */
 	vd->vdev_nowritecache = B_FALSE;
 
+	/*
+	 * Likewise for the notrim bit.
+	 */
+	vd->vdev_notrim = B_FALSE;
+
 #ifdef __APPLE__
 	/* Inform the ZIO pipeline that we are non-rotational */
 	vd->vdev_nonrot = B_FALSE;
@@ -730,6 +735,34 @@ vdev_disk_ioctl_done(void *zio_arg, int error)
 	zio_interrupt(zio);
 }
 
+#ifdef DKIOCUNMAP
+/*
+ * Unmap the range of a trim zio.  The ioctl is synchronous, so it is
+ * issued from a taskq rather than from vdev_disk_io_start().
+ */
+static void
+vdev_disk_io_trim(void *arg)
+{
+	zio_t *zio = (zio_t *)arg;
+	vdev_disk_t *dvd = zio->io_vd->vdev_tsd;
+	dk_extent_t extent;
+	dk_unmap_t unmap;
+
+	bzero(&extent, sizeof (extent));
+	extent.offset = zio->io_offset;
+	extent.length = zio->io_size;
+
+	bzero(&unmap, sizeof (unmap));
+	unmap.extents = &extent;
+	unmap.extentsCount = 1;
+
+	zio->io_error = ldi_ioctl(dvd->vd_lh, DKIOCUNMAP, (intptr_t)&unmap,
+	    FKIOCTL, kcred, NULL);
+
+	zio_delay_interrupt(zio);
+}
+#endif
+
 static void
 vdev_disk_io_start(zio_t *zio)
 {
@@ -818,6 +851,19 @@ vdev_disk_io_start(zio_t *zio)
 			flags = B_READ | B_ASYNC;
 		break;
 
+	case ZIO_TYPE_FREE:
+#ifdef DKIOCUNMAP
+		if (!vd->vdev_notrim) {
+			zio->io_target_timestamp = zio_handle_io_delay(zio);
+			VERIFY3U(taskq_dispatch(system_taskq,
+			    vdev_disk_io_trim, zio, TQ_SLEEP), !=, 0);
+			return;
+		}
+#endif
+		zio->io_error = SET_ERROR(ENOTSUP);
+		zio_interrupt(zio);
+		return;
+
 	default:
 		zio->io_error = SET_ERROR(ENOTSUP);
 		zio_execute(zio);
@@ -73,6 +73,9 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	/* Rotational optimizations only make sense on block devices */
 	vd->vdev_nonrot = B_TRUE;
 
+	/* Assume the file system can punch holes until it fails to */
+	vd->vdev_notrim = B_FALSE;
+
 	/*
 	 * We must have a pathname, and it must be absolute.
 	 */
@@ -273,6 +276,54 @@ vdev_file_io_strategy(void *arg)
 	zio_delay_interrupt(zio);
 }
 
+/*
+ * Trim a range of the file by punching a hole in it, which returns the
+ * space to the file system the vdev lives on.
+ */
+static int
+vdev_file_punch_hole(vnode_t *vp, uint64_t offset, uint64_t size)
+{
+#ifdef _KERNEL
+#ifdef F_PUNCHHOLE
+	vfs_context_t context;
+	fpunchhole_t fp;
+	int error;
+
+	bzero(&fp, sizeof (fp));
+	fp.fp_offset = offset;
+	fp.fp_length = size;
+
+	context = vfs_context_create(spl_vfs_context_kernel());
+	error = VNOP_IOCTL(vp, F_PUNCHHOLE, (caddr_t)&fp, 0, context);
+	(void) vfs_context_rele(context);
+
+	return (error);
+#else
+	return (SET_ERROR(ENOTSUP));
+#endif
+#else
+	return (vn_punch_hole(vp, offset, size));
+#endif
+}
+
+static void
+vdev_file_io_trim(void *arg)
+{
+	zio_t *zio = (zio_t *)arg;
+	vdev_t *vd = zio->io_vd;
+	vdev_file_t *vf = vd->vdev_tsd;
+
+	if (!vnode_getwithvid(vf->vf_vnode, vf->vf_vid)) {
+		zio->io_error = vdev_file_punch_hole(vf->vf_vnode,
+		    zio->io_offset, zio->io_size);
+		vnode_put(vf->vf_vnode);
+	} else {
+		zio->io_error = SET_ERROR(EIO);
+	}
+
+	zio_delay_interrupt(zio);
+}
+
 static void
 vdev_file_io_start(zio_t *zio)
 {
@@ -304,6 +355,19 @@ vdev_file_io_start(zio_t *zio)
         return;
     }
 
+	if (zio->io_type == ZIO_TYPE_FREE) {
+		if (vd->vdev_notrim) {
+			zio->io_error = SET_ERROR(ENOTSUP);
+			zio_interrupt(zio);
+			return;
+		}
+
+		zio->io_target_timestamp = zio_handle_io_delay(zio);
+		VERIFY3U(taskq_dispatch(system_taskq, vdev_file_io_trim, zio,
+		    TQ_SLEEP), !=, 0);
+		return;
+	}
+
 	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
 	zio->io_target_timestamp = zio_handle_io_delay(zio);
 
@@ -343,6 +343,13 @@ vdev_config_generate_stats(vdev_t *vd, nvlist_t *nv)
 	    vsx->vsx_agg_histo[ZIO_PRIORITY_SCRUB],
 	    ARRAY_SIZE(vsx->vsx_agg_histo[ZIO_PRIORITY_SCRUB]));
 
+	/* Mirror child read selection */
+	fnvlist_add_uint64(nvx, ZPOOL_CONFIG_VDEV_MIRROR_READS,
+	    vsx->vsx_mirror_reads);
+
+	fnvlist_add_uint64(nvx, ZPOOL_CONFIG_VDEV_MIRROR_READ_LAT,
+	    vsx->vsx_mirror_read_lat);
+
 	/* Add extended stats nvlist to main nvlist */
 	fnvlist_add_nvlist(nv, ZPOOL_CONFIG_VDEV_STATS_EX, nvx);
 
@@ -420,6 +427,13 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_ASIZE,
 		    vd->vdev_asize);
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_IS_LOG, vd->vdev_islog);
+		if (vd->vdev_alloc_bias == VDEV_BIAS_SPECIAL) {
+			fnvlist_add_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS,
+			    VDEV_ALLOC_BIAS_SPECIAL);
+		} else if (vd->vdev_alloc_bias == VDEV_BIAS_DEDUP) {
+			fnvlist_add_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS,
+			    VDEV_ALLOC_BIAS_DEDUP);
+		}
 		if (vd->vdev_removing)
 			fnvlist_add_uint64(nv, ZPOOL_CONFIG_REMOVING,
 			    vd->vdev_removing);
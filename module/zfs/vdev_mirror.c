@@ -43,6 +43,7 @@ typedef struct mirror_child {
 	uint64_t	mc_offset;
 	int		mc_error;
 	int		mc_load;
+	hrtime_t	mc_issued;
 	uint8_t		mc_tried;
 	uint8_t		mc_skipped;
 	uint8_t		mc_speculative;
@@ -78,6 +79,21 @@ uint64_t zfs_vdev_mirror_rotating_seek_offset = 1 * 1024 * 1024;
 uint64_t zfs_vdev_mirror_non_rotating_inc = 0;
 uint64_t zfs_vdev_mirror_non_rotating_seek_inc = 1;
 
+/*
+ * Latency based load calculation.  When enabled, each child's load is the
+ * time it is expected to take to complete the bytes already in flight to it
+ * plus this read, based on a moving average of the read latency and size
+ * seen from that child.  Children whose load is within
+ * zfs_vdev_mirror_latency_hysteresis percent of the lowest are treated as
+ * equal, so that similar devices share reads rather than flapping between
+ * each other.  A child which has not completed a read for
+ * zfs_vdev_mirror_latency_stale_ms is sent a read once idle so that its
+ * estimate follows the device after it recovers.
+ */
+int zfs_vdev_mirror_latency_select = 0;
+uint64_t zfs_vdev_mirror_latency_hysteresis = 25;
+uint64_t zfs_vdev_mirror_latency_stale_ms = 1000;
+
 static inline size_t
 vdev_mirror_map_size(int children)
 {
@@ -113,8 +129,33 @@ static const zio_vsd_ops_t vdev_mirror_vsd_ops = {
 	zio_vsd_default_cksum_report
 };
 
+/*
+ * Expected time in microseconds for vd to complete a read of 'size' bytes
+ * behind the reads already in flight to it.
+ */
+static int
+vdev_mirror_latency_load(vdev_t *vd, uint64_t size)
+{
+	uint64_t lat = vd->vdev_mirror_lat_avg;
+	uint64_t avg_size = MAX(vd->vdev_mirror_size_avg, SPA_MINBLOCKSIZE);
+	uint64_t inflight = vd->vdev_mirror_inflight;
+	uint64_t load;
+
+	if (lat == 0)
+		return (0);
+
+	if (inflight == 0 && gethrtime() - vd->vdev_mirror_sampled >
+	    MSEC2NSEC(zfs_vdev_mirror_latency_stale_ms))
+		return (0);
+
+	load = lat / (NANOSEC / MICROSEC) * (inflight + size) / avg_size;
+
+	return ((int)MIN(load, INT_MAX - 1));
+}
+
 static int
-vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
+vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset,
+    uint64_t zio_size)
 {
 	uint64_t lastoffset;
 	int load;
@@ -123,6 +164,9 @@ vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
 	if (mm->mm_root)
 		return (INT_MAX);
 
+	if (zfs_vdev_mirror_latency_select)
+		return (vdev_mirror_latency_load(vd, zio_size));
+
 	/*
 	 * We don't return INT_MAX if the device is resilvering i.e.
 	 * vdev_resilver_txg != 0 as when tested performance was slightly
@@ -250,11 +294,63 @@ vdev_mirror_close(vdev_t *vd)
 		vdev_close(vd->vdev_child[c]);
 }
 
+/*
+ * Account a read the mirror is about to issue to child mc.
+ */
+static void
+vdev_mirror_read_start(mirror_map_t *mm, mirror_child_t *mc, zio_t *zio)
+{
+	vdev_t *vd = mc->mc_vd;
+
+	if (mm->mm_root)
+		return;
+
+	mc->mc_issued = gethrtime();
+	atomic_inc_64(&vd->vdev_mirror_reads);
+	atomic_add_64(&vd->vdev_mirror_inflight, zio->io_size);
+}
+
+/*
+ * Fold a completed read into its child's latency and size averages.  The
+ * averages are updated without a lock; a racing update may be lost, which
+ * is harmless for an estimate.
+ */
+static void
+vdev_mirror_read_done(mirror_child_t *mc, zio_t *zio)
+{
+	vdev_t *vd = mc->mc_vd;
+	hrtime_t now = gethrtime();
+	uint64_t lat = now - mc->mc_issued;
+
+	mc->mc_issued = 0;
+	atomic_add_64(&vd->vdev_mirror_inflight, -(int64_t)zio->io_size);
+
+	if (zio->io_error != 0)
+		return;
+
+	atomic_add_64(&vd->vdev_mirror_read_lat, lat);
+
+	/* moving averages with a weight of 1/8 for the newest sample */
+	if (vd->vdev_mirror_lat_avg == 0) {
+		vd->vdev_mirror_lat_avg = lat;
+		vd->vdev_mirror_size_avg = zio->io_size;
+	} else {
+		vd->vdev_mirror_lat_avg += ((int64_t)lat -
+		    (int64_t)vd->vdev_mirror_lat_avg) / 8;
+		vd->vdev_mirror_size_avg += ((int64_t)zio->io_size -
+		    (int64_t)vd->vdev_mirror_size_avg) / 8;
+	}
+	vd->vdev_mirror_sampled = now;
+}
+
 static void
 vdev_mirror_child_done(zio_t *zio)
 {
 	mirror_child_t *mc = zio->io_private;
 
+	if (mc->mc_issued != 0)
+		vdev_mirror_read_done(mc, zio);
+
 	mc->mc_error = zio->io_error;
 	mc->mc_tried = 1;
 	mc->mc_skipped = 0;
@@ -342,6 +438,7 @@ vdev_mirror_child_select(zio_t *zio)
 {
 	mirror_map_t *mm = zio->io_vsd;
 	uint64_t txg = zio->io_txg;
+	boolean_t latency = zfs_vdev_mirror_latency_select && !mm->mm_root;
 	int c, lowest_load;
 
 	ASSERT(zio->io_bp == NULL || BP_PHYSICAL_BIRTH(zio->io_bp) == txg);
@@ -369,7 +466,12 @@ vdev_mirror_child_select(zio_t *zio)
 			continue;
 		}
 
-		mc->mc_load = vdev_mirror_load(mm, mc->mc_vd, mc->mc_offset);
+		mc->mc_load = vdev_mirror_load(mm, mc->mc_vd, mc->mc_offset,
+		    zio->io_size);
+		if (latency) {
+			lowest_load = MIN(lowest_load, mc->mc_load);
+			continue;
+		}
 		if (mc->mc_load > lowest_load)
 			continue;
 
@@ -381,6 +483,26 @@ vdev_mirror_child_select(zio_t *zio)
 		mm->mm_preferred_cnt++;
 	}
 
+	/*
+	 * With latency based loads prefer every child within the hysteresis
+	 * band of the lowest load.
+	 */
+	if (latency && lowest_load != INT_MAX) {
+		uint64_t limit = (uint64_t)lowest_load *
+		    (100 + zfs_vdev_mirror_latency_hysteresis) / 100;
+
+		for (c = 0; c < mm->mm_children; c++) {
+			mirror_child_t *mc = &mm->mm_child[c];
+
+			if (mc->mc_tried || mc->mc_skipped ||
+			    mc->mc_load > limit)
+				continue;
+
+			mm->mm_preferred[mm->mm_preferred_cnt] = c;
+			mm->mm_preferred_cnt++;
+		}
+	}
+
 	if (mm->mm_preferred_cnt == 1) {
 		vdev_queue_register_lastoffset(
 		    mm->mm_child[mm->mm_preferred[0]].mc_vd, zio);
@@ -447,10 +569,11 @@ vdev_mirror_io_start(zio_t *zio)
 		c = vdev_mirror_child_select(zio);
 		children = (c >= 0);
 	} else {
-		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
+		ASSERT(zio->io_type == ZIO_TYPE_WRITE ||
+		    zio->io_type == ZIO_TYPE_FREE);
 
 		/*
-		 * Writes go to all children.
+		 * Writes and trims go to all children.
 		 */
 		c = 0;
 		children = mm->mm_children;
@@ -458,6 +581,8 @@ vdev_mirror_io_start(zio_t *zio)
 
 	while (children--) {
 		mc = &mm->mm_child[c];
+		if (zio->io_type == ZIO_TYPE_READ)
+			vdev_mirror_read_start(mm, mc, zio);
 		zio_nowait(zio_vdev_child_io(zio, zio->io_bp,
 		    mc->mc_vd, mc->mc_offset, zio->io_abd, zio->io_size,
 		    zio->io_type, zio->io_priority, 0,
@@ -502,7 +627,7 @@ vdev_mirror_io_done(zio_t *zio)
 		}
 	}
 
-	if (zio->io_type == ZIO_TYPE_WRITE) {
+	if (zio->io_type == ZIO_TYPE_WRITE || zio->io_type == ZIO_TYPE_FREE) {
 		/*
 		 * XXX -- for now, treat partial writes as success.
 		 *
@@ -544,6 +669,7 @@ vdev_mirror_io_done(zio_t *zio)
 		ASSERT(c >= 0 && c < mm->mm_children);
 		mc = &mm->mm_child[c];
 		zio_vdev_io_redone(zio);
+		vdev_mirror_read_start(mm, mc, zio);
 		zio_nowait(zio_vdev_child_io(zio, zio->io_bp,
 		    mc->mc_vd, mc->mc_offset, zio->io_abd, zio->io_size,
 		    ZIO_TYPE_READ, zio->io_priority, 0,
@@ -119,6 +119,21 @@
  * maximum percentage, this indicates that the rate of incoming data is
  * greater than the rate that the backend storage can handle. In this case, we
  * must further throttle incoming writes (see dmu_tx_delay() for details).
+ *
+ * Adaptive Limits
+ *
+ * The static per-class max_active values above can only be right for one
+ * kind of device, and pools mixing rotating and solid state vdevs need very
+ * different limits per vdev.  When zfs_vdev_queue_adaptive is set, each leaf
+ * vdev instead runs a small controller per I/O class (see vdev_queue_adapt())
+ * which steers that class's max_active towards the depth at which the disk
+ * service time, the same io_delay recorded in vsx_disk_histo, stays under
+ * zfs_vdev_queue_target_latency_us.  The limit is raised by one while the
+ * class is backlogged and under target, and cut by a quarter once the
+ * target is exceeded.  It never drops below the class's min_active nor
+ * rises above zfs_vdev_queue_adaptive_max_pct percent of its static
+ * max_active.  For async writes the dirty data ramp still applies, between
+ * zfs_vdev_async_write_min_active and the adaptive limit.
  */
 
 /*
@@ -139,7 +154,7 @@ uint32_t zfs_vdev_max_active = 1000;
  * depending on underlying storage.
  *
  * The ratio of the queues' max_actives determines the balance of performance
- * between reads, writes, and scrubs.  E.g., increasing
+ * between reads, writes, scrubs and trims.  E.g., increasing
  * zfs_vdev_scrub_max_active will cause the scrub or resilver to complete
  * more quickly, but reads and writes to have higher latency and lower
  * throughput.
@@ -154,6 +169,8 @@ uint32_t zfs_vdev_async_write_min_active = 1;
 uint32_t zfs_vdev_async_write_max_active = 10;
 uint32_t zfs_vdev_scrub_min_active = 1;
 uint32_t zfs_vdev_scrub_max_active = 2;
+uint32_t zfs_vdev_trim_min_active = 1;
+uint32_t zfs_vdev_trim_max_active = 2;
 
 /*
  * When the pool has less than zfs_vdev_async_write_active_min_dirty_percent
@@ -175,6 +192,13 @@ int zfs_vdev_aggregation_limit = SPA_OLD_MAXBLOCKSIZE;
 int zfs_vdev_read_gap_limit = 32 << 10;
 int zfs_vdev_write_gap_limit = 4 << 10;
 
+/*
+ * Issue aggregated I/Os directly from, or into, the buffers of the I/Os
+ * they are made of, by building the aggregate's data as a gang ABD,
+ * instead of copying everything through a bounce buffer.
+ */
+int zfs_vdev_aggregate_gang = 1;
+
 /*
  * Define the queue depth percentage for each top-level. This percentage is
  * used in conjunction with zfs_vdev_async_max_active to determine how many
@@ -191,6 +215,21 @@ uint64_t zfs_vdev_queue_depth_pct = 1000;
 uint64_t zfs_vdev_queue_depth_pct = 300;
 #endif
 
+/*
+ * Adaptive per-vdev max_active, see "Adaptive Limits" above.  The target is
+ * the average disk service time, in microseconds, each I/O class should be
+ * held under; the limits are allowed to grow up to
+ * zfs_vdev_queue_adaptive_max_pct percent of the static max_active.
+ */
+int zfs_vdev_queue_adaptive = 0;
+uint64_t zfs_vdev_queue_target_latency_us = 10000;
+uint32_t zfs_vdev_queue_adaptive_max_pct = 400;
+
+/*
+ * Number of completions in a class between controller adjustments.
+ */
+#define	VDEV_QUEUE_ADAPT_IOS	32
+
 int
 vdev_queue_offset_compare(const void *x1, const void *x2)
 {
@@ -219,11 +258,14 @@ vdev_queue_class_tree(vdev_queue_t *vq, zio_priority_t p)
 static inline avl_tree_t *
 vdev_queue_type_tree(vdev_queue_t *vq, zio_type_t t)
 {
-	ASSERT(t == ZIO_TYPE_READ || t == ZIO_TYPE_WRITE);
+	ASSERT(t == ZIO_TYPE_READ || t == ZIO_TYPE_WRITE ||
+	    t == ZIO_TYPE_FREE);
 	if (t == ZIO_TYPE_READ)
 		return (&vq->vq_read_offset_tree);
-	else
+	else if (t == ZIO_TYPE_WRITE)
 		return (&vq->vq_write_offset_tree);
+	else
+		return (&vq->vq_trim_offset_tree);
 }
 
 int
@@ -259,16 +301,23 @@ vdev_queue_class_min_active(zio_priority_t p)
 		return (zfs_vdev_async_write_min_active);
 	case ZIO_PRIORITY_SCRUB:
 		return (zfs_vdev_scrub_min_active);
+	case ZIO_PRIORITY_TRIM:
+		return (zfs_vdev_trim_min_active);
 	default:
 		panic("invalid priority %u", p);
 		return (0);
 	}
 }
 
+/*
+ * Return the async write limit for the current amount of dirty data,
+ * interpolated between zfs_vdev_async_write_min_active and max_active.
+ */
 static int
-vdev_queue_max_async_writes(spa_t *spa)
+vdev_queue_max_async_writes(spa_t *spa, uint32_t max_active)
 {
 	int writes;
+	uint32_t min_active = MIN(zfs_vdev_async_write_min_active, max_active);
 	uint64_t dirty = spa->spa_dsl_pool->dp_dirty_total;
 	uint64_t min_bytes =  zfs_dirty_data_max *
 		zfs_vdev_async_write_active_min_dirty_percent / 100;
@@ -279,13 +328,13 @@ vdev_queue_max_async_writes(spa_t *spa)
 	 * execution time of those actions we push data out as fast as possible.
 	 */
 	if (spa_has_pending_synctask(spa)) {
-		return (zfs_vdev_async_write_max_active);
+		return (max_active);
 	}
 
 	if (dirty < min_bytes)
-		return (zfs_vdev_async_write_min_active);
+		return (min_active);
 	if (dirty > max_bytes)
-		return (zfs_vdev_async_write_max_active);
+		return (max_active);
 
 	/*
 	 * linear interpolation:
@@ -293,19 +342,15 @@ vdev_queue_max_async_writes(spa_t *spa)
 	 * move right by min_bytes
 	 * move up by min_writes
 	 */
-	writes = (dirty - min_bytes) *
-		zfs_vdev_async_write_max_active -
-		zfs_vdev_async_write_min_active /
-		(uint64_t)(
-		(max_bytes - min_bytes) +
-	    zfs_vdev_async_write_min_active);
-	ASSERT3U(writes, >=, zfs_vdev_async_write_min_active);
-	ASSERT3U(writes, <=, zfs_vdev_async_write_max_active);
+	writes = (dirty - min_bytes) * (max_active - min_active) /
+	    (max_bytes - min_bytes) + min_active;
+	ASSERT3U(writes, >=, min_active);
+	ASSERT3U(writes, <=, max_active);
 	return (writes);
 }
 
-static int
-vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
+static uint32_t
+vdev_queue_class_static_max_active(zio_priority_t p)
 {
 	switch (p) {
 	case ZIO_PRIORITY_SYNC_READ:
@@ -315,15 +360,83 @@ vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
 	case ZIO_PRIORITY_ASYNC_READ:
 		return (zfs_vdev_async_read_max_active);
 	case ZIO_PRIORITY_ASYNC_WRITE:
-		return (vdev_queue_max_async_writes(spa));
+		return (zfs_vdev_async_write_max_active);
 	case ZIO_PRIORITY_SCRUB:
 		return (zfs_vdev_scrub_max_active);
+	case ZIO_PRIORITY_TRIM:
+		return (zfs_vdev_trim_max_active);
 	default:
 		panic("invalid priority %u", p);
 		return (0);
 	}
 }
 
+static int
+vdev_queue_class_max_active(vdev_queue_t *vq, zio_priority_t p)
+{
+	uint32_t max_active;
+
+	if (zfs_vdev_queue_adaptive)
+		max_active = vq->vq_class[p].vqc_max_active;
+	else
+		max_active = vdev_queue_class_static_max_active(p);
+
+	if (p == ZIO_PRIORITY_ASYNC_WRITE)
+		return (vdev_queue_max_async_writes(vq->vq_vdev->vdev_spa,
+		    max_active));
+
+	return (max_active);
+}
+
+/*
+ * Feed the disk service time of a completed i/o to its class's controller,
+ * and every VDEV_QUEUE_ADAPT_IOS completions move the class's max_active
+ * towards zfs_vdev_queue_target_latency_us: additive increase while the
+ * class is backlogged and under target, multiplicative decrease when over.
+ */
+static void
+vdev_queue_adapt(vdev_queue_t *vq, zio_t *zio)
+{
+	zio_priority_t p = zio->io_priority;
+	vdev_queue_class_t *vqc = &vq->vq_class[p];
+	uint64_t target = USEC2NSEC(zfs_vdev_queue_target_latency_us);
+	uint32_t min_active, max_active, limit;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (!zfs_vdev_queue_adaptive || zio->io_error != 0 ||
+	    zio->io_delay <= 0)
+		return;
+
+	/* moving average with a weight of 1/8 for the newest sample */
+	if (vqc->vqc_lat_avg == 0)
+		vqc->vqc_lat_avg = zio->io_delay;
+	else
+		vqc->vqc_lat_avg += ((int64_t)zio->io_delay -
+		    (int64_t)vqc->vqc_lat_avg) / 8;
+
+	if (++vqc->vqc_adapt_ios < VDEV_QUEUE_ADAPT_IOS)
+		return;
+	vqc->vqc_adapt_ios = 0;
+
+	min_active = MAX(vdev_queue_class_min_active(p), 1);
+	max_active = MAX(vdev_queue_class_static_max_active(p) *
+	    zfs_vdev_queue_adaptive_max_pct / 100, min_active);
+	limit = MIN(MAX(vqc->vqc_max_active, min_active), max_active);
+
+	if (vqc->vqc_lat_avg > target) {
+		limit = MAX(limit - MAX(limit / 4, 1), min_active);
+		if (limit < vqc->vqc_max_active)
+			vqc->vqc_decreases++;
+	} else if (avl_numnodes(&vqc->vqc_queued_tree) > 0 &&
+	    limit < max_active) {
+		limit++;
+		vqc->vqc_increases++;
+	}
+
+	vqc->vqc_max_active = limit;
+}
+
 /*
  * Return the i/o class to issue from, or ZIO_PRIORITY_MAX_QUEUEABLE if
  * there is no eligible class.
@@ -331,7 +444,6 @@ vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
 static zio_priority_t
 vdev_queue_class_to_issue(vdev_queue_t *vq)
 {
-	spa_t *spa = vq->vq_vdev->vdev_spa;
 	zio_priority_t p;
 
 	if (avl_numnodes(&vq->vq_active_tree) >= zfs_vdev_max_active)
@@ -352,7 +464,7 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
 		if (avl_numnodes(vdev_queue_class_tree(vq, p)) > 0 &&
 		    vq->vq_class[p].vqc_active <
-		    vdev_queue_class_max_active(spa, p))
+		    vdev_queue_class_max_active(vq, p))
 			return (p);
 	}
 
@@ -378,6 +490,9 @@ vdev_queue_init(vdev_t *vd)
 	avl_create(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE),
 		vdev_queue_offset_compare, sizeof (zio_t),
 		offsetof(struct zio, io_offset_node));
+	avl_create(vdev_queue_type_tree(vq, ZIO_TYPE_FREE),
+		vdev_queue_offset_compare, sizeof (zio_t),
+		offsetof(struct zio, io_offset_node));
 
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
 		int (*compfn) (const void *, const void *);
@@ -393,6 +508,10 @@ vdev_queue_init(vdev_t *vd)
 			compfn = vdev_queue_offset_compare;
 		avl_create(vdev_queue_class_tree(vq, p), compfn,
 			sizeof (zio_t), offsetof(struct zio, io_queue_node));
+
+		/* the adaptive limit starts out at the static one */
+		vq->vq_class[p].vqc_max_active =
+		    vdev_queue_class_static_max_active(p);
 	}
 
 	vq->vq_lastoffset = 0;
@@ -409,6 +528,7 @@ vdev_queue_fini(vdev_t *vd)
 	avl_destroy(&vq->vq_active_tree);
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_READ));
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE));
+	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_FREE));
 
 	mutex_destroy(&vq->vq_lock);
 }
@@ -511,7 +631,8 @@ vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
 static void
 vdev_queue_agg_io_done(zio_t *aio)
 {
-	if (aio->io_type == ZIO_TYPE_READ) {
+	/* A gang was read straight into the parents' buffers */
+	if (aio->io_type == ZIO_TYPE_READ && !abd_is_gang(aio->io_abd)) {
 		zio_t *pio;
 		zio_link_t *zl = NULL;
 		while ((pio = zio_walk_parents(aio, &zl)) != NULL) {
@@ -537,7 +658,8 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 {
 	zio_t *first, *last, *aio, *dio, *mandatory, *nio;
 	uint64_t maxgap = 0;
-	uint64_t size;
+	uint64_t size, saved = 0;
+	abd_t *abd;
 	boolean_t stretch = B_FALSE;
 	avl_tree_t *t = vdev_queue_type_tree(vq, zio->io_type);
 	enum zio_flag flags = zio->io_flags & ZIO_FLAG_AGG_INHERIT;
@@ -657,8 +779,13 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	size = IO_SPAN(first, last);
 	ASSERT3U(size, <=, SPA_MAXBLOCKSIZE);
 
+	if (zfs_vdev_aggregate_gang)
+		abd = abd_alloc_gang();
+	else
+		abd = abd_alloc_for_io(size, B_TRUE);
+
 	aio = zio_vdev_delegated_io(first->io_vd, first->io_offset,
-	    abd_alloc_for_io(size, B_TRUE), size, first->io_type,
+	    abd, size, first->io_type,
 	    zio->io_priority, flags | ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE,
 	    vdev_queue_agg_io_done, NULL);
 	aio->io_timestamp = first->io_timestamp;
@@ -669,7 +796,29 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 		nio = AVL_NEXT(t, dio);
 		ASSERT3U(dio->io_type, ==, aio->io_type);
 
-		if (dio->io_flags & ZIO_FLAG_NODATA) {
+		if (abd_is_gang(abd)) {
+			/*
+			 * The I/Os are sorted and never overlap (see the
+			 * IO_GAP() checks above), so each one starts at or
+			 * after the end of the gang built so far.
+			 */
+			uint64_t end = aio->io_offset + abd->abd_size;
+
+			ASSERT3U(dio->io_offset, >=, end);
+			if (dio->io_offset > end) {
+				abd_gang_add_gap(abd, dio->io_offset - end,
+				    dio->io_type == ZIO_TYPE_WRITE);
+			}
+
+			if (dio->io_flags & ZIO_FLAG_NODATA) {
+				ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
+				abd_gang_add_gap(abd, dio->io_size, B_TRUE);
+			} else {
+				abd_gang_add(abd, dio->io_abd, 0,
+				    dio->io_size);
+				saved += dio->io_size;
+			}
+		} else if (dio->io_flags & ZIO_FLAG_NODATA) {
 			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
 			abd_zero_off(aio->io_abd,
 			    dio->io_offset - aio->io_offset, dio->io_size);
@@ -684,6 +833,11 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 		zio_execute(dio);
 	} while (dio != last);
 
+	ASSERT3U(abd->abd_size, ==, size);
+
+	vq->vq_class[zio->io_priority].vqc_agg_ios++;
+	vq->vq_class[zio->io_priority].vqc_agg_copy_saved += saved;
+
 	return (aio);
 }
 
@@ -765,6 +919,9 @@ vdev_queue_io(zio_t *zio)
 		    zio->io_priority != ZIO_PRIORITY_ASYNC_READ &&
 		    zio->io_priority != ZIO_PRIORITY_SCRUB)
 			zio->io_priority = ZIO_PRIORITY_ASYNC_READ;
+	} else if (zio->io_type == ZIO_TYPE_FREE) {
+		/* Only trims of freed space are queued as frees. */
+		zio->io_priority = ZIO_PRIORITY_TRIM;
 	} else {
 		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
 		if (zio->io_priority != ZIO_PRIORITY_SYNC_WRITE &&
@@ -805,6 +962,8 @@ vdev_queue_io_done(zio_t *zio)
 	vq->vq_io_complete_ts = gethrtime();
 	vq->vq_io_delta_ts = vq->vq_io_complete_ts - zio->io_timestamp;
 
+	vdev_queue_adapt(vq, zio);
+
 	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
 		mutex_exit(&vq->vq_lock);
 		if (nio->io_done == vdev_queue_agg_io_done) {
@@ -831,6 +990,24 @@ vdev_queue_length(vdev_t *vd)
 	return (avl_numnodes(&vd->vdev_queue.vq_active_tree));
 }
 
+/*
+ * Current max_active of an i/o class, including any adaptive adjustment.
+ */
+uint32_t
+vdev_queue_max_active(vdev_t *vd, zio_priority_t p)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+
+	/* the async write ramp needs the dsl_pool, which may not be open */
+	if (vd->vdev_spa->spa_dsl_pool == NULL) {
+		return (zfs_vdev_queue_adaptive ?
+		    vq->vq_class[p].vqc_max_active :
+		    vdev_queue_class_static_max_active(p));
+	}
+
+	return (vdev_queue_class_max_active(vq, p));
+}
+
 uint64_t
 vdev_queue_lastoffset(vdev_t *vd)
 {
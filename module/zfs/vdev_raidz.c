@@ -27,6 +27,8 @@
 #include <sys/zfs_context.h>
 #include <sys/spa.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
 #include <sys/vdev_disk.h>
 #include <sys/vdev_file.h>
 #include <sys/zio.h>
@@ -102,61 +104,6 @@
  * or in concert to recover missing data columns.
  */
 
-typedef struct raidz_col {
-	uint64_t rc_devidx;		/* child device index for I/O */
-	uint64_t rc_offset;		/* device offset */
-	uint64_t rc_size;		/* I/O size */
-	abd_t *rc_abd;			/* I/O data */
-	void *rc_gdata;			/* used to store the "good" version */
-	int rc_error;			/* I/O error for this device */
-	uint8_t rc_tried;		/* Did we attempt this I/O column? */
-	uint8_t rc_skipped;		/* Did we skip this I/O column? */
-} raidz_col_t;
-
-typedef struct raidz_map {
-	uint64_t rm_cols;		/* Regular column count */
-	uint64_t rm_scols;		/* Count including skipped columns */
-	uint64_t rm_bigcols;		/* Number of oversized columns */
-	uint64_t rm_asize;		/* Actual total I/O size */
-	uint64_t rm_missingdata;	/* Count of missing data devices */
-	uint64_t rm_missingparity;	/* Count of missing parity devices */
-	uint64_t rm_firstdatacol;	/* First data column/parity count */
-	uint64_t rm_nskip;		/* Skipped sectors for padding */
-	uint64_t rm_skipstart;		/* Column index of padding start */
-	abd_t *rm_abd_copy;		/* rm_asize-buffer of copied data */
-	uintptr_t rm_reports;		/* # of referencing checksum reports */
-	uint8_t	rm_freed;		/* map no longer has referencing ZIO */
-	uint8_t	rm_ecksuminjected;	/* checksum error was injected */
-	raidz_col_t rm_col[1];		/* Flexible array of I/O columns */
-} raidz_map_t;
-
-#define	VDEV_RAIDZ_P		0
-#define	VDEV_RAIDZ_Q		1
-#define	VDEV_RAIDZ_R		2
-
-#define	VDEV_RAIDZ_MUL_2(x)	(((x) << 1) ^ (((x) & 0x80) ? 0x1d : 0))
-#define	VDEV_RAIDZ_MUL_4(x)	(VDEV_RAIDZ_MUL_2(VDEV_RAIDZ_MUL_2(x)))
-
-/*
- * We provide a mechanism to perform the field multiplication operation on a
- * 64-bit value all at once rather than a byte at a time. This works by
- * creating a mask from the top bit in each byte and using that to
- * conditionally apply the XOR of 0x1d.
- */
-#define	VDEV_RAIDZ_64MUL_2(x, mask) \
-{ \
-	(mask) = (x) & 0x8080808080808080ULL; \
-	(mask) = ((mask) << 1) - ((mask) >> 7); \
-	(x) = (((x) << 1) & 0xfefefefefefefefeULL) ^ \
-	    ((mask) & 0x1d1d1d1d1d1d1d1dULL); \
-}
-
-#define	VDEV_RAIDZ_64MUL_4(x, mask) \
-{ \
-	VDEV_RAIDZ_64MUL_2((x), mask); \
-	VDEV_RAIDZ_64MUL_2((x), mask); \
-}
-
 #define VDEV_LABEL_OFFSET(x)    (x + VDEV_LABEL_START_SIZE)
 
 /*
@@ -235,8 +182,6 @@ static const uint8_t vdev_raidz_log2[256] = {
 	0x74, 0xd6, 0xf4, 0xea, 0xa8, 0x50, 0x58, 0xaf,
 };
 
-static void vdev_raidz_generate_parity(raidz_map_t *rm);
-
 /*
  * Multiply a given number by 2 raised to the given power.
  */
@@ -256,7 +201,7 @@ vdev_raidz_exp2(uint_t a, int exp)
 	return (vdev_raidz_pow2[exp]);
 }
 
-static void
+void
 vdev_raidz_map_free(raidz_map_t *rm)
 {
 	int c;
@@ -456,7 +401,7 @@ static const zio_vsd_ops_t vdev_raidz_vsd_ops = {
  * Avoid inlining the function to keep vdev_raidz_io_start(), which
  * is this functions only caller, as small as possible on the stack.
  */
-static raidz_map_t *
+raidz_map_t *
 vdev_raidz_map_alloc(abd_t *abd, uint64_t size, uint64_t offset,
     uint64_t unit_shift, uint64_t dcols, uint64_t nparity)
 {
@@ -791,9 +736,16 @@ vdev_raidz_generate_parity_pqr(raidz_map_t *rm)
  * Generate RAID parity in the first virtual columns according to the number of
  * parity columns available.
  */
-static void
+void
 vdev_raidz_generate_parity(raidz_map_t *rm)
 {
+	const raidz_impl_ops_t *ops = vdev_raidz_math_get_ops();
+
+	if (ops != NULL) {
+		vdev_raidz_math_generate(ops, rm);
+		return;
+	}
+
 	switch (rm->rm_firstdatacol) {
 	case 1:
 		vdev_raidz_generate_parity_p(rm);
@@ -1471,14 +1423,17 @@ vdev_raidz_reconstruct_general(raidz_map_t *rm, int *tgts, int ntgts)
 	uint8_t *used;
 
 	abd_t **bufs = NULL;
+	const raidz_impl_ops_t *ops = vdev_raidz_math_get_ops();
 
 	int code = 0;
 
 	/*
-	 * Matrix reconstruction can't use scatter ABDs yet, so we allocate
-	 * temporary linear ABDs.
+	 * The original matrix reconstruction can't use scatter ABDs, so we
+	 * allocate temporary linear ABDs.  The vectorized implementations
+	 * iterate over the ABD chunks directly.
 	 */
-	if (!abd_is_linear(rm->rm_col[rm->rm_firstdatacol].rc_abd)) {
+	if (ops == NULL &&
+	    !abd_is_linear(rm->rm_col[rm->rm_firstdatacol].rc_abd)) {
 		bufs = kmem_alloc(rm->rm_cols * sizeof (abd_t *), KM_PUSHPAGE);
 
 		for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
@@ -1572,8 +1527,13 @@ vdev_raidz_reconstruct_general(raidz_map_t *rm, int *tgts, int ntgts)
 	/*
 	 * Reconstruct the missing data using the generated matrix.
 	 */
-	vdev_raidz_matrix_reconstruct(rm, n, nmissing_rows, missing_rows,
-	    invrows, used);
+	if (ops != NULL) {
+		vdev_raidz_math_reconstruct(ops, rm, n, nmissing_rows,
+		    missing_rows, invrows, used);
+	} else {
+		vdev_raidz_matrix_reconstruct(rm, n, nmissing_rows,
+		    missing_rows, invrows, used);
+	}
 
 	kmem_free(p, psize);
 
@@ -1596,7 +1556,7 @@ vdev_raidz_reconstruct_general(raidz_map_t *rm, int *tgts, int ntgts)
 	return (code);
 }
 
-static int
+int
 vdev_raidz_reconstruct(raidz_map_t *rm, int *t, int nt)
 {
 	int tgts[VDEV_RAIDZ_MAXPARITY], *dt;
@@ -1641,8 +1601,11 @@ vdev_raidz_reconstruct(raidz_map_t *rm, int *t, int nt)
 
 	/*
 	 * See if we can use any of our optimized reconstruction routines.
+	 * The vectorized implementations handle every combination of
+	 * missing columns through the general method.
 	 */
-	if (!vdev_raidz_default_to_general) {
+	if (!vdev_raidz_default_to_general &&
+	    vdev_raidz_math_get_ops() == NULL) {
 		switch (nbaddata) {
 		case 1:
 			if (parity_valid[VDEV_RAIDZ_P])
@@ -1920,6 +1883,35 @@ vdev_raidz_child_done(zio_t *zio)
  *      vdevs have had errors, then create zio read operations to the parity
  *      columns' VDevs as well.
  */
+static void
+vdev_raidz_io_start_trim(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t width = vd->vdev_children;
+	uint64_t b_start = zio->io_offset >> ashift;
+	uint64_t b_end = (zio->io_offset + zio->io_size) >> ashift;
+	uint64_t c, start_row, end_row;
+
+	/*
+	 * Sector b of the vdev is at row (b / width) of child (b % width),
+	 * so each child holds a contiguous run of rows of the range.  Trim
+	 * them without a map, parity sectors being unused along with data.
+	 */
+	for (c = 0; c < width; c++) {
+		start_row = b_start > c ? ((b_start - c - 1) / width) + 1 : 0;
+		end_row = b_end > c ? ((b_end - c - 1) / width) + 1 : 0;
+		if (start_row >= end_row)
+			continue;
+
+		zio_nowait(zio_vdev_child_io(zio, NULL, vd->vdev_child[c],
+		    start_row << ashift, NULL, (end_row - start_row) << ashift,
+		    ZIO_TYPE_FREE, zio->io_priority, 0, NULL, NULL));
+	}
+
+	zio_execute(zio);
+}
+
 static void
 vdev_raidz_io_start(zio_t *zio)
 {
@@ -1930,6 +1922,11 @@ vdev_raidz_io_start(zio_t *zio)
 	raidz_col_t *rc;
 	int c, i;
 
+	if (zio->io_type == ZIO_TYPE_FREE) {
+		vdev_raidz_io_start_trim(zio);
+		return;
+	}
+
 	rm = vdev_raidz_map_alloc(zio->io_abd, zio->io_size, zio->io_offset,
 	    tvd->vdev_ashift, vd->vdev_children,
 	    vd->vdev_nparity);
@@ -2316,6 +2313,12 @@ vdev_raidz_io_done(zio_t *zio)
 	int tgts[VDEV_RAIDZ_MAXPARITY];
 	int code;
 
+	/*
+	 * Trims are best effort, and have no map.
+	 */
+	if (zio->io_type == ZIO_TYPE_FREE)
+		return;
+
 	ASSERT(zio->io_bp != NULL);  /* XXX need to add code to enforce this */
 
 	ASSERT(rm->rm_missingparity <= rm->rm_firstdatacol);
@@ -0,0 +1,420 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/abd.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
+
+/*
+ * Vectorized RAID-Z parity generation and reconstruction.
+ *
+ * Parity generation walks each data column once and folds it into P, Q
+ * and R with the gen_* kernels.  Reconstruction uses the matrix computed
+ * by vdev_raidz_reconstruct_general() for every combination of missing
+ * columns: each missing column is the sum of the surviving columns, each
+ * multiplied by a constant, which is exactly what the mul_add kernel
+ * computes.  Both walk the ABD chunks directly, so scatter ABDs no
+ * longer need to be copied into linear buffers.
+ *
+ * All implementations are benchmarked by vdev_raidz_math_init() and the
+ * fastest one is used unless zfs_vdev_raidz_impl selects another.
+ */
+
+/*
+ * Indexed by raidz_impl_id_t - RAIDZ_IMPL_SCALAR.
+ */
+static const raidz_impl_ops_t *vdev_raidz_impls[] = {
+	&vdev_raidz_scalar_ops,
+	&vdev_raidz_sse2_ops,
+	&vdev_raidz_ssse3_ops,
+	&vdev_raidz_avx2_ops,
+	&vdev_raidz_avx512bw_ops,
+};
+
+#define	RAIDZ_IMPL_CNT	\
+	(sizeof (vdev_raidz_impls) / sizeof (vdev_raidz_impls[0]))
+
+/*
+ * Tunable: which RAID-Z implementation to use, see raidz_impl_id_t.  Ids
+ * which are not usable on this system fall back to the fastest one.
+ */
+uint64_t zfs_vdev_raidz_impl = RAIDZ_IMPL_FASTEST;
+
+static const raidz_impl_ops_t *vdev_raidz_fastest = &vdev_raidz_scalar_ops;
+static const raidz_impl_ops_t *vdev_raidz_selected = NULL;
+
+const raidz_impl_ops_t *
+vdev_raidz_math_get_ops(void)
+{
+	return (vdev_raidz_selected);
+}
+
+/*
+ * Select the implementation used for new I/O.  Returns EINVAL for an
+ * unknown id and ENOTSUP for an implementation which is not usable here;
+ * the fastest implementation is selected in both cases.
+ */
+int
+vdev_raidz_impl_set(uint64_t id)
+{
+	const raidz_impl_ops_t *ops;
+	int error = 0;
+
+	if (id == RAIDZ_IMPL_FASTEST) {
+		ops = vdev_raidz_fastest;
+	} else if (id == RAIDZ_IMPL_ORIGINAL) {
+		ops = NULL;
+	} else if (id >= RAIDZ_IMPL_MAX) {
+		ops = vdev_raidz_fastest;
+		error = SET_ERROR(EINVAL);
+	} else if (!vdev_raidz_impls[id - RAIDZ_IMPL_SCALAR]->is_supported()) {
+		ops = vdev_raidz_fastest;
+		error = SET_ERROR(ENOTSUP);
+	} else {
+		ops = vdev_raidz_impls[id - RAIDZ_IMPL_SCALAR];
+	}
+
+	zfs_vdev_raidz_impl = (error == 0) ? id : RAIDZ_IMPL_FASTEST;
+	vdev_raidz_selected = ops;
+
+	return (error);
+}
+
+/*
+ * Parity generation
+ */
+typedef struct raidz_math_gen {
+	const raidz_impl_ops_t *rg_ops;
+	int rg_nparity;
+	uint8_t *rg_p;
+	uint8_t *rg_q;
+	uint8_t *rg_r;
+} raidz_math_gen_t;
+
+static void
+vdev_raidz_math_gen_run(const raidz_impl_ops_t *ops, raidz_math_gen_t *rg,
+    const uint8_t *d, size_t size)
+{
+	switch (rg->rg_nparity) {
+	case 1:
+		ops->gen_p(rg->rg_p, d, size);
+		break;
+	case 2:
+		ops->gen_pq(rg->rg_p, rg->rg_q, d, size);
+		rg->rg_q += size;
+		break;
+	case 3:
+		ops->gen_pqr(rg->rg_p, rg->rg_q, rg->rg_r, d, size);
+		rg->rg_q += size;
+		rg->rg_r += size;
+		break;
+	}
+	rg->rg_p += size;
+}
+
+static int
+vdev_raidz_math_gen_func(void *buf, size_t size, void *private)
+{
+	raidz_math_gen_t *rg = private;
+	size_t vsize = P2ALIGN(size, RAIDZ_MATH_BLOCK);
+
+	if (vsize != 0)
+		vdev_raidz_math_gen_run(rg->rg_ops, rg, buf, vsize);
+	if (size != vsize) {
+		vdev_raidz_math_gen_run(&vdev_raidz_scalar_ops, rg,
+		    (uint8_t *)buf + vsize, size - vsize);
+	}
+
+	return (0);
+}
+
+void
+vdev_raidz_math_generate(const raidz_impl_ops_t *ops, raidz_map_t *rm)
+{
+	uint8_t *par[VDEV_RAIDZ_MAXPARITY] = { NULL, NULL, NULL };
+	int nparity = rm->rm_firstdatacol;
+	uint64_t psize = rm->rm_col[VDEV_RAIDZ_P].rc_size;
+	uint64_t *q, *r, mask, i;
+	int c, p;
+
+	if (nparity < 1 || nparity > VDEV_RAIDZ_MAXPARITY)
+		cmn_err(CE_PANIC, "invalid RAID-Z configuration");
+
+	for (p = 0; p < nparity; p++) {
+		ASSERT3U(rm->rm_col[p].rc_size, ==, psize);
+		par[p] = abd_to_buf(rm->rm_col[p].rc_abd);
+	}
+
+	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+		abd_t *src = rm->rm_col[c].rc_abd;
+		uint64_t csize = rm->rm_col[c].rc_size;
+		raidz_math_gen_t rg;
+
+		ASSERT3U(csize, <=, psize);
+
+		if (c == rm->rm_firstdatacol) {
+			ASSERT(csize == psize || csize == 0);
+			abd_copy_to_buf_off(par[0], src, 0, csize);
+			bzero(par[0] + csize, psize - csize);
+			for (p = 1; p < nparity; p++)
+				bcopy(par[0], par[p], psize);
+			continue;
+		}
+
+		rg.rg_ops = ops;
+		rg.rg_nparity = nparity;
+		rg.rg_p = par[VDEV_RAIDZ_P];
+		rg.rg_q = par[VDEV_RAIDZ_Q];
+		rg.rg_r = par[VDEV_RAIDZ_R];
+		(void) abd_iterate_func(src, 0, csize,
+		    vdev_raidz_math_gen_func, &rg);
+
+		/*
+		 * Treat short columns as though they are full of 0s.
+		 * Note that there's therefore nothing needed for P.
+		 */
+		q = (uint64_t *)par[VDEV_RAIDZ_Q];
+		r = (uint64_t *)par[VDEV_RAIDZ_R];
+		for (i = csize / sizeof (uint64_t);
+		    nparity > 1 && i < psize / sizeof (uint64_t); i++) {
+			VDEV_RAIDZ_64MUL_2(q[i], mask);
+			if (nparity > 2)
+				VDEV_RAIDZ_64MUL_4(r[i], mask);
+		}
+	}
+}
+
+/*
+ * Reconstruction
+ */
+typedef struct raidz_math_rec {
+	const raidz_impl_ops_t *rr_ops;
+	uint8_t rr_coeff;
+} raidz_math_rec_t;
+
+static void
+vdev_raidz_math_mul_add(const raidz_impl_ops_t *ops, uint8_t *dst,
+    const uint8_t *src, size_t size, uint8_t c)
+{
+	if (c == 1)
+		ops->gen_p(dst, src, size);
+	else if (c != 0)
+		ops->mul_add(dst, src, size, c);
+}
+
+static int
+vdev_raidz_math_rec_func(void *dbuf, void *sbuf, size_t size, void *private)
+{
+	raidz_math_rec_t *rr = private;
+	size_t vsize = P2ALIGN(size, RAIDZ_MATH_BLOCK);
+
+	if (vsize != 0) {
+		vdev_raidz_math_mul_add(rr->rr_ops, dbuf, sbuf, vsize,
+		    rr->rr_coeff);
+	}
+	if (size != vsize) {
+		vdev_raidz_math_mul_add(&vdev_raidz_scalar_ops,
+		    (uint8_t *)dbuf + vsize, (uint8_t *)sbuf + vsize,
+		    size - vsize, rr->rr_coeff);
+	}
+
+	return (0);
+}
+
+/*
+ * Rebuild the missing data columns from the inverted matrix rows: missing
+ * column j is the sum over the used columns i of invrows[j][i] * used[i],
+ * with short columns treated as though they are full of 0s.
+ */
+void
+vdev_raidz_math_reconstruct(const raidz_impl_ops_t *ops, raidz_map_t *rm,
+    int n, int nmissing, const int *missing, uint8_t **invrows,
+    const uint8_t *used)
+{
+	int i, j, c, cc;
+
+	for (j = 0; j < nmissing; j++) {
+		raidz_col_t *dcol;
+
+		cc = missing[j] + rm->rm_firstdatacol;
+		ASSERT3U(cc, >=, rm->rm_firstdatacol);
+		ASSERT3U(cc, <, rm->rm_cols);
+		dcol = &rm->rm_col[cc];
+
+		abd_zero_off(dcol->rc_abd, 0, dcol->rc_size);
+
+		for (i = 0; i < n; i++) {
+			raidz_col_t *scol;
+			raidz_math_rec_t rr;
+
+			c = used[i];
+			ASSERT3U(c, <, rm->rm_cols);
+			ASSERT3U(c, !=, cc);
+			scol = &rm->rm_col[c];
+
+			rr.rr_ops = ops;
+			rr.rr_coeff = invrows[j][i];
+			(void) abd_iterate_func2(dcol->rc_abd, scol->rc_abd,
+			    0, 0, MIN(dcol->rc_size, scol->rc_size),
+			    vdev_raidz_math_rec_func, &rr);
+		}
+	}
+}
+
+/*
+ * Benchmark
+ *
+ * Every usable implementation is timed for RAIDZ_BENCH_NS generating
+ * triple parity over RAIDZ_BENCH_SIZE of data and multiplying the same
+ * amount of data during reconstruction.  The results are exported as
+ * bytes per second in the vdev_raidz_bench kstat; the implementation
+ * with the best combined rate becomes the default.
+ */
+#define	RAIDZ_BENCH_SIZE	(32 * 1024)
+#define	RAIDZ_BENCH_NS		(MSEC2NSEC(1))
+#define	RAIDZ_BENCH_COEFF	0x8e
+
+typedef struct raidz_math_kstat {
+	kstat_named_t rmks_gen[RAIDZ_IMPL_CNT];
+	kstat_named_t rmks_rec[RAIDZ_IMPL_CNT];
+	kstat_named_t rmks_fastest;
+	kstat_named_t rmks_selected;
+} raidz_math_kstat_t;
+
+static raidz_math_kstat_t vdev_raidz_kstat_data;
+static kstat_t *vdev_raidz_kstat;
+
+static uint64_t
+vdev_raidz_benchmark_impl(const raidz_impl_ops_t *ops, boolean_t gen,
+    uint8_t *buf)
+{
+	uint8_t *p = buf;
+	uint8_t *q = p + RAIDZ_BENCH_SIZE;
+	uint8_t *r = q + RAIDZ_BENCH_SIZE;
+	uint8_t *d = r + RAIDZ_BENCH_SIZE;
+	uint64_t run_count = 0, run_time_ns;
+	hrtime_t start;
+
+	kpreempt_disable();
+	start = gethrtime();
+	do {
+		int i;
+
+		for (i = 0; i < 16; i++, run_count++) {
+			if (gen)
+				ops->gen_pqr(p, q, r, d, RAIDZ_BENCH_SIZE);
+			else
+				ops->mul_add(p, d, RAIDZ_BENCH_SIZE,
+				    RAIDZ_BENCH_COEFF);
+		}
+	} while ((run_time_ns = gethrtime() - start) < RAIDZ_BENCH_NS);
+	kpreempt_enable();
+
+	return (RAIDZ_BENCH_SIZE * run_count * NANOSEC / MAX(run_time_ns, 1));
+}
+
+static int
+vdev_raidz_kstat_update(kstat_t *ksp, int rw)
+{
+	raidz_math_kstat_t *rmks = ksp->ks_data;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	rmks->rmks_selected.value.ui64 = zfs_vdev_raidz_impl;
+
+	return (0);
+}
+
+void
+vdev_raidz_math_init(void)
+{
+	raidz_math_kstat_t *rmks = &vdev_raidz_kstat_data;
+	uint64_t best_bw = 0;
+	uint8_t *buf;
+	int i;
+
+	buf = vmem_alloc(4 * RAIDZ_BENCH_SIZE, KM_SLEEP);
+	for (i = 0; i < 4 * RAIDZ_BENCH_SIZE / sizeof (uint64_t); i++)
+		((uint64_t *)buf)[i] = (uintptr_t)(buf + i);
+
+	kstat_named_init(&rmks->rmks_fastest, "fastest", KSTAT_DATA_UINT64);
+	kstat_named_init(&rmks->rmks_selected, "selected", KSTAT_DATA_UINT64);
+
+	for (i = 0; i < RAIDZ_IMPL_CNT; i++) {
+		const raidz_impl_ops_t *ops = vdev_raidz_impls[i];
+		uint64_t gen_bw = 0, rec_bw = 0, bw;
+		char name[KSTAT_STRLEN];
+
+		if (ops->is_supported()) {
+			gen_bw = vdev_raidz_benchmark_impl(ops, B_TRUE, buf);
+			rec_bw = vdev_raidz_benchmark_impl(ops, B_FALSE, buf);
+		}
+
+		/* Harmonic mean in KiB/s, both paths matter equally. */
+		bw = 2 * (gen_bw >> 10) * (rec_bw >> 10) /
+		    MAX((gen_bw >> 10) + (rec_bw >> 10), 1);
+		if (bw > best_bw) {
+			best_bw = bw;
+			vdev_raidz_fastest = ops;
+		}
+
+		(void) snprintf(name, sizeof (name), "%s_gen", ops->name);
+		kstat_named_init(&rmks->rmks_gen[i], name, KSTAT_DATA_UINT64);
+		rmks->rmks_gen[i].value.ui64 = gen_bw;
+
+		(void) snprintf(name, sizeof (name), "%s_rec", ops->name);
+		kstat_named_init(&rmks->rmks_rec[i], name, KSTAT_DATA_UINT64);
+		rmks->rmks_rec[i].value.ui64 = rec_bw;
+	}
+
+	for (i = 0; i < RAIDZ_IMPL_CNT; i++) {
+		if (vdev_raidz_impls[i] == vdev_raidz_fastest)
+			rmks->rmks_fastest.value.ui64 = i + RAIDZ_IMPL_SCALAR;
+	}
+
+	vmem_free(buf, 4 * RAIDZ_BENCH_SIZE);
+
+	(void) vdev_raidz_impl_set(zfs_vdev_raidz_impl);
+
+	vdev_raidz_kstat = kstat_create("zfs", 0, "vdev_raidz_bench", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (raidz_math_kstat_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (vdev_raidz_kstat != NULL) {
+		vdev_raidz_kstat->ks_data = rmks;
+		vdev_raidz_kstat->ks_update = vdev_raidz_kstat_update;
+		kstat_install(vdev_raidz_kstat);
+	}
+}
+
+void
+vdev_raidz_math_fini(void)
+{
+	if (vdev_raidz_kstat != NULL) {
+		kstat_delete(vdev_raidz_kstat);
+		vdev_raidz_kstat = NULL;
+	}
+
+	vdev_raidz_fastest = &vdev_raidz_scalar_ops;
+	vdev_raidz_selected = NULL;
+}
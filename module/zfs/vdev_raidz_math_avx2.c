@@ -0,0 +1,210 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 RAID-Z kernels, 32 bytes per ymm register.
+ *
+ * Same algorithms as the SSSE3 kernels: multiplication by 2 through a
+ * signed compare against zero, and by any other constant through a pair
+ * of per-nibble vpshufb lookups.  vpshufb shuffles within each 128-bit
+ * lane, so the 16-entry tables are broadcast to both lanes.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/simd.h>
+#include <sys/vdev_raidz_impl.h>
+
+#if defined(__x86_64__) && defined(HAVE_AVX2)
+
+static const uint8_t raidz_avx2_const[32] __attribute__((aligned(16))) = {
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f
+};
+
+/*
+ * x = 2 * x, with zero in ymm6 and the reduction polynomial in ymm7.
+ */
+#define	RAIDZ_AVX2_MUL2(x, t)				\
+	"vpcmpgtb %%" x ", %%ymm6, %%" t "\n"		\
+	"vpaddb	%%" x ", %%" x ", %%" x "\n"		\
+	"vpand	%%ymm7, %%" t ", %%" t "\n"		\
+	"vpxor	%%" t ", %%" x ", %%" x "\n"
+
+#define	RAIDZ_AVX2_LOAD_POLY				\
+	"vpxor	%%ymm6, %%ymm6, %%ymm6\n"		\
+	"vbroadcasti128 0(%[cst]), %%ymm7\n"
+
+static void
+raidz_avx2_gen_p(uint8_t *p, const uint8_t *d, size_t size)
+{
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "1:\n"
+	    "vmovdqu (%[d],%[off]), %%ymm0\n"
+	    "vpxor	(%[p],%[off]), %%ymm0, %%ymm0\n"
+	    "vmovdqu %%ymm0, (%[p],%[off])\n"
+	    "add	$32, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    "vzeroupper\n"
+	    : [off] "+r" (off)
+	    : [p] "r" (p), [d] "r" (d), [size] "r" (size)
+	    : "xmm0", "memory", "cc");
+	kfpu_end();
+}
+
+static void
+raidz_avx2_gen_pq(uint8_t *p, uint8_t *q, const uint8_t *d, size_t size)
+{
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    RAIDZ_AVX2_LOAD_POLY
+	    "1:\n"
+	    "vmovdqu (%[d],%[off]), %%ymm0\n"
+	    "vmovdqu (%[q],%[off]), %%ymm2\n"
+	    "vpxor	(%[p],%[off]), %%ymm0, %%ymm1\n"
+	    RAIDZ_AVX2_MUL2("ymm2", "ymm3")
+	    "vpxor	%%ymm0, %%ymm2, %%ymm2\n"
+	    "vmovdqu %%ymm1, (%[p],%[off])\n"
+	    "vmovdqu %%ymm2, (%[q],%[off])\n"
+	    "add	$32, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    "vzeroupper\n"
+	    : [off] "+r" (off)
+	    : [p] "r" (p), [q] "r" (q), [d] "r" (d), [size] "r" (size),
+	    [cst] "r" (raidz_avx2_const)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm6", "xmm7", "memory", "cc");
+	kfpu_end();
+}
+
+static void
+raidz_avx2_gen_pqr(uint8_t *p, uint8_t *q, uint8_t *r, const uint8_t *d,
+    size_t size)
+{
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    RAIDZ_AVX2_LOAD_POLY
+	    "1:\n"
+	    "vmovdqu (%[d],%[off]), %%ymm0\n"
+	    "vmovdqu (%[q],%[off]), %%ymm2\n"
+	    "vmovdqu (%[r],%[off]), %%ymm4\n"
+	    "vpxor	(%[p],%[off]), %%ymm0, %%ymm1\n"
+	    RAIDZ_AVX2_MUL2("ymm2", "ymm3")
+	    "vpxor	%%ymm0, %%ymm2, %%ymm2\n"
+	    RAIDZ_AVX2_MUL2("ymm4", "ymm5")
+	    RAIDZ_AVX2_MUL2("ymm4", "ymm5")
+	    "vpxor	%%ymm0, %%ymm4, %%ymm4\n"
+	    "vmovdqu %%ymm1, (%[p],%[off])\n"
+	    "vmovdqu %%ymm2, (%[q],%[off])\n"
+	    "vmovdqu %%ymm4, (%[r],%[off])\n"
+	    "add	$32, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    "vzeroupper\n"
+	    : [off] "+r" (off)
+	    : [p] "r" (p), [q] "r" (q), [r] "r" (r), [d] "r" (d),
+	    [size] "r" (size), [cst] "r" (raidz_avx2_const)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+	    "memory", "cc");
+	kfpu_end();
+}
+
+static void
+raidz_avx2_mul_add(uint8_t *dst, const uint8_t *src, size_t size, uint8_t c)
+{
+	uint8_t tbl[32] __attribute__((aligned(16)));
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	vdev_raidz_gf_mul_tables(c, &tbl[0], &tbl[16]);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "vbroadcasti128 0(%[tbl]), %%ymm8\n"
+	    "vbroadcasti128 16(%[tbl]), %%ymm9\n"
+	    "vbroadcasti128 16(%[cst]), %%ymm10\n"
+	    "1:\n"
+	    "vmovdqu (%[src],%[off]), %%ymm0\n"
+	    "vpsrlw	$4, %%ymm0, %%ymm1\n"
+	    "vpand	%%ymm10, %%ymm0, %%ymm0\n"
+	    "vpand	%%ymm10, %%ymm1, %%ymm1\n"
+	    "vpshufb %%ymm0, %%ymm8, %%ymm2\n"
+	    "vpshufb %%ymm1, %%ymm9, %%ymm3\n"
+	    "vpxor	%%ymm3, %%ymm2, %%ymm2\n"
+	    "vpxor	(%[dst],%[off]), %%ymm2, %%ymm2\n"
+	    "vmovdqu %%ymm2, (%[dst],%[off])\n"
+	    "add	$32, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    "vzeroupper\n"
+	    : [off] "+r" (off)
+	    : [dst] "r" (dst), [src] "r" (src), [size] "r" (size),
+	    [tbl] "r" (tbl), [cst] "r" (raidz_avx2_const)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm8", "xmm9", "xmm10",
+	    "memory", "cc");
+	kfpu_end();
+}
+
+static boolean_t
+raidz_avx2_is_supported(void)
+{
+	return (zfs_avx2_available());
+}
+
+const raidz_impl_ops_t vdev_raidz_avx2_ops = {
+	.gen_p = raidz_avx2_gen_p,
+	.gen_pq = raidz_avx2_gen_pq,
+	.gen_pqr = raidz_avx2_gen_pqr,
+	.mul_add = raidz_avx2_mul_add,
+	.is_supported = raidz_avx2_is_supported,
+	.name = "avx2"
+};
+
+#else	/* !(__x86_64__ && HAVE_AVX2) */
+
+static boolean_t
+raidz_avx2_is_supported(void)
+{
+	return (B_FALSE);
+}
+
+const raidz_impl_ops_t vdev_raidz_avx2_ops = {
+	.is_supported = raidz_avx2_is_supported,
+	.name = "avx2"
+};
+
+#endif	/* __x86_64__ && HAVE_AVX2 */
@@ -0,0 +1,225 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX-512BW RAID-Z kernels, 64 bytes per zmm register.
+ *
+ * Byte compares only produce opmask results in AVX-512, and opmask
+ * registers cannot be named in inline assembly clobbers unless the whole
+ * file is built for AVX-512.  All multiplications, including by 2 and 4
+ * during parity generation, therefore use the per-nibble vpshufb lookup,
+ * with the 16-entry tables broadcast to all four 128-bit lanes.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/simd.h>
+#include <sys/vdev_raidz_impl.h>
+
+#if defined(__x86_64__) && defined(HAVE_AVX512BW)
+
+static const uint8_t raidz_avx512_nibble[16] __attribute__((aligned(16))) = {
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f
+};
+
+/*
+ * x = c * x using the lo/hi tables in zmm registers lo and hi, with the
+ * nibble mask in zmm15.  Clobbers t0 and t1.
+ */
+#define	RAIDZ_AVX512_MUL(x, lo, hi, t0, t1)			\
+	"vpsrlw	$4, %%" x ", %%" t1 "\n"			\
+	"vpandq	%%zmm15, %%" x ", %%" t0 "\n"			\
+	"vpandq	%%zmm15, %%" t1 ", %%" t1 "\n"			\
+	"vpshufb %%" t0 ", %%" lo ", %%" t0 "\n"		\
+	"vpshufb %%" t1 ", %%" hi ", %%" t1 "\n"		\
+	"vpxorq	%%" t1 ", %%" t0 ", %%" x "\n"
+
+#define	RAIDZ_AVX512_LOAD_TABLES					\
+	"vbroadcasti32x4 0(%[tbl]), %%zmm8\n"			\
+	"vbroadcasti32x4 16(%[tbl]), %%zmm9\n"			\
+	"vbroadcasti32x4 32(%[tbl]), %%zmm10\n"			\
+	"vbroadcasti32x4 48(%[tbl]), %%zmm11\n"			\
+	"vbroadcasti32x4 (%[nib]), %%zmm15\n"
+
+/*
+ * Low and high nibble lookup tables for multiplying by 2 and by 4.
+ */
+static const uint8_t raidz_avx512_gen_tbl[64] __attribute__((aligned(16))) = {
+	0x00, 0x02, 0x04, 0x06, 0x08, 0x0a, 0x0c, 0x0e,
+	0x10, 0x12, 0x14, 0x16, 0x18, 0x1a, 0x1c, 0x1e,
+	0x00, 0x20, 0x40, 0x60, 0x80, 0xa0, 0xc0, 0xe0,
+	0x1d, 0x3d, 0x5d, 0x7d, 0x9d, 0xbd, 0xdd, 0xfd,
+	0x00, 0x04, 0x08, 0x0c, 0x10, 0x14, 0x18, 0x1c,
+	0x20, 0x24, 0x28, 0x2c, 0x30, 0x34, 0x38, 0x3c,
+	0x00, 0x40, 0x80, 0xc0, 0x1d, 0x5d, 0x9d, 0xdd,
+	0x3a, 0x7a, 0xba, 0xfa, 0x27, 0x67, 0xa7, 0xe7
+};
+
+static void
+raidz_avx512bw_gen_p(uint8_t *p, const uint8_t *d, size_t size)
+{
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "1:\n"
+	    "vmovdqu64 (%[d],%[off]), %%zmm0\n"
+	    "vpxorq	(%[p],%[off]), %%zmm0, %%zmm0\n"
+	    "vmovdqu64 %%zmm0, (%[p],%[off])\n"
+	    "add	$64, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    "vzeroupper\n"
+	    : [off] "+r" (off)
+	    : [p] "r" (p), [d] "r" (d), [size] "r" (size)
+	    : "xmm0", "memory", "cc");
+	kfpu_end();
+}
+
+static void
+raidz_avx512bw_gen_pq(uint8_t *p, uint8_t *q, const uint8_t *d, size_t size)
+{
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    RAIDZ_AVX512_LOAD_TABLES
+	    "1:\n"
+	    "vmovdqu64 (%[d],%[off]), %%zmm0\n"
+	    "vmovdqu64 (%[q],%[off]), %%zmm2\n"
+	    "vpxorq	(%[p],%[off]), %%zmm0, %%zmm1\n"
+	    RAIDZ_AVX512_MUL("zmm2", "zmm8", "zmm9", "zmm3", "zmm4")
+	    "vpxorq	%%zmm0, %%zmm2, %%zmm2\n"
+	    "vmovdqu64 %%zmm1, (%[p],%[off])\n"
+	    "vmovdqu64 %%zmm2, (%[q],%[off])\n"
+	    "add	$64, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    "vzeroupper\n"
+	    : [off] "+r" (off)
+	    : [p] "r" (p), [q] "r" (q), [d] "r" (d), [size] "r" (size),
+	    [tbl] "r" (raidz_avx512_gen_tbl), [nib] "r" (raidz_avx512_nibble)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm8", "xmm9", "xmm10",
+	    "xmm11", "xmm15", "memory", "cc");
+	kfpu_end();
+}
+
+static void
+raidz_avx512bw_gen_pqr(uint8_t *p, uint8_t *q, uint8_t *r, const uint8_t *d,
+    size_t size)
+{
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    RAIDZ_AVX512_LOAD_TABLES
+	    "1:\n"
+	    "vmovdqu64 (%[d],%[off]), %%zmm0\n"
+	    "vmovdqu64 (%[q],%[off]), %%zmm2\n"
+	    "vmovdqu64 (%[r],%[off]), %%zmm5\n"
+	    "vpxorq	(%[p],%[off]), %%zmm0, %%zmm1\n"
+	    RAIDZ_AVX512_MUL("zmm2", "zmm8", "zmm9", "zmm3", "zmm4")
+	    "vpxorq	%%zmm0, %%zmm2, %%zmm2\n"
+	    RAIDZ_AVX512_MUL("zmm5", "zmm10", "zmm11", "zmm6", "zmm7")
+	    "vpxorq	%%zmm0, %%zmm5, %%zmm5\n"
+	    "vmovdqu64 %%zmm1, (%[p],%[off])\n"
+	    "vmovdqu64 %%zmm2, (%[q],%[off])\n"
+	    "vmovdqu64 %%zmm5, (%[r],%[off])\n"
+	    "add	$64, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    "vzeroupper\n"
+	    : [off] "+r" (off)
+	    : [p] "r" (p), [q] "r" (q), [r] "r" (r), [d] "r" (d),
+	    [size] "r" (size), [tbl] "r" (raidz_avx512_gen_tbl),
+	    [nib] "r" (raidz_avx512_nibble)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+	    "xmm8", "xmm9", "xmm10", "xmm11", "xmm15", "memory", "cc");
+	kfpu_end();
+}
+
+static void
+raidz_avx512bw_mul_add(uint8_t *dst, const uint8_t *src, size_t size,
+    uint8_t c)
+{
+	uint8_t tbl[32] __attribute__((aligned(16)));
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	vdev_raidz_gf_mul_tables(c, &tbl[0], &tbl[16]);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "vbroadcasti32x4 0(%[tbl]), %%zmm8\n"
+	    "vbroadcasti32x4 16(%[tbl]), %%zmm9\n"
+	    "vbroadcasti32x4 (%[nib]), %%zmm15\n"
+	    "1:\n"
+	    "vmovdqu64 (%[src],%[off]), %%zmm0\n"
+	    RAIDZ_AVX512_MUL("zmm0", "zmm8", "zmm9", "zmm1", "zmm2")
+	    "vpxorq	(%[dst],%[off]), %%zmm0, %%zmm0\n"
+	    "vmovdqu64 %%zmm0, (%[dst],%[off])\n"
+	    "add	$64, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    "vzeroupper\n"
+	    : [off] "+r" (off)
+	    : [dst] "r" (dst), [src] "r" (src), [size] "r" (size),
+	    [tbl] "r" (tbl), [nib] "r" (raidz_avx512_nibble)
+	    : "xmm0", "xmm1", "xmm2", "xmm8", "xmm9", "xmm15", "memory", "cc");
+	kfpu_end();
+}
+
+static boolean_t
+raidz_avx512bw_is_supported(void)
+{
+	return (zfs_avx512bw_available());
+}
+
+const raidz_impl_ops_t vdev_raidz_avx512bw_ops = {
+	.gen_p = raidz_avx512bw_gen_p,
+	.gen_pq = raidz_avx512bw_gen_pq,
+	.gen_pqr = raidz_avx512bw_gen_pqr,
+	.mul_add = raidz_avx512bw_mul_add,
+	.is_supported = raidz_avx512bw_is_supported,
+	.name = "avx512bw"
+};
+
+#else	/* !(__x86_64__ && HAVE_AVX512BW) */
+
+static boolean_t
+raidz_avx512bw_is_supported(void)
+{
+	return (B_FALSE);
+}
+
+const raidz_impl_ops_t vdev_raidz_avx512bw_ops = {
+	.is_supported = raidz_avx512bw_is_supported,
+	.name = "avx512bw"
+};
+
+#endif	/* __x86_64__ && HAVE_AVX512BW */
@@ -0,0 +1,127 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Portable RAID-Z kernels working on 64-bit words.  These also finish the
+ * sub-RAIDZ_MATH_BLOCK remainder for the vector implementations, so they
+ * accept any size which is a multiple of 8 bytes.
+ *
+ * Multiplication by an arbitrary constant c uses the bits of c: for each
+ * set bit k, 2^k * src is added to the result.  The eight masks are built
+ * once per call so the inner loop is branch free.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/vdev_raidz_impl.h>
+
+static void
+raidz_scalar_gen_p(uint8_t *pb, const uint8_t *db, size_t size)
+{
+	uint64_t *p = (uint64_t *)pb;
+	const uint64_t *d = (const uint64_t *)db;
+	size_t i, cnt = size / sizeof (uint64_t);
+
+	ASSERT(IS_P2ALIGNED(size, sizeof (uint64_t)));
+
+	for (i = 0; i < cnt; i++)
+		p[i] ^= d[i];
+}
+
+static void
+raidz_scalar_gen_pq(uint8_t *pb, uint8_t *qb, const uint8_t *db, size_t size)
+{
+	uint64_t *p = (uint64_t *)pb;
+	uint64_t *q = (uint64_t *)qb;
+	const uint64_t *d = (const uint64_t *)db;
+	size_t i, cnt = size / sizeof (uint64_t);
+	uint64_t mask;
+
+	ASSERT(IS_P2ALIGNED(size, sizeof (uint64_t)));
+
+	for (i = 0; i < cnt; i++) {
+		p[i] ^= d[i];
+		VDEV_RAIDZ_64MUL_2(q[i], mask);
+		q[i] ^= d[i];
+	}
+}
+
+static void
+raidz_scalar_gen_pqr(uint8_t *pb, uint8_t *qb, uint8_t *rb,
+    const uint8_t *db, size_t size)
+{
+	uint64_t *p = (uint64_t *)pb;
+	uint64_t *q = (uint64_t *)qb;
+	uint64_t *r = (uint64_t *)rb;
+	const uint64_t *d = (const uint64_t *)db;
+	size_t i, cnt = size / sizeof (uint64_t);
+	uint64_t mask;
+
+	ASSERT(IS_P2ALIGNED(size, sizeof (uint64_t)));
+
+	for (i = 0; i < cnt; i++) {
+		p[i] ^= d[i];
+		VDEV_RAIDZ_64MUL_2(q[i], mask);
+		q[i] ^= d[i];
+		VDEV_RAIDZ_64MUL_4(r[i], mask);
+		r[i] ^= d[i];
+	}
+}
+
+static void
+raidz_scalar_mul_add(uint8_t *dstb, const uint8_t *srcb, size_t size,
+    uint8_t c)
+{
+	uint64_t *dst = (uint64_t *)dstb;
+	const uint64_t *src = (const uint64_t *)srcb;
+	size_t i, cnt = size / sizeof (uint64_t);
+	uint64_t bit[8], mask, t, acc;
+	int k;
+
+	ASSERT(IS_P2ALIGNED(size, sizeof (uint64_t)));
+
+	for (k = 0; k < 8; k++)
+		bit[k] = ((c >> k) & 1) ? ~0ULL : 0;
+
+	for (i = 0; i < cnt; i++) {
+		t = src[i];
+		acc = t & bit[0];
+		for (k = 1; k < 8; k++) {
+			VDEV_RAIDZ_64MUL_2(t, mask);
+			acc ^= t & bit[k];
+		}
+		dst[i] ^= acc;
+	}
+}
+
+static boolean_t
+raidz_scalar_is_supported(void)
+{
+	return (B_TRUE);
+}
+
+const raidz_impl_ops_t vdev_raidz_scalar_ops = {
+	.gen_p = raidz_scalar_gen_p,
+	.gen_pq = raidz_scalar_gen_pq,
+	.gen_pqr = raidz_scalar_gen_pqr,
+	.mul_add = raidz_scalar_mul_add,
+	.is_supported = raidz_scalar_is_supported,
+	.name = "scalar"
+};
@@ -0,0 +1,310 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SSE2 and SSSE3 RAID-Z kernels, 16 bytes per xmm register.
+ *
+ * Multiplication by 2 is the vector form of VDEV_RAIDZ_64MUL_2: pcmpgtb
+ * against zero turns the top bit of every byte into a mask selecting the
+ * 0x1d reduction.  SSE2 multiplies by an arbitrary constant like the
+ * scalar code, by summing 2^k * src over the set bits of c.  SSSE3 uses
+ * two 16-entry pshufb lookups, one per nibble, instead; its parity
+ * generation is the SSE2 code.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/simd.h>
+#include <sys/vdev_raidz_impl.h>
+
+#if defined(__x86_64__) && defined(HAVE_SSE2)
+
+static const uint8_t raidz_sse_poly[16] __attribute__((aligned(16))) = {
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+	0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d
+};
+
+/*
+ * x = 2 * x, with the reduction polynomial in xmm7.
+ */
+#define	RAIDZ_SSE2_MUL2(x, t)			\
+	"pxor	%%" t ", %%" t "\n"		\
+	"pcmpgtb %%" x ", %%" t "\n"		\
+	"paddb	%%" x ", %%" x "\n"		\
+	"pand	%%xmm7, %%" t "\n"		\
+	"pxor	%%" t ", %%" x "\n"
+
+static void
+raidz_sse2_gen_p(uint8_t *p, const uint8_t *d, size_t size)
+{
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "1:\n"
+	    "movdqu	(%[d],%[off]), %%xmm0\n"
+	    "movdqu	(%[p],%[off]), %%xmm1\n"
+	    "pxor	%%xmm0, %%xmm1\n"
+	    "movdqu	%%xmm1, (%[p],%[off])\n"
+	    "add	$16, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    : [off] "+r" (off)
+	    : [p] "r" (p), [d] "r" (d), [size] "r" (size)
+	    : "xmm0", "xmm1", "memory", "cc");
+	kfpu_end();
+}
+
+static void
+raidz_sse2_gen_pq(uint8_t *p, uint8_t *q, const uint8_t *d, size_t size)
+{
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqa	(%[poly]), %%xmm7\n"
+	    "1:\n"
+	    "movdqu	(%[d],%[off]), %%xmm0\n"
+	    "movdqu	(%[p],%[off]), %%xmm1\n"
+	    "movdqu	(%[q],%[off]), %%xmm2\n"
+	    "pxor	%%xmm0, %%xmm1\n"
+	    RAIDZ_SSE2_MUL2("xmm2", "xmm3")
+	    "pxor	%%xmm0, %%xmm2\n"
+	    "movdqu	%%xmm1, (%[p],%[off])\n"
+	    "movdqu	%%xmm2, (%[q],%[off])\n"
+	    "add	$16, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    : [off] "+r" (off)
+	    : [p] "r" (p), [q] "r" (q), [d] "r" (d), [size] "r" (size),
+	    [poly] "r" (raidz_sse_poly)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm7", "memory", "cc");
+	kfpu_end();
+}
+
+static void
+raidz_sse2_gen_pqr(uint8_t *p, uint8_t *q, uint8_t *r, const uint8_t *d,
+    size_t size)
+{
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqa	(%[poly]), %%xmm7\n"
+	    "1:\n"
+	    "movdqu	(%[d],%[off]), %%xmm0\n"
+	    "movdqu	(%[p],%[off]), %%xmm1\n"
+	    "movdqu	(%[q],%[off]), %%xmm2\n"
+	    "movdqu	(%[r],%[off]), %%xmm4\n"
+	    "pxor	%%xmm0, %%xmm1\n"
+	    RAIDZ_SSE2_MUL2("xmm2", "xmm3")
+	    "pxor	%%xmm0, %%xmm2\n"
+	    RAIDZ_SSE2_MUL2("xmm4", "xmm5")
+	    RAIDZ_SSE2_MUL2("xmm4", "xmm5")
+	    "pxor	%%xmm0, %%xmm4\n"
+	    "movdqu	%%xmm1, (%[p],%[off])\n"
+	    "movdqu	%%xmm2, (%[q],%[off])\n"
+	    "movdqu	%%xmm4, (%[r],%[off])\n"
+	    "add	$16, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    : [off] "+r" (off)
+	    : [p] "r" (p), [q] "r" (q), [r] "r" (r), [d] "r" (d),
+	    [size] "r" (size), [poly] "r" (raidz_sse_poly)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm7",
+	    "memory", "cc");
+	kfpu_end();
+}
+
+/*
+ * acc ^= (2^k * src) & mask[k], with 2^(k-1) * src in xmm0.
+ */
+#define	RAIDZ_SSE2_MUL_ADD_BIT(m)		\
+	RAIDZ_SSE2_MUL2("xmm0", "xmm2")		\
+	"movdqa	%%xmm0, %%xmm3\n"		\
+	"pand	%%" m ", %%xmm3\n"		\
+	"pxor	%%xmm3, %%xmm1\n"
+
+static void
+raidz_sse2_mul_add(uint8_t *dst, const uint8_t *src, size_t size, uint8_t c)
+{
+	uint8_t mask[8][16] __attribute__((aligned(16)));
+	size_t off = 0;
+	int k;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	for (k = 0; k < 8; k++)
+		(void) memset(mask[k], ((c >> k) & 1) ? 0xff : 0, 16);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqa	(%[poly]), %%xmm7\n"
+	    "movdqa	0(%[mask]), %%xmm8\n"
+	    "movdqa	16(%[mask]), %%xmm9\n"
+	    "movdqa	32(%[mask]), %%xmm10\n"
+	    "movdqa	48(%[mask]), %%xmm11\n"
+	    "movdqa	64(%[mask]), %%xmm12\n"
+	    "movdqa	80(%[mask]), %%xmm13\n"
+	    "movdqa	96(%[mask]), %%xmm14\n"
+	    "movdqa	112(%[mask]), %%xmm15\n"
+	    "1:\n"
+	    "movdqu	(%[src],%[off]), %%xmm0\n"
+	    "movdqa	%%xmm0, %%xmm1\n"
+	    "pand	%%xmm8, %%xmm1\n"
+	    RAIDZ_SSE2_MUL_ADD_BIT("xmm9")
+	    RAIDZ_SSE2_MUL_ADD_BIT("xmm10")
+	    RAIDZ_SSE2_MUL_ADD_BIT("xmm11")
+	    RAIDZ_SSE2_MUL_ADD_BIT("xmm12")
+	    RAIDZ_SSE2_MUL_ADD_BIT("xmm13")
+	    RAIDZ_SSE2_MUL_ADD_BIT("xmm14")
+	    RAIDZ_SSE2_MUL_ADD_BIT("xmm15")
+	    "movdqu	(%[dst],%[off]), %%xmm4\n"
+	    "pxor	%%xmm1, %%xmm4\n"
+	    "movdqu	%%xmm4, (%[dst],%[off])\n"
+	    "add	$16, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    : [off] "+r" (off)
+	    : [dst] "r" (dst), [src] "r" (src), [size] "r" (size),
+	    [poly] "r" (raidz_sse_poly), [mask] "r" (mask)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm7", "xmm8", "xmm9",
+	    "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
+	    "memory", "cc");
+	kfpu_end();
+}
+
+static boolean_t
+raidz_sse2_is_supported(void)
+{
+	return (zfs_sse2_available());
+}
+
+const raidz_impl_ops_t vdev_raidz_sse2_ops = {
+	.gen_p = raidz_sse2_gen_p,
+	.gen_pq = raidz_sse2_gen_pq,
+	.gen_pqr = raidz_sse2_gen_pqr,
+	.mul_add = raidz_sse2_mul_add,
+	.is_supported = raidz_sse2_is_supported,
+	.name = "sse2"
+};
+
+#if defined(HAVE_SSSE3)
+
+static const uint8_t raidz_ssse3_nibble[16] __attribute__((aligned(16))) = {
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f
+};
+
+static void
+raidz_ssse3_mul_add(uint8_t *dst, const uint8_t *src, size_t size, uint8_t c)
+{
+	uint8_t tbl[32] __attribute__((aligned(16)));
+	size_t off = 0;
+
+	ASSERT(size != 0 && IS_P2ALIGNED(size, RAIDZ_MATH_BLOCK));
+
+	vdev_raidz_gf_mul_tables(c, &tbl[0], &tbl[16]);
+
+	kfpu_begin();
+	__asm__ __volatile__(
+	    "movdqa	0(%[tbl]), %%xmm8\n"
+	    "movdqa	16(%[tbl]), %%xmm9\n"
+	    "movdqa	(%[nib]), %%xmm10\n"
+	    "1:\n"
+	    "movdqu	(%[src],%[off]), %%xmm0\n"
+	    "movdqa	%%xmm0, %%xmm1\n"
+	    "psrlw	$4, %%xmm1\n"
+	    "pand	%%xmm10, %%xmm0\n"
+	    "pand	%%xmm10, %%xmm1\n"
+	    "movdqa	%%xmm8, %%xmm2\n"
+	    "movdqa	%%xmm9, %%xmm3\n"
+	    "pshufb	%%xmm0, %%xmm2\n"
+	    "pshufb	%%xmm1, %%xmm3\n"
+	    "pxor	%%xmm3, %%xmm2\n"
+	    "movdqu	(%[dst],%[off]), %%xmm4\n"
+	    "pxor	%%xmm2, %%xmm4\n"
+	    "movdqu	%%xmm4, (%[dst],%[off])\n"
+	    "add	$16, %[off]\n"
+	    "cmp	%[size], %[off]\n"
+	    "jb	1b\n"
+	    : [off] "+r" (off)
+	    : [dst] "r" (dst), [src] "r" (src), [size] "r" (size),
+	    [tbl] "r" (tbl), [nib] "r" (raidz_ssse3_nibble)
+	    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm8", "xmm9", "xmm10",
+	    "memory", "cc");
+	kfpu_end();
+}
+
+static boolean_t
+raidz_ssse3_is_supported(void)
+{
+	return (zfs_sse2_available() && zfs_ssse3_available());
+}
+
+const raidz_impl_ops_t vdev_raidz_ssse3_ops = {
+	.gen_p = raidz_sse2_gen_p,
+	.gen_pq = raidz_sse2_gen_pq,
+	.gen_pqr = raidz_sse2_gen_pqr,
+	.mul_add = raidz_ssse3_mul_add,
+	.is_supported = raidz_ssse3_is_supported,
+	.name = "ssse3"
+};
+
+#else	/* !HAVE_SSSE3 */
+
+static boolean_t
+raidz_ssse3_is_supported(void)
+{
+	return (B_FALSE);
+}
+
+const raidz_impl_ops_t vdev_raidz_ssse3_ops = {
+	.is_supported = raidz_ssse3_is_supported,
+	.name = "ssse3"
+};
+
+#endif	/* HAVE_SSSE3 */
+
+#else	/* !(__x86_64__ && HAVE_SSE2) */
+
+static boolean_t
+raidz_sse_is_supported(void)
+{
+	return (B_FALSE);
+}
+
+const raidz_impl_ops_t vdev_raidz_sse2_ops = {
+	.is_supported = raidz_sse_is_supported,
+	.name = "sse2"
+};
+
+const raidz_impl_ops_t vdev_raidz_ssse3_ops = {
+	.is_supported = raidz_sse_is_supported,
+	.name = "ssse3"
+};
+
+#endif	/* __x86_64__ && HAVE_SSE2 */
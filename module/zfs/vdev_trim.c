@@ -0,0 +1,648 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * TRIM of the free space of top-level vdevs.
+ *
+ * There are two kinds of trim, each run by its own thread per top-level
+ * vdev:
+ *
+ *   o Manual trim ("zpool trim") walks every metaslab in turn, loading it
+ *     if needed, and trims all of its free space (ms_tree), optionally
+ *     limited to vdev_trim_rate bytes per second.  It can be suspended and
+ *     resumed from the metaslab it stopped at, or canceled.
+ *
+ *   o Automatic trim (the "autotrim" pool property) trims the ranges
+ *     collected in ms_trim as they leave the defer trees in
+ *     metaslab_sync_done().  Ranges are batched for zfs_trim_txg_batch
+ *     txgs, so that neighbouring frees can be merged into larger extents
+ *     and space which is quickly reallocated is never trimmed at all.
+ *
+ * While a metaslab is being trimmed its ms_trimming count is non-zero and
+ * the allocator passes it over, so a range can never be reallocated and
+ * written while a trim of it is still outstanding.
+ *
+ * Trims are issued as ZIO_TYPE_FREE zios against the top-level vdev.  The
+ * mirror and raidz vdevs fan them out to their children, and the leaf
+ * vdev queues schedule them in the ZIO_PRIORITY_TRIM class.  A leaf whose
+ * device does not support trim is marked vdev_notrim and fails any
+ * further trim immediately; a top-level vdev with no leaf able to trim is
+ * not walked at all.
+ *
+ * The threads only ever try to take the config lock, checking whether
+ * they have been asked to exit between attempts, since they are stopped
+ * by vdev_trim_stop_wait() from paths which hold it as writer.
+ *
+ * The state of a manual trim is kept in core only and is reported in the
+ * vdev stats; a pool which is exported or a system which is restarted
+ * while a manual trim is running does not resume it.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_trim.h>
+#include <sys/metaslab_impl.h>
+#include <sys/range_tree.h>
+#include <sys/zio.h>
+
+/*
+ * Maximum size of a single trim extent; larger free ranges are split.
+ */
+uint64_t zfs_trim_extent_bytes_max = 128 * 1024 * 1024;
+
+/*
+ * Free ranges smaller than this are not worth trimming and are skipped.
+ */
+uint64_t zfs_trim_extent_bytes_min = 32 * 1024;
+
+/*
+ * Maximum number of trim zios outstanding per top-level vdev.
+ */
+uint64_t zfs_trim_queue_limit = 10;
+
+/*
+ * Number of txgs the automatic trim lets freed ranges accumulate for.
+ */
+uint64_t zfs_trim_txg_batch = 32;
+
+static boolean_t
+vdev_trim_should_exit(vdev_t *vd, boolean_t autotrim)
+{
+	return (autotrim ? vd->vdev_autotrim_exit_wanted :
+	    vd->vdev_trim_exit_wanted);
+}
+
+/*
+ * Returns B_TRUE if at least one leaf of the vdev may be able to trim.
+ */
+static boolean_t
+vdev_trim_supported(vdev_t *vd)
+{
+	int c;
+
+	if (vd->vdev_children == 0)
+		return (!vd->vdev_notrim);
+
+	for (c = 0; c < vd->vdev_children; c++) {
+		if (vdev_trim_supported(vd->vdev_child[c]))
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+static void
+vdev_trim_cb(zio_t *zio)
+{
+	vdev_t *vd = zio->io_private;
+
+	spa_config_exit(zio->io_spa, SCL_STATE_ALL, vd);
+
+	mutex_enter(&vd->vdev_trim_io_lock);
+	ASSERT3U(vd->vdev_trim_inflight, >, 0);
+	vd->vdev_trim_inflight--;
+	cv_broadcast(&vd->vdev_trim_io_cv);
+	mutex_exit(&vd->vdev_trim_io_lock);
+}
+
+static void
+vdev_trim_wait_inflight(vdev_t *vd, uint64_t limit)
+{
+	mutex_enter(&vd->vdev_trim_io_lock);
+	while (vd->vdev_trim_inflight > limit)
+		cv_wait(&vd->vdev_trim_io_cv, &vd->vdev_trim_io_lock);
+	mutex_exit(&vd->vdev_trim_io_lock);
+}
+
+/*
+ * Issue one trim zio, holding the config lock as reader until it is done.
+ */
+static int
+vdev_trim_issue(vdev_t *vd, uint64_t start, uint64_t size,
+    boolean_t autotrim)
+{
+	spa_t *spa = vd->vdev_spa;
+
+	vdev_trim_wait_inflight(vd, MAX(zfs_trim_queue_limit, 1) - 1);
+
+	while (!spa_config_tryenter(spa, SCL_STATE_ALL, vd, RW_READER)) {
+		if (vdev_trim_should_exit(vd, autotrim))
+			return (SET_ERROR(EINTR));
+		delay(1);
+	}
+
+	mutex_enter(&vd->vdev_trim_io_lock);
+	vd->vdev_trim_inflight++;
+	mutex_exit(&vd->vdev_trim_io_lock);
+
+	zio_nowait(zio_trim(NULL, vd, start, size, vdev_trim_cb, vd,
+	    ZIO_PRIORITY_TRIM, ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+	    ZIO_FLAG_DONT_RETRY));
+
+	return (0);
+}
+
+/*
+ * Wait until the rate limit of the manual trim allows it to issue more than
+ * the bytes it has already issued since it started.
+ */
+static int
+vdev_trim_rate_wait(vdev_t *vd, hrtime_t start, uint64_t issued)
+{
+	int error = 0;
+
+	mutex_enter(&vd->vdev_trim_lock);
+	while (vd->vdev_trim_rate != 0 && !vd->vdev_trim_exit_wanted &&
+	    issued > NSEC2MSEC(gethrtime() - start) * vd->vdev_trim_rate /
+	    1000) {
+		(void) cv_timedwait_hires(&vd->vdev_trim_cv,
+		    &vd->vdev_trim_lock, MSEC2NSEC(10), MSEC2NSEC(1), 0);
+	}
+	if (vd->vdev_trim_exit_wanted)
+		error = SET_ERROR(EINTR);
+	mutex_exit(&vd->vdev_trim_lock);
+
+	return (error);
+}
+
+/*
+ * Take the config lock as reader, giving up with EINTR if the thread is
+ * asked to exit while it waits.
+ */
+static int
+vdev_trim_config_enter(vdev_t *vd, boolean_t autotrim)
+{
+	while (!spa_config_tryenter(vd->vdev_spa, SCL_CONFIG, vd, RW_READER)) {
+		if (vdev_trim_should_exit(vd, autotrim))
+			return (SET_ERROR(EINTR));
+		delay(1);
+	}
+
+	return (0);
+}
+
+/*
+ * Return the number of metaslabs of vd, read under the config lock, or 0
+ * if the thread was asked to exit.
+ */
+static uint64_t
+vdev_trim_ms_count(vdev_t *vd, boolean_t autotrim)
+{
+	uint64_t count;
+
+	if (vdev_trim_config_enter(vd, autotrim) != 0)
+		return (0);
+	count = vd->vdev_ms_count;
+	spa_config_exit(vd->vdev_spa, SCL_CONFIG, vd);
+
+	return (count);
+}
+
+/*
+ * Trim the free ranges of one metaslab: all of ms_tree for a manual trim,
+ * the accumulated ms_trim for an automatic one.  Returns non-zero if the
+ * thread was asked to exit.
+ */
+static int
+vdev_trim_metaslab(vdev_t *vd, uint64_t id, boolean_t autotrim,
+    hrtime_t start, uint64_t *issued)
+{
+	spa_t *spa = vd->vdev_spa;
+	uint64_t align = 1ULL << vd->vdev_top->vdev_ashift;
+	uint64_t extent_max = MAX(P2ALIGN(zfs_trim_extent_bytes_max, align),
+	    align);
+	metaslab_t *msp;
+	range_tree_t *rt;
+	zfs_btree_index_t where;
+	range_seg_t *rs;
+	kmutex_t lock;
+	int error;
+
+	error = vdev_trim_config_enter(vd, autotrim);
+	if (error != 0)
+		return (error);
+
+	if (vd->vdev_ms == NULL || id >= vd->vdev_ms_count) {
+		spa_config_exit(spa, SCL_CONFIG, vd);
+		return (0);
+	}
+	msp = vd->vdev_ms[id];
+
+	mutex_enter(&msp->ms_lock);
+
+	/*
+	 * Not synced yet, so nothing in it has ever been freed, or nothing
+	 * freed since the last automatic trim.
+	 */
+	if (msp->ms_freedtree == NULL ||
+	    (autotrim && range_tree_space(msp->ms_trim) == 0)) {
+		mutex_exit(&msp->ms_lock);
+		spa_config_exit(spa, SCL_CONFIG, vd);
+		return (0);
+	}
+
+	if (!autotrim) {
+		metaslab_load_wait(msp);
+		if (!msp->ms_loaded)
+			error = metaslab_load(msp);
+		if (error != 0) {
+			mutex_exit(&msp->ms_lock);
+			spa_config_exit(spa, SCL_CONFIG, vd);
+			return (0);
+		}
+	}
+
+	msp->ms_trimming++;
+
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_enter(&lock);
+	rt = range_tree_create(NULL, NULL, &lock);
+	if (!autotrim)
+		range_tree_walk(msp->ms_tree, range_tree_add, rt);
+	else
+		range_tree_walk(msp->ms_trim, range_tree_add, rt);
+	range_tree_vacate(msp->ms_trim, NULL, NULL);
+	mutex_exit(&lock);
+
+	mutex_exit(&msp->ms_lock);
+	spa_config_exit(spa, SCL_CONFIG, vd);
+
+	/* The tree is private to this thread, so it is walked unlocked. */
+	for (rs = zfs_btree_first(&rt->rt_root, &where);
+	    rs != NULL && error == 0;
+	    rs = zfs_btree_next(&rt->rt_root, &where, &where)) {
+		uint64_t off = rs_get_start(rs, rt);
+		uint64_t end = rs_get_end(rs, rt);
+
+		if (end - off < zfs_trim_extent_bytes_min)
+			continue;
+
+		while (off < end && error == 0) {
+			uint64_t size = MIN(end - off, extent_max);
+
+			if (!autotrim) {
+				error = vdev_trim_rate_wait(vd, start,
+				    *issued);
+				if (error != 0)
+					break;
+			} else if (vd->vdev_autotrim_exit_wanted) {
+				error = SET_ERROR(EINTR);
+				break;
+			}
+
+			error = vdev_trim_issue(vd, off, size, autotrim);
+			if (error != 0)
+				break;
+			*issued += size;
+			off += size;
+		}
+	}
+
+	vdev_trim_wait_inflight(vd, 0);
+
+	mutex_enter(&lock);
+	range_tree_vacate(rt, NULL, NULL);
+	range_tree_destroy(rt);
+	mutex_exit(&lock);
+	mutex_destroy(&lock);
+
+	mutex_enter(&msp->ms_lock);
+	ASSERT3S(msp->ms_trimming, >, 0);
+	msp->ms_trimming--;
+	mutex_exit(&msp->ms_lock);
+
+	return (error);
+}
+
+static void
+vdev_trim_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	hrtime_t start = gethrtime();
+	uint64_t issued = 0;
+	uint64_t id, count;
+	int error = 0;
+
+	mutex_enter(&vd->vdev_trim_lock);
+	id = vd->vdev_trim_offset >> vd->vdev_ms_shift;
+	mutex_exit(&vd->vdev_trim_lock);
+	count = vdev_trim_ms_count(vd, B_FALSE);
+
+	for (; id < count && vdev_trim_supported(vd); id++) {
+		error = vdev_trim_metaslab(vd, id, B_FALSE, start, &issued);
+		if (error != 0)
+			break;
+
+		mutex_enter(&vd->vdev_trim_lock);
+		vd->vdev_trim_offset = (id + 1) << vd->vdev_ms_shift;
+		mutex_exit(&vd->vdev_trim_lock);
+	}
+
+	mutex_enter(&vd->vdev_trim_lock);
+	if (error == 0 && !vd->vdev_trim_exit_wanted) {
+		vd->vdev_trim_state = VDEV_TRIM_COMPLETE;
+		vd->vdev_trim_action_time = gethrestime_sec();
+	}
+	vd->vdev_trim_thread = NULL;
+	vd->vdev_trim_exit_wanted = B_FALSE;
+	cv_broadcast(&vd->vdev_trim_cv);
+	mutex_exit(&vd->vdev_trim_lock);
+
+	thread_exit();
+}
+
+static void
+vdev_autotrim_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	spa_t *spa = vd->vdev_spa;
+	uint64_t last_txg = spa_last_synced_txg(spa);
+	uint64_t id, count, issued = 0;
+
+	mutex_enter(&vd->vdev_trim_lock);
+	while (!vd->vdev_autotrim_exit_wanted) {
+		(void) cv_timedwait_hires(&vd->vdev_trim_cv,
+		    &vd->vdev_trim_lock, SEC2NSEC(1), MSEC2NSEC(1), 0);
+
+		if (vd->vdev_autotrim_exit_wanted ||
+		    spa_last_synced_txg(spa) < last_txg + zfs_trim_txg_batch)
+			continue;
+		last_txg = spa_last_synced_txg(spa);
+		mutex_exit(&vd->vdev_trim_lock);
+
+		count = vdev_trim_ms_count(vd, B_TRUE);
+		for (id = 0; id < count && vdev_trim_supported(vd); id++) {
+			if (vdev_trim_metaslab(vd, id, B_TRUE, 0,
+			    &issued) != 0)
+				break;
+		}
+
+		mutex_enter(&vd->vdev_trim_lock);
+	}
+	vd->vdev_autotrim_thread = NULL;
+	vd->vdev_autotrim_exit_wanted = B_FALSE;
+	cv_broadcast(&vd->vdev_trim_cv);
+	mutex_exit(&vd->vdev_trim_lock);
+
+	thread_exit();
+}
+
+/*
+ * Start (or resume) a manual trim of the top-level vdev, or change the
+ * rate of a running one.
+ */
+static void
+vdev_trim(vdev_t *vd, uint64_t rate)
+{
+	ASSERT(MUTEX_HELD(&vd->vdev_trim_lock));
+	ASSERT(vd == vd->vdev_top);
+
+	while (vd->vdev_trim_thread != NULL && vd->vdev_trim_exit_wanted)
+		cv_wait(&vd->vdev_trim_cv, &vd->vdev_trim_lock);
+
+	vd->vdev_trim_rate = rate;
+	cv_broadcast(&vd->vdev_trim_cv);
+	if (vd->vdev_trim_thread != NULL)
+		return;
+
+	if (vd->vdev_trim_state != VDEV_TRIM_SUSPENDED)
+		vd->vdev_trim_offset = 0;
+	vd->vdev_trim_state = VDEV_TRIM_ACTIVE;
+	vd->vdev_trim_action_time = gethrestime_sec();
+	vd->vdev_trim_thread = thread_create(NULL, 0, vdev_trim_thread, vd,
+	    0, &p0, TS_RUN, minclsyspri);
+}
+
+/*
+ * Ask the manual trim to stop, leaving it in the given state.
+ */
+static void
+vdev_trim_stop(vdev_t *vd, vdev_trim_state_t state)
+{
+	ASSERT(MUTEX_HELD(&vd->vdev_trim_lock));
+
+	if (vd->vdev_trim_thread != NULL)
+		vd->vdev_trim_exit_wanted = B_TRUE;
+	cv_broadcast(&vd->vdev_trim_cv);
+
+	vd->vdev_trim_state = state;
+	vd->vdev_trim_action_time = gethrestime_sec();
+}
+
+static void
+vdev_autotrim_start(vdev_t *vd)
+{
+	ASSERT(MUTEX_HELD(&vd->vdev_trim_lock));
+
+	while (vd->vdev_autotrim_thread != NULL &&
+	    vd->vdev_autotrim_exit_wanted)
+		cv_wait(&vd->vdev_trim_cv, &vd->vdev_trim_lock);
+
+	if (vd->vdev_autotrim_thread == NULL) {
+		vd->vdev_autotrim_thread = thread_create(NULL, 0,
+		    vdev_autotrim_thread, vd, 0, &p0, TS_RUN, minclsyspri);
+	}
+}
+
+/*
+ * Stop both trim threads of the top-level vdev and wait for them to exit.
+ * A running manual trim is left suspended.
+ */
+void
+vdev_trim_stop_wait(vdev_t *vd)
+{
+	mutex_enter(&vd->vdev_trim_lock);
+	if (vd->vdev_trim_thread == NULL && vd->vdev_autotrim_thread == NULL) {
+		mutex_exit(&vd->vdev_trim_lock);
+		return;
+	}
+
+	if (vd->vdev_trim_state == VDEV_TRIM_ACTIVE)
+		vdev_trim_stop(vd, VDEV_TRIM_SUSPENDED);
+	if (vd->vdev_trim_thread != NULL)
+		vd->vdev_trim_exit_wanted = B_TRUE;
+	if (vd->vdev_autotrim_thread != NULL)
+		vd->vdev_autotrim_exit_wanted = B_TRUE;
+	cv_broadcast(&vd->vdev_trim_cv);
+
+	while (vd->vdev_trim_thread != NULL ||
+	    vd->vdev_autotrim_thread != NULL)
+		cv_wait(&vd->vdev_trim_cv, &vd->vdev_trim_lock);
+	mutex_exit(&vd->vdev_trim_lock);
+}
+
+/*
+ * The top-level vdev svd is being replaced by tvd (see
+ * vdev_top_transfer()): move the trim state and threads over.
+ */
+void
+vdev_trim_xfer(vdev_t *svd, vdev_t *tvd)
+{
+	vdev_trim_state_t state;
+	boolean_t autotrim;
+
+	mutex_enter(&svd->vdev_trim_lock);
+	state = svd->vdev_trim_state;
+	autotrim = (svd->vdev_autotrim_thread != NULL);
+	mutex_exit(&svd->vdev_trim_lock);
+
+	vdev_trim_stop_wait(svd);
+
+	mutex_enter(&svd->vdev_trim_lock);
+	mutex_enter(&tvd->vdev_trim_lock);
+	tvd->vdev_trim_state = svd->vdev_trim_state;
+	tvd->vdev_trim_rate = svd->vdev_trim_rate;
+	tvd->vdev_trim_offset = svd->vdev_trim_offset;
+	tvd->vdev_trim_action_time = svd->vdev_trim_action_time;
+	svd->vdev_trim_state = VDEV_TRIM_NONE;
+	svd->vdev_trim_offset = 0;
+	mutex_exit(&svd->vdev_trim_lock);
+
+	if (state == VDEV_TRIM_ACTIVE)
+		vdev_trim(tvd, tvd->vdev_trim_rate);
+	if (autotrim)
+		vdev_autotrim_start(tvd);
+	mutex_exit(&tvd->vdev_trim_lock);
+}
+
+/*
+ * Start or stop the automatic trim threads to match the autotrim property.
+ */
+void
+vdev_autotrim_restart(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	boolean_t autotrim = spa_get_autotrim(spa) && spa_writeable(spa);
+	uint64_t c, m;
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		if (vd->vdev_ishole || vd->vdev_ms == NULL)
+			continue;
+
+		mutex_enter(&vd->vdev_trim_lock);
+		if (autotrim) {
+			vdev_autotrim_start(vd);
+			mutex_exit(&vd->vdev_trim_lock);
+			continue;
+		}
+		if (vd->vdev_autotrim_thread == NULL) {
+			mutex_exit(&vd->vdev_trim_lock);
+			continue;
+		}
+
+		vd->vdev_autotrim_exit_wanted = B_TRUE;
+		cv_broadcast(&vd->vdev_trim_cv);
+		while (vd->vdev_autotrim_thread != NULL)
+			cv_wait(&vd->vdev_trim_cv, &vd->vdev_trim_lock);
+		mutex_exit(&vd->vdev_trim_lock);
+
+		for (m = 0; m < vd->vdev_ms_count; m++) {
+			metaslab_t *msp = vd->vdev_ms[m];
+
+			mutex_enter(&msp->ms_lock);
+			range_tree_vacate(msp->ms_trim, NULL, NULL);
+			mutex_exit(&msp->ms_lock);
+		}
+	}
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+}
+
+static int
+spa_trim_vdev(vdev_t *vd, pool_trim_func_t func, uint64_t rate)
+{
+	int error = 0;
+
+	mutex_enter(&vd->vdev_trim_lock);
+	switch (func) {
+	case POOL_TRIM_START:
+		if (!vdev_writeable(vd) || !vdev_trim_supported(vd))
+			error = SET_ERROR(ENXIO);
+		else
+			vdev_trim(vd, rate);
+		break;
+	case POOL_TRIM_CANCEL:
+		if (vd->vdev_trim_state != VDEV_TRIM_ACTIVE &&
+		    vd->vdev_trim_state != VDEV_TRIM_SUSPENDED)
+			error = SET_ERROR(ENOENT);
+		else
+			vdev_trim_stop(vd, VDEV_TRIM_CANCELED);
+		break;
+	case POOL_TRIM_SUSPEND:
+		if (vd->vdev_trim_state != VDEV_TRIM_ACTIVE)
+			error = SET_ERROR(ENOENT);
+		else
+			vdev_trim_stop(vd, VDEV_TRIM_SUSPENDED);
+		break;
+	default:
+		error = SET_ERROR(EINVAL);
+	}
+	mutex_exit(&vd->vdev_trim_lock);
+
+	return (error);
+}
+
+/*
+ * Start, cancel or suspend the manual trim of the top-level vdev holding
+ * the vdev with the given guid, or of every top-level vdev if the guid is
+ * zero or that of the root vdev.  The rate is in bytes per second, zero
+ * meaning unlimited.
+ */
+int
+spa_trim(spa_t *spa, uint64_t guid, pool_trim_func_t func, uint64_t rate)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_t *vd;
+	int error = 0;
+	int c, done = 0;
+
+	if (func >= POOL_TRIM_FUNCS)
+		return (SET_ERROR(EINVAL));
+
+	if (func == POOL_TRIM_START && !spa_writeable(spa))
+		return (SET_ERROR(EROFS));
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+	if (guid != 0 && guid != rvd->vdev_guid) {
+		vd = spa_lookup_by_guid(spa, guid, B_FALSE);
+		if (vd == NULL || vd->vdev_top == NULL ||
+		    vd->vdev_top->vdev_ishole)
+			error = SET_ERROR(ENODEV);
+		else
+			error = spa_trim_vdev(vd->vdev_top, func, rate);
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+		return (error);
+	}
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vd = rvd->vdev_child[c];
+		if (vd->vdev_ishole || vd->vdev_ms == NULL)
+			continue;
+		if (spa_trim_vdev(vd, func, rate) == 0)
+			done++;
+	}
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+	return (done == 0 ? SET_ERROR(ENOENT) : 0);
+}
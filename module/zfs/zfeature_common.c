@@ -290,4 +290,38 @@ zpool_feature_init(void)
 	    "Support for dataset level encryption",
 	    ZFEATURE_FLAG_PER_DATASET, encryption_deps);
 	}
+
+	static const spa_feature_t zstd_deps[] = {
+		SPA_FEATURE_EXTENSIBLE_DATASET,
+		SPA_FEATURE_NONE
+	};
+	zfeature_register(SPA_FEATURE_ZSTD_COMPRESS,
+	    "org.openzfsonosx:zstd_compress", "zstd_compress",
+	    "zstd compression algorithm support.",
+	    ZFEATURE_FLAG_PER_DATASET, zstd_deps);
+
+	zfeature_register(SPA_FEATURE_ALLOCATION_CLASSES,
+	    "org.zfsonlinux:allocation_classes", "allocation_classes",
+	    "Support for separate allocation classes.",
+	    ZFEATURE_FLAG_READONLY_COMPAT, NULL);
+
+	static const spa_feature_t log_spacemap_deps[] = {
+		SPA_FEATURE_SPACEMAP_HISTOGRAM,
+		SPA_FEATURE_NONE
+	};
+	zfeature_register(SPA_FEATURE_LOG_SPACEMAP,
+	    "org.openzfsonosx:log_spacemap", "log_spacemap",
+	    "Log metaslab changes on a single spacemap and "
+	    "flush them periodically.",
+	    ZFEATURE_FLAG_READONLY_COMPAT, log_spacemap_deps);
+
+	zfeature_register(SPA_FEATURE_DEDUP_LOG,
+	    "org.openzfsonosx:dedup_log", "dedup_log",
+	    "Log dedup table changes and flush them to the DDT in batches.",
+	    ZFEATURE_FLAG_READONLY_COMPAT, NULL);
+
+	zfeature_register(SPA_FEATURE_DDT_PRUNE,
+	    "org.openzfsonosx:ddt_prune", "ddt_prune",
+	    "Free blocks whose unique dedup table entries were pruned.",
+	    ZFEATURE_FLAG_READONLY_COMPAT, NULL);
 }
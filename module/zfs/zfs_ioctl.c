@@ -60,6 +60,7 @@
 #include <sys/spa.h>
 #include <sys/spa_impl.h>
 #include <sys/vdev.h>
+#include <sys/vdev_trim.h>
 #include <sys/priv_impl.h>
 #include <sys/dmu.h>
 #include <sys/dsl_dir.h>
@@ -84,6 +85,7 @@
 #include <sys/zfs_onexit.h>
 #include <sys/zvol.h>
 #include <sys/dsl_scan.h>
+#include <sys/ddt.h>
 #include <sharefs/share.h>
 #include <sys/fm/util.h>
 #include <sys/dsl_crypt.h>
@@ -94,6 +96,7 @@
 #include <sys/dsl_userhold.h>
 #include <sys/zfeature.h>
 #include <sys/zio_checksum.h>
+#include <sys/zio_compress.h>
 
 #include "zfs_namecheck.h"
 #include "zfs_prop.h"
@@ -1633,6 +1636,56 @@ zfs_ioc_pool_scan(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * inputs:
+ * zc_name		name of the pool
+ * zc_cookie		pool_trim_func_t
+ * zc_guid		guid of the vdev to trim, or 0 for the whole pool
+ * zc_obj		trim rate in bytes per second, or 0 for unlimited
+ */
+static int
+zfs_ioc_pool_trim(zfs_cmd_t *zc)
+{
+	spa_t *spa;
+	int error;
+
+	if (zc->zc_cookie >= POOL_TRIM_FUNCS)
+		return (SET_ERROR(EINVAL));
+
+	if ((error = spa_open(zc->zc_name, &spa, FTAG)) != 0)
+		return (error);
+
+	error = spa_trim(spa, zc->zc_guid, zc->zc_cookie, zc->zc_obj);
+
+	spa_close(spa, FTAG);
+
+	return (error);
+}
+
+/*
+ * inputs:
+ * zc_name		name of the pool
+ * zc_obj		prune unique entries older than this many days
+ *
+ * outputs:
+ * zc_cookie		number of entries pruned
+ */
+static int
+zfs_ioc_pool_ddt_prune(zfs_cmd_t *zc)
+{
+	spa_t *spa;
+	int error;
+
+	if ((error = spa_open(zc->zc_name, &spa, FTAG)) != 0)
+		return (error);
+
+	error = ddt_prune(spa, zc->zc_obj, &zc->zc_cookie);
+
+	spa_close(spa, FTAG);
+
+	return (error);
+}
+
 static int
 zfs_ioc_pool_freeze(zfs_cmd_t *zc)
 {
@@ -3791,6 +3844,20 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 				spa_close(spa, FTAG);
 			}
 
+			if (ZIO_COMPRESS_IS_ZSTD(intval)) {
+				spa_t *spa;
+
+				if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+					return (err);
+
+				if (!spa_feature_is_enabled(spa,
+				    SPA_FEATURE_ZSTD_COMPRESS)) {
+					spa_close(spa, FTAG);
+					return (SET_ERROR(ENOTSUP));
+				}
+				spa_close(spa, FTAG);
+			}
+
 			/*
 			 * If this is a bootable dataset then
 			 * verify that the compression algorithm
@@ -3849,6 +3916,27 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 		}
 		break;
 
+	case ZFS_PROP_SPECIAL_SMALL_BLOCKS:
+		/* Small blocks can only go to special vdevs with the feature */
+		if (nvpair_value_uint64(pair, &intval) == 0 && intval != 0) {
+			spa_t *spa;
+
+			if (intval < SPA_MINBLOCKSIZE ||
+			    intval > SPA_OLD_MAXBLOCKSIZE || !ISP2(intval))
+				return (SET_ERROR(EINVAL));
+
+			if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+				return (err);
+
+			if (!spa_feature_is_enabled(spa,
+			    SPA_FEATURE_ALLOCATION_CLASSES)) {
+				spa_close(spa, FTAG);
+				return (SET_ERROR(ENOTSUP));
+			}
+			spa_close(spa, FTAG);
+		}
+		break;
+
 	case ZFS_PROP_SHARESMB:
 		if (zpl_earlier_version(dsname, ZPL_VERSION_FUID))
 			return (SET_ERROR(ENOTSUP));
@@ -5824,6 +5912,10 @@ zfs_ioctl_init(void)
 							zfs_secpolicy_config, B_TRUE, POOL_CHECK_NONE);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_SCAN,
 								   zfs_ioc_pool_scan);
+	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_TRIM,
+								   zfs_ioc_pool_trim);
+	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_DDT_PRUNE,
+								   zfs_ioc_pool_ddt_prune);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_UPGRADE,
 								   zfs_ioc_pool_upgrade);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_VDEV_ADD,
@@ -44,6 +44,8 @@
 #include <sys/spa.h>
 #include <sys/zap_impl.h>
 #include <sys/zil.h>
+#include <sys/vdev_raidz.h>
+#include <zfs_fletcher.h>
 
 /*
  * In Solaris the tunable are set via /etc/system. Until we have a load
@@ -97,6 +99,8 @@ osx_kstat_t osx_kstat = {
 	{ "async_write_max_active",		KSTAT_DATA_UINT64 },
 	{ "scrub_min_active",			KSTAT_DATA_UINT64 },
 	{ "scrub_max_active",			KSTAT_DATA_UINT64 },
+	{ "trim_min_active",			KSTAT_DATA_UINT64 },
+	{ "trim_max_active",			KSTAT_DATA_UINT64 },
 	{ "async_write_min_dirty_pct",	KSTAT_DATA_INT64  },
 	{ "async_write_max_dirty_pct",	KSTAT_DATA_INT64  },
 	{ "aggregation_limit",			KSTAT_DATA_INT64  },
@@ -138,17 +142,25 @@ osx_kstat_t osx_kstat = {
 	{"metaslab_gang_bang",			KSTAT_DATA_INT64  },
 	{"metaslab_df_alloc_threshold",	KSTAT_DATA_INT64  },
 	{"metaslab_df_free_pct",		KSTAT_DATA_INT64  },
+	{"metaslab_allocator",			KSTAT_DATA_INT64  },
 	{"zio_injection_enabled",		KSTAT_DATA_INT64  },
 	{"zvol_immediate_write_sz",		KSTAT_DATA_INT64  },
 
 	{ "l2arc_noprefetch",			KSTAT_DATA_INT64  },
 	{ "l2arc_feed_again",			KSTAT_DATA_INT64  },
 	{ "l2arc_norw",					KSTAT_DATA_INT64  },
+	{ "l2arc_rebuild_enabled",		KSTAT_DATA_INT64  },
 
 	{"zfs_top_maxinflight",			KSTAT_DATA_INT64  },
 	{"zfs_resilver_delay",			KSTAT_DATA_INT64  },
 	{"zfs_scrub_delay",				KSTAT_DATA_INT64  },
 	{"zfs_scan_idle",				KSTAT_DATA_INT64  },
+	{"zfs_scan_legacy",			KSTAT_DATA_INT64  },
+	{"zfs_scan_vdev_limit",			KSTAT_DATA_UINT64  },
+	{"zfs_scan_mem_lim_fact",		KSTAT_DATA_INT64  },
+	{"zfs_scan_mem_lim_soft_fact",		KSTAT_DATA_INT64  },
+	{"zfs_scan_max_ext_gap",		KSTAT_DATA_UINT64  },
+	{"zfs_scan_checkpoint_intval",		KSTAT_DATA_INT64  },
 
 	{"zfs_recover",					KSTAT_DATA_INT64  },
 
@@ -177,6 +189,51 @@ osx_kstat_t osx_kstat = {
 	{"zio_dva_throttle_enabled",KSTAT_DATA_UINT64  },
 
 	{"zfs_vdev_file_size_mismatch_cnt",KSTAT_DATA_UINT64  },
+
+	{"zfs_fletcher_4_impl",KSTAT_DATA_UINT64  },
+	{"zfs_vdev_raidz_impl",KSTAT_DATA_UINT64  },
+
+	{"zfs_trim_extent_bytes_max",KSTAT_DATA_UINT64  },
+	{"zfs_trim_extent_bytes_min",KSTAT_DATA_UINT64  },
+	{"zfs_trim_queue_limit",KSTAT_DATA_UINT64  },
+	{"zfs_trim_txg_batch",KSTAT_DATA_UINT64  },
+
+	{"zfs_ddt_data_is_special",KSTAT_DATA_UINT64  },
+	{"zfs_user_indirect_is_special",KSTAT_DATA_UINT64  },
+	{"zfs_special_class_reserve_pct",KSTAT_DATA_UINT64  },
+
+	{"zfs_unflushed_max_mem_amt",KSTAT_DATA_UINT64  },
+	{"zfs_unflushed_log_block_max",KSTAT_DATA_UINT64  },
+	{"zfs_min_metaslabs_to_flush",KSTAT_DATA_UINT64  },
+	{"zfs_max_metaslabs_to_flush",KSTAT_DATA_UINT64  },
+
+	{"dmu_object_alloc_chunk_shift",KSTAT_DATA_INT64  },
+	{"zfs_commit_timeout_pct",KSTAT_DATA_INT64  },
+	{"zil_slog_stripe",KSTAT_DATA_INT64  },
+	{"zfs_vdev_queue_adaptive",KSTAT_DATA_INT64  },
+	{"zfs_vdev_queue_target_latency_us",KSTAT_DATA_UINT64  },
+	{"zfs_vdev_queue_adaptive_max_pct",KSTAT_DATA_UINT64  },
+	{"zfs_vdev_mirror_latency_select",KSTAT_DATA_INT64  },
+	{"zfs_vdev_mirror_latency_hysteresis",KSTAT_DATA_UINT64  },
+	{"zfs_vdev_mirror_latency_stale_ms",KSTAT_DATA_UINT64  },
+	{"zfetch_max_distance",			KSTAT_DATA_UINT64  },
+	{"zfetch_min_distance",			KSTAT_DATA_UINT64  },
+	{"dbuf_hash_load_max",			KSTAT_DATA_UINT64  },
+	{"zfs_arc_hash_resize",			KSTAT_DATA_INT64  },
+	{"zfs_arc_evict_threads",		KSTAT_DATA_INT64  },
+	{"zfs_arc_evict_thread_bytes",		KSTAT_DATA_UINT64  },
+	{"zfs_vdev_aggregate_gang",		KSTAT_DATA_INT64  },
+	{"zfs_compress_probe",			KSTAT_DATA_INT64  },
+	{"zfs_compress_probe_size",		KSTAT_DATA_UINT64  },
+	{"zfs_compress_probe_min_pct",		KSTAT_DATA_UINT64  },
+	{"zfs_decompress_stream",		KSTAT_DATA_INT64  },
+	{"zfs_dedup_log_txg_max",		KSTAT_DATA_UINT64  },
+	{"zfs_dedup_log_mem_max",		KSTAT_DATA_UINT64  },
+	{"zfs_dedup_log_flush_txgs",		KSTAT_DATA_UINT64  },
+	{"zfs_dedup_log_flush_entries_min",	KSTAT_DATA_UINT64  },
+	{"zfs_dedup_log_flush_entries_max",	KSTAT_DATA_UINT64  },
+	{"zfs_send_workers",			KSTAT_DATA_UINT64  },
+	{"zfs_send_worker_range",		KSTAT_DATA_UINT64  },
 };
 
 
@@ -221,6 +278,7 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		l2arc_noprefetch = ks->l2arc_noprefetch.value.i64;
 		l2arc_feed_again = ks->l2arc_feed_again.value.i64;
 		l2arc_norw = ks->l2arc_norw.value.i64;
+		l2arc_rebuild_enabled = ks->l2arc_rebuild_enabled.value.i64;
 
 		/* vdev_queue */
 
@@ -246,6 +304,10 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_vdev_scrub_min_active.value.ui64;
 		zfs_vdev_scrub_max_active =
 			ks->zfs_vdev_scrub_max_active.value.ui64;
+		zfs_vdev_trim_min_active =
+			ks->zfs_vdev_trim_min_active.value.ui64;
+		zfs_vdev_trim_max_active =
+			ks->zfs_vdev_trim_max_active.value.ui64;
 		zfs_vdev_async_write_active_min_dirty_percent =
 			ks->zfs_vdev_async_write_active_min_dirty_percent.value.i64;
 		zfs_vdev_async_write_active_max_dirty_percent =
@@ -321,6 +383,8 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->metaslab_df_alloc_threshold.value.i64;
 		metaslab_df_free_pct =
 			ks->metaslab_df_free_pct.value.i64;
+		metaslab_allocator =
+			ks->metaslab_allocator.value.i64;
 		zio_injection_enabled =
 			ks->zio_injection_enabled.value.i64;
 		zvol_immediate_write_sz =
@@ -334,6 +398,18 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_scrub_delay.value.i64;
 		zfs_scan_idle =
 			ks->zfs_scan_idle.value.i64;
+		zfs_scan_legacy =
+			ks->zfs_scan_legacy.value.i64;
+		zfs_scan_vdev_limit =
+			ks->zfs_scan_vdev_limit.value.ui64;
+		zfs_scan_mem_lim_fact =
+			ks->zfs_scan_mem_lim_fact.value.i64;
+		zfs_scan_mem_lim_soft_fact =
+			ks->zfs_scan_mem_lim_soft_fact.value.i64;
+		zfs_scan_max_ext_gap =
+			ks->zfs_scan_max_ext_gap.value.ui64;
+		zfs_scan_checkpoint_intval =
+			ks->zfs_scan_checkpoint_intval.value.i64;
 		zfs_recover =
 			ks->zfs_recover.value.i64;
 
@@ -378,6 +454,91 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 
 		zio_dva_throttle_enabled =
 		    (boolean_t) ks->zio_dva_throttle_enabled.value.ui64;
+
+		(void) fletcher_4_impl_set(
+		    ks->zfs_fletcher_4_impl.value.ui64);
+		(void) vdev_raidz_impl_set(
+		    ks->zfs_vdev_raidz_impl.value.ui64);
+
+		zfs_trim_extent_bytes_max =
+		    ks->zfs_trim_extent_bytes_max.value.ui64;
+		zfs_trim_extent_bytes_min =
+		    ks->zfs_trim_extent_bytes_min.value.ui64;
+		zfs_trim_queue_limit =
+		    ks->zfs_trim_queue_limit.value.ui64;
+		zfs_trim_txg_batch =
+		    ks->zfs_trim_txg_batch.value.ui64;
+
+		zfs_ddt_data_is_special =
+		    ks->zfs_ddt_data_is_special.value.ui64;
+		zfs_user_indirect_is_special =
+		    ks->zfs_user_indirect_is_special.value.ui64;
+		zfs_special_class_metadata_reserve_pct =
+		    ks->zfs_special_class_metadata_reserve_pct.value.ui64;
+
+		zfs_unflushed_max_mem_amt =
+		    ks->zfs_unflushed_max_mem_amt.value.ui64;
+		zfs_unflushed_log_block_max =
+		    ks->zfs_unflushed_log_block_max.value.ui64;
+		zfs_min_metaslabs_to_flush =
+		    ks->zfs_min_metaslabs_to_flush.value.ui64;
+		zfs_max_metaslabs_to_flush =
+		    ks->zfs_max_metaslabs_to_flush.value.ui64;
+
+		dmu_object_alloc_chunk_shift =
+		    ks->dmu_object_alloc_chunk_shift.value.i64;
+		zfs_commit_timeout_pct =
+		    ks->zfs_commit_timeout_pct.value.i64;
+		zil_slog_stripe =
+		    ks->zil_slog_stripe.value.i64;
+		zfs_vdev_queue_adaptive =
+		    ks->zfs_vdev_queue_adaptive.value.i64;
+		zfs_vdev_queue_target_latency_us =
+		    ks->zfs_vdev_queue_target_latency_us.value.ui64;
+		zfs_vdev_queue_adaptive_max_pct =
+		    ks->zfs_vdev_queue_adaptive_max_pct.value.ui64;
+		zfs_vdev_mirror_latency_select =
+		    ks->zfs_vdev_mirror_latency_select.value.i64;
+		zfs_vdev_mirror_latency_hysteresis =
+		    ks->zfs_vdev_mirror_latency_hysteresis.value.ui64;
+		zfs_vdev_mirror_latency_stale_ms =
+		    ks->zfs_vdev_mirror_latency_stale_ms.value.ui64;
+		zfetch_max_distance =
+		    ks->zfetch_max_distance.value.ui64;
+		zfetch_min_distance =
+		    ks->zfetch_min_distance.value.ui64;
+		dbuf_hash_load_max =
+		    ks->dbuf_hash_load_max.value.ui64;
+		zfs_arc_hash_resize =
+		    ks->zfs_arc_hash_resize.value.i64;
+		zfs_arc_evict_threads =
+		    ks->zfs_arc_evict_threads.value.i64;
+		zfs_arc_evict_thread_bytes =
+		    ks->zfs_arc_evict_thread_bytes.value.ui64;
+		zfs_vdev_aggregate_gang =
+		    ks->zfs_vdev_aggregate_gang.value.i64;
+		zfs_compress_probe =
+		    ks->zfs_compress_probe.value.i64;
+		zfs_compress_probe_size =
+		    ks->zfs_compress_probe_size.value.ui64;
+		zfs_compress_probe_min_pct =
+		    ks->zfs_compress_probe_min_pct.value.ui64;
+		zfs_decompress_stream =
+		    ks->zfs_decompress_stream.value.i64;
+		zfs_dedup_log_txg_max =
+		    ks->zfs_dedup_log_txg_max.value.ui64;
+		zfs_dedup_log_mem_max =
+		    ks->zfs_dedup_log_mem_max.value.ui64;
+		zfs_dedup_log_flush_txgs =
+		    ks->zfs_dedup_log_flush_txgs.value.ui64;
+		zfs_dedup_log_flush_entries_min =
+		    ks->zfs_dedup_log_flush_entries_min.value.ui64;
+		zfs_dedup_log_flush_entries_max =
+		    ks->zfs_dedup_log_flush_entries_max.value.ui64;
+		zfs_send_workers =
+		    ks->zfs_send_workers.value.ui64;
+		zfs_send_worker_range =
+		    ks->zfs_send_worker_range.value.ui64;
 	} else {
 
 		/* kstat READ */
@@ -410,6 +571,7 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		ks->l2arc_noprefetch.value.i64               = l2arc_noprefetch;
 		ks->l2arc_feed_again.value.i64               = l2arc_feed_again;
 		ks->l2arc_norw.value.i64                     = l2arc_norw;
+		ks->l2arc_rebuild_enabled.value.i64          = l2arc_rebuild_enabled;
 
 		/* vdev_queue */
 		ks->zfs_vdev_max_active.value.ui64 =
@@ -434,6 +596,10 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_vdev_scrub_min_active ;
 		ks->zfs_vdev_scrub_max_active.value.ui64 =
 			zfs_vdev_scrub_max_active ;
+		ks->zfs_vdev_trim_min_active.value.ui64 =
+			zfs_vdev_trim_min_active ;
+		ks->zfs_vdev_trim_max_active.value.ui64 =
+			zfs_vdev_trim_max_active ;
 		ks->zfs_vdev_async_write_active_min_dirty_percent.value.i64 =
 			zfs_vdev_async_write_active_min_dirty_percent ;
 		ks->zfs_vdev_async_write_active_max_dirty_percent.value.i64 =
@@ -509,6 +675,8 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			metaslab_df_alloc_threshold;
 		ks->metaslab_df_free_pct.value.i64 =
 			metaslab_df_free_pct;
+		ks->metaslab_allocator.value.i64 =
+			metaslab_allocator;
 		ks->zio_injection_enabled.value.i64 =
 			zio_injection_enabled;
 		ks->zvol_immediate_write_sz.value.i64 =
@@ -522,6 +690,18 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_scrub_delay;
 		ks->zfs_scan_idle.value.i64 =
 			zfs_scan_idle;
+		ks->zfs_scan_legacy.value.i64 =
+			zfs_scan_legacy;
+		ks->zfs_scan_vdev_limit.value.ui64 =
+			zfs_scan_vdev_limit;
+		ks->zfs_scan_mem_lim_fact.value.i64 =
+			zfs_scan_mem_lim_fact;
+		ks->zfs_scan_mem_lim_soft_fact.value.i64 =
+			zfs_scan_mem_lim_soft_fact;
+		ks->zfs_scan_max_ext_gap.value.ui64 =
+			zfs_scan_max_ext_gap;
+		ks->zfs_scan_checkpoint_intval.value.i64 =
+			zfs_scan_checkpoint_intval;
 
 		ks->zfs_recover.value.i64 =
 			zfs_recover;
@@ -565,6 +745,87 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		ks->zio_dva_throttle_enabled.value.ui64 = (uint64_t) zio_dva_throttle_enabled;
 
 		ks->zfs_vdev_file_size_mismatch_cnt.value.ui64 = zfs_vdev_file_size_mismatch_cnt;
+
+		ks->zfs_fletcher_4_impl.value.ui64 = zfs_fletcher_4_impl;
+		ks->zfs_vdev_raidz_impl.value.ui64 = zfs_vdev_raidz_impl;
+
+		ks->zfs_trim_extent_bytes_max.value.ui64 =
+		    zfs_trim_extent_bytes_max;
+		ks->zfs_trim_extent_bytes_min.value.ui64 =
+		    zfs_trim_extent_bytes_min;
+		ks->zfs_trim_queue_limit.value.ui64 = zfs_trim_queue_limit;
+		ks->zfs_trim_txg_batch.value.ui64 = zfs_trim_txg_batch;
+
+		ks->zfs_ddt_data_is_special.value.ui64 =
+		    zfs_ddt_data_is_special;
+		ks->zfs_user_indirect_is_special.value.ui64 =
+		    zfs_user_indirect_is_special;
+		ks->zfs_special_class_metadata_reserve_pct.value.ui64 =
+		    zfs_special_class_metadata_reserve_pct;
+
+		ks->zfs_unflushed_max_mem_amt.value.ui64 =
+		    zfs_unflushed_max_mem_amt;
+		ks->zfs_unflushed_log_block_max.value.ui64 =
+		    zfs_unflushed_log_block_max;
+		ks->zfs_min_metaslabs_to_flush.value.ui64 =
+		    zfs_min_metaslabs_to_flush;
+		ks->zfs_max_metaslabs_to_flush.value.ui64 =
+		    zfs_max_metaslabs_to_flush;
+
+		ks->dmu_object_alloc_chunk_shift.value.i64 =
+		    dmu_object_alloc_chunk_shift;
+		ks->zfs_commit_timeout_pct.value.i64 =
+		    zfs_commit_timeout_pct;
+		ks->zil_slog_stripe.value.i64 =
+		    zil_slog_stripe;
+		ks->zfs_vdev_queue_adaptive.value.i64 =
+		    zfs_vdev_queue_adaptive;
+		ks->zfs_vdev_queue_target_latency_us.value.ui64 =
+		    zfs_vdev_queue_target_latency_us;
+		ks->zfs_vdev_queue_adaptive_max_pct.value.ui64 =
+		    zfs_vdev_queue_adaptive_max_pct;
+		ks->zfs_vdev_mirror_latency_select.value.i64 =
+		    zfs_vdev_mirror_latency_select;
+		ks->zfs_vdev_mirror_latency_hysteresis.value.ui64 =
+		    zfs_vdev_mirror_latency_hysteresis;
+		ks->zfs_vdev_mirror_latency_stale_ms.value.ui64 =
+		    zfs_vdev_mirror_latency_stale_ms;
+		ks->zfetch_max_distance.value.ui64 =
+		    zfetch_max_distance;
+		ks->zfetch_min_distance.value.ui64 =
+		    zfetch_min_distance;
+		ks->dbuf_hash_load_max.value.ui64 =
+		    dbuf_hash_load_max;
+		ks->zfs_arc_hash_resize.value.i64 =
+		    zfs_arc_hash_resize;
+		ks->zfs_arc_evict_threads.value.i64 =
+		    zfs_arc_evict_threads;
+		ks->zfs_arc_evict_thread_bytes.value.ui64 =
+		    zfs_arc_evict_thread_bytes;
+		ks->zfs_vdev_aggregate_gang.value.i64 =
+		    zfs_vdev_aggregate_gang;
+		ks->zfs_compress_probe.value.i64 =
+		    zfs_compress_probe;
+		ks->zfs_compress_probe_size.value.ui64 =
+		    zfs_compress_probe_size;
+		ks->zfs_compress_probe_min_pct.value.ui64 =
+		    zfs_compress_probe_min_pct;
+		ks->zfs_decompress_stream.value.i64 =
+		    zfs_decompress_stream;
+		ks->zfs_dedup_log_txg_max.value.ui64 =
+		    zfs_dedup_log_txg_max;
+		ks->zfs_dedup_log_mem_max.value.ui64 =
+		    zfs_dedup_log_mem_max;
+		ks->zfs_dedup_log_flush_txgs.value.ui64 =
+		    zfs_dedup_log_flush_txgs;
+		ks->zfs_dedup_log_flush_entries_min.value.ui64 =
+		    zfs_dedup_log_flush_entries_min;
+		ks->zfs_dedup_log_flush_entries_max.value.ui64 =
+		    zfs_dedup_log_flush_entries_max;
+		ks->zfs_send_workers.value.ui64 =
+		    zfs_send_workers;
+		ks->zfs_send_worker_range.value.ui64 =
+		    zfs_send_worker_range;
 	}
 
 	return 0;
@@ -1215,7 +1215,7 @@ zfs_get_done(zgd_t *zgd, int error)
 	}
 #endif
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	kmem_free(zgd, sizeof (zgd_t));
 }
@@ -1228,8 +1228,8 @@ static int zil_fault_io = 0;
  * Get data to generate a TX_WRITE intent log record.
  */
 int
-zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
-			 znode_t *zp, rl_t *rl)
+zfs_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio, znode_t *zp, rl_t *rl)
 {
 	zfsvfs_t *zfsvfs = arg;
 	objset_t *os = zfsvfs->z_os;
@@ -1240,8 +1240,9 @@ zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
 	zgd_t *zgd;
 	int error = 0;
 
-	ASSERT(zio != NULL);
-	ASSERT(size != 0);
+	ASSERT3P(lwb, !=, NULL);
+	ASSERT3P(zio, !=, NULL);
+	ASSERT3U(size, !=, 0);
 
 #ifndef __APPLE__
 	/*
@@ -1261,7 +1262,7 @@ zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio,
 #endif
 
 	zgd = (zgd_t *)kmem_zalloc(sizeof (zgd_t), KM_SLEEP);
-	zgd->zgd_zilog = zfsvfs->z_log;
+	zgd->zgd_lwb = lwb;
 	zgd->zgd_private = zp;
 	zgd->zgd_rl = rl;
 
@@ -47,6 +47,7 @@
 #include <sys/time.h>
 #include <sys/abd.h>
 #include <sys/dsl_crypt.h>
+#include <sys/dsl_scan.h>
 
 /*
  * ==========================================================================
@@ -211,6 +212,9 @@ zio_init(void)
 	zio_inject_init();
 
 	lz4_init();
+	zstd_init();
+	zio_compress_init();
+	zio_checksum_init();
 
 }
 
@@ -248,6 +252,9 @@ zio_fini(void)
 
 	zio_inject_fini();
 
+	zio_checksum_fini();
+	zio_compress_fini();
+	zstd_fini();
 	lz4_fini();
 
 #ifdef __APPLE__
@@ -751,7 +758,7 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 {
 	zio_t *zio;
 
-	ASSERT3U(psize, <=, SPA_MAXBLOCKSIZE);
+	IMPLY(type != ZIO_TYPE_FREE, psize <= SPA_MAXBLOCKSIZE);
 	ASSERT(P2PHASE(psize, SPA_MINBLOCKSIZE) == 0);
 	ASSERT(P2PHASE(offset, SPA_MINBLOCKSIZE) == 0);
 
@@ -1085,6 +1092,7 @@ zio_free_sync(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 
 	metaslab_check_free(spa, bp);
 	arc_freed(spa, bp);
+	dsl_scan_freed(spa, bp);
 
 	/*
 	 * GANG and DEDUP blocks can induce a read (for the gang block header,
@@ -1160,6 +1168,31 @@ zio_ioctl(zio_t *pio, spa_t *spa, vdev_t *vd, int cmd,
 	return (zio);
 }
 
+/*
+ * Discard a range of a top-level vdev's allocatable space.  The range
+ * must not be allocated for the lifetime of the i/o.  Like a scrub read,
+ * the i/o is queued at each leaf, where it is issued as a trim, unmap or
+ * hole punch by the leaf's vdev_op_io_start.
+ */
+zio_t *
+zio_trim(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
+    zio_done_func_t *done, void *private, zio_priority_t priority,
+    enum zio_flag flags)
+{
+	ASSERT(vd == vd->vdev_top);
+	ASSERT0(P2PHASE(offset, 1ULL << vd->vdev_ashift));
+	ASSERT0(P2PHASE(size, 1ULL << vd->vdev_ashift));
+	ASSERT3U(offset + size, <=, vd->vdev_asize);
+
+	if (vd->vdev_children == 0)
+		offset += VDEV_LABEL_START_SIZE;
+
+	return (zio_create(pio, vd->vdev_spa, 0, NULL, NULL, size, size, done,
+	    private, ZIO_TYPE_FREE, priority, flags | ZIO_FLAG_DONT_AGGREGATE |
+	    ZIO_FLAG_DONT_CACHE, vd, offset, NULL, ZIO_STAGE_OPEN,
+	    ZIO_TRIM_PIPELINE));
+}
+
 zio_t *
 zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
     abd_t *data, int checksum, zio_done_func_t *done, void *private,
@@ -1501,7 +1534,12 @@ zio_write_compress(zio_t *zio)
 	if (compress != ZIO_COMPRESS_OFF &&
 	    !(zio->io_flags & ZIO_FLAG_RAW_COMPRESS)) {
 		void *cbuf = zio_buf_alloc(lsize);
-		psize = zio_compress_data(compress, zio->io_abd, cbuf, lsize);
+		/*
+		 * Dedup and nopwrite match blocks by the checksum of their
+		 * compressed form, so don't let early abort change it.
+		 */
+		psize = zio_compress_data(compress, zio->io_abd, cbuf, lsize,
+		    !zp->zp_dedup && !zp->zp_nopwrite);
 		if (psize == 0 || psize == lsize) {
 			compress = ZIO_COMPRESS_OFF;
 			zio_buf_free(cbuf, lsize);
@@ -2526,6 +2564,7 @@ zio_write_gang_block(zio_t *pio)
 		zp.zp_nopwrite = B_FALSE;
 		zp.zp_encrypt = gio->io_prop.zp_encrypt;
 		zp.zp_byteorder = gio->io_prop.zp_byteorder;
+		zp.zp_zpl_smallblk = 0;
 		bzero(zp.zp_salt, ZIO_DATA_SALT_LEN);
 		bzero(zp.zp_iv, ZIO_DATA_IV_LEN);
 		bzero(zp.zp_mac, ZIO_DATA_MAC_LEN);
@@ -2919,6 +2958,20 @@ zio_ddt_write(zio_t *zio)
 	ASSERT(!(zio->io_bp_override && (zio->io_flags & ZIO_FLAG_RAW)));
 
 	ddt_enter(ddt);
+
+	if (zio->io_bp_override == NULL && ddt_over_quota(spa) &&
+	    !ddt_exists(ddt, bp)) {
+		/*
+		 * The DDT has reached its quota, so write this block as an
+		 * ordinary one rather than adding another entry to the table.
+		 */
+		zp->zp_dedup = B_FALSE;
+		BP_SET_DEDUP(bp, B_FALSE);
+		zio->io_pipeline = ZIO_WRITE_PIPELINE;
+		ddt_exit(ddt);
+		return (ZIO_PIPELINE_CONTINUE);
+	}
+
 	dde = ddt_lookup(ddt, bp, B_TRUE);
 	ddp = &dde->dde_phys[p];
 
@@ -3029,10 +3082,17 @@ zio_ddt_free(zio_t *zio)
 
 	ddt_enter(ddt);
 	freedde = dde = ddt_lookup(ddt, bp, B_TRUE);
-	if (dde) {
-		ddp = ddt_phys_select(dde, bp);
-		if (ddp)
-			ddt_phys_decref(ddp);
+	ddp = ddt_phys_select(dde, bp);
+	if (ddp != NULL) {
+		ddt_phys_decref(ddp);
+	} else {
+		/*
+		 * The entry for this block has been pruned from the DDT
+		 * (see ddt_prune()), so nothing else can reference it.
+		 */
+		zio->io_pipeline |= ZIO_STAGE_DVA_FREE;
+		if (BP_IS_GANG(bp))
+			zio->io_pipeline |= ZIO_GANG_STAGES;
 	}
 	ddt_exit(ddt);
 
@@ -3137,7 +3197,7 @@ static int
 zio_dva_allocate(zio_t *zio)
 {
 	spa_t *spa = zio->io_spa;
-	metaslab_class_t *mc = spa_normal_class(spa);
+	metaslab_class_t *mc;
 	blkptr_t *bp = zio->io_bp;
 	int error;
 	int flags = 0;
@@ -3166,10 +3226,23 @@ zio_dva_allocate(zio_t *zio)
 		flags |= METASLAB_FASTWRITE;
 	}
 
+	mc = spa_preferred_class(spa, zio->io_size, zio->io_prop.zp_type,
+	    zio->io_prop.zp_level, zio->io_prop.zp_zpl_smallblk);
+
 	error = metaslab_alloc(spa, mc, zio->io_size, bp,
 	    zio->io_prop.zp_copies, zio->io_txg, NULL, flags,
 	    &zio->io_alloc_list, zio);
 
+	/*
+	 * A full special or dedup class falls back to the normal class.
+	 */
+	if (error == ENOSPC && mc != spa_normal_class(spa)) {
+		mc = spa_normal_class(spa);
+		error = metaslab_alloc(spa, mc, zio->io_size, bp,
+		    zio->io_prop.zp_copies, zio->io_txg, NULL, flags,
+		    &zio->io_alloc_list, zio);
+	}
+
 	if (error != 0) {
 		spa_dbgmsg(spa, "%s: metaslab allocation failure: zio %p, "
 		    "size %llu, error %d", spa_name(spa), zio, zio->io_size,
@@ -3418,7 +3491,8 @@ zio_vdev_io_start(zio_t *zio)
 	}
 
 	if (vd->vdev_ops->vdev_op_leaf &&
-	    (zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE)) {
+	    (zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE ||
+	    zio->io_type == ZIO_TYPE_FREE)) {
 
 		if (zio->io_type == ZIO_TYPE_READ && vdev_cache_read(zio))
 			return (ZIO_PIPELINE_CONTINUE);
@@ -3448,7 +3522,8 @@ zio_vdev_io_done(zio_t *zio)
 	if (zio_wait_for_children(zio, ZIO_CHILD_VDEV, ZIO_WAIT_DONE))
 		return (ZIO_PIPELINE_STOP);
 
-	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
+	ASSERT(zio->io_type == ZIO_TYPE_READ ||
+	    zio->io_type == ZIO_TYPE_WRITE || zio->io_type == ZIO_TYPE_FREE);
 
 	if (zio->io_delay)
 		zio->io_delay = gethrtime() - zio->io_delay;
@@ -3467,10 +3542,14 @@ zio_vdev_io_done(zio_t *zio)
 		if (zio_injection_enabled && zio->io_error == 0)
 			zio->io_error = zio_handle_label_injection(zio, EIO);
 
+		/*
+		 * A failed trim leaves the data in place, which is harmless,
+		 * so it is no reason to probe the device.
+		 */
 		if (zio->io_error) {
 			if (!vdev_accessible(vd, zio)) {
 				zio->io_error = SET_ERROR(ENXIO);
-			} else {
+			} else if (zio->io_type != ZIO_TYPE_FREE) {
 				unexpected_error = B_TRUE;
 			}
 		}
@@ -3575,6 +3654,15 @@ zio_vdev_io_assess(zio_t *zio)
 	    zio->io_cmd == DKIOCFLUSHWRITECACHE && vd != NULL)
 		vd->vdev_nowritecache = B_TRUE;
 
+	/*
+	 * Likewise, a leaf that cannot trim is marked so that no further
+	 * trims are issued to it.
+	 */
+	if ((zio->io_error == ENOTSUP || zio->io_error == ENOTTY) &&
+	    zio->io_type == ZIO_TYPE_FREE && vd != NULL &&
+	    vd->vdev_ops->vdev_op_leaf)
+		vd->vdev_notrim = B_TRUE;
+
 	if (zio->io_error)
 		zio->io_pipeline = ZIO_INTERLOCK_PIPELINE;
 
@@ -4125,7 +4213,8 @@ zio_done(zio_t *zio)
 		 */
 #ifndef __OPPLE__
 		if (zio->io_error != ECKSUM && zio->io_vd != NULL &&
-			!vdev_is_dead(zio->io_vd))
+		    zio->io_type != ZIO_TYPE_FREE &&
+		    !vdev_is_dead(zio->io_vd))
 			zfs_ereport_post(FM_EREPORT_ZFS_IO, zio->io_spa,
 			    zio->io_vd, &zio->io_bookmark, zio, 0, 0);
 #endif
@@ -31,6 +31,7 @@
 #include <sys/zio_checksum.h>
 #include <sys/zil.h>
 #include <sys/abd.h>
+#include <sys/kstat.h>
 #include <zfs_fletcher.h>
 
 /*
@@ -89,8 +90,38 @@
  * construct and destruct the pre-initialized checksum context.  The
  * pre-initialized context is then reused during each checksum
  * invocation and passed to the checksum function.
+ *
+ * ABD STREAMING
+ *
+ * Every checksum function takes the ABD itself and consumes it one chunk
+ * at a time through abd_iterate_func(), so scatter ABDs are never copied
+ * into a linear buffer to be checksummed.  The only bytes copied out are
+ * the embedded checksum trailer (zio_eck_t or zil_chain_t) of the
+ * ZCHECKSUM_FLAG_EMBEDDED checksums.  The "zio_checksum" kstat reports,
+ * per checksum function, the bytes handled each way.
  */
 
+typedef struct zio_checksum_stats {
+	uint64_t	zcks_calls;		/* checksums computed */
+	uint64_t	zcks_streamed;		/* bytes read from ABD chunks */
+	uint64_t	zcks_linearized;	/* bytes copied out */
+} zio_checksum_stats_t;
+
+static zio_checksum_stats_t zio_checksum_stats[ZIO_CHECKSUM_FUNCTIONS];
+static kstat_t *zio_checksum_ksp;
+
+static void
+zio_checksum_account(enum zio_checksum checksum, uint64_t streamed,
+    uint64_t linearized)
+{
+	zio_checksum_stats_t *zcks = &zio_checksum_stats[checksum];
+
+	atomic_inc_64(&zcks->zcks_calls);
+	atomic_add_64(&zcks->zcks_streamed, streamed);
+	if (linearized != 0)
+		atomic_add_64(&zcks->zcks_linearized, linearized);
+}
+
 /*ARGSUSED*/
 static void
 abd_checksum_off(abd_t *abd, uint64_t size,
@@ -367,6 +398,9 @@ zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
 
 		ci->ci_func[0](abd, size, spa->spa_cksum_tmpls[checksum],
 		    &cksum);
+		zio_checksum_account(checksum, size,
+		    checksum == ZIO_CHECKSUM_ZILOG2 ? sizeof (zil_chain_t) :
+		    sizeof (zio_eck_t));
 		if (bp != NULL && BP_USES_CRYPT(bp) &&
 		    BP_GET_TYPE(bp) != DMU_OT_OBJSET)
 			zio_checksum_handle_crypt(&cksum, &saved, insecure);
@@ -378,6 +412,7 @@ zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
 		saved = bp->blk_cksum;
 		ci->ci_func[0](abd, size, spa->spa_cksum_tmpls[checksum],
 		    &cksum);
+		zio_checksum_account(checksum, size, 0);
 		if (BP_USES_CRYPT(bp) && BP_GET_TYPE(bp) != DMU_OT_OBJSET)
 			zio_checksum_handle_crypt(&cksum, &saved, insecure);
 		bp->blk_cksum = cksum;
@@ -454,6 +489,9 @@ zio_checksum_error_impl(spa_t *spa, const blkptr_t *bp,
 
 		ci->ci_func[byteswap](abd, size,
 		    spa->spa_cksum_tmpls[checksum], &actual_cksum);
+		zio_checksum_account(checksum, size,
+		    checksum == ZIO_CHECKSUM_ZILOG2 ? sizeof (zil_chain_t) :
+		    sizeof (zio_eck_t));
 
 		abd_copy_from_buf_off(abd, &expected_cksum, eck_offset,
 		    sizeof (zio_cksum_t));
@@ -467,6 +505,7 @@ zio_checksum_error_impl(spa_t *spa, const blkptr_t *bp,
 		expected_cksum = bp->blk_cksum;
 		ci->ci_func[byteswap](abd, size,
 		    spa->spa_cksum_tmpls[checksum], &actual_cksum);
+		zio_checksum_account(checksum, size, 0);
 	}
 
 	/*
@@ -547,3 +586,65 @@ zio_checksum_templates_free(spa_t *spa)
 		}
 	}
 }
+
+static int
+zio_checksum_kstat_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-16s %-14s %-16s %-14s\n",
+	    "checksum", "calls", "streamed", "linearized");
+
+	return (0);
+}
+
+static int
+zio_checksum_kstat_data(char *buf, size_t size, void *data)
+{
+	zio_checksum_stats_t *zcks = data;
+	enum zio_checksum c = zcks - zio_checksum_stats;
+
+	(void) snprintf(buf, size, "%-16s %-14llu %-16llu %-14llu\n",
+	    zio_checksum_table[c].ci_name, (u_longlong_t)zcks->zcks_calls,
+	    (u_longlong_t)zcks->zcks_streamed,
+	    (u_longlong_t)zcks->zcks_linearized);
+
+	return (0);
+}
+
+/*
+ * One row per checksum function.
+ */
+static void *
+zio_checksum_kstat_addr(kstat_t *ksp, off_t n)
+{
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		if (zio_checksum_table[c].ci_func[0] == NULL)
+			continue;
+		if (n-- == 0)
+			return (&zio_checksum_stats[c]);
+	}
+
+	return (NULL);
+}
+
+void
+zio_checksum_init(void)
+{
+	zio_checksum_ksp = kstat_create("zfs", 0, "zio_checksum", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+
+	if (zio_checksum_ksp != NULL) {
+		zio_checksum_ksp->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(zio_checksum_ksp, zio_checksum_kstat_headers,
+		    zio_checksum_kstat_data, zio_checksum_kstat_addr);
+		kstat_install(zio_checksum_ksp);
+	}
+}
+
+void
+zio_checksum_fini(void)
+{
+	if (zio_checksum_ksp != NULL) {
+		kstat_delete(zio_checksum_ksp);
+		zio_checksum_ksp = NULL;
+	}
+}
@@ -34,27 +34,161 @@
 #include <sys/zfeature.h>
 #include <sys/zio.h>
 #include <sys/zio_compress.h>
+#include <sys/kstat.h>
+
+/*
+ * Early abort.  Before running one of the slower compressors (gzip, and
+ * zstd other than its fast levels) over a block, lz4 is run over
+ * ZIO_COMPRESS_PROBE_SAMPLES evenly spaced samples of it, totalling
+ * zfs_compress_probe_size bytes.  If lz4 saves less than
+ * zfs_compress_probe_min_pct percent of the samples, the block is taken
+ * to be incompressible (typically already compressed media) and is
+ * written uncompressed without running the slow compressor at all.
+ * Blocks smaller than four times the probe size are always compressed.
+ */
+int zfs_compress_probe = 1;
+uint32_t zfs_compress_probe_size = 32 << 10;
+uint32_t zfs_compress_probe_min_pct = 3;
+
+#define	ZIO_COMPRESS_PROBE_SAMPLES	8
+
+/*
+ * Block compressors need their input in one piece, so a scatter ABD is
+ * copied into a linear buffer before it is compressed: this also keeps
+ * the compressed form of a block reproducible, which the L2ARC and
+ * encrypted blocks rely on.  Decompression has no such constraint, and
+ * the algorithms with a ci_decompress_abd function read the compressed
+ * data of a scatter ABD one chunk at a time instead of copying it
+ * first, unless zfs_decompress_stream is cleared.  Linear ABDs are used
+ * in place either way.
+ */
+int zfs_decompress_stream = 1;
+
+/*
+ * Per-algorithm statistics, exported in the zio_compress kstat.
+ * compress_time and compress_bytes cover the full compressions run for
+ * algorithms that are probed, and give the cost per byte used to
+ * estimate the time saved by each early abort.  The last three count the
+ * input bytes of compressions and decompressions by how they reached the
+ * algorithm: read in place from a linear ABD, streamed from the chunks
+ * of a scatter ABD, or linearized by copying.
+ */
+typedef struct zio_compress_stats {
+	uint64_t	zcs_attempted;		/* full compressions run */
+	uint64_t	zcs_aborted;		/* skipped after the probe */
+	uint64_t	zcs_probe_time;		/* ns spent probing */
+	uint64_t	zcs_compress_time;	/* ns spent compressing */
+	uint64_t	zcs_compress_bytes;	/* bytes compressed */
+	uint64_t	zcs_saved_time;		/* estimated ns saved */
+	uint64_t	zcs_direct;		/* bytes used in place */
+	uint64_t	zcs_streamed;		/* bytes streamed by chunk */
+	uint64_t	zcs_linearized;		/* bytes copied to a buffer */
+} zio_compress_stats_t;
+
+static zio_compress_stats_t zio_compress_stats[ZIO_COMPRESS_FUNCTIONS];
+static kstat_t *zio_compress_ksp;
 
 /*
  * Compression vectors.
  */
 zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
-	{"inherit",		0,	NULL,		NULL},
-	{"on",			0,	NULL,		NULL},
-	{"uncompressed",	0,	NULL,		NULL},
-	{"lzjb",		0,	lzjb_compress,	lzjb_decompress},
-	{"empty",		0,	NULL,		NULL},
-	{"gzip-1",		1,	gzip_compress,	gzip_decompress},
-	{"gzip-2",		2,	gzip_compress,	gzip_decompress},
-	{"gzip-3",		3,	gzip_compress,	gzip_decompress},
-	{"gzip-4",		4,	gzip_compress,	gzip_decompress},
-	{"gzip-5",		5,	gzip_compress,	gzip_decompress},
-	{"gzip-6",		6,	gzip_compress,	gzip_decompress},
-	{"gzip-7",		7,	gzip_compress,	gzip_decompress},
-	{"gzip-8",		8,	gzip_compress,	gzip_decompress},
-	{"gzip-9",		9,	gzip_compress,	gzip_decompress},
-	{"zle",			64,	zle_compress,	zle_decompress},
-	{"lz4",			0,	lz4_compress_zfs,	lz4_decompress_zfs}
+	{"inherit",		0,	NULL,		NULL,	NULL},
+	{"on",			0,	NULL,		NULL,	NULL},
+	{"uncompressed",	0,	NULL,		NULL,	NULL},
+	{"lzjb",		0,	lzjb_compress,	lzjb_decompress, NULL},
+	{"empty",		0,	NULL,		NULL,	NULL},
+	{"gzip-1",		1,	gzip_compress,	gzip_decompress, NULL},
+	{"gzip-2",		2,	gzip_compress,	gzip_decompress, NULL},
+	{"gzip-3",		3,	gzip_compress,	gzip_decompress, NULL},
+	{"gzip-4",		4,	gzip_compress,	gzip_decompress, NULL},
+	{"gzip-5",		5,	gzip_compress,	gzip_decompress, NULL},
+	{"gzip-6",		6,	gzip_compress,	gzip_decompress, NULL},
+	{"gzip-7",		7,	gzip_compress,	gzip_decompress, NULL},
+	{"gzip-8",		8,	gzip_compress,	gzip_decompress, NULL},
+	{"gzip-9",		9,	gzip_compress,	gzip_decompress, NULL},
+	{"zle",			64,	zle_compress,	zle_decompress, NULL},
+	{"lz4",			0,	lz4_compress_zfs, lz4_decompress_zfs,
+	    lz4_decompress_abd},
+	{"zstd-1",		1,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-2",		2,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-3",		3,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-4",		4,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-5",		5,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-6",		6,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-7",		7,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-8",		8,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-9",		9,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-10",		10,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-11",		11,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-12",		12,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-13",		13,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-14",		14,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-15",		15,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-16",		16,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-17",		17,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-18",		18,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-19",		19,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-1",		-1,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-2",		-2,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-3",		-3,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-4",		-4,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-5",		-5,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-6",		-6,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-7",		-7,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-8",		-8,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-9",		-9,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-10",	-10,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-20",	-20,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-30",	-30,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-40",	-40,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-50",	-50,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-60",	-60,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-70",	-70,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-80",	-80,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-90",	-90,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-100",	-100,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-500",	-500,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd},
+	{"zstd-fast-1000",	-1000,	zstd_compress_zfs, zstd_decompress_zfs,
+	    zstd_decompress_abd}
 };
 
 enum zio_compress
@@ -93,11 +227,62 @@ zio_compress_zeroed_cb(void *data, size_t len, void *private)
 	return (0);
 }
 
+static boolean_t
+zio_compress_probe_wanted(enum zio_compress c, size_t s_len)
+{
+	if (!zfs_compress_probe || zfs_compress_probe_size == 0)
+		return (B_FALSE);
+
+	if (s_len < 4 * (size_t)zfs_compress_probe_size)
+		return (B_FALSE);
+
+	return ((c >= ZIO_COMPRESS_GZIP_1 && c <= ZIO_COMPRESS_GZIP_9) ||
+	    (ZIO_COMPRESS_IS_ZSTD(c) && zio_compress_table[c].ci_level > 0));
+}
+
+/*
+ * Compress the probe samples of src with lz4, using dst as scratch
+ * space, and return B_TRUE if they shrank by at least
+ * zfs_compress_probe_min_pct percent.
+ */
+static boolean_t
+zio_compress_probe(void *src, void *dst, size_t s_len)
+{
+	size_t stride = s_len / ZIO_COMPRESS_PROBE_SAMPLES;
+	size_t sample = MIN(zfs_compress_probe_size /
+	    ZIO_COMPRESS_PROBE_SAMPLES, stride);
+	uint64_t in = 0, out = 0;
+
+	if (sample < SPA_MINBLOCKSIZE)
+		return (B_TRUE);
+
+	for (int i = 0; i < ZIO_COMPRESS_PROBE_SAMPLES; i++) {
+		size_t c_len = lz4_compress_zfs((char *)src + i * stride, dst,
+		    sample, sample, 0);
+
+		in += sample;
+		out += MIN(c_len, sample);
+	}
+
+	return ((in - out) * 100 >= in * zfs_compress_probe_min_pct);
+}
+
+/*
+ * Compress s_len bytes of src into dst, returning the compressed size, or
+ * s_len if the data did not compress by at least 12.5%.  If early_abort
+ * is set, the slower algorithms may give up on data that looks
+ * incompressible without trying; callers that must reproduce the on-disk
+ * form of an existing block pass B_FALSE.
+ */
 size_t
-zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
+zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len,
+    boolean_t early_abort)
 {
 	size_t c_len, d_len;
 	zio_compress_info_t *ci = &zio_compress_table[c];
+	zio_compress_stats_t *zcs = &zio_compress_stats[c];
+	boolean_t probe;
+	hrtime_t start;
 
 	ASSERT((uint_t)c < ZIO_COMPRESS_FUNCTIONS);
 	ASSERT((uint_t)c == ZIO_COMPRESS_EMPTY || ci->ci_compress != NULL);
@@ -117,7 +302,37 @@ zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
 
 	/* No compression algorithms can read from ABDs directly */
 	void *tmp = abd_borrow_buf_copy(src, s_len);
+	atomic_add_64(abd_is_linear(src) ? &zcs->zcs_direct :
+	    &zcs->zcs_linearized, s_len);
+
+	probe = zio_compress_probe_wanted(c, s_len);
+	if (probe && early_abort) {
+		start = gethrtime();
+		boolean_t compressible = zio_compress_probe(tmp, dst, s_len);
+		hrtime_t probe_time = gethrtime() - start;
+
+		atomic_add_64(&zcs->zcs_probe_time, probe_time);
+		if (!compressible) {
+			uint64_t kb = zcs->zcs_compress_bytes >> 10;
+			uint64_t est = (kb == 0) ? 0 :
+			    (zcs->zcs_compress_time / kb) * (s_len >> 10);
+
+			abd_return_buf(src, tmp, s_len);
+			atomic_inc_64(&zcs->zcs_aborted);
+			if (est > probe_time)
+				atomic_add_64(&zcs->zcs_saved_time,
+				    est - probe_time);
+			return (s_len);
+		}
+	}
+
+	start = gethrtime();
 	c_len = ci->ci_compress(tmp, dst, s_len, d_len, ci->ci_level);
+	if (probe) {
+		atomic_inc_64(&zcs->zcs_attempted);
+		atomic_add_64(&zcs->zcs_compress_time, gethrtime() - start);
+		atomic_add_64(&zcs->zcs_compress_bytes, s_len);
+	}
 	abd_return_buf(src, tmp, s_len);
 
 	if (c_len > d_len)
@@ -138,13 +353,111 @@ zio_decompress_data_buf(enum zio_compress c, void *src, void *dst,
 	return (ci->ci_decompress(src, dst, s_len, d_len, ci->ci_level));
 }
 
+/*
+ * Decompress s_len bytes of src into dst.  A scatter src is streamed
+ * into the algorithm's ci_decompress_abd function when it has one; if
+ * that fails, the block is decompressed again from a linear copy, so an
+ * error is only reported by the linear decompressor.
+ */
 int
 zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
     size_t s_len, size_t d_len)
 {
+	zio_compress_info_t *ci = &zio_compress_table[c];
+	zio_compress_stats_t *zcs = &zio_compress_stats[c];
+
+	if ((uint_t)c < ZIO_COMPRESS_FUNCTIONS && !abd_is_linear(src) &&
+	    zfs_decompress_stream && ci->ci_decompress_abd != NULL &&
+	    ci->ci_decompress_abd(src, dst, s_len, d_len,
+	    ci->ci_level) == 0) {
+		atomic_add_64(&zcs->zcs_streamed, s_len);
+		return (0);
+	}
+
 	void *tmp = abd_borrow_buf_copy(src, s_len);
 	int ret = zio_decompress_data_buf(c, tmp, dst, s_len, d_len);
 	abd_return_buf(src, tmp, s_len);
 
+	if ((uint_t)c < ZIO_COMPRESS_FUNCTIONS)
+		atomic_add_64(abd_is_linear(src) ? &zcs->zcs_direct :
+		    &zcs->zcs_linearized, s_len);
+
 	return (ret);
 }
+
+static int
+zio_compress_kstat_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-16s %-12s %-12s %-12s %-14s %-14s "
+	    "%-14s %-14s %-14s\n", "algorithm", "attempted", "aborted",
+	    "probe_us", "compress_us", "saved_us", "direct", "streamed",
+	    "linearized");
+
+	return (0);
+}
+
+static int
+zio_compress_kstat_data(char *buf, size_t size, void *data)
+{
+	zio_compress_stats_t *zcs = data;
+	enum zio_compress c = zcs - zio_compress_stats;
+
+	(void) snprintf(buf, size, "%-16s %-12llu %-12llu %-12llu %-14llu "
+	    "%-14llu %-14llu %-14llu %-14llu\n", zio_compress_table[c].ci_name,
+	    (u_longlong_t)zcs->zcs_attempted, (u_longlong_t)zcs->zcs_aborted,
+	    (u_longlong_t)(zcs->zcs_probe_time / (NANOSEC / MICROSEC)),
+	    (u_longlong_t)(zcs->zcs_compress_time / (NANOSEC / MICROSEC)),
+	    (u_longlong_t)(zcs->zcs_saved_time / (NANOSEC / MICROSEC)),
+	    (u_longlong_t)zcs->zcs_direct, (u_longlong_t)zcs->zcs_streamed,
+	    (u_longlong_t)zcs->zcs_linearized);
+
+	return (0);
+}
+
+/*
+ * One row per compression algorithm.
+ */
+static void *
+zio_compress_kstat_addr(kstat_t *ksp, off_t n)
+{
+	for (enum zio_compress c = 0; c < ZIO_COMPRESS_FUNCTIONS; c++) {
+		if (zio_compress_table[c].ci_compress == NULL)
+			continue;
+		if (n-- == 0)
+			return (&zio_compress_stats[c]);
+	}
+
+	return (NULL);
+}
+
+void
+zio_compress_init(void)
+{
+	zio_compress_ksp = kstat_create("zfs", 0, "zio_compress", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+
+	if (zio_compress_ksp != NULL) {
+		zio_compress_ksp->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(zio_compress_ksp, zio_compress_kstat_headers,
+		    zio_compress_kstat_data, zio_compress_kstat_addr);
+		kstat_install(zio_compress_ksp);
+	}
+}
+
+void
+zio_compress_fini(void)
+{
+	if (zio_compress_ksp != NULL) {
+		kstat_delete(zio_compress_ksp);
+		zio_compress_ksp = NULL;
+	}
+}
+
+spa_feature_t
+zio_compress_to_feature(enum zio_compress c)
+{
+	if (ZIO_COMPRESS_IS_ZSTD(c))
+		return (SPA_FEATURE_ZSTD_COMPRESS);
+
+	return (SPA_FEATURE_NONE);
+}
@@ -0,0 +1,495 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * zstd compression for ZFS, using the zstd library vendored in module/zstd.
+ *
+ * Every level has its own zio_compress value, so the ARC and the L2ARC
+ * always know the exact level needed to compress a block again.  The
+ * compressed buffer starts with a header holding the size of the zstd
+ * frame, since the physical size of the block is padded to the sector
+ * size, and the library version which wrote it.
+ *
+ * The library runs on caller supplied workspaces (ZSTD_initStaticCCtx()),
+ * so it does not allocate memory itself on these paths.  Workspaces are
+ * kept in a small per-direction pool sized to the largest request seen,
+ * and are released after zstd_pool_idle_time seconds without use.  In
+ * the kext the library's own allocator is zstd_kmem_alloc() below.
+ *
+ * The "zstd_stats" kstat reports, for each level, the compression ratio
+ * (in hundredths), the compression and decompression throughput in KiB/s
+ * and the number of bytes compressed, all observed on real I/O.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio_compress.h>
+
+#define	ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+typedef struct zstd_zfs_hdr {
+	uint32_t	zh_csize;	/* size of the zstd frame */
+	uint32_t	zh_version;	/* ZSTD_VERSION_NUMBER of the writer */
+} zstd_zfs_hdr_t;
+
+typedef struct zstd_kmem {
+	void		*zk_mem;
+	size_t		zk_size;
+	hrtime_t	zk_idle;	/* when it was last released */
+	boolean_t	zk_busy;
+} zstd_kmem_t;
+
+typedef struct zstd_pool {
+	kmutex_t	zp_lock;
+	zstd_kmem_t	*zp_kmem;
+	int		zp_count;
+} zstd_pool_t;
+
+typedef struct zstd_stats {
+	uint64_t	zs_comp_in;
+	uint64_t	zs_comp_out;
+	uint64_t	zs_comp_ns;
+	uint64_t	zs_decomp_out;
+	uint64_t	zs_decomp_ns;
+} zstd_stats_t;
+
+typedef struct zstd_kstat_level {
+	kstat_named_t	zkl_ratio;
+	kstat_named_t	zkl_comp;
+	kstat_named_t	zkl_decomp;
+	kstat_named_t	zkl_bytes;
+} zstd_kstat_level_t;
+
+#define	ZSTD_ZFS_NLEVELS \
+	(ZIO_COMPRESS_ZSTD_FAST_1000 - ZIO_COMPRESS_ZSTD_1 + 1)
+
+static int zstd_pool_idle_time = 60;
+
+static zstd_pool_t zstd_cpool;
+static zstd_pool_t zstd_dpool;
+static zstd_stats_t zstd_stats[ZSTD_ZFS_NLEVELS];
+static zstd_kstat_level_t zstd_kstat_data[ZSTD_ZFS_NLEVELS];
+static kstat_t *zstd_kstat;
+
+#ifdef _KERNEL
+/*
+ * malloc(), calloc() and free() for the library, which are named in
+ * module/zstd/lib/common/zstd_deps.h.  kmem_free() needs the size, so it
+ * is kept in a header in front of the buffer; the header is 16 bytes to
+ * keep the buffer as aligned as kmem_alloc() made it.
+ */
+#define	ZSTD_KMEM_HDR	(2 * sizeof (uint64_t))
+
+void *
+zstd_kmem_alloc(size_t size)
+{
+	uint64_t *hdr;
+
+	if (size > (size_t)-1 - ZSTD_KMEM_HDR)
+		return (NULL);
+
+	hdr = kmem_alloc(size + ZSTD_KMEM_HDR, KM_NOSLEEP);
+	if (hdr == NULL)
+		return (NULL);
+	hdr[0] = size + ZSTD_KMEM_HDR;
+	return ((char *)hdr + ZSTD_KMEM_HDR);
+}
+
+void *
+zstd_kmem_calloc(size_t n, size_t size)
+{
+	void *ptr;
+
+	if (size != 0 && n > (size_t)-1 / size)
+		return (NULL);
+
+	ptr = zstd_kmem_alloc(n * size);
+	if (ptr != NULL)
+		bzero(ptr, n * size);
+	return (ptr);
+}
+
+void
+zstd_kmem_free(void *ptr)
+{
+	uint64_t *hdr;
+
+	if (ptr == NULL)
+		return;
+
+	hdr = (uint64_t *)((char *)ptr - ZSTD_KMEM_HDR);
+	kmem_free(hdr, hdr[0]);
+}
+#endif
+
+static void
+zstd_pool_init(zstd_pool_t *zp, int count)
+{
+	mutex_init(&zp->zp_lock, NULL, MUTEX_DEFAULT, NULL);
+	zp->zp_kmem = kmem_zalloc(count * sizeof (zstd_kmem_t), KM_SLEEP);
+	zp->zp_count = count;
+}
+
+static void
+zstd_pool_fini(zstd_pool_t *zp)
+{
+	int i;
+
+	for (i = 0; i < zp->zp_count; i++) {
+		zstd_kmem_t *zk = &zp->zp_kmem[i];
+
+		ASSERT(!zk->zk_busy);
+		if (zk->zk_mem != NULL)
+			vmem_free(zk->zk_mem, zk->zk_size);
+	}
+	kmem_free(zp->zp_kmem, zp->zp_count * sizeof (zstd_kmem_t));
+	mutex_destroy(&zp->zp_lock);
+}
+
+/*
+ * Return a workspace of at least size bytes.  An idle pooled workspace
+ * which is big enough is reused, otherwise the smallest idle one is
+ * reallocated.  When every pooled workspace is busy a private one is
+ * allocated and freed again by zstd_pool_put().
+ */
+static zstd_kmem_t *
+zstd_pool_get(zstd_pool_t *zp, size_t size)
+{
+	zstd_kmem_t *zk, *victim = NULL;
+	int i;
+
+	mutex_enter(&zp->zp_lock);
+	for (i = 0; i < zp->zp_count; i++) {
+		zk = &zp->zp_kmem[i];
+		if (zk->zk_busy)
+			continue;
+		if (zk->zk_size >= size) {
+			zk->zk_busy = B_TRUE;
+			mutex_exit(&zp->zp_lock);
+			return (zk);
+		}
+		if (victim == NULL || zk->zk_size < victim->zk_size)
+			victim = zk;
+	}
+	if (victim != NULL)
+		victim->zk_busy = B_TRUE;
+	mutex_exit(&zp->zp_lock);
+
+	if (victim != NULL) {
+		if (victim->zk_mem != NULL)
+			vmem_free(victim->zk_mem, victim->zk_size);
+		victim->zk_mem = vmem_alloc(size, KM_SLEEP);
+		victim->zk_size = size;
+		return (victim);
+	}
+
+	zk = kmem_zalloc(sizeof (zstd_kmem_t), KM_SLEEP);
+	zk->zk_mem = vmem_alloc(size, KM_SLEEP);
+	zk->zk_size = size;
+	zk->zk_busy = B_TRUE;
+	return (zk);
+}
+
+static void
+zstd_pool_put(zstd_pool_t *zp, zstd_kmem_t *zk)
+{
+	hrtime_t now = gethrtime();
+	int i;
+
+	if (zk < zp->zp_kmem || zk >= zp->zp_kmem + zp->zp_count) {
+		vmem_free(zk->zk_mem, zk->zk_size);
+		kmem_free(zk, sizeof (zstd_kmem_t));
+		return;
+	}
+
+	mutex_enter(&zp->zp_lock);
+	zk->zk_busy = B_FALSE;
+	zk->zk_idle = now;
+
+	/* Give back the memory of workspaces nobody has needed lately. */
+	for (i = 0; i < zp->zp_count; i++) {
+		zk = &zp->zp_kmem[i];
+		if (zk->zk_busy || zk->zk_mem == NULL ||
+		    now - zk->zk_idle < SEC2NSEC(zstd_pool_idle_time))
+			continue;
+		vmem_free(zk->zk_mem, zk->zk_size);
+		zk->zk_mem = NULL;
+		zk->zk_size = 0;
+	}
+	mutex_exit(&zp->zp_lock);
+}
+
+static zstd_stats_t *
+zstd_level_stats(int level)
+{
+	enum zio_compress c;
+
+	if (level > 0)
+		return (&zstd_stats[level - 1]);
+
+	for (c = ZIO_COMPRESS_ZSTD_FAST_1; c <= ZIO_COMPRESS_ZSTD_FAST_1000;
+	    c++) {
+		if (zio_compress_table[c].ci_level == level)
+			return (&zstd_stats[c - ZIO_COMPRESS_ZSTD_1]);
+	}
+	return (NULL);
+}
+
+size_t
+zstd_compress_zfs(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	zstd_zfs_hdr_t *hdr = d_start;
+	char *dest = d_start;
+	zstd_stats_t *zs = zstd_level_stats(level);
+	hrtime_t start = gethrtime();
+	zstd_kmem_t *zk;
+	ZSTD_CCtx *cctx;
+	size_t c_len = s_len;
+
+	ASSERT(d_len >= sizeof (*hdr));
+	ASSERT(zs != NULL);
+
+	zk = zstd_pool_get(&zstd_cpool, ZSTD_estimateCCtxSize_usingCParams(
+	    ZSTD_getCParams(level, s_len, 0)));
+	cctx = ZSTD_initStaticCCtx(zk->zk_mem, zk->zk_size);
+	if (cctx != NULL) {
+		size_t ret = ZSTD_compressCCtx(cctx, &dest[sizeof (*hdr)],
+		    d_len - sizeof (*hdr), s_start, s_len, level);
+
+		/* An error here means the block did not compress. */
+		if (!ZSTD_isError(ret)) {
+			hdr->zh_csize = BE_32((uint32_t)ret);
+			hdr->zh_version = BE_32(ZSTD_VERSION_NUMBER);
+			c_len = ret + sizeof (*hdr);
+		}
+	}
+	zstd_pool_put(&zstd_cpool, zk);
+
+	atomic_add_64(&zs->zs_comp_in, s_len);
+	atomic_add_64(&zs->zs_comp_out, c_len);
+	atomic_add_64(&zs->zs_comp_ns, gethrtime() - start);
+
+	return (c_len);
+}
+
+int
+zstd_decompress_zfs(void *s_start, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	const char *src = s_start;
+	zstd_stats_t *zs = zstd_level_stats(level);
+	hrtime_t start = gethrtime();
+	zstd_kmem_t *zk;
+	ZSTD_DCtx *dctx;
+	uint32_t bufsiz;
+	size_t ret;
+
+	ASSERT(zs != NULL);
+
+	if (s_len < sizeof (zstd_zfs_hdr_t))
+		return (1);
+
+	/* invalid compressed buffer size encoded at start */
+	bufsiz = BE_IN32(src);
+	if (bufsiz + sizeof (zstd_zfs_hdr_t) > s_len)
+		return (1);
+
+	zk = zstd_pool_get(&zstd_dpool, ZSTD_estimateDCtxSize());
+	dctx = ZSTD_initStaticDCtx(zk->zk_mem, zk->zk_size);
+	if (dctx == NULL) {
+		zstd_pool_put(&zstd_dpool, zk);
+		return (1);
+	}
+	ret = ZSTD_decompressDCtx(dctx, d_start, d_len,
+	    &src[sizeof (zstd_zfs_hdr_t)], bufsiz);
+	zstd_pool_put(&zstd_dpool, zk);
+
+	if (ZSTD_isError(ret))
+		return (1);
+
+	atomic_add_64(&zs->zs_decomp_out, d_len);
+	atomic_add_64(&zs->zs_decomp_ns, gethrtime() - start);
+
+	return (0);
+}
+
+typedef struct zstd_stream {
+	ZSTD_DStream	*zst_dctx;
+	ZSTD_outBuffer	zst_out;
+	size_t		zst_ret;	/* zero once the frame is complete */
+} zstd_stream_t;
+
+static int
+zstd_stream_cb(void *buf, size_t len, void *private)
+{
+	zstd_stream_t *zst = private;
+	ZSTD_inBuffer in = { buf, len, 0 };
+
+	while (in.pos < in.size) {
+		size_t pos = in.pos;
+
+		/* Input left over after the end of the frame is garbage. */
+		if (zst->zst_ret == 0)
+			return (1);
+
+		zst->zst_ret = ZSTD_decompressStream(zst->zst_dctx,
+		    &zst->zst_out, &in);
+		if (ZSTD_isError(zst->zst_ret))
+			return (1);
+		if (in.pos == pos && zst->zst_out.pos == zst->zst_out.size)
+			return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * Decompress a block held in an ABD, feeding the zstd frame to the
+ * library one ABD chunk at a time instead of copying it into a linear
+ * buffer.  The output buffer is handed to the library as stable, so it
+ * decodes straight into it without a window buffer of its own.  Returns
+ * non-zero on any error, and the caller then falls back to
+ * zstd_decompress_zfs().
+ */
+int
+zstd_decompress_abd(abd_t *src, void *d_start, size_t s_len, size_t d_len,
+    int level)
+{
+	zstd_stats_t *zs = zstd_level_stats(level);
+	hrtime_t start = gethrtime();
+	zstd_zfs_hdr_t hdr;
+	zstd_stream_t zst;
+	zstd_kmem_t *zk;
+	uint32_t bufsiz;
+	int err = 1;
+
+	ASSERT(zs != NULL);
+
+	if (s_len < sizeof (hdr))
+		return (1);
+
+	abd_copy_to_buf_off(&hdr, src, 0, sizeof (hdr));
+	bufsiz = BE_32(hdr.zh_csize);
+	if (bufsiz + sizeof (hdr) > s_len)
+		return (1);
+
+	zk = zstd_pool_get(&zstd_dpool,
+	    ZSTD_estimateDStreamSize(ZSTD_BLOCKSIZE_MAX));
+	zst.zst_dctx = ZSTD_initStaticDStream(zk->zk_mem, zk->zk_size);
+	if (zst.zst_dctx != NULL && !ZSTD_isError(ZSTD_DCtx_setParameter(
+	    zst.zst_dctx, ZSTD_d_stableOutBuffer, 1))) {
+		zst.zst_out.dst = d_start;
+		zst.zst_out.size = d_len;
+		zst.zst_out.pos = 0;
+		zst.zst_ret = 1;
+
+		if (abd_iterate_func(src, sizeof (hdr), bufsiz,
+		    zstd_stream_cb, &zst) == 0 && zst.zst_ret == 0)
+			err = 0;
+	}
+	zstd_pool_put(&zstd_dpool, zk);
+
+	if (err != 0)
+		return (err);
+
+	atomic_add_64(&zs->zs_decomp_out, d_len);
+	atomic_add_64(&zs->zs_decomp_ns, gethrtime() - start);
+
+	return (0);
+}
+
+/* Bytes per nanosecond as KiB/s, safe from overflow up to 1 PiB. */
+static uint64_t
+zstd_kstat_rate(uint64_t bytes, uint64_t ns)
+{
+	return ((bytes >> 10) * MICROSEC / MAX(ns / (NANOSEC / MICROSEC), 1));
+}
+
+static int
+zstd_kstat_update(kstat_t *ksp, int rw)
+{
+	zstd_kstat_level_t *zkl = ksp->ks_data;
+	int i;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	for (i = 0; i < ZSTD_ZFS_NLEVELS; i++) {
+		zstd_stats_t *zs = &zstd_stats[i];
+
+		zkl[i].zkl_ratio.value.ui64 = zs->zs_comp_in * 100 /
+		    MAX(zs->zs_comp_out, 1);
+		zkl[i].zkl_comp.value.ui64 =
+		    zstd_kstat_rate(zs->zs_comp_in, zs->zs_comp_ns);
+		zkl[i].zkl_decomp.value.ui64 =
+		    zstd_kstat_rate(zs->zs_decomp_out, zs->zs_decomp_ns);
+		zkl[i].zkl_bytes.value.ui64 = zs->zs_comp_in;
+	}
+
+	return (0);
+}
+
+void
+zstd_init(void)
+{
+	int i;
+
+	zstd_pool_init(&zstd_cpool, max_ncpus);
+	zstd_pool_init(&zstd_dpool, max_ncpus);
+
+	for (i = 0; i < ZSTD_ZFS_NLEVELS; i++) {
+		const char *level = zio_compress_table[ZIO_COMPRESS_ZSTD_1 +
+		    i].ci_name;
+		zstd_kstat_level_t *zkl = &zstd_kstat_data[i];
+		char name[KSTAT_STRLEN];
+
+		(void) snprintf(name, sizeof (name), "%s_ratio", level);
+		kstat_named_init(&zkl->zkl_ratio, name, KSTAT_DATA_UINT64);
+		(void) snprintf(name, sizeof (name), "%s_comp", level);
+		kstat_named_init(&zkl->zkl_comp, name, KSTAT_DATA_UINT64);
+		(void) snprintf(name, sizeof (name), "%s_decomp", level);
+		kstat_named_init(&zkl->zkl_decomp, name, KSTAT_DATA_UINT64);
+		(void) snprintf(name, sizeof (name), "%s_bytes", level);
+		kstat_named_init(&zkl->zkl_bytes, name, KSTAT_DATA_UINT64);
+	}
+
+	zstd_kstat = kstat_create("zfs", 0, "zstd_stats", "misc",
+	    KSTAT_TYPE_NAMED, ZSTD_ZFS_NLEVELS * sizeof (zstd_kstat_level_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (zstd_kstat != NULL) {
+		zstd_kstat->ks_data = zstd_kstat_data;
+		zstd_kstat->ks_update = zstd_kstat_update;
+		kstat_install(zstd_kstat);
+	}
+}
+
+void
+zstd_fini(void)
+{
+	if (zstd_kstat != NULL) {
+		kstat_delete(zstd_kstat);
+		zstd_kstat = NULL;
+	}
+
+	zstd_pool_fini(&zstd_dpool);
+	zstd_pool_fini(&zstd_cpool);
+}